@@ -2013,6 +2013,9 @@
 /** The size of the one or more regions in the shared module was out of
  * range. */
 #define VERR_GMM_SHARED_MODULE_BAD_REGIONS_SIZE     (-3831)
+/** The memory seeded as a large page isn't physically contiguous or isn't
+ * aligned on a large page boundary. */
+#define VERR_GMM_SEED_NOT_LARGE_PAGE                (-3832)
 /** @} */
 
 
@@ -175,6 +175,8 @@ typedef enum LOGGROUP
     LOG_GROUP_DRV,
     /** ACPI driver group */
     LOG_GROUP_DRV_ACPI,
+    /** AF_PACKET ring network transport driver group. */
+    LOG_GROUP_DRV_AF_PACKET,
     /** Audio driver group */
     LOG_GROUP_DRV_AUDIO,
     /** Block driver group. */
@@ -904,6 +906,7 @@ typedef enum LOGGROUP
     "DIS",          \
     "DRV",          \
     "DRV_ACPI",     \
+    "DRV_AF_PACKET", \
     "DRV_AUDIO",    \
     "DRV_BLOCK",    \
     "DRV_CHAR",     \
@@ -905,6 +905,12 @@ AssertCompile(CPUMCTX_EXTRN_SREG_FROM_IDX(X86_SREG_GS) == CPUMCTX_EXTRN_GS);
 /** NEM/Win: Mask. */
 #define CPUMCTX_EXTRN_NEM_WIN_MASK              UINT64_C(0x0007000000000000)
 
+/** NEM/Linux: Interrupt shadow, NMI blocking and injected events
+ *  (KVM_GET_VCPU_EVENTS). */
+#define CPUMCTX_EXTRN_NEM_LNX_EVENTS            UINT64_C(0x0001000000000000)
+/** NEM/Linux: Mask. */
+#define CPUMCTX_EXTRN_NEM_LNX_MASK              UINT64_C(0x0001000000000000)
+
 /** HM/SVM: Inhibit maskable interrupts (VMCPU_FF_INHIBIT_INTERRUPTS). */
 #define CPUMCTX_EXTRN_HM_SVM_INT_SHADOW         UINT64_C(0x0001000000000000)
 /** HM/SVM: Nested-guest interrupt pending (VMCPU_FF_INTERRUPT_NESTED_GUEST). */
@@ -26,8 +26,12 @@
 #ifndef ___VBox_vmm_dbgftrace_h
 #define ___VBox_vmm_dbgftrace_h
 
+#include <iprt/assert.h>
 #include <iprt/trace.h>
 #include <VBox/types.h>
+#if defined(RT_ARCH_AMD64) || defined(RT_ARCH_X86)
+# include <iprt/asm-amd64-x86.h>
+#endif
 
 RT_C_DECLS_BEGIN
 /** @defgroup grp_dbgf_trace  Tracing
@@ -149,6 +153,205 @@ VMMDECL(int) DBGFR3TraceConfig(PVM pVM, const char *pszConfig);
 /** @} */
 
 
+/** @defgroup grp_dbgf_traceevt  Binary Event Tracing
+ *
+ * Low overhead tracing of typed events into a per-VCPU ring buffer.  The rings
+ * are allocated at VM creation when /DBGF/TraceEvt/Entries is non-zero, while
+ * the event categories (DBGFTRACEEVT_F_XXX) can be switched on and off at
+ * runtime.  Events are only recorded by the EMT owning the ring, so recording
+ * an event is a couple of plain stores.
+ *
+ * The rings can be dumped to a file with DBGFR3TraceEvtDump, the format is:
+ *      - DBGFTRACEEVTFILEHDR
+ *      - DBGFTRACEEVTFILEHDR::cNames DBGFTRACEEVTFILENAME entries.
+ *      - DBGFTRACEEVTFILEHDR::cCpus times a DBGFTRACEEVTFILECPU header
+ *        followed by DBGFTRACEEVTFILECPU::cRecs DBGFTRACEEVTREC records,
+ *        oldest first.
+ *
+ * All fields are little endian and timestamps are host TSC ticks.
+ *
+ * @{
+ */
+
+/** @name DBGFTRACEEVT_F_XXX - Event categories.
+ * @{ */
+/** VM-exits (DBGFTRACEEVTTYPE_EXIT). */
+#define DBGFTRACEEVT_F_EXIT         RT_BIT_32(0)
+/** I/O port accesses (DBGFTRACEEVTTYPE_IOPORT_READ, DBGFTRACEEVTTYPE_IOPORT_WRITE). */
+#define DBGFTRACEEVT_F_IOPORT       RT_BIT_32(1)
+/** MMIO accesses (DBGFTRACEEVTTYPE_MMIO_READ, DBGFTRACEEVTTYPE_MMIO_WRITE). */
+#define DBGFTRACEEVT_F_MMIO         RT_BIT_32(2)
+/** Interrupts delivered to the guest (DBGFTRACEEVTTYPE_IRQ). */
+#define DBGFTRACEEVT_F_IRQ          RT_BIT_32(3)
+/** Halts (DBGFTRACEEVTTYPE_HALT). */
+#define DBGFTRACEEVT_F_HALT         RT_BIT_32(4)
+/** PDM queue flushes (DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH). */
+#define DBGFTRACEEVT_F_PDM_QUEUE    RT_BIT_32(5)
+/** All valid categories. */
+#define DBGFTRACEEVT_F_VALID_MASK   UINT32_C(0x0000003f)
+/** @} */
+
+/**
+ * Binary trace event types.
+ */
+typedef enum DBGFTRACEEVTTYPE
+{
+    /** Invalid zero entry. */
+    DBGFTRACEEVTTYPE_INVALID = 0,
+    /** VM-exit handled in ring-0.
+     * uTsc is the time of the exit, cTicks the time spent handling it,
+     * u64Arg0 the EMEXIT_MAKE_FT() flags and type, u64Arg1 the status code. */
+    DBGFTRACEEVTTYPE_EXIT,
+    /** I/O port read.
+     * bArg is the access size, u16Arg the port, u64Arg0 the value and u64Arg1
+     * the status code.  cTicks covers the device callback. */
+    DBGFTRACEEVTTYPE_IOPORT_READ,
+    /** I/O port write, same as DBGFTRACEEVTTYPE_IOPORT_READ. */
+    DBGFTRACEEVTTYPE_IOPORT_WRITE,
+    /** MMIO read.
+     * bArg is the access size, u64Arg0 the guest physical address and u64Arg1
+     * the (first 8 bytes of the) value.  cTicks covers the device callback. */
+    DBGFTRACEEVTTYPE_MMIO_READ,
+    /** MMIO write, same as DBGFTRACEEVTTYPE_MMIO_READ. */
+    DBGFTRACEEVTTYPE_MMIO_WRITE,
+    /** Interrupt fetched for delivery to the guest.
+     * bArg is 0 for the APIC and 1 for the PIC, u16Arg is the vector and
+     * u64Arg0 the IRQ tag and source (see PDMDevHlpPCISetIrq). */
+    DBGFTRACEEVTTYPE_IRQ,
+    /** The EMT halted.
+     * cTicks is the time spent halted, u64Arg1 the status code. */
+    DBGFTRACEEVTTYPE_HALT,
+    /** A PDM queue was flushed.
+     * cTicks is the time spent in the consumer callbacks and u64Arg0 the queue
+     * key, see the DBGFTRACEEVTFILENAME entries. */
+    DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH,
+    /** The end of valid types (exclusive). */
+    DBGFTRACEEVTTYPE_END
+} DBGFTRACEEVTTYPE;
+
+/**
+ * A binary trace event record.
+ */
+typedef struct DBGFTRACEEVTREC
+{
+    /** The host TSC when the event started. */
+    uint64_t            uTsc;
+    /** The duration of the event in host TSC ticks, 0 for instant events.
+     * Saturates at UINT32_MAX. */
+    uint32_t            cTicks;
+    /** The event type (DBGFTRACEEVTTYPE). */
+    uint8_t             enmType;
+    /** Type specific byte argument. */
+    uint8_t             bArg;
+    /** Type specific 16-bit argument. */
+    uint16_t            u16Arg;
+    /** Type specific 64-bit argument. */
+    uint64_t            u64Arg0;
+    /** Type specific 64-bit argument. */
+    uint64_t            u64Arg1;
+} DBGFTRACEEVTREC;
+AssertCompileSize(DBGFTRACEEVTREC, 32);
+/** Pointer to a binary trace event record. */
+typedef DBGFTRACEEVTREC *PDBGFTRACEEVTREC;
+/** Pointer to a const binary trace event record. */
+typedef DBGFTRACEEVTREC const *PCDBGFTRACEEVTREC;
+
+/**
+ * The trace file header.
+ */
+typedef struct DBGFTRACEEVTFILEHDR
+{
+    /** Magic value (DBGFTRACEEVTFILEHDR_MAGIC). */
+    uint32_t            u32Magic;
+    /** The file format version (DBGFTRACEEVTFILEHDR_VERSION). */
+    uint32_t            u32Version;
+    /** The size of this header. */
+    uint32_t            cbHdr;
+    /** The size of a record (DBGFTRACEEVTREC). */
+    uint32_t            cbRec;
+    /** The number of VCPU sections. */
+    uint32_t            cCpus;
+    /** The number of name table entries. */
+    uint32_t            cNames;
+    /** The host TSC frequency. */
+    uint64_t            u64TscHz;
+    /** The host TSC at the time of the dump. */
+    uint64_t            uTscDump;
+    /** The wall clock time of the dump (nanoseconds since the unix epoch). */
+    int64_t             i64UnixNsDump;
+    /** Reserved, MBZ. */
+    uint64_t            au64Reserved[2];
+} DBGFTRACEEVTFILEHDR;
+AssertCompileSize(DBGFTRACEEVTFILEHDR, 64);
+/** Magic value for DBGFTRACEEVTFILEHDR::u32Magic (Ella Fitzgerald). */
+#define DBGFTRACEEVTFILEHDR_MAGIC   UINT32_C(0x19170425)
+/** The current file format version. */
+#define DBGFTRACEEVTFILEHDR_VERSION UINT32_C(1)
+
+/**
+ * Trace file name table entry.
+ *
+ * Gives names to the exit types (DBGFTRACEEVTTYPE_EXIT::u64Arg0) and PDM
+ * queue keys (DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH::u64Arg0) found in the dump.
+ */
+typedef struct DBGFTRACEEVTFILENAME
+{
+    /** The key. */
+    uint64_t            uKey;
+    /** The event type the key belongs to (DBGFTRACEEVTTYPE). */
+    uint8_t             enmType;
+    /** Reserved, MBZ. */
+    uint8_t             abReserved[7];
+    /** The name, zero terminated. */
+    char                szName[48];
+} DBGFTRACEEVTFILENAME;
+AssertCompileSize(DBGFTRACEEVTFILENAME, 64);
+
+/**
+ * Per VCPU section header in the trace file.
+ */
+typedef struct DBGFTRACEEVTFILECPU
+{
+    /** The VCPU ID. */
+    uint32_t            idCpu;
+    /** The number of records following this header. */
+    uint32_t            cRecs;
+    /** The number of records that were lost because the ring wrapped around
+     * (either before or during the dump). */
+    uint64_t            cLost;
+} DBGFTRACEEVTFILECPU;
+AssertCompileSize(DBGFTRACEEVTFILECPU, 16);
+
+/**
+ * Checks whether any of the given event categories is enabled for a VCPU.
+ *
+ * @param   a_pVCpu         The cross context virtual CPU structure.
+ * @param   a_fCategories   The DBGFTRACEEVT_F_XXX mask.
+ */
+#define DBGFTRACEEVT_IS_ENABLED(a_pVCpu, a_fCategories) \
+    RT_UNLIKELY((a_pVCpu)->fTraceEvts & (a_fCategories))
+
+/**
+ * Gets the start timestamp for a timed event, returns 0 if none of the given
+ * categories are enabled.
+ *
+ * @param   a_pVCpu         The cross context virtual CPU structure.
+ * @param   a_fCategories   The DBGFTRACEEVT_F_XXX mask.
+ */
+#define DBGFTRACEEVT_START(a_pVCpu, a_fCategories) \
+    ( !DBGFTRACEEVT_IS_ENABLED(a_pVCpu, a_fCategories) ? UINT64_C(0) : ASMReadTSC() )
+
+VMM_INT_DECL(void) DBGFTraceEvtAdd(PVMCPU pVCpu, DBGFTRACEEVTTYPE enmType, uint64_t uTscStart,
+                                   uint8_t bArg, uint16_t u16Arg, uint64_t u64Arg0, uint64_t u64Arg1);
+#ifdef IN_RING3
+VMMR3DECL(int) DBGFR3TraceEvtConfig(PUVM pUVM, const char *pszConfig);
+VMMR3DECL(int) DBGFR3TraceEvtQueryConfig(PUVM pUVM, char *pszConfig, size_t cbConfig);
+VMMR3DECL(int) DBGFR3TraceEvtDump(PUVM pUVM, const char *pszFilename);
+#endif
+
+/** @} */
+
+
 /** @} */
 RT_C_DECLS_END
 
@@ -392,6 +392,7 @@ VMMR3_INT_DECL(int)             EMR3CheckRawForcedActions(PVM pVM, PVMCPU pVCpu)
 VMMR3_INT_DECL(int)             EMR3NotifyResume(PVM pVM);
 VMMR3_INT_DECL(int)             EMR3NotifySuspend(PVM pVM);
 VMMR3_INT_DECL(VBOXSTRICTRC)    EMR3HmSingleInstruction(PVM pVM, PVMCPU pVCpu, uint32_t fFlags);
+VMMR3_INT_DECL(const char *)    EMR3GetExitName(uint32_t uFlagsAndType, char *pszFallback, size_t cbFallback);
 
 /** @} */
 #endif /* IN_RING3 */
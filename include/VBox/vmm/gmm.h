@@ -383,8 +383,12 @@ typedef struct GMMSTATS
     uint32_t            cFreedChunks;
     /** The number of shareable modules (GMM:cShareableModules). */
     uint64_t            cShareableModules;
-    /** Space reserved for later. */
-    uint64_t            au64Reserved[2];
+    /** The number of entries in the content deduplication index
+     * (GMM::cDedupEntries). */
+    uint64_t            cDedupEntries;
+    /** The number of private pages freed by content deduplication merges
+     * (GMM::cDedupMergedPages). */
+    uint64_t            cDedupMergedPages;
 
     /** Statistics for the specified VM. (Zero filled if not requested.) */
     GMMVMSTATS          VMStats;
@@ -406,6 +410,7 @@ GMMR0DECL(int)  GMMR0AllocateHandyPages(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint3
                                         uint32_t cPagesToAlloc, PGMMPAGEDESC paPages);
 GMMR0DECL(int)  GMMR0AllocatePages(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t cPages, PGMMPAGEDESC paPages, GMMACCOUNT enmAccount);
 GMMR0DECL(int)  GMMR0AllocateLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t cbPage, uint32_t *pIdPage, RTHCPHYS *pHCPhys);
+GMMR0DECL(int)  GMMR0SeedLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, RTR3PTR pvR3, uint32_t *pIdPage, RTHCPHYS *pHCPhys);
 GMMR0DECL(int)  GMMR0FreePages(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t cPages, PGMMFREEPAGEDESC paPages, GMMACCOUNT enmAccount);
 GMMR0DECL(int)  GMMR0FreeLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t idPage);
 GMMR0DECL(int)  GMMR0BalloonedPages(PGVM pGVM, PVM pVM, VMCPUID idCpu, GMMBALLOONACTION enmAction, uint32_t cBalloonedPages);
@@ -418,6 +423,7 @@ GMMR0DECL(int)  GMMR0UnregisterSharedModule(PGVM pGVM, PVM pVM, VMCPUID idCpu, c
                                             RTGCPTR GCBaseAddr, uint32_t cbModule);
 GMMR0DECL(int)  GMMR0UnregisterAllSharedModules(PGVM pGVM, PVM pVM, VMCPUID idCpu);
 GMMR0DECL(int)  GMMR0CheckSharedModules(PGVM pGVM, PVM pVM, VMCPUID idCpu);
+GMMR0DECL(int)  GMMR0ScanForDuplicatePages(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t cMaxPages);
 GMMR0DECL(int)  GMMR0ResetSharedModules(PGVM pGVM, PVM pVM, VMCPUID idCpu);
 GMMR0DECL(int)  GMMR0QueryStatistics(PGMMSTATS pStats, PSUPDRVSESSION pSession);
 GMMR0DECL(int)  GMMR0ResetStatistics(PCGMMSTATS pStats, PSUPDRVSESSION pSession);
@@ -679,6 +685,7 @@ typedef GMMSHAREDPAGEDESC *PGMMSHAREDPAGEDESC;
 
 GMMR0DECL(int) GMMR0SharedModuleCheckPage(PGVM pGVM, PGMMSHAREDMODULE pModule, uint32_t idxRegion, uint32_t idxPage,
                                           PGMMSHAREDPAGEDESC pPageDesc);
+GMMR0DECL(int) GMMR0DedupCheckPage(PGVM pGVM, PGMMSHAREDPAGEDESC pPageDesc, bool *pfZeroPage);
 
 /**
  * Request buffer for GMMR0UnregisterSharedModuleReq / VMMR0_DO_GMM_UNREGISTER_SHARED_MODULE.
@@ -792,6 +799,7 @@ GMMR3DECL(int)  GMMR3BalloonedPages(PVM pVM, GMMBALLOONACTION enmAction, uint32_
 GMMR3DECL(int)  GMMR3RegisterSharedModule(PVM pVM, PGMMREGISTERSHAREDMODULEREQ pReq);
 GMMR3DECL(int)  GMMR3UnregisterSharedModule(PVM pVM, PGMMUNREGISTERSHAREDMODULEREQ pReq);
 GMMR3DECL(int)  GMMR3CheckSharedModules(PVM pVM);
+GMMR3DECL(int)  GMMR3ScanForDuplicatePages(PVM pVM, uint32_t cMaxPages);
 GMMR3DECL(int)  GMMR3ResetSharedModules(PVM pVM);
 
 # if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
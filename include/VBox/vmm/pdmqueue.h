@@ -43,18 +43,14 @@ typedef struct PDMQUEUEITEMCORE *PPDMQUEUEITEMCORE;
 
 /**
  * PDM queue item core.
+ *
+ * The pending items are tracked by index in a ring owned by the queue, so the
+ * core is just reserved space at the start of each item.
  */
 typedef struct PDMQUEUEITEMCORE
 {
-    /** Pointer to the next item in the pending list - R3 Pointer. */
-    R3PTRTYPE(PPDMQUEUEITEMCORE)    pNextR3;
-    /** Pointer to the next item in the pending list - R0 Pointer. */
-    R0PTRTYPE(PPDMQUEUEITEMCORE)    pNextR0;
-    /** Pointer to the next item in the pending list - RC Pointer. */
-    RCPTRTYPE(PPDMQUEUEITEMCORE)    pNextRC;
-#if HC_ARCH_BITS == 64
-    RTRCPTR                         Alignment0;
-#endif
+    /** Reserved for the queue implementation. */
+    uint64_t                        au64Reserved[3];
 } PDMQUEUEITEMCORE;
 
 
@@ -73,6 +69,22 @@ typedef DECLCALLBACK(bool) FNPDMQUEUEDEV(PPDMDEVINS pDevIns, PPDMQUEUEITEMCORE p
 /** Pointer to a FNPDMQUEUEDEV(). */
 typedef FNPDMQUEUEDEV *PFNPDMQUEUEDEV;
 
+/**
+ * Batched queue consumer callback for devices.
+ *
+ * @returns The number of items consumed, starting with the first one.  If
+ *          less than @a cItems, the rest is left in the queue and the
+ *          flushing will stop.
+ * @param   pDevIns     The device instance.
+ * @param   papItems    The items to consume, in insertion order.  Upon return
+ *                      the consumed items will be freed.
+ * @param   cItems      The number of items, at least one.
+ * @remarks Same locking rules as FNPDMQUEUEDEV.
+ */
+typedef DECLCALLBACK(uint32_t) FNPDMQUEUEDEVBATCH(PPDMDEVINS pDevIns, PPDMQUEUEITEMCORE *papItems, uint32_t cItems);
+/** Pointer to a FNPDMQUEUEDEVBATCH(). */
+typedef FNPDMQUEUEDEVBATCH *PFNPDMQUEUEDEVBATCH;
+
 /**
  * Queue consumer callback for USB devices.
  *
@@ -115,6 +127,22 @@ typedef DECLCALLBACK(bool) FNPDMQUEUEINT(PVM pVM, PPDMQUEUEITEMCORE pItem);
 /** Pointer to a FNPDMQUEUEINT(). */
 typedef FNPDMQUEUEINT *PFNPDMQUEUEINT;
 
+/**
+ * Batched queue consumer callback for internal component.
+ *
+ * @returns The number of items consumed, starting with the first one.  If
+ *          less than @a cItems, the rest is left in the queue and the
+ *          flushing will stop.
+ * @param   pVM         The cross context VM structure.
+ * @param   papItems    The items to consume, in insertion order.  Upon return
+ *                      the consumed items will be freed.
+ * @param   cItems      The number of items, at least one.
+ * @remarks Same locking rules as FNPDMQUEUEINT.
+ */
+typedef DECLCALLBACK(uint32_t) FNPDMQUEUEINTBATCH(PVM pVM, PPDMQUEUEITEMCORE *papItems, uint32_t cItems);
+/** Pointer to a FNPDMQUEUEINTBATCH(). */
+typedef FNPDMQUEUEINTBATCH *PFNPDMQUEUEINTBATCH;
+
 /**
  * Queue consumer callback for external component.
  *
@@ -132,16 +160,21 @@ typedef FNPDMQUEUEEXT *PFNPDMQUEUEEXT;
 #ifdef VBOX_IN_VMM
 VMMR3_INT_DECL(int)  PDMR3QueueCreateDevice(PVM pVM, PPDMDEVINS pDevIns, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
                                             PFNPDMQUEUEDEV pfnCallback, bool fRZEnabled, const char *pszName, PPDMQUEUE *ppQueue);
+VMMR3_INT_DECL(int)  PDMR3QueueCreateDeviceBatch(PVM pVM, PPDMDEVINS pDevIns, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
+                                                 PFNPDMQUEUEDEVBATCH pfnCallback, bool fRZEnabled, const char *pszName, PPDMQUEUE *ppQueue);
 VMMR3_INT_DECL(int)  PDMR3QueueCreateDriver(PVM pVM, PPDMDRVINS pDrvIns, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
                                             PFNPDMQUEUEDRV pfnCallback, const char *pszName, PPDMQUEUE *ppQueue);
 VMMR3_INT_DECL(int)  PDMR3QueueCreateInternal(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
                                               PFNPDMQUEUEINT pfnCallback, bool fGCEnabled, const char *pszName, PPDMQUEUE *ppQueue);
+VMMR3_INT_DECL(int)  PDMR3QueueCreateInternalBatch(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
+                                                   PFNPDMQUEUEINTBATCH pfnCallback, bool fRZEnabled, const char *pszName, PPDMQUEUE *ppQueue);
 VMMR3_INT_DECL(int)  PDMR3QueueCreateExternal(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
                                               PFNPDMQUEUEEXT pfnCallback, void *pvUser, const char *pszName, PPDMQUEUE *ppQueue);
 VMMR3_INT_DECL(int)  PDMR3QueueDestroy(PPDMQUEUE pQueue);
 VMMR3_INT_DECL(int)  PDMR3QueueDestroyDevice(PVM pVM, PPDMDEVINS pDevIns);
 VMMR3_INT_DECL(int)  PDMR3QueueDestroyDriver(PVM pVM, PPDMDRVINS pDrvIns);
 VMMR3_INT_DECL(void) PDMR3QueueFlushAll(PVM pVM);
+VMMR3_INT_DECL(int)  PDMR3QueueQueryTraceName(PVM pVM, uint64_t uKey, char *pszName, size_t cbName);
 #endif /* VBOX_IN_VMM */
 
 VMMDECL(PPDMQUEUEITEMCORE)    PDMQueueAlloc(PPDMQUEUE pQueue);
@@ -0,0 +1,218 @@
+/** @file
+ * PGM - Page Delta Encoding, Inlined Code.
+ *
+ * Used for sending pages that were dirtied again during live migration as a
+ * delta against the copy sent earlier.  This is inlined so that the saved
+ * state code and the teleporter testcases can share it without another
+ * library.
+ */
+
+/*
+ * Copyright (C) 2010-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+#ifndef ___VBox_vmm_pgmdelta_h_
+#define ___VBox_vmm_pgmdelta_h_
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/types.h>
+#include <VBox/err.h>
+#include <iprt/assert.h>
+#include <iprt/string.h>
+
+
+/** @defgroup grp_pgm_delta     The PGM Page Delta Helpers
+ * @ingroup grp_pgm
+ *
+ * The encoding is a sequence of (unchanged length, changed length, changed
+ * bytes) tuples, with both lengths stored as unsigned LEB128 numbers.  A run
+ * of unchanged bytes at the end of the page is omitted, so identical pages
+ * encode as zero bytes.  This is the XBZRLE format also used by other
+ * hypervisors for live migration.
+ *
+ * @{
+ */
+
+/** The max size of an encoded LEB128 run length (pages are <= 64KB). */
+#define PGMDELTA_MAX_RUN_LEN_BYTES  3
+
+
+/**
+ * Writes an unsigned LEB128 run length.
+ *
+ * @returns Number of bytes written, 0 if the buffer is too small.
+ * @param   pbDst       Where to write.
+ * @param   cbDst       The space left in the buffer.
+ * @param   cb          The run length.
+ */
+DECLINLINE(uint32_t) pgmDeltaPutRunLen(uint8_t *pbDst, uint32_t cbDst, uint32_t cb)
+{
+    uint32_t off = 0;
+    do
+    {
+        if (off >= cbDst)
+            return 0;
+        uint8_t b = (uint8_t)(cb & 0x7f);
+        cb >>= 7;
+        pbDst[off++] = cb ? b | 0x80 : b;
+    } while (cb);
+    return off;
+}
+
+
+/**
+ * Reads an unsigned LEB128 run length.
+ *
+ * @returns Number of bytes consumed, 0 if malformed or truncated.
+ * @param   pbSrc       The encoded data.
+ * @param   cbSrc       The amount of encoded data left.
+ * @param   pcb         Where to return the run length.
+ */
+DECLINLINE(uint32_t) pgmDeltaGetRunLen(uint8_t const *pbSrc, uint32_t cbSrc, uint32_t *pcb)
+{
+    uint32_t cb = 0;
+    for (uint32_t off = 0; off < RT_MIN(cbSrc, PGMDELTA_MAX_RUN_LEN_BYTES); off++)
+    {
+        cb |= (uint32_t)(pbSrc[off] & 0x7f) << (off * 7);
+        if (!(pbSrc[off] & 0x80))
+        {
+            *pcb = cb;
+            return off + 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Encodes the difference between two versions of a page.
+ *
+ * @returns The size of the encoded delta (0 if the pages are identical),
+ *          UINT32_MAX if it doesn't fit into @a cbDst.  In the latter case
+ *          the caller should send the page as-is.
+ * @param   pbOld       The previous page content (as known to the receiver).
+ * @param   pbNew       The current page content.
+ * @param   cbPage      The page size.  Must be a multiple of 8.
+ * @param   pbDst       Where to store the encoded delta.
+ * @param   cbDst       The size of the output buffer.  Passing less than
+ *                      @a cbPage makes the encoder give up early on pages
+ *                      that changed too much to be worth it.
+ */
+DECLINLINE(uint32_t) PGMDeltaEncode(uint8_t const *pbOld, uint8_t const *pbNew, uint32_t cbPage, uint8_t *pbDst, uint32_t cbDst)
+{
+    Assert(!(cbPage & 7));
+    uint32_t offDst = 0;
+    uint32_t off    = 0;
+    while (off < cbPage)
+    {
+        /*
+         * Unchanged run, a qword at a time while aligned.
+         */
+        uint32_t const offSame = off;
+        while (off < cbPage)
+        {
+            if (   !(off & 7)
+                && *(uint64_t const *)&pbOld[off] == *(uint64_t const *)&pbNew[off])
+                off += 8;
+            else if (pbOld[off] == pbNew[off])
+                off++;
+            else
+                break;
+        }
+        if (off >= cbPage)
+            break;
+
+        /*
+         * Changed run.  Ends at the first unchanged byte, like in XBZRLE;
+         * single byte islands cost one or two bytes of run length overhead.
+         */
+        uint32_t const offDiff = off;
+        while (off < cbPage && pbOld[off] != pbNew[off])
+            off++;
+
+        uint32_t cb = pgmDeltaPutRunLen(&pbDst[offDst], cbDst - offDst, offDiff - offSame);
+        if (!cb)
+            return UINT32_MAX;
+        offDst += cb;
+        cb = pgmDeltaPutRunLen(&pbDst[offDst], cbDst - offDst, off - offDiff);
+        if (!cb)
+            return UINT32_MAX;
+        offDst += cb;
+        if (cbDst - offDst < off - offDiff)
+            return UINT32_MAX;
+        memcpy(&pbDst[offDst], &pbNew[offDiff], off - offDiff);
+        offDst += off - offDiff;
+    }
+    return offDst;
+}
+
+
+/**
+ * Applies a delta produced by PGMDeltaEncode to a page.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_INVALID_PARAMETER if the delta is malformed or doesn't fit the
+ *          page.  The page content is undefined in this case.
+ * @param   pbSrc       The encoded delta.
+ * @param   cbSrc       The size of the encoded delta.
+ * @param   pbPage      The page to update in place.
+ * @param   cbPage      The page size.
+ */
+DECLINLINE(int) PGMDeltaDecode(uint8_t const *pbSrc, uint32_t cbSrc, uint8_t *pbPage, uint32_t cbPage)
+{
+    uint32_t offSrc = 0;
+    uint32_t off    = 0;
+    while (offSrc < cbSrc)
+    {
+        uint32_t cbSame;
+        uint32_t cb = pgmDeltaGetRunLen(&pbSrc[offSrc], cbSrc - offSrc, &cbSame);
+        if (RT_UNLIKELY(!cb))
+            return VERR_INVALID_PARAMETER;
+        offSrc += cb;
+
+        uint32_t cbDiff;
+        cb = pgmDeltaGetRunLen(&pbSrc[offSrc], cbSrc - offSrc, &cbDiff);
+        if (RT_UNLIKELY(!cb))
+            return VERR_INVALID_PARAMETER;
+        offSrc += cb;
+
+        if (RT_UNLIKELY(!cbDiff))
+            return VERR_INVALID_PARAMETER;
+        if (RT_UNLIKELY(cbSame > cbPage - off))
+            return VERR_INVALID_PARAMETER;
+        off += cbSame;
+        if (RT_UNLIKELY(cbDiff > cbPage - off))
+            return VERR_INVALID_PARAMETER;
+        if (RT_UNLIKELY(cbDiff > cbSrc - offSrc))
+            return VERR_INVALID_PARAMETER;
+        memcpy(&pbPage[off], &pbSrc[offSrc], cbDiff);
+        off    += cbDiff;
+        offSrc += cbDiff;
+    }
+    return VINF_SUCCESS;
+}
+
+/** @} */
+
+#endif
+
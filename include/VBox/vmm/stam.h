@@ -27,6 +27,7 @@
 #define ___VBox_vmm_stam_h
 
 #include <VBox/types.h>
+#include <iprt/assert.h>
 #include <iprt/stdarg.h>
 #ifdef _MSC_VER
 # if _MSC_VER >= 1400
@@ -161,6 +162,8 @@ typedef enum STAMTYPE
     STAMTYPE_BOOL,
     /** Generic boolean value. Reset to false. */
     STAMTYPE_BOOL_RESET,
+    /** Log-linear histogram of profiling periods or other values. */
+    STAMTYPE_HISTOGRAM,
     /** The end (exclusive). */
     STAMTYPE_END
 } STAMTYPE;
@@ -1091,6 +1094,153 @@ typedef const STAMPROFILEADV *PCSTAMPROFILEADV;
 #endif
 
 
+/** The number of bits below the most significant one used for selecting
+ * the linear sub-bucket of a STAMHISTOGRAM.  With 2 bits each power of two
+ * is split into 4 buckets, giving a relative error of at most 25%. */
+#define STAMHISTOGRAM_SUB_BITS      2
+/** The number of linear sub-buckets per power of two. */
+#define STAMHISTOGRAM_SUB_BUCKETS   (1U << STAMHISTOGRAM_SUB_BITS)
+/** The number of buckets in a STAMHISTOGRAM, covering all 64-bit values. */
+#define STAMHISTOGRAM_BUCKETS       ((64 - STAMHISTOGRAM_SUB_BITS + 1) * STAMHISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Histogram sample - STAMTYPE_HISTOGRAM.
+ *
+ * A STAMPROFILE with the values additionally counted in log-linear buckets,
+ * so that percentiles can be calculated when the statistics are printed or
+ * snapshotted.  Values below STAMHISTOGRAM_SUB_BUCKETS have a bucket each,
+ * above that every power of two is split into STAMHISTOGRAM_SUB_BUCKETS
+ * equally sized buckets.
+ *
+ * Unlike the other samples it is updated using atomic operations, so it can
+ * be shared by several threads and contexts without any locking.  The sample
+ * is reset when registered.
+ */
+typedef struct STAMHISTOGRAM
+{
+    /** The STAMPROFILE core with the number of values, their sum, max and min. */
+    STAMPROFILE         Core;
+    /** The number of values in each bucket. */
+    volatile uint64_t   acBuckets[STAMHISTOGRAM_BUCKETS];
+} STAMHISTOGRAM;
+/** Pointer to a histogram sample. */
+typedef STAMHISTOGRAM *PSTAMHISTOGRAM;
+/** Pointer to a const histogram sample. */
+typedef const STAMHISTOGRAM *PCSTAMHISTOGRAM;
+
+
+/** @def STAM_REL_HISTOGRAM_ADD
+ * Adds a value to a histogram.
+ *
+ * @param   pHistogram      Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   uValue          The value (usually ticks of a period) to add.  This
+ *                          is only referenced once.
+ *
+ * @remarks Requires iprt/asm.h.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_ADD(pHistogram, uValue) \
+    do { \
+        uint64_t const StamPrefix_uValue = (uValue); \
+        uint64_t       StamPrefix_uOld; \
+        unsigned       StamPrefix_iBucket; \
+        if (StamPrefix_uValue < STAMHISTOGRAM_SUB_BUCKETS) \
+            StamPrefix_iBucket = (unsigned)StamPrefix_uValue; \
+        else \
+        { \
+            unsigned const StamPrefix_iBit = ASMBitLastSetU64(StamPrefix_uValue); \
+            StamPrefix_iBucket = ((StamPrefix_iBit - STAMHISTOGRAM_SUB_BITS) << STAMHISTOGRAM_SUB_BITS) \
+                               + (unsigned)(  (StamPrefix_uValue >> (StamPrefix_iBit - 1 - STAMHISTOGRAM_SUB_BITS)) \
+                                            & (STAMHISTOGRAM_SUB_BUCKETS - 1)); \
+        } \
+        ASMAtomicIncU64(&(pHistogram)->acBuckets[StamPrefix_iBucket]); \
+        ASMAtomicIncU64(&(pHistogram)->Core.cPeriods); \
+        ASMAtomicAddU64(&(pHistogram)->Core.cTicks, StamPrefix_uValue); \
+        StamPrefix_uOld = ASMAtomicUoReadU64(&(pHistogram)->Core.cTicksMax); \
+        while (   StamPrefix_uOld < StamPrefix_uValue \
+               && !ASMAtomicCmpXchgExU64(&(pHistogram)->Core.cTicksMax, StamPrefix_uValue, StamPrefix_uOld, &StamPrefix_uOld)) \
+        { /* retry */ } \
+        StamPrefix_uOld = ASMAtomicUoReadU64(&(pHistogram)->Core.cTicksMin); \
+        while (   StamPrefix_uOld > StamPrefix_uValue \
+               && !ASMAtomicCmpXchgExU64(&(pHistogram)->Core.cTicksMin, StamPrefix_uValue, StamPrefix_uOld, &StamPrefix_uOld)) \
+        { /* retry */ } \
+    } while (0)
+#else
+# define STAM_REL_HISTOGRAM_ADD(pHistogram, uValue) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_ADD
+ * Adds a value to a histogram.
+ *
+ * @param   pHistogram      Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   uValue          The value (usually ticks of a period) to add.  This
+ *                          is only referenced once.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_ADD(pHistogram, uValue) STAM_REL_HISTOGRAM_ADD(pHistogram, uValue)
+#else
+# define STAM_HISTOGRAM_ADD(pHistogram, uValue) do { } while (0)
+#endif
+
+
+/** @def STAM_REL_HISTOGRAM_START
+ * Samples the start time of a period to be added to a histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ *
+ * @remarks Declears a stack variable that will be used by related macros.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_START(pHistogram, Prefix) \
+    uint64_t Prefix##_tsStart; \
+    STAM_GET_TS(Prefix##_tsStart)
+#else
+# define STAM_REL_HISTOGRAM_START(pHistogram, Prefix) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_START
+ * Samples the start time of a period to be added to a histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ *
+ * @remarks Declears a stack variable that will be used by related macros.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_START(pHistogram, Prefix) STAM_REL_HISTOGRAM_START(pHistogram, Prefix)
+#else
+# define STAM_HISTOGRAM_START(pHistogram, Prefix) do { } while (0)
+#endif
+
+/** @def STAM_REL_HISTOGRAM_STOP
+ * Samples the stop time of a period and adds it to the histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix) \
+    do { \
+        uint64_t Prefix##_cTicks; \
+        STAM_GET_TS(Prefix##_cTicks); \
+        Prefix##_cTicks -= Prefix##_tsStart; \
+        STAM_REL_HISTOGRAM_ADD(pHistogram, Prefix##_cTicks); \
+    } while (0)
+#else
+# define STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_STOP
+ * Samples the stop time of a period and adds it to the histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_STOP(pHistogram, Prefix) STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix)
+#else
+# define STAM_HISTOGRAM_STOP(pHistogram, Prefix) do { } while (0)
+#endif
+
+
 /**
  * Ratio of A to B, uint32_t types.
  * @remark Use STAM_STATS or STAM_REL_STATS for modifying A & B values.
@@ -1109,6 +1259,112 @@ typedef const STAMRATIOU32 *PCSTAMRATIOU32;
 
 
 
+/** @defgroup grp_stam_shm  The STAM Shared Memory Export Format
+ *
+ * When enabled (CFGM /STAM/Export/Enabled), the VM process publishes its
+ * samples in a read-only POSIX shared memory segment so that external tools
+ * can poll them without entering the VM process.  The segment starts with a
+ * STAMSHMHDR, followed by the descriptor table (STAMSHMDESC), the string table
+ * (zero terminated UTF-8 names and descriptions) and the value area.  Values
+ * are raw copies of the sample structures defined in this file (STAMCOUNTER,
+ * STAMPROFILE, STAMHISTOGRAM, ...), except that advanced profiles are exported
+ * as their STAMPROFILE core and callback samples as zero terminated strings of
+ * STAMSHM_CALLBACK_CCH bytes.  When the VM terminates, u32Magic is changed to
+ * ~STAMSHMHDR_MAGIC and the segment is unlinked.
+ *
+ * The publisher updates the segment in place.  Readers must use the sequence
+ * counter in the header: read STAMSHMHDR::uSeq, retry if odd, copy what is
+ * needed, and retry if uSeq has changed in the mean time.  The segment never
+ * shrinks, but it may grow when the descriptor table is rebuilt; readers
+ * should remap when STAMSHMHDR::cbSegment exceeds the size they've mapped.
+ * @{
+ */
+
+/** Magic value for STAMSHMHDR::u32Magic (Lee Morgan). */
+#define STAMSHMHDR_MAGIC            UINT32_C(0x19380710)
+/** The current format version (STAMSHMHDR::u32Version). */
+#define STAMSHMHDR_VERSION          UINT32_C(0x00010000)
+/** The default segment name prefix; the VM process ID is appended in decimal. */
+#define STAMSHM_NAME_PREFIX         "/VBoxSTAM-"
+/** The size of a callback sample value (string) in the value area. */
+#define STAMSHM_CALLBACK_CCH        64
+/** Value for STAMSHMDESC::offDesc when there is no description. */
+#define STAMSHM_NO_DESC             UINT32_MAX
+
+/**
+ * The header of the STAM shared memory segment.
+ */
+typedef struct STAMSHMHDR
+{
+    /** Magic value (STAMSHMHDR_MAGIC). */
+    uint32_t            u32Magic;
+    /** Format version (STAMSHMHDR_VERSION). */
+    uint32_t            u32Version;
+    /** Sequence counter, odd while the publisher is updating the segment. */
+    uint32_t volatile   uSeq;
+    /** Incremented every time the descriptor table is rebuilt. */
+    uint32_t volatile   uLayoutGen;
+    /** The size of the segment in bytes. */
+    uint32_t volatile   cbSegment;
+    /** The size of this header (sizeof(STAMSHMHDR)). */
+    uint32_t            cbHdr;
+    /** The size of a descriptor (sizeof(STAMSHMDESC)). */
+    uint32_t            cbDesc;
+    /** The number of descriptors. */
+    uint32_t            cDescs;
+    /** Offset of the descriptor table relative to the start of the segment. */
+    uint32_t            offDescs;
+    /** Offset of the string table relative to the start of the segment. */
+    uint32_t            offStrings;
+    /** Offset of the value area relative to the start of the segment. */
+    uint32_t            offValues;
+    /** The size of the value area. */
+    uint32_t            cbValues;
+    /** RTTimeNanoTS() of the last update. */
+    uint64_t volatile   u64NanoTS;
+    /** The number of value updates since the segment was created. */
+    uint64_t volatile   cUpdates;
+    /** The update interval in milliseconds. */
+    uint32_t            cMsInterval;
+    /** The ID of the VM process. */
+    uint32_t            uPid;
+    /** The VM name (CFGM /Name), zero terminated. */
+    char                szVMName[64];
+} STAMSHMHDR;
+AssertCompileSize(STAMSHMHDR, 136);
+/** Pointer to a STAM shared memory header. */
+typedef STAMSHMHDR *PSTAMSHMHDR;
+/** Pointer to a const STAM shared memory header. */
+typedef STAMSHMHDR const *PCSTAMSHMHDR;
+
+/**
+ * A sample descriptor in the STAM shared memory segment.
+ */
+typedef struct STAMSHMDESC
+{
+    /** Offset of the sample name into the string table. */
+    uint32_t            offName;
+    /** Offset of the description into the string table, STAMSHM_NO_DESC if none. */
+    uint32_t            offDesc;
+    /** Offset of the value relative to STAMSHMHDR::offValues (8 byte aligned). */
+    uint32_t            offValue;
+    /** The size of the value. */
+    uint16_t            cbValue;
+    /** The sample type (STAMTYPE). */
+    uint8_t             enmType;
+    /** The sample unit (STAMUNIT). */
+    uint8_t             enmUnit;
+} STAMSHMDESC;
+AssertCompileSize(STAMSHMDESC, 16);
+/** Pointer to a STAM shared memory descriptor. */
+typedef STAMSHMDESC *PSTAMSHMDESC;
+/** Pointer to a const STAM shared memory descriptor. */
+typedef STAMSHMDESC const *PCSTAMSHMDESC;
+
+/** @} */
+
+
+
 
 /** @defgroup grp_stam_r3   The STAM Host Context Ring 3 API
  * @{
@@ -1253,6 +1509,9 @@ typedef FNSTAMR3ENUM *PFNSTAMR3ENUM;
 
 VMMR3DECL(int)  STAMR3Enum(PUVM pUVM, const char *pszPat, PFNSTAMR3ENUM pfnEnum, void *pvUser);
 VMMR3DECL(const char *) STAMR3GetUnit(STAMUNIT enmUnit);
+VMMR3_INT_DECL(uint64_t) STAMR3HistogramPercentile(PCSTAMHISTOGRAM pHistogram, uint32_t uPerMyriad);
+VMMR3_INT_DECL(int)  STAMR3ExportStart(PVM pVM);
+VMMR3_INT_DECL(void) STAMR3ExportStop(PUVM pUVM);
 
 /** @} */
 
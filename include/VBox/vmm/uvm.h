@@ -56,7 +56,7 @@ typedef struct UVMCPU
 #ifdef ___VMInternal_h
         struct VMINTUSERPERVMCPU    s;
 #endif
-        uint8_t                     padding[512];
+        uint8_t                     padding[2560];
     } vm;
 
     /** The DBGF data. */
@@ -213,7 +213,7 @@ typedef struct VMCPU
 #ifdef ___IOMInternal_h
         struct IOMCPU       s;
 #endif
-        uint8_t             padding[512];       /* multiple of 64 */
+        uint8_t             padding[1024];      /* multiple of 64 */
     } iom;
 
     /** DBGF part.
@@ -256,8 +256,17 @@ typedef struct VMCPU
     /** Profiling samples for use by ad hoc profiling. */
     STAMPROFILEADV          aStatAdHoc[8];                          /* size: 40*8 = 320 */
 
+    /** Binary event trace categories enabled for this VCPU, DBGFTRACEEVT_F_XXX. */
+    uint32_t                fTraceEvts;
+    /** Alignment padding. */
+    uint32_t                u32Alignment3;
+    /** The binary event trace ring of this VCPU - R3 Ptr. */
+    R3PTRTYPE(struct DBGFTRACEEVTRING *) pTraceEvtRingR3;
+    /** The binary event trace ring of this VCPU - R0 Ptr. */
+    R0PTRTYPE(struct DBGFTRACEEVTRING *) pTraceEvtRingR0;
+
     /** Align the following members on page boundary. */
-    uint8_t                 abAlignment2[2936];
+    uint8_t                 abAlignment2[HC_ARCH_BITS == 64 ? 2400 : 2408];
 
     /** PGM part. */
     union VMCPUUNIONPGM
@@ -104,6 +104,8 @@ typedef enum VMMCALLRING3
     VMMCALLRING3_PGM_ALLOCATE_HANDY_PAGES,
     /** Allocates a large (2MB) page. */
     VMMCALLRING3_PGM_ALLOCATE_LARGE_HANDY_PAGE,
+    /** Restores a page from the saved-state page file (lazy restore). */
+    VMMCALLRING3_PGM_LAZY_RESTORE_PAGE,
     /** Acquire the MM hypervisor heap lock. */
     VMMCALLRING3_MMHYPER_LOCK,
     /** Replay the REM handler notifications. */
@@ -350,6 +352,8 @@ typedef enum VMMR0OPERATION
     VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE,
     /** Call PGMR0PhysSetupIommu(). */
     VMMR0_DO_PGM_PHYS_SETUP_IOMMU,
+    /** Call PGMR0PhysSeedLargeHandyPage(). */
+    VMMR0_DO_PGM_SEED_LARGE_HANDY_PAGE,
 
     /** Call GMMR0InitialReservation(). */
     VMMR0_DO_GMM_INITIAL_RESERVATION = 256,
@@ -379,6 +383,8 @@ typedef enum VMMR0OPERATION
     VMMR0_DO_GMM_RESET_SHARED_MODULES,
     /** Call GMMR0CheckSharedModules. */
     VMMR0_DO_GMM_CHECK_SHARED_MODULES,
+    /** Call GMMR0ScanForDuplicatePages. */
+    VMMR0_DO_GMM_SCAN_DUPLICATE_PAGES,
     /** Call GMMR0FindDuplicatePage. */
     VMMR0_DO_GMM_FIND_DUPLICATE_PAGE,
     /** Call GMMR0QueryStatistics(). */
@@ -0,0 +1,1307 @@
+/* $Id$ */
+/** @file
+ * DrvAFPacket - Linux AF_PACKET ring network transport driver.
+ *
+ * Bridges a VM directly to a host network interface from ring-3 using a
+ * packet socket with PACKET_MMAP TPACKET_V3 rings.  Received frames are
+ * handed to the device straight out of the memory mapped receive ring, a
+ * whole ring block per wakeup, and transmit buffers are allocated directly
+ * in the transmit ring so that the only system call per transmit session
+ * is the final kick.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_DRV_AF_PACKET
+#include <VBox/log.h>
+#include <VBox/vmm/pdmdrv.h>
+#include <VBox/vmm/pdmnetifs.h>
+#include <VBox/vmm/pdmnetinline.h>
+
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/mem.h>
+#include <iprt/memcache.h>
+#include <iprt/net.h>
+#include <iprt/param.h>
+#include <iprt/pipe.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/uuid.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "VBoxDD.h"
+#include "HostVNetHdr.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/* Older headers lack some of the bits we use, they are ABI so just define them. */
+#ifndef PACKET_VNET_HDR
+# define PACKET_VNET_HDR            15
+#endif
+#ifndef PACKET_QDISC_BYPASS
+# define PACKET_QDISC_BYPASS        20
+#endif
+#ifndef TP_STATUS_CSUMNOTREADY
+# define TP_STATUS_CSUMNOTREADY     (1 << 3)
+#endif
+
+/** Offset of the frame data (or virtio-net header) in a transmit ring slot. */
+#define DRVAFPACKET_TX_DATA_OFFSET  (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+/** Offset of the link level address in a receive ring packet header. */
+#define DRVAFPACKET_RX_LL_OFFSET    TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+/** The largest frame we ever pass up (GSO) or accept for sending. */
+#define DRVAFPACKET_MAX_FRAME       (_64K + 64)
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * AF_PACKET driver instance data.
+ *
+ * @implements PDMINETWORKUP
+ */
+typedef struct DRVAFPACKET
+{
+    /** The network interface. */
+    PDMINETWORKUP           INetworkUp;
+    /** The network interface. */
+    PPDMINETWORKDOWN        pIAboveNet;
+    /** Pointer to the driver instance. */
+    PPDMDRVINS              pDrvIns;
+    /** The packet socket. */
+    int                     iSocket;
+    /** The host interface index. */
+    int                     iIfIndex;
+    /** The configured host interface name. */
+    char                   *pszDeviceName;
+    /** Whether frames are prefixed by a virtio-net header (PACKET_VNET_HDR). */
+    bool                    fVNetHdr;
+    bool                    afPadding[7];
+
+    /** The mapping of both rings (receive ring first). */
+    uint8_t                *pbRing;
+    /** Size of the mapping. */
+    size_t                  cbRing;
+
+    /** Size of a receive ring block. */
+    uint32_t                cbRxBlock;
+    /** Number of receive ring blocks. */
+    uint32_t                cRxBlocks;
+    /** The receive block we expect the kernel to retire next. */
+    uint32_t                iRxBlock;
+    /** Receive timeout for partially filled blocks, milliseconds. */
+    uint32_t                cMsRxBlockTimeout;
+    /** Scratch buffer for frames which need rewriting before passing up. */
+    uint8_t                *pbRxScratch;
+
+    /** The transmit ring, NULL if the host doesn't support one with TPACKET_V3. */
+    uint8_t                *pbTxRing;
+    /** Size of a transmit ring slot. */
+    uint32_t                cbTxFrame;
+    /** Number of transmit ring slots. */
+    uint32_t                cTxFrames;
+    /** The next transmit ring slot to fill. */
+    uint32_t                iTxFrame;
+    /** Number of slots handed to the kernel since the last kick. */
+    uint32_t                cTxPending;
+    /** The buffer currently allocated directly in the transmit ring, if any. */
+    PPDMSCATTERGATHER       pSgTxRing;
+    /** Cache of scatter/gather descriptors (followed by a GSO context). */
+    RTMEMCACHE              hSgCache;
+
+    /** The write end of the control pipe. */
+    RTPIPE                  hPipeWrite;
+    /** The read end of the control pipe. */
+    RTPIPE                  hPipeRead;
+    /** Reader thread. */
+    PPDMTHREAD              pThread;
+    /** Transmit lock used by drvAFPacketNetworkUp_BeginXmit. */
+    RTCRITSECT              XmitLock;
+
+    /** Number of frames dropped by the kernel because the receive ring was full. */
+    STAMCOUNTER             StatRecvDropped;
+    /** Number of frames dropped because they were truncated, malformed or could
+     *  not be re-tagged. */
+    STAMCOUNTER             StatRecvBad;
+    /** Number of frames dropped because the transmit ring was full. */
+    STAMCOUNTER             StatXmitRingFull;
+    /** Number of frames the kernel rejected as wrongly formatted. */
+    STAMCOUNTER             StatXmitWrongFormat;
+#ifdef VBOX_WITH_STATISTICS
+    /** Number of sent packets. */
+    STAMCOUNTER             StatPktSent;
+    /** Number of sent bytes. */
+    STAMCOUNTER             StatPktSentBytes;
+    /** Number of sent GSO packets passed on to the host. */
+    STAMCOUNTER             StatPktSentGso;
+    /** Number of transmit ring kicks. */
+    STAMCOUNTER             StatXmitKicks;
+    /** Number of received packets. */
+    STAMCOUNTER             StatPktRecv;
+    /** Number of received bytes. */
+    STAMCOUNTER             StatPktRecvBytes;
+    /** Number of received GSO packets. */
+    STAMCOUNTER             StatPktRecvGso;
+    /** Number of receive ring blocks processed. */
+    STAMCOUNTER             StatRecvBlocks;
+    /** Profiling packet transmit runs. */
+    STAMPROFILE             StatTransmit;
+    /** Profiling packet receive runs. */
+    STAMPROFILEADV          StatReceive;
+#endif /* VBOX_WITH_STATISTICS */
+} DRVAFPACKET, *PDRVAFPACKET;
+
+
+/** Converts a pointer to DRVAFPACKET::INetworkUp to a PDRVAFPACKET. */
+#define PDMINETWORKUP_2_DRVAFPACKET(pInterface) ( (PDRVAFPACKET)((uintptr_t)pInterface - RT_UOFFSETOF(DRVAFPACKET, INetworkUp)) )
+
+
+
+/**
+ * Gets the transmit ring slot header for the given index.
+ */
+DECLINLINE(struct tpacket3_hdr *) drvAFPacketTxSlot(PDRVAFPACKET pThis, uint32_t iFrame)
+{
+    return (struct tpacket3_hdr *)(pThis->pbTxRing + (size_t)iFrame * pThis->cbTxFrame);
+}
+
+
+/**
+ * Tells the kernel to process the transmit ring slots we've filled in.
+ *
+ * @param   pThis           The instance data.
+ * @param   fWait           Whether to wait for the kernel to complete sending.
+ */
+static void drvAFPacketXmitKick(PDRVAFPACKET pThis, bool fWait)
+{
+    if (pThis->cTxPending || fWait)
+    {
+        STAM_COUNTER_INC(&pThis->StatXmitKicks);
+        ssize_t cbRet = send(pThis->iSocket, NULL, 0, fWait ? 0 : MSG_DONTWAIT);
+        if (cbRet < 0 && errno != EAGAIN && errno != ENOBUFS)
+            LogRelMax(32, ("AFPacket#%d: send(kick) failed: errno=%d\n", pThis->pDrvIns->iInstance, errno));
+        pThis->cTxPending = 0;
+    }
+}
+
+
+/**
+ * Reserves the next free transmit ring slot, flushing the ring if necessary.
+ *
+ * The slot must be handed to the kernel by drvAFPacketXmitCommitSlot or given
+ * back by drvAFPacketXmitReleaseSlot.
+ *
+ * @returns Pointer to the slot header, NULL if the ring is full.
+ * @param   pThis           The instance data.
+ */
+static struct tpacket3_hdr *drvAFPacketXmitReserveSlot(PDRVAFPACKET pThis)
+{
+    struct tpacket3_hdr *pSlot = drvAFPacketTxSlot(pThis, pThis->iTxFrame);
+    for (unsigned iTry = 0; ; iTry++)
+    {
+        uint32_t fStatus = ASMAtomicReadU32((uint32_t volatile *)&pSlot->tp_status);
+        if (fStatus == TP_STATUS_AVAILABLE)
+            break;
+        if (fStatus & TP_STATUS_WRONG_FORMAT)
+        {
+            /* The kernel stops processing the ring at a malformed frame, drop it. */
+            STAM_REL_COUNTER_INC(&pThis->StatXmitWrongFormat);
+            ASMAtomicWriteU32((uint32_t volatile *)&pSlot->tp_status, TP_STATUS_AVAILABLE);
+            break;
+        }
+        if (iTry > 0)
+            return NULL;
+        /* Wait for the kernel to drain what we've queued so far. */
+        drvAFPacketXmitKick(pThis, true /*fWait*/);
+    }
+
+    pThis->iTxFrame = (pThis->iTxFrame + 1) % pThis->cTxFrames;
+    return pSlot;
+}
+
+
+/**
+ * Hands a filled transmit ring slot to the kernel.
+ *
+ * @param   pThis           The instance data.
+ * @param   pSlot           The slot.
+ * @param   cbData          The number of bytes at DRVAFPACKET_TX_DATA_OFFSET,
+ *                          including any virtio-net header.
+ */
+static void drvAFPacketXmitCommitSlot(PDRVAFPACKET pThis, struct tpacket3_hdr *pSlot, uint32_t cbData)
+{
+    pSlot->tp_len         = cbData;
+    pSlot->tp_next_offset = 0;
+    ASMAtomicWriteU32((uint32_t volatile *)&pSlot->tp_status, TP_STATUS_SEND_REQUEST);
+
+    if (++pThis->cTxPending >= pThis->cTxFrames / 2)
+        drvAFPacketXmitKick(pThis, false /*fWait*/);
+}
+
+
+/**
+ * Gives back a reserved transmit ring slot that won't be sent after all.
+ *
+ * The kernel processes the ring in order and stops at the first slot which
+ * isn't requesting to be sent, so a hole would stall the ring.  Any slots
+ * committed after this one are therefore moved down one slot; the kernel
+ * cannot have looked at them yet for the same reason.
+ *
+ * @param   pThis           The instance data.
+ * @param   pSlot           The slot.
+ */
+static void drvAFPacketXmitReleaseSlot(PDRVAFPACKET pThis, struct tpacket3_hdr *pSlot)
+{
+    uint32_t iNext = (uint32_t)(((uint8_t *)pSlot - pThis->pbTxRing) / pThis->cbTxFrame);
+    Assert(drvAFPacketTxSlot(pThis, iNext) == pSlot);
+    for (iNext = (iNext + 1) % pThis->cTxFrames; iNext != pThis->iTxFrame; iNext = (iNext + 1) % pThis->cTxFrames)
+    {
+        struct tpacket3_hdr *pNext = drvAFPacketTxSlot(pThis, iNext);
+        Assert(pNext->tp_status == TP_STATUS_SEND_REQUEST);
+        memcpy((uint8_t *)pSlot + DRVAFPACKET_TX_DATA_OFFSET, (uint8_t *)pNext + DRVAFPACKET_TX_DATA_OFFSET, pNext->tp_len);
+        pSlot->tp_len         = pNext->tp_len;
+        pSlot->tp_next_offset = 0;
+        ASMAtomicWriteU32((uint32_t volatile *)&pSlot->tp_status, TP_STATUS_SEND_REQUEST);
+        pSlot = pNext;
+    }
+    ASMAtomicWriteU32((uint32_t volatile *)&pSlot->tp_status, TP_STATUS_AVAILABLE);
+    pThis->iTxFrame = (pThis->iTxFrame + pThis->cTxFrames - 1) % pThis->cTxFrames;
+}
+
+
+/**
+ * Sends a frame by copying it into the transmit ring, or by a plain send() if
+ * we don't have one.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The instance data.
+ * @param   pHdr            The virtio-net header if fVNetHdr, NULL otherwise.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+static int drvAFPacketXmitCopy(PDRVAFPACKET pThis, PCHOSTVNETHDR pHdr, void const *pvFrame, size_t cbFrame)
+{
+    size_t const cbHdr = pHdr ? sizeof(*pHdr) : 0;
+    if (pThis->pbTxRing)
+    {
+        if (RT_UNLIKELY(DRVAFPACKET_TX_DATA_OFFSET + cbHdr + cbFrame > pThis->cbTxFrame))
+            return VERR_BUFFER_OVERFLOW;
+        struct tpacket3_hdr *pSlot = drvAFPacketXmitReserveSlot(pThis);
+        if (RT_UNLIKELY(!pSlot))
+        {
+            STAM_REL_COUNTER_INC(&pThis->StatXmitRingFull);
+            return VERR_NET_NO_BUFFER_SPACE;
+        }
+        uint8_t *pbDst = (uint8_t *)pSlot + DRVAFPACKET_TX_DATA_OFFSET;
+        if (pHdr)
+            memcpy(pbDst, pHdr, cbHdr);
+        memcpy(pbDst + cbHdr, pvFrame, cbFrame);
+        drvAFPacketXmitCommitSlot(pThis, pSlot, (uint32_t)(cbHdr + cbFrame));
+        return VINF_SUCCESS;
+    }
+
+    struct iovec aSegs[2];
+    aSegs[0].iov_base = (void *)pHdr;
+    aSegs[0].iov_len  = cbHdr;
+    aSegs[1].iov_base = (void *)pvFrame;
+    aSegs[1].iov_len  = cbFrame;
+    struct msghdr Msg;
+    RT_ZERO(Msg);
+    Msg.msg_iov    = pHdr ? &aSegs[0] : &aSegs[1];
+    Msg.msg_iovlen = pHdr ? 2 : 1;
+    ssize_t cbSent = sendmsg(pThis->iSocket, &Msg, 0);
+    if (cbSent < 0)
+        return errno == ENOBUFS || errno == EAGAIN ? VERR_NET_NO_BUFFER_SPACE : RTErrConvertFromErrno(errno);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
+ */
+static DECLCALLBACK(int) drvAFPacketNetworkUp_BeginXmit(PPDMINETWORKUP pInterface, bool fOnWorkerThread)
+{
+    RT_NOREF(fOnWorkerThread);
+    PDRVAFPACKET pThis = PDMINETWORKUP_2_DRVAFPACKET(pInterface);
+    int rc = RTCritSectTryEnter(&pThis->XmitLock);
+    if (RT_FAILURE(rc))
+        rc = VERR_TRY_AGAIN;
+    return rc;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnAllocBuf}
+ */
+static DECLCALLBACK(int) drvAFPacketNetworkUp_AllocBuf(PPDMINETWORKUP pInterface, size_t cbMin,
+                                                       PCPDMNETWORKGSO pGso, PPPDMSCATTERGATHER ppSgBuf)
+{
+    PDRVAFPACKET pThis = PDMINETWORKUP_2_DRVAFPACKET(pInterface);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+    if (RT_UNLIKELY(cbMin > DRVAFPACKET_MAX_FRAME))
+        return VERR_NO_MEMORY;
+
+    PPDMSCATTERGATHER pSgBuf = (PPDMSCATTERGATHER)RTMemCacheAlloc(pThis->hSgCache);
+    if (!pSgBuf)
+        return VERR_NO_MEMORY;
+    PPDMNETWORKGSO pGsoCopy = (PPDMNETWORKGSO)(pSgBuf + 1);
+
+    /*
+     * Try to place the frame directly in the transmit ring.  This is possible
+     * for one buffer at a time when the frame fits the slot and the host can
+     * take care of any segmentation.
+     */
+    HOSTVNETHDR VNetHdr;
+    size_t const cbHdr = pThis->fVNetHdr ? sizeof(HOSTVNETHDR) : 0;
+    if (   pThis->pbTxRing
+        && !pThis->pSgTxRing
+        && DRVAFPACKET_TX_DATA_OFFSET + cbHdr + cbMin <= pThis->cbTxFrame
+        && (!pGso || (pThis->fVNetHdr && HostVNetHdrFromGso(&VNetHdr, pGso))))
+    {
+        struct tpacket3_hdr *pSlot = drvAFPacketXmitReserveSlot(pThis);
+        if (pSlot)
+        {
+            pSgBuf->fFlags         = PDMSCATTERGATHER_FLAGS_MAGIC | PDMSCATTERGATHER_FLAGS_OWNER_1;
+            pSgBuf->cbUsed         = 0;
+            pSgBuf->cbAvailable    = pThis->cbTxFrame - DRVAFPACKET_TX_DATA_OFFSET - cbHdr;
+            pSgBuf->pvAllocator    = pSlot;
+            pSgBuf->cSegs          = 1;
+            pSgBuf->aSegs[0].cbSeg = pSgBuf->cbAvailable;
+            pSgBuf->aSegs[0].pvSeg = (uint8_t *)pSlot + DRVAFPACKET_TX_DATA_OFFSET + cbHdr;
+            if (pGso)
+            {
+                *pGsoCopy = *pGso;
+                pSgBuf->pvUser = pGsoCopy;
+            }
+            else
+                pSgBuf->pvUser = NULL;
+            pThis->pSgTxRing = pSgBuf;
+            *ppSgBuf = pSgBuf;
+            return VINF_SUCCESS;
+        }
+    }
+
+    /*
+     * Fall back on a heap buffer which gets copied (and segmented if needed)
+     * into the ring when sent.
+     */
+    void *pvBuf = RTMemAlloc(RT_ALIGN_Z(cbMin, 16));
+    if (!pvBuf)
+    {
+        RTMemCacheFree(pThis->hSgCache, pSgBuf);
+        return VERR_NO_MEMORY;
+    }
+    pSgBuf->fFlags         = PDMSCATTERGATHER_FLAGS_MAGIC | PDMSCATTERGATHER_FLAGS_OWNER_1;
+    pSgBuf->cbUsed         = 0;
+    pSgBuf->cbAvailable    = RT_ALIGN_Z(cbMin, 16);
+    pSgBuf->pvAllocator    = NULL;
+    pSgBuf->cSegs          = 1;
+    pSgBuf->aSegs[0].cbSeg = pSgBuf->cbAvailable;
+    pSgBuf->aSegs[0].pvSeg = pvBuf;
+    if (pGso)
+    {
+        *pGsoCopy = *pGso;
+        pSgBuf->pvUser = pGsoCopy;
+    }
+    else
+        pSgBuf->pvUser = NULL;
+    *ppSgBuf = pSgBuf;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Releases a scatter/gather buffer allocated by drvAFPacketNetworkUp_AllocBuf.
+ *
+ * @param   pThis           The instance data.
+ * @param   pSgBuf          The buffer.
+ */
+static void drvAFPacketFreeSgBuf(PDRVAFPACKET pThis, PPDMSCATTERGATHER pSgBuf)
+{
+    Assert((pSgBuf->fFlags & PDMSCATTERGATHER_FLAGS_MAGIC_MASK) == PDMSCATTERGATHER_FLAGS_MAGIC);
+    if (pSgBuf->pvAllocator)
+    {
+        /* The ring slot has been committed or released by the caller. */
+        Assert(pThis->pSgTxRing == pSgBuf);
+        pThis->pSgTxRing = NULL;
+    }
+    else
+        RTMemFree(pSgBuf->aSegs[0].pvSeg);
+    pSgBuf->fFlags = 0;
+    RTMemCacheFree(pThis->hSgCache, pSgBuf);
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnFreeBuf}
+ */
+static DECLCALLBACK(int) drvAFPacketNetworkUp_FreeBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf)
+{
+    PDRVAFPACKET pThis = PDMINETWORKUP_2_DRVAFPACKET(pInterface);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+    if (pSgBuf)
+    {
+        if (pSgBuf->pvAllocator)
+            drvAFPacketXmitReleaseSlot(pThis, (struct tpacket3_hdr *)pSgBuf->pvAllocator);
+        drvAFPacketFreeSgBuf(pThis, pSgBuf);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBuf}
+ */
+static DECLCALLBACK(int) drvAFPacketNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    RT_NOREF(fOnWorkerThread);
+    PDRVAFPACKET pThis = PDMINETWORKUP_2_DRVAFPACKET(pInterface);
+    STAM_PROFILE_START(&pThis->StatTransmit, a);
+
+    AssertPtr(pSgBuf);
+    Assert((pSgBuf->fFlags & PDMSCATTERGATHER_FLAGS_MAGIC_MASK) == PDMSCATTERGATHER_FLAGS_MAGIC);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+    Assert(pSgBuf->cbUsed <= pSgBuf->cbAvailable);
+
+    /* Set an FTM checkpoint as this operation changes the state permanently. */
+    PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
+
+    int             rc       = VINF_SUCCESS;
+    uint8_t        *pbFrame  = (uint8_t *)pSgBuf->aSegs[0].pvSeg;
+    size_t const    cbFrame  = pSgBuf->cbUsed;
+    PCPDMNETWORKGSO pGso     = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+    HOSTVNETHDR     VNetHdr;
+    Log2(("drvAFPacketSend: pbFrame=%p cbUsed=%#x pGso=%p\n" "%.*Rhxd\n",
+          pbFrame, cbFrame, pGso, RT_MIN(cbFrame, 64), pbFrame));
+
+    if (pSgBuf->pvAllocator)
+    {
+        /*
+         * Zero copy: the frame is already in the ring slot, just fill in the
+         * virtio-net header in front of it and hand it over.
+         */
+        struct tpacket3_hdr *pSlot = (struct tpacket3_hdr *)pSgBuf->pvAllocator;
+        uint32_t cbHdr = 0;
+        if (pThis->fVNetHdr)
+        {
+            bool fOk = HostVNetHdrFromGso(&VNetHdr, pGso); Assert(fOk); NOREF(fOk);
+            if (pGso)
+            {
+                PDMNetGsoPrepForDirectUse(pGso, pbFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+                STAM_COUNTER_INC(&pThis->StatPktSentGso);
+            }
+            cbHdr = sizeof(VNetHdr);
+            memcpy((uint8_t *)pSlot + DRVAFPACKET_TX_DATA_OFFSET, &VNetHdr, cbHdr);
+        }
+        drvAFPacketXmitCommitSlot(pThis, pSlot, cbHdr + (uint32_t)cbFrame);
+    }
+    else if (!pGso)
+    {
+        HostVNetHdrFromGso(&VNetHdr, NULL);
+        rc = drvAFPacketXmitCopy(pThis, pThis->fVNetHdr ? &VNetHdr : NULL, pbFrame, cbFrame);
+    }
+    else if (   pThis->fVNetHdr
+             && HostVNetHdrFromGso(&VNetHdr, pGso)
+             && (   !pThis->pbTxRing
+                 || DRVAFPACKET_TX_DATA_OFFSET + sizeof(VNetHdr) + cbFrame <= pThis->cbTxFrame))
+    {
+        PDMNetGsoPrepForDirectUse(pGso, pbFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+        rc = drvAFPacketXmitCopy(pThis, &VNetHdr, pbFrame, cbFrame);
+        if (RT_SUCCESS(rc))
+            STAM_COUNTER_INC(&pThis->StatPktSentGso);
+    }
+    else
+    {
+        /*
+         * Segment it ourselves.
+         */
+        uint8_t         abHdrScratch[256];
+        uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+        HostVNetHdrFromGso(&VNetHdr, NULL);
+        for (uint32_t iSeg = 0; iSeg < cSegs && RT_SUCCESS(rc); iSeg++)
+        {
+            uint32_t cbSegFrame;
+            void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, cbFrame, abHdrScratch,
+                                                       iSeg, cSegs, &cbSegFrame);
+            rc = drvAFPacketXmitCopy(pThis, pThis->fVNetHdr ? &VNetHdr : NULL, pvSegFrame, cbSegFrame);
+        }
+    }
+
+    drvAFPacketFreeSgBuf(pThis, pSgBuf);
+
+    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
+    if (RT_SUCCESS(rc))
+    {
+        STAM_COUNTER_INC(&pThis->StatPktSent);
+        STAM_COUNTER_ADD(&pThis->StatPktSentBytes, cbFrame);
+    }
+    else
+    {
+        LogFlow(("drvAFPacketSend: failed with %Rrc\n", rc));
+        rc = rc == VERR_NO_MEMORY || rc == VERR_NET_NO_BUFFER_SPACE ? VERR_NET_NO_BUFFER_SPACE : VERR_NET_DOWN;
+    }
+    return rc;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
+ */
+static DECLCALLBACK(void) drvAFPacketNetworkUp_EndXmit(PPDMINETWORKUP pInterface)
+{
+    PDRVAFPACKET pThis = PDMINETWORKUP_2_DRVAFPACKET(pInterface);
+    /* One kick per transmit session is what batches the frames. */
+    drvAFPacketXmitKick(pThis, false /*fWait*/);
+    RTCritSectLeave(&pThis->XmitLock);
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSetPromiscuousMode}
+ */
+static DECLCALLBACK(void) drvAFPacketNetworkUp_SetPromiscuousMode(PPDMINETWORKUP pInterface, bool fPromiscuous)
+{
+    RT_NOREF(pInterface, fPromiscuous);
+    LogFlow(("drvAFPacketNetworkUp_SetPromiscuousMode: fPromiscuous=%d\n", fPromiscuous));
+    /* The host interface is always put into promiscuous mode, nothing to do. */
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnNotifyLinkChanged}
+ */
+static DECLCALLBACK(void) drvAFPacketNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInterface, PDMNETWORKLINKSTATE enmLinkState)
+{
+    RT_NOREF(pInterface, enmLinkState);
+    LogFlow(("drvAFPacketNetworkUp_NotifyLinkChanged: enmLinkState=%d\n", enmLinkState));
+}
+
+
+/**
+ * Passes a received frame up to the device, segmenting GSO frames if the
+ * device can't take them as they are.
+ *
+ * @returns VBox status code, failure if the VM is changing state.
+ * @param   pThis           The instance data.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The frame size.
+ * @param   pGso            The GSO context, NULL if plain frame.
+ */
+static int drvAFPacketRecvFrame(PDRVAFPACKET pThis, uint8_t *pbFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+    STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    STAM_COUNTER_INC(&pThis->StatPktRecv);
+    STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbFrame);
+    Log2(("drvAFPacketRecvFrame: cbFrame=%#x pGso=%p\n" "%.*Rhxd\n", cbFrame, pGso, RT_MIN(cbFrame, 64), pbFrame));
+
+    if (!pGso)
+        return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbFrame, cbFrame);
+
+    STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+    PDMNetGsoPrepForDirectUse(pGso, pbFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+    if (   pThis->pIAboveNet->pfnReceiveGso
+        && RT_SUCCESS(pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, pGso)))
+        return VINF_SUCCESS;
+
+    /* The device doesn't do LRO, carve it up. */
+    uint8_t         abHdrScratch[256];
+    uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegFrame;
+        void    *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        if (iSeg > 0)
+        {
+            STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+            rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+            STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+        AssertRC(rc);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Processes one packet from a retired receive ring block.
+ *
+ * @param   pThis           The instance data.
+ * @param   pPktHdr         The packet header in the ring.
+ * @param   offPkt          The offset of the packet header into the block.
+ */
+static void drvAFPacketRecvPacket(PDRVAFPACKET pThis, struct tpacket3_hdr *pPktHdr, size_t offPkt)
+{
+    uint8_t *pbFrame = (uint8_t *)pPktHdr + pPktHdr->tp_mac;
+    size_t   cbFrame = pPktHdr->tp_snaplen;
+    if (RT_UNLIKELY(   pPktHdr->tp_snaplen != pPktHdr->tp_len
+                    || cbFrame < sizeof(RTNETETHERHDR)
+                    || cbFrame > DRVAFPACKET_MAX_FRAME
+                    || offPkt + pPktHdr->tp_mac + cbFrame > pThis->cbRxBlock))
+    {
+        STAM_REL_COUNTER_INC(&pThis->StatRecvBad);
+        return;
+    }
+
+    /*
+     * Reinsert the VLAN tag the NIC stripped.  The ring doesn't have room
+     * in front of the frame for it, so this takes the scratch buffer.
+     */
+    if (   (pPktHdr->tp_status & TP_STATUS_VLAN_VALID)
+        && cbFrame + sizeof(uint32_t) <= DRVAFPACKET_MAX_FRAME)
+    {
+        uint8_t *pbDst = pThis->pbRxScratch;
+#ifdef TP_STATUS_VLAN_TPID_VALID
+        uint16_t uTpid = pPktHdr->tp_status & TP_STATUS_VLAN_TPID_VALID ? (uint16_t)pPktHdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+#else
+        uint16_t uTpid = ETH_P_8021Q;
+#endif
+        memcpy(pbDst, pbFrame, 2 * sizeof(RTMAC));
+        pbDst[12] = RT_HI_U8(uTpid);
+        pbDst[13] = RT_LO_U8(uTpid);
+        uint16_t uTci  = (uint16_t)pPktHdr->hv1.tp_vlan_tci;
+        pbDst[14] = RT_HI_U8(uTci);
+        pbDst[15] = RT_LO_U8(uTci);
+        memcpy(pbDst + 16, pbFrame + 12, cbFrame - 12);
+        if (pThis->fVNetHdr)
+            memcpy(pbDst - sizeof(HOSTVNETHDR), pbFrame - sizeof(HOSTVNETHDR), sizeof(HOSTVNETHDR));
+        pbFrame  = pbDst;
+        cbFrame += sizeof(uint32_t);
+    }
+    else if (pPktHdr->tp_status & TP_STATUS_VLAN_VALID)
+    {
+        /* Passing it on untagged would put it on the wrong network. */
+        LogRelMax(32, ("AFPacket#%d: Dropping VLAN %#x frame of %#zx bytes, no room for the tag\n",
+                       pThis->pDrvIns->iInstance, (uint16_t)pPktHdr->hv1.tp_vlan_tci, cbFrame));
+        STAM_REL_COUNTER_INC(&pThis->StatRecvBad);
+        return;
+    }
+
+    /*
+     * Deal with the offloading the host left for us to do.  Frames sent by
+     * the host itself carry a partial checksum.
+     */
+    PDMNETWORKGSO   Gso;
+    PCPDMNETWORKGSO pGso = NULL;
+    if (pThis->fVNetHdr)
+    {
+        HOSTVNETHDR VNetHdr;
+        memcpy(&VNetHdr, pbFrame - sizeof(VNetHdr), sizeof(VNetHdr));
+        if (pbFrame == pThis->pbRxScratch && (VNetHdr.u8Flags & HOSTVNETHDR_F_NEEDS_CSUM))
+            VNetHdr.u16CSumStart += sizeof(uint32_t);
+        if (VNetHdr.u8GsoType != HOSTVNETHDR_GSO_NONE)
+        {
+            pGso = HostVNetHdrToGso(&VNetHdr, pbFrame, cbFrame, &Gso);
+            if (!pGso)
+            {
+                STAM_REL_COUNTER_INC(&pThis->StatRecvBad);
+                return;
+            }
+        }
+        else if (!HostVNetHdrCompleteChecksum(&VNetHdr, pbFrame, cbFrame))
+        {
+            STAM_REL_COUNTER_INC(&pThis->StatRecvBad);
+            return;
+        }
+    }
+    else if (pPktHdr->tp_status & TP_STATUS_CSUMNOTREADY)
+        LogFlow(("drvAFPacketRecvPacket: partial checksum without vnet header (%#x bytes)\n", cbFrame));
+
+    drvAFPacketRecvFrame(pThis, pbFrame, cbFrame, pGso);
+}
+
+
+/**
+ * Asynchronous I/O thread for handling receive.
+ *
+ * @returns VINF_SUCCESS (ignored).
+ * @param   pDrvIns         The driver instance.
+ * @param   pThread         The thread.
+ */
+static DECLCALLBACK(int) drvAFPacketAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVAFPACKET pThis = PDMINS_2_DATA(pDrvIns, PDRVAFPACKET);
+    LogFlow(("drvAFPacketAsyncIoThread: pThis=%p\n", pThis));
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        struct tpacket_block_desc *pBlock = (struct tpacket_block_desc *)(pThis->pbRing + (size_t)pThis->iRxBlock * pThis->cbRxBlock);
+        if (!(ASMAtomicReadU32((uint32_t volatile *)&pBlock->hdr.bh1.block_status) & TP_STATUS_USER))
+        {
+            /*
+             * Wait for the kernel to retire the block.
+             */
+            struct pollfd aFDs[2];
+            aFDs[0].fd      = pThis->iSocket;
+            aFDs[0].events  = POLLIN | POLLERR;
+            aFDs[0].revents = 0;
+            aFDs[1].fd      = RTPipeToNative(pThis->hPipeRead);
+            aFDs[1].events  = POLLIN | POLLPRI | POLLERR | POLLHUP;
+            aFDs[1].revents = 0;
+            STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+            int rc = poll(&aFDs[0], RT_ELEMENTS(aFDs), -1 /* infinite */);
+            STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+
+            if (rc > 0 && aFDs[1].revents)
+            {
+                if (aFDs[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+                    break;
+                /* drain the pipe */
+                char ch;
+                size_t cbRead;
+                RTPipeRead(pThis->hPipeRead, &ch, 1, &cbRead);
+            }
+            else if (rc < 0)
+            {
+                if (errno != EINTR)
+                    AssertMsgFailed(("poll: errno=%d %s\n", errno, strerror(errno)));
+                RTThreadYield();
+            }
+            continue;
+        }
+
+        /*
+         * Pass up every packet in the block straight out of the ring, then give
+         * the block back to the kernel.
+         */
+        STAM_COUNTER_INC(&pThis->StatRecvBlocks);
+        uint32_t const       cPkts   = pBlock->hdr.bh1.num_pkts;
+        struct tpacket3_hdr *pPktHdr = (struct tpacket3_hdr *)((uint8_t *)pBlock + pBlock->hdr.bh1.offset_to_first_pkt);
+        bool                 fLosing = false;
+        for (uint32_t iPkt = 0; iPkt < cPkts && pThread->enmState == PDMTHREADSTATE_RUNNING; iPkt++)
+        {
+            size_t const offPkt = (uint8_t *)pPktHdr - (uint8_t *)pBlock;
+            if (RT_UNLIKELY(offPkt + sizeof(*pPktHdr) > pThis->cbRxBlock))
+            {
+                STAM_REL_COUNTER_INC(&pThis->StatRecvBad);
+                break;
+            }
+            fLosing |= RT_BOOL(pPktHdr->tp_status & TP_STATUS_LOSING);
+            drvAFPacketRecvPacket(pThis, pPktHdr, offPkt);
+            pPktHdr = (struct tpacket3_hdr *)((uint8_t *)pPktHdr + pPktHdr->tp_next_offset);
+        }
+
+        ASMAtomicWriteU32((uint32_t volatile *)&pBlock->hdr.bh1.block_status, TP_STATUS_KERNEL);
+        pThis->iRxBlock = (pThis->iRxBlock + 1) % pThis->cRxBlocks;
+
+        if (fLosing)
+        {
+            /* Reading the statistics resets them as well as the losing indicator. */
+            struct tpacket_stats_v3 Stats;
+            socklen_t               cbStats = sizeof(Stats);
+            if (!getsockopt(pThis->iSocket, SOL_PACKET, PACKET_STATISTICS, &Stats, &cbStats))
+                STAM_REL_COUNTER_ADD(&pThis->StatRecvDropped, Stats.tp_drops);
+        }
+    }
+
+    LogFlow(("drvAFPacketAsyncIoThread: returns %Rrc\n", VINF_SUCCESS));
+    STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Unblock the receive thread so it can respond to a state change.
+ *
+ * @returns VBox status code.
+ * @param   pDrvIns     The driver instance.
+ * @param   pThread     The receive thread.
+ */
+static DECLCALLBACK(int) drvAFPacketAsyncIoWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    RT_NOREF(pThread);
+    PDRVAFPACKET pThis = PDMINS_2_DATA(pDrvIns, PDRVAFPACKET);
+
+    size_t cbIgnored;
+    int rc = RTPipeWrite(pThis->hPipeWrite, "", 1, &cbIgnored);
+    AssertRC(rc);
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates, binds and maps the packet socket rings.
+ *
+ * @returns VBox status code, error set.
+ * @param   pThis           The instance data.
+ * @param   cTxFrames       The number of transmit ring slots to try for.
+ * @param   fQdiscBypass    Whether to bypass the host queueing discipline.
+ */
+static int drvAFPacketOpen(PDRVAFPACKET pThis, uint32_t cTxFrames, bool fQdiscBypass)
+{
+    PPDMDRVINS pDrvIns = pThis->pDrvIns;
+
+    pThis->iIfIndex = if_nametoindex(pThis->pszDeviceName);
+    if (!pThis->iIfIndex)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INTNET_FLT_IF_NOT_FOUND, RT_SRC_POS,
+                                   N_("AFPacket#%d: Host interface '%s' not found"), pDrvIns->iInstance, pThis->pszDeviceName);
+
+    pThis->iSocket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (pThis->iSocket < 0)
+        return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                   N_("AFPacket#%d: Failed to create a packet socket (errno=%d). The VM process requires CAP_NET_RAW for this attachment type"),
+                                   pDrvIns->iInstance, errno);
+
+    int iVal;
+    if (pThis->fVNetHdr)
+    {
+        iVal = 1;
+        if (setsockopt(pThis->iSocket, SOL_PACKET, PACKET_VNET_HDR, &iVal, sizeof(iVal)))
+            return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                       N_("AFPacket#%d: The host does not support PACKET_VNET_HDR (errno=%d)"), pDrvIns->iInstance, errno);
+    }
+
+    iVal = TPACKET_V3;
+    if (setsockopt(pThis->iSocket, SOL_PACKET, PACKET_VERSION, &iVal, sizeof(iVal)))
+        return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                   N_("AFPacket#%d: The host does not support TPACKET_V3 (errno=%d)"), pDrvIns->iInstance, errno);
+
+    /*
+     * The receive ring.  Blocks are retired either when full or after the
+     * timeout, so the timeout bounds the latency of a lone frame.
+     */
+    struct tpacket_req3 Req;
+    RT_ZERO(Req);
+    Req.tp_block_size       = pThis->cbRxBlock;
+    Req.tp_block_nr         = pThis->cRxBlocks;
+    Req.tp_frame_size       = TPACKET_ALIGNMENT << 7;
+    Req.tp_frame_nr         = (pThis->cbRxBlock / Req.tp_frame_size) * pThis->cRxBlocks;
+    Req.tp_retire_blk_tov   = pThis->cMsRxBlockTimeout;
+    Req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    if (setsockopt(pThis->iSocket, SOL_PACKET, PACKET_RX_RING, &Req, sizeof(Req)))
+        return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                   N_("AFPacket#%d: Failed to set up the receive ring (errno=%d)"), pDrvIns->iInstance, errno);
+    size_t const cbRxRing = (size_t)pThis->cbRxBlock * pThis->cRxBlocks;
+
+    /*
+     * The transmit ring.  TPACKET_V3 transmit rings need Linux 4.11, fall back
+     * on sendmsg() if that fails.  Each slot takes a whole frame, including
+     * GSO frames when the host does the segmentation for us.
+     */
+    size_t cbTxRing = 0;
+    if (cTxFrames)
+    {
+        uint32_t const cbTxFrame = RT_ALIGN_32(DRVAFPACKET_TX_DATA_OFFSET + (pThis->fVNetHdr ? sizeof(HOSTVNETHDR) : 0)
+                                               + (pThis->fVNetHdr ? DRVAFPACKET_MAX_FRAME : 2048 - 64), TPACKET_ALIGNMENT);
+        RT_ZERO(Req);
+        Req.tp_block_size = RT_ALIGN_32(cbTxFrame, PAGE_SIZE);
+        Req.tp_frame_size = Req.tp_block_size > _16K ? Req.tp_block_size : cbTxFrame;
+        Req.tp_block_nr   = (cTxFrames + Req.tp_block_size / Req.tp_frame_size - 1) / (Req.tp_block_size / Req.tp_frame_size);
+        Req.tp_frame_nr   = Req.tp_block_nr * (Req.tp_block_size / Req.tp_frame_size);
+        if (!setsockopt(pThis->iSocket, SOL_PACKET, PACKET_TX_RING, &Req, sizeof(Req)))
+        {
+            pThis->cbTxFrame = Req.tp_frame_size;
+            pThis->cTxFrames = Req.tp_frame_nr;
+            cbTxRing = (size_t)Req.tp_block_size * Req.tp_block_nr;
+        }
+        else
+            LogRel(("AFPacket#%d: No transmit ring (errno=%d), using sendmsg.\n", pDrvIns->iInstance, errno));
+    }
+
+    pThis->cbRing = cbRxRing + cbTxRing;
+    void *pvRing = mmap(NULL, pThis->cbRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, pThis->iSocket, 0);
+    if (pvRing == MAP_FAILED)
+        pvRing = mmap(NULL, pThis->cbRing, PROT_READ | PROT_WRITE, MAP_SHARED, pThis->iSocket, 0);
+    if (pvRing == MAP_FAILED)
+    {
+        pThis->cbRing = 0;
+        return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                   N_("AFPacket#%d: Failed to map the packet rings (errno=%d)"), pDrvIns->iInstance, errno);
+    }
+    pThis->pbRing   = (uint8_t *)pvRing;
+    pThis->pbTxRing = cbTxRing ? pThis->pbRing + cbRxRing : NULL;
+
+    if (fQdiscBypass)
+    {
+        iVal = 1;
+        if (setsockopt(pThis->iSocket, SOL_PACKET, PACKET_QDISC_BYPASS, &iVal, sizeof(iVal)))
+            LogRel(("AFPacket#%d: PACKET_QDISC_BYPASS not supported (errno=%d)\n", pDrvIns->iInstance, errno));
+    }
+
+    /*
+     * Bind to the interface and make it accept the guest's unicast traffic.
+     */
+    struct sockaddr_ll Addr;
+    RT_ZERO(Addr);
+    Addr.sll_family   = AF_PACKET;
+    Addr.sll_protocol = htons(ETH_P_ALL);
+    Addr.sll_ifindex  = pThis->iIfIndex;
+    if (bind(pThis->iSocket, (struct sockaddr *)&Addr, sizeof(Addr)))
+        return PDMDrvHlpVMSetError(pDrvIns, RTErrConvertFromErrno(errno), RT_SRC_POS,
+                                   N_("AFPacket#%d: Failed to bind to host interface '%s' (errno=%d)"),
+                                   pDrvIns->iInstance, pThis->pszDeviceName, errno);
+
+    struct packet_mreq Mreq;
+    RT_ZERO(Mreq);
+    Mreq.mr_ifindex = pThis->iIfIndex;
+    Mreq.mr_type    = PACKET_MR_PROMISC;
+    if (setsockopt(pThis->iSocket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &Mreq, sizeof(Mreq)))
+        LogRel(("AFPacket#%d: Failed to make '%s' promiscuous (errno=%d)\n", pDrvIns->iInstance, pThis->pszDeviceName, errno));
+
+    LogRel(("AFPacket#%d: Attached to '%s' (ifindex %d): rx %u x %#x, tx %u x %#x, vnet hdr %RTbool\n",
+            pDrvIns->iInstance, pThis->pszDeviceName, pThis->iIfIndex, pThis->cRxBlocks, pThis->cbRxBlock,
+            pThis->cTxFrames, pThis->cbTxFrame, pThis->fVNetHdr));
+    return VINF_SUCCESS;
+}
+
+
+/* -=-=-=-=- PDMIBASE -=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) drvAFPacketQueryInterface(PPDMIBASE pInterface, const char *pszIID)
+{
+    PPDMDRVINS      pDrvIns = PDMIBASE_2_PDMDRV(pInterface);
+    PDRVAFPACKET    pThis   = PDMINS_2_DATA(pDrvIns, PDRVAFPACKET);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBASE, &pDrvIns->IBase);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMINETWORKUP, &pThis->INetworkUp);
+    return NULL;
+}
+
+/* -=-=-=-=- PDMDRVREG -=-=-=-=- */
+
+/**
+ * Destruct a driver instance.
+ *
+ * Most VM resources are freed by the VM. This callback is provided so that any non-VM
+ * resources can be freed correctly.
+ *
+ * @param   pDrvIns     The driver instance data.
+ */
+static DECLCALLBACK(void) drvAFPacketDestruct(PPDMDRVINS pDrvIns)
+{
+    LogFlow(("drvAFPacketDestruct\n"));
+    PDRVAFPACKET pThis = PDMINS_2_DATA(pDrvIns, PDRVAFPACKET);
+    PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
+
+    int rc;
+    if (pThis->hPipeWrite != NIL_RTPIPE)
+    {
+        rc = RTPipeClose(pThis->hPipeWrite); AssertRC(rc);
+        pThis->hPipeWrite = NIL_RTPIPE;
+    }
+    if (pThis->hPipeRead != NIL_RTPIPE)
+    {
+        rc = RTPipeClose(pThis->hPipeRead); AssertRC(rc);
+        pThis->hPipeRead = NIL_RTPIPE;
+    }
+
+    if (pThis->pbRing)
+    {
+        munmap(pThis->pbRing, pThis->cbRing);
+        pThis->pbRing   = NULL;
+        pThis->pbTxRing = NULL;
+    }
+    if (pThis->iSocket >= 0)
+    {
+        close(pThis->iSocket);
+        pThis->iSocket = -1;
+    }
+
+    if (pThis->pbRxScratch)
+    {
+        RTMemFree(pThis->pbRxScratch - sizeof(HOSTVNETHDR));
+        pThis->pbRxScratch = NULL;
+    }
+    if (pThis->hSgCache != NIL_RTMEMCACHE)
+    {
+        RTMemCacheDestroy(pThis->hSgCache);
+        pThis->hSgCache = NIL_RTMEMCACHE;
+    }
+
+    MMR3HeapFree(pThis->pszDeviceName);
+    pThis->pszDeviceName = NULL;
+
+    if (RTCritSectIsInitialized(&pThis->XmitLock))
+        RTCritSectDelete(&pThis->XmitLock);
+
+    /*
+     * Deregister statistics.
+     */
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvDropped);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvBad);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatXmitRingFull);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatXmitWrongFormat);
+#ifdef VBOX_WITH_STATISTICS
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSent);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatXmitKicks);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvBlocks);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
+#endif /* VBOX_WITH_STATISTICS */
+}
+
+
+/**
+ * Construct an AF_PACKET network transport driver instance.
+ *
+ * @copydoc FNPDMDRVCONSTRUCT
+ */
+static DECLCALLBACK(int) drvAFPacketConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint32_t fFlags)
+{
+    RT_NOREF(fFlags);
+    PDMDRV_CHECK_VERSIONS_RETURN(pDrvIns);
+    PDRVAFPACKET pThis = PDMINS_2_DATA(pDrvIns, PDRVAFPACKET);
+
+    /*
+     * Init the static parts.
+     */
+    pThis->pDrvIns                              = pDrvIns;
+    pThis->iSocket                              = -1;
+    pThis->hPipeWrite                           = NIL_RTPIPE;
+    pThis->hPipeRead                            = NIL_RTPIPE;
+    pThis->hSgCache                             = NIL_RTMEMCACHE;
+
+    /* IBase */
+    pDrvIns->IBase.pfnQueryInterface            = drvAFPacketQueryInterface;
+    /* INetwork */
+    pThis->INetworkUp.pfnBeginXmit              = drvAFPacketNetworkUp_BeginXmit;
+    pThis->INetworkUp.pfnAllocBuf               = drvAFPacketNetworkUp_AllocBuf;
+    pThis->INetworkUp.pfnFreeBuf                = drvAFPacketNetworkUp_FreeBuf;
+    pThis->INetworkUp.pfnSendBuf                = drvAFPacketNetworkUp_SendBuf;
+    pThis->INetworkUp.pfnEndXmit                = drvAFPacketNetworkUp_EndXmit;
+    pThis->INetworkUp.pfnSetPromiscuousMode     = drvAFPacketNetworkUp_SetPromiscuousMode;
+    pThis->INetworkUp.pfnNotifyLinkChanged      = drvAFPacketNetworkUp_NotifyLinkChanged;
+
+    /*
+     * Statistics.
+     */
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvDropped,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Frames dropped by the host because the receive ring was full.", "/Drivers/AFPacket%d/Packets/RecvDropped", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvBad,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Truncated, malformed or untaggable frames dropped.", "/Drivers/AFPacket%d/Packets/RecvBad", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatXmitRingFull,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Frames dropped because the transmit ring was full.", "/Drivers/AFPacket%d/Packets/XmitRingFull", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatXmitWrongFormat, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Frames the host rejected as malformed.",   "/Drivers/AFPacket%d/Packets/XmitWrongFormat", pDrvIns->iInstance);
+#ifdef VBOX_WITH_STATISTICS
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSent,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of sent packets.",                  "/Drivers/AFPacket%d/Packets/Sent", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",                    "/Drivers/AFPacket%d/Bytes/Sent", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO packets passed to the host.", "/Drivers/AFPacket%d/Packets/SentGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatXmitKicks,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of transmit ring kicks.",           "/Drivers/AFPacket%d/XmitKicks", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",              "/Drivers/AFPacket%d/Packets/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",                "/Drivers/AFPacket%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received GSO packets.",          "/Drivers/AFPacket%d/Packets/ReceivedGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvBlocks,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of receive ring blocks processed.", "/Drivers/AFPacket%d/RecvBlocks", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,        STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",          "/Drivers/AFPacket%d/Transmit", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",           "/Drivers/AFPacket%d/Receive", pDrvIns->iInstance);
+#endif /* VBOX_WITH_STATISTICS */
+
+    /*
+     * Validate the config.
+     */
+    PDMDRV_VALIDATE_CONFIG_RETURN(pDrvIns, "Device|VNetHdr|RxBlockSize|RxBlocks|RxBlockTimeout|TxFrames|QdiscBypass", "");
+
+    /*
+     * Check that no-one is attached to us.
+     */
+    AssertMsgReturn(PDMDrvHlpNoAttach(pDrvIns) == VERR_PDM_NO_ATTACHED_DRIVER,
+                    ("Configuration error: Not possible to attach anything to this driver!\n"),
+                    VERR_PDM_DRVINS_NO_ATTACH);
+
+    /*
+     * Query the network port interface.
+     */
+    pThis->pIAboveNet = PDMIBASE_QUERY_INTERFACE(pDrvIns->pUpBase, PDMINETWORKDOWN);
+    if (!pThis->pIAboveNet)
+        return PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_MISSING_INTERFACE_ABOVE,
+                                N_("Configuration error: The above device/driver didn't export the network port interface"));
+
+    /*
+     * Read the configuration.
+     */
+    /** @cfgm{Device, string}
+     * The name of the host network interface to bridge to. */
+    int rc = CFGMR3QueryStringAlloc(pCfg, "Device", &pThis->pszDeviceName);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"Device\" value"));
+
+    /** @cfgm{VNetHdr, bool, false}
+     * Exchange virtio-net headers with the host so GSO frames and partial
+     * checksums pass through unsegmented.  The receive side requires a host
+     * kernel which supports virtio-net headers in the packet rings (5.8+). */
+    rc = CFGMR3QueryBoolDef(pCfg, "VNetHdr", &pThis->fVNetHdr, false);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"VNetHdr\" value"));
+
+    /** @cfgm{RxBlockSize, uint32_t, 256K}
+     * Size of a receive ring block, must be a power of two multiple of the page
+     * size and hold the largest frame. */
+    rc = CFGMR3QueryU32Def(pCfg, "RxBlockSize", &pThis->cbRxBlock, _256K);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RxBlockSize\" value"));
+    if (   pThis->cbRxBlock < _128K
+        || pThis->cbRxBlock > _16M
+        || !RT_IS_POWER_OF_TWO(pThis->cbRxBlock))
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"RxBlockSize\" must be a power of two between 128K and 16M"));
+
+    /** @cfgm{RxBlocks, uint32_t, 64}
+     * Number of receive ring blocks. */
+    rc = CFGMR3QueryU32Def(pCfg, "RxBlocks", &pThis->cRxBlocks, 64);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RxBlocks\" value"));
+    if (pThis->cRxBlocks < 2 || pThis->cRxBlocks > 4096)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"RxBlocks\" must be between 2 and 4096"));
+
+    /** @cfgm{RxBlockTimeout, uint32_t, 1}
+     * Milliseconds after which a partially filled receive block is handed over. */
+    rc = CFGMR3QueryU32Def(pCfg, "RxBlockTimeout", &pThis->cMsRxBlockTimeout, 1);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RxBlockTimeout\" value"));
+    if (!pThis->cMsRxBlockTimeout)
+        pThis->cMsRxBlockTimeout = 1;
+
+    /** @cfgm{TxFrames, uint32_t, 256}
+     * Number of transmit ring slots, 0 to always use sendmsg(). */
+    uint32_t cTxFrames;
+    rc = CFGMR3QueryU32Def(pCfg, "TxFrames", &cTxFrames, 256);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"TxFrames\" value"));
+    if (cTxFrames > _16K)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"TxFrames\" must not exceed 16384"));
+
+    /** @cfgm{QdiscBypass, bool, false}
+     * Send frames straight to the NIC driver, bypassing traffic control. */
+    bool fQdiscBypass;
+    rc = CFGMR3QueryBoolDef(pCfg, "QdiscBypass", &fQdiscBypass, false);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"QdiscBypass\" value"));
+
+    /*
+     * Allocate the bits which shouldn't be allocated on the I/O paths.
+     */
+    rc = RTCritSectInit(&pThis->XmitLock);
+    AssertRCReturn(rc, rc);
+
+    rc = RTMemCacheCreate(&pThis->hSgCache, sizeof(PDMSCATTERGATHER) + sizeof(PDMNETWORKGSO), 0, UINT32_MAX,
+                          NULL, NULL, NULL, 0);
+    AssertRCReturn(rc, rc);
+
+    uint8_t *pbScratch = (uint8_t *)RTMemAlloc(sizeof(HOSTVNETHDR) + DRVAFPACKET_MAX_FRAME);
+    AssertReturn(pbScratch, VERR_NO_MEMORY);
+    pThis->pbRxScratch = pbScratch + sizeof(HOSTVNETHDR);
+
+    /*
+     * Open the socket and set up the rings.
+     */
+    rc = drvAFPacketOpen(pThis, cTxFrames, fQdiscBypass);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Create the control pipe.
+     */
+    rc = RTPipeCreate(&pThis->hPipeRead, &pThis->hPipeWrite, 0 /*fFlags*/);
+    AssertRCReturn(rc, rc);
+
+    /*
+     * Create the async I/O thread.
+     */
+    rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pThread, pThis, drvAFPacketAsyncIoThread, drvAFPacketAsyncIoWakeup,
+                               128 * _1K, RTTHREADTYPE_IO, "AFPacket");
+    AssertRCReturn(rc, rc);
+
+    return rc;
+}
+
+
+/**
+ * AF_PACKET network transport driver registration record.
+ */
+const PDMDRVREG g_DrvAFPacket =
+{
+    /* u32Version */
+    PDM_DRVREG_VERSION,
+    /* szName */
+    "AFPacket",
+    /* szRCMod */
+    "",
+    /* szR0Mod */
+    "",
+    /* pszDescription */
+    "AF_PACKET Ring Network Transport Driver",
+    /* fFlags */
+    PDM_DRVREG_FLAGS_HOST_BITS_DEFAULT,
+    /* fClass. */
+    PDM_DRVREG_CLASS_NETWORK,
+    /* cMaxInstances */
+    ~0U,
+    /* cbInstance */
+    sizeof(DRVAFPACKET),
+    /* pfnConstruct */
+    drvAFPacketConstruct,
+    /* pfnDestruct */
+    drvAFPacketDestruct,
+    /* pfnRelocate */
+    NULL,
+    /* pfnIOCtl */
+    NULL,
+    /* pfnPowerOn */
+    NULL,
+    /* pfnReset */
+    NULL,
+    /* pfnSuspend */
+    NULL,
+    /* pfnResume */
+    NULL,
+    /* pfnAttach */
+    NULL,
+    /* pfnDetach */
+    NULL,
+    /* pfnPowerOff */
+    NULL,
+    /* pfnSoftReset */
+    NULL,
+    /* u32EndVersion */
+    PDM_DRVREG_VERSION
+};
+
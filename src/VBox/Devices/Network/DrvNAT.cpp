@@ -71,6 +71,10 @@ extern "C" {
 
 #define DRVNAT_MAXFRAMESIZE (16 * 1024)
 
+/** Number of frames the RX thread delivers to the guest before it kicks the
+ * NAT thread to reclaim the mbufs while the queue is still non-empty. */
+#define DRVNAT_RECV_NOTIFY_BATCH 32
+
 /**
  * @todo: This is a bad hack to prevent freezing the guest during high network
  *        activity. Windows host only. This needs to be fixed properly.
@@ -206,6 +210,8 @@ typedef struct DRVNAT
     volatile uint32_t       cUrgPkts;
     /** Number of in-flight regular packets. */
     volatile uint32_t       cPkts;
+    /** Packets the RX thread delivered since it last kicked the NAT thread. */
+    uint32_t                cPktsSinceNotify;
 
     /** Transmit lock taken by BeginXmit and released by EndXmit. */
     RTCRITSECT              XmitLock;
@@ -245,7 +251,9 @@ static DECLCALLBACK(int) drvNATRecv(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
 
     while (pThread->enmState == PDMTHREADSTATE_RUNNING)
     {
+        /* Deliver everything that queued up since the last wakeup in one go. */
         RTReqQueueProcess(pThis->hRecvReqQueue, 0);
+        STAM_COUNTER_INC(&pThis->StatNATRecvBatches);
         if (ASMAtomicReadU32(&pThis->cPkts) == 0)
             RTSemEventWait(pThis->EventRecv, RT_INDEFINITE_WAIT);
     }
@@ -371,9 +379,18 @@ static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int c
 
 done_unlocked:
     slirp_ext_m_free(pThis->pNATState, m, pu8Buf);
-    ASMAtomicDecU32(&pThis->cPkts);
 
-    drvNATNotifyNATThread(pThis, "drvNATRecvWorker");
+    /*
+     * The NAT thread only needs a kick to notice the freed mbufs, so do that
+     * once per batch rather than for every frame (it's a pipe write and a
+     * poll round each).
+     */
+    if (   ASMAtomicDecU32(&pThis->cPkts) == 0
+        || ++pThis->cPktsSinceNotify >= DRVNAT_RECV_NOTIFY_BATCH)
+    {
+        pThis->cPktsSinceNotify = 0;
+        drvNATNotifyNATThread(pThis, "drvNATRecvWorker");
+    }
 
     STAM_PROFILE_STOP(&pThis->StatNATRecv, a);
 }
@@ -788,6 +805,8 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
     unsigned int cBreak = 0;
 #else /* RT_OS_WINDOWS */
     unsigned int cPollNegRet = 0;
+    struct pollfd *polls = NULL;
+    int cPollsAlloc = 0;
 #endif /* !RT_OS_WINDOWS */
 
     LogFlow(("drvNATAsyncIoThread: pThis=%p\n", pThis));
@@ -808,10 +827,19 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
          */
 #ifndef RT_OS_WINDOWS
         nFDs = slirp_get_nsock(pThis->pNATState);
-        /* allocation for all sockets + Management pipe */
-        struct pollfd *polls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
-        if (polls == NULL)
-            return VERR_NO_MEMORY;
+        /* allocation for all sockets + Management pipe, kept across rounds */
+        if (1 + nFDs > cPollsAlloc)
+        {
+            int cNew = RT_ALIGN_32(1 + nFDs, 64);
+            struct pollfd *pNew = (struct pollfd *)RTMemRealloc(polls, cNew * sizeof(struct pollfd));
+            if (pNew == NULL)
+            {
+                RTMemFree(polls);
+                return VERR_NO_MEMORY;
+            }
+            polls = pNew;
+            cPollsAlloc = cNew;
+        }
 
         /* don't pass the management pipe */
         slirp_select_fill(pThis->pNATState, &nFDs, &polls[1]);
@@ -821,7 +849,7 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         polls[0].events = POLLRDNORM | POLLPRI | POLLRDBAND;
         polls[0].revents = 0;
 
-        int cChangedFDs = poll(polls, nFDs + 1, slirp_get_timeout_ms(pThis->pNATState));
+        int cChangedFDs = slirp_poll(pThis->pNATState, polls, nFDs + 1, slirp_get_timeout_ms(pThis->pNATState));
         if (cChangedFDs < 0)
         {
             if (errno == EINTR)
@@ -861,7 +889,6 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         }
         /* process _all_ outstanding requests but don't wait */
         RTReqQueueProcess(pThis->hSlirpReqQueue, 0);
-        RTMemFree(polls);
 
 #else /* RT_OS_WINDOWS */
         nFDs = -1;
@@ -899,6 +926,9 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
 #endif /* RT_OS_WINDOWS */
     }
 
+#ifndef RT_OS_WINDOWS
+    RTMemFree(polls);
+#endif
     return VINF_SUCCESS;
 }
 
@@ -1021,11 +1051,14 @@ void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
     if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
         return;
 
-    ASMAtomicIncU32(&pThis->cPkts);
+    uint32_t cPkts = ASMAtomicIncU32(&pThis->cPkts);
     int rc = RTReqQueueCallEx(pThis->hRecvReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
                               (PFNRT)drvNATRecvWorker, 4, pThis, pu8Buf, cb, m);
     AssertRC(rc);
-    drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
+    /* The RX thread drains the whole queue before it goes back to sleep, so
+       only the first packet of a batch needs to wake it up. */
+    if (cPkts == 1)
+        drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
     STAM_COUNTER_INC(&pThis->StatQueuePktSent);
     LogFlowFuncLeave();
 }
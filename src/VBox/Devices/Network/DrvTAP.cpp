@@ -61,10 +61,27 @@
 #else
 # include <sys/fcntl.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/uio.h>
+# include <net/if.h>
+# include <linux/if_tun.h>
+#endif
 #include <errno.h>
 #include <unistd.h>
 
 #include "VBoxDD.h"
+#include "HostVNetHdr.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The max number of TAP queues (IFF_MULTI_QUEUE) we open. */
+#define DRVTAP_MAX_QUEUES       8
+/** The max number of frames read from one queue per poll() wakeup. */
+#define DRVTAP_MAX_RECV_BATCH   64
+/** The size of the receive buffer, large enough for GSO frames. */
+#define DRVTAP_RECV_BUF_SIZE    (_64K + _1K)
 
 
 /*********************************************************************************************************************************
@@ -83,8 +100,18 @@ typedef struct DRVTAP
     PPDMINETWORKDOWN        pIAboveNet;
     /** Pointer to the driver instance. */
     PPDMDRVINS              pDrvIns;
-    /** TAP device file handle. */
+    /** TAP device file handle (the first queue). */
     RTFILE                  hFileDevice;
+    /** File handles of the additional queues when using IFF_MULTI_QUEUE. */
+    RTFILE                  ahFileQueues[DRVTAP_MAX_QUEUES - 1];
+    /** The number of queues, i.e. hFileDevice + valid ahFileQueues entries. */
+    uint32_t                cQueues;
+    /** Whether frames are prefixed by a virtio-net header (IFF_VNET_HDR). */
+    bool                    fVNetHdr;
+    /** Whether we opened the device ourselves and must close it. */
+    bool                    fOwnDevice;
+    /** The receive buffer, preceded by room for the virtio-net header. */
+    uint8_t                *pbRecvBuf;
     /** The configured TAP device name. */
     char                   *pszDeviceName;
 #ifdef RT_OS_SOLARIS
@@ -117,6 +144,12 @@ typedef struct DRVTAP
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of GSO packets handed to the host for segmenting. */
+    STAMCOUNTER             StatPktSentGso;
+    /** Number of GSO packets received from the host. */
+    STAMCOUNTER             StatPktRecvGso;
+    /** Number of poll() wakeups with frames to read. */
+    STAMCOUNTER             StatRecvWakeups;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -145,6 +178,95 @@ static int              SolarisTAPAttach(PDRVTAP pThis);
 
 
 
+/**
+ * Gets the file handle of the given queue.
+ */
+DECLINLINE(RTFILE) drvTAPQueueFile(PDRVTAP pThis, uint32_t iQueue)
+{
+    return iQueue == 0 ? pThis->hFileDevice : pThis->ahFileQueues[iQueue - 1];
+}
+
+
+/**
+ * Picks the transmit queue for a frame.
+ *
+ * Frames of the same IPv4/IPv6 flow always go to the same queue so the host
+ * doesn't reorder them.
+ *
+ * @returns Queue index.
+ * @param   pThis           The instance data.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+static uint32_t drvTAPSelectXmitQueue(PDRVTAP pThis, uint8_t const *pbFrame, size_t cbFrame)
+{
+    if (pThis->cQueues <= 1)
+        return 0;
+
+    /* Hash the addresses and ports (assuming no IP options, it only needs to be consistent). */
+    uint32_t offFlow, cbFlow;
+    uint16_t const uEtherType = cbFrame >= sizeof(RTNETETHERHDR) ? RT_MAKE_U16(pbFrame[13], pbFrame[12]) : 0;
+    if (uEtherType == RTNET_ETHERTYPE_IPV4)
+    {
+        offFlow = sizeof(RTNETETHERHDR) + RT_UOFFSETOF(RTNETIPV4, ip_src);
+        cbFlow  = 2 * sizeof(RTNETADDRIPV4) + 2 * sizeof(uint16_t);
+    }
+    else if (uEtherType == RTNET_ETHERTYPE_IPV6)
+    {
+        offFlow = sizeof(RTNETETHERHDR) + RT_UOFFSETOF(RTNETIPV6, ip6_src);
+        cbFlow  = 2 * sizeof(RTNETADDRIPV6) + 2 * sizeof(uint16_t);
+    }
+    else
+        return 0;
+    if (offFlow + cbFlow > cbFrame)
+        return 0;
+
+    uint32_t uHash = UINT32_C(2166136261);
+    for (uint32_t off = offFlow; off < offFlow + cbFlow; off++)
+        uHash = (uHash ^ pbFrame[off]) * UINT32_C(16777619);
+    return uHash % pThis->cQueues;
+}
+
+
+/**
+ * Writes a frame to the TAP device.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if the host cannot take the GSO frame as is, the
+ *          caller must segment it.
+ * @param   pThis           The instance data.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The frame size.
+ * @param   pGso            The GSO context, NULL for plain frames.
+ */
+static int drvTAPWriteFrame(PDRVTAP pThis, void *pvFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    RTFILE hFile = drvTAPQueueFile(pThis, drvTAPSelectXmitQueue(pThis, (uint8_t const *)pvFrame, cbFrame));
+#ifdef RT_OS_LINUX
+    if (pThis->fVNetHdr)
+    {
+        HOSTVNETHDR VNetHdr;
+        if (!HostVNetHdrFromGso(&VNetHdr, pGso))
+            return VERR_NOT_SUPPORTED;
+        if (pGso)
+            PDMNetGsoPrepForDirectUse(pGso, pvFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+
+        struct iovec aSegs[2];
+        aSegs[0].iov_base = &VNetHdr;
+        aSegs[0].iov_len  = sizeof(VNetHdr);
+        aSegs[1].iov_base = pvFrame;
+        aSegs[1].iov_len  = cbFrame;
+        if (writev(RTFileToNative(hFile), aSegs, RT_ELEMENTS(aSegs)) < 0)
+            return RTErrConvertFromErrno(errno);
+        return VINF_SUCCESS;
+    }
+#endif
+    if (pGso)
+        return VERR_NOT_SUPPORTED;
+    return RTFileWrite(hFile, pvFrame, cbFrame, NULL);
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
  */
@@ -263,23 +385,31 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
               "%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+        rc = drvTAPWriteFrame(pThis, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
     }
     else
     {
-        uint8_t         abHdrScratch[256];
-        uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
+        uint8_t        *pbFrame = (uint8_t *)pSgBuf->aSegs[0].pvSeg;
         PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
-        uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
-        rc = VINF_SUCCESS;
-        for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+
+        /* Let the host do the segmentation if it can (IFF_VNET_HDR). */
+        rc = drvTAPWriteFrame(pThis, pbFrame, pSgBuf->cbUsed, pGso);
+        if (RT_SUCCESS(rc))
+            STAM_COUNTER_INC(&pThis->StatPktSentGso);
+        else if (rc == VERR_NOT_SUPPORTED)
         {
-            uint32_t cbSegFrame;
-            void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
-                                                       iSeg, cSegs, &cbSegFrame);
-            rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
-            if (RT_FAILURE(rc))
-                break;
+            uint8_t         abHdrScratch[256];
+            uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+            rc = VINF_SUCCESS;
+            for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegFrame;
+                void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, pSgBuf->cbUsed, abHdrScratch,
+                                                           iSeg, cSegs, &cbSegFrame);
+                rc = drvTAPWriteFrame(pThis, pvSegFrame, cbSegFrame, NULL);
+                if (RT_FAILURE(rc))
+                    break;
+            }
         }
     }
 
@@ -330,6 +460,152 @@ static DECLCALLBACK(void) drvTAPNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 }
 
 
+/**
+ * Passes a received frame up to the device.
+ *
+ * @returns VBox status code, failure if woken up by a VM state change.
+ * @param   pThis           The instance data.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The frame size.
+ * @param   pGso            The GSO context, NULL for plain frames.
+ */
+static int drvTAPRecvFrame(PDRVTAP pThis, uint8_t *pbFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    /*
+     * Wait for the device to have space for this frame.
+     * Most guests use frame-sized receive buffers, hence non-zero cbMax
+     * automatically means there is enough room for entire frame. Some
+     * guests (eg. Solaris) use large chains of small receive buffers
+     * (each 128 or so bytes large). We will still start receiving as soon
+     * as cbMax is non-zero because:
+     *  - it would be quite expensive for pfnCanReceive to accurately
+     *    determine free receive buffer space
+     *  - if we were waiting for enough free buffers, there is a risk
+     *    of deadlocking because the guest could be waiting for a receive
+     *    overflow error to allocate more receive buffers
+     */
+    STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+    STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+
+    /*
+     * A return code != VINF_SUCCESS means that we were woken up during a VM
+     * state transition. Drop the packet and wait for the next one.
+     */
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Pass the data up.
+     */
+#ifdef LOG_ENABLED
+    uint64_t u64Now = RTTimeProgramNanoTS();
+    LogFlow(("drvTAPAsyncIoThread: %-4d bytes at %llu ns  deltas: r=%llu t=%llu\n",
+             cbFrame, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
+    pThis->u64LastReceiveTS = u64Now;
+#endif
+    Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbFrame, cbFrame, pbFrame));
+    STAM_COUNTER_INC(&pThis->StatPktRecv);
+    STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbFrame);
+    if (!pGso)
+    {
+        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbFrame, cbFrame);
+        AssertRC(rc);
+        return VINF_SUCCESS;
+    }
+
+    STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+    PDMNetGsoPrepForDirectUse(pGso, pbFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+    if (   pThis->pIAboveNet->pfnReceiveGso
+        && RT_SUCCESS(pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, pGso)))
+        return VINF_SUCCESS;
+
+    /* No large receive offload in the device, carve it up. */
+    uint8_t         abHdrScratch[256];
+    uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegFrame;
+        void    *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        if (iSeg > 0)
+        {
+            STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+            rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+            STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+        AssertRC(rc);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads and passes up the frames pending on a queue.
+ *
+ * Draining the queue (up to a limit) saves a poll() per frame when traffic
+ * comes in bursts.
+ *
+ * @returns VBox status code.  VERR_INVALID_HANDLE if the device is gone.
+ * @param   pThis           The instance data.
+ * @param   pThread         The receive thread.
+ * @param   hFile           The queue file handle.
+ */
+static int drvTAPRecvQueue(PDRVTAP pThis, PPDMTHREAD pThread, RTFILE hFile)
+{
+    size_t const cbHdr = pThis->fVNetHdr ? sizeof(HOSTVNETHDR) : 0;
+    for (unsigned iFrame = 0;
+         iFrame < DRVTAP_MAX_RECV_BATCH && pThread->enmState == PDMTHREADSTATE_RUNNING;
+         iFrame++)
+    {
+        /*
+         * Read the frame, the virtio-net header lands just in front of it.
+         */
+        uint8_t *pbFrame = pThis->pbRecvBuf;
+        size_t   cbRead  = 0;
+        int rc = RTFileRead(hFile, pbFrame - cbHdr, DRVTAP_RECV_BUF_SIZE + cbHdr, &cbRead);
+        if (RT_FAILURE(rc))
+        {
+            if (rc == VERR_TRY_AGAIN)
+                return VINF_SUCCESS;
+            LogFlow(("drvTAPAsyncIoThread: RTFileRead -> %Rrc\n", rc));
+            return rc;
+        }
+        if (cbRead <= cbHdr)
+            continue;
+        size_t cbFrame = cbRead - cbHdr;
+
+        /*
+         * Complete the offloading work the host left for us.
+         */
+        PDMNETWORKGSO   Gso;
+        PCPDMNETWORKGSO pGso = NULL;
+        if (cbHdr)
+        {
+            HOSTVNETHDR VNetHdr;
+            memcpy(&VNetHdr, pbFrame - cbHdr, sizeof(VNetHdr));
+            if (VNetHdr.u8GsoType != HOSTVNETHDR_GSO_NONE)
+            {
+                pGso = HostVNetHdrToGso(&VNetHdr, pbFrame, cbFrame, &Gso);
+                if (!pGso)
+                {
+                    LogRelMax(16, ("TAP#%d: Dropping unsupported GSO frame (type %#x)\n", pThis->pDrvIns->iInstance, VNetHdr.u8GsoType));
+                    continue;
+                }
+            }
+            else if (!HostVNetHdrCompleteChecksum(&VNetHdr, pbFrame, cbFrame))
+                continue;
+        }
+
+        if (RT_FAILURE(drvTAPRecvFrame(pThis, pbFrame, cbFrame, pGso)))
+            return VINF_SUCCESS;
+    }
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Asynchronous I/O thread for handling receive.
  *
@@ -350,94 +626,35 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
     /*
      * Polling loop.
      */
+    uint32_t const cQueues = pThis->cQueues;
     while (pThread->enmState == PDMTHREADSTATE_RUNNING)
     {
         /*
-         * Wait for something to become available.
+         * Wait for something to become available on any of the queues.
          */
-        struct pollfd aFDs[2];
-        aFDs[0].fd      = RTFileToNative(pThis->hFileDevice);
-        aFDs[0].events  = POLLIN | POLLPRI;
-        aFDs[0].revents = 0;
-        aFDs[1].fd      = RTPipeToNative(pThis->hPipeRead);
-        aFDs[1].events  = POLLIN | POLLPRI | POLLERR | POLLHUP;
-        aFDs[1].revents = 0;
+        struct pollfd aFDs[DRVTAP_MAX_QUEUES + 1];
+        for (uint32_t iQueue = 0; iQueue < cQueues; iQueue++)
+        {
+            aFDs[iQueue].fd      = RTFileToNative(drvTAPQueueFile(pThis, iQueue));
+            aFDs[iQueue].events  = POLLIN | POLLPRI;
+            aFDs[iQueue].revents = 0;
+        }
+        aFDs[cQueues].fd      = RTPipeToNative(pThis->hPipeRead);
+        aFDs[cQueues].events  = POLLIN | POLLPRI | POLLERR | POLLHUP;
+        aFDs[cQueues].revents = 0;
         STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
         errno=0;
-        int rc = poll(&aFDs[0], RT_ELEMENTS(aFDs), -1 /* infinite */);
+        int rc = poll(&aFDs[0], cQueues + 1, -1 /* infinite */);
 
         /* this might have changed in the meantime */
         if (pThread->enmState != PDMTHREADSTATE_RUNNING)
             break;
 
         STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
-        if (    rc > 0
-            &&  (aFDs[0].revents & (POLLIN | POLLPRI))
-            &&  !aFDs[1].revents)
-        {
-            /*
-             * Read the frame.
-             */
-            char achBuf[16384];
-            size_t cbRead = 0;
-            /** @note At least on Linux we will never receive more than one network packet
-             *        after poll() returned successfully. I don't know why but a second
-             *        RTFileRead() operation will return with VERR_TRY_AGAIN in any case. */
-            rc = RTFileRead(pThis->hFileDevice, achBuf, sizeof(achBuf), &cbRead);
-            if (RT_SUCCESS(rc))
-            {
-                /*
-                 * Wait for the device to have space for this frame.
-                 * Most guests use frame-sized receive buffers, hence non-zero cbMax
-                 * automatically means there is enough room for entire frame. Some
-                 * guests (eg. Solaris) use large chains of small receive buffers
-                 * (each 128 or so bytes large). We will still start receiving as soon
-                 * as cbMax is non-zero because:
-                 *  - it would be quite expensive for pfnCanReceive to accurately
-                 *    determine free receive buffer space
-                 *  - if we were waiting for enough free buffers, there is a risk
-                 *    of deadlocking because the guest could be waiting for a receive
-                 *    overflow error to allocate more receive buffers
-                 */
-                STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
-                int rc1 = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
-                STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
-
-                /*
-                 * A return code != VINF_SUCCESS means that we were woken up during a VM
-                 * state transition. Drop the packet and wait for the next one.
-                 */
-                if (RT_FAILURE(rc1))
-                    continue;
-
-                /*
-                 * Pass the data up.
-                 */
-#ifdef LOG_ENABLED
-                uint64_t u64Now = RTTimeProgramNanoTS();
-                LogFlow(("drvTAPAsyncIoThread: %-4d bytes at %llu ns  deltas: r=%llu t=%llu\n",
-                         cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
-                pThis->u64LastReceiveTS = u64Now;
-#endif
-                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
-                STAM_COUNTER_INC(&pThis->StatPktRecv);
-                STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-                rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
-                AssertRC(rc1);
-            }
-            else
-            {
-                LogFlow(("drvTAPAsyncIoThread: RTFileRead -> %Rrc\n", rc));
-                if (rc == VERR_INVALID_HANDLE)
-                    break;
-                RTThreadYield();
-            }
-        }
-        else if (   rc > 0
-                 && aFDs[1].revents)
+        if (rc > 0 && aFDs[cQueues].revents)
         {
-            LogFlow(("drvTAPAsyncIoThread: Control message: enmState=%d revents=%#x\n", pThread->enmState, aFDs[1].revents));
-            if (aFDs[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+            LogFlow(("drvTAPAsyncIoThread: Control message: enmState=%d revents=%#x\n", pThread->enmState, aFDs[cQueues].revents));
+            if (aFDs[cQueues].revents & (POLLHUP | POLLERR | POLLNVAL))
                 break;
 
             /* drain the pipe */
@@ -445,6 +662,21 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
             size_t cbRead;
             RTPipeRead(pThis->hPipeRead, &ch, 1, &cbRead);
         }
+        else if (rc > 0)
+        {
+            STAM_COUNTER_INC(&pThis->StatRecvWakeups);
+            for (uint32_t iQueue = 0; iQueue < cQueues; iQueue++)
+                if (aFDs[iQueue].revents & (POLLIN | POLLPRI))
+                {
+                    rc = drvTAPRecvQueue(pThis, pThread, drvTAPQueueFile(pThis, iQueue));
+                    if (rc == VERR_INVALID_HANDLE)
+                        break;
+                    if (RT_FAILURE(rc))
+                        RTThreadYield();
+                }
+            if (rc == VERR_INVALID_HANDLE)
+                break;
+        }
         else
         {
             /*
@@ -454,9 +686,9 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
              * if they are not supposed to occur in our setup.
              */
             if (errno == EINTR)
-                Log(("rc=%d revents=%#x,%#x errno=%p %s\n", rc, aFDs[0].revents, aFDs[1].revents, errno, strerror(errno)));
+                Log(("rc=%d revents=%#x,%#x errno=%p %s\n", rc, aFDs[0].revents, aFDs[cQueues].revents, errno, strerror(errno)));
             else
-                AssertMsgFailed(("rc=%d revents=%#x,%#x errno=%p %s\n", rc, aFDs[0].revents, aFDs[1].revents, errno, strerror(errno)));
+                AssertMsgFailed(("rc=%d revents=%#x,%#x errno=%p %s\n", rc, aFDs[0].revents, aFDs[cQueues].revents, errno, strerror(errno)));
             RTThreadYield();
         }
     }
@@ -750,6 +982,57 @@ static DECLCALLBACK(int) SolarisTAPAttach(PDRVTAP pThis)
 
 #endif  /* RT_OS_SOLARIS */
 
+
+#ifdef RT_OS_LINUX
+/**
+ * Enables the virtio-net header and offloads on a TAP queue.
+ *
+ * @param   pThis           The instance data.
+ * @param   hFile           The queue file handle.
+ */
+static void drvTAPLinuxConfigureVNetHdr(PDRVTAP pThis, RTFILE hFile)
+{
+    int cbHdr = sizeof(HOSTVNETHDR);
+    if (ioctl(RTFileToNative(hFile), TUNSETVNETHDRSZ, &cbHdr) == -1)
+        LogRel(("TAP#%d: TUNSETVNETHDRSZ failed, errno=%d\n", pThis->pDrvIns->iInstance, errno));
+
+    /* These tell the host what we can take on receive. */
+    if (ioctl(RTFileToNative(hFile), TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) == -1)
+        LogRel(("TAP#%d: TUNSETOFFLOAD failed, errno=%d\n", pThis->pDrvIns->iInstance, errno));
+}
+
+
+/**
+ * Opens a queue of a TAP interface, creating the interface if necessary.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The instance data.
+ * @param   pIfr            The interface request.  ifr_flags must be set
+ *                          up; ifr_name is updated with the name the kernel
+ *                          picked if it was empty.
+ * @param   phFile          Where to return the queue file handle.
+ */
+static int drvTAPLinuxOpenQueue(PDRVTAP pThis, struct ifreq *pIfr, PRTFILE phFile)
+{
+    RTFILE hFile;
+    int rc = RTFileOpen(&hFile, "/dev/net/tun", RTFILE_O_READWRITE | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | RTFILE_O_INHERIT);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (ioctl(RTFileToNative(hFile), TUNSETIFF, pIfr) == -1)
+    {
+        rc = RTErrConvertFromErrno(errno);
+        RTFileClose(hFile);
+        return rc;
+    }
+    if (pIfr->ifr_flags & IFF_VNET_HDR)
+        drvTAPLinuxConfigureVNetHdr(pThis, hFile);
+
+    *phFile = hFile;
+    return VINF_SUCCESS;
+}
+#endif /* RT_OS_LINUX */
+
 /* -=-=-=-=- PDMIBASE -=-=-=-=- */
 
 /**
@@ -811,7 +1094,29 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     if (pThis->pszTerminateApplication)
         drvTAPTerminateApplication(pThis);
 
-#endif  /* RT_OS_SOLARIS */
+#else  /* !RT_OS_SOLARIS */
+    /*
+     * Close the queues we opened.  The main file handle belongs to Main
+     * unless we created the interface ourselves.
+     */
+    for (uint32_t iQueue = 1; iQueue < pThis->cQueues; iQueue++)
+    {
+        rc = RTFileClose(pThis->ahFileQueues[iQueue - 1]); AssertRC(rc);
+        pThis->ahFileQueues[iQueue - 1] = NIL_RTFILE;
+    }
+    pThis->cQueues = 1;
+    if (pThis->fOwnDevice && pThis->hFileDevice != NIL_RTFILE)
+    {
+        rc = RTFileClose(pThis->hFileDevice); AssertRC(rc);
+        pThis->hFileDevice = NIL_RTFILE;
+    }
+#endif  /* !RT_OS_SOLARIS */
+
+    if (pThis->pbRecvBuf)
+    {
+        RTMemFree(pThis->pbRecvBuf - sizeof(HOSTVNETHDR));
+        pThis->pbRecvBuf = NULL;
+    }
 
 #ifdef RT_OS_SOLARIS
     if (!pThis->fStatic)
@@ -841,6 +1146,9 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvWakeups);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -863,6 +1171,12 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
      */
     pThis->pDrvIns                      = pDrvIns;
     pThis->hFileDevice                  = NIL_RTFILE;
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->ahFileQueues); i++)
+        pThis->ahFileQueues[i]          = NIL_RTFILE;
+    pThis->cQueues                      = 1;
+    pThis->fVNetHdr                     = false;
+    pThis->fOwnDevice                   = false;
+    pThis->pbRecvBuf                    = NULL;
     pThis->hPipeWrite                   = NIL_RTPIPE;
     pThis->hPipeRead                    = NIL_RTPIPE;
     pThis->pszDeviceName                = NULL;
@@ -892,6 +1206,9 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO frames handed to the host.", "/Drivers/TAP%d/Packets/SentGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO frames received.",   "/Drivers/TAP%d/Packets/ReceivedGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvWakeups,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of receive thread wakeups with frames pending.", "/Drivers/TAP%d/ReceiveWakeups", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -899,7 +1216,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "Device\0InitProg\0TermProg\0FileHandle\0TAPSetupApplication\0TAPTerminateApplication\0MAC"))
+    if (!CFGMR3AreValuesValid(pCfg, "Device\0InitProg\0TermProg\0FileHandle\0TAPSetupApplication\0TAPTerminateApplication\0MAC\0Queues\0VNetHdr"))
         return PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES, "");
 
     /*
@@ -964,15 +1281,100 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 
 #else /* !RT_OS_SOLARIS */
 
+# ifdef RT_OS_LINUX
+    /** @cfgm{Queues, uint32_t, 1}
+     * The number of TAP queues (IFF_MULTI_QUEUE) to use, 1 to 8.  Transmitted
+     * frames are spread over the queues by flow, received frames are taken
+     * from all of them.  Requires the interface to be multiqueue capable. */
+    uint32_t cQueues;
+    rc = CFGMR3QueryU32Def(pCfg, "Queues", &cQueues, 1);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"Queues\" value"));
+    if (cQueues < 1 || cQueues > DRVTAP_MAX_QUEUES)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"Queues\" must be between 1 and %u"), DRVTAP_MAX_QUEUES);
+
+    /** @cfgm{VNetHdr, boolean, false}
+     * Exchange virtio-net headers with the host (IFF_VNET_HDR) so that GSO
+     * frames and partial checksums can be passed without segmenting them. */
+    bool fVNetHdr;
+    rc = CFGMR3QueryBoolDef(pCfg, "VNetHdr", &fVNetHdr, false);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"VNetHdr\" value"));
+
+    struct ifreq Ifr;
+    RT_ZERO(Ifr);
+# endif
+
     uint64_t u64File;
     rc = CFGMR3QueryU64(pCfg, "FileHandle", &u64File);
-    if (RT_FAILURE(rc))
+    if (RT_SUCCESS(rc))
+    {
+        pThis->hFileDevice = (RTFILE)(uintptr_t)u64File;
+        if (!RTFileIsValid(pThis->hFileDevice))
+            return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_HANDLE, RT_SRC_POS,
+                                       N_("The TAP file handle %RTfile is not valid"), pThis->hFileDevice);
+# ifdef RT_OS_LINUX
+        /*
+         * The interface flags are fixed by whoever attached the handle, so we
+         * can only use what was enabled there.
+         */
+        if (ioctl(RTFileToNative(pThis->hFileDevice), TUNGETIFF, &Ifr) == -1)
+            RT_ZERO(Ifr);
+        if (fVNetHdr && !(Ifr.ifr_flags & IFF_VNET_HDR))
+            LogRel(("TAP#%d: The interface was not attached with IFF_VNET_HDR, ignoring \"VNetHdr\"\n", pDrvIns->iInstance));
+        else if (Ifr.ifr_flags & IFF_VNET_HDR)
+            drvTAPLinuxConfigureVNetHdr(pThis, pThis->hFileDevice);
+        if (cQueues > 1 && !(Ifr.ifr_flags & IFF_MULTI_QUEUE))
+        {
+            LogRel(("TAP#%d: The interface was not attached with IFF_MULTI_QUEUE, ignoring \"Queues\"\n", pDrvIns->iInstance));
+            cQueues = 1;
+        }
+# endif
+    }
+# ifdef RT_OS_LINUX
+    else if (   rc == VERR_CFGM_VALUE_NOT_FOUND
+             && RT_SUCCESS(CFGMR3QueryStringAlloc(pCfg, "Device", &pThis->pszDeviceName)))
+    {
+        /*
+         * No handle from Main, attach to (or create) the named interface.
+         */
+        Ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+        if (fVNetHdr)
+            Ifr.ifr_flags |= IFF_VNET_HDR;
+        if (cQueues > 1)
+            Ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        RTStrCopy(Ifr.ifr_name, sizeof(Ifr.ifr_name), pThis->pszDeviceName);
+        rc = drvTAPLinuxOpenQueue(pThis, &Ifr, &pThis->hFileDevice);
+        if (RT_FAILURE(rc))
+            return PDMDrvHlpVMSetError(pDrvIns, VERR_HOSTIF_INIT_FAILED, RT_SRC_POS,
+                                       N_("Failed to open the TAP interface '%s' (%Rrc)"), pThis->pszDeviceName, rc);
+        pThis->fOwnDevice = true;
+    }
+# endif
+    else
         return PDMDRV_SET_ERROR(pDrvIns, rc,
                                 N_("Configuration error: Query for \"FileHandle\" 32-bit signed integer failed"));
-    pThis->hFileDevice = (RTFILE)(uintptr_t)u64File;
-    if (!RTFileIsValid(pThis->hFileDevice))
-        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_HANDLE, RT_SRC_POS,
-                                   N_("The TAP file handle %RTfile is not valid"), pThis->hFileDevice);
+
+# ifdef RT_OS_LINUX
+    pThis->fVNetHdr = RT_BOOL(Ifr.ifr_flags & IFF_VNET_HDR);
+
+    /*
+     * Attach the additional queues.
+     */
+    while (pThis->cQueues < cQueues)
+    {
+        rc = drvTAPLinuxOpenQueue(pThis, &Ifr, &pThis->ahFileQueues[pThis->cQueues - 1]);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("TAP#%d: Failed to attach queue #%u of '%s' (%Rrc), continuing with %u queue(s)\n",
+                    pDrvIns->iInstance, pThis->cQueues, Ifr.ifr_name, rc, pThis->cQueues));
+            break;
+        }
+        pThis->cQueues++;
+    }
+    LogRel(("TAP#%d: %u queue(s), virtio-net header %s\n", pDrvIns->iInstance, pThis->cQueues, pThis->fVNetHdr ? "enabled" : "disabled"));
+# endif
 #endif /* !RT_OS_SOLARIS */
 
     /*
@@ -987,13 +1389,23 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
      * We should actually query if it's a TAP device, but I haven't
      * found any way to do that.
      */
-    if (fcntl(RTFileToNative(pThis->hFileDevice), F_SETFL, O_NONBLOCK) == -1)
-        return PDMDrvHlpVMSetError(pDrvIns, VERR_HOSTIF_IOCTL, RT_SRC_POS,
-                                   N_("Configuration error: Failed to configure /dev/net/tun. errno=%d"), errno);
+    for (uint32_t iQueue = 0; iQueue < pThis->cQueues; iQueue++)
+        if (fcntl(RTFileToNative(drvTAPQueueFile(pThis, iQueue)), F_SETFL, O_NONBLOCK) == -1)
+            return PDMDrvHlpVMSetError(pDrvIns, VERR_HOSTIF_IOCTL, RT_SRC_POS,
+                                       N_("Configuration error: Failed to configure /dev/net/tun. errno=%d"), errno);
     /** @todo determine device name. This can be done by reading the link /proc/<pid>/fd/<fd> */
     Log(("drvTAPContruct: %d (from fd)\n", (intptr_t)pThis->hFileDevice));
     rc = VINF_SUCCESS;
 
+    /*
+     * Allocate the receive buffer, leaving room for the virtio-net header in
+     * front of it.
+     */
+    uint8_t *pbRecvBuf = (uint8_t *)RTMemAlloc(sizeof(HOSTVNETHDR) + DRVTAP_RECV_BUF_SIZE);
+    if (!pbRecvBuf)
+        return VERR_NO_MEMORY;
+    pThis->pbRecvBuf = pbRecvBuf + sizeof(HOSTVNETHDR);
+
     /*
      * Create the control pipe.
      */
@@ -0,0 +1,206 @@
+/* $Id$ */
+/** @file
+ * Helpers for exchanging virtio-net headers with host network interfaces.
+ *
+ * The Linux TAP (IFF_VNET_HDR) and AF_PACKET (PACKET_VNET_HDR) interfaces
+ * prefix each frame with a struct virtio_net_hdr describing pending
+ * segmentation and checksum offloading work.  These helpers translate
+ * between that header and the PDMNETWORKGSO context used by the devices.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___VBox_HostVNetHdr_h
+#define ___VBox_HostVNetHdr_h
+
+#include <VBox/types.h>
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/net.h>
+#include <iprt/string.h>
+
+
+/** @name HOSTVNETHDR::u8Flags
+ * @{ */
+/** Checksum needs completing: use u16CSumStart and u16CSumOffset. */
+#define HOSTVNETHDR_F_NEEDS_CSUM    UINT8_C(0x01)
+/** The checksum has already been verified. */
+#define HOSTVNETHDR_F_DATA_VALID    UINT8_C(0x02)
+/** @} */
+
+/** @name HOSTVNETHDR::u8GsoType
+ * @{ */
+#define HOSTVNETHDR_GSO_NONE        UINT8_C(0x00)
+#define HOSTVNETHDR_GSO_TCPV4       UINT8_C(0x01)
+#define HOSTVNETHDR_GSO_UDP         UINT8_C(0x03)
+#define HOSTVNETHDR_GSO_TCPV6       UINT8_C(0x04)
+#define HOSTVNETHDR_GSO_ECN         UINT8_C(0x80)
+/** @} */
+
+/**
+ * The virtio-net header as exchanged with the host kernel (native byte order).
+ */
+typedef struct HOSTVNETHDR
+{
+    uint8_t     u8Flags;
+    uint8_t     u8GsoType;
+    uint16_t    u16HdrLen;
+    uint16_t    u16GsoSize;
+    uint16_t    u16CSumStart;
+    uint16_t    u16CSumOffset;
+} HOSTVNETHDR;
+AssertCompileSize(HOSTVNETHDR, 10);
+/** Pointer to a host virtio-net header. */
+typedef HOSTVNETHDR *PHOSTVNETHDR;
+/** Pointer to a const host virtio-net header. */
+typedef HOSTVNETHDR const *PCHOSTVNETHDR;
+
+
+/**
+ * Translates a GSO context into a virtio-net header.
+ *
+ * Only the types the host can segment in hardware or software without
+ * tunnelling are expressible; the caller must carve the other ones itself.
+ *
+ * @returns true if @a pHdr was set up, false if the caller must segment.
+ * @param   pHdr                Where to return the header.
+ * @param   pGso                The GSO context, NULL for a plain frame.
+ */
+DECLINLINE(bool) HostVNetHdrFromGso(PHOSTVNETHDR pHdr, PCPDMNETWORKGSO pGso)
+{
+    RT_ZERO(*pHdr);
+    if (!pGso)
+        return true;
+    switch ((PDMNETWORKGSOTYPE)pGso->u8Type)
+    {
+        case PDMNETWORKGSOTYPE_IPV4_TCP:
+            pHdr->u8GsoType = HOSTVNETHDR_GSO_TCPV4;
+            break;
+        case PDMNETWORKGSOTYPE_IPV6_TCP:
+            pHdr->u8GsoType = HOSTVNETHDR_GSO_TCPV6;
+            break;
+        default:
+            /* UFO is deprecated on the host side and the tunneled variants have
+               no virtio representation. */
+            return false;
+    }
+    pHdr->u8Flags       = HOSTVNETHDR_F_NEEDS_CSUM;
+    pHdr->u16HdrLen     = pGso->cbHdrsTotal;
+    pHdr->u16GsoSize    = pGso->cbMaxSeg;
+    pHdr->u16CSumStart  = pGso->offHdr2;
+    pHdr->u16CSumOffset = RT_UOFFSETOF(RTNETTCP, th_sum);
+    return true;
+}
+
+
+/**
+ * Sets up a GSO context from a virtio-net header received from the host.
+ *
+ * The protocol headers are parsed from the frame rather than trusting
+ * u16HdrLen and u16CSumStart since the host does not always fill them in for
+ * frames coming off the wire (GRO).
+ *
+ * @returns @a pGso on success, NULL if the frame isn't a GSO frame we can
+ *          handle.
+ * @param   pHdr                The virtio-net header.
+ * @param   pbFrame             The frame.
+ * @param   cbFrame             The frame size.
+ * @param   pGso                Where to return the GSO context.
+ */
+DECLINLINE(PPDMNETWORKGSO) HostVNetHdrToGso(PCHOSTVNETHDR pHdr, uint8_t const *pbFrame, size_t cbFrame, PPDMNETWORKGSO pGso)
+{
+    uint8_t const fGsoType = pHdr->u8GsoType & ~HOSTVNETHDR_GSO_ECN;
+    if (   (fGsoType != HOSTVNETHDR_GSO_TCPV4 && fGsoType != HOSTVNETHDR_GSO_TCPV6)
+        || pHdr->u16GsoSize == 0
+        || cbFrame > _64K
+        || cbFrame < sizeof(RTNETETHERHDR) + sizeof(uint32_t))
+        return NULL;
+
+    /* Skip a single VLAN tag, the NIC leaves it in the frame in that case. */
+    uint32_t offHdr1    = sizeof(RTNETETHERHDR);
+    uint16_t uEtherType = RT_MAKE_U16(pbFrame[13], pbFrame[12]);
+    if (uEtherType == RTNET_ETHERTYPE_VLAN)
+    {
+        offHdr1   += sizeof(uint32_t);
+        uEtherType = RT_MAKE_U16(pbFrame[17], pbFrame[16]);
+    }
+
+    uint32_t offHdr2;
+    if (fGsoType == HOSTVNETHDR_GSO_TCPV4)
+    {
+        if (   uEtherType != RTNET_ETHERTYPE_IPV4
+            || offHdr1 + RTNETIPV4_MIN_LEN > cbFrame)
+            return NULL;
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pbFrame + offHdr1);
+        if (pIpHdr->ip_p != RTNETIPV4_PROT_TCP)
+            return NULL;
+        offHdr2 = offHdr1 + pIpHdr->ip_hl * 4;
+        pGso->u8Type = PDMNETWORKGSOTYPE_IPV4_TCP;
+    }
+    else
+    {
+        if (   uEtherType != RTNET_ETHERTYPE_IPV6
+            || offHdr1 + sizeof(RTNETIPV6) > cbFrame)
+            return NULL;
+        PCRTNETIPV6 pIpHdr = (PCRTNETIPV6)(pbFrame + offHdr1);
+        if (pIpHdr->ip6_nxt != RTNETIPV4_PROT_TCP) /** @todo IPv6 extension headers. */
+            return NULL;
+        offHdr2 = offHdr1 + sizeof(RTNETIPV6);
+        pGso->u8Type = PDMNETWORKGSOTYPE_IPV6_TCP;
+    }
+    if (offHdr2 + RTNETTCP_MIN_LEN > cbFrame)
+        return NULL;
+
+    uint32_t const cbHdrsTotal = offHdr2 + ((PCRTNETTCP)(pbFrame + offHdr2))->th_off * 4;
+    if (   cbHdrsTotal >= UINT8_MAX
+        || cbHdrsTotal >= cbFrame)
+        return NULL;
+
+    pGso->cbHdrsTotal = (uint8_t)cbHdrsTotal;
+    pGso->cbHdrsSeg   = (uint8_t)cbHdrsTotal;
+    pGso->cbMaxSeg    = pHdr->u16GsoSize;
+    pGso->offHdr1     = (uint8_t)offHdr1;
+    pGso->offHdr2     = (uint8_t)offHdr2;
+    pGso->u8Unused    = 0;
+    if (!PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame))
+        return NULL;
+    return pGso;
+}
+
+
+/**
+ * Completes a partial checksum as requested by HOSTVNETHDR_F_NEEDS_CSUM.
+ *
+ * The checksum field is expected to hold the pseudo header sum on input.
+ *
+ * @returns true on success, false if the header is inconsistent with the frame.
+ * @param   pHdr                The virtio-net header.
+ * @param   pbFrame             The frame.
+ * @param   cbFrame             The frame size.
+ */
+DECLINLINE(bool) HostVNetHdrCompleteChecksum(PCHOSTVNETHDR pHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    if (!(pHdr->u8Flags & HOSTVNETHDR_F_NEEDS_CSUM))
+        return true;
+    if (   pHdr->u16CSumStart >= cbFrame
+        || (size_t)pHdr->u16CSumStart + pHdr->u16CSumOffset + sizeof(uint16_t) > cbFrame)
+        return false;
+
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(pbFrame + pHdr->u16CSumStart, cbFrame - pHdr->u16CSumStart, 0, &fOdd);
+    uint16_t u16Sum = RTNetIPv4FinalizeChecksum(u32Sum);
+    memcpy(pbFrame + pHdr->u16CSumStart + pHdr->u16CSumOffset, &u16Sum, sizeof(u16Sum));
+    return true;
+}
+
+#endif
+
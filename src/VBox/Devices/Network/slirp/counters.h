@@ -70,6 +70,7 @@ COUNTING_COUNTER(TCP, "TCP sockets");
 COUNTING_COUNTER(TCPHot, "TCP sockets active");
 COUNTING_COUNTER(UDP, "UDP sockets");
 COUNTING_COUNTER(UDPHot, "UDP sockets active");
+COUNTING_COUNTER(EpollCtl, "epoll_ctl calls updating the socket interest set");
 
 COUNTING_COUNTER(IORead_in_1, "SB IORead_in_1");
 COUNTING_COUNTER(IORead_in_1_bytes, "SB IORead_in_1_bytes");
@@ -114,6 +115,7 @@ PROFILE_COUNTER(ALIAS_output, "ALIAS::output");
 # else
 /*DrvNAT.cpp*/
 DRV_COUNTING_COUNTER(NATRecvWakeups, "counting wakeups of NAT RX thread");
+DRV_COUNTING_COUNTER(NATRecvBatches, "counting batches of packets delivered to the guest by the NAT RX thread");
 DRV_PROFILE_COUNTER(NATRecv,"Time spent in NATRecv worker");
 DRV_PROFILE_COUNTER(NATRecvWait,"Time spent in NATRecv worker in waiting of free RX buffers");
 DRV_COUNTING_COUNTER(QueuePktSent, "counting packet sent via PDM Queue");
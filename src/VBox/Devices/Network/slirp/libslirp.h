@@ -175,6 +175,12 @@ unsigned int slirp_get_timeout_ms(PNATState pData);
  * Returns the number of sockets.
  */
 int slirp_get_nsock(PNATState pData);
+
+/*
+ * poll() replacement for the array set up by slirp_select_fill(), polls[0]
+ * being the caller's control descriptor.
+ */
+int slirp_poll(PNATState pData, struct pollfd *polls, int nfds, int cMillies);
 # endif
 
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
@@ -55,6 +55,9 @@
 # include <sys/ioctl.h>
 # include <poll.h>
 # include <netinet/in.h>
+# ifdef VBOX_NAT_WITH_EPOLL
+#  include <sys/epoll.h>
+# endif
 #else
 # include <Winnls.h>
 # define _WINSOCK2API_
@@ -295,6 +298,134 @@ static int slirpVerifyAndFreeSocket(PNATState pData, struct socket *pSocket)
     return 0;
 }
 
+#ifdef VBOX_NAT_WITH_EPOLL
+
+/** Maximum number of events fetched by a single epoll_wait() in slirp_poll(). */
+# define SLIRP_EPOLL_BATCH 128
+
+/* The poll and epoll event bits are interchangeable on Linux, the fill code
+   and the epoll registration share the masks. */
+AssertCompile(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT && POLLPRI == EPOLLPRI);
+AssertCompile(POLLERR == EPOLLERR && POLLHUP == EPOLLHUP);
+AssertCompile(POLLRDNORM == EPOLLRDNORM && POLLRDBAND == EPOLLRDBAND && POLLWRNORM == EPOLLWRNORM);
+
+/**
+ * Gives up on epoll and lets slirp_poll() fall back on poll().
+ */
+static void slirpEpollDisable(PNATState pData, int iErr)
+{
+    LogRel(("NAT: epoll failed (errno=%d), falling back to poll()\n", iErr));
+    close(pData->iEpollFd);
+    pData->iEpollFd = -1;
+    pData->iEpollCtlFd = -1;
+}
+
+/**
+ * Removes the epoll registration of a socket, if any.
+ *
+ * Called by sofree() and when the socket stops being engaged.  The descriptor
+ * is usually closed by now, in which case the kernel has already dropped it
+ * from the set; the owner check makes sure we don't unregister a reused
+ * descriptor belonging to another socket.
+ */
+void slirp_epoll_forget(PNATState pData, struct socket *so)
+{
+    if (!so->so_epoll_events)
+        return;
+    so->so_epoll_events = 0;
+    if (   so->so_epoll_fd >= 0
+        && so->so_epoll_fd < pData->cEpollOwners
+        && pData->papEpollOwners[so->so_epoll_fd] == so)
+    {
+        pData->papEpollOwners[so->so_epoll_fd] = NULL;
+        if (pData->iEpollFd != -1)
+        {
+            struct epoll_event Event; /* non-NULL for kernels older than 2.6.9 */
+            RT_ZERO(Event);
+            epoll_ctl(pData->iEpollFd, EPOLL_CTL_DEL, so->so_epoll_fd, &Event);
+            STAM_COUNTER_INC(&pData->StatEpollCtl);
+        }
+    }
+}
+
+/**
+ * Adds or modifies an epoll registration.
+ *
+ * @returns 0 on success, errno on failure.
+ */
+static int slirpEpollRegister(PNATState pData, int fd, uint32_t fEvents, bool fRegistered)
+{
+    struct epoll_event Event;
+    int rc;
+
+    RT_ZERO(Event);
+    Event.events  = fEvents;
+    Event.data.fd = fd;
+    STAM_COUNTER_INC(&pData->StatEpollCtl);
+    rc = epoll_ctl(pData->iEpollFd, fRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &Event);
+    if (rc < 0 && errno == (fRegistered ? ENOENT : EEXIST))
+    {
+        /* Our idea of the registration is stale, the descriptor was closed
+           and reused behind our back. */
+        STAM_COUNTER_INC(&pData->StatEpollCtl);
+        rc = epoll_ctl(pData->iEpollFd, fRegistered ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &Event);
+    }
+    return rc < 0 ? errno : 0;
+}
+
+/**
+ * Brings the epoll registration of a socket in line with what
+ * slirp_select_fill() engaged it for in this round.
+ *
+ * Only sockets whose interest actually changed cost a system call.
+ */
+static void slirpEpollSync(PNATState pData, struct socket *so, struct pollfd *polls, int cPolls)
+{
+    uint32_t fWant = 0;
+    int rc;
+
+    if (   so->so_poll_index >= 0
+        && so->so_poll_index < cPolls
+        && polls[so->so_poll_index].fd == so->s)
+        fWant = (uint16_t)polls[so->so_poll_index].events;
+
+    if (so->so_epoll_events && so->so_epoll_fd != so->s)
+        slirp_epoll_forget(pData, so);
+    if (fWant == so->so_epoll_events)
+        return;
+    if (!fWant)
+    {
+        slirp_epoll_forget(pData, so);
+        return;
+    }
+
+    if (so->s >= pData->cEpollOwners)
+    {
+        int cNew = RT_ALIGN_32(so->s + 1, 64);
+        struct socket **papNew = (struct socket **)RTMemRealloc(pData->papEpollOwners, cNew * sizeof(papNew[0]));
+        if (!papNew)
+        {
+            slirpEpollDisable(pData, ENOMEM);
+            return;
+        }
+        memset(&papNew[pData->cEpollOwners], 0, (cNew - pData->cEpollOwners) * sizeof(papNew[0]));
+        pData->papEpollOwners = papNew;
+        pData->cEpollOwners   = cNew;
+    }
+
+    rc = slirpEpollRegister(pData, so->s, fWant, so->so_epoll_events != 0);
+    if (rc != 0)
+    {
+        slirpEpollDisable(pData, rc);
+        return;
+    }
+    so->so_epoll_fd     = so->s;
+    so->so_epoll_events = fWant;
+    pData->papEpollOwners[so->s] = so;
+}
+
+#endif /* VBOX_NAT_WITH_EPOLL */
+
 int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
                bool fPassDomain, bool fUseHostResolver, int i32AliasMode,
                int iIcmpCacheLimit, void *pvUser)
@@ -437,6 +568,16 @@ int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
     STAILQ_INIT(&pData->DNSMapPatterns);
 #endif
 
+#ifdef VBOX_NAT_WITH_EPOLL
+    pData->iEpollCtlFd = -1;
+    pData->iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pData->iEpollFd < 0)
+    {
+        LogRel(("NAT: epoll_create1 failed (errno=%d), using poll()\n", errno));
+        pData->iEpollFd = -1;
+    }
+#endif
+
     slirp_link_up(pData);
     return VINF_SUCCESS;
 }
@@ -592,6 +733,11 @@ void slirp_term(PNATState pData)
     Log(("\n"
          "\n"
          "\n"));
+#endif
+#ifdef VBOX_NAT_WITH_EPOLL
+    if (pData->iEpollFd != -1)
+        close(pData->iEpollFd);
+    RTMemFree(pData->papEpollOwners);
 #endif
     RTCritSectRwDelete(&pData->CsRwHandlerChain);
     RTMemFree(pData);
@@ -814,6 +960,21 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
     }
 done:
 
+#ifdef VBOX_NAT_WITH_EPOLL
+    /*
+     * Push the interest changes of this round to the epoll set.  This is
+     * also done when the link is down so that the sockets stop firing.
+     */
+    if (pData->iEpollFd != -1)
+    {
+        slirpEpollSync(pData, &pData->icmp_socket, polls, poll_index);
+        for (so = tcb.so_next; so != &tcb && pData->iEpollFd != -1; so = so->so_next)
+            slirpEpollSync(pData, so, polls, poll_index);
+        for (so = udb.so_next; so != &udb && pData->iEpollFd != -1; so = so->so_next)
+            slirpEpollSync(pData, so, polls, poll_index);
+    }
+#endif
+
 #if defined(RT_OS_WINDOWS)
     *pnfds = VBOX_EVENT_COUNT;
 #else /* RT_OS_WINDOWS */
@@ -1649,6 +1810,73 @@ int slirp_get_nsock(PNATState pData)
 {
     return pData->nsock;
 }
+
+/**
+ * Waits for events on the descriptors set up by slirp_select_fill().
+ *
+ * This is a drop-in replacement for poll().  @a polls[0] belongs to the caller
+ * (its control pipe) and @a polls[1..nfds-1] is the array slirp_select_fill()
+ * has filled in.  On Linux the sockets stay registered with an epoll set
+ * between rounds, so the wait costs in proportion to the number of ready
+ * sockets instead of the total number.
+ */
+int slirp_poll(PNATState pData, struct pollfd *polls, int nfds, int cMillies)
+{
+# ifdef VBOX_NAT_WITH_EPOLL
+    if (pData->iEpollFd != -1 && nfds > 0)
+    {
+        struct epoll_event aEvents[SLIRP_EPOLL_BATCH];
+        struct pollfd *pSockPolls = &polls[1];
+        int cSockPolls = nfds - 1;
+        int cEvents;
+        int cChanged = 0;
+        int i;
+
+        if (pData->iEpollCtlFd != polls[0].fd)
+        {
+            int rc = slirpEpollRegister(pData, polls[0].fd, (uint16_t)polls[0].events, false /*fRegistered*/);
+            if (rc != 0)
+            {
+                slirpEpollDisable(pData, rc);
+                return poll(polls, nfds, cMillies);
+            }
+            pData->iEpollCtlFd = polls[0].fd;
+        }
+        polls[0].revents = 0;
+
+        cEvents = epoll_wait(pData->iEpollFd, aEvents, RT_ELEMENTS(aEvents), cMillies);
+        if (cEvents < 0)
+            return cEvents;
+
+        for (i = 0; i < cEvents; i++)
+        {
+            int fd = aEvents[i].data.fd;
+            struct pollfd *pPoll = NULL;
+
+            if (fd == pData->iEpollCtlFd)
+                pPoll = &polls[0];
+            else if (fd >= 0 && fd < pData->cEpollOwners)
+            {
+                struct socket *so = pData->papEpollOwners[fd];
+                if (   so
+                    && so->so_poll_index >= 0
+                    && so->so_poll_index < cSockPolls
+                    && pSockPolls[so->so_poll_index].fd == fd)
+                    pPoll = &pSockPolls[so->so_poll_index];
+            }
+            if (!pPoll)
+                continue; /* stale, slirp_select_fill() will sort it out next round */
+
+            pPoll->revents = (short)(aEvents[i].events & ((uint16_t)pPoll->events | POLLERR | POLLHUP));
+            if (pPoll->revents)
+                cChanged++;
+        }
+        return cChanged;
+    }
+# endif
+    RT_NOREF(pData);
+    return poll(polls, nfds, cMillies);
+}
 #endif
 
 /*
@@ -210,3 +210,10 @@
 
 /* Define if you have <sys/type32.h> */
 #undef HAVE_SYS_TYPES32_H
+
+/* Define to keep the sockets registered with an epoll set instead of passing
+ * all of them to poll() on every iteration (see slirp_poll()) */
+#undef VBOX_NAT_WITH_EPOLL
+#if defined(RT_OS_LINUX) && !defined(VBOX_NAT_WITHOUT_EPOLL)
+# define VBOX_NAT_WITH_EPOLL
+#endif
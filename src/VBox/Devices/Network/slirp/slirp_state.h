@@ -158,6 +158,8 @@ typedef struct NATState
     struct in_addr bindIP;
     /* Stuff from tcp_input.c */
     struct socket tcb;
+    /** TCP sockets hashed on laddr:lport/faddr:fport, see solookup_tcp(). */
+    struct socket *apTcpHash[SO_HASH_SIZE];
 
     struct socket *tcp_last_so;
     tcp_seq tcp_iss;
@@ -175,6 +177,8 @@ typedef struct NATState
     /* Stuff from udp.c */
     struct udpstat_t udpstat;
     struct socket udb;
+    /** UDP sockets hashed on laddr:lport, see solookup_udp(). */
+    struct socket *apUdpHash[SO_HASH_SIZE];
     struct socket *udp_last_so;
 
 # ifndef RT_OS_WINDOWS
@@ -189,6 +193,16 @@ typedef struct NATState
 #  define NSOCK_DEC() do {pData->nsock--;} while (0)
 #  define NSOCK_INC_EX(ex) do {ex->pData->nsock++;} while (0)
 #  define NSOCK_DEC_EX(ex) do {ex->pData->nsock--;} while (0)
+#  ifdef VBOX_NAT_WITH_EPOLL
+    /** The epoll set sockets are registered with, -1 when poll() is used. */
+    int iEpollFd;
+    /** The caller's control descriptor registered by slirp_poll(), -1 if none. */
+    int iEpollCtlFd;
+    /** Number of entries in papEpollOwners. */
+    int cEpollOwners;
+    /** Maps descriptors to the socket which registered them with the epoll set. */
+    struct socket **papEpollOwners;
+#  endif
 # else
 #  define NSOCK_INC() do {} while (0)
 #  define NSOCK_DEC() do {} while (0)
@@ -97,6 +97,95 @@ solookup(struct socket *head, struct in_addr laddr,
     return (struct socket *)NULL;
 }
 
+/*
+ * Socket lookup hashes.
+ *
+ * Every TCP socket is indexed on its full 4-tuple and every UDP socket on the
+ * guest side address and port (which is all udp_input() matches on), so the
+ * per-segment lookup doesn't have to walk tcb/udb.  Sockets are (re)hashed
+ * whenever the fields making up the key are assigned and unhashed by sofree().
+ */
+static unsigned
+sohashfn(struct in_addr laddr, u_int lport, struct in_addr faddr, u_int fport)
+{
+    uint32_t u32 = laddr.s_addr ^ RT_BSWAP_U32(faddr.s_addr) ^ ((lport << 16) | (fport & 0xffff));
+    u32 ^= u32 >> 16;
+    u32 *= UINT32_C(0x45d9f3b);
+    u32 ^= u32 >> 16;
+    return u32 & (SO_HASH_SIZE - 1);
+}
+
+void
+sounhash(struct socket *so)
+{
+    if (so->so_hpprev == NULL)
+        return;
+    if (so->so_hnext != NULL)
+        so->so_hnext->so_hpprev = so->so_hpprev;
+    *so->so_hpprev = so->so_hnext;
+    so->so_hnext = NULL;
+    so->so_hpprev = NULL;
+}
+
+static void
+sohash_insert(struct socket **ppHead, struct socket *so)
+{
+    sounhash(so);
+    so->so_hnext = *ppHead;
+    if (so->so_hnext != NULL)
+        so->so_hnext->so_hpprev = &so->so_hnext;
+    so->so_hpprev = ppHead;
+    *ppHead = so;
+}
+
+void
+sohash_tcp(PNATState pData, struct socket *so)
+{
+    Assert(so->so_type == IPPROTO_TCP);
+    sohash_insert(&pData->apTcpHash[sohashfn(so->so_laddr, so->so_lport, so->so_faddr, so->so_fport)], so);
+}
+
+void
+sohash_udp(PNATState pData, struct socket *so)
+{
+    static const struct in_addr s_AnyAddr = { INADDR_ANY };
+    Assert(so->so_type == IPPROTO_UDP);
+    sohash_insert(&pData->apUdpHash[sohashfn(so->so_laddr, so->so_lport, s_AnyAddr, 0)], so);
+}
+
+struct socket *
+solookup_tcp(PNATState pData, struct in_addr laddr, u_int lport, struct in_addr faddr, u_int fport)
+{
+    struct socket *so;
+
+    for (so = pData->apTcpHash[sohashfn(laddr, lport, faddr, fport)]; so != NULL; so = so->so_hnext)
+    {
+        if (   so->so_lport        == lport
+            && so->so_laddr.s_addr == laddr.s_addr
+            && so->so_faddr.s_addr == faddr.s_addr
+            && so->so_fport        == fport)
+            return so;
+    }
+
+    return (struct socket *)NULL;
+}
+
+struct socket *
+solookup_udp(PNATState pData, struct in_addr laddr, u_int lport)
+{
+    static const struct in_addr s_AnyAddr = { INADDR_ANY };
+    struct socket *so;
+
+    for (so = pData->apUdpHash[sohashfn(laddr, lport, s_AnyAddr, 0)]; so != NULL; so = so->so_hnext)
+    {
+        if (   so->so_lport        == lport
+            && so->so_laddr.s_addr == laddr.s_addr)
+            return so;
+    }
+
+    return (struct socket *)NULL;
+}
+
 /*
  * Create a new socket, initialise the fields
  * It is the responsibility of the caller to
@@ -161,6 +250,11 @@ sofree(PNATState pData, struct socket *so)
         so->so_ohdr = NULL;
     }
 
+    sounhash(so);
+#ifdef VBOX_NAT_WITH_EPOLL
+    slirp_epoll_forget(pData, so);
+#endif
+
     if (so->so_next && so->so_prev)
     {
         remque(pData, so);  /* crashes if so is not in a queue */
@@ -1084,6 +1178,7 @@ no_sockopt:
         so->so_faddr = alias_addr;
     else
         so->so_faddr = addr.sin_addr;
+    sohash_tcp(pData, so);
 
     so->s = s;
     SOCKET_UNLOCK(so);
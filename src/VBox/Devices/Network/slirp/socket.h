@@ -32,6 +32,9 @@
 #define SO_EXPIRE 240000
 #define SO_EXPIREFAST 10000
 
+/** Number of buckets in the TCP and UDP socket lookup hashes (power of two). */
+#define SO_HASH_SIZE 512
+
 /*
  * Our socket structure
  */
@@ -40,6 +43,8 @@ struct socket
 {
     struct socket   *so_next;
     struct socket   *so_prev;    /* For a linked list of sockets */
+    struct socket   *so_hnext;   /* Next socket in the same lookup hash bucket */
+    struct socket  **so_hpprev;  /* Link pointing to us in the hash chain, NULL if not hashed */
 
 #if !defined(RT_OS_WINDOWS)
     int s;                       /* The actual socket */
@@ -89,6 +94,10 @@ struct socket
 #ifndef RT_OS_WINDOWS
     int so_poll_index;
 #endif /* !RT_OS_WINDOWS */
+#ifdef VBOX_NAT_WITH_EPOLL
+    int so_epoll_fd;             /* descriptor registered with the epoll set */
+    uint32_t so_epoll_events;    /* events registered with the epoll set, 0 if not registered */
+#endif
     /*
      * FD_CLOSE/POLLHUP event has been occurred on socket
      */
@@ -164,6 +173,14 @@ struct iovec
 
 void so_init (void);
 struct socket * solookup (struct socket *, struct in_addr, u_int, struct in_addr, u_int);
+struct socket * solookup_tcp (PNATState, struct in_addr, u_int, struct in_addr, u_int);
+struct socket * solookup_udp (PNATState, struct in_addr, u_int);
+void sohash_tcp (PNATState, struct socket *);
+void sohash_udp (PNATState, struct socket *);
+void sounhash (struct socket *);
+#ifdef VBOX_NAT_WITH_EPOLL
+void slirp_epoll_forget (PNATState, struct socket *);
+#endif
 struct socket * socreate (void);
 void sofree (PNATState, struct socket *);
 int sobind(PNATState, struct socket *);
@@ -480,9 +480,8 @@ findso:
         || so->so_faddr.s_addr != ti->ti_dst.s_addr)
     {
         QSOCKET_UNLOCK(tcb);
-        /** @todo fix SOLOOKUP macrodefinition to be usable here */
-        so = solookup(&tcb, ti->ti_src, ti->ti_sport,
-                      ti->ti_dst, ti->ti_dport);
+        so = solookup_tcp(pData, ti->ti_src, ti->ti_sport,
+                          ti->ti_dst, ti->ti_dport);
         if (so)
         {
             tcp_last_so = so;
@@ -539,6 +538,7 @@ findso:
         so->so_lport = ti->ti_sport;
         so->so_faddr = ti->ti_dst;
         so->so_fport = ti->ti_dport;
+        sohash_tcp(pData, so);
 
         so->so_iptos = ((struct ip *)ti)->ip_tos;
 
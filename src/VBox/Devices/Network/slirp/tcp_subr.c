@@ -597,6 +597,7 @@ tcp_connect(PNATState pData, struct socket *inso)
     /* Translate connections from localhost to the real hostname */
     if (so->so_faddr.s_addr == 0 || so->so_faddr.s_addr == loopback_addr.s_addr)
         so->so_faddr = alias_addr;
+    sohash_tcp(pData, so);
 
     /* Close the accept() socket, set right state */
     if (inso->so_state & SS_FACCEPTONCE)
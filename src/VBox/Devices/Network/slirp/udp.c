@@ -238,20 +238,8 @@ udp_input(PNATState pData, register struct mbuf *m, int iphlen)
     if (   so->so_lport != uh->uh_sport
         || so->so_laddr.s_addr != ip->ip_src.s_addr)
     {
-        struct socket *tmp;
-
-        for (tmp = udb.so_next; tmp != &udb; tmp = tmp->so_next)
-        {
-            if (   tmp->so_lport        == uh->uh_sport
-                && tmp->so_laddr.s_addr == ip->ip_src.s_addr)
-            {
-                so = tmp;
-                break;
-            }
-        }
-        if (tmp == &udb)
-            so = NULL;
-        else
+        so = solookup_udp(pData, ip->ip_src, uh->uh_sport);
+        if (so)
         {
             udpstat.udpps_pcbcachemiss++;
             udp_last_so = so;
@@ -478,6 +466,7 @@ int udp_output(PNATState pData, struct socket *so, struct mbuf *m,
             LogRel2(("NAT: port-forward: using %RTnaipv4 for %R[natsock]\n",
                      pData->guest_addr_guess.s_addr, so));
             so->so_laddr = pData->guest_addr_guess;
+            sohash_udp(pData, so);
         }
         else
         {
@@ -564,6 +553,7 @@ udp_attach(PNATState pData, struct socket *so)
     QSOCKET_LOCK(udb);
     insque(pData, so, &udb);
     NSOCK_INC();
+    sohash_udp(pData, so);
     QSOCKET_UNLOCK(udb);
     return so->s;
 error:
@@ -661,6 +651,7 @@ udp_listen(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_
 
     so->so_lport = lport;
     so->so_laddr.s_addr = laddr;
+    sohash_udp(pData, so);
     if (flags != SS_FACCEPTONCE)
         so->so_expire = 0;
 
@@ -258,6 +258,11 @@ extern "C" DECLEXPORT(int) VBoxDriversRegister(PCPDMDRVREGCB pCallbacks, uint32_
     if (RT_FAILURE(rc))
         return rc;
 #endif
+#ifdef RT_OS_LINUX
+    rc = pCallbacks->pfnRegister(pCallbacks, &g_DrvAFPacket);
+    if (RT_FAILURE(rc))
+        return rc;
+#endif
 #ifdef VBOX_WITH_UDPTUNNEL
     rc = pCallbacks->pfnRegister(pCallbacks, &g_DrvUDPTunnel);
     if (RT_FAILURE(rc))
@@ -110,6 +110,9 @@ extern const PDMDRVREG g_DrvISCSITransportTcp;
 #if defined(RT_OS_LINUX) || defined(RT_OS_FREEBSD)
 extern const PDMDRVREG g_DrvHostInterface;
 #endif
+#ifdef RT_OS_LINUX
+extern const PDMDRVREG g_DrvAFPacket;
+#endif
 #ifdef VBOX_WITH_UDPTUNNEL
 extern const PDMDRVREG g_DrvUDPTunnel;
 #endif
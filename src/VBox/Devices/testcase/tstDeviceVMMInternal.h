@@ -130,7 +130,7 @@ typedef struct VMINTUSERPERVMCPU
     PCTSTDEVVMMCALLBACKS pVmmCallbacks;
     /** @todo: */
 } VMINTUSERPERVMCPU;
-AssertCompile(sizeof(VMINTUSERPERVMCPU) <= 512);
+AssertCompile(sizeof(VMINTUSERPERVMCPU) <= 2560);
 
 /**
  * Internal user VM structure.
@@ -153,7 +153,7 @@ typedef struct PDMCRITSECTINT
     /** The actual critical section used for emulation. */
     RTCRITSECT           CritSect;
 } PDMCRITSECTINT;
-AssertCompile(sizeof(PDMCRITSECTINT) <= (HC_ARCH_BITS == 32 ? 0x80 : 0xc0));
+AssertCompile(sizeof(PDMCRITSECTINT) <= (HC_ARCH_BITS == 32 ? 0x88 : 0xc0));
 
 /**
  * Internal PDM thread instance data.
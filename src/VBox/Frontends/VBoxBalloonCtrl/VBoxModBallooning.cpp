@@ -24,6 +24,10 @@
 #endif /* !VBOX_ONLY_DOCS */
 
 #include "VBoxWatchdogInternal.h"
+#include "VBoxModBallooningPolicy.h"
+#include <iprt/ctype.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
 #include <iprt/system.h>
 
 using namespace com;
@@ -46,7 +50,10 @@ enum GETOPTDEF_BALLOONCTRL
     GETOPTDEF_BALLOONCTRL_BALLOONMAX,
     GETOPTDEF_BALLOONCTRL_BALLOONSAFETY,
     GETOPTDEF_BALLOONCTRL_TIMEOUTMS,
-    GETOPTDEF_BALLOONCTRL_GROUPS
+    GETOPTDEF_BALLOONCTRL_GROUPS,
+    GETOPTDEF_BALLOONCTRL_POLICY,
+    GETOPTDEF_BALLOONCTRL_PRESSURE,
+    GETOPTDEF_BALLOONCTRL_DECISIONLOG
 };
 
 /**
@@ -54,14 +61,33 @@ enum GETOPTDEF_BALLOONCTRL
  */
 static const RTGETOPTDEF g_aBalloonOpts[] = {
     { "--balloon-dec",            GETOPTDEF_BALLOONCTRL_BALLOONDEC,        RTGETOPT_REQ_UINT32 },
+    { "--balloon-decision-log",   GETOPTDEF_BALLOONCTRL_DECISIONLOG,       RTGETOPT_REQ_STRING },
     { "--balloon-groups",         GETOPTDEF_BALLOONCTRL_GROUPS,            RTGETOPT_REQ_STRING },
     { "--balloon-inc",            GETOPTDEF_BALLOONCTRL_BALLOONINC,        RTGETOPT_REQ_UINT32 },
     { "--balloon-interval",       GETOPTDEF_BALLOONCTRL_TIMEOUTMS,         RTGETOPT_REQ_UINT32 },
     { "--balloon-lower-limit",    GETOPTDEF_BALLOONCTRL_BALLOONLOWERLIMIT, RTGETOPT_REQ_UINT32 },
     { "--balloon-max",            GETOPTDEF_BALLOONCTRL_BALLOONMAX,        RTGETOPT_REQ_UINT32 },
+    { "--balloon-policy",         GETOPTDEF_BALLOONCTRL_POLICY,            RTGETOPT_REQ_STRING },
+    { "--balloon-pressure",       GETOPTDEF_BALLOONCTRL_PRESSURE,          RTGETOPT_REQ_UINT32 },
     { "--balloon-safety-margin",  GETOPTDEF_BALLOONCTRL_BALLOONSAFETY,     RTGETOPT_REQ_UINT32 }
 };
 
+/**
+ * The ballooning policies.
+ */
+typedef enum BALLOONPOLICY
+{
+    /** Not configured (yet). */
+    BALLOONPOLICY_INVALID = 0,
+    /** Each VM is handled on its own, inflating towards the requested balloon
+     *  size as long as the guest has free memory.  The default. */
+    BALLOONPOLICY_THRESHOLD,
+    /** All VMs are handled together, reclaiming memory from the guests with the
+     *  most free memory when the host runs short and giving it back when the
+     *  host has memory to spare. */
+    BALLOONPOLICY_PRESSURE
+} BALLOONPOLICY;
+
 /** The ballooning module's payload. */
 typedef struct VBOXWATCHDOG_BALLOONCTRL_PAYLOAD
 {
@@ -84,6 +110,18 @@ static uint32_t g_cMbMemoryBalloonDecrement  = 128;
 static uint32_t g_cMbMemoryBalloonMax        = 0;
 static uint32_t g_cMbMemoryBalloonLowerLimit = 128;
 static uint32_t g_cbMemoryBalloonSafety     = 1024;
+/** Command line: The ballooning policy. */
+static BALLOONPOLICY g_enmBalloonPolicy      = BALLOONPOLICY_INVALID;
+/** Command line: Host memory pressure (percent of time stalled during the last
+ *  10 seconds) at which the pressure policy starts reclaiming guest memory. */
+static uint32_t g_uBalloonPressureHigh       = 0;
+/** Whether g_uBalloonPressureHigh was set on the command line, 0 is valid
+ *  there and disables pressure driven reclaiming. */
+static bool     g_fBalloonPressureSet        = false;
+/** Command line: Where to log the pressure policy decisions to (CSV). */
+static const char *g_pszBalloonDecisionLog   = NULL;
+/** The decision log stream, NULL if not logging decisions. */
+static PRTSTREAM g_pBalloonDecisionLog       = NULL;
 
 
 /*********************************************************************************************************************************
@@ -504,6 +542,238 @@ static int balloonMachineUpdate(PVBOXWATCHDOG_MACHINE pMachine)
     return vrc;
 }
 
+/**
+ * Converts a ballooning policy name to the enum value.
+ *
+ * @return  IPRT status code.
+ * @param   pszPolicy               The policy name.
+ * @param   penmPolicy              Where to store the policy on success.
+ */
+static int balloonPolicyToEnum(const char *pszPolicy, BALLOONPOLICY *penmPolicy)
+{
+    AssertPtrReturn(pszPolicy, VERR_INVALID_POINTER);
+    AssertPtrReturn(penmPolicy, VERR_INVALID_POINTER);
+
+    if (!RTStrICmp(pszPolicy, "threshold"))
+        *penmPolicy = BALLOONPOLICY_THRESHOLD;
+    else if (!RTStrICmp(pszPolicy, "pressure"))
+        *penmPolicy = BALLOONPOLICY_PRESSURE;
+    else
+        return VERR_INVALID_PARAMETER;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Queries the current host memory pressure.
+ *
+ * On Linux this is the "some avg10" value of the pressure stall information
+ * (/proc/pressure/memory, kernel 4.20 and later), i.e. the percentage of the
+ * last 10 seconds in which at least one task was stalled waiting for memory.
+ *
+ * @return  IPRT status code, VERR_NOT_SUPPORTED if the host doesn't tell.
+ * @param   puPressure              Where to store the pressure (in 1/100 percent).
+ */
+static int balloonQueryHostPressure(uint32_t *puPressure)
+{
+#ifdef RT_OS_LINUX
+    PRTSTREAM pStrm;
+    int vrc = RTStrmOpen("/proc/pressure/memory", "r", &pStrm);
+    if (RT_FAILURE(vrc))
+        return vrc;
+
+    vrc = VERR_NOT_SUPPORTED;
+    char szLine[256];
+    while (RT_SUCCESS(RTStrmGetLine(pStrm, szLine, sizeof(szLine))))
+    {
+        if (strncmp(szLine, "some ", 5))
+            continue;
+
+        const char *pszValue = strstr(szLine, "avg10=");
+        if (pszValue)
+        {
+            char *pszNext = NULL;
+            uint32_t uPercent = 0;
+            vrc = RTStrToUInt32Ex(pszValue + sizeof("avg10=") - 1, &pszNext, 10, &uPercent);
+            if (RT_SUCCESS(vrc))
+            {
+                uint32_t uFraction = 0;
+                if (   pszNext
+                    && *pszNext == '.'
+                    && RT_C_IS_DIGIT(pszNext[1]))
+                {
+                    uFraction = (pszNext[1] - '0') * 10;
+                    if (RT_C_IS_DIGIT(pszNext[2]))
+                        uFraction += pszNext[2] - '0';
+                }
+                *puPressure = uPercent * 100 + uFraction;
+                vrc = VINF_SUCCESS;
+            }
+        }
+        break;
+    }
+
+    RTStrmClose(pStrm);
+    return vrc;
+#else
+    RT_NOREF(puPressure);
+    return VERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Determines the fairness weight of the specified machine.
+ *
+ * The weight can be set
+ * - via per-VM extra-data ("VBoxInternal2/Watchdog/BalloonCtrl/BalloonWeight")
+ * - via global extra-data ("VBoxInternal2/Watchdog/BalloonCtrl/BalloonWeight")
+ *
+ * Precedence from top to bottom.  A VM with twice the weight of another gives
+ * up half as much memory when the host needs memory back, and gets twice as
+ * much back when the host has memory to spare.
+ *
+ * @return  The weight, 1 to 10000.
+ * @param   pMachine                Machine to determine the weight for.
+ */
+static uint32_t balloonPolicyGetWeight(PVBOXWATCHDOG_MACHINE pMachine)
+{
+    uint32_t uWeight;
+    cfgGetValueU32(g_pVirtualBox, pMachine->machine,
+                   "VBoxInternal2/Watchdog/BalloonCtrl/BalloonWeight", "VBoxInternal2/Watchdog/BalloonCtrl/BalloonWeight",
+                   &uWeight, BALLOON_POLICY_DEFAULT_WEIGHT);
+    return RT_MAX(RT_MIN(uWeight, 10000), 1);
+}
+
+/**
+ * Collects the guest memory statistics of all running machines for a
+ * pressure policy pass.
+ *
+ * Machines without guest statistics (yet) are skipped.
+ *
+ * @param   vecVMs                  Where to add the machines.
+ */
+static void balloonPolicyCollect(vecBalloonPolicyVM &vecVMs)
+{
+    for (mapVMIter it = g_mapVM.begin(); it != g_mapVM.end(); ++it)
+    {
+        PVBOXWATCHDOG_MACHINE pMachine = &it->second;
+        if (!balloonIsPossible(getMachineState(pMachine)))
+            continue;
+
+        LONG cKbTotal = 0;
+        LONG cKbFree  = 0;
+        uint32_t cMbBalloonCur = 0;
+        int vrc = getMetric(pMachine, L"Guest/RAM/Usage/Total", &cKbTotal);
+        if (RT_SUCCESS(vrc))
+            vrc = getMetric(pMachine, L"Guest/RAM/Usage/Free", &cKbFree);
+        if (RT_SUCCESS(vrc))
+            vrc = balloonGetCurrentSize(pMachine, &cMbBalloonCur);
+        if (RT_FAILURE(vrc))
+        {
+            serviceLog("[%ls] Error retrieving metrics, rc=%Rrc\n", pMachine->strName.raw(), vrc);
+            continue;
+        }
+        if (cKbTotal <= 0 || cKbFree <= 0)
+        {
+            serviceLogVerbose(("[%ls] No metrics available yet!\n", pMachine->strName.raw()));
+            continue;
+        }
+
+        BALLOONPOLICYVM VM;
+        VM.pMachine      = pMachine;
+        VM.cMbTotal      = (uint32_t)cKbTotal / 1024;
+        VM.cMbFree       = (uint32_t)cKbFree / 1024;
+        VM.cMbBalloonCur = cMbBalloonCur;
+        VM.uWeight       = balloonPolicyGetWeight(pMachine);
+        VM.fEnabled      = balloonIsEnabled(pMachine);
+        VM.cMbDelta      = 0;
+        VM.pszReason     = "hold";
+
+        /* The balloon may grow up to the requested size, or if none is set, up to
+           where the guest is left with the lower limit.  The maximum applies to both. */
+        VM.cMbBalloonCeiling = balloonGetRequestedSize(pMachine);
+        if (!VM.cMbBalloonCeiling)
+            VM.cMbBalloonCeiling = VM.cMbTotal > g_cMbMemoryBalloonLowerLimit ? VM.cMbTotal - g_cMbMemoryBalloonLowerLimit : 0;
+        uint32_t const cMbMax = balloonGetMaxSize(pMachine);
+        if (cMbMax && VM.cMbBalloonCeiling > cMbMax)
+            VM.cMbBalloonCeiling = cMbMax;
+
+        vecVMs.push_back(VM);
+    }
+}
+
+/**
+ * Does a pressure policy pass over all running machines.
+ *
+ * @return  IPRT status code.
+ */
+static int balloonPolicyUpdateAll(void)
+{
+    uint64_t cbHostAvail = 0;
+    int vrc = RTSystemQueryAvailableRam(&cbHostAvail);
+    if (RT_FAILURE(vrc))
+    {
+        serviceLog("Error querying available host memory, rc=%Rrc\n", vrc);
+        return VINF_SUCCESS; /* Try again next time. */
+    }
+    uint32_t const cMbHostAvail = (uint32_t)RT_MIN(cbHostAvail / _1M, UINT32_MAX);
+
+    uint32_t uPressure = 0;
+    int vrc2 = balloonQueryHostPressure(&uPressure);
+    if (RT_FAILURE(vrc2))
+        uPressure = 0;
+
+    vecBalloonPolicyVM vecVMs;
+    balloonPolicyCollect(vecVMs);
+    BALLOONPOLICYCFG Cfg;
+    Cfg.cMbSafety     = g_cbMemoryBalloonSafety;
+    Cfg.uPressureHigh = g_uBalloonPressureHigh;
+    Cfg.cMbIncrement  = g_cMbMemoryBalloonIncrement;
+    Cfg.cMbDecrement  = g_cMbMemoryBalloonDecrement;
+    Cfg.cMbLowerLimit = g_cMbMemoryBalloonLowerLimit;
+    balloonPolicyDecide(&Cfg, vecVMs, cMbHostAvail, uPressure);
+
+    serviceLogVerbose(("Host: Available=%RU32MB, Pressure=%u.%02u%%%s, VMs=%zu\n", cMbHostAvail,
+                       uPressure / 100, uPressure % 100, RT_SUCCESS(vrc2) ? "" : " (n/a)", vecVMs.size()));
+
+    RTTIMESPEC Now;
+    uint64_t const msNow = RTTimeSpecGetMilli(RTTimeNow(&Now));
+    for (size_t i = 0; i < vecVMs.size(); i++)
+    {
+        BALLOONPOLICYVM &VM = vecVMs[i];
+
+        if (g_pBalloonDecisionLog)
+            RTStrmPrintf(g_pBalloonDecisionLog, "%RU64,%ls,%RU32,%u.%02u,%RU32,%RU32,%RU32,%RU32,%RU32,%RI32,%s\n",
+                         msNow, VM.pMachine->strName.raw(), cMbHostAvail, uPressure / 100, uPressure % 100,
+                         VM.cMbFree, VM.cMbTotal, VM.cMbBalloonCur, VM.cMbBalloonCeiling, VM.uWeight,
+                         VM.cMbDelta, VM.pszReason);
+
+        PVBOXWATCHDOG_BALLOONCTRL_PAYLOAD pData;
+        pData = (PVBOXWATCHDOG_BALLOONCTRL_PAYLOAD)payloadFrom(VM.pMachine, VBOX_MOD_BALLOONING_NAME);
+        AssertContinue(pData);
+
+        uint32_t const cMbBalloonNew = VM.cMbBalloonCur + VM.cMbDelta;
+        if (VM.cMbDelta)
+        {
+            serviceLog("[%ls] %s balloon by %RU32MB to %RU32MB (%s; free %RU32MB, weight %RU32) ...\n",
+                       VM.pMachine->strName.raw(), VM.cMbDelta > 0 ? "Inflating" : "Deflating",
+                       RT_ABS(VM.cMbDelta), cMbBalloonNew, VM.pszReason, VM.cMbFree, VM.uWeight);
+            vrc = balloonSetSize(VM.pMachine, cMbBalloonNew);
+            if (RT_FAILURE(vrc))
+                serviceLog("[%ls] Error setting balloon size, rc=%Rrc\n", VM.pMachine->strName.raw(), vrc);
+        }
+        else
+            serviceLogVerbose(("[%ls] Free RAM (MB): %RU32, Ballooning: Current=%RU32MB, Ceiling=%RU32MB, Weight=%RU32 (%s)\n",
+                               VM.pMachine->strName.raw(), VM.cMbFree, VM.cMbBalloonCur, VM.cMbBalloonCeiling,
+                               VM.uWeight, VM.pszReason));
+
+        pData->cMbBalloonCurLast = cMbBalloonNew;
+    }
+
+    if (g_pBalloonDecisionLog)
+        RTStrmFlush(g_pBalloonDecisionLog);
+    return VINF_SUCCESS;
+}
+
 static int balloonSetSize(PVBOXWATCHDOG_MACHINE pMachine, uint32_t cMbBalloonCur)
 {
     int vrc = VINF_SUCCESS;
@@ -595,6 +865,21 @@ static DECLCALLBACK(int) VBoxModBallooningOption(int argc, char *argv[], int *pi
                 g_cbMemoryBalloonSafety = ValueUnion.u32;
                 break;
 
+            case GETOPTDEF_BALLOONCTRL_POLICY:
+                rc = balloonPolicyToEnum(ValueUnion.psz, &g_enmBalloonPolicy);
+                if (RT_FAILURE(rc))
+                    rc = -1; /* Option unknown. */
+                break;
+
+            case GETOPTDEF_BALLOONCTRL_PRESSURE:
+                g_uBalloonPressureHigh = RT_MIN(ValueUnion.u32, 100);
+                g_fBalloonPressureSet  = true;
+                break;
+
+            case GETOPTDEF_BALLOONCTRL_DECISIONLOG:
+                g_pszBalloonDecisionLog = ValueUnion.psz;
+                break;
+
             /** @todo This option is a common module option! Put
              *        this into a utility function! */
             case GETOPTDEF_BALLOONCTRL_TIMEOUTMS:
@@ -639,6 +924,42 @@ static DECLCALLBACK(int) VBoxModBallooningInit(void)
                        "VBoxInternal2/Watchdog/BalloonCtrl/BalloonLowerLimitMB", NULL /* Per-machine */,
                        &g_cMbMemoryBalloonLowerLimit, 128);
 
+    if (g_enmBalloonPolicy == BALLOONPOLICY_INVALID) /* Not set by command line? */
+    {
+        Utf8Str strPolicy;
+        cfgGetValueStr(g_pVirtualBox, NULL /* Machine */,
+                       "VBoxInternal2/Watchdog/BalloonCtrl/Policy", NULL /* Per-machine */,
+                       strPolicy, "threshold" /* Default value. */);
+        int rc2 = balloonPolicyToEnum(strPolicy.c_str(), &g_enmBalloonPolicy);
+        if (RT_FAILURE(rc2))
+        {
+            serviceLog("balloon: Warning: Ballooning policy string invalid (%s), defaulting to threshold\n",
+                       strPolicy.c_str());
+            g_enmBalloonPolicy = BALLOONPOLICY_THRESHOLD;
+        }
+    }
+
+    if (!g_fBalloonPressureSet)
+    {
+        cfgGetValueU32(g_pVirtualBox, NULL /* Machine */,
+                       "VBoxInternal2/Watchdog/BalloonCtrl/PressurePercent", NULL /* Per-machine */,
+                       &g_uBalloonPressureHigh, 10);
+        g_uBalloonPressureHigh = RT_MIN(g_uBalloonPressureHigh, 100);
+    }
+
+    if (g_pszBalloonDecisionLog)
+    {
+        int rc = RTStrmOpen(g_pszBalloonDecisionLog, "a", &g_pBalloonDecisionLog);
+        if (RT_FAILURE(rc))
+        {
+            serviceLog("balloon: Error opening decision log \"%s\", rc=%Rrc\n", g_pszBalloonDecisionLog, rc);
+            return rc;
+        }
+        RTStrmPrintf(g_pBalloonDecisionLog,
+                     "# time_ms,vm,host_avail_mb,host_pressure_pct,free_mb,total_mb,balloon_mb,ceiling_mb,weight,delta_mb,reason\n");
+    }
+
+    serviceLogVerbose(("balloon: Using the %s policy\n", g_enmBalloonPolicy == BALLOONPOLICY_PRESSURE ? "pressure" : "threshold"));
     return VINF_SUCCESS;
 }
 
@@ -655,6 +976,12 @@ static DECLCALLBACK(int) VBoxModBallooningMain(void)
     }
 
     int rc = VINF_SUCCESS;
+    if (g_enmBalloonPolicy == BALLOONPOLICY_PRESSURE)
+    {
+        rc = balloonPolicyUpdateAll();
+        s_msLast = RTTimeMilliTS();
+        return rc;
+    }
 
     /** @todo Provide API for enumerating/working w/ machines inside a module! */
     mapVMIter it = g_mapVM.begin();
@@ -685,6 +1012,11 @@ static DECLCALLBACK(int) VBoxModBallooningStop(void)
 
 static DECLCALLBACK(void) VBoxModBallooningTerm(void)
 {
+    if (g_pBalloonDecisionLog)
+    {
+        RTStrmClose(g_pBalloonDecisionLog);
+        g_pBalloonDecisionLog = NULL;
+    }
 }
 
 static DECLCALLBACK(int) VBoxModBallooningOnMachineRegistered(const Bstr &strUuid)
@@ -695,7 +1027,8 @@ static DECLCALLBACK(int) VBoxModBallooningOnMachineRegistered(const Bstr &strUui
     PVBOXWATCHDOG_BALLOONCTRL_PAYLOAD pData;
     int rc = payloadAlloc(pMachine, VBOX_MOD_BALLOONING_NAME,
                           sizeof(VBOXWATCHDOG_BALLOONCTRL_PAYLOAD), (void**)&pData);
-    if (RT_SUCCESS(rc))
+    if (   RT_SUCCESS(rc)
+        && g_enmBalloonPolicy != BALLOONPOLICY_PRESSURE) /* The pressure policy only acts on the periodic passes. */
         rc = balloonMachineUpdate(pMachine);
 
     return rc;
@@ -719,7 +1052,8 @@ static DECLCALLBACK(int) VBoxModBallooningOnMachineStateChanged(const Bstr &strU
     PVBOXWATCHDOG_MACHINE pMachine = getMachine(strUuid);
     /* Note: The machine state will change to "setting up" when machine gets deleted,
      *       so pMachine might be NULL here. */
-    if (!pMachine)
+    if (   !pMachine
+        || g_enmBalloonPolicy == BALLOONPOLICY_PRESSURE)
         return VINF_SUCCESS;
 
     return balloonMachineUpdate(pMachine);
@@ -747,7 +1081,8 @@ VBOXMODULE g_ModBallooning =
     /* pszUsage. */
     " [--balloon-dec=<MB>] [--balloon-groups=<string>] [--balloon-inc=<MB>]\n"
     " [--balloon-interval=<ms>] [--balloon-lower-limit=<MB>]\n"
-    " [--balloon-max=<MB>]\n",
+    " [--balloon-max=<MB>] [--balloon-policy=<threshold|pressure>]\n"
+    " [--balloon-pressure=<percent>] [--balloon-decision-log=<file>]\n",
     /* pszOptions. */
     "--balloon-dec          Sets the ballooning decrement in MB (128 MB).\n"
     "--balloon-groups       Sets the VM groups for ballooning (all).\n"
@@ -761,6 +1096,14 @@ VBOXMODULE g_ModBallooning =
     "Set \"VBoxInternal/Guest/BalloonSizeMax\" for a per-VM maximum ballooning size.\n"
 #endif
     "--balloon-safety-margin Free memory when deflating a balloon in MB (1024 MB).\n"
+    "--balloon-policy       Sets the ballooning policy (threshold). \"pressure\"\n"
+    "                       balances all VMs against host memory availability\n"
+    "                       and pressure, using per-VM weights set with\n"
+    "                       \"VBoxInternal2/Watchdog/BalloonCtrl/BalloonWeight\" (100).\n"
+    "--balloon-pressure     Sets the host memory pressure in percent at which\n"
+    "                       the pressure policy reclaims guest memory (10),\n"
+    "                       0 leaves only the safety margin.\n"
+    "--balloon-decision-log Appends the pressure policy decisions to a CSV file.\n"
     ,
     /* methods. */
     VBoxModBallooningPreInit,
@@ -0,0 +1,144 @@
+/* $Id$ */
+/** @file
+ * VBoxModBallooningPolicy - The decision part of the pressure ballooning policy.
+ */
+
+/*
+ * Copyright (C) 2011-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "VBoxModBallooningPolicy.h"
+#include <iprt/cdefs.h>
+
+
+/**
+ * Decides the balloon changes of a pressure policy pass.
+ *
+ * First the changes each VM needs regardless of the host state: deflating the
+ * balloons of guests which run short of memory, which exceed their ceiling or
+ * have ballooning disabled.  Then, if the host is short of memory (below the
+ * safety margin or above the pressure threshold), the missing memory is taken
+ * from the guests in proportion to their free memory divided by their weight.
+ * If the host has more than twice the safety margin available and no
+ * pressure, memory is given back in proportion to balloon size times weight.
+ * Between these two the balloons are left alone, so decisions don't flap.
+ *
+ * All changes are limited to the ballooning increment/decrement per interval.
+ *
+ * This is kept free of the API so the testcase can feed it made up machines.
+ *
+ * @param   pCfg                    The policy settings.
+ * @param   vecVMs                  The machines, cMbDelta and pszReason are set.
+ * @param   cMbHostAvail            Host memory available (MB).
+ * @param   uPressure               Host memory pressure (1/100 percent), 0 if unknown.
+ */
+void balloonPolicyDecide(PCBALLOONPOLICYCFG pCfg, vecBalloonPolicyVM &vecVMs, uint32_t cMbHostAvail, uint32_t uPressure)
+{
+    uint32_t const cMbSafety    = pCfg->cMbSafety;
+    uint32_t const uPressureMax = pCfg->uPressureHigh * 100;
+
+    /*
+     * What does the host want?
+     */
+    uint32_t cMbReclaim = 0;
+    uint32_t cMbSurplus = 0;
+    if (cMbHostAvail < cMbSafety)
+        cMbReclaim = cMbSafety - cMbHostAvail;
+    if (uPressureMax && uPressure >= uPressureMax)
+        cMbReclaim = RT_MAX(cMbReclaim, pCfg->cMbIncrement);
+    if (   !cMbReclaim
+        && cMbHostAvail / 2 > cMbSafety
+        && (!uPressureMax || uPressure < uPressureMax / 4))
+        cMbSurplus = cMbHostAvail - cMbSafety * 2;
+
+    /* Deflating is paid from the host memory above half the safety margin. */
+    uint32_t cMbHostSpare = cMbHostAvail > cMbSafety / 2 ? cMbHostAvail - cMbSafety / 2 : 0;
+
+    /*
+     * Per-VM needs.
+     */
+    uint64_t uReclaimTotal = 0;
+    uint64_t uSurplusTotal = 0;
+    for (size_t i = 0; i < vecVMs.size(); i++)
+    {
+        BALLOONPOLICYVM &VM = vecVMs[i];
+        uint32_t cMbDeflate = 0;
+        if (!VM.fEnabled)
+        {
+            cMbDeflate   = VM.cMbBalloonCur;
+            VM.pszReason = "disabled";
+        }
+        else if (VM.cMbBalloonCur > VM.cMbBalloonCeiling)
+        {
+            cMbDeflate   = RT_MIN(pCfg->cMbDecrement, VM.cMbBalloonCur - VM.cMbBalloonCeiling);
+            VM.pszReason = "ceiling";
+        }
+        else if (VM.cMbFree < pCfg->cMbLowerLimit)
+        {
+            cMbDeflate   = RT_MIN(RT_MIN(pCfg->cMbDecrement, VM.cMbBalloonCur), cMbHostSpare);
+            VM.pszReason = "guest-low";
+        }
+        else
+        {
+            /* Candidate for the host driven changes below. */
+            uint32_t const cMbSlack = VM.cMbFree - pCfg->cMbLowerLimit;
+            uint32_t const cMbRoom  = VM.cMbBalloonCeiling - VM.cMbBalloonCur;
+            if (cMbReclaim && RT_MIN(cMbSlack, cMbRoom) >= BALLOON_POLICY_MIN_STEP_MB)
+                uReclaimTotal += (uint64_t)RT_MIN(cMbSlack, cMbRoom) * BALLOON_POLICY_DEFAULT_WEIGHT / VM.uWeight;
+            else if (cMbSurplus && VM.cMbBalloonCur)
+                uSurplusTotal += (uint64_t)VM.cMbBalloonCur * VM.uWeight;
+            continue;
+        }
+
+        VM.cMbDelta   = -(int32_t)cMbDeflate;
+        cMbHostSpare -= RT_MIN(cMbHostSpare, cMbDeflate);
+    }
+
+    /*
+     * Host driven changes, shared out by weight.
+     */
+    for (size_t i = 0; i < vecVMs.size(); i++)
+    {
+        BALLOONPOLICYVM &VM = vecVMs[i];
+        if (   !VM.fEnabled
+            || VM.cMbDelta
+            || VM.cMbBalloonCur > VM.cMbBalloonCeiling
+            || VM.cMbFree < pCfg->cMbLowerLimit)
+            continue;
+
+        uint32_t const cMbSlack = VM.cMbFree - pCfg->cMbLowerLimit;
+        uint32_t const cMbRoom  = VM.cMbBalloonCeiling - VM.cMbBalloonCur;
+        uint32_t const cMbCanGive = RT_MIN(RT_MIN(cMbSlack, cMbRoom), pCfg->cMbIncrement);
+        if (uReclaimTotal && RT_MIN(cMbSlack, cMbRoom) >= BALLOON_POLICY_MIN_STEP_MB)
+        {
+            uint64_t const uScore = (uint64_t)RT_MIN(cMbSlack, cMbRoom) * BALLOON_POLICY_DEFAULT_WEIGHT / VM.uWeight;
+            uint32_t cMbShare = (uint32_t)RT_MIN(cMbReclaim * uScore / uReclaimTotal + 1, UINT32_MAX);
+            cMbShare = RT_MIN(RT_MAX(cMbShare, BALLOON_POLICY_MIN_STEP_MB), cMbCanGive);
+            VM.cMbDelta  = (int32_t)cMbShare;
+            VM.pszReason = "host-reclaim";
+        }
+        else if (uSurplusTotal && VM.cMbBalloonCur)
+        {
+            uint64_t const uScore = (uint64_t)VM.cMbBalloonCur * VM.uWeight;
+            uint32_t cMbShare = (uint32_t)RT_MIN(cMbSurplus * uScore / uSurplusTotal, UINT32_MAX);
+            cMbShare = RT_MIN(RT_MIN(cMbShare, VM.cMbBalloonCur), pCfg->cMbDecrement);
+            if (cMbShare < BALLOON_POLICY_MIN_STEP_MB && cMbShare != VM.cMbBalloonCur)
+                cMbShare = 0;
+            VM.cMbDelta  = -(int32_t)cMbShare;
+            VM.pszReason = cMbShare ? "host-surplus" : "hold";
+        }
+    }
+}
+
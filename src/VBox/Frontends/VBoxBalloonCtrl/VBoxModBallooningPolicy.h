@@ -0,0 +1,80 @@
+/* $Id$ */
+/** @file
+ * VBoxModBallooningPolicy - The decision part of the pressure ballooning policy.
+ */
+
+/*
+ * Copyright (C) 2011-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___H_VBOXMODBALLOONINGPOLICY
+#define ___H_VBOXMODBALLOONINGPOLICY
+
+#include <iprt/types.h>
+
+#include <vector>
+
+/** The smallest balloon change (MB) the pressure policy bothers doing. */
+#define BALLOON_POLICY_MIN_STEP_MB          16
+/** The default fairness weight of a VM. */
+#define BALLOON_POLICY_DEFAULT_WEIGHT       100
+
+struct VBOXWATCHDOG_MACHINE;
+
+/**
+ * Per-VM input and output of a pressure policy pass.
+ */
+typedef struct BALLOONPOLICYVM
+{
+    /** The machine. */
+    struct VBOXWATCHDOG_MACHINE *pMachine;
+    /** Guest RAM size (MB). */
+    uint32_t                cMbTotal;
+    /** Free guest RAM (MB). */
+    uint32_t                cMbFree;
+    /** Current balloon size (MB). */
+    uint32_t                cMbBalloonCur;
+    /** The balloon size (MB) the VM must not exceed. */
+    uint32_t                cMbBalloonCeiling;
+    /** Fairness weight, the higher the less memory is taken from the VM. */
+    uint32_t                uWeight;
+    /** Whether ballooning is enabled for the VM. */
+    bool                    fEnabled;
+    /** The balloon change decided on (MB). */
+    int32_t                 cMbDelta;
+    /** Why cMbDelta was chosen, for the logs. */
+    const char             *pszReason;
+} BALLOONPOLICYVM;
+typedef std::vector<BALLOONPOLICYVM> vecBalloonPolicyVM;
+
+/**
+ * The settings a pressure policy pass works with.
+ */
+typedef struct BALLOONPOLICYCFG
+{
+    /** Host memory (MB) to keep available. */
+    uint32_t                cMbSafety;
+    /** Host memory pressure (percent) at which memory is reclaimed, 0 if
+     *  only the safety margin counts. */
+    uint32_t                uPressureHigh;
+    /** The most a balloon is inflated by per pass (MB). */
+    uint32_t                cMbIncrement;
+    /** The most a balloon is deflated by per pass (MB). */
+    uint32_t                cMbDecrement;
+    /** Free guest memory (MB) below which the balloon is deflated. */
+    uint32_t                cMbLowerLimit;
+} BALLOONPOLICYCFG;
+typedef BALLOONPOLICYCFG const *PCBALLOONPOLICYCFG;
+
+void balloonPolicyDecide(PCBALLOONPOLICYCFG pCfg, vecBalloonPolicyVM &vecVMs, uint32_t cMbHostAvail, uint32_t uPressure);
+
+#endif /* !___H_VBOXMODBALLOONINGPOLICY */
+
@@ -0,0 +1,216 @@
+/* $Id$ */
+/** @file
+ * VBoxBalloonCtrl testcase for the pressure ballooning policy decisions.
+ */
+
+/*
+ * Copyright (C) 2011-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "../VBoxModBallooningPolicy.h"
+
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST g_hTest;
+
+
+/**
+ * Returns the defaults of VBoxBalloonCtrl, with the given pressure threshold.
+ */
+static BALLOONPOLICYCFG tstDefaultCfg(uint32_t uPressureHigh)
+{
+    BALLOONPOLICYCFG Cfg;
+    Cfg.cMbSafety     = 1024;
+    Cfg.uPressureHigh = uPressureHigh;
+    Cfg.cMbIncrement  = 256;
+    Cfg.cMbDecrement  = 128;
+    Cfg.cMbLowerLimit = 128;
+    return Cfg;
+}
+
+/**
+ * Makes up an enabled machine with the default weight.
+ */
+static BALLOONPOLICYVM tstVM(uint32_t cMbFree, uint32_t cMbBalloonCur, uint32_t cMbBalloonCeiling)
+{
+    BALLOONPOLICYVM VM;
+    VM.pMachine          = NULL;
+    VM.cMbTotal          = 4096;
+    VM.cMbFree           = cMbFree;
+    VM.cMbBalloonCur     = cMbBalloonCur;
+    VM.cMbBalloonCeiling = cMbBalloonCeiling;
+    VM.uWeight           = BALLOON_POLICY_DEFAULT_WEIGHT;
+    VM.fEnabled          = true;
+    VM.cMbDelta          = 0;
+    VM.pszReason         = "hold";
+    return VM;
+}
+
+/**
+ * Checks the decision taken for one machine.
+ */
+static void tstCheckVM(BALLOONPOLICYVM const &VM, int32_t cMbDelta, const char *pszReason, unsigned iLine)
+{
+    if (VM.cMbDelta != cMbDelta || strcmp(VM.pszReason, pszReason))
+        RTTestFailed(g_hTest, "line %u: got %RI32 (%s), expected %RI32 (%s)",
+                     iLine, VM.cMbDelta, VM.pszReason, cMbDelta, pszReason);
+}
+#define TST_CHECK_VM(a_VM, a_cMbDelta, a_pszReason) tstCheckVM(a_VM, a_cMbDelta, a_pszReason, __LINE__)
+
+
+static void tstHostDriven(void)
+{
+    RTTestSub(g_hTest, "Host driven changes");
+    BALLOONPOLICYCFG Cfg = tstDefaultCfg(10);
+
+    /* Between the safety margin and twice of it, without pressure: leave it be. */
+    vecBalloonPolicyVM vecVMs;
+    vecVMs.push_back(tstVM(1000, 200, 1000));
+    balloonPolicyDecide(&Cfg, vecVMs, 1500, 0);
+    TST_CHECK_VM(vecVMs[0], 0, "hold");
+
+    /* Plenty of memory but some pressure below the threshold: leave it be. */
+    vecVMs[0] = tstVM(1000, 200, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 500);
+    TST_CHECK_VM(vecVMs[0], 0, "hold");
+
+    /* Pressure above the threshold: inflate by up to the increment. */
+    vecVMs[0] = tstVM(1000, 200, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 5000);
+    TST_CHECK_VM(vecVMs[0], 256, "host-reclaim");
+
+    /* Below the safety margin: inflate, limited by the increment. */
+    vecVMs[0] = tstVM(1000, 200, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 512, 0);
+    TST_CHECK_VM(vecVMs[0], 256, "host-reclaim");
+
+    /* ... and by the room left below the ceiling. */
+    vecVMs[0] = tstVM(1000, 200, 300);
+    balloonPolicyDecide(&Cfg, vecVMs, 512, 0);
+    TST_CHECK_VM(vecVMs[0], 100, "host-reclaim");
+
+    /* Plenty of memory and no pressure: deflate, limited by the decrement. */
+    vecVMs[0] = tstVM(1000, 200, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 0);
+    TST_CHECK_VM(vecVMs[0], -128, "host-surplus");
+
+    /* Surplus shares below the minimum step are not worth it, unless they
+       finish off the balloon. */
+    vecVMs[0] = tstVM(1000, 100, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 2050, 0);
+    TST_CHECK_VM(vecVMs[0], 0, "hold");
+
+    vecVMs[0] = tstVM(1000, 2, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 2050, 0);
+    TST_CHECK_VM(vecVMs[0], -2, "host-surplus");
+}
+
+
+static void tstPressureDisabled(void)
+{
+    RTTestSub(g_hTest, "Pressure threshold 0");
+    BALLOONPOLICYCFG Cfg = tstDefaultCfg(0);
+
+    /* Pressure is ignored... */
+    vecBalloonPolicyVM vecVMs;
+    vecVMs.push_back(tstVM(1000, 200, 1000));
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 9000);
+    TST_CHECK_VM(vecVMs[0], -128, "host-surplus");
+
+    /* ... while the safety margin still counts. */
+    vecVMs[0] = tstVM(1000, 200, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 512, 9000);
+    TST_CHECK_VM(vecVMs[0], 256, "host-reclaim");
+}
+
+
+static void tstWeights(void)
+{
+    RTTestSub(g_hTest, "Weights");
+    BALLOONPOLICYCFG Cfg = tstDefaultCfg(10);
+
+    /* Reclaiming: the heavier VM gives half as much. */
+    vecBalloonPolicyVM vecVMs;
+    vecVMs.push_back(tstVM(2128, 0, 4000));
+    vecVMs.push_back(tstVM(2128, 0, 4000));
+    vecVMs[1].uWeight = 200;
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 1500);
+    TST_CHECK_VM(vecVMs[0], 171, "host-reclaim");
+    TST_CHECK_VM(vecVMs[1],  86, "host-reclaim");
+
+    /* Giving back: the heavier VM gets twice as much. */
+    Cfg.cMbDecrement = 1024;
+    vecVMs[0] = tstVM(2128, 1000, 4000);
+    vecVMs[1] = tstVM(2128, 1000, 4000);
+    vecVMs[1].uWeight = 200;
+    balloonPolicyDecide(&Cfg, vecVMs, 2048 + 300, 0);
+    TST_CHECK_VM(vecVMs[0], -100, "host-surplus");
+    TST_CHECK_VM(vecVMs[1], -200, "host-surplus");
+}
+
+
+static void tstVMNeeds(void)
+{
+    RTTestSub(g_hTest, "Per-VM needs");
+    BALLOONPOLICYCFG Cfg = tstDefaultCfg(10);
+
+    /* These apply whatever the host wants. */
+    vecBalloonPolicyVM vecVMs;
+    vecVMs.push_back(tstVM(1000, 300, 1000));
+    vecVMs[0].fEnabled = false;
+    vecVMs.push_back(tstVM(1000, 500, 100));
+    vecVMs.push_back(tstVM(64, 50, 1000));
+    balloonPolicyDecide(&Cfg, vecVMs, 512, 5000);
+    TST_CHECK_VM(vecVMs[0], -300, "disabled");
+    TST_CHECK_VM(vecVMs[1], -128, "ceiling");
+    TST_CHECK_VM(vecVMs[2],    0, "guest-low");
+
+    /* Deflating for guests short of memory is paid from the host memory
+       above half the safety margin. */
+    vecVMs.clear();
+    vecVMs.push_back(tstVM(64, 128, 1000));
+    vecVMs.push_back(tstVM(64, 128, 1000));
+    balloonPolicyDecide(&Cfg, vecVMs, 600, 0);
+    TST_CHECK_VM(vecVMs[0], -88, "guest-low");
+    TST_CHECK_VM(vecVMs[1],   0, "guest-low");
+
+    vecVMs[0] = tstVM(64, 50, 1000);
+    vecVMs[1] = tstVM(64, 500, 1000);
+    balloonPolicyDecide(&Cfg, vecVMs, 8192, 0);
+    TST_CHECK_VM(vecVMs[0],  -50, "guest-low");
+    TST_CHECK_VM(vecVMs[1], -128, "guest-low");
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstBalloonPolicy", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstHostDriven();
+    tstPressureDisabled();
+    tstWeights();
+    tstVMNeeds();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
@@ -539,6 +539,8 @@ public:
     Utf8Str i_getHardeningLogFilename(void);
 
     void i_composeSavedStateFilename(Utf8Str &strStateFilePath);
+    static Utf8Str i_getSavedStatePageFilename(const Utf8Str &strStateFilePath);
+    static void i_deleteSavedStateFiles(const Utf8Str &strStateFilePath);
 
     void i_getDefaultVideoCaptureFile(Utf8Str &strFile);
 
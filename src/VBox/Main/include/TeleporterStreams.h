@@ -0,0 +1,77 @@
+/* $Id$ */
+/** @file
+ * Main - Teleporter, Multi-Socket Stream Transport.
+ */
+
+/*
+ * Copyright (C) 2010-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___TeleporterStreams_h___
+#define ___TeleporterStreams_h___
+
+#include <iprt/types.h>
+
+
+/**
+ * TCP stream header.
+ *
+ * This is an extra layer for fixing the problem with figuring out when the SSM
+ * stream ends.
+ */
+typedef struct TELEPORTERTCPHDR
+{
+    /** Magic value. */
+    uint32_t    u32Magic;
+    /** The size of the data block following this header.
+     * 0 indicates the end of the stream, while UINT32_MAX indicates
+     * cancelation. */
+    uint32_t    cb;
+} TELEPORTERTCPHDR;
+/** Magic value for TELEPORTERTCPHDR::u32Magic. (Egberto Gismonti Amin) */
+#define TELEPORTERTCPHDR_MAGIC       UINT32_C(0x19471205)
+/** The max block size. */
+#define TELEPORTERTCPHDR_MAX_SIZE    UINT32_C(0x00fffff8)
+
+
+/**
+ * Hello sent by the source on each additional data connection.
+ */
+typedef struct TELEPORTERSTREAMHELLO
+{
+    /** Magic value (TELEPORTERSTREAMHELLO_MAGIC). */
+    uint32_t    u32Magic;
+    /** The stream index, 1 or higher (0 is the control connection). */
+    uint32_t    iStream;
+    /** The cookie the target handed out with the data port. */
+    uint64_t    u64Cookie;
+} TELEPORTERSTREAMHELLO;
+/** Magic value for TELEPORTERSTREAMHELLO::u32Magic. (Hermeto Pascoal) */
+#define TELEPORTERSTREAMHELLO_MAGIC  UINT32_C(0x19360622)
+
+/** The max number of sockets a teleportation can be spread over. */
+#define TELEPORTER_MAX_STREAMS       16
+/** The default number of sockets, see VBoxInternal2/TeleporterStreams. */
+#define TELEPORTER_DEF_STREAMS       4
+
+
+/** Handle to a set of sockets carrying one SSM stream. */
+typedef struct TELEPORTERSTREAMS *PTELEPORTERSTREAMS;
+
+int         TeleporterStreamsCreate(PTELEPORTERSTREAMS *ppStreams, bool fWriter, RTSOCKET const *pahSockets, uint32_t cSockets);
+int         TeleporterStreamsWrite(PTELEPORTERSTREAMS pStreams, const void *pvBuf, size_t cbToWrite);
+int         TeleporterStreamsRead(PTELEPORTERSTREAMS pStreams, void *pvBuf, size_t cbToRead, size_t *pcbRead);
+void        TeleporterStreamsSetStopReading(PTELEPORTERSTREAMS pStreams, bool fStop);
+int         TeleporterStreamsClose(PTELEPORTERSTREAMS pStreams, bool fCancelled);
+void        TeleporterStreamsDestroy(PTELEPORTERSTREAMS pStreams);
+
+#endif
+
@@ -28,12 +28,14 @@
 
 #include "AutoCaller.h"
 #include "HashedPw.h"
+#include "TeleporterStreams.h"
 
 #include <iprt/asm.h>
 #include <iprt/err.h>
 #include <iprt/rand.h>
 #include <iprt/socket.h>
 #include <iprt/tcp.h>
+#include <iprt/time.h>
 #include <iprt/timer.h>
 
 #include <VBox/vmm/vmapi.h>
@@ -71,6 +73,16 @@ public:
     bool volatile       mfIOError;
     /** @} */
 
+    /** @name multi-socket stream stuff
+     * @{  */
+    /** The number of sockets carrying the SSM stream, mhSocket included. */
+    uint32_t            mcStreams;
+    /** The sockets carrying the SSM stream, [0] being mhSocket. */
+    RTSOCKET            mahStreamSockets[TELEPORTER_MAX_STREAMS];
+    /** The multi-socket stream, NULL when only mhSocket is used. */
+    PTELEPORTERSTREAMS  mpStreams;
+    /** @} */
+
     TeleporterState(Console *pConsole, PUVM pUVM, Progress *pProgress, bool fIsSource)
         : mptrConsole(pConsole)
         , mpUVM(pUVM)
@@ -82,7 +94,11 @@ public:
         , mfStopReading(false)
         , mfEndOfStream(false)
         , mfIOError(false)
+        , mcStreams(1)
+        , mpStreams(NULL)
     {
+        for (unsigned i = 0; i < RT_ELEMENTS(mahStreamSockets); i++)
+            mahStreamSockets[i] = NIL_RTSOCKET;
         VMR3RetainUVM(mpUVM);
     }
 
@@ -106,6 +122,12 @@ public:
     MachineState_T      menmOldMachineState;
     bool                mfSuspendedByUs;
     bool                mfUnlockedMedia;
+    /** The number of sockets to spread the stream over. */
+    uint32_t            mcStreamsWanted;
+    /** When the teleportation started (RTTimeNanoTS). */
+    uint64_t            mnsStart;
+    /** When the VM stopped running, 0 while still running (RTTimeNanoTS). */
+    uint64_t            mnsDowntimeStart;
 
     TeleporterStateSrc(Console *pConsole, PUVM pUVM, Progress *pProgress, MachineState_T enmOldMachineState)
         : TeleporterState(pConsole, pUVM, pProgress, true /*fIsSource*/)
@@ -114,6 +136,9 @@ public:
         , menmOldMachineState(enmOldMachineState)
         , mfSuspendedByUs(false)
         , mfUnlockedMedia(false)
+        , mcStreamsWanted(1)
+        , mnsStart(0)
+        , mnsDowntimeStart(0)
     {
     }
 };
@@ -128,6 +153,7 @@ public:
     IMachine                   *mpMachine;
     IInternalMachineControl    *mpControl;
     PRTTCPSERVER                mhServer;
+    Utf8Str                     mstrAddress;
     PRTTIMERLR                  mphTimerLR;
     bool                        mfLockedMedia;
     int                         mRc;
@@ -150,27 +176,6 @@ public:
 };
 
 
-/**
- * TCP stream header.
- *
- * This is an extra layer for fixing the problem with figuring out when the SSM
- * stream ends.
- */
-typedef struct TELEPORTERTCPHDR
-{
-    /** Magic value. */
-    uint32_t    u32Magic;
-    /** The size of the data block following this header.
-     * 0 indicates the end of the stream, while UINT32_MAX indicates
-     * cancelation. */
-    uint32_t    cb;
-} TELEPORTERTCPHDR;
-/** Magic value for TELEPORTERTCPHDR::u32Magic. (Egberto Gismonti Amin) */
-#define TELEPORTERTCPHDR_MAGIC       UINT32_C(0x19471205)
-/** The max block size. */
-#define TELEPORTERTCPHDR_MAX_SIZE    UINT32_C(0x00fffff8)
-
-
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
 *********************************************************************************************************************************/
@@ -318,6 +323,28 @@ static DECLCALLBACK(int) teleporterTcpOpWrite(void *pvUser, uint64_t offStream,
     AssertReturn(cbToWrite < UINT32_MAX, VERR_OUT_OF_RANGE);
     AssertReturn(pState->mfIsSource, VERR_INVALID_HANDLE);
 
+    /* Note down when the guest stopped running for the downtime statistics. */
+    TeleporterStateSrc *pStateSrc = (TeleporterStateSrc *)pState;
+    if (!pStateSrc->mnsDowntimeStart)
+    {
+        VMSTATE const enmVMState = VMR3GetStateU(pState->mpUVM);
+        if (   enmVMState != VMSTATE_RUNNING_LS
+            && enmVMState != VMSTATE_DEBUGGING_LS)
+            pStateSrc->mnsDowntimeStart = RTTimeNanoTS();
+    }
+
+    if (pState->mpStreams)
+    {
+        int rc = TeleporterStreamsWrite(pState->mpStreams, pvBuf, cbToWrite);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter/TCP: Write error: %Rrc (cb=%#zx)\n", rc, cbToWrite));
+            return rc;
+        }
+        pState->moffStream += cbToWrite;
+        return VINF_SUCCESS;
+    }
+
     for (;;)
     {
         TELEPORTERTCPHDR Hdr;
@@ -396,6 +423,24 @@ static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, v
         if (pState->mfIOError)
             return VERR_IO_GEN_FAILURE;
 
+        /*
+         * The multi-socket stream does the block handling itself.
+         */
+        if (pState->mpStreams)
+        {
+            size_t cbRead = cbToRead;
+            rc = TeleporterStreamsRead(pState->mpStreams, pvBuf, cbToRead, pcbRead ? &cbRead : NULL);
+            if (RT_SUCCESS(rc))
+            {
+                pState->moffStream += cbRead;
+                if (pcbRead)
+                    *pcbRead = cbRead;
+            }
+            else if (rc != VERR_EOF && rc != VERR_SSM_CANCELLED)
+                pState->mfIOError = true;
+            return rc;
+        }
+
         /*
          * If there is no more data in the current block, read the next
          * block header.
@@ -535,6 +580,16 @@ static DECLCALLBACK(int) teleporterTcpOpClose(void *pvUser, bool fCancelled)
 {
     TeleporterState *pState = (TeleporterState *)pvUser;
 
+    if (pState->mpStreams)
+    {
+        if (!pState->mfIsSource)
+            ASMAtomicWriteBool(&pState->mfStopReading, true);
+        int rc = TeleporterStreamsClose(pState->mpStreams, fCancelled);
+        if (RT_FAILURE(rc))
+            LogRel(("Teleporter/TCP: Closing the streams failed: %Rrc\n", rc));
+        return rc;
+    }
+
     if (pState->mfIsSource)
     {
         TELEPORTERTCPHDR EofHdr;
@@ -625,6 +680,92 @@ static DECLCALLBACK(void) teleporterDstTimeout(RTTIMERLR hTimerLR, void *pvUser,
 }
 
 
+/**
+ * Destroys the multi-socket stream and closes the extra sockets.
+ *
+ * @param   pState              The teleporter state.
+ */
+static void teleporterCloseStreams(TeleporterState *pState)
+{
+    TeleporterStreamsDestroy(pState->mpStreams);
+    pState->mpStreams = NULL;
+    for (uint32_t i = 1; i < RT_ELEMENTS(pState->mahStreamSockets); i++)
+        if (pState->mahStreamSockets[i] != NIL_RTSOCKET)
+        {
+            if (pState->mfIsSource)
+                RTTcpClientClose(pState->mahStreamSockets[i]);
+            else
+                RTTcpServerDisconnectClient2(pState->mahStreamSockets[i]);
+            pState->mahStreamSockets[i] = NIL_RTSOCKET;
+        }
+    pState->mahStreamSockets[0] = NIL_RTSOCKET;
+    pState->mcStreams = 1;
+}
+
+
+/**
+ * Negotiates and connects the extra sockets for spreading the stream.
+ *
+ * The destination answers the "streams" command with the port and cookie of
+ * a server accepting the extra connections, each of which is then introduced
+ * by a TELEPORTERSTREAMHELLO.  The destination ACKs again once all of them
+ * are in.
+ *
+ * @returns S_OK on success, E_FAIL+setError() on failure.
+ * @param   pState              The teleporter source state.
+ */
+HRESULT Console::i_teleporterSrcConnectStreams(TeleporterStateSrc *pState)
+{
+    char szCmd[64];
+    RTStrPrintf(szCmd, sizeof(szCmd), "streams=%u", pState->mcStreamsWanted);
+    HRESULT hrc = i_teleporterSrcSubmitCommand(pState, szCmd);
+    if (FAILED(hrc))
+        return hrc;
+
+    char szLine[128];
+    int vrc = teleporterTcpReadLine(pState, szLine, sizeof(szLine));
+    if (RT_FAILURE(vrc))
+        return setErrorBoth(E_FAIL, vrc, tr("Failed reading the stream port: %Rrc"), vrc);
+    uint32_t uPort     = 0;
+    uint64_t u64Cookie = 0;
+    char    *pszNext   = NULL;
+    if (!strncmp(szLine, RT_STR_TUPLE("PORT=")))
+        vrc = RTStrToUInt32Ex(&szLine[sizeof("PORT=") - 1], &pszNext, 10, &uPort);
+    else
+        vrc = VERR_PARSE_ERROR;
+    if (RT_SUCCESS(vrc) && pszNext && !strncmp(pszNext, RT_STR_TUPLE(";COOKIE=")))
+        vrc = RTStrToUInt64Full(pszNext + sizeof(";COOKIE=") - 1, 16, &u64Cookie);
+    else if (RT_SUCCESS(vrc))
+        vrc = VERR_PARSE_ERROR;
+    if (vrc != VINF_SUCCESS || !uPort || uPort > 65535)
+        return setError(E_FAIL, tr("Unexpected stream port reply '%s'"), szLine);
+
+    pState->mahStreamSockets[0] = pState->mhSocket;
+    for (uint32_t i = 1; i < pState->mcStreamsWanted; i++)
+    {
+        vrc = RTTcpClientConnect(pState->mstrHostname.c_str(), uPort, &pState->mahStreamSockets[i]);
+        if (RT_FAILURE(vrc))
+            return setErrorBoth(E_FAIL, vrc, tr("Failed to connect stream #%u to port %u on '%s': %Rrc"),
+                                i, uPort, pState->mstrHostname.c_str(), vrc);
+        vrc = RTTcpSetSendCoalescing(pState->mahStreamSockets[i], false /*fEnable*/);
+        AssertRC(vrc);
+
+        TELEPORTERSTREAMHELLO Hello;
+        Hello.u32Magic  = TELEPORTERSTREAMHELLO_MAGIC;
+        Hello.iStream   = i;
+        Hello.u64Cookie = u64Cookie;
+        vrc = RTTcpWrite(pState->mahStreamSockets[i], &Hello, sizeof(Hello));
+        if (RT_FAILURE(vrc))
+            return setErrorBoth(E_FAIL, vrc, tr("Failed to introduce stream #%u: %Rrc"), i, vrc);
+    }
+
+    hrc = i_teleporterSrcReadACK(pState, "streams-connected");
+    if (SUCCEEDED(hrc))
+        pState->mcStreams = pState->mcStreamsWanted;
+    return hrc;
+}
+
+
 /**
  * Do the teleporter.
  *
@@ -647,6 +788,7 @@ HRESULT Console::i_teleporterSrc(TeleporterStateSrc *pState)
         return hrc;
     if (fCanceled)
         return setError(E_FAIL, tr("canceled"));
+    pState->mnsStart = RTTimeNanoTS();
 
     /*
      * Try connect to the destination machine, disable Nagle.
@@ -679,6 +821,16 @@ HRESULT Console::i_teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    /*
+     * Open the extra connections for the state data when configured.
+     */
+    if (pState->mcStreamsWanted > 1)
+    {
+        hrc = i_teleporterSrcConnectStreams(pState);
+        if (FAILED(hrc))
+            return hrc;
+    }
+
     /*
      * Start loading the state.
      *
@@ -690,6 +842,13 @@ HRESULT Console::i_teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    if (pState->mcStreams > 1)
+    {
+        vrc = TeleporterStreamsCreate(&pState->mpStreams, true /*fWriter*/, pState->mahStreamSockets, pState->mcStreams);
+        if (RT_FAILURE(vrc))
+            return setErrorBoth(E_FAIL, vrc, tr("TeleporterStreamsCreate -> %Rrc"), vrc);
+    }
+
     RTSocketRetain(pState->mhSocket);
     void *pvUser = static_cast<void *>(static_cast<TeleporterState *>(pState));
     vrc = VMR3Teleport(pState->mpUVM,
@@ -698,6 +857,8 @@ HRESULT Console::i_teleporterSrc(TeleporterStateSrc *pState)
                        teleporterProgressCallback,  pvUser,
                        &pState->mfSuspendedByUs);
     RTSocketRelease(pState->mhSocket);
+    TeleporterStreamsDestroy(pState->mpStreams);
+    pState->mpStreams = NULL;
     if (RT_FAILURE(vrc))
     {
         if (   vrc == VERR_SSM_CANCELLED
@@ -749,6 +910,12 @@ HRESULT Console::i_teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    uint64_t const nsNow = RTTimeNanoTS();
+    LogRel(("Teleporter: Done in %RU64 ms over %u stream(s), downtime %RU64 ms, %RU64 bytes sent\n",
+            (nsNow - pState->mnsStart) / RT_NS_1MS, pState->mcStreams,
+            pState->mnsDowntimeStart ? (nsNow - pState->mnsDowntimeStart) / RT_NS_1MS : 0,
+            pState->moffStream - UINT64_MAX / 2));
+
     /*
      * teleporterSrcThreadWrapper will do the automatic power off because it
      * has to release the AutoVMCaller.
@@ -781,6 +948,7 @@ Console::i_teleporterSrcThreadWrapper(RTTHREAD hThreadSelf, void *pvUser)
         hrc = pState->mptrConsole->i_teleporterSrc(pState);
 
     /* Close the connection ASAP on so that the other side can complete. */
+    teleporterCloseStreams(pState);
     if (pState->mhSocket != NIL_RTSOCKET)
     {
         RTTcpClientClose(pState->mhSocket);
@@ -993,6 +1161,17 @@ HRESULT Console::teleport(const com::Utf8Str &aHostname, ULONG aTcpport, const c
     pState->muPort          = aTcpport;
     pState->mcMsMaxDowntime = aMaxDowntime;
 
+    /* The number of connections to spread the saved state data over. */
+    Bstr bstrStreams;
+    hrc = mMachine->GetExtraData(Bstr("VBoxInternal2/TeleporterStreams").raw(), bstrStreams.asOutParam());
+    if (SUCCEEDED(hrc) && bstrStreams.isNotEmpty())
+    {
+        uint32_t cStreams = Utf8Str(bstrStreams).toUInt32();
+        pState->mcStreamsWanted = RT_MIN(RT_MAX(cStreams, 1), TELEPORTER_MAX_STREAMS);
+    }
+    else
+        pState->mcStreamsWanted = TELEPORTER_DEF_STREAMS;
+
     void *pvUser = static_cast<void *>(static_cast<TeleporterState *>(pState));
     ptrProgress->i_setCancelCallback(teleporterProgressCancelCallback, pvUser);
 
@@ -1115,6 +1294,7 @@ HRESULT Console::i_teleporterTrg(PUVM pUVM, IMachine *pMachine, Utf8Str *pErrorM
             TeleporterStateTrg theState(this, pUVM, pProgress, pMachine, mControl, &hTimerLR, fStartPaused);
             theState.mstrPassword      = strPassword;
             theState.mhServer          = hServer;
+            theState.mstrAddress       = strAddress;
 
             void *pvUser = static_cast<void *>(static_cast<TeleporterState *>(&theState));
             if (pProgress->i_setCancelCallback(teleporterProgressCancelCallback, pvUser))
@@ -1252,6 +1432,112 @@ static int teleporterTcpWriteNACK(TeleporterStateTrg *pState, int32_t rc2, const
 }
 
 
+/**
+ * Handles the "streams" command, setting up the extra data connections.
+ *
+ * @returns VBox status code.  Any NACK has been sent.
+ * @param   pState          The teleporter destination state.
+ * @param   pszCount        The requested number of streams.
+ */
+static int teleporterTrgAcceptStreams(TeleporterStateTrg *pState, const char *pszCount)
+{
+    uint32_t cStreams;
+    int vrc = RTStrToUInt32Full(pszCount, 10, &cStreams);
+    if (   vrc != VINF_SUCCESS
+        || cStreams < 1
+        || cStreams > TELEPORTER_MAX_STREAMS
+        || pState->mcStreams > 1)
+    {
+        LogRel(("Teleporter: Bad streams command: '%s'\n", pszCount));
+        vrc = VERR_INVALID_PARAMETER;
+        teleporterTcpWriteNACK(pState, vrc);
+        return vrc;
+    }
+
+    /*
+     * Create the server on a random port (same range as the main server).
+     */
+    const char  *pszAddress = pState->mstrAddress.isEmpty() ? NULL : pState->mstrAddress.c_str();
+    PRTTCPSERVER hServer    = NULL;
+    uint32_t     uPort      = 0;
+    vrc = VERR_NET_ADDRESS_IN_USE;
+    for (int cTries = 10240; cTries > 0 && vrc == VERR_NET_ADDRESS_IN_USE; cTries--)
+    {
+        uPort = RTRandU32Ex(cTries >= 8192 ? 49152 : 1024, 65534);
+        vrc = RTTcpServerCreateEx(pszAddress, uPort, &hServer);
+    }
+    if (RT_FAILURE(vrc))
+    {
+        LogRel(("Teleporter: Failed to create the stream server: %Rrc\n", vrc));
+        teleporterTcpWriteNACK(pState, vrc);
+        return vrc;
+    }
+
+    uint64_t const u64Cookie = RTRandU64();
+    char   szMsg[80];
+    size_t cchMsg = RTStrPrintf(szMsg, sizeof(szMsg), "PORT=%u;COOKIE=%RX64\n", uPort, u64Cookie);
+    vrc = teleporterTcpWriteACK(pState);
+    if (RT_SUCCESS(vrc))
+        vrc = RTTcpWrite(pState->mhSocket, szMsg, cchMsg);
+
+    /*
+     * Accept the connections, giving up after 30 seconds.
+     */
+    RTTIMERLR hTimerLR = NIL_RTTIMERLR;
+    if (RT_SUCCESS(vrc))
+        vrc = RTTimerLRCreateEx(&hTimerLR, 0 /*ns*/, RTTIMER_FLAGS_CPU_ANY, teleporterDstTimeout, hServer);
+    if (RT_SUCCESS(vrc))
+        vrc = RTTimerLRStart(hTimerLR, 30 * RT_NS_1SEC_64);
+    uint32_t cConnected = 1;
+    while (RT_SUCCESS(vrc) && cConnected < cStreams)
+    {
+        RTSOCKET hSocket;
+        vrc = RTTcpServerListen2(hServer, &hSocket);
+        if (RT_FAILURE(vrc))
+            break;
+
+        TELEPORTERSTREAMHELLO Hello;
+        int vrc2 = RTTcpSelectOne(hSocket, 5000);
+        if (RT_SUCCESS(vrc2))
+            vrc2 = RTTcpRead(hSocket, &Hello, sizeof(Hello), NULL);
+        if (   RT_SUCCESS(vrc2)
+            && Hello.u32Magic  == TELEPORTERSTREAMHELLO_MAGIC
+            && Hello.u64Cookie == u64Cookie
+            && Hello.iStream   >= 1
+            && Hello.iStream   <  cStreams
+            && pState->mahStreamSockets[Hello.iStream] == NIL_RTSOCKET)
+        {
+            RTTcpSetSendCoalescing(hSocket, false /*fEnable*/);
+            pState->mahStreamSockets[Hello.iStream] = hSocket;
+            cConnected++;
+        }
+        else
+        {
+            /* Could be anyone, just drop it. */
+            LogRel(("Teleporter: Rejected stream connection (vrc2=%Rrc)\n", vrc2));
+            RTTcpServerDisconnectClient2(hSocket);
+        }
+    }
+    RTTimerLRDestroy(hTimerLR);
+    RTTcpServerDestroy(hServer);
+
+    if (RT_SUCCESS(vrc))
+    {
+        pState->mahStreamSockets[0] = pState->mhSocket;
+        pState->mcStreams = cStreams;
+        LogRel(("Teleporter: Receiving the state over %u streams\n", cStreams));
+        return teleporterTcpWriteACK(pState);
+    }
+
+    LogRel(("Teleporter: Failed to accept the stream connections: %Rrc\n", vrc));
+    teleporterCloseStreams(pState);
+    if (vrc == VERR_TCP_SERVER_SHUTDOWN)
+        vrc = VERR_TIMEOUT;
+    teleporterTcpWriteNACK(pState, vrc);
+    return vrc;
+}
+
+
 /**
  * @copydoc FNRTTCPSERVE
  *
@@ -1350,10 +1636,17 @@ Console::i_teleporterTrgServeConnection(RTSOCKET hSocket, void *pvUser)
             RTSocketRetain(pState->mhSocket); /* For concurrent access by I/O thread and EMT. */
             pState->moffStream = 0;
 
+            if (pState->mcStreams > 1)
+            {
+                vrc = TeleporterStreamsCreate(&pState->mpStreams, false /*fWriter*/, pState->mahStreamSockets, pState->mcStreams);
+                AssertLogRelRC(vrc);
+            }
+
             void *pvUser2 = static_cast<void *>(static_cast<TeleporterState *>(pState));
-            vrc = VMR3LoadFromStream(pState->mpUVM,
-                                     &g_teleporterTcpOps, pvUser2,
-                                     teleporterProgressCallback, pvUser2);
+            if (RT_SUCCESS(vrc))
+                vrc = VMR3LoadFromStream(pState->mpUVM,
+                                         &g_teleporterTcpOps, pvUser2,
+                                         teleporterProgressCallback, pvUser2);
 
             RTSocketRelease(pState->mhSocket);
             vrc2 = VMR3AtErrorDeregister(pState->mpUVM, Console::i_genericVMSetErrorCallback, &pState->mErrorText);
@@ -1368,8 +1661,11 @@ Console::i_teleporterTrgServeConnection(RTSOCKET hSocket, void *pvUser)
 
             /* The EOS might not have been read, make sure it is. */
             pState->mfStopReading = false;
+            if (pState->mpStreams)
+                TeleporterStreamsSetStopReading(pState->mpStreams, false);
             size_t cbRead;
             vrc = teleporterTcpOpRead(pvUser2, pState->moffStream, szCmd, 1, &cbRead);
+            teleporterCloseStreams(pState);
             if (vrc != VERR_EOF)
             {
                 LogRel(("Teleporter: Draining teleporterTcpOpRead -> %Rrc\n", vrc));
@@ -1379,6 +1675,8 @@ Console::i_teleporterTrgServeConnection(RTSOCKET hSocket, void *pvUser)
 
             vrc = teleporterTcpWriteACK(pState);
         }
+        else if (!strncmp(szCmd, RT_STR_TUPLE("streams=")))
+            vrc = teleporterTrgAcceptStreams(pState, &szCmd[sizeof("streams=") - 1]);
         else if (!strcmp(szCmd, "cancel"))
         {
             /* Don't ACK this. */
@@ -1448,6 +1746,7 @@ Console::i_teleporterTrgServeConnection(RTSOCKET hSocket, void *pvUser)
         vrc = VERR_WRONG_ORDER;
     if (RT_FAILURE(vrc))
         teleporterTrgUnlockMedia(pState);
+    teleporterCloseStreams(pState);
 
     pState->mRc = vrc;
     pState->mhSocket = NIL_RTSOCKET;
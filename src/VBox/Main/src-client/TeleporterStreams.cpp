@@ -0,0 +1,718 @@
+/* $Id$ */
+/** @file
+ * Main - Teleporter, Multi-Socket Stream Transport.
+ *
+ * Spreads the SSM stream of a teleportation over several TCP connections so
+ * the transfer isn't limited by what a single connection (and the thread
+ * feeding it) can push through.  The stream is cut into blocks which are
+ * dealt out round-robin, block N going to socket N % cSockets.  Each block
+ * uses the same TELEPORTERTCPHDR framing as the single socket transport and
+ * every socket is terminated by its own end-of-stream header, so the reader
+ * can restore the original order without any sequence numbers.
+ *
+ * Each socket is serviced by a thread of its own with a short queue of blocks
+ * in front of it, so a socket momentarily stalling (a full send window, say)
+ * doesn't hold up the others.
+ */
+
+/*
+ * Copyright (C) 2010-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_MAIN_CONSOLE
+#include "TeleporterStreams.h"
+
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/mem.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+#include <iprt/tcp.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The size of the blocks the stream is cut into.  Small enough to spread a
+ * large write over all the sockets, large enough to keep the header and
+ * queueing overhead negligible. */
+#define TELEPORTER_STREAMS_BLOCK_SIZE   _128K
+/** The max number of blocks queued per socket. */
+#define TELEPORTER_STREAMS_MAX_QUEUED   8
+/** How long to wait for the other sockets to reach their end-of-stream
+ * header once one of them has (milliseconds). */
+#define TELEPORTER_STREAMS_EOS_TIMEOUT  30000
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A queued block.
+ */
+typedef struct TELEPORTERSTREAMBLOCK
+{
+    /** The next block in the queue. */
+    struct TELEPORTERSTREAMBLOCK   *pNext;
+    /** The number of data bytes.  For end markers this is the header value,
+     * i.e. 0 for end-of-stream and UINT32_MAX for cancellation. */
+    uint32_t                        cb;
+    /** How much the reader has consumed. */
+    uint32_t                        offRead;
+    /** Set if this is an end marker. */
+    bool                            fEnd;
+    /** The data. */
+    uint8_t                         ab[1];
+} TELEPORTERSTREAMBLOCK;
+/** Pointer to a queued block. */
+typedef TELEPORTERSTREAMBLOCK *PTELEPORTERSTREAMBLOCK;
+
+
+/**
+ * Per socket state.
+ */
+typedef struct TELEPORTERSTREAM
+{
+    /** The set this socket belongs to. */
+    struct TELEPORTERSTREAMS       *pParent;
+    /** The socket (owned by the caller). */
+    RTSOCKET                        hSocket;
+    /** The index of this stream. */
+    uint32_t                        iStream;
+    /** The number of blocks in the queue. */
+    uint32_t                        cBlocks;
+    /** The I/O thread. */
+    RTTHREAD                        hThread;
+    /** Protects the queue. */
+    RTCRITSECT                      CritSect;
+    /** The queue head. */
+    PTELEPORTERSTREAMBLOCK          pHead;
+    /** The queue tail. */
+    PTELEPORTERSTREAMBLOCK          pTail;
+    /** Signalled when a block has been queued or the thread is done. */
+    RTSEMEVENT                      hEvtQueued;
+    /** Signalled when a block has been dequeued or the thread is done. */
+    RTSEMEVENT                      hEvtDequeued;
+    /** Set when the I/O thread has finished. */
+    bool volatile                   fDone;
+    /** The I/O status of the thread. */
+    int32_t volatile                rc;
+} TELEPORTERSTREAM;
+/** Pointer to the per socket state. */
+typedef TELEPORTERSTREAM *PTELEPORTERSTREAM;
+
+
+/**
+ * A set of sockets carrying one SSM stream.
+ */
+typedef struct TELEPORTERSTREAMS
+{
+    /** Whether this is the writing (source) side. */
+    bool                            fWriter;
+    /** Tells the I/O threads to quit. */
+    bool volatile                   fShutdown;
+    /** Makes TeleporterStreamsRead return VERR_EOF, see
+     * TeleporterStreamsSetStopReading. */
+    bool volatile                   fStopReading;
+    /** The number of sockets. */
+    uint32_t                        cStreams;
+    /** The stream the next block goes to or comes from. */
+    uint32_t                        iNext;
+    /** The first I/O error, sticky. */
+    int32_t volatile                rc;
+    /** The per socket state. */
+    TELEPORTERSTREAM                aStreams[1];
+} TELEPORTERSTREAMS;
+
+
+/**
+ * Records the first I/O error.
+ */
+static void teleporterStreamsSetError(PTELEPORTERSTREAMS pThis, int rc)
+{
+    Assert(RT_FAILURE(rc));
+    ASMAtomicCmpXchgS32(&pThis->rc, rc, VINF_SUCCESS);
+}
+
+
+/**
+ * Adds a block to the queue of a stream, waiting for room if necessary.
+ *
+ * @returns VBox status code.  The caller still owns @a pBlock on failure.
+ * @param   pStream         The stream.
+ * @param   pBlock          The block.
+ */
+static int teleporterStreamEnqueue(PTELEPORTERSTREAM pStream, PTELEPORTERSTREAMBLOCK pBlock)
+{
+    PTELEPORTERSTREAMS pThis = pStream->pParent;
+    pBlock->pNext   = NULL;
+    pBlock->offRead = 0;
+    for (;;)
+    {
+        if (pThis->fShutdown)
+            return VERR_CANCELLED;
+        if (pThis->fWriter && pStream->fDone)
+            return RT_FAILURE(pStream->rc) ? pStream->rc : VERR_BROKEN_PIPE;
+
+        RTCritSectEnter(&pStream->CritSect);
+        if (pStream->cBlocks < TELEPORTER_STREAMS_MAX_QUEUED)
+        {
+            if (pStream->pTail)
+                pStream->pTail->pNext = pBlock;
+            else
+                pStream->pHead = pBlock;
+            pStream->pTail = pBlock;
+            pStream->cBlocks++;
+            RTCritSectLeave(&pStream->CritSect);
+            RTSemEventSignal(pStream->hEvtQueued);
+            return VINF_SUCCESS;
+        }
+        RTCritSectLeave(&pStream->CritSect);
+
+        RTSemEventWait(pStream->hEvtDequeued, 1000);
+    }
+}
+
+
+/**
+ * Removes the block at the head of the queue.
+ *
+ * @returns The block, NULL if the queue is empty.
+ * @param   pStream         The stream.
+ */
+static PTELEPORTERSTREAMBLOCK teleporterStreamDequeue(PTELEPORTERSTREAM pStream)
+{
+    RTCritSectEnter(&pStream->CritSect);
+    PTELEPORTERSTREAMBLOCK pBlock = pStream->pHead;
+    if (pBlock)
+    {
+        pStream->pHead = pBlock->pNext;
+        if (!pStream->pHead)
+            pStream->pTail = NULL;
+        pStream->cBlocks--;
+    }
+    RTCritSectLeave(&pStream->CritSect);
+    if (pBlock)
+        RTSemEventSignal(pStream->hEvtDequeued);
+    return pBlock;
+}
+
+
+/**
+ * Allocates a block.
+ *
+ * @returns Pointer to the block, NULL if out of memory.
+ * @param   cb              The header size value.
+ * @param   fEnd            Whether it's an end marker (no data).
+ */
+static PTELEPORTERSTREAMBLOCK teleporterStreamAllocBlock(uint32_t cb, bool fEnd)
+{
+    PTELEPORTERSTREAMBLOCK pBlock;
+    pBlock = (PTELEPORTERSTREAMBLOCK)RTMemAlloc(RT_UOFFSETOF(TELEPORTERSTREAMBLOCK, ab) + (fEnd ? 0 : cb));
+    if (pBlock)
+    {
+        pBlock->pNext   = NULL;
+        pBlock->cb      = cb;
+        pBlock->offRead = 0;
+        pBlock->fEnd    = fEnd;
+    }
+    return pBlock;
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, Sends the blocks queued for one socket.}
+ */
+static DECLCALLBACK(int) teleporterStreamWriterThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    PTELEPORTERSTREAM  pStream = (PTELEPORTERSTREAM)pvUser;
+    PTELEPORTERSTREAMS pThis   = pStream->pParent;
+
+    for (;;)
+    {
+        PTELEPORTERSTREAMBLOCK pBlock = teleporterStreamDequeue(pStream);
+        if (!pBlock)
+        {
+            if (pThis->fShutdown)
+                break;
+            RTSemEventWait(pStream->hEvtQueued, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        /* Keep draining the queue after a failure so the producer doesn't get
+           stuck, it'll pick up the status on its next write. */
+        bool const fEnd = pBlock->fEnd;
+        if (RT_SUCCESS(pStream->rc) && !pThis->fShutdown)
+        {
+            TELEPORTERTCPHDR Hdr;
+            Hdr.u32Magic = TELEPORTERTCPHDR_MAGIC;
+            Hdr.cb       = pBlock->cb;
+            int rc;
+            if (fEnd)
+                rc = RTTcpWrite(pStream->hSocket, &Hdr, sizeof(Hdr));
+            else
+                rc = RTTcpSgWriteL(pStream->hSocket, 2, &Hdr, sizeof(Hdr), &pBlock->ab[0], (size_t)pBlock->cb);
+            if (RT_FAILURE(rc))
+            {
+                LogRel(("Teleporter/TCP#%u: Write error: %Rrc (cb=%#x)\n", pStream->iStream, rc, Hdr.cb));
+                ASMAtomicWriteS32(&pStream->rc, rc);
+                teleporterStreamsSetError(pThis, rc);
+            }
+        }
+        RTMemFree(pBlock);
+        if (fEnd)
+            break;
+    }
+
+    ASMAtomicWriteBool(&pStream->fDone, true);
+    RTSemEventSignal(pStream->hEvtDequeued);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Receives exactly @a cb bytes, giving up when the set is being shut down.
+ *
+ * @returns VBox status code.
+ * @param   pStream         The stream.
+ * @param   pvBuf           Where to put the data.
+ * @param   cb              How much to receive.
+ */
+static int teleporterStreamRecv(PTELEPORTERSTREAM pStream, void *pvBuf, size_t cb)
+{
+    while (cb > 0)
+    {
+        int rc = RTTcpSelectOne(pStream->hSocket, 1000);
+        if (rc == VERR_TIMEOUT)
+        {
+            if (pStream->pParent->fShutdown)
+                return VERR_CANCELLED;
+            continue;
+        }
+        if (RT_FAILURE(rc))
+            return rc;
+
+        size_t cbRead = 0;
+        rc = RTTcpRead(pStream->hSocket, pvBuf, cb, &cbRead);
+        if (RT_FAILURE(rc))
+            return rc;
+        if (!cbRead)
+            return VERR_NET_CONNECTION_RESET_BY_PEER;
+        pvBuf = (uint8_t *)pvBuf + cbRead;
+        cb   -= cbRead;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, Receives the blocks sent over one socket.}
+ */
+static DECLCALLBACK(int) teleporterStreamReaderThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    PTELEPORTERSTREAM  pStream = (PTELEPORTERSTREAM)pvUser;
+    PTELEPORTERSTREAMS pThis   = pStream->pParent;
+
+    int rc;
+    for (;;)
+    {
+        TELEPORTERTCPHDR Hdr;
+        rc = teleporterStreamRecv(pStream, &Hdr, sizeof(Hdr));
+        if (RT_FAILURE(rc))
+        {
+            if (rc != VERR_CANCELLED)
+                LogRel(("Teleporter/TCP#%u: Header read error: %Rrc\n", pStream->iStream, rc));
+            break;
+        }
+        bool const fEnd = Hdr.cb == 0 || Hdr.cb == UINT32_MAX;
+        if (RT_UNLIKELY(   Hdr.u32Magic != TELEPORTERTCPHDR_MAGIC
+                        || (Hdr.cb > TELEPORTERTCPHDR_MAX_SIZE && !fEnd)))
+        {
+            LogRel(("Teleporter/TCP#%u: Invalid block: u32Magic=%#x cb=%#x\n", pStream->iStream, Hdr.u32Magic, Hdr.cb));
+            rc = VERR_IO_GEN_FAILURE;
+            break;
+        }
+
+        PTELEPORTERSTREAMBLOCK pBlock = teleporterStreamAllocBlock(Hdr.cb, fEnd);
+        if (!pBlock)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+        if (!fEnd)
+        {
+            rc = teleporterStreamRecv(pStream, &pBlock->ab[0], Hdr.cb);
+            if (RT_FAILURE(rc))
+            {
+                if (rc != VERR_CANCELLED)
+                    LogRel(("Teleporter/TCP#%u: Data read error: %Rrc (cb=%#x)\n", pStream->iStream, rc, Hdr.cb));
+                RTMemFree(pBlock);
+                break;
+            }
+        }
+        rc = teleporterStreamEnqueue(pStream, pBlock);
+        if (RT_FAILURE(rc))
+        {
+            RTMemFree(pBlock);
+            break;
+        }
+
+        /* Stop at the end marker, anything following it on the socket belongs
+           to the caller (the control connection continues with commands). */
+        if (fEnd)
+            break;
+    }
+
+    if (RT_FAILURE(rc) && rc != VERR_CANCELLED)
+        teleporterStreamsSetError(pThis, rc);
+    ASMAtomicWriteS32(&pStream->rc, rc);
+    ASMAtomicWriteBool(&pStream->fDone, true);
+    RTSemEventSignal(pStream->hEvtQueued);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates a multi-socket stream and starts the I/O threads.
+ *
+ * @returns VBox status code.
+ * @param   ppStreams       Where to return the handle.
+ * @param   fWriter         true for the sending (source) side, false for the
+ *                          receiving (target) side.
+ * @param   pahSockets      The connected sockets, in stream order.  These
+ *                          remain owned by the caller and must stay open until
+ *                          TeleporterStreamsDestroy has been called.
+ * @param   cSockets        The number of sockets (1..TELEPORTER_MAX_STREAMS).
+ */
+int TeleporterStreamsCreate(PTELEPORTERSTREAMS *ppStreams, bool fWriter, RTSOCKET const *pahSockets, uint32_t cSockets)
+{
+    AssertPtrReturn(ppStreams, VERR_INVALID_POINTER);
+    *ppStreams = NULL;
+    AssertReturn(cSockets > 0 && cSockets <= TELEPORTER_MAX_STREAMS, VERR_INVALID_PARAMETER);
+
+    PTELEPORTERSTREAMS pThis;
+    pThis = (PTELEPORTERSTREAMS)RTMemAllocZ(RT_UOFFSETOF(TELEPORTERSTREAMS, aStreams) + cSockets * sizeof(pThis->aStreams[0]));
+    if (!pThis)
+        return VERR_NO_MEMORY;
+    pThis->fWriter  = fWriter;
+    pThis->cStreams = cSockets;
+    pThis->rc       = VINF_SUCCESS;
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cSockets; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        pStream->pParent      = pThis;
+        pStream->hSocket      = pahSockets[i];
+        pStream->iStream      = i;
+        pStream->hThread      = NIL_RTTHREAD;
+        pStream->hEvtQueued   = NIL_RTSEMEVENT;
+        pStream->hEvtDequeued = NIL_RTSEMEVENT;
+        pStream->rc           = VINF_SUCCESS;
+    }
+    for (uint32_t i = 0; i < cSockets && RT_SUCCESS(rc); i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        rc = RTCritSectInit(&pStream->CritSect);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pStream->hEvtQueued);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pStream->hEvtDequeued);
+        if (RT_SUCCESS(rc))
+            rc = RTThreadCreateF(&pStream->hThread, fWriter ? teleporterStreamWriterThread : teleporterStreamReaderThread,
+                                 pStream, 0 /*cbStack*/, RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE,
+                                 fWriter ? "TeleportW%u" : "TeleportR%u", i);
+        if (RT_FAILURE(rc))
+            pStream->hThread = NIL_RTTHREAD;
+    }
+    if (RT_FAILURE(rc))
+    {
+        TeleporterStreamsDestroy(pThis);
+        return rc;
+    }
+
+    *ppStreams = pThis;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues data for sending.
+ *
+ * @returns VBox status code, the first I/O error of any of the sockets.
+ * @param   pThis           The stream handle (writer).
+ * @param   pvBuf           The data.
+ * @param   cbToWrite       The amount of data.
+ */
+int TeleporterStreamsWrite(PTELEPORTERSTREAMS pThis, const void *pvBuf, size_t cbToWrite)
+{
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    AssertReturn(pThis->fWriter, VERR_INVALID_HANDLE);
+
+    while (cbToWrite > 0)
+    {
+        int rc = pThis->rc;
+        if (RT_FAILURE(rc))
+            return rc;
+
+        uint32_t const cb = (uint32_t)RT_MIN(cbToWrite, TELEPORTER_STREAMS_BLOCK_SIZE);
+        PTELEPORTERSTREAMBLOCK pBlock = teleporterStreamAllocBlock(cb, false /*fEnd*/);
+        if (!pBlock)
+            return VERR_NO_MEMORY;
+        memcpy(&pBlock->ab[0], pvBuf, cb);
+
+        rc = teleporterStreamEnqueue(&pThis->aStreams[pThis->iNext], pBlock);
+        if (RT_FAILURE(rc))
+        {
+            RTMemFree(pBlock);
+            return rc;
+        }
+        pThis->iNext = (pThis->iNext + 1) % pThis->cStreams;
+
+        pvBuf      = (uint8_t const *)pvBuf + cb;
+        cbToWrite -= cb;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Waits for all the reader threads to reach their end-of-stream header.
+ *
+ * This makes sure nothing belonging to the stream is left in any of the
+ * sockets, the first one continues to be used for commands afterwards.
+ *
+ * @returns VERR_EOF on success, failure status otherwise.
+ * @param   pThis           The stream handle (reader).
+ */
+static int teleporterStreamsWaitForEnd(PTELEPORTERSTREAMS pThis)
+{
+    uint64_t const msStart = RTTimeMilliTS();
+    for (uint32_t i = 0; i < pThis->cStreams; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        while (!pStream->fDone)
+        {
+            if (   pThis->fShutdown
+                || RTTimeMilliTS() - msStart > TELEPORTER_STREAMS_EOS_TIMEOUT)
+            {
+                LogRel(("Teleporter/TCP#%u: Timed out waiting for the end of the stream\n", i));
+                return VERR_TIMEOUT;
+            }
+            RTSemEventWait(pStream->hEvtQueued, 100);
+        }
+        if (RT_FAILURE(pStream->rc))
+            return pStream->rc;
+    }
+    return VERR_EOF;
+}
+
+
+/**
+ * Reads data, restoring the original block order.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_EOF at the end of the stream or when reading was stopped.
+ * @retval  VERR_SSM_CANCELLED if the source cancelled the stream.
+ * @param   pThis           The stream handle (reader).
+ * @param   pvBuf           Where to put the data.
+ * @param   cbToRead        How much to read.
+ * @param   pcbRead         Where to return the amount read.  Optional, if NULL
+ *                          exactly @a cbToRead bytes will be read.
+ */
+int TeleporterStreamsRead(PTELEPORTERSTREAMS pThis, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    AssertReturn(!pThis->fWriter, VERR_INVALID_HANDLE);
+
+    while (cbToRead > 0)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[pThis->iNext];
+        RTCritSectEnter(&pStream->CritSect);
+        PTELEPORTERSTREAMBLOCK pBlock = pStream->pHead;
+        RTCritSectLeave(&pStream->CritSect);
+        if (!pBlock)
+        {
+            if (pThis->fStopReading)
+                return VERR_EOF;
+            if (pStream->fDone)
+            {
+                /* Check the queue again, the thread may have queued its last
+                   block after we looked. */
+                RTCritSectEnter(&pStream->CritSect);
+                pBlock = pStream->pHead;
+                RTCritSectLeave(&pStream->CritSect);
+                if (!pBlock)
+                    return RT_FAILURE(pThis->rc) ? pThis->rc : RT_FAILURE(pStream->rc) ? pStream->rc : VERR_EOF;
+            }
+            else
+            {
+                RTSemEventWait(pStream->hEvtQueued, 1000);
+                continue;
+            }
+        }
+
+        /* End markers are left in the queue so later reads fail the same way. */
+        if (pBlock->fEnd)
+            return pBlock->cb ? VERR_SSM_CANCELLED : teleporterStreamsWaitForEnd(pThis);
+
+        uint32_t const cb = (uint32_t)RT_MIN(cbToRead, pBlock->cb - pBlock->offRead);
+        memcpy(pvBuf, &pBlock->ab[pBlock->offRead], cb);
+        pBlock->offRead += cb;
+        if (pBlock->offRead >= pBlock->cb)
+        {
+            PTELEPORTERSTREAMBLOCK pDone = teleporterStreamDequeue(pStream);
+            Assert(pDone == pBlock);
+            RTMemFree(pDone);
+            pThis->iNext = (pThis->iNext + 1) % pThis->cStreams;
+        }
+
+        if (pcbRead)
+        {
+            *pcbRead = cb;
+            return VINF_SUCCESS;
+        }
+        pvBuf     = (uint8_t *)pvBuf + cb;
+        cbToRead -= cb;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Makes TeleporterStreamsRead return VERR_EOF instead of waiting for data.
+ *
+ * This is the equivalent of TeleporterState::mfStopReading for the single
+ * socket transport and can be undone to drain the end of the stream.
+ *
+ * @param   pThis           The stream handle (reader).
+ * @param   fStop           Whether to stop or resume reading.
+ */
+void TeleporterStreamsSetStopReading(PTELEPORTERSTREAMS pThis, bool fStop)
+{
+    AssertPtrReturnVoid(pThis);
+    ASMAtomicWriteBool(&pThis->fStopReading, fStop);
+    if (fStop)
+        for (uint32_t i = 0; i < pThis->cStreams; i++)
+            RTSemEventSignal(pThis->aStreams[i].hEvtQueued);
+}
+
+
+/**
+ * Closes the stream.
+ *
+ * For the writer this terminates every socket with an end-of-stream (or
+ * cancellation) header and waits for everything to be sent.  For the reader
+ * it is the same as TeleporterStreamsSetStopReading(pThis, true).
+ *
+ * @returns VBox status code, the first I/O error of any of the sockets.
+ * @param   pThis           The stream handle.
+ * @param   fCancelled      Whether the stream was cancelled.
+ */
+int TeleporterStreamsClose(PTELEPORTERSTREAMS pThis, bool fCancelled)
+{
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    if (!pThis->fWriter)
+    {
+        TeleporterStreamsSetStopReading(pThis, true);
+        return VINF_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < pThis->cStreams; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        if (pStream->hThread == NIL_RTTHREAD)
+            continue;
+        PTELEPORTERSTREAMBLOCK pBlock = teleporterStreamAllocBlock(fCancelled ? UINT32_MAX : 0, true /*fEnd*/);
+        if (pBlock)
+        {
+            int rc = teleporterStreamEnqueue(pStream, pBlock);
+            if (RT_FAILURE(rc))
+                RTMemFree(pBlock);
+        }
+        else
+            teleporterStreamsSetError(pThis, VERR_NO_MEMORY);
+    }
+
+    /* The threads quit after sending the end marker (or failing). */
+    for (uint32_t i = 0; i < pThis->cStreams; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        if (pStream->hThread != NIL_RTTHREAD)
+        {
+            RTThreadWait(pStream->hThread, RT_INDEFINITE_WAIT, NULL);
+            pStream->hThread = NIL_RTTHREAD;
+        }
+    }
+    return pThis->rc;
+}
+
+
+/**
+ * Stops the I/O threads and frees the stream.  The sockets are left open.
+ *
+ * @param   pThis           The stream handle.  NULL is ignored.
+ */
+void TeleporterStreamsDestroy(PTELEPORTERSTREAMS pThis)
+{
+    if (!pThis)
+        return;
+
+    ASMAtomicWriteBool(&pThis->fShutdown, true);
+    for (uint32_t i = 0; i < pThis->cStreams; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        if (pStream->hEvtQueued != NIL_RTSEMEVENT)
+            RTSemEventSignal(pStream->hEvtQueued);
+        if (pStream->hEvtDequeued != NIL_RTSEMEVENT)
+            RTSemEventSignal(pStream->hEvtDequeued);
+    }
+
+    for (uint32_t i = 0; i < pThis->cStreams; i++)
+    {
+        PTELEPORTERSTREAM pStream = &pThis->aStreams[i];
+        if (pStream->hThread != NIL_RTTHREAD)
+        {
+            RTThreadWait(pStream->hThread, RT_INDEFINITE_WAIT, NULL);
+            pStream->hThread = NIL_RTTHREAD;
+        }
+
+        PTELEPORTERSTREAMBLOCK pBlock = pStream->pHead;
+        while (pBlock)
+        {
+            PTELEPORTERSTREAMBLOCK pNext = pBlock->pNext;
+            RTMemFree(pBlock);
+            pBlock = pNext;
+        }
+        pStream->pHead = pStream->pTail = NULL;
+
+        RTSemEventDestroy(pStream->hEvtQueued);
+        pStream->hEvtQueued = NIL_RTSEMEVENT;
+        RTSemEventDestroy(pStream->hEvtDequeued);
+        pStream->hEvtDequeued = NIL_RTSEMEVENT;
+        if (RTCritSectIsInitialized(&pStream->CritSect))
+            RTCritSectDelete(&pStream->CritSect);
+    }
+
+    RTMemFree(pThis);
+}
+
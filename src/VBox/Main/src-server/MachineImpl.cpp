@@ -5262,6 +5262,9 @@ HRESULT Machine::unregister(AutoCaller &autoCaller,
         // add the saved state file to the list of files the caller should delete
         Assert(!mSSData->strStateFilePath.isEmpty());
         mData->llFilesToDelete.push_back(mSSData->strStateFilePath);
+        Utf8Str strPageFile = i_getSavedStatePageFilename(mSSData->strStateFilePath);
+        if (RTFileExists(strPageFile.c_str()))
+            mData->llFilesToDelete.push_back(strPageFile);
 
         mSSData->strStateFilePath.setNull();
 
@@ -7615,6 +7618,35 @@ void Machine::i_composeSavedStateFilename(Utf8Str &strStateFilePath)
                                    time.u8Hour, time.u8Minute, time.u8Second, time.u32Nanosecond);
 }
 
+/**
+ * Returns the name of the RAM page file which accompanies a saved state file
+ * written with lazy restore enabled (PGM/LazyRestore).
+ *
+ * The VMM derives the name by appending PGM_LAZY_RESTORE_FILE_SUFFIX to the
+ * saved state file name.  The file belongs to the saved state file and must
+ * be copied, moved and deleted together with it.
+ *
+ * @returns The page file name.
+ * @param   strStateFilePath    The saved state file name.
+ */
+/* static */
+Utf8Str Machine::i_getSavedStatePageFilename(const Utf8Str &strStateFilePath)
+{
+    return Utf8StrFmt("%s.pages", strStateFilePath.c_str());
+}
+
+/**
+ * Deletes a saved state file and its RAM page file, if any.
+ *
+ * @param   strStateFilePath    The saved state file name.
+ */
+/* static */
+void Machine::i_deleteSavedStateFiles(const Utf8Str &strStateFilePath)
+{
+    RTFileDelete(strStateFilePath.c_str());
+    RTFileDelete(i_getSavedStatePageFilename(strStateFilePath).c_str());
+}
+
 /**
  *  Returns the full path to the default video capture file.
  */
@@ -13192,7 +13224,7 @@ void SessionMachine::i_saveStateHandler(SaveStateTask &task)
             // Delete the saved state file (might have been already created).
             // No need to check whether this is shared with a snapshot here
             // because we certainly created a fresh saved state file here.
-            RTFileDelete(task.m_strStateFilePath.c_str());
+            i_deleteSavedStateFiles(task.m_strStateFilePath);
         }
     }
     catch (HRESULT aRC) { rc = aRC; }
@@ -14644,7 +14676,7 @@ void SessionMachine::i_releaseSavedStateFile(const Utf8Str &strStateFile,
              || !mData->mFirstSnapshot->i_sharesSavedStateFile(strStateFile, pSnapshotToIgnore)
                                 // this checks the SnapshotMachine's state file paths
            )
-            RTFileDelete(strStateFile.c_str());
+            i_deleteSavedStateFiles(strStateFile);
 }
 
 /**
@@ -14909,7 +14941,7 @@ HRESULT SessionMachine::i_setMachineState(MachineState_T aMachineState)
                  || !mData->mFirstSnapshot->i_sharesSavedStateFile(mSSData->strStateFilePath, NULL /* pSnapshotToIgnore */)
                                                 // ... none of the snapshots share the saved state file
                )
-                RTFileDelete(mSSData->strStateFilePath.c_str());
+                i_deleteSavedStateFiles(mSSData->strStateFilePath);
         }
 
         mSSData->strStateFilePath.setNull();
@@ -222,6 +222,11 @@ HRESULT MachineCloneVMPrivate::addSaveState(const ComObjPtr<Machine> &machine, b
         if (RT_FAILURE(vrc))
             return p->setErrorBoth(VBOX_E_IPRT_ERROR, vrc, p->tr("Could not query file size of '%s' (%Rrc)"),
                                    sst.strSaveStateFile.c_str(), vrc);
+        /* The RAM page file of a lazy restore capable saved state goes
+         * along with it. */
+        uint64_t cbPageFile;
+        if (RT_SUCCESS(RTFileQuerySize(Machine::i_getSavedStatePageFilename(sst.strSaveStateFile).c_str(), &cbPageFile)))
+            cbSize += cbPageFile;
         /*  same rule as above: count both the data which needs to
          * be read and written */
         sst.uWeight = (ULONG)(2 * (cbSize + _1M - 1) / _1M);
@@ -1417,6 +1422,18 @@ HRESULT MachineCloneVM::run()
                                           p->tr("Could not copy state file '%s' to '%s' (%Rrc)"),
                                           sst.strSaveStateFile.c_str(), strTrgSaveState.c_str(), vrc);
                 newFiles.append(strTrgSaveState);
+
+                const Utf8Str strSrcPageFile = Machine::i_getSavedStatePageFilename(sst.strSaveStateFile);
+                if (RTFileExists(strSrcPageFile.c_str()))
+                {
+                    const Utf8Str strTrgPageFile = Machine::i_getSavedStatePageFilename(strTrgSaveState);
+                    vrc = RTFileCopyEx(strSrcPageFile.c_str(), strTrgPageFile.c_str(), 0, NULL, NULL);
+                    if (RT_FAILURE(vrc))
+                        throw p->setErrorBoth(VBOX_E_IPRT_ERROR, vrc,
+                                              p->tr("Could not copy state file '%s' to '%s' (%Rrc)"),
+                                              strSrcPageFile.c_str(), strTrgPageFile.c_str(), vrc);
+                    newFiles.append(strTrgPageFile);
+                }
             }
             /* Update the path in the configuration either for the current
              * machine state or the snapshots. */
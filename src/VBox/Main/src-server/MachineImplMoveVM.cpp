@@ -390,6 +390,11 @@ HRESULT MachineMoveVM::init()
                     vrc = RTFileQuerySize(name.c_str(), &cbFile);
                     if (RT_SUCCESS(vrc))
                     {
+                        /* The RAM page file of a lazy restore capable saved state goes along with it. */
+                        uint64_t cbPageFile;
+                        if (RT_SUCCESS(RTFileQuerySize(Machine::i_getSavedStatePageFilename(name).c_str(), &cbPageFile)))
+                            cbFile += cbPageFile;
+
                         std::pair<std::map<Utf8Str, SAVESTATETASKMOVE>::iterator,bool> ret;
                         ret = finalSaveStateFilesMap.insert(std::make_pair(name, sst));
                         if (ret.second == true)
@@ -687,6 +692,24 @@ void MachineMoveVM::i_MoveVMThreadTask(MachineMoveVM* task)
                 newFiles.append(strTrgSaveState);
                 /* save original file for deletion in the end */
                 originalFiles.append(sst.strSaveStateFile);
+
+                /* The RAM page file of a lazy restore capable saved state goes along with it. */
+                const Utf8Str strSrcPageFile = Machine::i_getSavedStatePageFilename(sst.strSaveStateFile);
+                if (RTFileExists(strSrcPageFile.c_str()))
+                {
+                    const Utf8Str strTrgPageFile = Machine::i_getSavedStatePageFilename(strTrgSaveState);
+                    vrc = RTFileCopyEx(strSrcPageFile.c_str(), strTrgPageFile.c_str(), 0, NULL, NULL);
+                    if (RT_FAILURE(vrc))
+                    {
+                        Utf8StrFmt errorDesc("Could not copy state file '%s' to '%s' (%Rrc)",
+                                             strSrcPageFile.c_str(), strTrgPageFile.c_str(), vrc);
+                        taskMoveVM->errorsList.push_back(ErrorInfoItem(VBOX_E_IPRT_ERROR, errorDesc.c_str()));
+
+                        throw machine->setErrorBoth(VBOX_E_IPRT_ERROR, vrc, machine->tr(errorDesc.c_str()));
+                    }
+                    newFiles.append(strTrgPageFile);
+                    originalFiles.append(strSrcPageFile);
+                }
                 ++itState;
             }
         }
@@ -1507,6 +1530,9 @@ HRESULT MachineMoveVM::addSaveState(const ComObjPtr<Machine> &machine)
 
             return m_pMachine->setErrorBoth(VBOX_E_IPRT_ERROR, vrc, m_pMachine->tr(errorDesc.c_str()));
         }
+        uint64_t cbPageFile;
+        if (RT_SUCCESS(RTFileQuerySize(Machine::i_getSavedStatePageFilename(sst.strSaveStateFile).c_str(), &cbPageFile)))
+            cbSize += cbPageFile;
         /* same rule as above: count both the data which needs to
          * be read and written */
         sst.uWeight = (ULONG)(2 * (cbSize + _1M - 1) / _1M);
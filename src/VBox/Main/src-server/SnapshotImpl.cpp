@@ -854,7 +854,12 @@ HRESULT Snapshot::i_uninitOne(AutoWriteLock &writeLock,
             }
         }
         if (!fFound)
+        {
             llFilenames.push_back(m->pMachine->mSSData->strStateFilePath);
+            Utf8Str strPageFile = Machine::i_getSavedStatePageFilename(m->pMachine->mSSData->strStateFilePath);
+            if (RTFileExists(strPageFile.c_str()))
+                llFilenames.push_back(strPageFile);
+        }
     }
 
     i_beginSnapshotDelete();
@@ -1957,7 +1962,7 @@ HRESULT SessionMachine::i_finishTakingSnapshot(TakeSnapshotTask &task, AutoWrite
             // no need to test for whether the saved state file is shared: an online
             // snapshot means that a new saved state file was created, which we must
             // clean up now
-            RTFileDelete(task.m_pSnapshot->i_getStateFilePath().c_str());
+            Machine::i_deleteSavedStateFiles(task.m_pSnapshot->i_getStateFilePath());
 
         alock.acquire();
 
@@ -0,0 +1,559 @@
+/* $Id$ */
+/** @file
+ * tstTeleporterStreams - Multi-socket teleporter transport and page delta benchmark.
+ *
+ * Simulates a live migration between two threads of the same process over
+ * loopback TCP: a source that repeatedly sends the dirty pages of a guest RAM
+ * image while a "guest" thread keeps dirtying it, and a target applying the
+ * page records.  Reports the total migration time and the downtime (from
+ * stopping the guest to the target having everything) for a single socket and
+ * for the requested number of sockets.
+ */
+
+/*
+ * Copyright (C) 2010-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "TeleporterStreams.h"
+
+#include <VBox/vmm/pgmdelta.h>
+
+#include <iprt/asm.h>
+#include <iprt/err.h>
+#include <iprt/getopt.h>
+#include <iprt/mem.h>
+#include <iprt/param.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/tcp.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Page record header.
+ */
+typedef struct TSTRECHDR
+{
+    /** The page number. */
+    uint32_t    iPage;
+    /** The record type, TSTREC_XXX. */
+    uint16_t    u16Type;
+    /** The size of the data following the header. */
+    uint16_t    cb;
+} TSTRECHDR;
+/** @name Record types.
+ * @{ */
+#define TSTREC_RAW      UINT16_C(1)
+#define TSTREC_DELTA    UINT16_C(2)
+#define TSTREC_END      UINT16_C(3)
+/** @} */
+
+/** The max delta we bother sending instead of the page. */
+#define TST_MAX_DELTA   (PAGE_SIZE / 2)
+
+/**
+ * Benchmark parameters and shared state.
+ */
+typedef struct TSTMIGRATION
+{
+    /* Parameters. */
+    uint32_t            cStreams;
+    uint32_t            cPages;
+    uint32_t            cDirtyPagesPerSec;
+    uint32_t            cDeltaCacheEntries;
+    uint32_t            cMsMaxDowntime;
+
+    /* The guest. */
+    uint8_t            *pbSrcRam;
+    uint64_t           *pbmDirty;
+    bool volatile       fStopGuest;
+    RTTHREAD            hGuestThread;
+
+    /* The target. */
+    uint8_t            *pbDstRam;
+    uint32_t            uPort;
+    uint64_t            u64Cookie;
+    PRTTCPSERVER        hServer;
+    RTTHREAD            hTargetThread;
+    int volatile        rcTarget;
+    uint64_t volatile   nsTargetDone;
+
+    /* Source side delta cache (direct mapped). */
+    uint32_t           *paCacheTags;
+    uint8_t            *pbCache;
+
+    /* Statistics. */
+    uint64_t            cbSent;
+    uint64_t            cPagesSent;
+    uint64_t            cDeltaPages;
+    uint64_t            cPasses;
+} TSTMIGRATION;
+typedef TSTMIGRATION *PTSTMIGRATION;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST g_hTest;
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, Dirties random guest pages at a fixed rate.}
+ */
+static DECLCALLBACK(int) tstGuestThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    PTSTMIGRATION pThis = (PTSTMIGRATION)pvUser;
+    uint32_t const cPerMs = RT_MAX(pThis->cDirtyPagesPerSec / 1000, 1);
+    while (!ASMAtomicReadBool(&pThis->fStopGuest))
+    {
+        for (uint32_t i = 0; i < cPerMs; i++)
+        {
+            /* Touch a few dwords only, like most real guest writes do. */
+            uint32_t const iPage  = RTRandU32Ex(0, pThis->cPages - 1);
+            uint32_t      *pu32   = (uint32_t *)&pThis->pbSrcRam[(size_t)iPage << PAGE_SHIFT];
+            uint32_t const offSeq = RTRandU32Ex(0, PAGE_SIZE / sizeof(uint32_t) - 16);
+            for (uint32_t off = 0; off < 16; off += 4)
+                ASMAtomicIncU32(&pu32[offSeq + off]);
+            ASMAtomicBitSet(pThis->pbmDirty, iPage);
+        }
+        RTThreadSleep(1);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, Accepts the sockets and applies the page
+ *                      records to the target RAM.}
+ */
+static DECLCALLBACK(int) tstTargetThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    PTSTMIGRATION pThis = (PTSTMIGRATION)pvUser;
+    RTSOCKET      ahSockets[TELEPORTER_MAX_STREAMS];
+    for (uint32_t i = 0; i < RT_ELEMENTS(ahSockets); i++)
+        ahSockets[i] = NIL_RTSOCKET;
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t cConnected = 0; cConnected < pThis->cStreams && RT_SUCCESS(rc); )
+    {
+        RTSOCKET hSocket;
+        rc = RTTcpServerListen2(pThis->hServer, &hSocket);
+        if (RT_FAILURE(rc))
+            break;
+        TELEPORTERSTREAMHELLO Hello;
+        rc = RTTcpRead(hSocket, &Hello, sizeof(Hello), NULL);
+        if (   RT_SUCCESS(rc)
+            && Hello.u32Magic  == TELEPORTERSTREAMHELLO_MAGIC
+            && Hello.u64Cookie == pThis->u64Cookie
+            && Hello.iStream   <  pThis->cStreams
+            && ahSockets[Hello.iStream] == NIL_RTSOCKET)
+        {
+            ahSockets[Hello.iStream] = hSocket;
+            cConnected++;
+        }
+        else
+        {
+            RTTcpServerDisconnectClient2(hSocket);
+            rc = RT_FAILURE(rc) ? rc : VERR_INVALID_MAGIC;
+        }
+    }
+
+    PTELEPORTERSTREAMS pStreams = NULL;
+    if (RT_SUCCESS(rc))
+        rc = TeleporterStreamsCreate(&pStreams, false /*fWriter*/, ahSockets, pThis->cStreams);
+    while (RT_SUCCESS(rc))
+    {
+        TSTRECHDR Hdr;
+        rc = TeleporterStreamsRead(pStreams, &Hdr, sizeof(Hdr), NULL);
+        if (RT_FAILURE(rc))
+            break;
+        if (Hdr.u16Type == TSTREC_END)
+        {
+            ASMAtomicWriteU64(&pThis->nsTargetDone, RTTimeNanoTS());
+            /* The stream must end right here. */
+            uint8_t b;
+            rc = TeleporterStreamsRead(pStreams, &b, 1, NULL);
+            rc = rc == VERR_EOF ? VINF_SUCCESS : RT_FAILURE(rc) ? rc : VERR_TOO_MUCH_DATA;
+            break;
+        }
+        if (Hdr.iPage >= pThis->cPages)
+        {
+            rc = VERR_OUT_OF_RANGE;
+            break;
+        }
+
+        uint8_t *pbPage = &pThis->pbDstRam[(size_t)Hdr.iPage << PAGE_SHIFT];
+        if (Hdr.u16Type == TSTREC_RAW && Hdr.cb == PAGE_SIZE)
+            rc = TeleporterStreamsRead(pStreams, pbPage, PAGE_SIZE, NULL);
+        else if (Hdr.u16Type == TSTREC_DELTA && Hdr.cb > 0 && Hdr.cb <= TST_MAX_DELTA)
+        {
+            uint8_t abDelta[TST_MAX_DELTA];
+            rc = TeleporterStreamsRead(pStreams, abDelta, Hdr.cb, NULL);
+            if (RT_SUCCESS(rc))
+                rc = PGMDeltaDecode(abDelta, Hdr.cb, pbPage, PAGE_SIZE);
+        }
+        else
+            rc = VERR_INVALID_PARAMETER;
+    }
+
+    TeleporterStreamsDestroy(pStreams);
+    for (uint32_t i = 0; i < RT_ELEMENTS(ahSockets); i++)
+        if (ahSockets[i] != NIL_RTSOCKET)
+            RTTcpServerDisconnectClient2(ahSockets[i]);
+    ASMAtomicWriteS32(&pThis->rcTarget, rc);
+    return rc;
+}
+
+
+/**
+ * Sends one page, as a delta if the cache has the previous version.
+ */
+static int tstSendPage(PTSTMIGRATION pThis, PTELEPORTERSTREAMS pStreams, uint8_t *pbBuf, uint32_t *poffBuf, uint32_t iPage)
+{
+    uint8_t        abPage[PAGE_SIZE];
+    uint8_t        abDelta[TST_MAX_DELTA];
+    TSTRECHDR      Hdr;
+    uint8_t const *pbData;
+    memcpy(abPage, &pThis->pbSrcRam[(size_t)iPage << PAGE_SHIFT], PAGE_SIZE);
+
+    Hdr.iPage   = iPage;
+    Hdr.u16Type = TSTREC_RAW;
+    Hdr.cb      = PAGE_SIZE;
+    pbData      = abPage;
+    if (pThis->cDeltaCacheEntries)
+    {
+        uint32_t const iSlot   = iPage & (pThis->cDeltaCacheEntries - 1);
+        uint8_t       *pbCache = &pThis->pbCache[(size_t)iSlot << PAGE_SHIFT];
+        if (pThis->paCacheTags[iSlot] == iPage)
+        {
+            uint32_t cbDelta = PGMDeltaEncode(pbCache, abPage, PAGE_SIZE, abDelta, sizeof(abDelta));
+            if (cbDelta == 0)
+                return VINF_SUCCESS;    /* Changed back, nothing to send. */
+            if (cbDelta != UINT32_MAX)
+            {
+                Hdr.u16Type = TSTREC_DELTA;
+                Hdr.cb      = (uint16_t)cbDelta;
+                pbData      = abDelta;
+                pThis->cDeltaPages++;
+            }
+        }
+        pThis->paCacheTags[iSlot] = iPage;
+        memcpy(pbCache, abPage, PAGE_SIZE);
+    }
+
+    /* Stage it, flushing the buffer when full. */
+    if (*poffBuf + sizeof(Hdr) + Hdr.cb > _128K)
+    {
+        int rc = TeleporterStreamsWrite(pStreams, pbBuf, *poffBuf);
+        if (RT_FAILURE(rc))
+            return rc;
+        pThis->cbSent += *poffBuf;
+        *poffBuf = 0;
+    }
+    memcpy(&pbBuf[*poffBuf], &Hdr, sizeof(Hdr));
+    memcpy(&pbBuf[*poffBuf + sizeof(Hdr)], pbData, Hdr.cb);
+    *poffBuf += sizeof(Hdr) + Hdr.cb;
+    pThis->cPagesSent++;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Sends all the pages that are dirty.
+ *
+ * @returns VBox status code.
+ * @param   pcPages     Where to return the number of pages sent.
+ */
+static int tstSendDirtyPages(PTSTMIGRATION pThis, PTELEPORTERSTREAMS pStreams, uint8_t *pbBuf, uint32_t *poffBuf,
+                             uint32_t *pcPages)
+{
+    uint32_t cPages = 0;
+    int32_t  iPage  = ASMBitFirstSet(pThis->pbmDirty, pThis->cPages);
+    while (iPage >= 0)
+    {
+        if (ASMAtomicBitTestAndClear(pThis->pbmDirty, iPage))
+        {
+            int rc = tstSendPage(pThis, pStreams, pbBuf, poffBuf, (uint32_t)iPage);
+            if (RT_FAILURE(rc))
+                return rc;
+            cPages++;
+        }
+        iPage = ASMBitNextSet(pThis->pbmDirty, pThis->cPages, iPage);
+    }
+    *pcPages = cPages;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Does one migration, reporting the results.
+ */
+static void tstMigrate(uint32_t cStreams, uint32_t cPages, uint32_t cDirtyPagesPerSec, uint32_t cDeltaCacheEntries,
+                       uint32_t cMsMaxDowntime)
+{
+    RTTestSubF(g_hTest, "%u stream(s), %u MB, %u dirty pages/s, %u cache entries",
+               cStreams, cPages >> (20 - PAGE_SHIFT), cDirtyPagesPerSec, cDeltaCacheEntries);
+
+    TSTMIGRATION This;
+    RT_ZERO(This);
+    This.cStreams           = cStreams;
+    This.cPages             = cPages;
+    This.cDirtyPagesPerSec  = cDirtyPagesPerSec;
+    This.cDeltaCacheEntries = cDeltaCacheEntries;
+    This.cMsMaxDowntime     = cMsMaxDowntime;
+    This.hGuestThread       = NIL_RTTHREAD;
+    This.hTargetThread      = NIL_RTTHREAD;
+    This.rcTarget           = VERR_INTERNAL_ERROR;
+
+    size_t const cbRam = (size_t)cPages << PAGE_SHIFT;
+    This.pbSrcRam    = (uint8_t *)RTMemPageAlloc(cbRam);
+    This.pbDstRam    = (uint8_t *)RTMemPageAllocZ(cbRam);
+    This.pbmDirty    = (uint64_t *)RTMemAllocZ(RT_ALIGN_Z(cPages, 64) / 8);
+    This.paCacheTags = cDeltaCacheEntries ? (uint32_t *)RTMemAlloc(cDeltaCacheEntries * sizeof(uint32_t)) : NULL;
+    This.pbCache     = cDeltaCacheEntries ? (uint8_t *)RTMemPageAlloc((size_t)cDeltaCacheEntries << PAGE_SHIFT) : NULL;
+    uint8_t *pbBuf   = (uint8_t *)RTMemAlloc(_128K);
+    if (   !This.pbSrcRam || !This.pbDstRam || !This.pbmDirty || !pbBuf
+        || (cDeltaCacheEntries && (!This.paCacheTags || !This.pbCache)))
+    {
+        RTTestFailed(g_hTest, "Out of memory");
+        RTMemPageFree(This.pbSrcRam, cbRam);
+        RTMemPageFree(This.pbDstRam, cbRam);
+        RTMemFree(This.pbmDirty);
+        RTMemFree(This.paCacheTags);
+        if (This.pbCache)
+            RTMemPageFree(This.pbCache, (size_t)cDeltaCacheEntries << PAGE_SHIFT);
+        RTMemFree(pbBuf);
+        return;
+    }
+    if (cDeltaCacheEntries)
+        memset(This.paCacheTags, 0xff, cDeltaCacheEntries * sizeof(uint32_t));
+
+    /* Random data in every other page, the rest zero (but still sent). */
+    for (uint32_t iPage = 0; iPage < cPages; iPage++)
+    {
+        uint8_t *pbPage = &This.pbSrcRam[(size_t)iPage << PAGE_SHIFT];
+        if (iPage & 1)
+            RTRandBytes(pbPage, PAGE_SIZE);
+        else
+            RT_BZERO(pbPage, PAGE_SIZE);
+    }
+    memset(This.pbmDirty, 0xff, RT_ALIGN_Z(cPages, 64) / 8);
+
+    /*
+     * Set up the target and connect the sockets.
+     */
+    int rc = VERR_NET_ADDRESS_IN_USE;
+    for (int cTries = 256; cTries > 0 && rc == VERR_NET_ADDRESS_IN_USE; cTries--)
+    {
+        This.uPort = RTRandU32Ex(49152, 65534);
+        rc = RTTcpServerCreateEx("127.0.0.1", This.uPort, &This.hServer);
+    }
+    RTTESTI_CHECK_RC_OK(rc);
+    This.u64Cookie = RTRandU64();
+    if (RT_SUCCESS(rc))
+        rc = RTThreadCreate(&This.hTargetThread, tstTargetThread, &This, 0, RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "Target");
+    RTTESTI_CHECK_RC_OK(rc);
+
+    RTSOCKET ahSockets[TELEPORTER_MAX_STREAMS];
+    uint32_t cConnected = 0;
+    while (RT_SUCCESS(rc) && cConnected < cStreams)
+    {
+        rc = RTTcpClientConnect("127.0.0.1", This.uPort, &ahSockets[cConnected]);
+        if (RT_SUCCESS(rc))
+        {
+            TELEPORTERSTREAMHELLO Hello;
+            Hello.u32Magic  = TELEPORTERSTREAMHELLO_MAGIC;
+            Hello.iStream   = cConnected;
+            Hello.u64Cookie = This.u64Cookie;
+            cConnected++;
+            rc = RTTcpWrite(ahSockets[cConnected - 1], &Hello, sizeof(Hello));
+        }
+    }
+    RTTESTI_CHECK_RC_OK(rc);
+
+    /*
+     * Start the guest and do the passes.  Stop the guest when the remaining
+     * dirty pages can be sent within the downtime budget at the rate the last
+     * pass achieved, or after 30 passes when it doesn't converge.
+     */
+    PTELEPORTERSTREAMS pStreams = NULL;
+    if (RT_SUCCESS(rc))
+        rc = TeleporterStreamsCreate(&pStreams, true /*fWriter*/, ahSockets, cStreams);
+    if (RT_SUCCESS(rc))
+        rc = RTThreadCreate(&This.hGuestThread, tstGuestThread, &This, 0, RTTHREADTYPE_DEFAULT, RTTHREADFLAGS_WAITABLE, "Guest");
+    RTTESTI_CHECK_RC_OK(rc);
+
+    uint64_t const nsStart         = RTTimeNanoTS();
+    uint64_t       nsDowntimeStart = 0;
+    uint32_t       offBuf          = 0;
+    while (RT_SUCCESS(rc))
+    {
+        uint64_t const nsPass = RTTimeNanoTS();
+        uint32_t cPagesPass;
+        rc = tstSendDirtyPages(&This, pStreams, pbBuf, &offBuf, &cPagesPass);
+        if (RT_FAILURE(rc))
+            break;
+        This.cPasses++;
+
+        uint64_t const nsElapsed = RT_MAX(RTTimeNanoTS() - nsPass, 1);
+        uint32_t       cDirty    = 0;
+        for (int32_t iPage = ASMBitFirstSet(This.pbmDirty, cPages); iPage >= 0;
+             iPage = ASMBitNextSet(This.pbmDirty, cPages, iPage))
+            cDirty++;
+        uint64_t const cNsEst    = cPagesPass ? (uint64_t)cDirty * nsElapsed / cPagesPass : 0;
+        if (cNsEst <= (uint64_t)cMsMaxDowntime * RT_NS_1MS || This.cPasses >= 30)
+            break;
+    }
+
+    /* Stop-and-copy. */
+    if (RT_SUCCESS(rc))
+    {
+        nsDowntimeStart = RTTimeNanoTS();
+        ASMAtomicWriteBool(&This.fStopGuest, true);
+        RTThreadWait(This.hGuestThread, RT_INDEFINITE_WAIT, NULL);
+        This.hGuestThread = NIL_RTTHREAD;
+
+        uint32_t cPagesPass;
+        rc = tstSendDirtyPages(&This, pStreams, pbBuf, &offBuf, &cPagesPass);
+        if (RT_SUCCESS(rc))
+        {
+            TSTRECHDR Hdr;
+            Hdr.iPage   = 0;
+            Hdr.u16Type = TSTREC_END;
+            Hdr.cb      = 0;
+            memcpy(&pbBuf[offBuf], &Hdr, sizeof(Hdr));
+            offBuf += sizeof(Hdr);
+            rc = TeleporterStreamsWrite(pStreams, pbBuf, offBuf);
+            This.cbSent += offBuf;
+        }
+        RTTESTI_CHECK_RC_OK(rc);
+    }
+    int rc2 = TeleporterStreamsClose(pStreams, RT_FAILURE(rc));
+    if (RT_SUCCESS(rc))
+        RTTESTI_CHECK_RC_OK(rc = rc2);
+
+    if (This.hGuestThread != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&This.fStopGuest, true);
+        RTThreadWait(This.hGuestThread, RT_INDEFINITE_WAIT, NULL);
+    }
+    if (This.hTargetThread != NIL_RTTHREAD)
+    {
+        if (RT_FAILURE(rc))
+            RTTcpServerShutdown(This.hServer);
+        RTThreadWait(This.hTargetThread, RT_INDEFINITE_WAIT, NULL);
+        if (RT_SUCCESS(rc))
+            RTTESTI_CHECK_RC_OK(rc = This.rcTarget);
+    }
+    TeleporterStreamsDestroy(pStreams);
+    for (uint32_t i = 0; i < cConnected; i++)
+        RTTcpClientCloseEx(ahSockets[i], false /*fGracefulShutdown*/);
+    if (This.hServer)
+        RTTcpServerDestroy(This.hServer);
+
+    /*
+     * Check and report.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t const nsDone = ASMAtomicReadU64(&This.nsTargetDone);
+        if (memcmp(This.pbSrcRam, This.pbDstRam, cbRam))
+            RTTestFailed(g_hTest, "The target RAM differs from the source");
+        RTTestValue(g_hTest, "Total time",   (nsDone - nsStart) / RT_NS_1MS, RTTESTUNIT_MS);
+        RTTestValue(g_hTest, "Downtime",     (nsDone - nsDowntimeStart) / RT_NS_1MS, RTTESTUNIT_MS);
+        RTTestValue(g_hTest, "Passes",       This.cPasses, RTTESTUNIT_OCCURRENCES);
+        RTTestValue(g_hTest, "Pages sent",   This.cPagesSent, RTTESTUNIT_OCCURRENCES);
+        RTTestValue(g_hTest, "Delta pages",  This.cDeltaPages, RTTESTUNIT_OCCURRENCES);
+        RTTestValue(g_hTest, "Data sent",    This.cbSent / _1M, RTTESTUNIT_MEGABYTES);
+        RTTestValue(g_hTest, "Throughput",   This.cbSent / _1M * RT_NS_1SEC / RT_MAX(nsDone - nsStart, 1),
+                    RTTESTUNIT_MEGABYTES_PER_SEC);
+    }
+
+    RTMemPageFree(This.pbSrcRam, cbRam);
+    RTMemPageFree(This.pbDstRam, cbRam);
+    RTMemFree(This.pbmDirty);
+    RTMemFree(This.paCacheTags);
+    if (This.pbCache)
+        RTMemPageFree(This.pbCache, (size_t)cDeltaCacheEntries << PAGE_SHIFT);
+    RTMemFree(pbBuf);
+}
+
+
+int main(int argc, char **argv)
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstTeleporterStreams", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    /*
+     * Parse the options.
+     */
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--streams",          's', RTGETOPT_REQ_UINT32 },
+        { "--ram-mb",           'm', RTGETOPT_REQ_UINT32 },
+        { "--dirty-rate",       'd', RTGETOPT_REQ_UINT32 },
+        { "--delta-cache-mb",   'c', RTGETOPT_REQ_UINT32 },
+        { "--max-downtime-ms",  't', RTGETOPT_REQ_UINT32 },
+    };
+    uint32_t cStreams          = TELEPORTER_DEF_STREAMS;
+    uint32_t cMbRam            = 128;
+    uint32_t cDirtyPagesPerSec = 20000;
+    uint32_t cMbDeltaCache     = 16;
+    uint32_t cMsMaxDowntime    = 300;
+
+    RTGETOPTSTATE  GetState;
+    RTGETOPTUNION  ValueUnion;
+    int ch;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /*fFlags*/);
+    while ((ch = RTGetOpt(&GetState, &ValueUnion)) != 0)
+    {
+        switch (ch)
+        {
+            case 's': cStreams          = RT_MIN(RT_MAX(ValueUnion.u32, 1), TELEPORTER_MAX_STREAMS); break;
+            case 'm': cMbRam            = RT_MAX(ValueUnion.u32, 1); break;
+            case 'd': cDirtyPagesPerSec = ValueUnion.u32; break;
+            case 'c': cMbDeltaCache     = ValueUnion.u32; break;
+            case 't': cMsMaxDowntime    = ValueUnion.u32; break;
+            default:
+                return RTGetOptPrintError(ch, &ValueUnion);
+        }
+    }
+
+    /* The cache is direct mapped, so round the entry count down to a power of two. */
+    uint32_t cDeltaCacheEntries = cMbDeltaCache * (_1M / PAGE_SIZE);
+    while (cDeltaCacheEntries & (cDeltaCacheEntries - 1))
+        cDeltaCacheEntries &= cDeltaCacheEntries - 1;
+    uint32_t const cPages = cMbRam * (_1M / PAGE_SIZE);
+
+    /*
+     * A single socket without deltas is the old teleporter, compare with that.
+     */
+    tstMigrate(1, cPages, cDirtyPagesPerSec, 0, cMsMaxDowntime);
+    if (cDeltaCacheEntries)
+        tstMigrate(1, cPages, cDirtyPagesPerSec, cDeltaCacheEntries, cMsMaxDowntime);
+    if (cStreams > 1)
+        tstMigrate(cStreams, cPages, cDirtyPagesPerSec, cDeltaCacheEntries, cMsMaxDowntime);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -95,6 +95,7 @@ extern "C"
 #include "netif/etharp.h"
 
 #include "proxy.h"
+#include "proxy_pollmgr.h"
 #include "pxremap.h"
 #include "portfwd.h"
 }
@@ -657,6 +658,7 @@ VBoxNetLwipNAT::VBoxNetLwipNAT(SOCKET icmpsock4, SOCKET icmpsock6) : VBoxNetBase
     m_src6.sin6_len = sizeof(m_src6);
 #endif
     m_ProxyOptions.nameservers = NULL;
+    m_ProxyOptions.pollmgr_workers = 1;
 
     m_LwipNetIf.name[0] = 'N';
     m_LwipNetIf.name[1] = 'T';
@@ -903,6 +905,30 @@ int VBoxNetLwipNAT::init()
     }
 
 
+    /*
+     * Number of poll manager threads proxied TCP connections are
+     * spread over.
+     */
+    com::Bstr bstrPollWorkers;
+    com::Bstr bstrPollWorkersKey = com::BstrFmt("NAT/%s/PollWorkers", networkName.c_str());
+    hrc = virtualbox->GetExtraData(bstrPollWorkersKey.raw(), bstrPollWorkers.asOutParam());
+    if (SUCCEEDED(hrc) && bstrPollWorkers.isNotEmpty())
+    {
+        uint32_t cWorkers = 0;
+        rc = RTStrToUInt32Full(com::Utf8Str(bstrPollWorkers).c_str(), 10, &cWorkers);
+        if (rc == VINF_SUCCESS && cWorkers >= 1 && cWorkers <= POLLMGR_MAX_WORKERS)
+        {
+            m_ProxyOptions.pollmgr_workers = (int)cWorkers;
+            LogRel(("Will use %u poll manager workers\n", cWorkers));
+        }
+        else
+        {
+            LogRel(("Failed to parse \"%s\" poll manager worker count (must be 1..%u)\n",
+                    com::Utf8Str(bstrPollWorkers).c_str(), POLLMGR_MAX_WORKERS));
+        }
+    }
+
+
     if (!fDontLoadRulesOnStartup)
     {
         fetchNatPortForwardRules(m_net, false, m_vecPortForwardRule4);
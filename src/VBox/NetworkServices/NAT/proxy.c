@@ -97,7 +97,7 @@ proxy_init(struct netif *proxy_netif, struct proxy_options *opts)
         tftpd_init(proxy_netif, opts->tftp_root);
     }
 
-    status = pollmgr_init();
+    status = pollmgr_init(opts->pollmgr_workers);
     if (status < 0) {
         errx(EXIT_FAILURE, "failed to initialize poll manager");
         /* NOTREACHED */
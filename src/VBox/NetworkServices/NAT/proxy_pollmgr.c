@@ -43,6 +43,27 @@
 
 #include <iprt/req.h>
 #include <iprt/err.h>
+#include <iprt/thread.h>
+
+/*
+ * On Linux the workers wait with epoll(7) so that the cost of a wakeup
+ * is proportional to the number of ready sockets rather than to the
+ * number of sockets polled.  Elsewhere plain poll() is used.
+ */
+#if defined(RT_OS_LINUX) && !defined(POLLMGR_NO_EPOLL)
+# define POLLMGR_EPOLL 1
+# include <sys/epoll.h>
+#endif
+
+
+#ifdef POLLMGR_EPOLL
+/* max number of ready sockets fetched with one epoll_wait() */
+#define POLLMGR_EPOLL_BATCH 64
+
+/* the poll(2) and epoll(7) event bits are the same on Linux */
+AssertCompile(POLLIN == EPOLLIN && POLLPRI == EPOLLPRI && POLLOUT == EPOLLOUT);
+AssertCompile(POLLERR == EPOLLERR && POLLHUP == EPOLLHUP);
+#endif
 
 
 #define POLLMGR_GARBAGE (-1)
@@ -57,12 +78,20 @@ enum {
 
 
 struct pollmgr_chan {
-    struct pollmgr_handler *handler;
     void *arg;
     bool arg_valid;
 };
 
-struct pollmgr {
+/*
+ * Each worker thread polls its own set of sockets and has its own
+ * request queue, so the channel handlers it runs can only touch its
+ * own arrays.  Worker 0 is the original poll manager thread that owns
+ * all the "global" sockets (listeners, udp, dns, ping); proxied tcp
+ * connections are spread over all the workers.
+ */
+struct pollmgr_shard {
+    int index;
+
     struct pollfd *fds;
     struct pollmgr_handler **handlers;
     nfds_t capacity;            /* allocated size of the arrays */
@@ -77,16 +106,52 @@ struct pollmgr {
     /* emulate channels with request queue */
     RTREQQUEUE queue;
     struct pollmgr_handler queue_handler;
-    struct pollmgr_chan chan_handlers[POLLMGR_CHAN_COUNT];
+    struct pollmgr_chan chan_args[POLLMGR_CHAN_COUNT];
+
+    RTTHREAD thread;
+
+#ifdef POLLMGR_EPOLL
+    int epfd;
+    struct epoll_event events[POLLMGR_EPOLL_BATCH];
+
+    /*
+     * Slots deleted while processing ready events.  The arrays are
+     * compacted after the batch is done so that slot numbers in the
+     * rest of the batch remain valid.
+     */
+    int *dead;
+    nfds_t ndead;
+#endif
+};
+
+struct pollmgr {
+    struct pollmgr_shard shards[POLLMGR_MAX_WORKERS];
+    int nshards;
+
+    /* channel handlers are shared by all workers */
+    struct pollmgr_handler *chan_handlers[POLLMGR_CHAN_COUNT];
+
+    /* worker the current thread is (NULL means worker 0) */
+    RTTLS tls;
 } pollmgr;
 
 
+static int pollmgr_shard_init(struct pollmgr_shard *, int);
+static void pollmgr_shard_cleanup(struct pollmgr_shard *);
+static struct pollmgr_shard *pollmgr_current(void);
+
 static int pollmgr_queue_callback(struct pollmgr_handler *, SOCKET, int);
-static void pollmgr_chan_call_handler(int, void *);
+static void pollmgr_chan_call_handler(struct pollmgr_shard *, int, void *);
 
-static void pollmgr_loop(void);
+static DECLCALLBACK(int) pollmgr_worker_thread(RTTHREAD, void *);
+static void pollmgr_loop(struct pollmgr_shard *);
 
-static void pollmgr_add_at(int, struct pollmgr_handler *, SOCKET, int);
+static int pollmgr_add_at(struct pollmgr_shard *, int, struct pollmgr_handler *, SOCKET, int);
+#ifdef POLLMGR_EPOLL
+static int pollmgr_epoll_ctl(struct pollmgr_shard *, int, int);
+static void pollmgr_epoll_kill(struct pollmgr_shard *, int);
+static void pollmgr_epoll_compact(struct pollmgr_shard *);
+#endif
 static void pollmgr_refptr_delete(struct pollmgr_refptr *);
 
 
@@ -99,13 +164,47 @@ static void pollmgr_refptr_delete(struct pollmgr_refptr *);
  * fragmentation.
  *
  * We can use shared buffer here since we read from sockets
- * sequentially in a loop over pollfd.
+ * sequentially in a loop over pollfd.  Only worker 0 polls the
+ * sockets that use it.
  */
 u8_t pollmgr_udpbuf[64 * 1024];
 
 
 int
-pollmgr_init(void)
+pollmgr_init(int nworkers)
+{
+    int i;
+
+    if (nworkers < 1) {
+        nworkers = 1;
+    }
+    else if (nworkers > POLLMGR_MAX_WORKERS) {
+        nworkers = POLLMGR_MAX_WORKERS;
+    }
+
+    pollmgr.tls = RTTlsAlloc();
+    if (pollmgr.tls == NIL_RTTLS) {
+        return -1;
+    }
+
+    for (i = 0; i < nworkers; ++i) {
+        if (pollmgr_shard_init(&pollmgr.shards[i], i) < 0) {
+            while (--i >= 0) {
+                pollmgr_shard_cleanup(&pollmgr.shards[i]);
+            }
+            RTTlsFree(pollmgr.tls);
+            pollmgr.tls = NIL_RTTLS;
+            return -1;
+        }
+    }
+
+    pollmgr.nshards = nworkers;
+    return 0;
+}
+
+
+static int
+pollmgr_shard_init(struct pollmgr_shard *shard, int index)
 {
     struct pollfd *newfds;
     struct pollmgr_handler **newhdls;
@@ -113,25 +212,40 @@ pollmgr_init(void)
     int rc, status;
     nfds_t i;
 
-    rc = RTReqQueueCreate(&pollmgr.queue);
+    shard->index = index;
+    shard->thread = NIL_RTTHREAD;
+
+    rc = RTReqQueueCreate(&shard->queue);
     if (RT_FAILURE(rc))
         return -1;
 
-    pollmgr.fds = NULL;
-    pollmgr.handlers = NULL;
-    pollmgr.capacity = 0;
-    pollmgr.nfds = 0;
+#ifdef POLLMGR_EPOLL
+    shard->dead = NULL;
+    shard->ndead = 0;
+    shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epfd < 0) {
+        DPRINTF0(("epoll_create1: %R[sockerr]\n", errno));
+        RTReqQueueDestroy(shard->queue);
+        shard->queue = NIL_RTREQQUEUE;
+        return -1;
+    }
+#endif
+
+    shard->fds = NULL;
+    shard->handlers = NULL;
+    shard->capacity = 0;
+    shard->nfds = 0;
 
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
-        pollmgr.chan[i][POLLMGR_CHFD_RD] = INVALID_SOCKET;
-        pollmgr.chan[i][POLLMGR_CHFD_WR] = INVALID_SOCKET;
+        shard->chan[i][POLLMGR_CHFD_RD] = INVALID_SOCKET;
+        shard->chan[i][POLLMGR_CHFD_WR] = INVALID_SOCKET;
     }
 
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
 #ifndef RT_OS_WINDOWS
         int j;
 
-        status = socketpair(PF_LOCAL, SOCK_DGRAM, 0, pollmgr.chan[i]);
+        status = socketpair(PF_LOCAL, SOCK_DGRAM, 0, shard->chan[i]);
         if (status < 0) {
             DPRINTF(("socketpair: %R[sockerr]\n", SOCKERRNO()));
             goto cleanup_close;
@@ -139,7 +253,7 @@ pollmgr_init(void)
 
         /* now manually make them O_NONBLOCK */
         for (j = 0; j < 2; ++j) {
-            int s = pollmgr.chan[i][j];
+            int s = shard->chan[i][j];
             int sflags;
 
             sflags = fcntl(s, F_GETFL, 0);
@@ -155,7 +269,7 @@ pollmgr_init(void)
             }
         }
 #else
-        status = RTWinSocketPair(PF_INET, SOCK_DGRAM, 0, pollmgr.chan[i]);
+        status = RTWinSocketPair(PF_INET, SOCK_DGRAM, 0, shard->chan[i]);
         if (RT_FAILURE(status)) {
             goto cleanup_close;
         }
@@ -167,56 +281,142 @@ pollmgr_init(void)
     LWIP_ASSERT1(newcap >= POLLMGR_SLOT_STATIC_COUNT);
 
     newfds = (struct pollfd *)
-        malloc(newcap * sizeof(*pollmgr.fds));
+        malloc(newcap * sizeof(*shard->fds));
     if (newfds == NULL) {
         DPRINTF(("%s: Failed to allocate fds array\n", __func__));
         goto cleanup_close;
     }
 
     newhdls = (struct pollmgr_handler **)
-        malloc(newcap * sizeof(*pollmgr.handlers));
+        malloc(newcap * sizeof(*shard->handlers));
     if (newhdls == NULL) {
         DPRINTF(("%s: Failed to allocate handlers array\n", __func__));
         free(newfds);
         goto cleanup_close;
     }
 
-    pollmgr.capacity = newcap;
-    pollmgr.fds = newfds;
-    pollmgr.handlers = newhdls;
+#ifdef POLLMGR_EPOLL
+    shard->dead = (int *)malloc(newcap * sizeof(*shard->dead));
+    if (shard->dead == NULL) {
+        DPRINTF(("%s: Failed to allocate dead slots array\n", __func__));
+        free(newhdls);
+        free(newfds);
+        goto cleanup_close;
+    }
+#endif
+
+    shard->capacity = newcap;
+    shard->fds = newfds;
+    shard->handlers = newhdls;
 
-    pollmgr.nfds = POLLMGR_SLOT_STATIC_COUNT;
+    shard->nfds = POLLMGR_SLOT_STATIC_COUNT;
 
-    for (i = 0; i < pollmgr.capacity; ++i) {
-        pollmgr.fds[i].fd = INVALID_SOCKET;
-        pollmgr.fds[i].events = 0;
-        pollmgr.fds[i].revents = 0;
+    for (i = 0; i < shard->capacity; ++i) {
+        shard->fds[i].fd = INVALID_SOCKET;
+        shard->fds[i].events = 0;
+        shard->fds[i].revents = 0;
     }
 
     /* add request queue notification */
-    pollmgr.queue_handler.callback = pollmgr_queue_callback;
-    pollmgr.queue_handler.data = NULL;
-    pollmgr.queue_handler.slot = -1;
-
-    pollmgr_add_at(POLLMGR_QUEUE, &pollmgr.queue_handler,
-                   pollmgr.chan[POLLMGR_QUEUE][POLLMGR_CHFD_RD],
-                   POLLIN);
+    shard->queue_handler.callback = pollmgr_queue_callback;
+    shard->queue_handler.data = shard;
+    shard->queue_handler.slot = -1;
+
+    status = pollmgr_add_at(shard, POLLMGR_QUEUE, &shard->queue_handler,
+                            shard->chan[POLLMGR_QUEUE][POLLMGR_CHFD_RD],
+                            POLLIN);
+    if (status < 0) {
+        pollmgr_shard_cleanup(shard);
+        return -1;
+    }
 
     return 0;
 
   cleanup_close:
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
-        SOCKET *chan = pollmgr.chan[i];
+        SOCKET *chan = shard->chan[i];
         if (chan[POLLMGR_CHFD_RD] != INVALID_SOCKET) {
             closesocket(chan[POLLMGR_CHFD_RD]);
             closesocket(chan[POLLMGR_CHFD_WR]);
         }
     }
 
+#ifdef POLLMGR_EPOLL
+    close(shard->epfd);
+    shard->epfd = -1;
+#endif
+    RTReqQueueDestroy(shard->queue);
+    shard->queue = NIL_RTREQQUEUE;
     return -1;
 }
 
 
+/*
+ * Undo pollmgr_shard_init() for a worker that was never started.
+ */
+static void
+pollmgr_shard_cleanup(struct pollmgr_shard *shard)
+{
+    int i;
+
+    for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
+        SOCKET *chan = shard->chan[i];
+        if (chan[POLLMGR_CHFD_RD] != INVALID_SOCKET) {
+            closesocket(chan[POLLMGR_CHFD_RD]);
+            closesocket(chan[POLLMGR_CHFD_WR]);
+        }
+    }
+
+    free(shard->fds);
+    free(shard->handlers);
+#ifdef POLLMGR_EPOLL
+    free(shard->dead);
+    close(shard->epfd);
+    shard->epfd = -1;
+#endif
+    RTReqQueueDestroy(shard->queue);
+    shard->queue = NIL_RTREQQUEUE;
+}
+
+
+/*
+ * The worker the calling thread belongs to.  Threads other than the
+ * workers (e.g. lwip thread during initialization, before the
+ * workers are started) act on behalf of worker 0.
+ */
+static struct pollmgr_shard *
+pollmgr_current(void)
+{
+    struct pollmgr_shard *shard;
+
+    shard = (struct pollmgr_shard *)RTTlsGet(pollmgr.tls);
+    if (shard == NULL) {
+        shard = &pollmgr.shards[0];
+    }
+    return shard;
+}
+
+
+/*
+ * Number of worker threads.
+ */
+int
+pollmgr_shard_count(void)
+{
+    return pollmgr.nshards;
+}
+
+
+/*
+ * Pick the worker for a new connection with the given flow hash.
+ */
+int
+pollmgr_shard_select(u32_t hash)
+{
+    return (int)(hash % (u32_t)pollmgr.nshards);
+}
+
+
 /*
  * Add new channel.  We now implement channels with request queue, so
  * all channels get the same socket that triggers queue processing.
@@ -230,27 +430,40 @@ pollmgr_add_chan(int slot, struct pollmgr_handler *handler)
     AssertReturn(handler != NULL && handler->callback != NULL, INVALID_SOCKET);
 
     handler->slot = slot;
-    pollmgr.chan_handlers[slot].handler = handler;
-    return pollmgr.chan[POLLMGR_QUEUE][POLLMGR_CHFD_WR];
+    pollmgr.chan_handlers[slot] = handler;
+    return pollmgr.shards[0].chan[POLLMGR_QUEUE][POLLMGR_CHFD_WR];
+}
+
+
+/*
+ * Send to worker 0.
+ */
+ssize_t
+pollmgr_chan_send(int slot, void *buf, size_t nbytes)
+{
+    return pollmgr_chan_send_to(0, slot, buf, nbytes);
 }
 
 
 /*
  * This used to actually send data over the channel's socket.  Now we
  * queue a request and send single byte notification over shared
- * POLLMGR_QUEUE socket.
+ * POLLMGR_QUEUE socket of the specified worker.
  */
 ssize_t
-pollmgr_chan_send(int slot, void *buf, size_t nbytes)
+pollmgr_chan_send_to(int index, int slot, void *buf, size_t nbytes)
 {
     static const char notification = 0x5a;
 
+    struct pollmgr_shard *shard;
     void *ptr;
     SOCKET fd;
     ssize_t nsent;
     int rc;
 
     AssertReturn(0 <= slot && slot < POLLMGR_CHAN_COUNT, -1);
+    AssertReturn(0 <= index && index < pollmgr.nshards, -1);
+    shard = &pollmgr.shards[index];
 
     /*
      * XXX: Hack alert.  We only ever "sent" single pointer which was
@@ -265,12 +478,12 @@ pollmgr_chan_send(int slot, void *buf, size_t nbytes)
 
     ptr = *(void **)buf;
 
-    rc = RTReqQueueCallEx(pollmgr.queue, NULL, 0,
+    rc = RTReqQueueCallEx(shard->queue, NULL, 0,
                           RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                          (PFNRT)pollmgr_chan_call_handler, 2,
-                          slot, ptr);
+                          (PFNRT)pollmgr_chan_call_handler, 3,
+                          shard, slot, ptr);
 
-    fd = pollmgr.chan[POLLMGR_QUEUE][POLLMGR_CHFD_WR];
+    fd = shard->chan[POLLMGR_QUEUE][POLLMGR_CHFD_WR];
     nsent = send(fd, &notification, 1, 0);
     if (nsent == SOCKET_ERROR) {
         DPRINTF(("send on chan %d: %R[sockerr]\n", slot, SOCKERRNO()));
@@ -293,14 +506,18 @@ pollmgr_chan_send(int slot, void *buf, size_t nbytes)
 static int
 pollmgr_queue_callback(struct pollmgr_handler *handler, SOCKET fd, int revents)
 {
+    struct pollmgr_shard *shard;
+    char buf[16];
     ssize_t nread;
     int sockerr;
     int rc;
 
-    RT_NOREF(handler, revents);
-    Assert(pollmgr.queue != NIL_RTREQQUEUE);
+    RT_NOREF(revents);
+    shard = (struct pollmgr_shard *)handler->data;
+    Assert(shard->queue != NIL_RTREQQUEUE);
 
-    nread = recv(fd, (char *)pollmgr_udpbuf, sizeof(pollmgr_udpbuf), 0);
+    /* notifications are single bytes, don't use shared pollmgr_udpbuf */
+    nread = recv(fd, buf, sizeof(buf), 0);
     sockerr = SOCKERRNO();      /* save now, may be clobbered */
 
     if (nread == SOCKET_ERROR) {
@@ -313,7 +530,7 @@ pollmgr_queue_callback(struct pollmgr_handler *handler, SOCKET fd, int revents)
         return POLLIN;
     }
 
-    rc = RTReqQueueProcess(pollmgr.queue, 0);
+    rc = RTReqQueueProcess(shard->queue, 0);
     if (RT_UNLIKELY(rc != VERR_TIMEOUT && RT_FAILURE_NP(rc))) {
         DPRINTF0(("%s: RTReqQueueProcess: %Rrc\n", __func__, rc));
     }
@@ -327,19 +544,19 @@ pollmgr_queue_callback(struct pollmgr_handler *handler, SOCKET fd, int revents)
  * handler's callback.
  */
 static void
-pollmgr_chan_call_handler(int slot, void *arg)
+pollmgr_chan_call_handler(struct pollmgr_shard *shard, int slot, void *arg)
 {
     struct pollmgr_handler *handler;
     int nevents;
 
     AssertReturnVoid(0 <= slot && slot < POLLMGR_CHAN_COUNT);
 
-    handler = pollmgr.chan_handlers[slot].handler;
+    handler = pollmgr.chan_handlers[slot];
     AssertReturnVoid(handler != NULL && handler->callback != NULL);
 
     /* arrange for pollmgr_chan_recv_ptr() to "receive" the arg */
-    pollmgr.chan_handlers[slot].arg = arg;
-    pollmgr.chan_handlers[slot].arg_valid = true;
+    shard->chan_args[slot].arg = arg;
+    shard->chan_args[slot].arg_valid = true;
 
     nevents = handler->callback(handler, INVALID_SOCKET, POLLIN);
     if (nevents != POLLIN) {
@@ -354,11 +571,13 @@ pollmgr_chan_call_handler(int slot, void *arg)
 void *
 pollmgr_chan_recv_ptr(struct pollmgr_handler *handler, SOCKET fd, int revents)
 {
+    struct pollmgr_shard *shard;
     int slot;
     void *ptr;
 
     RT_NOREF(fd);
 
+    shard = pollmgr_current();
     slot = handler->slot;
     Assert(0 <= slot && slot < POLLMGR_CHAN_COUNT);
 
@@ -374,13 +593,13 @@ pollmgr_chan_recv_ptr(struct pollmgr_handler *handler, SOCKET fd, int revents)
 
     LWIP_ASSERT1(revents & POLLIN);
 
-    if (!pollmgr.chan_handlers[slot].arg_valid) {
+    if (!shard->chan_args[slot].arg_valid) {
         err(EXIT_FAILURE, "chan %d: recv", (int)handler->slot);
         /* NOTREACHED */
     }
 
-    ptr = pollmgr.chan_handlers[slot].arg;
-    pollmgr.chan_handlers[slot].arg_valid = false;
+    ptr = shard->chan_args[slot].arg;
+    shard->chan_args[slot].arg_valid = false;
 
     return ptr;
 }
@@ -388,35 +607,37 @@ pollmgr_chan_recv_ptr(struct pollmgr_handler *handler, SOCKET fd, int revents)
 
 /*
  * Must be called from pollmgr loop (via callbacks), so no locking.
+ * The handler is added to the worker running the callback.
  */
 int
 pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
 {
+    struct pollmgr_shard *shard = pollmgr_current();
     int slot;
 
-    DPRINTF2(("%s: new fd %d\n", __func__, fd));
+    DPRINTF2(("%s: new fd %d (worker %d)\n", __func__, fd, shard->index));
 
-    if (pollmgr.nfds == pollmgr.capacity) {
+    if (shard->nfds == shard->capacity) {
         struct pollfd *newfds;
         struct pollmgr_handler **newhdls;
         nfds_t newcap;
         nfds_t i;
 
-        newcap = pollmgr.capacity * 2;
+        newcap = shard->capacity * 2;
 
         newfds = (struct pollfd *)
-            realloc(pollmgr.fds, newcap * sizeof(*pollmgr.fds));
+            realloc(shard->fds, newcap * sizeof(*shard->fds));
         if (newfds == NULL) {
             DPRINTF(("%s: Failed to reallocate fds array\n", __func__));
             handler->slot = -1;
             return -1;
         }
 
-        pollmgr.fds = newfds; /* don't crash/leak if realloc(handlers) fails */
+        shard->fds = newfds; /* don't crash/leak if realloc(handlers) fails */
         /* but don't update capacity yet! */
 
         newhdls = (struct pollmgr_handler **)
-            realloc(pollmgr.handlers, newcap * sizeof(*pollmgr.handlers));
+            realloc(shard->handlers, newcap * sizeof(*shard->handlers));
         if (newhdls == NULL) {
             DPRINTF(("%s: Failed to reallocate handlers array\n", __func__));
             /* if we failed to realloc here, then fds points to the
@@ -425,10 +646,24 @@ pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
             return -1;
         }
 
-        pollmgr.handlers = newhdls;
-        pollmgr.capacity = newcap;
+        shard->handlers = newhdls;
+
+#ifdef POLLMGR_EPOLL
+        {
+            int *newdead = (int *)
+                realloc(shard->dead, newcap * sizeof(*shard->dead));
+            if (newdead == NULL) {
+                DPRINTF(("%s: Failed to reallocate dead slots array\n", __func__));
+                handler->slot = -1;
+                return -1;
+            }
+            shard->dead = newdead;
+        }
+#endif
+
+        shard->capacity = newcap;
 
-        for (i = pollmgr.nfds; i < newcap; ++i) {
+        for (i = shard->nfds; i < newcap; ++i) {
             newfds[i].fd = INVALID_SOCKET;
             newfds[i].events = 0;
             newfds[i].revents = 0;
@@ -436,58 +671,294 @@ pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
         }
     }
 
-    slot = pollmgr.nfds;
-    ++pollmgr.nfds;
+    slot = shard->nfds;
+    ++shard->nfds;
 
-    pollmgr_add_at(slot, handler, fd, events);
+    if (pollmgr_add_at(shard, slot, handler, fd, events) < 0) {
+        --shard->nfds;
+        return -1;
+    }
     return slot;
 }
 
 
-static void
-pollmgr_add_at(int slot, struct pollmgr_handler *handler, SOCKET fd, int events)
+static int
+pollmgr_add_at(struct pollmgr_shard *shard, int slot,
+               struct pollmgr_handler *handler, SOCKET fd, int events)
 {
-    pollmgr.fds[slot].fd = fd;
-    pollmgr.fds[slot].events = events;
-    pollmgr.fds[slot].revents = 0;
-    pollmgr.handlers[slot] = handler;
+    shard->fds[slot].fd = fd;
+    shard->fds[slot].events = events;
+    shard->fds[slot].revents = 0;
+    shard->handlers[slot] = handler;
+
+#ifdef POLLMGR_EPOLL
+    if (pollmgr_epoll_ctl(shard, EPOLL_CTL_ADD, slot) < 0) {
+        DPRINTF0(("%s: EPOLL_CTL_ADD fd %d: %R[sockerr]\n",
+                  __func__, fd, errno));
+        shard->fds[slot].fd = INVALID_SOCKET;
+        shard->fds[slot].events = 0;
+        shard->handlers[slot] = NULL;
+        handler->slot = -1;
+        return -1;
+    }
+#endif
 
     handler->slot = slot;
+    handler->shard = shard->index;
+    return 0;
 }
 
 
 void
 pollmgr_update_events(int slot, int events)
 {
+    struct pollmgr_shard *shard = pollmgr_current();
+
     LWIP_ASSERT1(slot >= POLLMGR_SLOT_FIRST_DYNAMIC);
-    LWIP_ASSERT1((nfds_t)slot < pollmgr.nfds);
+    LWIP_ASSERT1((nfds_t)slot < shard->nfds);
 
-    pollmgr.fds[slot].events = events;
+#ifdef POLLMGR_EPOLL
+    if (shard->fds[slot].events != events) {
+        shard->fds[slot].events = events;
+        pollmgr_epoll_ctl(shard, EPOLL_CTL_MOD, slot);
+    }
+#else
+    shard->fds[slot].events = events;
+#endif
 }
 
 
 void
 pollmgr_del_slot(int slot)
 {
+    struct pollmgr_shard *shard = pollmgr_current();
+
     LWIP_ASSERT1(slot >= POLLMGR_SLOT_FIRST_DYNAMIC);
 
     DPRINTF2(("%s(%d): fd %d ! DELETED\n",
-              __func__, slot, pollmgr.fds[slot].fd));
+              __func__, slot, shard->fds[slot].fd));
 
-    pollmgr.fds[slot].fd = INVALID_SOCKET; /* see poll loop */
+#ifdef POLLMGR_EPOLL
+    pollmgr_epoll_kill(shard, slot);
+#else
+    shard->fds[slot].fd = INVALID_SOCKET; /* see poll loop */
+#endif
 }
 
 
+/*
+ * Entry point of worker 0.  It starts the other workers before
+ * entering its own loop so that they begin processing the requests
+ * queued for them during initialization.
+ */
 void
 pollmgr_thread(void *ignored)
 {
+    int i;
+
     LWIP_UNUSED_ARG(ignored);
-    pollmgr_loop();
+
+    for (i = 1; i < pollmgr.nshards; ++i) {
+        struct pollmgr_shard *shard = &pollmgr.shards[i];
+        int rc;
+
+        rc = RTThreadCreateF(&shard->thread, pollmgr_worker_thread, shard,
+                             0, RTTHREADTYPE_IO, 0, "pollmgr%d", i);
+        if (RT_FAILURE(rc)) {
+            errx(EXIT_FAILURE, "failed to create poll manager worker %d", i);
+            /* NOTREACHED */
+        }
+    }
+
+    RTTlsSet(pollmgr.tls, &pollmgr.shards[0]);
+    pollmgr_loop(&pollmgr.shards[0]);
+}
+
+
+static DECLCALLBACK(int)
+pollmgr_worker_thread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    struct pollmgr_shard *shard = (struct pollmgr_shard *)pvUser;
+
+    RT_NOREF(hThreadSelf);
+
+    RTTlsSet(pollmgr.tls, shard);
+    pollmgr_loop(shard);
+    return VINF_SUCCESS;
+}
+
+
+#ifdef POLLMGR_EPOLL
+
+/*
+ * Register, update or unregister slot's socket with the worker's
+ * epoll instance.  Readiness is level-triggered: the handlers read
+ * a single datagram or connection per callback and rely on being
+ * called again while there's more, exactly as with poll().
+ */
+static int
+pollmgr_epoll_ctl(struct pollmgr_shard *shard, int op, int slot)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (uint32_t)shard->fds[slot].events & (EPOLLIN | EPOLLPRI | EPOLLOUT);
+    ev.data.u32 = (uint32_t)slot;
+
+    return epoll_ctl(shard->epfd, op, shard->fds[slot].fd, &ev);
+}
+
+
+/*
+ * Stop polling the slot and schedule it for removal from the arrays
+ * at the end of the current batch.
+ */
+static void
+pollmgr_epoll_kill(struct pollmgr_shard *shard, int slot)
+{
+    if (shard->handlers[slot] == NULL) {
+        return;                 /* already dead */
+    }
+
+    /* may fail with EBADF if the handler has already closed it */
+    if (shard->fds[slot].fd != INVALID_SOCKET) {
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, shard->fds[slot].fd, NULL);
+    }
+
+    shard->fds[slot].fd = INVALID_SOCKET;
+    shard->fds[slot].events = 0;
+    shard->fds[slot].revents = 0;
+    shard->handlers[slot] = NULL;
+
+    if (slot >= POLLMGR_SLOT_FIRST_DYNAMIC) {
+        shard->dead[shard->ndead++] = slot;
+    }
+}
+
+
+/*
+ * Fill the holes left by dead slots with live entries from the end
+ * of the arrays.  Moved sockets get their epoll data updated.
+ */
+static void
+pollmgr_epoll_compact(struct pollmgr_shard *shard)
+{
+    nfds_t i;
+
+    for (i = 0; i < shard->ndead; ++i) {
+        const int dead = shard->dead[i];
+        int last;
+
+        /* drop dead entries at the end of the array */
+        while (shard->nfds > POLLMGR_SLOT_FIRST_DYNAMIC
+               && shard->handlers[shard->nfds - 1] == NULL)
+        {
+            --shard->nfds;
+        }
+
+        if ((nfds_t)dead >= shard->nfds) {
+            continue;           /* already dropped */
+        }
+
+        /* move live entry at the end into the freed slot */
+        last = shard->nfds - 1;
+        shard->fds[dead] = shard->fds[last]; /* struct copy */
+        shard->handlers[dead] = shard->handlers[last];
+        shard->handlers[dead]->slot = dead;
+        pollmgr_epoll_ctl(shard, EPOLL_CTL_MOD, dead);
+        --shard->nfds;
+
+        shard->fds[last].fd = INVALID_SOCKET;
+        shard->fds[last].events = 0;
+        shard->fds[last].revents = 0;
+        shard->handlers[last] = NULL;
+    }
+
+    shard->ndead = 0;
+}
+
+
+static void
+pollmgr_loop(struct pollmgr_shard *shard)
+{
+    int nready;
+    int i;
+
+    for (;;) {
+        nready = epoll_wait(shard->epfd, shard->events,
+                            POLLMGR_EPOLL_BATCH, -1);
+
+        DPRINTF2(("%s: ready %d fd%s\n",
+                  __func__, nready, (nready == 1 ? "" : "s")));
+
+        if (nready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err(EXIT_FAILURE, "epoll_wait"); /* XXX: what to do on error? */
+            /* NOTREACHED*/
+        }
+
+        for (i = 0; i < nready; ++i) {
+            struct pollmgr_handler *handler;
+            const int slot = (int)shard->events[i].data.u32;
+            SOCKET fd;
+            int revents, nevents;
+
+            /* deleted by a handler earlier in this batch? */
+            if ((nfds_t)slot >= shard->nfds
+                || shard->handlers[slot] == NULL
+                || shard->fds[slot].fd == INVALID_SOCKET)
+            {
+                continue;
+            }
+
+            fd = shard->fds[slot].fd;
+            revents = (int)(shard->events[i].events
+                            & (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP));
+            handler = shard->handlers[slot];
+
+            if (handler->callback != NULL) {
+                DPRINTF2(("%s: fd %d @ revents 0x%x\n",
+                          __func__, fd, revents));
+                nevents = (*handler->callback)(handler, fd, revents);
+            }
+            else {
+                DPRINTF0(("%s: invalid handler for fd %d: %p (callback = NULL)\n",
+                          __func__, fd, (void *)handler));
+                nevents = -1;   /* delete it */
+            }
+
+            if (shard->handlers[slot] != handler) {
+                continue;       /* callback deleted its own slot */
+            }
+
+            if (nevents >= 0) {
+                if (nevents != shard->fds[slot].events) {
+                    DPRINTF2(("%s: fd %d ! nevents 0x%x\n",
+                              __func__, fd, nevents));
+                    shard->fds[slot].events = nevents;
+                    pollmgr_epoll_ctl(shard, EPOLL_CTL_MOD, slot);
+                }
+            }
+            else {
+                DPRINTF2(("%s: fd %d ! DELETED%s\n", __func__, fd,
+                          slot < POLLMGR_SLOT_FIRST_DYNAMIC ? " (channel)" : ""));
+                pollmgr_epoll_kill(shard, slot);
+            }
+        }
+
+        if (shard->ndead > 0) {
+            pollmgr_epoll_compact(shard);
+        }
+    } /* poll loop */
 }
 
+#else  /* !POLLMGR_EPOLL */
 
 static void
-pollmgr_loop(void)
+pollmgr_loop(struct pollmgr_shard *shard)
 {
     int nready;
     SOCKET delfirst;
@@ -496,9 +967,9 @@ pollmgr_loop(void)
 
     for (;;) {
 #ifndef RT_OS_WINDOWS
-        nready = poll(pollmgr.fds, pollmgr.nfds, -1);
+        nready = poll(shard->fds, shard->nfds, -1);
 #else
-        int rc = RTWinPoll(pollmgr.fds, pollmgr.nfds,RT_INDEFINITE_WAIT, &nready);
+        int rc = RTWinPoll(shard->fds, shard->nfds,RT_INDEFINITE_WAIT, &nready);
         if (RT_FAILURE(rc)) {
             err(EXIT_FAILURE, "poll"); /* XXX: what to do on error? */
             /* NOTREACHED*/
@@ -524,13 +995,13 @@ pollmgr_loop(void)
         delfirst = INVALID_SOCKET;
         pdelprev = &delfirst;
 
-        for (i = 0; (nfds_t)i < pollmgr.nfds && nready > 0; ++i) {
+        for (i = 0; (nfds_t)i < shard->nfds && nready > 0; ++i) {
             struct pollmgr_handler *handler;
             SOCKET fd;
             int revents, nevents;
 
-            fd = pollmgr.fds[i].fd;
-            revents = pollmgr.fds[i].revents;
+            fd = shard->fds[i].fd;
+            revents = shard->fds[i].revents;
 
             /*
              * Channel handlers can request deletion of dynamic slots
@@ -552,7 +1023,7 @@ pollmgr_loop(void)
             }
             --nready;
 
-            handler = pollmgr.handlers[i];
+            handler = shard->handlers[i];
 
             if (handler != NULL && handler->callback != NULL) {
 #ifdef LWIP_PROXY_DEBUG
@@ -587,32 +1058,32 @@ pollmgr_loop(void)
 
           update_events:
             if (nevents >= 0) {
-                if (nevents != pollmgr.fds[i].events) {
+                if (nevents != shard->fds[i].events) {
                     DPRINTF2(("%s: fd %d ! nevents 0x%x\n",
                               __func__, fd, nevents));
                 }
-                pollmgr.fds[i].events = nevents;
+                shard->fds[i].events = nevents;
             }
             else if (i < POLLMGR_SLOT_FIRST_DYNAMIC) {
                 /* Don't garbage-collect channels. */
                 DPRINTF2(("%s: fd %d ! DELETED (channel %d)\n",
                           __func__, fd, i));
-                pollmgr.fds[i].fd = INVALID_SOCKET;
-                pollmgr.fds[i].events = 0;
-                pollmgr.fds[i].revents = 0;
-                pollmgr.handlers[i] = NULL;
+                shard->fds[i].fd = INVALID_SOCKET;
+                shard->fds[i].events = 0;
+                shard->fds[i].revents = 0;
+                shard->handlers[i] = NULL;
             }
             else {
                 DPRINTF2(("%s: fd %d ! DELETED\n", __func__, fd));
 
                 /* schedule for deletion (see g/c loop for details) */
                 *pdelprev = i;  /* make previous entry point to us */
-                pdelprev = &pollmgr.fds[i].fd;
+                pdelprev = &shard->fds[i].fd;
 
-                pollmgr.fds[i].fd = INVALID_SOCKET; /* end of list (for now) */
-                pollmgr.fds[i].events = POLLMGR_GARBAGE;
-                pollmgr.fds[i].revents = 0;
-                pollmgr.handlers[i] = NULL;
+                shard->fds[i].fd = INVALID_SOCKET; /* end of list (for now) */
+                shard->fds[i].events = POLLMGR_GARBAGE;
+                shard->fds[i].revents = 0;
+                shard->handlers[i] = NULL;
             }
         } /* processing loop */
 
@@ -630,33 +1101,33 @@ pollmgr_loop(void)
          * processing loop above.
          */
         while (delfirst != INVALID_SOCKET) {
-            const int last = pollmgr.nfds - 1;
+            const int last = shard->nfds - 1;
 
             /*
              * We want a live entry in the last slot to swap into the
              * freed slot, so make sure we have one.
              */
-            if (pollmgr.fds[last].events == POLLMGR_GARBAGE /* garbage */
-                || pollmgr.fds[last].fd == INVALID_SOCKET)  /* or killed */
+            if (shard->fds[last].events == POLLMGR_GARBAGE /* garbage */
+                || shard->fds[last].fd == INVALID_SOCKET)  /* or killed */
             {
                 /* drop garbage entry at the end of the array */
-                --pollmgr.nfds;
+                --shard->nfds;
 
                 if (delfirst == (SOCKET)last) {
-                    /* congruent to delnext >= pollmgr.nfds test below */
+                    /* congruent to delnext >= shard->nfds test below */
                     delfirst = INVALID_SOCKET; /* done */
                 }
             }
             else {
-                const SOCKET delnext = pollmgr.fds[delfirst].fd;
+                const SOCKET delnext = shard->fds[delfirst].fd;
 
                 /* copy live entry at the end to the first slot being freed */
-                pollmgr.fds[delfirst] = pollmgr.fds[last]; /* struct copy */
-                pollmgr.handlers[delfirst] = pollmgr.handlers[last];
-                pollmgr.handlers[delfirst]->slot = (int)delfirst;
-                --pollmgr.nfds;
+                shard->fds[delfirst] = shard->fds[last]; /* struct copy */
+                shard->handlers[delfirst] = shard->handlers[last];
+                shard->handlers[delfirst]->slot = (int)delfirst;
+                --shard->nfds;
 
-                if ((nfds_t)delnext >= pollmgr.nfds) {
+                if ((nfds_t)delnext >= shard->nfds) {
                     delfirst = INVALID_SOCKET; /* done */
                 }
                 else {
@@ -664,14 +1135,16 @@ pollmgr_loop(void)
                 }
             }
 
-            pollmgr.fds[last].fd = INVALID_SOCKET;
-            pollmgr.fds[last].events = 0;
-            pollmgr.fds[last].revents = 0;
-            pollmgr.handlers[last] = NULL;
+            shard->fds[last].fd = INVALID_SOCKET;
+            shard->fds[last].events = 0;
+            shard->fds[last].revents = 0;
+            shard->handlers[last] = NULL;
         }
     } /* poll loop */
 }
 
+#endif /* !POLLMGR_EPOLL */
+
 
 /**
  * Create strongly held refptr.
@@ -46,8 +46,12 @@ struct pollmgr_handler {
     pollmgr_callback callback;
     void *data;
     int slot;
+    int shard;                  /* worker; set by pollmgr_add() */
 };
 
+/* max number of poll manager worker threads */
+#define POLLMGR_MAX_WORKERS 16
+
 struct pollmgr_refptr {
     struct pollmgr_handler *ptr;
     sys_mutex_t lock;
@@ -55,11 +59,16 @@ struct pollmgr_refptr {
     size_t weak;
 };
 
-int pollmgr_init(void);
+int pollmgr_init(int nworkers);
+
+/* worker threads */
+int pollmgr_shard_count(void);
+int pollmgr_shard_select(u32_t hash);
 
 /* static named slots (aka "channels") */
 SOCKET pollmgr_add_chan(int, struct pollmgr_handler *);
 ssize_t pollmgr_chan_send(int, void *buf, size_t nbytes);
+ssize_t pollmgr_chan_send_to(int shard, int, void *buf, size_t nbytes);
 void *pollmgr_chan_recv_ptr(struct pollmgr_handler *, SOCKET, int);
 
 /* dynamic slots */
@@ -340,7 +340,7 @@ pxtcp_init(void)
 static ssize_t
 pxtcp_chan_send(enum pollmgr_slot_t slot, struct pxtcp *pxtcp)
 {
-    return pollmgr_chan_send(slot, &pxtcp, sizeof(pxtcp));
+    return pollmgr_chan_send_to(pxtcp->pmhdl.shard, slot, &pxtcp, sizeof(pxtcp));
 }
 
 
@@ -352,7 +352,7 @@ static ssize_t
 pxtcp_chan_send_weak(enum pollmgr_slot_t slot, struct pxtcp *pxtcp)
 {
     pollmgr_refptr_weak_ref(pxtcp->rp);
-    return pollmgr_chan_send(slot, &pxtcp->rp, sizeof(pxtcp->rp));
+    return pollmgr_chan_send_to(pxtcp->pmhdl.shard, slot, &pxtcp->rp, sizeof(pxtcp->rp));
 }
 
 
@@ -590,6 +590,7 @@ pxtcp_allocate(void)
     pxtcp->pmhdl.callback = NULL;
     pxtcp->pmhdl.data = (void *)pxtcp;
     pxtcp->pmhdl.slot = -1;
+    pxtcp->pmhdl.shard = 0;
 
     pxtcp->pcb = NULL;
     pxtcp->sock = INVALID_SOCKET;
@@ -999,6 +1000,43 @@ pxtcp_schedule_reject(struct pxtcp *pxtcp)
 }
 
 
+/**
+ * Hash of the connection's addresses and ports.  Used to spread
+ * proxied connections over poll manager workers.
+ */
+static u32_t
+pxtcp_flow_hash(struct tcp_pcb *pcb)
+{
+    const u8_t *addrs[2];
+    size_t addrlen;
+    u32_t hash;
+    size_t i, j;
+
+    if (PCB_ISIPV6(pcb)) {
+        addrs[0] = (const u8_t *)ipX_2_ip6(&pcb->local_ip);
+        addrs[1] = (const u8_t *)ipX_2_ip6(&pcb->remote_ip);
+        addrlen = sizeof(ip6_addr_t);
+    }
+    else {
+        addrs[0] = (const u8_t *)ipX_2_ip(&pcb->local_ip);
+        addrs[1] = (const u8_t *)ipX_2_ip(&pcb->remote_ip);
+        addrlen = sizeof(ip_addr_t);
+    }
+
+    /* FNV-1a */
+    hash = 2166136261U;
+    for (i = 0; i < 2; ++i) {
+        for (j = 0; j < addrlen; ++j) {
+            hash = (hash ^ addrs[i][j]) * 16777619U;
+        }
+    }
+    hash = (hash ^ pcb->local_port) * 16777619U;
+    hash = (hash ^ pcb->remote_port) * 16777619U;
+
+    return hash;
+}
+
+
 /**
  * Global tcp_proxy_accept() callback for proxied outgoing TCP
  * connections from guest(s).
@@ -1064,6 +1102,7 @@ pxtcp_pcb_accept_outbound(struct tcp_pcb *newpcb, struct pbuf *p,
     pxtcp->sock = sock;
 
     pxtcp->pmhdl.callback = pxtcp_pmgr_connect;
+    pxtcp->pmhdl.shard = pollmgr_shard_select(pxtcp_flow_hash(newpcb));
     pxtcp->events = POLLOUT;
 
     nsent = pxtcp_chan_send(POLLMGR_CHAN_PXTCP_ADD, pxtcp);
@@ -0,0 +1,481 @@
+/* $Id$ */
+/** @file
+ * NAT Network - poll manager benchmark.
+ *
+ * Echo servers behind the poll manager are driven by loopback clients to
+ * measure connection rate and throughput for a given number of poll manager
+ * workers.  Accepted connections are spread over the workers the same way
+ * pxtcp spreads proxied connections.  Without --workers the benchmark runs
+ * itself once per worker count (1, 2, 4, ...).
+ */
+
+/*
+ * Copyright (C) 2013-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#undef TCP_MSS                  /* lwipopts.h has its own */
+
+#include "winutils.h"
+
+extern "C"
+{
+#include "proxy.h"
+#include "proxy_pollmgr.h"
+}
+
+#include <iprt/asm.h>
+#include <iprt/env.h>
+#include <iprt/err.h>
+#include <iprt/getopt.h>
+#include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/path.h>
+#include <iprt/process.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Server side of an echo connection.
+ */
+typedef struct TSTECHOCONN
+{
+    /** Poll manager handler, must be first. */
+    struct pollmgr_handler  Handler;
+    /** The accepted socket. */
+    SOCKET                  hSocket;
+} TSTECHOCONN;
+typedef TSTECHOCONN *PTSTECHOCONN;
+
+/**
+ * Client thread arguments and results.
+ */
+typedef struct TSTCLIENT
+{
+    /** Number of connections this client drives (throughput phase). */
+    uint32_t                cConns;
+    /** The result: bytes echoed or connections completed. */
+    uint64_t                cResults;
+    /** Failure indicator. */
+    bool                    fFailed;
+} TSTCLIENT;
+typedef TSTCLIENT *PTSTCLIENT;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST               g_hTest;
+/** The listening socket. */
+static SOCKET               g_hListener = INVALID_SOCKET;
+/** The loopback address the listener is bound to. */
+static struct sockaddr_in   g_ListenAddr;
+/** The handler of the listener. */
+static struct pollmgr_handler g_ListenHandler;
+/** The handler of the add channel. */
+static struct pollmgr_handler g_ChanAddHandler;
+/** Size of the blocks echoed in the throughput phase. */
+static uint32_t             g_cbBlock = _16K;
+/** When the current phase ends (RTTimeMilliTS). */
+static uint64_t volatile    g_msDeadline;
+
+
+/**
+ * Echo handler, runs on the worker the connection was assigned to.
+ */
+static int tstEchoPump(struct pollmgr_handler *pHandler, SOCKET hSocket, int fRevents)
+{
+    PTSTECHOCONN pConn = (PTSTECHOCONN)pHandler->data;
+    RT_NOREF(fRevents);
+
+    char abBuf[_16K];
+    ssize_t cbRead = recv(hSocket, abBuf, sizeof(abBuf), 0);
+    if (cbRead > 0)
+    {
+        ssize_t off = 0;
+        while (off < cbRead)
+        {
+            ssize_t cbSent = send(hSocket, &abBuf[off], cbRead - off, 0);
+            if (cbSent <= 0)
+                break;
+            off += cbSent;
+        }
+        if (off == cbRead)
+            return POLLIN;
+    }
+
+    closesocket(hSocket);
+    RTMemFree(pConn);
+    return -1;
+}
+
+
+/**
+ * POLLMGR_CHAN_PXTCP_ADD handler: start polling a connection assigned to
+ * this worker.
+ */
+static int tstChanAdd(struct pollmgr_handler *pHandler, SOCKET hSocket, int fRevents)
+{
+    PTSTECHOCONN pConn = (PTSTECHOCONN)pollmgr_chan_recv_ptr(pHandler, hSocket, fRevents);
+    if (pollmgr_add(&pConn->Handler, pConn->hSocket, POLLIN) < 0)
+    {
+        closesocket(pConn->hSocket);
+        RTMemFree(pConn);
+    }
+    return POLLIN;
+}
+
+
+/**
+ * Listener handler (worker 0): accept and hand the connection to a worker
+ * picked by hashing the peer address.
+ */
+static int tstListen(struct pollmgr_handler *pHandler, SOCKET hSocket, int fRevents)
+{
+    RT_NOREF(pHandler, fRevents);
+
+    struct sockaddr_in Peer;
+    socklen_t cbPeer = sizeof(Peer);
+    SOCKET hConn = accept(hSocket, (struct sockaddr *)&Peer, &cbPeer);
+    if (hConn == INVALID_SOCKET)
+        return POLLIN;
+
+    int fOn = 1;
+    setsockopt(hConn, IPPROTO_TCP, TCP_NODELAY, &fOn, sizeof(fOn));
+
+    PTSTECHOCONN pConn = (PTSTECHOCONN)RTMemAllocZ(sizeof(*pConn));
+    if (!pConn)
+    {
+        closesocket(hConn);
+        return POLLIN;
+    }
+    pConn->Handler.callback = tstEchoPump;
+    pConn->Handler.data     = pConn;
+    pConn->Handler.slot     = -1;
+    pConn->hSocket          = hConn;
+
+    uint32_t uHash = (Peer.sin_addr.s_addr ^ ((uint32_t)Peer.sin_port << 16)) * UINT32_C(2654435761);
+    int iShard = pollmgr_shard_select(uHash >> 8);
+    if (pollmgr_chan_send_to(iShard, POLLMGR_CHAN_PXTCP_ADD, &pConn, sizeof(pConn)) < 0)
+    {
+        closesocket(hConn);
+        RTMemFree(pConn);
+    }
+    return POLLIN;
+}
+
+
+/**
+ * Connects a blocking client socket to the listener.
+ */
+static SOCKET tstConnect(void)
+{
+    SOCKET hSocket = socket(PF_INET, SOCK_STREAM, 0);
+    if (hSocket == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    if (connect(hSocket, (struct sockaddr *)&g_ListenAddr, sizeof(g_ListenAddr)) != 0)
+    {
+        closesocket(hSocket);
+        return INVALID_SOCKET;
+    }
+    int fOn = 1;
+    setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, &fOn, sizeof(fOn));
+    return hSocket;
+}
+
+
+/**
+ * Receives exactly @a cb bytes.
+ */
+static bool tstRecvAll(SOCKET hSocket, uint8_t *pb, size_t cb)
+{
+    while (cb > 0)
+    {
+        ssize_t cbRead = recv(hSocket, (char *)pb, cb, 0);
+        if (cbRead <= 0)
+            return false;
+        pb += cbRead;
+        cb -= cbRead;
+    }
+    return true;
+}
+
+
+/**
+ * Runs the poll manager, which never returns.
+ */
+static DECLCALLBACK(int) tstPollMgrThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    pollmgr_thread(pvUser);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Throughput client: keeps one block in flight on each of its connections.
+ */
+static DECLCALLBACK(int) tstThroughputClient(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PTSTCLIENT pClient = (PTSTCLIENT)pvUser;
+    RT_NOREF(hThreadSelf);
+
+    SOCKET   *pahSockets = (SOCKET *)RTMemAlloc(pClient->cConns * sizeof(SOCKET));
+    uint8_t  *pbBuf      = (uint8_t *)RTMemAllocZ(g_cbBlock);
+    uint32_t  cConns     = 0;
+    if (pahSockets && pbBuf)
+        for (; cConns < pClient->cConns; cConns++)
+        {
+            pahSockets[cConns] = tstConnect();
+            if (pahSockets[cConns] == INVALID_SOCKET)
+                break;
+        }
+    pClient->fFailed = cConns != pClient->cConns;
+
+    while (!pClient->fFailed && RTTimeMilliTS() < g_msDeadline)
+    {
+        for (uint32_t i = 0; i < cConns && !pClient->fFailed; i++)
+            if (send(pahSockets[i], (const char *)pbBuf, g_cbBlock, 0) != (ssize_t)g_cbBlock)
+                pClient->fFailed = true;
+        for (uint32_t i = 0; i < cConns && !pClient->fFailed; i++)
+            if (!tstRecvAll(pahSockets[i], pbBuf, g_cbBlock))
+                pClient->fFailed = true;
+            else
+                pClient->cResults += g_cbBlock;
+    }
+
+    for (uint32_t i = 0; i < cConns; i++)
+        closesocket(pahSockets[i]);
+    RTMemFree(pahSockets);
+    RTMemFree(pbBuf);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Connection rate client: connect, one byte round trip, close.
+ */
+static DECLCALLBACK(int) tstConnectClient(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PTSTCLIENT pClient = (PTSTCLIENT)pvUser;
+    RT_NOREF(hThreadSelf);
+
+    while (RTTimeMilliTS() < g_msDeadline)
+    {
+        SOCKET hSocket = tstConnect();
+        if (hSocket == INVALID_SOCKET)
+        {
+            pClient->fFailed = true;
+            break;
+        }
+        uint8_t b = 0x42;
+        bool fOk = send(hSocket, (const char *)&b, 1, 0) == 1
+                && tstRecvAll(hSocket, &b, 1);
+        closesocket(hSocket);
+        if (!fOk)
+        {
+            pClient->fFailed = true;
+            break;
+        }
+        pClient->cResults++;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Runs one phase with @a cClients client threads.
+ *
+ * @returns The sum of the client results.
+ */
+static uint64_t tstRunClients(PFNRTTHREAD pfnClient, uint32_t cClients, uint32_t cConnsPerClient, uint32_t cSecs)
+{
+    PTSTCLIENT  paClients  = (PTSTCLIENT)RTMemAllocZ(cClients * sizeof(TSTCLIENT));
+    PRTTHREAD   pahThreads = (PRTTHREAD)RTMemAllocZ(cClients * sizeof(RTTHREAD));
+    RTTESTI_CHECK_RET(paClients && pahThreads, 0);
+
+    g_msDeadline = RTTimeMilliTS() + cSecs * RT_MS_1SEC;
+    for (uint32_t i = 0; i < cClients; i++)
+    {
+        paClients[i].cConns = cConnsPerClient;
+        RTTESTI_CHECK_RC(RTThreadCreateF(&pahThreads[i], pfnClient, &paClients[i], 0, RTTHREADTYPE_DEFAULT,
+                                         RTTHREADFLAGS_WAITABLE, "client%u", i), VINF_SUCCESS);
+    }
+
+    uint64_t cTotal = 0;
+    for (uint32_t i = 0; i < cClients; i++)
+    {
+        if (pahThreads[i] != NIL_RTTHREAD)
+            RTThreadWait(pahThreads[i], RT_INDEFINITE_WAIT, NULL);
+        if (paClients[i].fFailed)
+            RTTestFailed(g_hTest, "client #%u failed", i);
+        cTotal += paClients[i].cResults;
+    }
+
+    RTMemFree(pahThreads);
+    RTMemFree(paClients);
+    return cTotal;
+}
+
+
+/**
+ * Runs the benchmark with the poll manager configured for @a cWorkers.
+ */
+static void tstBenchmark(uint32_t cWorkers, uint32_t cClients, uint32_t cConns, uint32_t cSecs)
+{
+    RTTestSubF(g_hTest, "%u worker(s)", cWorkers);
+
+    RTTESTI_CHECK_RETV(pollmgr_init((int)cWorkers) == 0);
+    RTTESTI_CHECK_RETV(pollmgr_shard_count() == (int)cWorkers);
+
+    g_ChanAddHandler.callback = tstChanAdd;
+    g_ChanAddHandler.data     = NULL;
+    g_ChanAddHandler.slot     = -1;
+    pollmgr_add_chan(POLLMGR_CHAN_PXTCP_ADD, &g_ChanAddHandler);
+
+    /*
+     * Listener on an ephemeral loopback port, polled by worker 0.
+     */
+    g_hListener = socket(PF_INET, SOCK_STREAM, 0);
+    RTTESTI_CHECK_RETV(g_hListener != INVALID_SOCKET);
+    RT_ZERO(g_ListenAddr);
+    g_ListenAddr.sin_family      = AF_INET;
+    g_ListenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t cbAddr = sizeof(g_ListenAddr);
+    RTTESTI_CHECK_RETV(bind(g_hListener, (struct sockaddr *)&g_ListenAddr, sizeof(g_ListenAddr)) == 0);
+    RTTESTI_CHECK_RETV(getsockname(g_hListener, (struct sockaddr *)&g_ListenAddr, &cbAddr) == 0);
+    RTTESTI_CHECK_RETV(listen(g_hListener, 1024) == 0);
+
+    g_ListenHandler.callback = tstListen;
+    g_ListenHandler.data     = NULL;
+    g_ListenHandler.slot     = -1;
+    RTTESTI_CHECK_RETV(pollmgr_add(&g_ListenHandler, g_hListener, POLLIN) >= 0);
+
+    /* Worker 0 starts the others; none of them ever returns. */
+    RTTHREAD hThread;
+    RTTESTI_CHECK_RC_RETV(RTThreadCreate(&hThread, tstPollMgrThread, NULL, 0, RTTHREADTYPE_IO, 0, "pollmgr"),
+                          VINF_SUCCESS);
+
+    /*
+     * Connection rate.
+     */
+    uint64_t cConnects = tstRunClients(tstConnectClient, cClients, 0, cSecs);
+    RTTestValue(g_hTest, "Connections", cConnects / cSecs, RTTESTUNIT_CALLS_PER_SEC);
+
+    /*
+     * Throughput.
+     */
+    uint64_t cbEchoed = tstRunClients(tstThroughputClient, cClients, RT_MAX(cConns / cClients, 1), cSecs);
+    RTTestValue(g_hTest, "Throughput", cbEchoed / cSecs / _1K, RTTESTUNIT_KILOBYTES_PER_SEC);
+}
+
+
+/**
+ * Runs this benchmark in a child process for each worker count, as the poll
+ * manager can only be initialized once per process.
+ */
+static void tstSpawnAll(uint32_t cMaxWorkers, uint32_t cClients, uint32_t cConns, uint32_t cSecs)
+{
+    char szExec[RTPATH_MAX];
+    RTTESTI_CHECK_RETV(RTProcGetExecutablePath(szExec, sizeof(szExec)) != NULL);
+
+    for (uint32_t cWorkers = 1; cWorkers <= cMaxWorkers; cWorkers *= 2)
+    {
+        char szWorkers[16], szClients[16], szConns[16], szSecs[16];
+        RTStrPrintf(szWorkers, sizeof(szWorkers), "%u", cWorkers);
+        RTStrPrintf(szClients, sizeof(szClients), "%u", cClients);
+        RTStrPrintf(szConns,   sizeof(szConns),   "%u", cConns);
+        RTStrPrintf(szSecs,    sizeof(szSecs),    "%u", cSecs);
+        const char *apszArgs[] =
+        {
+            szExec, "--workers", szWorkers, "--clients", szClients, "--connections", szConns, "--seconds", szSecs, NULL
+        };
+
+        RTPROCESS hProcess;
+        int rc = RTProcCreate(szExec, apszArgs, RTENV_DEFAULT, 0 /*fFlags*/, &hProcess);
+        if (RT_FAILURE(rc))
+        {
+            RTTestFailed(g_hTest, "RTProcCreate -> %Rrc", rc);
+            return;
+        }
+        RTPROCSTATUS ProcStatus;
+        rc = RTProcWait(hProcess, RTPROCWAIT_FLAGS_BLOCK, &ProcStatus);
+        if (   RT_FAILURE(rc)
+            || ProcStatus.enmReason != RTPROCEXITREASON_NORMAL
+            || ProcStatus.iStatus != 0)
+            RTTestFailed(g_hTest, "%u worker(s): child failed (rc=%Rrc status=%d)", cWorkers, rc, ProcStatus.iStatus);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, 0, "tstNATPollMgr", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--workers",      'w', RTGETOPT_REQ_UINT32 },
+        { "--clients",      'c', RTGETOPT_REQ_UINT32 },
+        { "--connections",  'n', RTGETOPT_REQ_UINT32 },
+        { "--seconds",      's', RTGETOPT_REQ_UINT32 },
+        { "--block-size",   'b', RTGETOPT_REQ_UINT32 },
+    };
+
+    uint32_t cWorkers = 0;
+    uint32_t cClients = 8;
+    uint32_t cConns   = 64;
+    uint32_t cSecs    = 3;
+
+    int ch;
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /*fFlags*/);
+    while ((ch = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (ch)
+        {
+            case 'w': cWorkers = RT_MIN(RT_MAX(ValueUnion.u32, 1), POLLMGR_MAX_WORKERS); break;
+            case 'c': cClients = RT_MAX(ValueUnion.u32, 1); break;
+            case 'n': cConns   = RT_MAX(ValueUnion.u32, 1); break;
+            case 's': cSecs    = RT_MAX(ValueUnion.u32, 1); break;
+            case 'b': g_cbBlock = RT_MIN(RT_MAX(ValueUnion.u32, 1), _16K); break;
+            default:
+                return RTGetOptPrintError(ch, &ValueUnion);
+        }
+    }
+
+    if (cWorkers)
+        tstBenchmark(cWorkers, cClients, cConns, cSecs);
+    else
+        tstSpawnAll(RT_MIN(RTMpGetOnlineCount(), POLLMGR_MAX_WORKERS), cClients, cConns, cSecs);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
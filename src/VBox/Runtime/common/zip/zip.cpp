@@ -1819,6 +1819,57 @@ RTDECL(int) RTZipBlockCompress(RTZIPTYPE enmType, RTZIPLEVEL enmLevel, uint32_t
         }
 
         case RTZIPTYPE_ZLIB:
+        {
+#ifdef RTZIP_USE_ZLIB
+            AssertReturn(cbSrc == (uInt)cbSrc, VERR_TOO_MUCH_DATA);
+            AssertReturn(cbDst == (uInt)cbDst, VERR_OUT_OF_RANGE);
+
+            int iLevel = Z_DEFAULT_COMPRESSION;
+            switch (enmLevel)
+            {
+                case RTZIPLEVEL_STORE:      iLevel = 0; break;
+                case RTZIPLEVEL_FAST:       iLevel = 1; break;
+                case RTZIPLEVEL_DEFAULT:    iLevel = Z_DEFAULT_COMPRESSION; break;
+                case RTZIPLEVEL_MAX:        iLevel = 9; break;
+            }
+
+            /* Block compression is typically done on small inputs (pages), so
+               size the window and hash table after the input instead of paying
+               for initializing the full default sized ones on each call. */
+            int cWindowBits = 9;
+            while (cWindowBits < MAX_WBITS && ((size_t)1 << cWindowBits) < cbSrc)
+                cWindowBits++;
+            int const iMemLevel = RT_MIN(RT_MAX(cWindowBits - 7, 1), MAX_MEM_LEVEL);
+
+            z_stream ZStrm;
+            RT_ZERO(ZStrm);
+            ZStrm.next_in   = (Bytef *)pvSrc;
+            ZStrm.avail_in  = (uInt)cbSrc;
+            ZStrm.next_out  = (Bytef *)pvDst;
+            ZStrm.avail_out = (uInt)cbDst;
+
+            int rc = deflateInit2(&ZStrm, iLevel, Z_DEFLATED, cWindowBits, iMemLevel, Z_DEFAULT_STRATEGY);
+            if (RT_UNLIKELY(rc != Z_OK))
+                return zipErrConvertFromZlib(rc, true /*fCompressing*/);
+            rc = deflate(&ZStrm, Z_FINISH);
+            if (rc != Z_STREAM_END)
+            {
+                deflateEnd(&ZStrm);
+                if (rc == Z_OK || rc == Z_BUF_ERROR)
+                    return VERR_BUFFER_OVERFLOW;
+                return zipErrConvertFromZlib(rc, true /*fCompressing*/);
+            }
+            rc = deflateEnd(&ZStrm);
+            if (rc != Z_OK)
+                return zipErrConvertFromZlib(rc, true /*fCompressing*/);
+
+            *pcbDstActual = ZStrm.total_out;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
 
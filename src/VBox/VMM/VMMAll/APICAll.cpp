@@ -29,6 +29,14 @@
 #include <VBox/vmm/vmcpuset.h>
 
 
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+static bool     apicPostInterruptEx(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGERMODE enmTriggerMode, uint32_t uSrcTag,
+                                    PVMCPUSET pNotifySet);
+static uint32_t apicNotifyCpuSet(PVM pVM, PCVMCPUSET pNotifySet);
+
+
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
 *********************************************************************************************************************************/
@@ -1070,6 +1078,104 @@ static VBOXSTRICTRC apicSetIcrLo(PVMCPU pVCpu, uint32_t uIcrLo, int rcRZ, bool f
 }
 
 
+/**
+ * Sends a fixed, edge-triggered IPI written via the x2APIC ICR without going
+ * through apicSendIpi().
+ *
+ * Guests doing TLB shootdowns or function-call IPIs send these in bulk. The
+ * destination is resolved using the x2APIC destination map instead of
+ * querying each APIC, the vector is posted to all targets and the EMTs that
+ * need waking up or poking are notified in one batch afterwards.
+ *
+ * @returns true if the IPI was sent, false if the caller must use the generic
+ *          path (nothing was changed in that case).
+ * @param   pVCpu           The cross context virtual CPU structure.
+ *
+ * @remarks The ICR must have been written to the x2APIC page already.
+ */
+static bool apicSendIpiFast(PVMCPU pVCpu)
+{
+    VMCPU_ASSERT_EMT(pVCpu);
+    Assert(XAPIC_IN_X2APIC_MODE(pVCpu));
+
+    PCX2APICPAGE pX2ApicPage = VMCPU_TO_CX2APICPAGE(pVCpu);
+    PCXAPICPAGE  pXApicPage  = VMCPU_TO_CXAPICPAGE(pVCpu);
+    uint8_t const uVector    = pXApicPage->icr_lo.u.u8Vector;
+    if (   (XAPICDELIVERYMODE)pXApicPage->icr_lo.u.u3DeliveryMode != XAPICDELIVERYMODE_FIXED
+        || (XAPICTRIGGERMODE)pXApicPage->icr_lo.u.u1TriggerMode  != XAPICTRIGGERMODE_EDGE
+        || uVector <= XAPIC_ILLEGAL_VECTOR_END)
+        return false;
+
+    /*
+     * Resolve the destination, see apicSendIpi() and apicGetDestCpuSet().
+     * The x2APIC ID of each VCPU is its VCPU ID and read-only.
+     */
+    PVM            pVM       = pVCpu->CTX_SUFF(pVM);
+    VMCPUID const  cCpus     = pVM->cCpus;
+    uint64_t const fAllCpus  = cCpus < 64 ? RT_BIT_64(cCpus) - 1 : UINT64_MAX;
+    uint64_t const fSelf     = RT_BIT_64(pVCpu->idCpu);
+    uint32_t const fDest     = pX2ApicPage->icr_hi.u32IcrHi;
+    uint64_t       fTargets;
+    switch ((XAPICDESTSHORTHAND)pXApicPage->icr_lo.u.u2DestShorthand)
+    {
+        case XAPICDESTSHORTHAND_NONE:
+        {
+            if (fDest == X2APIC_ID_BROADCAST_MASK)
+                fTargets = fAllCpus;
+            else if ((XAPICDESTMODE)pXApicPage->icr_lo.u.u1DestMode == XAPICDESTMODE_PHYSICAL)
+                fTargets = fDest < cCpus ? RT_BIT_64(fDest) : 0;
+            else
+            {
+                /* Any APIC missing from the map could still match by its LDR, leave that to apicIsLogicalDest(). */
+                uint64_t const fDestMap = ASMAtomicReadU64(&VM_TO_APIC(pVM)->u64X2ApicDestMap);
+                if (fDestMap != fAllCpus)
+                    return false;
+
+                /* The cluster ID selects 16 consecutive VCPUs, the low word is a bitmap of them. */
+                uint32_t const idCluster = X2APIC_LDR_GET_CLUSTER_ID(fDest) >> 16;
+                if (idCluster < 64 / 16)
+                    fTargets = ((uint64_t)(fDest & X2APIC_LDR_LOGICAL_ID) << (idCluster * 16)) & fDestMap;
+                else
+                    fTargets = 0;
+            }
+            break;
+        }
+        case XAPICDESTSHORTHAND_SELF:           fTargets = fSelf;               break;
+        case XAPIDDESTSHORTHAND_ALL_INCL_SELF:  fTargets = fAllCpus;            break;
+        case XAPICDESTSHORTHAND_ALL_EXCL_SELF:  fTargets = fAllCpus & ~fSelf;   break;
+        default:                                return false;
+    }
+
+    /*
+     * Post the interrupt to all targets and notify their EMTs in one go.
+     */
+    VMCPUSET NotifySet;
+    VMCPUSET_EMPTY(&NotifySet);
+    uint32_t cIpis = 0;
+    while (fTargets)
+    {
+        VMCPUID const idCpu = ASMBitFirstSetU64(fTargets) - 1;
+        fTargets &= ~RT_BIT_64(idCpu);
+
+        PVMCPU pVCpuDst = &pVM->aCpus[idCpu];
+        if (APICIsEnabled(pVCpuDst))
+        {
+            apicPostInterruptEx(pVCpuDst, uVector, XAPICTRIGGERMODE_EDGE, 0 /* uSrcTag */, &NotifySet);
+            cIpis++;
+        }
+    }
+    uint32_t const cNotified = apicNotifyCpuSet(pVM, &NotifySet);
+
+    Log2(("APIC%u: apicSendIpiFast: uVector=%#x fDest=%#RX32 cIpis=%u cNotified=%u\n", pVCpu->idCpu, uVector, fDest, cIpis,
+          cNotified));
+    STAM_COUNTER_INC(&pVCpu->apic.s.StatIcrFastPath);
+    STAM_COUNTER_ADD(&pVCpu->apic.s.StatIcrFastPathIpis, cIpis);
+    STAM_COUNTER_ADD(&pVCpu->apic.s.StatIcrFastPathNotify, cNotified);
+    RT_NOREF2(cIpis, cNotified);
+    return true;
+}
+
+
 /**
  * Sets the Interrupt Command Register (ICR).
  *
@@ -1096,6 +1202,15 @@ static VBOXSTRICTRC apicSetIcr(PVMCPU pVCpu, uint64_t u64Icr, int rcRZ)
         PX2APICPAGE pX2ApicPage = VMCPU_TO_X2APICPAGE(pVCpu);
         pX2ApicPage->icr_hi.u32IcrHi = RT_HI_U32(u64Icr);
         STAM_COUNTER_INC(&pVCpu->apic.s.StatIcrFullWrite);
+
+        /* Fixed IPIs in x2APIC mode skip the generic delivery logic, see apicSendIpiFast(). */
+        if (XAPIC_IN_X2APIC_MODE(pVCpu))
+        {
+            PXAPICPAGE pXApicPage = VMCPU_TO_XAPICPAGE(pVCpu);
+            pXApicPage->icr_lo.all.u32IcrLo = uLo;
+            if (apicSendIpiFast(pVCpu))
+                return VINF_SUCCESS;
+        }
         return apicSetIcrLo(pVCpu, uLo, rcRZ, false /* fUpdateStat */);
     }
     return apicMsrAccessError(pVCpu, MSR_IA32_X2APIC_ICR, APICMSRACCESS_WRITE_RSVD_BITS);
@@ -1318,6 +1433,7 @@ static VBOXSTRICTRC apicSetLdr(PVMCPU pVCpu, uint32_t uLdr)
 
     PXAPICPAGE pXApicPage = VMCPU_TO_XAPICPAGE(pVCpu);
     apicWriteRaw32(pXApicPage, XAPIC_OFF_LDR, uLdr & XAPIC_LDR_VALID);
+    apicUpdateX2ApicDestMap(pVCpu);
     return VINF_SUCCESS;
 }
 
@@ -2273,6 +2389,9 @@ void apicInitIpi(PVMCPU pVCpu)
     /* Clear the interrupt line states for LINT0 and LINT1 pins. */
     pApicCpu->fActiveLint0 = false;
     pApicCpu->fActiveLint1 = false;
+
+    /* The LDR was cleared above. */
+    apicUpdateX2ApicDestMap(pVCpu);
 }
 
 
@@ -2327,6 +2446,32 @@ void apicResetCpu(PVMCPU pVCpu, bool fResetApicBaseMsr)
      */
     ASMMemZero32(&pXApicPage->id, sizeof(pXApicPage->id));
     pXApicPage->id.u8ApicId = pVCpu->idCpu;
+
+    apicUpdateX2ApicDestMap(pVCpu);
+}
+
+
+/**
+ * Updates the bit of the given VCPU in the x2APIC destination map.
+ *
+ * The ICR fast path must resolve a logical destination to exactly the set of
+ * APICs apicIsLogicalDest() would match, so an APIC is only part of the map
+ * while it is in x2APIC mode and its LDR is the one derived from its x2APIC ID
+ * (the LDR is software writable in Hyper-V compatibility mode and is cleared
+ * by an INIT).
+ *
+ * @param   pVCpu       The cross context virtual CPU structure.
+ */
+void apicUpdateX2ApicDestMap(PVMCPU pVCpu)
+{
+    AssertCompile(VMM_MAX_CPU_COUNT <= 64);
+    PAPIC          pApic = VM_TO_APIC(pVCpu->CTX_SUFF(pVM));
+    uint64_t const fCpu  = RT_BIT_64(pVCpu->idCpu);
+    if (   XAPIC_IN_X2APIC_MODE(pVCpu)
+        && VMCPU_TO_CX2APICPAGE(pVCpu)->ldr.u32LogicalApicId == X2APIC_LDR_FROM_ID(pVCpu->idCpu))
+        ASMAtomicOrU64(&pApic->u64X2ApicDestMap, fCpu);
+    else
+        ASMAtomicAndU64(&pApic->u64X2ApicDestMap, ~fCpu);
 }
 
 
@@ -2449,8 +2594,7 @@ VMM_INT_DECL(int) APICSetBaseMsr(PVMCPU pVCpu, uint64_t u64BaseMsr)
                  * LDR initialization occurs when entering x2APIC mode.
                  * See Intel spec. 10.12.10.2 "Deriving Logical x2APIC ID from the Local x2APIC ID".
                  */
-                pX2ApicPage->ldr.u32LogicalApicId = ((pX2ApicPage->id.u32ApicId & UINT32_C(0xffff0)) << 16)
-                                                  | (UINT32_C(1) << pX2ApicPage->id.u32ApicId & UINT32_C(0xf));
+                pX2ApicPage->ldr.u32LogicalApicId = X2APIC_LDR_FROM_ID(pX2ApicPage->id.u32ApicId);
 
                 LogRel(("APIC%u: Switched mode to x2APIC\n", pVCpu->idCpu));
                 break;
@@ -2466,6 +2610,7 @@ VMM_INT_DECL(int) APICSetBaseMsr(PVMCPU pVCpu, uint64_t u64BaseMsr)
     }
 
     ASMAtomicWriteU64(&pApicCpu->uApicBaseMsr, uBaseMsr);
+    apicUpdateX2ApicDestMap(pVCpu);
     return VINF_SUCCESS;
 }
 
@@ -3044,22 +3189,92 @@ VMM_INT_DECL(void) apicClearInterruptFF(PVMCPU pVCpu, PDMAPICIRQ enmType)
 
 
 /**
- * Posts an interrupt to a target APIC.
+ * Flags an update of pending interrupts on the target VCPU, either right away
+ * or by adding it to the set of VCPUs to notify in one go later.
  *
- * This function handles interrupts received from the system bus or
- * interrupts generated locally from the LVT or via a self IPI.
+ * @param   pVCpu           The cross context virtual CPU structure.
+ * @param   pNotifySet      The set of VCPUs to notify by apicNotifyCpuSet(),
+ *                          NULL to notify the target immediately.
+ */
+DECLINLINE(void) apicSetUpdatePendingFF(PVMCPU pVCpu, PVMCPUSET pNotifySet)
+{
+    if (!pNotifySet)
+        apicSetInterruptFF(pVCpu, PDMAPICIRQ_UPDATE_PENDING);
+    else
+    {
+        VMCPU_FF_SET(pVCpu, VMCPU_FF_UPDATE_APIC);
+        VMCPUSET_ADD(pNotifySet, pVCpu->idCpu);
+    }
+}
+
+
+/**
+ * Wakes up or pokes the EMTs of a set of VCPUs that have had interrupts posted
+ * to them, the batched counterpart of the notification done by
+ * apicSetInterruptFF().
  *
- * Don't use this function to try and deliver ExtINT style interrupts.
+ * @returns Number of VCPUs in the set (excluding the caller).
+ * @param   pVM             The cross context VM structure.
+ * @param   pNotifySet      The set of VCPUs to notify.
+ */
+static uint32_t apicNotifyCpuSet(PVM pVM, PCVMCPUSET pNotifySet)
+{
+    VMCPUID const idCpuSelf = VMMGetCpuId(pVM);
+    VMCPUID const cCpus     = pVM->cCpus;
+    uint32_t      cNotified = 0;
+#if defined(IN_RING0)
+    VMCPUSET SleepSet;
+    VMCPUSET PokeSet;
+    VMCPUSET_EMPTY(&SleepSet);
+    VMCPUSET_EMPTY(&PokeSet);
+    for (VMCPUID idCpu = 0; idCpu < cCpus; idCpu++)
+        if (   VMCPUSET_IS_PRESENT(pNotifySet, idCpu)
+            && idCpu != idCpuSelf)
+        {
+            switch (VMCPU_GET_STATE(&pVM->aCpus[idCpu]))
+            {
+                case VMCPUSTATE_STARTED_EXEC:       VMCPUSET_ADD(&PokeSet, idCpu);  cNotified++; break;
+                case VMCPUSTATE_STARTED_HALTED:     VMCPUSET_ADD(&SleepSet, idCpu); cNotified++; break;
+                default:                            break; /* nothing to do in other states. */
+            }
+        }
+    if (cNotified)
+        GVMMR0SchedWakeUpAndPokeCpusNoGVMNoLock(pVM, &SleepSet, &PokeSet);
+#elif defined(IN_RING3)
+    for (VMCPUID idCpu = 0; idCpu < cCpus; idCpu++)
+        if (   VMCPUSET_IS_PRESENT(pNotifySet, idCpu)
+            && idCpu != idCpuSelf)
+        {
+            PVMCPU pVCpuDst = &pVM->aCpus[idCpu];
+# ifdef VBOX_WITH_REM
+            REMR3NotifyInterruptSet(pVM, pVCpuDst);
+# endif
+            VMR3NotifyCpuFFU(pVCpuDst->pUVCpu, VMNOTIFYFF_FLAGS_DONE_REM | VMNOTIFYFF_FLAGS_POKE);
+            cNotified++;
+        }
+#else
+    RT_NOREF4(pNotifySet, idCpuSelf, cCpus, pVM);
+#endif
+    return cNotified;
+}
+
+
+/**
+ * Posts an interrupt to a target APIC, worker for apicPostInterrupt() and the
+ * x2APIC ICR fast path.
  *
  * @returns true if the interrupt was accepted, false otherwise.
  * @param   pVCpu               The cross context virtual CPU structure.
  * @param   uVector             The vector of the interrupt to be posted.
  * @param   enmTriggerMode      The trigger mode of the interrupt.
  * @param   uSrcTag             The interrupt source tag (debugging).
+ * @param   pNotifySet          Where to add the target if its EMT needs
+ *                              notifying, NULL to notify it immediately.
  *
  * @thread  Any.
  */
-VMM_INT_DECL(bool) apicPostInterrupt(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGERMODE enmTriggerMode, uint32_t uSrcTag)
+static bool apicPostInterruptEx(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGERMODE enmTriggerMode, uint32_t uSrcTag,
+                                PVMCPUSET pNotifySet)
 {
     Assert(pVCpu);
     Assert(uVector > XAPIC_ILLEGAL_VECTOR_END);
@@ -3102,7 +3317,7 @@ VMM_INT_DECL(bool) apicPostInterrupt(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGER
                     if (!fAlreadySet)
                     {
                         Log2(("APIC: apicPostInterrupt: Setting UPDATE_APIC FF for edge-triggered intr. uVector=%#x\n", uVector));
-                        apicSetInterruptFF(pVCpu, PDMAPICIRQ_UPDATE_PENDING);
+                        apicSetUpdatePendingFF(pVCpu, pNotifySet);
                     }
                 }
             }
@@ -3117,7 +3332,7 @@ VMM_INT_DECL(bool) apicPostInterrupt(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGER
                 if (!fAlreadySet)
                 {
                     Log2(("APIC: apicPostInterrupt: Setting UPDATE_APIC FF for level-triggered intr. uVector=%#x\n", uVector));
-                    apicSetInterruptFF(pVCpu, PDMAPICIRQ_UPDATE_PENDING);
+                    apicSetUpdatePendingFF(pVCpu, pNotifySet);
                 }
             }
         }
@@ -3139,6 +3354,28 @@ VMM_INT_DECL(bool) apicPostInterrupt(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGER
 }
 
 
+/**
+ * Posts an interrupt to a target APIC.
+ *
+ * This function handles interrupts received from the system bus or
+ * interrupts generated locally from the LVT or via a self IPI.
+ *
+ * Don't use this function to try and deliver ExtINT style interrupts.
+ *
+ * @returns true if the interrupt was accepted, false otherwise.
+ * @param   pVCpu               The cross context virtual CPU structure.
+ * @param   uVector             The vector of the interrupt to be posted.
+ * @param   enmTriggerMode      The trigger mode of the interrupt.
+ * @param   uSrcTag             The interrupt source tag (debugging).
+ *
+ * @thread  Any.
+ */
+VMM_INT_DECL(bool) apicPostInterrupt(PVMCPU pVCpu, uint8_t uVector, XAPICTRIGGERMODE enmTriggerMode, uint32_t uSrcTag)
+{
+    return apicPostInterruptEx(pVCpu, uVector, enmTriggerMode, uSrcTag, NULL /* pNotifySet */);
+}
+
+
 /**
  * Starts the APIC timer.
  *
@@ -26,6 +26,7 @@
 #include <VBox/err.h>
 #include <iprt/assert.h>
 #include <iprt/asm.h>
+#include <iprt/asm-amd64-x86.h>
 #include <iprt/stdarg.h>
 
 
@@ -408,3 +409,53 @@ VMM_INT_DECL(VBOXSTRICTRC) DBGFEventGenericWithArgs(PVM pVM, PVMCPU pVCpu, DBGFE
     return VINF_SUCCESS;
 }
 
+
+
+/**
+ * Records an event in the binary event trace ring of the calling VCPU.
+ *
+ * Callers check DBGFTRACEEVT_IS_ENABLED (or use DBGFTRACEEVT_START) first, so
+ * this is only called when the event category is enabled.
+ *
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   enmType     The event type.
+ * @param   uTscStart   The host TSC when the event started (see
+ *                      DBGFTRACEEVT_START), 0 for instant events.
+ * @param   bArg        Type specific byte argument.
+ * @param   u16Arg      Type specific 16-bit argument.
+ * @param   u64Arg0     Type specific 64-bit argument.
+ * @param   u64Arg1     Type specific 64-bit argument.
+ */
+VMM_INT_DECL(void) DBGFTraceEvtAdd(PVMCPU pVCpu, DBGFTRACEEVTTYPE enmType, uint64_t uTscStart,
+                                   uint8_t bArg, uint16_t u16Arg, uint64_t u64Arg0, uint64_t u64Arg1)
+{
+#ifndef IN_RC
+    PDBGFTRACEEVTRING pRing = pVCpu->CTX_SUFF(pTraceEvtRing);
+    if (pRing)
+    {
+        VMCPU_ASSERT_EMT(pVCpu);
+        uint64_t const   uTscNow = ASMReadTSC();
+        uint64_t const   iNext   = pRing->iNext;
+        PDBGFTRACEEVTREC pRec    = &pRing->aRecs[iNext & pRing->fMask];
+        if (uTscStart)
+        {
+            uint64_t const cTicks = uTscNow - uTscStart;
+            pRec->uTsc   = uTscStart;
+            pRec->cTicks = cTicks <= UINT32_MAX ? (uint32_t)cTicks : UINT32_MAX;
+        }
+        else
+        {
+            pRec->uTsc   = uTscNow;
+            pRec->cTicks = 0;
+        }
+        pRec->enmType = (uint8_t)enmType;
+        pRec->bArg    = bArg;
+        pRec->u16Arg  = u16Arg;
+        pRec->u64Arg0 = u64Arg0;
+        pRec->u64Arg1 = u64Arg1;
+        ASMAtomicWriteU64(&pRing->iNext, iNext + 1);
+    }
+#else
+    RT_NOREF7(pVCpu, enmType, uTscStart, bArg, u16Arg, u64Arg0, u64Arg1);
+#endif
+}
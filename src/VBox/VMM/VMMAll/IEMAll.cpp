@@ -1156,6 +1156,7 @@ DECLINLINE(void) iemInitDecoder(PVMCPU pVCpu, bool fBypassHandlers)
     pVCpu->iem.s.iNextMapping       = 0;
     pVCpu->iem.s.rcPassUp           = VINF_SUCCESS;
     pVCpu->iem.s.fBypassHandlers    = fBypassHandlers;
+    pVCpu->iem.s.uOpcodeCacheRev++; /* Paging may have changed since we last executed anything. */
 #ifdef VBOX_WITH_RAW_MODE_NOT_R0
     pVCpu->iem.s.fInPatchCode       = pVCpu->iem.s.uCpl == 0
                                && pVCpu->cpum.GstCtx.cs.u64Base == 0
@@ -1298,6 +1299,59 @@ DECLINLINE(void) iemReInitDecoder(PVMCPU pVCpu)
 
 
 
+#if defined(IN_RING3) && !defined(IEM_WITH_CODE_TLB)
+/**
+ * Tries to fetch opcode bytes from the opcode page cache.
+ *
+ * @returns true if the bytes were fetched, false if the caller must fetch
+ *          them the normal way (which also takes care of raising exceptions).
+ * @param   pVCpu       The cross context virtual CPU structure of the
+ *                      calling thread.
+ * @param   GCPtr       The linear address of the first byte.
+ * @param   pbDst       Where to store the bytes.
+ * @param   cbToRead    The number of bytes to fetch.  Must not cross a page
+ *                      boundrary.
+ */
+DECLINLINE(bool) iemOpcodeCacheTryRead(PVMCPU pVCpu, RTGCPTR GCPtr, uint8_t *pbDst, uint32_t cbToRead)
+{
+    PIEMOPCODECACHE pCache = pVCpu->iem.s.pOpcodeCacheR3;
+    if (pCache && !pVCpu->iem.s.fBypassHandlers)
+    { /* likely */ }
+    else
+        return false;
+    Assert(cbToRead > 0 && (GCPtr & PAGE_OFFSET_MASK) + cbToRead <= PAGE_SIZE);
+
+    PIEMOPCODECACHEHINT pHint     = &pCache->aHints[pVCpu->idCpu];
+    RTGCPTR const       GCPtrPage = GCPtr & ~(RTGCPTR)PAGE_OFFSET_MASK;
+    if (   pHint->GCPtrPage == GCPtrPage
+        && pHint->uRev      == pVCpu->iem.s.uOpcodeCacheRev)
+        STAM_COUNTER_INC(&pHint->StatHintHits);
+    else if (!iemR3OpcodeCacheLookup(pVCpu, pCache, pHint, GCPtrPage))
+        return false;
+    PIEMOPCODECACHEPAGE pPage = pHint->pPage;
+    if (!pPage)
+        return false;
+
+    /* Let the normal path deal with access violations. */
+    if (   (pHint->fUser    || pVCpu->iem.s.uCpl != 3)
+        && (!pHint->fNoExec || !(pVCpu->cpum.GstCtx.msrEFER & MSR_K6_EFER_NXE)))
+    { /* likely */ }
+    else
+        return false;
+
+    memcpy(pbDst, &pPage->abPage[GCPtr & PAGE_OFFSET_MASK], cbToRead);
+    ASMReadFence();
+    if (ASMAtomicUoReadU32(&pPage->uSeq) == pHint->uSeq)
+        return true;
+
+    /* Written to while we were copying or since the lookup; take the slow
+       path and let the next lookup refill the page. */
+    pHint->GCPtrPage = NIL_RTGCPTR;
+    return false;
+}
+#endif /* IN_RING3 && !IEM_WITH_CODE_TLB */
+
+
 /**
  * Prefetch opcodes the first time when starting executing.
  *
@@ -1362,6 +1416,19 @@ IEM_STATIC VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PVMCPU pVCpu, bool fByp
     }
 # endif /* VBOX_WITH_RAW_MODE_NOT_R0 */
 
+# ifdef IN_RING3
+    /*
+     * Try the opcode page cache first.
+     */
+    uint32_t const cbFromCache = RT_MIN(RT_MIN(cbToTryRead, PAGE_SIZE - (uint32_t)(GCPtrPC & PAGE_OFFSET_MASK)),
+                                        sizeof(pVCpu->iem.s.abOpcode));
+    if (iemOpcodeCacheTryRead(pVCpu, GCPtrPC, pVCpu->iem.s.abOpcode, cbFromCache))
+    {
+        pVCpu->iem.s.cbOpcode = (uint8_t)cbFromCache;
+        return VINF_SUCCESS;
+    }
+# endif
+
     RTGCPHYS    GCPhys;
     uint64_t    fFlags;
     int rc = PGMGstGetPage(pVCpu, GCPtrPC, &fFlags, &GCPhys);
@@ -1461,6 +1528,8 @@ IEM_STATIC VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PVMCPU pVCpu, bool fByp
  */
 VMM_INT_DECL(void) IEMTlbInvalidateAll(PVMCPU pVCpu, bool fVmm)
 {
+    pVCpu->iem.s.uOpcodeCacheRev++;
+
 #ifdef IEM_WITH_CODE_TLB
     pVCpu->iem.s.cbInstrBufTotal = 0;
     pVCpu->iem.s.CodeTlb.uTlbRevision += IEMTLB_REVISION_INCR;
@@ -1500,6 +1569,8 @@ VMM_INT_DECL(void) IEMTlbInvalidateAll(PVMCPU pVCpu, bool fVmm)
  */
 VMM_INT_DECL(void) IEMTlbInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtr)
 {
+    pVCpu->iem.s.uOpcodeCacheRev++;
+
 #if defined(IEM_WITH_CODE_TLB) || defined(IEM_WITH_DATA_TLB)
     GCPtr = GCPtr >> X86_PAGE_SHIFT;
     AssertCompile(RT_ELEMENTS(pVCpu->iem.s.CodeTlb.aEntries) == 256);
@@ -1535,6 +1606,8 @@ VMM_INT_DECL(void) IEMTlbInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtr)
  */
 VMM_INT_DECL(void) IEMTlbInvalidateAllPhysical(PVMCPU pVCpu)
 {
+    pVCpu->iem.s.uOpcodeCacheRev++;
+
 #if defined(IEM_WITH_CODE_TLB) || defined(IEM_WITH_DATA_TLB)
     /* Note! This probably won't end up looking exactly like this, but it give an idea... */
 
@@ -1579,15 +1652,22 @@ VMM_INT_DECL(void) IEMTlbInvalidateAllPhysical(PVMCPU pVCpu)
 /**
  * Invalidates the host physical aspects of the IEM TLBs.
  *
- * This is called internally as well as by PGM when moving GC mappings.
+ * This is called internally as well as by PGM when moving GC mappings, and
+ * by PGM when guest RAM is modified without going thru the access handlers
+ * (reset, state loading, simple writes), in which case the opcode page cache
+ * must be flushed.
  *
  * @param   pVM         The cross context VM structure.
  *
- * @remarks Caller holds the PGM lock.
+ * @remarks Caller may or may not hold the PGM lock.
  */
 VMM_INT_DECL(void) IEMTlbInvalidateAllPhysicalAllCpus(PVM pVM)
 {
+#ifdef IN_RING3
+    iemR3OpcodeCacheFlush(pVM);
+#else
     RT_NOREF_PV(pVM);
+#endif
 }
 
 #ifdef IEM_WITH_CODE_TLB
@@ -1955,6 +2035,14 @@ IEM_STATIC VBOXSTRICTRC iemOpcodeFetchMoreBytes(PVMCPU pVCpu, size_t cbMin)
     }
 # endif /* VBOX_WITH_RAW_MODE_NOT_R0 */
 
+# ifdef IN_RING3
+    if (iemOpcodeCacheTryRead(pVCpu, GCPtrNext, &pVCpu->iem.s.abOpcode[pVCpu->iem.s.cbOpcode], cbToTryRead))
+    {
+        pVCpu->iem.s.cbOpcode += cbToTryRead;
+        return VINF_SUCCESS;
+    }
+# endif
+
     RTGCPHYS    GCPhys;
     uint64_t    fFlags;
     int rc = PGMGstGetPage(pVCpu, GCPtrNext, &fFlags, &GCPhys);
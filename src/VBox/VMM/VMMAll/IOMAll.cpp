@@ -31,6 +31,7 @@
 #include <VBox/vmm/pdmdev.h>
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/cpum.h>
+#include <VBox/vmm/dbgftrace.h>
 #include <VBox/err.h>
 #include <VBox/log.h>
 #include <iprt/assert.h>
@@ -57,6 +58,75 @@ VMMDECL(bool) IOMIsLockWriteOwner(PVM pVM)
 //#undef LOG_GROUP
 //#define LOG_GROUP LOG_GROUP_IOM_IOPORT
 
+/**
+ * Calls the I/O port read handler of a device, IOMIOPortRead worker.
+ *
+ * @returns Strict VBox status code, see IOMIOPortRead.
+ * @param   pVCpu           The cross context virtual CPU structure of the calling EMT.
+ * @param   pStats          The statistics record for the port, NULL if none.
+ * @param   pfnInCallback   The device callback.
+ * @param   pDevIns         The device instance.
+ * @param   pvUser          The user argument for the callback.
+ * @param   Port            The port to read.
+ * @param   pu32Value       Where to store the value read.
+ * @param   cbValue         The size of the register to read in bytes.
+ */
+DECLINLINE(VBOXSTRICTRC) iomIOPortReadCallDevice(PVMCPU pVCpu, PIOMIOPORTSTATS pStats, PFNIOMIOPORTIN pfnInCallback,
+                                                 PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t *pu32Value,
+                                                 size_t cbValue)
+{
+    RT_NOREF_PV(pStats);
+    uint64_t const uTscTrace = DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_IOPORT);
+    VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_READ);
+    if (rcStrict == VINF_SUCCESS)
+    { /* likely */ }
+    else
+    {
+        STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->InRZToR3); });
+        return rcStrict;
+    }
+#ifdef VBOX_WITH_STATISTICS
+    if (pStats)
+    {
+        STAM_PROFILE_START(&pStats->CTX_SUFF_Z(ProfIn), a);
+        rcStrict = pfnInCallback(pDevIns, pvUser, Port, pu32Value, (unsigned)cbValue);
+        STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfIn), a);
+    }
+    else
+#endif
+        rcStrict = pfnInCallback(pDevIns, pvUser, Port, pu32Value, (unsigned)cbValue);
+    PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+
+#ifdef VBOX_WITH_STATISTICS
+    if (rcStrict == VINF_SUCCESS && pStats)
+        STAM_COUNTER_INC(&pStats->CTX_SUFF_Z(In));
+# ifndef IN_RING3
+    else if (rcStrict == VINF_IOM_R3_IOPORT_READ && pStats)
+        STAM_COUNTER_INC(&pStats->InRZToR3);
+# endif
+#endif
+    if (rcStrict == VERR_IOM_IOPORT_UNUSED)
+    {
+        /* make return value */
+        rcStrict = VINF_SUCCESS;
+        switch (cbValue)
+        {
+            case 1: *(uint8_t  *)pu32Value = 0xff; break;
+            case 2: *(uint16_t *)pu32Value = 0xffff; break;
+            case 4: *(uint32_t *)pu32Value = UINT32_C(0xffffffff); break;
+            default:
+                AssertMsgFailed(("Invalid I/O port size %d. Port=%d\n", cbValue, Port));
+                return VERR_IOM_INVALID_IOPORT_SIZE;
+        }
+    }
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_IOPORT_READ, uTscTrace, (uint8_t)cbValue, Port, *pu32Value,
+                        (int64_t)VBOXSTRICTRC_VAL(rcStrict));
+    Log3(("IOMIOPortRead: Port=%RTiop *pu32=%08RX32 cb=%d rc=%Rrc\n", Port, *pu32Value, cbValue, VBOXSTRICTRC_VAL(rcStrict)));
+    return rcStrict;
+}
+
+
 /**
  * Reads an I/O port register.
  *
@@ -77,6 +147,33 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
 {
     Assert(pVCpu->iom.s.PendingIOPortWrite.cbValue == 0);
 
+    /*
+     * Lock-free fast path: the range is in this context's range cache and the
+     * range table hasn't changed while we were copying out what we need.
+     */
+    uint32_t                  uGen;
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = iomIOPortGetRangeLockFree(pVM, pVCpu, Port, &uGen);
+    if (pRange)
+    {
+        PFNIOMIOPORTIN  pfnInCallback = pRange->pfnInCallback;
+        void           *pvUser        = pRange->pvUser;
+        PPDMDEVINS      pDevIns       = pRange->pDevIns;
+#ifdef VBOX_WITH_STATISTICS
+        PIOMIOPORTSTATS pStats        = pVCpu->iom.s.CTX_SUFF(pStatsLastRead);
+        if (pStats && pStats->Core.Key == Port)
+#else
+        PIOMIOPORTSTATS pStats        = NULL;
+#endif
+        {
+            if (   pfnInCallback
+                && iomRangeGenIsCurrent(pVM, uGen))
+            {
+                STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatIOPortLockFree);
+                return iomIOPortReadCallDevice(pVCpu, pStats, pfnInCallback, pDevIns, pvUser, Port, pu32Value, cbValue);
+            }
+        }
+    }
+
 /** @todo should initialize *pu32Value here because it can happen that some
  *        handle is buggy and doesn't handle all cases. */
     /* Take the IOM lock before performing any device I/O. */
@@ -98,19 +195,14 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
         if (pStats)
             pVCpu->iom.s.CTX_SUFF(pStatsLastRead) = pStats;
     }
+#else
+    PIOMIOPORTSTATS  pStats = NULL;
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastRead);
-    if (    !pRange
-        ||   (unsigned)Port - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, Port);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastRead) = pRange;
-    }
+    pRange = iomIOPortGetRangeCached(pVM, pVCpu, Port);
     MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
     if (pRange)
     {
@@ -135,50 +227,7 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_READ);
-        if (rcStrict == VINF_SUCCESS)
-        { /* likely */ }
-        else
-        {
-            STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->InRZToR3); });
-            return rcStrict;
-        }
-#ifdef VBOX_WITH_STATISTICS
-        if (pStats)
-        {
-            STAM_PROFILE_START(&pStats->CTX_SUFF_Z(ProfIn), a);
-            rcStrict = pfnInCallback(pDevIns, pvUser, Port, pu32Value, (unsigned)cbValue);
-            STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfIn), a);
-        }
-        else
-#endif
-            rcStrict = pfnInCallback(pDevIns, pvUser, Port, pu32Value, (unsigned)cbValue);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
-
-#ifdef VBOX_WITH_STATISTICS
-        if (rcStrict == VINF_SUCCESS && pStats)
-            STAM_COUNTER_INC(&pStats->CTX_SUFF_Z(In));
-# ifndef IN_RING3
-        else if (rcStrict == VINF_IOM_R3_IOPORT_READ && pStats)
-            STAM_COUNTER_INC(&pStats->InRZToR3);
-# endif
-#endif
-        if (rcStrict == VERR_IOM_IOPORT_UNUSED)
-        {
-            /* make return value */
-            rcStrict = VINF_SUCCESS;
-            switch (cbValue)
-            {
-                case 1: *(uint8_t  *)pu32Value = 0xff; break;
-                case 2: *(uint16_t *)pu32Value = 0xffff; break;
-                case 4: *(uint32_t *)pu32Value = UINT32_C(0xffffffff); break;
-                default:
-                    AssertMsgFailed(("Invalid I/O port size %d. Port=%d\n", cbValue, Port));
-                    return VERR_IOM_INVALID_IOPORT_SIZE;
-            }
-        }
-        Log3(("IOMIOPortRead: Port=%RTiop *pu32=%08RX32 cb=%d rc=%Rrc\n", Port, *pu32Value, cbValue, VBOXSTRICTRC_VAL(rcStrict)));
-        return rcStrict;
+        return iomIOPortReadCallDevice(pVCpu, pStats, pfnInCallback, pDevIns, pvUser, Port, pu32Value, cbValue);
     }
 
 #ifndef IN_RING3
@@ -272,14 +321,7 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastRead);
-    if (    !pRange
-        ||   (unsigned)uPort - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, uPort);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastRead) = pRange;
-    }
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = iomIOPortGetRangeCached(pVM, pVCpu, uPort);
     MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
     if (pRange)
     {
@@ -440,6 +482,69 @@ static VBOXSTRICTRC iomIOPortRing3WritePending(PVMCPU pVCpu, RTIOPORT Port, uint
 #endif
 
 
+/**
+ * Calls the I/O port write handler of a device, IOMIOPortWrite worker.
+ *
+ * @returns Strict VBox status code, see IOMIOPortWrite.
+ * @param   pVCpu           The cross context virtual CPU structure of the calling EMT.
+ * @param   pStats          The statistics record for the port, NULL if none.
+ * @param   pfnOutCallback  The device callback.
+ * @param   pDevIns         The device instance.
+ * @param   pvUser          The user argument for the callback.
+ * @param   Port            The port to write to.
+ * @param   u32Value        The value to write.
+ * @param   cbValue         The size of the register to write in bytes.
+ */
+DECLINLINE(VBOXSTRICTRC) iomIOPortWriteCallDevice(PVMCPU pVCpu, PIOMIOPORTSTATS pStats, PFNIOMIOPORTOUT pfnOutCallback,
+                                                  PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t u32Value,
+                                                  size_t cbValue)
+{
+    RT_NOREF_PV(pStats);
+    uint64_t const uTscTrace = DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_IOPORT);
+    VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_WRITE);
+    if (rcStrict == VINF_SUCCESS)
+    { /* likely */ }
+    else
+    {
+        STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->OutRZToR3); });
+#ifndef IN_RING3
+        if (RT_LIKELY(rcStrict == VINF_IOM_R3_IOPORT_WRITE))
+            return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
+#endif
+        return rcStrict;
+    }
+#ifdef VBOX_WITH_STATISTICS
+    if (pStats)
+    {
+        STAM_PROFILE_START(&pStats->CTX_SUFF_Z(ProfOut), a);
+        rcStrict = pfnOutCallback(pDevIns, pvUser, Port, u32Value, (unsigned)cbValue);
+        STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfOut), a);
+    }
+    else
+#endif
+        rcStrict = pfnOutCallback(pDevIns, pvUser, Port, u32Value, (unsigned)cbValue);
+    PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+
+#ifdef VBOX_WITH_STATISTICS
+    if (rcStrict == VINF_SUCCESS && pStats)
+        STAM_COUNTER_INC(&pStats->CTX_SUFF_Z(Out));
+# ifndef IN_RING3
+    else if (rcStrict == VINF_IOM_R3_IOPORT_WRITE && pStats)
+        STAM_COUNTER_INC(&pStats->OutRZToR3);
+# endif
+#endif
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_IOPORT_WRITE, uTscTrace, (uint8_t)cbValue, Port, u32Value,
+                        (int64_t)VBOXSTRICTRC_VAL(rcStrict));
+    Log3(("IOMIOPortWrite: Port=%RTiop u32=%08RX32 cb=%d rc=%Rrc\n", Port, u32Value, cbValue, VBOXSTRICTRC_VAL(rcStrict)));
+#ifndef IN_RING3
+    if (rcStrict == VINF_IOM_R3_IOPORT_WRITE)
+        return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
+#endif
+    return rcStrict;
+}
+
+
 /**
  * Writes to an I/O port register.
  *
@@ -462,6 +567,32 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
     Assert(pVCpu->iom.s.PendingIOPortWrite.cbValue == 0);
 #endif
 
+    /*
+     * Lock-free fast path, see IOMIOPortRead.
+     */
+    uint32_t                  uGen;
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = iomIOPortGetRangeLockFree(pVM, pVCpu, Port, &uGen);
+    if (pRange)
+    {
+        PFNIOMIOPORTOUT pfnOutCallback = pRange->pfnOutCallback;
+        void           *pvUser         = pRange->pvUser;
+        PPDMDEVINS      pDevIns        = pRange->pDevIns;
+#ifdef VBOX_WITH_STATISTICS
+        PIOMIOPORTSTATS pStats         = pVCpu->iom.s.CTX_SUFF(pStatsLastWrite);
+        if (pStats && pStats->Core.Key == Port)
+#else
+        PIOMIOPORTSTATS pStats         = NULL;
+#endif
+        {
+            if (   pfnOutCallback
+                && iomRangeGenIsCurrent(pVM, uGen))
+            {
+                STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatIOPortLockFree);
+                return iomIOPortWriteCallDevice(pVCpu, pStats, pfnOutCallback, pDevIns, pvUser, Port, u32Value, cbValue);
+            }
+        }
+    }
+
     /* Take the IOM lock before performing any device I/O. */
     int rc2 = IOM_LOCK_SHARED(pVM);
 #ifndef IN_RING3
@@ -483,19 +614,14 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
         if (pStats)
             pVCpu->iom.s.CTX_SUFF(pStatsLastWrite) = pStats;
     }
+#else
+    PIOMIOPORTSTATS pStats = NULL;
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastWrite);
-    if (    !pRange
-        ||   (unsigned)Port - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, Port);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) = pRange;
-    }
+    pRange = iomIOPortGetRangeCached(pVM, pVCpu, Port);
     MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
     if (pRange)
     {
@@ -520,44 +646,7 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_WRITE);
-        if (rcStrict == VINF_SUCCESS)
-        { /* likely */ }
-        else
-        {
-            STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->OutRZToR3); });
-#ifndef IN_RING3
-            if (RT_LIKELY(rcStrict == VINF_IOM_R3_IOPORT_WRITE))
-                return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
-#endif
-            return rcStrict;
-        }
-#ifdef VBOX_WITH_STATISTICS
-        if (pStats)
-        {
-            STAM_PROFILE_START(&pStats->CTX_SUFF_Z(ProfOut), a);
-            rcStrict = pfnOutCallback(pDevIns, pvUser, Port, u32Value, (unsigned)cbValue);
-            STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfOut), a);
-        }
-        else
-#endif
-            rcStrict = pfnOutCallback(pDevIns, pvUser, Port, u32Value, (unsigned)cbValue);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
-
-#ifdef VBOX_WITH_STATISTICS
-        if (rcStrict == VINF_SUCCESS && pStats)
-            STAM_COUNTER_INC(&pStats->CTX_SUFF_Z(Out));
-# ifndef IN_RING3
-        else if (rcStrict == VINF_IOM_R3_IOPORT_WRITE && pStats)
-            STAM_COUNTER_INC(&pStats->OutRZToR3);
-# endif
-#endif
-        Log3(("IOMIOPortWrite: Port=%RTiop u32=%08RX32 cb=%d rc=%Rrc\n", Port, u32Value, cbValue, VBOXSTRICTRC_VAL(rcStrict)));
-#ifndef IN_RING3
-        if (rcStrict == VINF_IOM_R3_IOPORT_WRITE)
-            return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
-#endif
-        return rcStrict;
+        return iomIOPortWriteCallDevice(pVCpu, pStats, pfnOutCallback, pDevIns, pvUser, Port, u32Value, cbValue);
     }
 
 #ifndef IN_RING3
@@ -642,14 +731,7 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastWrite);
-    if (    !pRange
-        ||   (unsigned)uPort - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, uPort);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) = pRange;
-    }
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = iomIOPortGetRangeCached(pVM, pVCpu, uPort);
     MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
     if (pRange)
     {
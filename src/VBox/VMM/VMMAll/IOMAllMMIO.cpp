@@ -29,6 +29,7 @@
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/trpm.h>
 #include <VBox/vmm/iem.h>
+#include <VBox/vmm/dbgftrace.h>
 #include "IOMInternal.h"
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/vmm.h>
@@ -299,6 +300,18 @@ static VBOXSTRICTRC iomMMIODoComplicatedWrite(PVM pVM, PVMCPU pVCpu, PIOMMMIORAN
 
 
 
+/**
+ * Gets the (first 8 bytes of the) value of an MMIO access for the binary event
+ * trace.
+ */
+DECLINLINE(uint64_t) iomMmioTraceValue(const void *pvValue, unsigned cbValue)
+{
+    uint64_t u64Value = 0;
+    memcpy(&u64Value, pvValue, RT_MIN(cbValue, sizeof(u64Value)));
+    return u64Value;
+}
+
+
 /**
  * Wrapper which does the write and updates range statistics when such are enabled.
  * @warning RT_SUCCESS(rc=VINF_IOM_R3_MMIO_WRITE) is TRUE!
@@ -322,6 +335,7 @@ static VBOXSTRICTRC iomMMIODoWrite(PVM pVM, PVMCPU pVCpu, PIOMMMIORANGE pRange,
     NOREF(pVCpu);
 #endif
 
+    uint64_t const uTscTrace = DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_MMIO);
     VBOXSTRICTRC rcStrict;
     if (RT_LIKELY(pRange->CTX_SUFF(pfnWriteCallback)))
     {
@@ -335,6 +349,9 @@ static VBOXSTRICTRC iomMMIODoWrite(PVM pVM, PVMCPU pVCpu, PIOMMMIORANGE pRange,
     }
     else
         rcStrict = VINF_SUCCESS;
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_MMIO_WRITE, uTscTrace, (uint8_t)cb, 0, GCPhysFault,
+                        iomMmioTraceValue(pvData, cb));
 
     STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfWrite), a);
     STAM_COUNTER_INC(&pStats->Accesses);
@@ -541,6 +558,7 @@ DECLINLINE(VBOXSTRICTRC) iomMMIODoRead(PVM pVM, PVMCPU pVCpu, PIOMMMIORANGE pRan
     NOREF(pVCpu);
 #endif
 
+    uint64_t const uTscTrace = DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_MMIO);
     VBOXSTRICTRC rcStrict;
     if (RT_LIKELY(pRange->CTX_SUFF(pfnReadCallback)))
     {
@@ -565,6 +583,9 @@ DECLINLINE(VBOXSTRICTRC) iomMMIODoRead(PVM pVM, PVMCPU pVCpu, PIOMMMIORANGE pRan
             case VINF_IOM_MMIO_UNUSED_00: rcStrict = iomMMIODoRead00s(pvValue, cbValue); break;
         }
     }
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_MMIO_READ, uTscTrace, (uint8_t)cbValue, 0, GCPhys,
+                        iomMmioTraceValue(pvValue, cbValue));
 
     STAM_PROFILE_STOP(&pStats->CTX_SUFF_Z(ProfRead), a);
     STAM_COUNTER_INC(&pStats->Accesses);
@@ -26,6 +26,7 @@
 #include <VBox/vmm/vm.h>
 #include <VBox/err.h>
 #include <VBox/vmm/apic.h>
+#include <VBox/vmm/dbgftrace.h>
 
 #include <VBox/log.h>
 #include <iprt/asm.h>
@@ -66,7 +67,11 @@ VMMDECL(int) PDMGetInterrupt(PVMCPU pVCpu, uint8_t *pu8Interrupt)
         if (RT_SUCCESS(rc))
         {
             if (rc == VINF_SUCCESS)
+            {
                 VBOXVMM_PDM_IRQ_GET(pVCpu, RT_LOWORD(uTagSrc), RT_HIWORD(uTagSrc), *pu8Interrupt);
+                if (DBGFTRACEEVT_IS_ENABLED(pVCpu, DBGFTRACEEVT_F_IRQ))
+                    DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_IRQ, 0, 0 /*APIC*/, *pu8Interrupt, uTagSrc, 0);
+            }
             return rc;
         }
         /* else if it's masked by TPR/PPR/whatever, go ahead checking the PIC. Such masked
@@ -91,6 +96,8 @@ VMMDECL(int) PDMGetInterrupt(PVMCPU pVCpu, uint8_t *pu8Interrupt)
             pdmUnlock(pVM);
             *pu8Interrupt = (uint8_t)i;
             VBOXVMM_PDM_IRQ_GET(pVCpu, RT_LOWORD(uTagSrc), RT_HIWORD(uTagSrc), i);
+            if (DBGFTRACEEVT_IS_ENABLED(pVCpu, DBGFTRACEEVT_F_IRQ))
+                DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_IRQ, 0, 1 /*PIC*/, (uint16_t)i, uTagSrc, 0);
             return VINF_SUCCESS;
         }
     }
@@ -112,11 +112,128 @@ DECL_FORCE_INLINE(int) pdmCritSectEnterFirst(PPDMCRITSECT pCritSect, RTNATIVETHR
     NOREF(pSrcPos);
 # endif
 
+#if defined(IN_RING3) || defined(IN_RING0)
+    PPDMCRITSECTPROF pProf = pCritSect->s.CTX_SUFF(pProf);
+    if (pProf)
+        pProf->u64TscEntered = ASMReadTSC();
+#endif
+
     STAM_PROFILE_ADV_START(&pCritSect->s.StatLocked, l);
     return VINF_SUCCESS;
 }
 
 
+#if defined(IN_RING3) || defined(IN_RING0)
+/**
+ * Records a contended acquisition in the wait profiling data of a critical
+ * section or read/write critical section.
+ *
+ * @param   pProf           The profiling data, fWaitProf must be set.
+ * @param   u64TscStart     The TSC when the caller started waiting.
+ * @param   uCaller         The return address of the enter call, 0 if not
+ *                          known.  Must be 0 unless the caller owns the
+ *                          section exclusively.
+ */
+void pdmCritSectProfRecordWait(PPDMCRITSECTPROF pProf, uint64_t u64TscStart, RTHCUINTPTR uCaller)
+{
+    Assert(pProf->fWaitProf);
+    int64_t        cTicksSigned = (int64_t)(ASMReadTSC() - u64TscStart);
+    uint64_t const cTicks       = cTicksSigned > 0 ? (uint64_t)cTicksSigned : 0;
+    STAM_REL_HISTOGRAM_ADD(&pProf->StatWait, cTicks);
+
+    /*
+     * Attribute the wait to the call site.  This is the space-saving algorithm,
+     * so a new site evicts the least hit one and inherits its count.  Only the
+     * owner gets here, so there are no races.
+     */
+    if (uCaller)
+    {
+# ifdef IN_RING0
+        bool const fRing0 = true;
+# else
+        bool const fRing0 = false;
+# endif
+        unsigned iMin = 0;
+        uint32_t cMin = UINT32_MAX;
+        for (unsigned i = 0; i < RT_ELEMENTS(pProf->aCallers); i++)
+        {
+            uint32_t const cHits = pProf->aCallers[i].cHits;
+            if (   pProf->aCallers[i].uAddr  == uCaller
+                && pProf->aCallers[i].fRing0 == fRing0)
+            {
+                pProf->aCallers[i].cHits = cHits + 1;
+                return;
+            }
+            if (cHits < cMin)
+            {
+                cMin = cHits;
+                iMin = i;
+            }
+        }
+        pProf->aCallers[iMin].uAddr  = uCaller;
+        pProf->aCallers[iMin].fRing0 = fRing0;
+        pProf->aCallers[iMin].cHits  = cMin + 1;
+    }
+}
+
+
+/**
+ * Tail code called when we've won the battle for the lock after having
+ * to spin or wait for it.
+ *
+ * @returns VINF_SUCCESS.
+ *
+ * @param   pCritSect       The critical section.
+ * @param   hNativeSelf     The native handle of this thread.
+ * @param   pSrcPos         The source position of the lock operation.
+ * @param   u64TscStart     The TSC when we started spinning, only valid when
+ *                          there is profiling data.
+ * @param   uCaller         The return address of the enter call.
+ */
+DECL_FORCE_INLINE(int) pdmCritSectEnterFirstContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD hNativeSelf,
+                                                      PCRTLOCKVALSRCPOS pSrcPos, uint64_t u64TscStart, RTHCUINTPTR uCaller)
+{
+    int rc = pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+    PPDMCRITSECTPROF pProf = pCritSect->s.CTX_SUFF(pProf);
+    if (pProf && pProf->fWaitProf)
+        pdmCritSectProfRecordWait(pProf, u64TscStart, uCaller);
+    return rc;
+}
+
+
+/**
+ * Updates the hold time average and the adaptive spin budget when the owner
+ * leaves the critical section for real.
+ *
+ * Spinning for about twice the average hold time catches most releases
+ * without burning CPU.  When that exceeds the limit the section is held for
+ * so long that blocking right away is cheaper than spinning at all.
+ *
+ * @param   pProf           The profiling data.
+ */
+DECL_FORCE_INLINE(void) pdmCritSectProfUpdateHold(PPDMCRITSECTPROF pProf)
+{
+    uint64_t const u64TscEntered = pProf->u64TscEntered;
+    if (u64TscEntered)
+    {
+        pProf->u64TscEntered = 0;
+
+        int64_t  const cTicks     = (int64_t)(ASMReadTSC() - u64TscEntered);
+        uint32_t const cTicksHold = cTicks <= 0 ? 0 : cTicks >= UINT32_MAX ? UINT32_MAX : (uint32_t)cTicks;
+        uint32_t       cTicksAvg  = pProf->cTicksHoldAvg;
+        if (cTicksAvg)
+            cTicksAvg = (uint32_t)(((uint64_t)cTicksAvg * 7 + cTicksHold) / 8);
+        else
+            cTicksAvg = cTicksHold;
+        pProf->cTicksHoldAvg = cTicksAvg;
+
+        uint64_t const cTicksSpin = (uint64_t)cTicksAvg * 2;
+        pProf->cTicksSpin = cTicksSpin <= pProf->cTicksSpinMax ? (uint32_t)cTicksSpin : 0;
+    }
+}
+#endif /* IN_RING3 || IN_RING0 */
+
+
 #if defined(IN_RING3) || defined(IN_RING0)
 /**
  * Deals with the contended case in ring-3 and ring-0.
@@ -127,14 +244,18 @@ DECL_FORCE_INLINE(int) pdmCritSectEnterFirst(PPDMCRITSECT pCritSect, RTNATIVETHR
  * @param   pCritSect           The critsect.
  * @param   hNativeSelf         The native thread handle.
  * @param   pSrcPos             The source position of the lock operation.
+ * @param   u64TscStart         The TSC when we started spinning, only valid
+ *                              when there is profiling data.
+ * @param   uCaller             The return address of the enter call.
  */
-static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD hNativeSelf, PCRTLOCKVALSRCPOS pSrcPos)
+static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD hNativeSelf, PCRTLOCKVALSRCPOS pSrcPos,
+                                         uint64_t u64TscStart, RTHCUINTPTR uCaller)
 {
     /*
      * Start waiting.
      */
     if (ASMAtomicIncS32(&pCritSect->s.Core.cLockers) == 0)
-        return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+        return pdmCritSectEnterFirstContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
 # ifdef IN_RING3
     STAM_COUNTER_INC(&pCritSect->s.StatContentionR3);
 # else
@@ -190,7 +311,7 @@ static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD
         if (RT_UNLIKELY(pCritSect->s.Core.u32Magic != RTCRITSECT_MAGIC))
             return VERR_SEM_DESTROYED;
         if (rc == VINF_SUCCESS)
-            return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+            return pdmCritSectEnterFirstContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
         AssertMsg(rc == VERR_INTERRUPTED, ("rc=%Rrc\n", rc));
 
 # ifdef IN_RING0
@@ -222,8 +343,10 @@ static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD
  * @param   pCritSect           The PDM critical section to enter.
  * @param   rcBusy              The status code to return when we're in GC or R0
  * @param   pSrcPos             The source position of the lock operation.
+ * @param   uCaller             The return address of the enter call, for the
+ *                              contention profiling.
  */
-DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRTLOCKVALSRCPOS pSrcPos)
+DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRTLOCKVALSRCPOS pSrcPos, RTHCUINTPTR uCaller)
 {
     Assert(pCritSect->s.Core.cNestings < 8);  /* useful to catch incorrect locking */
     Assert(pCritSect->s.Core.cNestings >= 0);
@@ -264,20 +387,49 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
 
     /*
      * Spin for a bit without incrementing the counter.
+     *
+     * In ring-3 and ring-0 the spin budget is derived from the observed hold
+     * times when we've got profiling data (see pdmCritSectProfUpdateHold).
+     * The budget is zero on uni-processor hosts and for sections which are
+     * held for so long that spinning is a waste of time.
      */
-    /** @todo Move this to cfgm variables since it doesn't make sense to spin on UNI
-     *        cpu systems. */
-    int32_t cSpinsLeft = CTX_SUFF(PDMCRITSECT_SPIN_COUNT_);
-    while (cSpinsLeft-- > 0)
+#if defined(IN_RING3) || defined(IN_RING0)
+    PPDMCRITSECTPROF const pProf       = pCritSect->s.CTX_SUFF(pProf);
+    uint64_t const         u64TscStart = pProf ? ASMReadTSC() : 0;
+    if (pProf)
     {
-        if (ASMAtomicCmpXchgS32(&pCritSect->s.Core.cLockers, 0, -1))
-            return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
-        ASMNopPause();
-        /** @todo Should use monitor/mwait on e.g. &cLockers here, possibly with a
-           cli'ed pendingpreemption check up front using sti w/ instruction fusing
-           for avoiding races. Hmm ... This is assuming the other party is actually
-           executing code on another CPU ... which we could keep track of if we
-           wanted. */
+        uint32_t const cTicksSpin = pProf->cTicksSpin;
+        if (cTicksSpin)
+            for (;;)
+            {
+                if (ASMAtomicCmpXchgS32(&pCritSect->s.Core.cLockers, 0, -1))
+                {
+                    STAM_REL_COUNTER_INC(&pProf->StatSpinHits);
+                    return pdmCritSectEnterFirstContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
+                }
+                ASMNopPause();
+                if (ASMReadTSC() - u64TscStart >= cTicksSpin)
+                    break;
+            }
+        STAM_REL_COUNTER_INC(&pProf->StatSpinMisses);
+    }
+    else
+#else
+    NOREF(uCaller);
+#endif
+    {
+        int32_t cSpinsLeft = CTX_SUFF(PDMCRITSECT_SPIN_COUNT_);
+        while (cSpinsLeft-- > 0)
+        {
+            if (ASMAtomicCmpXchgS32(&pCritSect->s.Core.cLockers, 0, -1))
+                return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+            ASMNopPause();
+            /** @todo Should use monitor/mwait on e.g. &cLockers here, possibly with a
+               cli'ed pendingpreemption check up front using sti w/ instruction fusing
+               for avoiding races. Hmm ... This is assuming the other party is actually
+               executing code on another CPU ... which we could keep track of if we
+               wanted. */
+        }
     }
 
 #ifdef IN_RING3
@@ -285,7 +437,7 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
      * Take the slow path.
      */
     NOREF(rcBusy);
-    return pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos);
+    return pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
 
 #else
 # ifdef IN_RING0
@@ -307,7 +459,7 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
         if (RTThreadPreemptIsEnabled(NIL_RTTHREAD))
         {
             STAM_REL_COUNTER_ADD(&pCritSect->s.StatContentionRZLock,    1000000);
-            rc = pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos);
+            rc = pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
         }
         else
         {
@@ -317,7 +469,7 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
             HMR0Leave(pVM, pVCpu);
             RTThreadPreemptRestore(NIL_RTTHREAD, XXX);
 
-            rc = pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos);
+            rc = pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
 
             RTThreadPreemptDisable(NIL_RTTHREAD, XXX);
             HMR0Enter(pVM, pVCpu);
@@ -330,7 +482,7 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
      */
     if (   RTThreadPreemptIsEnabled(NIL_RTTHREAD)
         && ASMIntAreEnabled())
-        return pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos);
+        return pdmR3R0CritSectEnterContended(pCritSect, hNativeSelf, pSrcPos, u64TscStart, uCaller);
 #  endif
 #endif /* IN_RING0 */
 
@@ -372,10 +524,10 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
 VMMDECL(int) PDMCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy)
 {
 #ifndef PDMCRITSECT_STRICT
-    return pdmCritSectEnter(pCritSect, rcBusy, NULL);
+    return pdmCritSectEnter(pCritSect, rcBusy, NULL, (uintptr_t)ASMReturnAddress());
 #else
     RTLOCKVALSRCPOS SrcPos = RTLOCKVALSRCPOS_INIT_NORMAL_API();
-    return pdmCritSectEnter(pCritSect, rcBusy, &SrcPos);
+    return pdmCritSectEnter(pCritSect, rcBusy, &SrcPos, SrcPos.uId);
 #endif
 }
 
@@ -402,10 +554,10 @@ VMMDECL(int) PDMCritSectEnterDebug(PPDMCRITSECT pCritSect, int rcBusy, RTHCUINTP
 {
 #ifdef PDMCRITSECT_STRICT
     RTLOCKVALSRCPOS SrcPos = RTLOCKVALSRCPOS_INIT_DEBUG_API();
-    return pdmCritSectEnter(pCritSect, rcBusy, &SrcPos);
+    return pdmCritSectEnter(pCritSect, rcBusy, &SrcPos, uId ? uId : (uintptr_t)ASMReturnAddress());
 #else
-    NOREF(uId); RT_SRC_POS_NOREF();
-    return pdmCritSectEnter(pCritSect, rcBusy, NULL);
+    RT_SRC_POS_NOREF();
+    return pdmCritSectEnter(pCritSect, rcBusy, NULL, uId ? uId : (uintptr_t)ASMReturnAddress());
 #endif
 }
 
@@ -595,6 +747,15 @@ VMMDECL(int) PDMCritSectLeave(PPDMCRITSECT pCritSect)
         return VINF_SEM_NESTED;
     }
 
+#if defined(IN_RING3) || defined(IN_RING0)
+    /*
+     * Feed the hold time to the adaptive spinning.
+     */
+    PPDMCRITSECTPROF pProf = pCritSect->s.CTX_SUFF(pProf);
+    if (pProf)
+        pdmCritSectProfUpdateHold(pProf);
+#endif
+
 #ifdef IN_RING0
 # if 0 /** @todo Make SUPSemEventSignal interrupt safe (handle table++) and enable this for: defined(RT_OS_LINUX) || defined(RT_OS_OS2) */
     if (1) /* SUPSemEventSignal is safe */
@@ -32,8 +32,8 @@
 #include <iprt/asm.h>
 #include <iprt/asm-amd64-x86.h>
 #include <iprt/assert.h>
+#include <iprt/lockvalidator.h>
 #ifdef IN_RING3
-# include <iprt/lockvalidator.h>
 # include <iprt/semaphore.h>
 #endif
 #if defined(IN_RING3) || defined(IN_RING0)
@@ -274,6 +274,8 @@ static int pdmCritSectRwEnterShared(PPDMCRITSECTRW pThis, int rcBusy, bool fTryO
 
                 if (ASMAtomicCmpXchgU64(&pThis->s.Core.u64State, u64State, u64OldState))
                 {
+                    PPDMCRITSECTPROF const pProf       = pThis->s.CTX_SUFF(pProf);
+                    uint64_t const         u64TscStart = pProf ? ASMReadTSC() : 0;
                     for (uint32_t iLoop = 0; ; iLoop++)
                     {
                         int rc;
@@ -362,6 +364,9 @@ static int pdmCritSectRwEnterShared(PPDMCRITSECTRW pThis, int rcBusy, bool fTryO
                     if (!fNoVal)
                         RTLockValidatorRecSharedAddOwner(pThis->s.Core.pValidatorRead, hThreadSelf, pSrcPos);
 # endif
+                    /* Other readers may be in here too, so no call site. */
+                    if (pProf)
+                        pdmCritSectProfRecordWait(pProf, u64TscStart, 0 /*uCaller*/);
                     break;
                 }
             }
@@ -833,6 +838,8 @@ static int pdmCritSectRwEnterExcl(PPDMCRITSECTRW pThis, int rcBusy, bool fTryOnl
             /*
              * Wait for our turn.
              */
+            PPDMCRITSECTPROF const pProf       = pThis->s.CTX_SUFF(pProf);
+            uint64_t const         u64TscStart = pProf ? ASMReadTSC() : 0;
             for (uint32_t iLoop = 0; ; iLoop++)
             {
                 int rc;
@@ -892,6 +899,8 @@ static int pdmCritSectRwEnterExcl(PPDMCRITSECTRW pThis, int rcBusy, bool fTryOnl
                 }
                 AssertMsg(iLoop < 1000, ("%u\n", iLoop)); /* may loop a few times here... */
             }
+            if (pProf)
+                pdmCritSectProfRecordWait(pProf, u64TscStart, pSrcPos ? pSrcPos->uId : 0);
 
         }
         else
@@ -100,26 +100,39 @@ VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
     Assert(VALID_PTR(pQueue) && pQueue->CTX_SUFF(pVM));
     Assert(VALID_PTR(pItem));
 
-#if 0 /* the paranoid android version: */
-    void *pvNext;
-    do
-    {
-        pvNext = ASMAtomicUoReadPtr((void * volatile *)&pQueue->CTX_SUFF(pPending));
-        ASMAtomicUoWritePtr((void * volatile *)&pItem->CTX_SUFF(pNext), pvNext);
-    } while (!ASMAtomicCmpXchgPtr(&pQueue->CTX_SUFF(pPending), pItem, pvNext));
-#else
-    PPDMQUEUEITEMCORE pNext;
-    do
-    {
-        pNext = pQueue->CTX_SUFF(pPending);
-        pItem->CTX_SUFF(pNext) = pNext;
-    } while (!ASMAtomicCmpXchgPtr(&pQueue->CTX_SUFF(pPending), pItem, pNext));
-#endif
+    /*
+     * Translate the item into an index, which is the same in all contexts.
+     */
+    uintptr_t const offItem = (uintptr_t)pItem - (uintptr_t)PDMQUEUE_ITEM(pQueue, 0);
+    uint32_t const  iItem   = (uint32_t)(offItem / pQueue->cbItem);
+    AssertMsgReturnVoid(iItem < pQueue->cItems && offItem % pQueue->cbItem == 0,
+                        ("pQueue=%p pItem=%p iItem=%#x\n", pQueue, pItem, iItem));
+
+    /*
+     * Reserve a slot in the pending ring and publish the item in it.  The ring
+     * is at least as large as the number of items, so the slot is free.
+     */
+    uint32_t const iSlot = ASMAtomicIncU32(&pQueue->iPendingHead) - 1;
+    uint32_t volatile *pu32Slot = &PDMQUEUE_PENDING_RING(pQueue)[iSlot & pQueue->fPendingMask];
+    Assert(*pu32Slot == 0);
+    ASMAtomicWriteU32(pu32Slot, iItem + 1);
 
     if (!pQueue->pTimer)
         pdmQueueSetFF(pQueue);
+
+    /*
+     * Producer side statistics.
+     */
     STAM_REL_COUNTER_INC(&pQueue->StatInsert);
     STAM_STATS({ ASMAtomicIncU32(&pQueue->cStatPending); });
+    uint32_t const cPending = iSlot + 1 - ASMAtomicUoReadU32(&pQueue->iPendingTail);
+    if (cPending >= pQueue->cItems - pQueue->cItems / 4 && pQueue->cItems >= 4)
+        STAM_REL_COUNTER_INC(&pQueue->StatInsertCongested);
+    uint32_t cPendingMax = ASMAtomicUoReadU32(&pQueue->cPendingMax);
+    while (   cPending > cPendingMax
+           && cPending <= pQueue->cItems
+           && !ASMAtomicCmpXchgExU32(&pQueue->cPendingMax, cPending, cPendingMax, &cPendingMax))
+    { /* retry */ }
 }
 
 
@@ -131,13 +144,21 @@ VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
  * @param   pQueue          The queue handle.
  * @param   pItem           The item to insert.
  * @param   NanoMaxDelay    The maximum delay before processing the queue, in nanoseconds.
- *                          This applies only to GC.
+ *                          If this is shorter than the polling interval of a
+ *                          timer driven queue, the queue is flushed via the
+ *                          force action flag instead of waiting for the timer.
  * @thread  Any thread.
  */
 VMMDECL(void) PDMQueueInsertEx(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem, uint64_t NanoMaxDelay)
 {
-    NOREF(NanoMaxDelay);
     PDMQueueInsert(pQueue, pItem);
+    if (   pQueue->pTimer
+        && NanoMaxDelay < pQueue->cMilliesInterval * RT_NS_1MS_64)
+    {
+        ASMAtomicWriteBool(&pQueue->fExpedite, true);
+        pdmQueueSetFF(pQueue);
+        STAM_REL_COUNTER_INC(&pQueue->StatInsertExpedite);
+    }
 #ifdef IN_RC
     PVM pVM = pQueue->CTX_SUFF(pVM);
     /** @todo figure out where to put this, the next bit should go there too.
@@ -202,9 +223,7 @@ VMMDECL(R0PTRTYPE(PPDMQUEUE)) PDMQueueR0Ptr(PPDMQUEUE pQueue)
 VMMDECL(bool) PDMQueueFlushIfNecessary(PPDMQUEUE pQueue)
 {
     AssertPtr(pQueue);
-    if (   pQueue->pPendingR3 != NIL_RTR3PTR
-        || pQueue->pPendingR0 != NIL_RTR0PTR
-        || pQueue->pPendingRC != NIL_RTRCPTR)
+    if (PDMQUEUE_IS_PENDING(pQueue))
     {
         pdmQueueSetFF(pQueue);
         return false;
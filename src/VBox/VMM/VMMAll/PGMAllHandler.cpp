@@ -27,6 +27,7 @@
 #include <VBox/vmm/em.h>
 #include <VBox/vmm/nem.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/sup.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -282,11 +283,15 @@ int pgmHandlerPhysicalExRegister(PVM pVM, PPGMPHYSHANDLER pPhysHandler, RTGCPHYS
         int rc = pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(pVM, pPhysHandler, pRam);
         if (rc == VINF_PGM_SYNC_CR3)
             rc = VINF_PGM_GCPHYS_ALIASED;
+        pgmHandlerPhysicalIdxUpdate(pVM, pRam, GCPhys, GCPhysLast);
 
 #if defined(IN_RING3) || defined(IN_RING0)
         NEMHCNotifyHandlerPhysicalRegister(pVM, pType->enmKind, GCPhys, GCPhysLast - GCPhys + 1);
 #endif
         pgmUnlock(pVM);
+#ifdef IN_RING3
+        pgmR3HandlerPhysicalIdxEnsure(pVM, GCPhys);
+#endif
 
 #ifdef VBOX_WITH_REM
 # ifndef IN_RING3
@@ -429,6 +434,137 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVM pVM, PPGMPHYSHANDL
 }
 
 
+/**
+ * Updates the physical handler index after a handler was registered,
+ * deregistered or changed its extent.
+ *
+ * Must be called while the handler range is valid, i.e. before resetting
+ * the keys when deregistering.  Ranges without an index are left alone, it
+ * is allocated by pgmR3HandlerPhysicalIdxEnsure after the PGM lock has been
+ * released.  In contexts without access to it, the index is marked stale and
+ * rebuilt by the next update in a context that has.
+ *
+ * @param   pVM             The cross context VM structure.
+ * @param   pRam            The RAM range containing the handler, NULL if not
+ *                          known.
+ * @param   GCPhys          The first address the change affects.
+ * @param   GCPhysLast      The last address the change affects (inclusive).
+ */
+void pgmHandlerPhysicalIdxUpdate(PVM pVM, PPGMRAMRANGE pRam, RTGCPHYS GCPhys, RTGCPHYS GCPhysLast)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (!pRam)
+    {
+        pRam = pgmPhysGetRange(pVM, GCPhys);
+        if (!pRam)
+            return;
+    }
+    Assert(GCPhys >= pRam->GCPhys && GCPhys <= pRam->GCPhysLast);
+    if (!pRam->paoffPhysHandlersR3)
+        return;
+
+    int32_t *paoffHandlers = pgmHandlerPhysicalIdxGet(pRam);
+    if (!paoffHandlers)
+    {
+        pRam->fFlags |= PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE;
+        return;
+    }
+
+    PAVLROGCPHYSTREE pTree        = &pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers;
+    uint32_t const   iPageLastRam = (uint32_t)(pRam->cb >> PAGE_SHIFT) - 1;
+    if (pRam->fFlags & PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE)
+    {
+        pgmHandlerPhysicalIdxFillWorker(pTree, pVM->pgm.s.CTX_SUFF(pTrees), pRam->GCPhys, paoffHandlers, 0, iPageLastRam);
+        pRam->fFlags &= ~PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE;
+    }
+    else
+    {
+        uint32_t const iPage     = (uint32_t)((GCPhys - pRam->GCPhys) >> PAGE_SHIFT);
+        uint32_t const iPageLast = GCPhysLast < pRam->GCPhysLast
+                                 ? (uint32_t)((GCPhysLast - pRam->GCPhys) >> PAGE_SHIFT) : iPageLastRam;
+        pgmHandlerPhysicalIdxFillWorker(pTree, pVM->pgm.s.CTX_SUFF(pTrees), pRam->GCPhys, paoffHandlers, iPage, iPageLast);
+    }
+}
+
+
+#ifdef IN_RING3
+/**
+ * Makes sure the RAM range containing @a GCPhys has a physical handler index.
+ *
+ * The index is allocated without owning the PGM lock and is made accessible
+ * from ring-0 when possible so handler faults taken there can use it as well.
+ * If the RAM ranges changed while allocating, or the caller still owns the
+ * lock, the allocation is left for a later call.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      An address in the RAM range.
+ */
+void pgmR3HandlerPhysicalIdxEnsure(PVM pVM, RTGCPHYS GCPhys)
+{
+    pgmLock(pVM);
+    PPGMRAMRANGE pRam = pgmPhysGetRange(pVM, GCPhys);
+    if (   !pRam
+        || pRam->paoffPhysHandlersR3
+        || PDMCritSectGetRecursion(&pVM->pgm.s.CritSectX) != 1)
+    {
+        pgmUnlock(pVM);
+        return;
+    }
+    uint32_t const idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+    size_t const   cbIdx          = RT_ALIGN_Z((size_t)(pRam->cb >> PAGE_SHIFT) * sizeof(int32_t), PAGE_SIZE);
+    pgmUnlock(pVM);
+
+    RTR0PTR R0Ptr = NIL_RTR0PTR;
+    void   *pvIdx = NULL;
+    int rc = SUPR3PageAllocEx(cbIdx >> PAGE_SHIFT, 0 /*fFlags*/, &pvIdx,
+#if defined(VBOX_WITH_MORE_RING0_MEM_MAPPINGS)
+                              &R0Ptr,
+#elif defined(VBOX_WITH_2X_4GB_ADDR_SPACE)
+                              VM_IS_HM_OR_NEM_ENABLED(pVM) ? &R0Ptr : NULL,
+#else
+                              NULL,
+#endif
+                              NULL /*paPages*/);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Failed to allocate a %zu byte handler index for %RGp: %Rrc\n", cbIdx, GCPhys, rc));
+        return;
+    }
+#if defined(VBOX_WITH_MORE_RING0_MEM_MAPPINGS)
+    Assert(R0Ptr != NIL_RTR0PTR);
+#elif defined(VBOX_WITH_2X_4GB_ADDR_SPACE)
+    if (!VM_IS_HM_OR_NEM_ENABLED(pVM))
+        R0Ptr = NIL_RTR0PTR;
+#else
+    R0Ptr = (uintptr_t)pvIdx;
+#endif
+
+    /*
+     * Install it unless the RAM ranges changed behind our back or someone
+     * beat us to it.  The range is rebuilt in full from the handler tree.
+     */
+    pgmLock(pVM);
+    if (   pVM->pgm.s.idRamRangesGen == idRamRangesGen
+        && !pRam->paoffPhysHandlersR3)
+    {
+        Assert(RT_ALIGN_Z((size_t)(pRam->cb >> PAGE_SHIFT) * sizeof(int32_t), PAGE_SIZE) == cbIdx);
+        pRam->paoffPhysHandlersR3 = (int32_t *)pvIdx;
+        pRam->paoffPhysHandlersR0 = R0Ptr;
+        pRam->fFlags |= PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE;
+        pgmHandlerPhysicalIdxUpdate(pVM, pRam, pRam->GCPhys, pRam->GCPhysLast);
+        pvIdx = NULL;
+    }
+    pgmUnlock(pVM);
+
+    if (pvIdx)
+    {
+        rc = SUPR3PageFreeEx(pvIdx, cbIdx >> PAGE_SHIFT);
+        AssertRC(rc);
+    }
+}
+#endif /* IN_RING3 */
+
+
 /**
  * Deregister a physical page access handler.
  *
@@ -458,6 +594,7 @@ int pgmHandlerPhysicalExDeregister(PVM pVM, PPGMPHYSHANDLER pPhysHandler, int fR
          */
         pgmHandlerPhysicalResetRamFlags(pVM, pPhysHandler);
         pgmHandlerPhysicalDeregisterNotifyREMAndNEM(pVM, pPhysHandler, fRestoreAsRAM);
+        pgmHandlerPhysicalIdxUpdate(pVM, NULL, pPhysHandler->Core.Key, pPhysHandler->Core.KeyLast);
         pVM->pgm.s.pLastPhysHandlerR0 = 0;
         pVM->pgm.s.pLastPhysHandlerR3 = 0;
         pVM->pgm.s.pLastPhysHandlerRC = 0;
@@ -537,6 +674,7 @@ VMMDECL(int)  PGMHandlerPhysicalDeregister(PVM pVM, RTGCPHYS GCPhys)
          */
         pgmHandlerPhysicalResetRamFlags(pVM, pRemoved);
         pgmHandlerPhysicalDeregisterNotifyREMAndNEM(pVM, pRemoved, -1);
+        pgmHandlerPhysicalIdxUpdate(pVM, NULL, pRemoved->Core.Key, pRemoved->Core.KeyLast);
         pVM->pgm.s.pLastPhysHandlerR0 = 0;
         pVM->pgm.s.pLastPhysHandlerR3 = 0;
         pVM->pgm.s.pLastPhysHandlerRC = 0;
@@ -881,6 +1019,7 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
          * Clear the ram flags. (We're gonna move or free it!)
          */
         pgmHandlerPhysicalResetRamFlags(pVM, pCur);
+        pgmHandlerPhysicalIdxUpdate(pVM, NULL, pCur->Core.Key, pCur->Core.KeyLast);
 #if defined(VBOX_WITH_REM) || defined(IN_RING3) || defined(IN_RING0)
         PPGMPHYSHANDLERTYPEINT const pCurType      = PGMPHYSHANDLER_GET_TYPE(pVM, pCur);
         bool const                   fRestoreAsRAM = pCurType->pfnHandlerR3 /** @todo this isn't entirely correct. */
@@ -919,6 +1058,7 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
                      * Set ram flags, flush shadow PT entries and finally tell REM about this.
                      */
                     rc = pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(pVM, pCur, pRam);
+                    pgmHandlerPhysicalIdxUpdate(pVM, pRam, GCPhys, GCPhysLast);
 
                     /** @todo NEM: not sure we need this notification... */
 #if defined(IN_RING3) || defined(IN_RING0)
@@ -926,6 +1066,9 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
 #endif
 
                     pgmUnlock(pVM);
+#ifdef IN_RING3
+                    pgmR3HandlerPhysicalIdxEnsure(pVM, GCPhys);
+#endif
 
 #ifdef VBOX_WITH_REM
 # ifndef IN_RING3
@@ -1060,6 +1203,7 @@ VMMDECL(int) PGMHandlerPhysicalSplit(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS GCPhysSp
 
             if (RT_LIKELY(RTAvlroGCPhysInsert(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, &pNew->Core)))
             {
+                pgmHandlerPhysicalIdxUpdate(pVM, NULL, pNew->Core.Key, pNew->Core.KeyLast);
                 LogFlow(("PGMHandlerPhysicalSplit: %RGp-%RGp and %RGp-%RGp\n",
                          pCur->Core.Key, pCur->Core.KeyLast, pNew->Core.Key, pNew->Core.KeyLast));
                 pgmUnlock(pVM);
@@ -1120,6 +1264,7 @@ VMMDECL(int) PGMHandlerPhysicalJoin(PVM pVM, RTGCPHYS GCPhys1, RTGCPHYS GCPhys2)
                         pCur1->cPages        = (pCur1->Core.KeyLast - (pCur1->Core.Key & X86_PTE_PAE_PG_MASK) + PAGE_SIZE) >> PAGE_SHIFT;
                         LogFlow(("PGMHandlerPhysicalJoin: %RGp-%RGp %RGp-%RGp\n",
                                  pCur1->Core.Key, pCur1->Core.KeyLast, pCur2->Core.Key, pCur2->Core.KeyLast));
+                        pgmHandlerPhysicalIdxUpdate(pVM, NULL, pCur2->Core.Key, pCur2->Core.KeyLast);
                         pVM->pgm.s.pLastPhysHandlerR0 = 0;
                         pVM->pgm.s.pLastPhysHandlerR3 = 0;
                         pVM->pgm.s.pLastPhysHandlerRC = 0;
@@ -21,6 +21,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_PGM_PHYS
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/trpm.h>
 #include <VBox/vmm/vmm.h>
 #include <VBox/vmm/iom.h>
@@ -859,6 +860,7 @@ int pgmPhysAllocPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ALLOCATED);
     PGM_PAGE_SET_PDE_TYPE(pVM, pPage, PGM_PAGE_PDE_TYPE_PT);
     pgmPhysInvalidatePageMapTLBEntry(pVM, GCPhys);
+    pgmPhysPageMarkLiveSaveDirty(pVM, pPage, GCPhys);
 
     /* Copy the shared page contents to the replacement page. */
     if (pvSharedPage)
@@ -1088,6 +1090,7 @@ void pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCP
     Assert(pVM->pgm.s.cMonitoredPages > 0);
     pVM->pgm.s.cMonitoredPages--;
     pVM->pgm.s.cWrittenToPages++;
+    pgmPhysPageMarkLiveSaveDirty(pVM, pPage, GCPhys);
 
 #ifndef IN_RC
     /*
@@ -1234,6 +1237,28 @@ int pgmPhysPageMapByPageID(PVM pVM, uint32_t idPage, RTHCPHYS HCPhys, void **ppv
 }
 
 
+/**
+ * Faults in a page which content is still in the saved-state page file.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pPage       The physical page tracking structure.
+ * @param   GCPhys      The address of the page.
+ *
+ * @remarks Called from within the PGM critical section.
+ */
+static int pgmPhysPageLazyRestore(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+#ifdef IN_RING3
+    return pgmR3PhysLazyRestorePage(pVM, pPage, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK);
+#else
+    NOREF(pPage);
+    return VMMRZCallRing3NoCpu(pVM, VMMCALLRING3_PGM_LAZY_RESTORE_PAGE, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK);
+#endif
+}
+
+
 /**
  * Maps a page into the current virtual address space so it can be accessed.
  *
@@ -1255,6 +1280,16 @@ static int pgmPhysPageMapCommon(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, PPPGMP
     PGM_LOCK_ASSERT_OWNER(pVM);
     NOREF(GCPhys);
 
+    /*
+     * Pages still pending lazy restore must be read from the page file first.
+     */
+    if (RT_UNLIKELY(PGM_PAGE_IS_LAZY_RESTORE(pPage)))
+    {
+        int rc = pgmPhysPageLazyRestore(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
 #if defined(IN_RC) || defined(VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0)
     /*
      * Just some sketchy GC/R0-darwin code.
@@ -1505,6 +1540,13 @@ int pgmPhysPageLoadIntoTlbWithPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
      * Make a special case for the zero page as it is kind of special.
      */
     PPGMPAGEMAPTLBE pTlbe = &pVM->pgm.s.CTXSUFF(PhysTlb).aEntries[PGM_PAGEMAPTLB_IDX(GCPhys)];
+    if (RT_UNLIKELY(PGM_PAGE_IS_LAZY_RESTORE(pPage)))
+    {
+        /* The page is probably still the zero page, so don't wait for pgmPhysPageMapCommon. */
+        int rc = pgmPhysPageLazyRestore(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
     if (    !PGM_PAGE_IS_ZERO(pPage)
         &&  !PGM_PAGE_IS_BALLOONED(pPage))
     {
@@ -3325,6 +3367,10 @@ VMMDECL(int) PGMPhysSimpleWriteGCPhys(PVM pVM, RTGCPHYS GCPhysDst, const void *p
      */
     if (!cb)
         return VINF_SUCCESS;
+#ifdef IN_RING3
+    /* This bypasses the access handlers, so tell IEM to forget what it cached. */
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+#endif
 
     /* map the 1st page */
     void *pvDst;
@@ -3494,6 +3540,10 @@ VMMDECL(int) PGMPhysSimpleWriteGCPtr(PVMCPU pVCpu, RTGCPTR GCPtrDst, const void
 
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PhysSimpleWrite));
     STAM_COUNTER_ADD(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PhysSimpleWriteBytes), cb);
+#ifdef IN_RING3
+    /* This bypasses the access handlers, so tell IEM to forget what it cached. */
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+#endif
 
     /* map the 1st page */
     void *pvDst;
@@ -3572,6 +3622,10 @@ VMMDECL(int) PGMPhysSimpleDirtyWriteGCPtr(PVMCPU pVCpu, RTGCPTR GCPtrDst, const
      */
     if (!cb)
         return VINF_SUCCESS;
+#ifdef IN_RING3
+    /* This bypasses the access handlers, so tell IEM to forget what it cached. */
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+#endif
 
     /* map the 1st page */
     void *pvDst;
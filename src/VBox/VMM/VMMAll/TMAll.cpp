@@ -362,61 +362,6 @@ DECLINLINE(bool) tmTimerTryWithLink(PTMTIMER pTimer, TMTIMERSTATE enmStateNew, T
 }
 
 
-/**
- * Links a timer into the active list of a timer queue.
- *
- * @param   pQueue          The queue.
- * @param   pTimer          The timer.
- * @param   u64Expire       The timer expiration time.
- *
- * @remarks Called while owning the relevant queue lock.
- */
-DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
-{
-    Assert(!pTimer->offNext);
-    Assert(!pTimer->offPrev);
-    Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
-
-    PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue);
-    if (pCur)
-    {
-        for (;; pCur = TMTIMER_GET_NEXT(pCur))
-        {
-            if (pCur->u64Expire > u64Expire)
-            {
-                const PTMTIMER pPrev = TMTIMER_GET_PREV(pCur);
-                TMTIMER_SET_NEXT(pTimer, pCur);
-                TMTIMER_SET_PREV(pTimer, pPrev);
-                if (pPrev)
-                    TMTIMER_SET_NEXT(pPrev, pTimer);
-                else
-                {
-                    TMTIMER_SET_HEAD(pQueue, pTimer);
-                    ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-                    DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive head", R3STRING(pTimer->pszDesc));
-                }
-                TMTIMER_SET_PREV(pCur, pTimer);
-                return;
-            }
-            if (!pCur->offNext)
-            {
-                TMTIMER_SET_NEXT(pCur, pTimer);
-                TMTIMER_SET_PREV(pTimer, pCur);
-                DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive tail", R3STRING(pTimer->pszDesc));
-                return;
-            }
-        }
-    }
-    else
-    {
-        TMTIMER_SET_HEAD(pQueue, pTimer);
-        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive empty", R3STRING(pTimer->pszDesc));
-    }
-}
-
-
-
 /**
  * Schedules the given timer on the given queue.
  *
@@ -582,6 +527,18 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
         {
             AssertMsg((int)pCur->enmClock == i, ("%s: %d != %d\n", pszWhere, pCur->enmClock, i));
             AssertMsg(TMTIMER_GET_PREV(pCur) == pPrev, ("%s: %p != %p\n", pszWhere, TMTIMER_GET_PREV(pCur), pPrev));
+
+            /* The search tree must be consistent and agree with the list order. */
+            AssertMsg(!pPrev || pPrev->u64TreeKey <= pCur->u64TreeKey,
+                      ("%s: %'RU64 > %'RU64\n", pszWhere, pPrev->u64TreeKey, pCur->u64TreeKey));
+            PTMTIMER const pTreeParent = TMTIMER_GET_TREE_NODE(pCur, pCur->offTreeParent);
+            PTMTIMER const pTreeLeft   = TMTIMER_GET_TREE_NODE(pCur, pCur->offTreeLeft);
+            PTMTIMER const pTreeRight  = TMTIMER_GET_TREE_NODE(pCur, pCur->offTreeRight);
+            AssertMsg(pTreeParent || pCur == TMTIMER_GET_TREE_ROOT(pQueue), ("%s: %p\n", pszWhere, pCur));
+            AssertMsg(!pTreeParent || pTreeParent->uTreePriority <= pCur->uTreePriority, ("%s: %p\n", pszWhere, pCur));
+            AssertMsg(!pTreeLeft  || TMTIMER_GET_TREE_NODE(pTreeLeft,  pTreeLeft->offTreeParent)  == pCur, ("%s: %p\n", pszWhere, pCur));
+            AssertMsg(!pTreeRight || TMTIMER_GET_TREE_NODE(pTreeRight, pTreeRight->offTreeParent) == pCur, ("%s: %p\n", pszWhere, pCur));
+
             TMTIMERSTATE enmState = pCur->enmState;
             switch (enmState)
             {
@@ -406,6 +406,11 @@ typedef struct GMMCHUNK
     /** Pointer to the free set this chunk belongs to.  NULL for
      * chunks with no free pages. (Giant mtx.) */
     PGMMCHUNKFREESET    pSet;
+    /** The private free set of the VM which seeded the chunk, NULL if not
+     * GMM_CHUNK_FLAGS_SEEDED or in bound memory mode.  Other VMs freeing shared
+     * pages in the chunk must link it back into this set and not their own.
+     * (Giant mtx.) */
+    PGMMCHUNKFREESET    pOwnerSet;
     /** List node in the chunk list (GMM::ChunkList).  (Giant mtx.) */
     RTLISTNODE          ListNode;
     /** Pointer to an array of mappings.  (Chunk mtx.) */
@@ -446,6 +451,12 @@ typedef struct GMMCHUNK
  * @{ */
 /** Indicates that the chunk is a large page (2MB). */
 #define GMM_CHUNK_FLAGS_LARGE_PAGE  UINT16_C(0x0001)
+/** Indicates that the chunk memory was supplied by ring-3 and is locked down
+ * (GMMR0SeedLargePage).  The owner VM uses the ring-3 mapping it supplied, and
+ * the chunk stays in the owner's private free set (GMMCHUNK::pOwnerSet) until
+ * the VM is cleaned up.  A seeded chunk which cannot be freed at that point
+ * loses the flag and is treated like any other chunk from then on. */
+#define GMM_CHUNK_FLAGS_SEEDED      UINT16_C(0x0002)
 /** @}  */
 
 
@@ -516,6 +527,12 @@ typedef struct GMM
     PAVLLU32NODECORE    pGlobalSharedModuleTree;
     /** Sharable modules (count of nodes in pGlobalSharedModuleTree). */
     uint32_t            cShareableModules;
+    /** The content deduplication index (GMMDEDUPENTRY), keyed by page hash. */
+    PAVLU32NODECORE     pDedupTree;
+    /** The number of entries in pDedupTree. */
+    uint32_t            cDedupEntries;
+    /** The number of private pages freed by content deduplication merges. */
+    uint64_t            cDedupMergedPages;
 
     /** The chunk list.  For simplifying the cleanup process. */
     RTLISTANCHOR        ChunkList;
@@ -636,6 +653,32 @@ typedef struct GMMCHECKSHAREDMODULEINFO
     VMCPUID                 idCpu;
 } GMMCHECKSHAREDMODULEINFO;
 
+/**
+ * Content deduplication index entry (GMM::pDedupTree).
+ *
+ * The key is the content hash of the page, see gmmR0DedupHashPage.  Entries
+ * are only hints; the page they refer to is revalidated on every use.
+ */
+typedef struct GMMDEDUPENTRY
+{
+    /** The AVL node core, the key is the page content hash. */
+    AVLU32NODECORE          Core;
+    /** Node in the candidate list of the owning VM (GMMPERVM::DedupCandidateList).
+     * Only linked while fShared is clear. */
+    RTLISTNODE              ListNode;
+    /** The ID of the candidate (private) or reference (shared) page. */
+    uint32_t                idPage;
+    /** The handle of the VM owning the candidate page. */
+    uint16_t                hGVM;
+    /** Set if idPage is a shared page, clear if it's a private candidate. */
+    bool                    fShared;
+} GMMDEDUPENTRY;
+/** Pointer to a content deduplication index entry. */
+typedef GMMDEDUPENTRY *PGMMDEDUPENTRY;
+
+/** The max number of entries in the content deduplication index. */
+#define GMM_DEDUP_MAX_ENTRIES       _1M
+
 /**
  * Argument packet for gmmR0FindDupPageInChunk by GMMR0FindDuplicatePage.
  */
@@ -736,6 +779,7 @@ static bool                 gmmR0CleanupVMScanChunk(PGMM pGMM, PGVM pGVM, PGMMCH
 DECLINLINE(void)            gmmR0UnlinkChunk(PGMMCHUNK pChunk);
 DECLINLINE(void)            gmmR0LinkChunk(PGMMCHUNK pChunk, PGMMCHUNKFREESET pSet);
 DECLINLINE(void)            gmmR0SelectSetAndLinkChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk);
+static void                 gmmR0DisownSeededChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk);
 #ifdef GMMR0_WITH_SANITY_CHECK
 static uint32_t             gmmR0SanityCheck(PGMM pGMM, const char *pszFunction, unsigned uLineNo);
 #endif
@@ -745,6 +789,8 @@ DECLINLINE(void)            gmmR0FreeSharedPage(PGMM pGMM, PGVM pGVM, uint32_t i
 static int                  gmmR0UnmapChunkLocked(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk);
 #ifdef VBOX_WITH_PAGE_SHARING
 static void                 gmmR0SharedModuleCleanup(PGMM pGMM, PGVM pGVM);
+static void                 gmmR0DedupPurgeVM(PGMM pGMM, PGVM pGVM);
+static DECLCALLBACK(int)    gmmR0DedupDestroyEntry(PAVLU32NODECORE pNode, void *pvUser);
 # ifdef VBOX_STRICT
 static uint32_t             gmmR0StrictPageChecksum(PGMM pGMM, PGVM pGVM, uint32_t idPage);
 # endif
@@ -888,6 +934,12 @@ GMMR0DECL(void) GMMR0Term(void)
     /* Free any chunks still hanging around. */
     RTAvlU32Destroy(&pGMM->pChunks, gmmR0TermDestroyChunk, pGMM);
 
+#ifdef VBOX_WITH_PAGE_SHARING
+    /* Drop the content deduplication index. */
+    RTAvlU32Destroy(&pGMM->pDedupTree, gmmR0DedupDestroyEntry, NULL);
+    pGMM->cDedupEntries = 0;
+#endif
+
     /* Destroy the chunk locks. */
     for (unsigned iMtx = 0; iMtx < RT_ELEMENTS(pGMM->aChunkMtx); iMtx++)
     {
@@ -952,6 +1004,7 @@ GMMR0DECL(void) GMMR0InitPerVMData(PGVM pGVM)
     pGVM->gmm.s.Stats.enmPolicy = GMMOCPOLICY_INVALID;
     pGVM->gmm.s.Stats.enmPriority = GMMPRIORITY_INVALID;
     pGVM->gmm.s.Stats.fMayAllocate = false;
+    RTListInit(&pGVM->gmm.s.DedupCandidateList);
 }
 
 
@@ -1240,6 +1293,13 @@ GMMR0DECL(void) GMMR0CleanupVM(PGVM pGVM)
     uint64_t uLockNanoTS = RTTimeSystemNanoTS();
     GMM_CHECK_SANITY_UPON_ENTERING(pGMM);
 
+#ifdef VBOX_WITH_PAGE_SHARING
+    /*
+     * Forget about the deduplication candidates of this VM.
+     */
+    gmmR0DedupPurgeVM(pGMM, pGVM);
+#endif
+
     /*
      * The policy is 'INVALID' until the initial reservation
      * request has been serviced.
@@ -1345,6 +1405,28 @@ GMMR0DECL(void) GMMR0CleanupVM(PGVM pGVM)
             }
         } while (fRedoFromStart);
 
+        /*
+         * Free the chunks seeded by the VM (GMMR0SeedLargePage).  Outside bound
+         * memory mode these are kept in the VM's private set and not in the one
+         * we just processed.  Chunks which are still mapped by other VMs or
+         * still hold shared pages are handed over to the global sets.
+         */
+        if (!pGMM->fBoundMemoryMode)
+        {
+            while ((pChunk = pGVM->gmm.s.Private.apLists[GMM_CHUNK_FREE_SET_UNUSED_LIST]) != NULL)
+            {
+                Assert(pChunk->pOwnerSet == &pGVM->gmm.s.Private);
+                if (!gmmR0FreeChunk(pGMM, pGVM, pChunk, true /*fRelaxedSem*/))
+                    gmmR0DisownSeededChunk(pGMM, pGVM, pChunk); /* still mapped */
+            }
+
+            RTListForEach(&pGMM->ChunkList, pChunk, GMMCHUNK, ListNode)
+            {
+                if (pChunk->pOwnerSet == &pGVM->gmm.s.Private)
+                    gmmR0DisownSeededChunk(pGMM, pGVM, pChunk);
+            }
+        }
+
         /*
          * Account for shared pages that weren't freed.
          */
@@ -1468,12 +1550,16 @@ static bool gmmR0CleanupVMScanChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk)
 
     /*
      * If not in bound memory mode, we should reset the hGVM field
-     * if it has our handle in it.
+     * if it has our handle in it.  (Our seeded chunks keep it until
+     * GMMR0CleanupVM has dealt with them.)
      */
     if (pChunk->hGVM == pGVM->hSelf)
     {
         if (!g_pGMM->fBoundMemoryMode)
-            pChunk->hGVM = NIL_GVM_HANDLE;
+        {
+            if (!(pChunk->fFlags & GMM_CHUNK_FLAGS_SEEDED))
+                pChunk->hGVM = NIL_GVM_HANDLE;
+        }
         else if (pChunk->cFree != GMM_CHUNK_NUM_PAGES)
         {
             SUPR0Printf("gmmR0CleanupVMScanChunk: %RKv/%#x: cFree=%#x - it should be 0 in bound mode!\n",
@@ -1964,7 +2050,9 @@ DECLINLINE(void) gmmR0LinkChunk(PGMMCHUNK pChunk, PGMMCHUNKFREESET pSet)
 DECLINLINE(void) gmmR0SelectSetAndLinkChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk)
 {
     PGMMCHUNKFREESET pSet;
-    if (pGMM->fBoundMemoryMode)
+    if (pChunk->pOwnerSet)
+        pSet = pChunk->pOwnerSet; /* Seeded, pGVM needn't be the owner. */
+    else if (pGMM->fBoundMemoryMode)
         pSet = &pGVM->gmm.s.Private;
     else if (pChunk->cShared)
         pSet = &pGMM->Shared;
@@ -1974,6 +2062,30 @@ DECLINLINE(void) gmmR0SelectSetAndLinkChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChu
 }
 
 
+/**
+ * Hands a chunk seeded by a terminating VM over to the global free sets.
+ *
+ * This is for seeded chunks which cannot be freed yet because other VMs still
+ * have them mapped or hold shared pages in them.  The memory stays locked down
+ * until the chunk is freed, so it can be treated like any other chunk.
+ *
+ * @param   pGMM        Pointer to the GMM instance.
+ * @param   pGVM        The terminating VM.
+ * @param   pChunk      The seeded chunk.
+ */
+static void gmmR0DisownSeededChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk)
+{
+    Assert(pChunk->pOwnerSet == &pGVM->gmm.s.Private);
+    Assert(!pGMM->fBoundMemoryMode);
+
+    gmmR0UnlinkChunk(pChunk);
+    pChunk->pOwnerSet = NULL;
+    pChunk->fFlags   &= ~GMM_CHUNK_FLAGS_SEEDED;
+    pChunk->hGVM      = NIL_GVM_HANDLE;
+    gmmR0SelectSetAndLinkChunk(pGMM, pGVM, pChunk);
+}
+
+
 /**
  * Frees a Chunk ID.
  *
@@ -2132,7 +2244,9 @@ static int gmmR0RegisterChunk(PGMM pGMM, PGMMCHUNKFREESET pSet, RTR0MEMOBJ MemOb
 {
     Assert(pGMM->hMtxOwner != RTThreadNativeSelf());
     Assert(hGVM != NIL_GVM_HANDLE || pGMM->fBoundMemoryMode);
-    Assert(fChunkFlags == 0 || fChunkFlags == GMM_CHUNK_FLAGS_LARGE_PAGE);
+    Assert(   fChunkFlags == 0
+           || fChunkFlags == GMM_CHUNK_FLAGS_LARGE_PAGE
+           || fChunkFlags == (GMM_CHUNK_FLAGS_LARGE_PAGE | GMM_CHUNK_FLAGS_SEEDED));
 
     int rc;
     PGMMCHUNK pChunk = (PGMMCHUNK)RTMemAllocZ(sizeof(*pChunk));
@@ -3011,6 +3125,53 @@ GMMR0DECL(int) GMMR0AllocatePagesReq(PGVM pGVM, PVM pVM, VMCPUID idCpu, PGMMALLO
 }
 
 
+/**
+ * Allocates all the pages in a large page chunk on behalf of a VM.
+ *
+ * @param   pGMM        Pointer to the GMM instance data.
+ * @param   pGVM        Pointer to the GVM instance.
+ * @param   pChunk      The large page chunk, all pages must be free.
+ * @param   pSet        The free set to link the chunk into afterwards.
+ * @param   pIdPage     Where to return the GMM page ID of the page.
+ * @param   pHCPhys     Where to return the host physical address of the page.
+ */
+static void gmmR0AllocateLargePageChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk, PGMMCHUNKFREESET pSet,
+                                        uint32_t *pIdPage, RTHCPHYS *pHCPhys)
+{
+    const unsigned cPages = (GMM_CHUNK_SIZE >> PAGE_SHIFT);
+    Assert(pChunk->cFree == cPages);
+    Assert(pChunk->fFlags & GMM_CHUNK_FLAGS_LARGE_PAGE);
+
+    /* Unlink the chunk from the free list. */
+    gmmR0UnlinkChunk(pChunk);
+
+    /* A recycled chunk has its pages on the free list in the order they were
+       freed, but the large page must start with the first one. */
+    for (unsigned iPage = 0; iPage < cPages; iPage++)
+        pChunk->aPages[iPage].Free.iNext = iPage + 1 < cPages ? iPage + 1 : UINT16_MAX;
+    pChunk->iFreeHead = 0;
+
+    /** @todo rewrite this to skip the looping. */
+    /* Allocate all pages. */
+    GMMPAGEDESC PageDesc;
+    gmmR0AllocatePage(pChunk, pGVM->hSelf, &PageDesc);
+
+    /* Return the first page as we'll use the whole chunk as one big page. */
+    *pIdPage = PageDesc.idPage;
+    *pHCPhys = PageDesc.HCPhysGCPhys;
+
+    for (unsigned i = 1; i < cPages; i++)
+        gmmR0AllocatePage(pChunk, pGVM->hSelf, &PageDesc);
+
+    /* Update accounting. */
+    pGVM->gmm.s.Stats.Allocated.cBasePages += cPages;
+    pGVM->gmm.s.Stats.cPrivatePages        += cPages;
+    pGMM->cAllocatedPages                  += cPages;
+
+    gmmR0LinkChunk(pChunk, pSet);
+}
+
+
 /**
  * Allocate a large page to represent guest RAM
  *
@@ -3087,30 +3248,7 @@ GMMR0DECL(int)  GMMR0AllocateLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32
             rc = gmmR0RegisterChunk(pGMM, pSet, hMemObj, pGVM->hSelf, GMM_CHUNK_FLAGS_LARGE_PAGE, &pChunk);
             if (RT_SUCCESS(rc))
             {
-                /*
-                 * Allocate all the pages in the chunk.
-                 */
-                /* Unlink the new chunk from the free list. */
-                gmmR0UnlinkChunk(pChunk);
-
-                /** @todo rewrite this to skip the looping. */
-                /* Allocate all pages. */
-                GMMPAGEDESC PageDesc;
-                gmmR0AllocatePage(pChunk, pGVM->hSelf, &PageDesc);
-
-                /* Return the first page as we'll use the whole chunk as one big page. */
-                *pIdPage = PageDesc.idPage;
-                *pHCPhys = PageDesc.HCPhysGCPhys;
-
-                for (unsigned i = 1; i < cPages; i++)
-                    gmmR0AllocatePage(pChunk, pGVM->hSelf, &PageDesc);
-
-                /* Update accounting. */
-                pGVM->gmm.s.Stats.Allocated.cBasePages += cPages;
-                pGVM->gmm.s.Stats.cPrivatePages        += cPages;
-                pGMM->cAllocatedPages                  += cPages;
-
-                gmmR0LinkChunk(pChunk, pSet);
+                gmmR0AllocateLargePageChunk(pGMM, pGVM, pChunk, pSet, pIdPage, pHCPhys);
                 gmmR0MutexRelease(pGMM);
             }
             else
@@ -3128,6 +3266,130 @@ GMMR0DECL(int)  GMMR0AllocateLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32
 }
 
 
+/**
+ * Allocate a large page to represent guest RAM, using memory supplied by
+ * ring-3.
+ *
+ * This is for hosts where ring-3 can get hold of memory that is backed by host
+ * large pages (hugetlbfs, transparent huge pages).  Unlike the chunks allocated
+ * by GMMR0AllocateLargePage, the owner VM accesses a seeded chunk thru the
+ * ring-3 mapping it supplied, so the host large page mapping is retained there
+ * too.  The chunk is private to the VM and kept around when its pages are
+ * freed, a later call will recycle it before asking for more memory.
+ *
+ * @returns VBox status code:
+ * @retval  VERR_GMM_SEED_ME if @a pvR3 is NIL and there are no seeded chunks
+ *          available for recycling.
+ * @retval  VERR_GMM_SEED_NOT_LARGE_PAGE if the memory at @a pvR3 isn't backed
+ *          by a physically contiguous and aligned large page.
+ * @param   pGVM        The global (ring-0) VM structure.
+ * @param   pVM         The cross context VM structure.
+ * @param   idCpu       The VCPU id.
+ * @param   pvR3        Pointer to the large page sized and aligned block of
+ *                      memory to lock down.  NIL_RTR3PTR to only try recycle
+ *                      a previously seeded chunk.
+ * @param   pIdPage     Where to return the GMM page ID of the page.
+ * @param   pHCPhys     Where to return the host physical address of the page.
+ */
+GMMR0DECL(int)  GMMR0SeedLargePage(PGVM pGVM, PVM pVM, VMCPUID idCpu, RTR3PTR pvR3, uint32_t *pIdPage, RTHCPHYS *pHCPhys)
+{
+    LogFlow(("GMMR0SeedLargePage: pGVM=%p pVM=%p pvR3=%RHv\n", pGVM, pVM, pvR3));
+
+    AssertReturn(!(pvR3 & (GMM_CHUNK_SIZE - 1)), VERR_INVALID_POINTER);
+    AssertPtrReturn(pIdPage, VERR_INVALID_PARAMETER);
+    AssertPtrReturn(pHCPhys, VERR_INVALID_PARAMETER);
+
+    /*
+     * Validate, get basics and take the semaphore.
+     */
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    int rc = GVMMR0ValidateGVMandVMandEMT(pGVM, pVM, idCpu);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    *pHCPhys = NIL_RTHCPHYS;
+    *pIdPage = NIL_GMM_PAGEID;
+
+    const unsigned cPages = (GMM_CHUNK_SIZE >> PAGE_SHIFT);
+    gmmR0MutexAcquire(pGMM);
+    if (!GMM_CHECK_SANITY_UPON_ENTERING(pGMM))
+    {
+        gmmR0MutexRelease(pGMM);
+        return VERR_GMM_IS_NOT_SANE;
+    }
+    if (RT_UNLIKELY(  pGVM->gmm.s.Stats.Allocated.cBasePages + pGVM->gmm.s.Stats.cBalloonedPages + cPages
+                    > pGVM->gmm.s.Stats.Reserved.cBasePages))
+    {
+        Log(("GMMR0SeedLargePage: Reserved=%#llx Allocated+Requested=%#llx+%#x!\n",
+             pGVM->gmm.s.Stats.Reserved.cBasePages, pGVM->gmm.s.Stats.Allocated.cBasePages, cPages));
+        gmmR0MutexRelease(pGMM);
+        return VERR_GMM_HIT_VM_ACCOUNT_LIMIT;
+    }
+
+    /*
+     * Recycle a previously seeded chunk if one has been freed up entirely.
+     */
+    for (PGMMCHUNK pChunk = pGVM->gmm.s.Private.apLists[GMM_CHUNK_FREE_SET_UNUSED_LIST]; pChunk; pChunk = pChunk->pFreeNext)
+        if (   (pChunk->fFlags & GMM_CHUNK_FLAGS_SEEDED)
+            && pChunk->hGVM == pGVM->hSelf)
+        {
+            gmmR0AllocateLargePageChunk(pGMM, pGVM, pChunk, &pGVM->gmm.s.Private, pIdPage, pHCPhys);
+            GMM_CHECK_SANITY_UPON_LEAVING(pGMM);
+            gmmR0MutexRelease(pGMM);
+            LogFlow(("GMMR0SeedLargePage: recycled chunk %#x\n", pChunk->Core.Key));
+            return VINF_SUCCESS;
+        }
+    gmmR0MutexRelease(pGMM);
+    if (pvR3 == NIL_RTR3PTR)
+        return VERR_GMM_SEED_ME;
+
+    /*
+     * Lock the memory and check that it's a single large page on the host.
+     */
+    RTR0MEMOBJ hMemObj;
+    rc = RTR0MemObjLockUser(&hMemObj, pvR3, GMM_CHUNK_SIZE, RTMEM_PROT_READ | RTMEM_PROT_WRITE, NIL_RTR0PROCESS);
+    if (RT_SUCCESS(rc))
+    {
+        RTHCPHYS const HCPhysFirst = RTR0MemObjGetPagePhysAddr(hMemObj, 0);
+        if (!(HCPhysFirst & (GMM_CHUNK_SIZE - 1)))
+        {
+            for (unsigned iPage = 1; iPage < cPages; iPage++)
+                if (RTR0MemObjGetPagePhysAddr(hMemObj, iPage) != HCPhysFirst + ((RTHCPHYS)iPage << PAGE_SHIFT))
+                {
+                    rc = VERR_GMM_SEED_NOT_LARGE_PAGE;
+                    break;
+                }
+        }
+        else
+            rc = VERR_GMM_SEED_NOT_LARGE_PAGE;
+
+        /*
+         * Add it as a new chunk with our hGVM and hand out all its pages.
+         * (The GMM locking is done inside gmmR0RegisterChunk.)
+         */
+        if (RT_SUCCESS(rc))
+        {
+            PGMMCHUNK pChunk;
+            rc = gmmR0RegisterChunk(pGMM, &pGVM->gmm.s.Private, hMemObj, pGVM->hSelf,
+                                    GMM_CHUNK_FLAGS_LARGE_PAGE | GMM_CHUNK_FLAGS_SEEDED, &pChunk);
+            if (RT_SUCCESS(rc))
+            {
+                if (!pGMM->fBoundMemoryMode)
+                    pChunk->pOwnerSet = &pGVM->gmm.s.Private;
+                gmmR0AllocateLargePageChunk(pGMM, pGVM, pChunk, &pGVM->gmm.s.Private, pIdPage, pHCPhys);
+                gmmR0MutexRelease(pGMM);
+            }
+        }
+        if (RT_FAILURE(rc))
+            RTR0MemObjFree(hMemObj, false /* fFreeMappings */);
+    }
+
+    LogFlow(("GMMR0SeedLargePage: returns %Rrc (HCPhys=%RHp)\n", rc, *pHCPhys));
+    return rc;
+}
+
+
 /**
  * Free a large page.
  *
@@ -3367,7 +3629,8 @@ static void gmmR0FreePageWorker(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk, uint32_t
     if (RT_UNLIKELY(   pChunk->cFree == GMM_CHUNK_NUM_PAGES
                     && pChunk->pFreeNext
                     && pChunk->pFreePrev /** @todo this is probably misfiring, see reset... */
-                    && !pGMM->fLegacyAllocationMode))
+                    && !pGMM->fLegacyAllocationMode
+                    && !(pChunk->fFlags & GMM_CHUNK_FLAGS_SEEDED)))
         gmmR0FreeChunk(pGMM, NULL, pChunk, false);
 
 }
@@ -3941,7 +4204,9 @@ static int gmmR0UnmapChunkLocked(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk)
  */
 static int gmmR0UnmapChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk, bool fRelaxedSem)
 {
-    if (!pGMM->fLegacyAllocationMode)
+    if (   !pGMM->fLegacyAllocationMode
+        && (   !(pChunk->fFlags & GMM_CHUNK_FLAGS_SEEDED)
+            || pChunk->hGVM != pGVM->hSelf))
     {
         /*
          * Lock the chunk and if possible leave the giant GMM lock.
@@ -3979,9 +4244,11 @@ static int gmmR0UnmapChunk(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk, bool fRelaxed
 static int gmmR0MapChunkLocked(PGMM pGMM, PGVM pGVM, PGMMCHUNK pChunk, PRTR3PTR ppvR3)
 {
     /*
-     * If we're in legacy mode this is simple.
+     * If we're in legacy mode or the chunk was seeded by the caller, this is simple.
      */
-    if (pGMM->fLegacyAllocationMode)
+    if (   pGMM->fLegacyAllocationMode
+        || (   (pChunk->fFlags & GMM_CHUNK_FLAGS_SEEDED)
+            && pChunk->hGVM == pGVM->hSelf))
     {
         if (pChunk->hGVM != pGVM->hSelf)
         {
@@ -5199,6 +5466,291 @@ GMMR0DECL(int) GMMR0CheckSharedModules(PGVM pGVM, PVM pVM, VMCPUID idCpu)
 #endif
 }
 
+#ifdef VBOX_WITH_PAGE_SHARING
+
+/**
+ * Calculates the content hash used as key in the deduplication index.
+ *
+ * @returns 32-bit hash of the page content.
+ * @param   pbPage      The page.
+ */
+static uint32_t gmmR0DedupHashPage(uint8_t const *pbPage)
+{
+    /* FNV-1a style over 64-bit words, folded to 32 bits. */
+    uint64_t const *pu64  = (uint64_t const *)pbPage;
+    uint64_t        uHash = UINT64_C(0xcbf29ce484222325);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+        uHash = (uHash ^ pu64[i]) * UINT64_C(0x00000100000001b3);
+    return (uint32_t)(uHash ^ (uHash >> 32));
+}
+
+
+/**
+ * Checks a private guest page against the content deduplication index.
+ *
+ * Performs the following tasks:
+ *  - If no page with the same hash is known, the page is recorded as a
+ *    candidate and nothing changes.
+ *  - If a candidate page with the same hash and identical content exists, the
+ *    page is converted to a shared page and becomes the reference copy for
+ *    that hash; the candidate (and later scanned duplicates) are merged into
+ *    it when they're scanned.
+ *  - If a shared reference page exists and its content is identical, the page
+ *    is freed and the shared page is returned in the pPageDesc descriptor.
+ *
+ * Zero filled pages are ignored and reported back via @a pfZeroPage.
+ *
+ * @remarks ASSUMES the caller has acquired the GMM semaphore!!
+ *
+ * @returns VBox status code.
+ * @param   pGVM        Pointer to the GVM instance data.
+ * @param   pPageDesc   Page descriptor.  idPage is set to NIL_GMM_PAGEID if
+ *                      nothing changed, otherwise idPage and HCPhys describe
+ *                      the (possibly new) page backing the guest page.
+ * @param   pfZeroPage  Where to return whether the page is zero filled.
+ */
+GMMR0DECL(int) GMMR0DedupCheckPage(PGVM pGVM, PGMMSHAREDPAGEDESC pPageDesc, bool *pfZeroPage)
+{
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    pPageDesc->u32StrictChecksum = 0;
+    *pfZeroPage = false;
+
+    uint32_t const idPage = pPageDesc->idPage;
+    PGMMPAGE       pPage  = gmmR0GetPage(pGMM, idPage);
+    AssertMsgReturn(pPage && GMM_PAGE_IS_PRIVATE(pPage), ("idPage=%#x GCPhys=%RGp\n", idPage, pPageDesc->GCPhys),
+                    VERR_PGM_PHYS_INVALID_PAGE_ID);
+
+    /*
+     * Get the virtual address of the local page and hash it.
+     */
+    PGMMCHUNK pChunk = gmmR0GetChunk(pGMM, idPage >> GMM_CHUNKID_SHIFT);
+    AssertMsgReturn(pChunk, ("idPage=%#x GCPhys=%RGp\n", idPage, pPageDesc->GCPhys), VERR_PGM_PHYS_INVALID_PAGE_ID);
+
+    int      rc;
+    uint8_t *pbChunk;
+    if (!gmmR0IsChunkMapped(pGMM, pGVM, pChunk, (PRTR3PTR)&pbChunk))
+    {
+        rc = gmmR0MapChunk(pGMM, pGVM, pChunk, false /*fRelaxedSem*/, (PRTR3PTR)&pbChunk);
+        AssertRCReturn(rc, rc);
+    }
+    uint8_t const *pbLocalPage = pbChunk + ((idPage & GMM_PAGEID_IDX_MASK) << PAGE_SHIFT);
+
+    if (ASMMemIsZeroPage(pbLocalPage))
+    {
+        *pfZeroPage = true;
+        pPageDesc->idPage = NIL_GMM_PAGEID;
+        return VINF_SUCCESS;
+    }
+
+    uint32_t const uHash  = gmmR0DedupHashPage(pbLocalPage);
+    PGMMDEDUPENTRY pEntry = (PGMMDEDUPENTRY)RTAvlU32Get(&pGMM->pDedupTree, uHash);
+    if (!pEntry)
+    {
+        /*
+         * First page with this content, remember it as a candidate.
+         */
+        if (pGMM->cDedupEntries < GMM_DEDUP_MAX_ENTRIES)
+        {
+            pEntry = (PGMMDEDUPENTRY)RTMemAlloc(sizeof(*pEntry));
+            if (pEntry)
+            {
+                pEntry->Core.Key = uHash;
+                pEntry->idPage   = idPage;
+                pEntry->hGVM     = pGVM->hSelf;
+                pEntry->fShared  = false;
+                bool fRc = RTAvlU32Insert(&pGMM->pDedupTree, &pEntry->Core); Assert(fRc); NOREF(fRc);
+                RTListAppend(&pGVM->gmm.s.DedupCandidateList, &pEntry->ListNode);
+                pGMM->cDedupEntries++;
+            }
+        }
+        pPageDesc->idPage = NIL_GMM_PAGEID;
+        return VINF_SUCCESS;
+    }
+
+    if (pEntry->idPage == idPage)
+    {
+        /* Seen this very page before and nobody has matched it since. */
+        pPageDesc->idPage = NIL_GMM_PAGEID;
+        return VINF_SUCCESS;
+    }
+
+    PGMMPAGE pRefPage = gmmR0GetPage(pGMM, pEntry->idPage);
+    if (pEntry->fShared)
+    {
+        if (pRefPage && GMM_PAGE_IS_SHARED(pRefPage))
+        {
+            /*
+             * Calculate the virtual address of the shared page, mapping the
+             * chunk into the VM process if not already done, and compare.
+             */
+            pChunk = gmmR0GetChunk(pGMM, pEntry->idPage >> GMM_CHUNKID_SHIFT);
+            Assert(pChunk); /* can't fail as gmmR0GetPage succeeded. */
+            if (!gmmR0IsChunkMapped(pGMM, pGVM, pChunk, (PRTR3PTR)&pbChunk))
+            {
+                rc = gmmR0MapChunk(pGMM, pGVM, pChunk, false /*fRelaxedSem*/, (PRTR3PTR)&pbChunk);
+                AssertRCReturn(rc, rc);
+            }
+            uint8_t const *pbSharedPage = pbChunk + ((pEntry->idPage & GMM_PAGEID_IDX_MASK) << PAGE_SHIFT);
+
+            if (!memcmp(pbSharedPage, pbLocalPage, PAGE_SIZE))
+            {
+#ifdef VBOX_STRICT
+                pPageDesc->u32StrictChecksum = RTCrc32(pbSharedPage, PAGE_SIZE);
+#endif
+                /*
+                 * Free the local page and pass along the shared one.
+                 */
+                GMMFREEPAGEDESC PageDesc;
+                PageDesc.idPage = idPage;
+                rc = gmmR0FreePages(pGMM, pGVM, 1, &PageDesc, GMMACCOUNT_BASE);
+                AssertRCReturn(rc, rc);
+
+                gmmR0UseSharedPage(pGMM, pGVM, pRefPage);
+                pGMM->cDedupMergedPages++;
+
+                pPageDesc->HCPhys = ((uint64_t)pRefPage->Shared.pfn) << PAGE_SHIFT;
+                pPageDesc->idPage = pEntry->idPage;
+                return VINF_SUCCESS;
+            }
+            Log(("GMMR0DedupCheckPage: hash collision %#x: idPage=%#x vs shared %#x\n", uHash, idPage, pEntry->idPage));
+        }
+    }
+    else if (pRefPage && GMM_PAGE_IS_PRIVATE(pRefPage))
+    {
+        /*
+         * Another private page with the same hash.  Compare the contents
+         * before turning this one into the shared reference copy, or a hash
+         * collision costs a copy-on-write fault for nothing.  The candidate
+         * may belong to another VM, so its chunk is only mapped into this VM
+         * process for the duration of the compare.
+         */
+        pChunk = gmmR0GetChunk(pGMM, pEntry->idPage >> GMM_CHUNKID_SHIFT);
+        Assert(pChunk); /* can't fail as gmmR0GetPage succeeded. */
+        bool const fMapped = gmmR0IsChunkMapped(pGMM, pGVM, pChunk, (PRTR3PTR)&pbChunk);
+        if (!fMapped)
+        {
+            rc = gmmR0MapChunk(pGMM, pGVM, pChunk, false /*fRelaxedSem*/, (PRTR3PTR)&pbChunk);
+            AssertRCReturn(rc, rc);
+        }
+        bool const fIdentical = !memcmp(pbChunk + ((pEntry->idPage & GMM_PAGEID_IDX_MASK) << PAGE_SHIFT),
+                                        pbLocalPage, PAGE_SIZE);
+        if (!fMapped)
+            gmmR0UnmapChunk(pGMM, pGVM, pChunk, false /*fRelaxedSem*/);
+
+        if (fIdentical)
+        {
+            gmmR0ConvertToSharedPage(pGMM, pGVM, pPageDesc->HCPhys, idPage, pPage, pPageDesc);
+            RTListNodeRemove(&pEntry->ListNode);
+            pEntry->idPage  = idPage;
+            pEntry->hGVM    = pGVM->hSelf;
+            pEntry->fShared = true;
+            return VINF_SUCCESS;
+        }
+        Log(("GMMR0DedupCheckPage: hash collision %#x: idPage=%#x vs candidate %#x\n", uHash, idPage, pEntry->idPage));
+    }
+
+    /*
+     * Stale entry (page freed or changed state) or a hash collision; make
+     * this page the new candidate.
+     */
+    if (!pEntry->fShared)
+        RTListNodeRemove(&pEntry->ListNode);
+    RTListAppend(&pGVM->gmm.s.DedupCandidateList, &pEntry->ListNode);
+    pEntry->idPage  = idPage;
+    pEntry->hGVM    = pGVM->hSelf;
+    pEntry->fShared = false;
+    pPageDesc->idPage = NIL_GMM_PAGEID;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Removes the deduplication candidates of a terminating VM.
+ *
+ * Shared reference entries are kept as the pages may outlive the VM.
+ *
+ * @remarks ASSUMES the caller has acquired the GMM semaphore!!
+ *
+ * @param   pGMM        Pointer to the GMM instance.
+ * @param   pGVM        Pointer to the GVM instance.
+ */
+static void gmmR0DedupPurgeVM(PGMM pGMM, PGVM pGVM)
+{
+    PGMMDEDUPENTRY pEntry, pNext;
+    RTListForEachSafe(&pGVM->gmm.s.DedupCandidateList, pEntry, pNext, GMMDEDUPENTRY, ListNode)
+    {
+        Assert(!pEntry->fShared && pEntry->hGVM == pGVM->hSelf);
+        PAVLU32NODECORE pRemoved = RTAvlU32Remove(&pGMM->pDedupTree, pEntry->Core.Key);
+        Assert(pRemoved == &pEntry->Core); NOREF(pRemoved);
+        RTListNodeRemove(&pEntry->ListNode);
+        RTMemFree(pEntry);
+        pGMM->cDedupEntries--;
+    }
+}
+
+
+/**
+ * RTAvlU32Destroy callback for the deduplication index.
+ *
+ * @returns 0
+ * @param   pNode       The node (GMMDEDUPENTRY) to destroy.
+ * @param   pvUser      Ignored.
+ */
+static DECLCALLBACK(int) gmmR0DedupDestroyEntry(PAVLU32NODECORE pNode, void *pvUser)
+{
+    NOREF(pvUser);
+    RTMemFree(pNode);
+    return 0;
+}
+
+#endif /* VBOX_WITH_PAGE_SHARING */
+
+/**
+ * Scans a slice of the guest RAM of the specified VM for pages with content
+ * identical to pages of this or other VMs and merges them.
+ *
+ * @returns VBox status code.
+ * @param   pGVM        The global (ring-0) VM structure.
+ * @param   pVM         The cross context VM structure.
+ * @param   idCpu       The calling EMT number.
+ * @param   cMaxPages   The max number of guest pages to examine.
+ * @thread  EMT(idCpu)
+ */
+GMMR0DECL(int) GMMR0ScanForDuplicatePages(PGVM pGVM, PVM pVM, VMCPUID idCpu, uint32_t cMaxPages)
+{
+#ifdef VBOX_WITH_PAGE_SHARING
+    /*
+     * Validate input and get the basics.
+     */
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    int rc = GVMMR0ValidateGVMandVMandEMT(pGVM, pVM, idCpu);
+    if (RT_FAILURE(rc))
+        return rc;
+    if (pGMM->fLegacyAllocationMode)
+        return VERR_NOT_SUPPORTED;
+
+    /*
+     * Take the semaphore and do some more validations.
+     */
+    gmmR0MutexAcquire(pGMM);
+    if (GMM_CHECK_SANITY_UPON_ENTERING(pGMM))
+    {
+        rc = PGMR0SharedPageScan(pVM, pGVM, idCpu, cMaxPages);
+        GMM_CHECK_SANITY_UPON_LEAVING(pGMM);
+    }
+    else
+        rc = VERR_GMM_IS_NOT_SANE;
+
+    gmmR0MutexRelease(pGMM);
+    return rc;
+#else
+    RT_NOREF(pGVM, pVM, idCpu, cMaxPages);
+    return VERR_NOT_IMPLEMENTED;
+#endif
+}
+
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
 
 /**
@@ -5369,7 +5921,8 @@ GMMR0DECL(int) GMMR0QueryStatistics(PGMMSTATS pStats, PSUPDRVSESSION pSession, P
     pStats->cChunks                     = pGMM->cChunks;
     pStats->cFreedChunks                = pGMM->cFreedChunks;
     pStats->cShareableModules           = pGMM->cShareableModules;
-    RT_ZERO(pStats->au64Reserved);
+    pStats->cDedupEntries               = pGMM->cDedupEntries;
+    pStats->cDedupMergedPages           = pGMM->cDedupMergedPages;
 
     /*
      * Copy out the VM statistics.
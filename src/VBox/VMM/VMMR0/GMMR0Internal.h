@@ -20,6 +20,7 @@
 
 #include <VBox/vmm/gmm.h>
 #include <iprt/avl.h>
+#include <iprt/list.h>
 
 
 /**
@@ -81,6 +82,9 @@ typedef struct GMMPERVM
     PAVLGCPTRNODECORE   pSharedModuleTree;
     /** Hints at the last chunk we allocated some memory from. */
     uint32_t            idLastChunkHint;
+    /** The content deduplication candidates owned by this VM (GMMDEDUPENTRY),
+     * so they can be purged without walking the whole index. */
+    RTLISTANCHOR        DedupCandidateList;
 } GMMPERVM;
 /** Pointer to the per-VM GMM data. */
 typedef GMMPERVM *PGMMPERVM;
@@ -2525,6 +2525,41 @@ GVMMR0DECL(int) GVMMR0SchedPokeNoGVMNoLock(PVM pVM, VMCPUID idCpu)
 }
 
 
+/**
+ * Worker for GVMMR0SchedWakeUpAndPokeCpus and
+ * GVMMR0SchedWakeUpAndPokeCpusNoGVMNoLock.
+ *
+ * @param   pGVM                The global (ring-0) VM structure.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSleepSet           The set of sleepers to wake up.
+ * @param   pPokeSet            The set of CPUs to poke.
+ */
+static void gvmmR0SchedWakeUpAndPokeCpusWorker(PGVM pGVM, PVM pVM, PCVMCPUSET pSleepSet, PCVMCPUSET pPokeSet)
+{
+    GVMM_CHECK_SMAP_SETUP();
+    RTNATIVETHREAD hSelf = RTThreadNativeSelf();
+    VMCPUID idCpu = pGVM->cCpus;
+    while (idCpu-- > 0)
+    {
+        /* Don't try poke or wake up ourselves. */
+        if (pGVM->aCpus[idCpu].hEMT == hSelf)
+            continue;
+
+        /* just ignore errors for now. */
+        if (VMCPUSET_IS_PRESENT(pSleepSet, idCpu))
+        {
+            gvmmR0SchedWakeUpOne(pGVM, &pGVM->aCpus[idCpu]);
+            GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+        }
+        else if (VMCPUSET_IS_PRESENT(pPokeSet, idCpu))
+        {
+            gvmmR0SchedPokeOne(pGVM, &pVM->aCpus[idCpu]);
+            GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+        }
+    }
+}
+
+
 /**
  * Wakes up a set of halted EMT threads so they can service pending request.
  *
@@ -2541,7 +2576,6 @@ GVMMR0DECL(int) GVMMR0SchedWakeUpAndPokeCpus(PGVM pGVM, PVM pVM, PCVMCPUSET pSle
     AssertPtrReturn(pPokeSet, VERR_INVALID_POINTER);
     GVMM_CHECK_SMAP_SETUP();
     GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
-    RTNATIVETHREAD hSelf = RTThreadNativeSelf();
 
     /*
      * Validate input and take the UsedLock.
@@ -2552,25 +2586,7 @@ GVMMR0DECL(int) GVMMR0SchedWakeUpAndPokeCpus(PGVM pGVM, PVM pVM, PCVMCPUSET pSle
     if (RT_SUCCESS(rc))
     {
         rc = VINF_SUCCESS;
-        VMCPUID idCpu = pGVM->cCpus;
-        while (idCpu-- > 0)
-        {
-            /* Don't try poke or wake up ourselves. */
-            if (pGVM->aCpus[idCpu].hEMT == hSelf)
-                continue;
-
-            /* just ignore errors for now. */
-            if (VMCPUSET_IS_PRESENT(pSleepSet, idCpu))
-            {
-                gvmmR0SchedWakeUpOne(pGVM, &pGVM->aCpus[idCpu]);
-                GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
-            }
-            else if (VMCPUSET_IS_PRESENT(pPokeSet, idCpu))
-            {
-                gvmmR0SchedPokeOne(pGVM, &pVM->aCpus[idCpu]);
-                GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
-            }
-        }
+        gvmmR0SchedWakeUpAndPokeCpusWorker(pGVM, pVM, pSleepSet, pPokeSet);
 
         int rc2 = GVMMR0_USED_SHARED_UNLOCK(pGVMM);
         AssertRC(rc2);
@@ -2582,6 +2598,40 @@ GVMMR0DECL(int) GVMMR0SchedWakeUpAndPokeCpus(PGVM pGVM, PVM pVM, PCVMCPUSET pSle
 }
 
 
+/**
+ * Wakes up a set of halted EMT threads and pokes another set, no GVM parameter
+ * and no used locking.
+ *
+ * This is for device emulation code in ring-0 (e.g. the APIC sending an IPI to
+ * several VCPUs) that would otherwise call GVMMR0SchedWakeUpNoGVMNoLock or
+ * GVMMR0SchedPokeNoGVMNoLock once for each target.
+ *
+ * @returns VBox status code, no informational stuff.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSleepSet           The set of sleepers to wake up.
+ * @param   pPokeSet            The set of CPUs to poke.
+ * @thread  EMT.
+ */
+GVMMR0DECL(int) GVMMR0SchedWakeUpAndPokeCpusNoGVMNoLock(PVM pVM, PCVMCPUSET pSleepSet, PCVMCPUSET pPokeSet)
+{
+    AssertPtrReturn(pSleepSet, VERR_INVALID_POINTER);
+    AssertPtrReturn(pPokeSet, VERR_INVALID_POINTER);
+    GVMM_CHECK_SMAP_SETUP();
+    GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+    PGVM pGVM;
+    PGVMM pGVMM;
+    int rc = gvmmR0ByVM(pVM, &pGVM, &pGVMM, false /*fTakeUsedLock*/);
+    GVMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VINF_SUCCESS;
+        gvmmR0SchedWakeUpAndPokeCpusWorker(pGVM, pVM, pSleepSet, pPokeSet);
+    }
+    return rc;
+}
+
+
 /**
  * VMMR0 request wrapper for GVMMR0SchedWakeUpAndPokeCpus.
  *
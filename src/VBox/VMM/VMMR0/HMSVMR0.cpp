@@ -26,6 +26,7 @@
 
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/dbgf.h>
+#include <VBox/vmm/dbgftrace.h>
 #include <VBox/vmm/iem.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/tm.h>
@@ -319,6 +320,8 @@ typedef struct SVMTRANSIENT
     /** Whether the \#VMEXIT was caused by a page-fault during delivery of an
      *  external interrupt or NMI. */
     bool            fVectoringPF;
+    /** The host TSC at the time of the \#VMEXIT (for the binary event trace). */
+    uint64_t        uHostTscExit;
 } SVMTRANSIENT, *PSVMTRANSIENT;
 AssertCompileMemberAlignment(SVMTRANSIENT, u64ExitCode, sizeof(uint64_t));
 AssertCompileMemberAlignment(SVMTRANSIENT, pVmcb,       sizeof(uint64_t));
@@ -4700,6 +4703,7 @@ static void hmR0SvmPostRunGuest(PVMCPU pVCpu, PSVMTRANSIENT pSvmTransient, int r
     Assert(!VMMRZCallRing3IsEnabled(pVCpu));
 
     uint64_t const uHostTsc = ASMReadTSC();                     /* Read the TSC as soon as possible. */
+    pSvmTransient->uHostTscExit = uHostTsc;
     ASMAtomicWriteBool(&pVCpu->hm.s.fCheckedTLBFlush, false);   /* See HMInvalidatePageOnAllVCpus(): used for TLB flushing. */
     ASMAtomicIncU32(&pVCpu->hm.s.cWorldSwitchExits);            /* Initialized in vmR3CreateUVM(): used for EMT poking. */
 
@@ -4872,6 +4876,9 @@ static int hmR0SvmRunGuestCodeNormal(PVMCPU pVCpu, uint32_t *pcLoops)
         VBOXVMM_R0_HMSVM_VMEXIT(pVCpu, &pVCpu->cpum.GstCtx, SvmTransient.u64ExitCode, pVCpu->hm.s.svm.pVmcb);
         rc = hmR0SvmHandleExit(pVCpu, &SvmTransient);
         STAM_PROFILE_ADV_STOP(&pVCpu->hm.s.StatExitHandling, x);
+        if (DBGFTRACEEVT_IS_ENABLED(pVCpu, DBGFTRACEEVT_F_EXIT))
+            DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_EXIT, SvmTransient.uHostTscExit, 0, 0,
+                            EMEXIT_MAKE_FT(EMEXIT_F_KIND_SVM, SvmTransient.u64ExitCode & EMEXIT_F_TYPE_MASK), (int64_t)rc);
         if (rc != VINF_SUCCESS)
             break;
         if (++(*pcLoops) >= cMaxResumeLoops)
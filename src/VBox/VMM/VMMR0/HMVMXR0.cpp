@@ -27,6 +27,7 @@
 
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/dbgf.h>
+#include <VBox/vmm/dbgftrace.h>
 #include <VBox/vmm/iem.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/selm.h>
@@ -289,6 +290,8 @@ typedef struct VMXTRANSIENT
     /** Whether the VM-exit was caused by a page-fault during delivery of an
      *  external interrupt or NMI. */
     bool            fVectoringPF;
+    /** The host TSC at the time of the VM-exit (for the binary event trace). */
+    uint64_t        uHostTscExit;
 } VMXTRANSIENT;
 AssertCompileMemberAlignment(VMXTRANSIENT, uExitReason,               sizeof(uint64_t));
 AssertCompileMemberAlignment(VMXTRANSIENT, uExitIntInfo,              sizeof(uint64_t));
@@ -8556,6 +8559,7 @@ static void hmR0VmxPostRunGuest(PVMCPU pVCpu, PVMXTRANSIENT pVmxTransient, int r
     AssertRC(rc);
     pVmxTransient->uExitReason    = (uint16_t)VMX_EXIT_REASON_BASIC(uExitReason);
     pVmxTransient->fVMEntryFailed = VMX_ENTRY_INT_INFO_IS_VALID(pVmxTransient->uEntryIntInfo);
+    pVmxTransient->uHostTscExit   = uHostTsc;
 
     if (rcVMRun == VINF_SUCCESS)
     {
@@ -8683,6 +8687,9 @@ static VBOXSTRICTRC hmR0VmxRunGuestCodeNormal(PVMCPU pVCpu)
         rcStrict = hmR0VmxHandleExit(pVCpu, &VmxTransient, VmxTransient.uExitReason);
 #endif
         STAM_PROFILE_ADV_STOP(&pVCpu->hm.s.StatExitHandling, x);
+        if (DBGFTRACEEVT_IS_ENABLED(pVCpu, DBGFTRACEEVT_F_EXIT))
+            DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_EXIT, VmxTransient.uHostTscExit, 0, 0,
+                            EMEXIT_MAKE_FT(EMEXIT_F_KIND_VMX, VmxTransient.uExitReason), (int64_t)VBOXSTRICTRC_VAL(rcStrict));
         if (rcStrict == VINF_SUCCESS)
         {
             if (cLoops <= pVCpu->CTX_SUFF(pVM)->hm.s.cMaxResumeLoops)
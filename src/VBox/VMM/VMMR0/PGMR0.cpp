@@ -256,6 +256,49 @@ VMMR0_INT_DECL(int) PGMR0PhysAllocateLargeHandyPage(PGVM pGVM, PVM pVM, VMCPUID
 }
 
 
+/**
+ * Allocates a large page (2MB) for use with a nested paging PDE from memory
+ * supplied by ring-3 (GMMR0SeedLargePage).
+ *
+ * @returns The following VBox status codes.
+ * @retval  VINF_SUCCESS on success.
+ * @retval  VERR_GMM_SEED_ME if @a pvR3 is NIL and ring-3 should supply the
+ *          memory.
+ *
+ * @param   pGVM        The global (ring-0) VM structure.
+ * @param   pVM         The cross context VM structure.
+ * @param   idCpu       The ID of the calling EMT.
+ * @param   pvR3        The large page sized and aligned ring-3 memory to use,
+ *                      NIL_RTR3PTR to try recycle a previously seeded page.
+ *
+ * @thread  EMT(idCpu)
+ *
+ * @remarks Must be called from within the PGM critical section. The caller
+ *          must clear the new pages.
+ */
+VMMR0_INT_DECL(int) PGMR0PhysSeedLargeHandyPage(PGVM pGVM, PVM pVM, VMCPUID idCpu, RTR3PTR pvR3)
+{
+    /*
+     * Validate inputs.
+     */
+    AssertReturn(idCpu < pGVM->cCpus, VERR_INVALID_CPU_ID); /* caller already checked this, but just to be sure. */
+    AssertReturn(pGVM->aCpus[idCpu].hEMT == RTThreadNativeSelf(), VERR_NOT_OWNER);
+    PGM_LOCK_ASSERT_OWNER_EX(pVM, &pVM->aCpus[idCpu]);
+    Assert(!pVM->pgm.s.cLargeHandyPages);
+
+    /*
+     * Do the job.
+     */
+    int rc = GMMR0SeedLargePage(pGVM, pVM, idCpu, pvR3,
+                                &pVM->pgm.s.aLargeHandyPage[0].idPage,
+                                &pVM->pgm.s.aLargeHandyPage[0].HCPhysGCPhys);
+    if (RT_SUCCESS(rc))
+        pVM->pgm.s.cLargeHandyPages = 1;
+
+    return rc;
+}
+
+
 #ifdef VBOX_WITH_PCI_PASSTHROUGH
 /* Interface sketch.  The interface belongs to a global PCI pass-through
    manager.  It shall use the global VM handle, not the user VM handle to
@@ -32,6 +32,65 @@
 
 
 #ifdef VBOX_WITH_PAGE_SHARING
+/**
+ * Applies a page change made by GMM to the PGM page.
+ *
+ * The page was either replaced by an existing shared version of it or
+ * converted into a read-only shared page, so, clear all references.
+ *
+ * The PGM lock shall be taken prior to calling this method.  Not for use in
+ * NEM mode, as the native API isn't told about the backing change.
+ *
+ * @returns true if the page was replaced by another host page, false if it
+ *          was converted in place.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pVCpu               The cross context virtual CPU structure of the
+ *                              calling EMT.
+ * @param   pPage               The PGM page (state ALLOCATED).
+ * @param   pPageDesc           The page descriptor GMM returned.
+ * @param   pfFlushTLBs         Where to indicate that the TLBs must be flushed.
+ *                              Not touched if no flush is required.
+ */
+static bool pgmR0SharedPageApply(PVM pVM, PVMCPU pVCpu, PPGMPAGE pPage, GMMSHAREDPAGEDESC const *pPageDesc, bool *pfFlushTLBs)
+{
+    Assert(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED);
+
+    bool fFlush = false;
+    int rc = pgmPoolTrackUpdateGCPhys(pVM, pPageDesc->GCPhys, pPage, true /* clear the entries */, &fFlush);
+    Assert(   rc == VINF_SUCCESS
+           || (   VMCPU_FF_IS_SET(pVCpu, VMCPU_FF_PGM_SYNC_CR3)
+               && (pVCpu->pgm.s.fSyncFlags & PGM_SYNC_CLEAR_PGM_POOL)));
+    if (rc == VINF_SUCCESS && fFlush)
+        *pfFlushTLBs = true;
+    NOREF(pVCpu);
+
+    bool fReplaced = false;
+    if (pPageDesc->HCPhys != PGM_PAGE_GET_HCPHYS(pPage))
+    {
+        /* Update the physical address and page id now. */
+        PGM_PAGE_SET_HCPHYS(pVM, pPage, pPageDesc->HCPhys);
+        PGM_PAGE_SET_PAGEID(pVM, pPage, pPageDesc->idPage);
+
+        /* Invalidate page map TLB entry for this page too. */
+        pgmPhysInvalidatePageMapTLBEntry(pVM, pPageDesc->GCPhys);
+        pVM->pgm.s.cReusedSharedPages++;
+        fReplaced = true;
+    }
+    /* else: nothing changed (== this page is now a shared
+       page), so no need to flush anything. */
+
+    pVM->pgm.s.cSharedPages++;
+    pVM->pgm.s.cPrivatePages--;
+    PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_SHARED);
+    pgmPhysPageMarkLiveSaveDirty(pVM, pPage, pPageDesc->GCPhys);
+
+# ifdef VBOX_STRICT /* check sum hack, bit 6 is taken by fLazyRestoreY */
+    pPage->s.u1Unused0 = pPageDesc->u32StrictChecksum & 1;
+# endif
+    return fReplaced;
+}
+
+
 /**
  * Check a registered module for shared page changes.
  *
@@ -58,6 +117,7 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
     Log(("PGMR0SharedModuleCheck: check %s %s base=%RGv size=%x\n", pModule->szName, pModule->szVersion, pModule->Core.Key, pModule->cbModule));
 
     PGM_LOCK_ASSERT_OWNER(pVM);     /* This cannot fail as we grab the lock in pgmR3SharedModuleRegRendezvous before calling into ring-0. */
+    AssertReturn(!VM_IS_NEM_ENABLED(pVM), VERR_NOT_SUPPORTED); /* NEM isn't notified by pgmR0SharedPageApply. */
 
     /*
      * Check every region of the shared module.
@@ -97,44 +157,10 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
                      */
                     if (PageDesc.idPage != NIL_GMM_PAGEID)
                     {
-                        Assert(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED);
-
                         Log(("PGMR0SharedModuleCheck: shared page gst virt=%RGv phys=%RGp host %RHp->%RHp\n",
                              GCPtrPage, PageDesc.GCPhys, PGM_PAGE_GET_HCPHYS(pPage), PageDesc.HCPhys));
-
-                        /* Page was either replaced by an existing shared
-                           version of it or converted into a read-only shared
-                           page, so, clear all references. */
-                        bool fFlush = false;
-                        rc = pgmPoolTrackUpdateGCPhys(pVM, PageDesc.GCPhys, pPage, true /* clear the entries */, &fFlush);
-                        Assert(   rc == VINF_SUCCESS
-                               || (   VMCPU_FF_IS_SET(pVCpu, VMCPU_FF_PGM_SYNC_CR3)
-                                   && (pVCpu->pgm.s.fSyncFlags & PGM_SYNC_CLEAR_PGM_POOL)));
-                        if (rc == VINF_SUCCESS)
-                            fFlushTLBs |= fFlush;
+                        pgmR0SharedPageApply(pVM, pVCpu, pPage, &PageDesc, &fFlushTLBs);
                         fFlushRemTLBs = true;
-
-                        if (PageDesc.HCPhys != PGM_PAGE_GET_HCPHYS(pPage))
-                        {
-                            /* Update the physical address and page id now. */
-                            PGM_PAGE_SET_HCPHYS(pVM, pPage, PageDesc.HCPhys);
-                            PGM_PAGE_SET_PAGEID(pVM, pPage, PageDesc.idPage);
-
-                            /* Invalidate page map TLB entry for this page too. */
-                            pgmPhysInvalidatePageMapTLBEntry(pVM, PageDesc.GCPhys);
-                            pVM->pgm.s.cReusedSharedPages++;
-                        }
-                        /* else: nothing changed (== this page is now a shared
-                           page), so no need to flush anything. */
-
-                        pVM->pgm.s.cSharedPages++;
-                        pVM->pgm.s.cPrivatePages--;
-                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_SHARED);
-
-# ifdef VBOX_STRICT /* check sum hack */
-                        pPage->s.u2Unused0 = PageDesc.u32StrictChecksum        & 3;
-                        //pPage->s.u2Unused1 = (PageDesc.u32StrictChecksum >> 8) & 3;
-# endif
                     }
                 }
             }
@@ -166,5 +192,113 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
 
     return rc;
 }
+
+
+/**
+ * Scans a slice of the guest RAM for pages with content identical to other
+ * pages of this or other VMs (page fusion content scanner).
+ *
+ * The scan resumes where the previous pass stopped (PGM::Dedup.GCPhysCursor)
+ * and wraps around after the last RAM range.  Only plain, unlocked RAM pages
+ * without access handlers and outside large pages are considered.
+ *
+ * The PGM lock and the GMM semaphore shall be taken prior to calling this
+ * method.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pGVM                Pointer to the GVM instance data.
+ * @param   idCpu               The ID of the calling virtual CPU.
+ * @param   cMaxPages           The max number of guest pages to examine.
+ */
+VMMR0DECL(int) PGMR0SharedPageScan(PVM pVM, PGVM pGVM, VMCPUID idCpu, uint32_t cMaxPages)
+{
+    PVMCPU              pVCpu         = &pVM->aCpus[idCpu];
+    int                 rc            = VINF_SUCCESS;
+    bool                fFlushTLBs    = false;
+    bool                fFlushRemTLBs = false;
+    RTGCPHYS            GCPhysCursor  = pVM->pgm.s.Dedup.GCPhysCursor;
+    uint32_t            cPagesLeft    = cMaxPages;
+
+    PGM_LOCK_ASSERT_OWNER(pVM);     /* This cannot fail as we grab the lock in pgmR3SharedPageScanRendezvous before calling into ring-0. */
+    AssertReturn(!VM_IS_NEM_ENABLED(pVM), VERR_NOT_SUPPORTED); /* NEM isn't notified by pgmR0SharedPageApply. */
+
+    /*
+     * Find the RAM range containing the cursor (or the next one above it).
+     */
+    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangesX);
+    while (pRam && pRam->GCPhysLast < GCPhysCursor)
+        pRam = pRam->CTX_SUFF(pNext);
+    if (!pRam)
+    {
+        pRam = pVM->pgm.s.CTX_SUFF(pRamRangesX);
+        GCPhysCursor = 0;
+    }
+
+    while (pRam && cPagesLeft > 0)
+    {
+        if (GCPhysCursor < pRam->GCPhys)
+            GCPhysCursor = pRam->GCPhys;
+        uint32_t const cPages = (uint32_t)(pRam->cb >> PAGE_SHIFT);
+        uint32_t       iPage  = (uint32_t)((GCPhysCursor - pRam->GCPhys) >> PAGE_SHIFT);
+        for (; iPage < cPages && cPagesLeft > 0; iPage++, cPagesLeft--)
+        {
+            PPGMPAGE pPage = &pRam->aPages[iPage];
+            if (    PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+                ||  PGM_PAGE_GET_STATE(pPage) != PGM_PAGE_STATE_ALLOCATED
+                ||  PGM_PAGE_HAS_ANY_HANDLERS(pPage)
+                ||  PGM_PAGE_GET_PDE_TYPE(pPage) == PGM_PAGE_PDE_TYPE_PDE
+                ||  PGM_PAGE_GET_READ_LOCKS(pPage) != 0
+                ||  PGM_PAGE_GET_WRITE_LOCKS(pPage) != 0)
+                continue;
+
+            GMMSHAREDPAGEDESC PageDesc;
+            PageDesc.idPage = PGM_PAGE_GET_PAGEID(pPage);
+            PageDesc.HCPhys = PGM_PAGE_GET_HCPHYS(pPage);
+            PageDesc.GCPhys = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+
+            bool fZeroPage;
+            rc = GMMR0DedupCheckPage(pGVM, &PageDesc, &fZeroPage);
+            if (RT_FAILURE(rc))
+                break;
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatDedupScanned);
+            if (fZeroPage)
+                STAM_REL_COUNTER_INC(&pVM->pgm.s.StatDedupZero);
+            else if (PageDesc.idPage != NIL_GMM_PAGEID)
+            {
+                Log(("PGMR0SharedPageScan: shared page phys=%RGp host %RHp->%RHp\n",
+                     PageDesc.GCPhys, PGM_PAGE_GET_HCPHYS(pPage), PageDesc.HCPhys));
+                if (pgmR0SharedPageApply(pVM, pVCpu, pPage, &PageDesc, &fFlushTLBs))
+                    STAM_REL_COUNTER_INC(&pVM->pgm.s.StatDedupMerged);
+                else
+                    STAM_REL_COUNTER_INC(&pVM->pgm.s.StatDedupConverted);
+                fFlushRemTLBs = true;
+            }
+        }
+
+        GCPhysCursor = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        if (RT_FAILURE(rc))
+            break;
+        if (iPage >= cPages)
+        {
+            pRam = pRam->CTX_SUFF(pNext);
+            if (!pRam)
+                GCPhysCursor = 0; /* Start over with the next pass. */
+        }
+    }
+    pVM->pgm.s.Dedup.GCPhysCursor = GCPhysCursor;
+
+    /*
+     * Do TLB flushing if necessary.
+     */
+    if (fFlushTLBs)
+        PGM_INVL_ALL_VCPU_TLBS(pVM);
+
+    if (fFlushRemTLBs)
+        for (VMCPUID idCurCpu = 0; idCurCpu < pVM->cCpus; idCurCpu++)
+            CPUMSetChangedFlags(&pVM->aCpus[idCurCpu], CPUM_CHANGED_GLOBAL_TLB_FLUSH);
+
+    return rc;
+}
 #endif /* VBOX_WITH_PAGE_SHARING */
 
@@ -1746,6 +1746,13 @@ static int vmmR0EntryExWorker(PGVM pGVM, PVM pVM, VMCPUID idCpu, VMMR0OPERATION
             VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
             break;
 
+        case VMMR0_DO_PGM_SEED_LARGE_HANDY_PAGE:
+            if (idCpu == NIL_VMCPUID)
+                return VERR_INVALID_CPU_ID;
+            rc = PGMR0PhysSeedLargeHandyPage(pGVM, pVM, idCpu, (RTR3PTR)u64Arg);
+            VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+            break;
+
         case VMMR0_DO_PGM_PHYS_SETUP_IOMMU:
             if (idCpu != 0)
                 return VERR_INVALID_CPU_ID;
@@ -1868,6 +1875,18 @@ static int vmmR0EntryExWorker(PGVM pGVM, PVM pVM, VMCPUID idCpu, VMMR0OPERATION
             VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
             break;
         }
+
+        case VMMR0_DO_GMM_SCAN_DUPLICATE_PAGES:
+        {
+            if (idCpu == NIL_VMCPUID)
+                return VERR_INVALID_CPU_ID;
+            if (    u64Arg > UINT32_MAX
+                ||  pReqHdr)
+                return VERR_INVALID_PARAMETER;
+            rc = GMMR0ScanForDuplicatePages(pGVM, pVM, idCpu, (uint32_t)u64Arg);
+            VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+            break;
+        }
 #endif
 
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
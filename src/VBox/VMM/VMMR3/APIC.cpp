@@ -1074,6 +1074,7 @@ static DECLCALLBACK(int) apicR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uin
         rc = SSMR3HandleGetStatus(pSSM);
         AssertRCReturn(rc, rc);
         CPUMSetGuestCpuIdPerCpuApicFeature(pVCpu, RT_BOOL(pApicCpu->uApicBaseMsr & MSR_IA32_APICBASE_EN));
+        apicUpdateX2ApicDestMap(pVCpu);
 
 #if defined(APIC_FUZZY_SSM_COMPAT_TEST) || defined(DEBUG_ramshankar)
         apicR3DumpState(pVCpu, "Loaded state", uVersion);
@@ -1657,6 +1658,12 @@ static DECLCALLBACK(int) apicR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFG
                          "/Devices/APIC/%u/IcrHiWrite");
         APIC_REG_COUNTER(&pApicCpu->StatIcrFullWrite,  "Number of times the ICR full (send IPI, x2APIC) is written.",
                          "/Devices/APIC/%u/IcrFullWrite");
+        APIC_REG_COUNTER(&pApicCpu->StatIcrFastPath,   "Number of x2APIC ICR writes handled by the fast path.",
+                         "/Devices/APIC/%u/IcrFastPath");
+        APIC_REG_COUNTER(&pApicCpu->StatIcrFastPathIpis, "Number of IPIs posted by the x2APIC ICR fast path.",
+                         "/Devices/APIC/%u/IcrFastPathIpis");
+        APIC_REG_COUNTER(&pApicCpu->StatIcrFastPathNotify, "Number of target EMTs notified in a batch by the x2APIC ICR fast path.",
+                         "/Devices/APIC/%u/IcrFastPathNotify");
     }
 # undef APIC_PROF_COUNTER
 # undef APIC_REG_ACCESS_COUNTER
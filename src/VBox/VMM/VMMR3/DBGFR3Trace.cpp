@@ -22,18 +22,29 @@
 #define LOG_GROUP LOG_GROUP_DBGF
 #include <VBox/vmm/dbgftrace.h>
 #include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/em.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/pdmapi.h>
+#include <VBox/vmm/pdmqueue.h>
 #include "DBGFInternal.h"
 #include <VBox/vmm/vm.h>
+#include <VBox/vmm/uvm.h>
 #include "VMMTracing.h"
 
+#include <VBox/dbg.h>
 #include <VBox/err.h>
 #include <VBox/log.h>
 #include <VBox/param.h>
+#include <VBox/sup.h>
 
+#include <iprt/asm.h>
+#include <iprt/asm-amd64-x86.h>
 #include <iprt/assert.h>
 #include <iprt/ctype.h>
+#include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
 #include <iprt/trace.h>
 
 
@@ -41,6 +52,12 @@
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 static DECLCALLBACK(void) dbgfR3TraceInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
+static DECLCALLBACK(void) dbgfR3TraceEvtInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
+static int dbgfR3TraceEvtConfigWorker(PVM pVM, const char *pszConfig);
+#ifdef VBOX_WITH_DEBUGGER
+static FNDBGCCMD dbgfR3TraceEvtCmdConfig;
+static FNDBGCCMD dbgfR3TraceEvtCmdDump;
+#endif
 
 
 /*********************************************************************************************************************************
@@ -65,6 +82,52 @@ static const struct
 };
 
 
+/**
+ * Binary event trace category translation table.
+ */
+static const struct
+{
+    /** The category name. */
+    const char *pszName;
+    /** The name length. */
+    uint32_t    cchName;
+    /** The mask (DBGFTRACEEVT_F_XXX). */
+    uint32_t    fMask;
+}   g_aTraceEvtCategories[] =
+{
+    {  RT_STR_TUPLE("exit"),   DBGFTRACEEVT_F_EXIT },
+    {  RT_STR_TUPLE("ioport"), DBGFTRACEEVT_F_IOPORT },
+    {  RT_STR_TUPLE("mmio"),   DBGFTRACEEVT_F_MMIO },
+    {  RT_STR_TUPLE("irq"),    DBGFTRACEEVT_F_IRQ },
+    {  RT_STR_TUPLE("halt"),   DBGFTRACEEVT_F_HALT },
+    {  RT_STR_TUPLE("pdmq"),   DBGFTRACEEVT_F_PDM_QUEUE },
+};
+
+#ifdef VBOX_WITH_DEBUGGER
+/** '.traceevt' arguments. */
+static const DBGCVARDESC g_aTraceEvtConfigArgs[] =
+{
+    /* cTimesMin,   cTimesMax,  enmCategory,            fFlags,                         pszName,        pszDescription */
+    {  0,           1,          DBGCVAR_CAT_STRING,     0,                              "config",       "Categories to enable, '-' prefix disables." },
+};
+
+/** '.traceevtdump' arguments. */
+static const DBGCVARDESC g_aTraceEvtDumpArgs[] =
+{
+    /* cTimesMin,   cTimesMax,  enmCategory,            fFlags,                         pszName,        pszDescription */
+    {  1,           1,          DBGCVAR_CAT_STRING,     0,                              "file",         "The file name." },
+};
+
+/** Command descriptors for the binary event trace. */
+static const DBGCCMD g_aTraceEvtCmds[] =
+{
+    /* pszCmd,          cArgsMin, cArgsMax, paArgDesc,                  cArgDescs,                          fFlags, pfnHandler,               pszSyntax,  ....pszDescription */
+    { "traceevt",       0, 1,     &g_aTraceEvtConfigArgs[0],  RT_ELEMENTS(g_aTraceEvtConfigArgs),     0,      dbgfR3TraceEvtCmdConfig,  "[config]", "Displays or changes the binary event trace categories (exit, ioport, mmio, irq, halt, pdmq, all)." },
+    { "traceevtdump",   1, 1,     &g_aTraceEvtDumpArgs[0],    RT_ELEMENTS(g_aTraceEvtDumpArgs),       0,      dbgfR3TraceEvtCmdDump,    "<file>",   "Dumps the binary event trace rings to a file." },
+};
+#endif
+
+
 /**
  * Initializes the tracing.
  *
@@ -132,6 +195,66 @@ static int dbgfR3TraceEnable(PVM pVM, uint32_t cbEntry, uint32_t cEntries)
 }
 
 
+/**
+ * Allocates the binary event trace rings if configured.
+ *
+ * @returns VBox status code
+ * @param   pVM                 The cross context VM structure.
+ */
+static int dbgfR3TraceEvtInit(PVM pVM)
+{
+    PCFGMNODE pNode = CFGMR3GetChild(CFGMR3GetRoot(pVM), "DBGF/TraceEvt");
+
+    /** @cfgm{/DBGF/TraceEvt/Entries, uint32_t, 0, 0, 1M}
+     * The number of records in the binary event trace ring of each VCPU.  This
+     * is rounded up to a power of two no smaller than 256.  Zero, the default,
+     * disables the binary event trace.  Each record takes 32 bytes. */
+    uint32_t cEntries;
+    int rc = CFGMR3QueryU32Def(pNode, "Entries", &cEntries, 0);
+    AssertRCReturn(rc, rc);
+    if (!cEntries)
+        return VINF_SUCCESS;
+    if (cEntries > _1M)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          "Configuration error: /DBGF/TraceEvt/Entries=%u is out of range (max 1M)", cEntries);
+    uint32_t cRecs = 256;
+    while (cRecs < cEntries)
+        cRecs <<= 1;
+
+    /*
+     * Allocate the rings.  They must be accessible from ring-0 since that's
+     * where most of the exits and device accesses are handled.
+     */
+    size_t const cbRing = RT_UOFFSETOF_DYN(DBGFTRACEEVTRING, aRecs[cRecs]);
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        PDBGFTRACEEVTRING pRing;
+        rc = MMR3HyperAllocOnceNoRel(pVM, cbRing, PAGE_SIZE, MM_TAG_DBGF, (void **)&pRing);
+        if (RT_FAILURE(rc))
+            return VMSetError(pVM, rc, RT_SRC_POS, "Failed to allocate %zu bytes for the binary event trace ring", cbRing);
+        pRing->iNext = 0;
+        pRing->cRecs = cRecs;
+        pRing->fMask = cRecs - 1;
+        PVMCPU pVCpu = &pVM->aCpus[idCpu];
+        pVCpu->pTraceEvtRingR3 = pRing;
+        pVCpu->pTraceEvtRingR0 = MMHyperCCToR0(pVM, pRing);
+    }
+    LogRel(("DBGF: Binary event trace enabled, %u records per VCPU\n", cRecs));
+
+    /** @cfgm{/DBGF/TraceEvt/Config, string, ""}
+     * The event categories to enable initially, see DBGFR3TraceEvtConfig for the
+     * syntax. */
+    char *pszConfig;
+    rc = CFGMR3QueryStringAllocDef(pNode, "Config", &pszConfig, "");
+    AssertRCReturn(rc, rc);
+    rc = dbgfR3TraceEvtConfigWorker(pVM, pszConfig);
+    if (RT_FAILURE(rc))
+        rc = VMSetError(pVM, rc, RT_SRC_POS, "/DBGF/TraceEvt/Config=\"%s\" -> %Rrc", pszConfig, rc);
+    MMR3HeapFree(pszConfig);
+    return rc;
+}
+
+
 /**
  * Initializes the tracing.
  *
@@ -188,11 +311,33 @@ int dbgfR3TraceInit(PVM pVM)
         }
     }
 
+    /*
+     * Set up the binary event trace.
+     */
+    if (RT_SUCCESS(rc))
+        rc = dbgfR3TraceEvtInit(pVM);
+
     /*
      * Register a debug info item that will dump the trace buffer content.
      */
     if (RT_SUCCESS(rc))
         rc = DBGFR3InfoRegisterInternal(pVM, "tracebuf", "Display the trace buffer content. No arguments.", dbgfR3TraceInfo);
+    if (RT_SUCCESS(rc))
+        rc = DBGFR3InfoRegisterInternal(pVM, "traceevt", "Display the binary event trace state. No arguments.",
+                                        dbgfR3TraceEvtInfo);
+
+#ifdef VBOX_WITH_DEBUGGER
+    /*
+     * Debugger commands.
+     */
+    static bool s_fRegisteredCmds = false;
+    if (RT_SUCCESS(rc) && !s_fRegisteredCmds)
+    {
+        int rc2 = DBGCRegisterCommands(&g_aTraceEvtCmds[0], RT_ELEMENTS(g_aTraceEvtCmds));
+        if (RT_SUCCESS(rc2))
+            s_fRegisteredCmds = true;
+    }
+#endif
 
     return rc;
 }
@@ -448,3 +593,393 @@ static DECLCALLBACK(void) dbgfR3TraceInfo(PVM pVM, PCDBGFINFOHLP pHlp, const cha
     NOREF(pszArgs);
 }
 
+
+
+/**
+ * Worker for DBGFR3TraceEvtConfig and dbgfR3TraceEvtInit.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pszConfig   The configuration change specification.
+ */
+static int dbgfR3TraceEvtConfigWorker(PVM pVM, const char *pszConfig)
+{
+    /*
+     * Parse the whole string before applying anything.
+     */
+    uint32_t fTraceEvts = pVM->aCpus[0].fTraceEvts;
+    for (;;)
+    {
+        char ch;
+        while ((ch = *pszConfig) != '\0' && (RT_C_IS_SPACE(ch) || ch == ','))
+            pszConfig++;
+        if (ch == '\0')
+            break;
+
+        bool fNo = false;
+        if (ch == '-' || ch == '!' || ch == '~')
+        {
+            fNo = true;
+            pszConfig++;
+        }
+        else if (ch == '+')
+            pszConfig++;
+        else if (ch == 'n' && pszConfig[1] == 'o')
+        {
+            fNo = true;
+            pszConfig += 2;
+        }
+
+        const char *pszName = pszConfig;
+        while ((ch = *pszConfig) != '\0' && !RT_C_IS_SPACE(ch) && ch != ',')
+            pszConfig++;
+        size_t const cchName = pszConfig - pszName;
+
+        uint32_t fMask = 0;
+        if (cchName == 3 && !strncmp(pszName, "all", 3))
+            fMask = DBGFTRACEEVT_F_VALID_MASK;
+        else
+            for (unsigned i = 0; i < RT_ELEMENTS(g_aTraceEvtCategories); i++)
+                if (   g_aTraceEvtCategories[i].cchName == cchName
+                    && !strncmp(g_aTraceEvtCategories[i].pszName, pszName, cchName))
+                {
+                    fMask = g_aTraceEvtCategories[i].fMask;
+                    break;
+                }
+        if (!fMask)
+            return VERR_NOT_FOUND;
+
+        if (fNo)
+            fTraceEvts &= ~fMask;
+        else
+            fTraceEvts |= fMask;
+    }
+
+    if (fTraceEvts && !pVM->aCpus[0].pTraceEvtRingR3)
+        return VERR_DBGF_NO_TRACE_BUFFER;
+
+    /*
+     * Apply it.
+     */
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+        ASMAtomicWriteU32(&pVM->aCpus[idCpu].fTraceEvts, fTraceEvts);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Changes the binary event trace categories.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if an unknown category is given.  No change made.
+ * @retval  VERR_DBGF_NO_TRACE_BUFFER if trying to enable categories and no
+ *          trace rings were configured (/DBGF/TraceEvt/Entries).
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pszConfig   The configuration change specification.  Category
+ *                      names separated by spaces or commas, each optionally
+ *                      prefixed by '-' to disable it.  The categories are
+ *                      'exit', 'ioport', 'mmio', 'irq', 'halt', 'pdmq' and
+ *                      'all'.
+ */
+VMMR3DECL(int) DBGFR3TraceEvtConfig(PUVM pUVM, const char *pszConfig)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pszConfig, VERR_INVALID_POINTER);
+
+    int rc = dbgfR3TraceEvtConfigWorker(pVM, pszConfig);
+    LogRel(("DBGF: Binary event trace config \"%s\" -> %Rrc (%#x)\n", pszConfig, rc, pVM->aCpus[0].fTraceEvts));
+    return rc;
+}
+
+
+/**
+ * Queries the enabled binary event trace categories.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_BUFFER_OVERFLOW if the buffer is too small. Buffer will be
+ *          empty.
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pszConfig   Pointer to the output buffer.
+ * @param   cbConfig    The size of the output buffer.
+ */
+VMMR3DECL(int) DBGFR3TraceEvtQueryConfig(PUVM pUVM, char *pszConfig, size_t cbConfig)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pszConfig, VERR_INVALID_POINTER);
+    if (cbConfig < 1)
+        return VERR_BUFFER_OVERFLOW;
+    *pszConfig = '\0';
+
+    uint32_t const fTraceEvts = pVM->aCpus[0].fTraceEvts;
+    size_t         off        = 0;
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aTraceEvtCategories); i++)
+        if (fTraceEvts & g_aTraceEvtCategories[i].fMask)
+        {
+            size_t const cchThis = g_aTraceEvtCategories[i].cchName + (off != 0);
+            if (off + cchThis >= cbConfig)
+            {
+                *pszConfig = '\0';
+                return VERR_BUFFER_OVERFLOW;
+            }
+            if (off != 0)
+                pszConfig[off++] = ' ';
+            memcpy(&pszConfig[off], g_aTraceEvtCategories[i].pszName, g_aTraceEvtCategories[i].cchName + 1);
+            off += g_aTraceEvtCategories[i].cchName;
+        }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Copies the records out of a binary event trace ring, oldest first.
+ *
+ * The EMT may keep adding records while we copy, so we check afterwards which
+ * of the copied records might have been overwritten and drop those.
+ *
+ * @returns Number of records copied to @a paRecs.
+ * @param   pRing       The ring.
+ * @param   paRecs      Where to copy the records, pRing->cRecs entries.
+ * @param   pcLost      Where to return the number of records lost to ring
+ *                      wrap-around.
+ */
+static uint32_t dbgfR3TraceEvtSnapshot(PDBGFTRACEEVTRING pRing, PDBGFTRACEEVTREC paRecs, uint64_t *pcLost)
+{
+    uint32_t const cRecs  = pRing->cRecs;
+    uint64_t const iEnd   = ASMAtomicReadU64(&pRing->iNext);
+    uint64_t const iStart = iEnd > cRecs ? iEnd - cRecs : 0;
+    for (uint64_t i = iStart; i < iEnd; i++)
+        paRecs[i - iStart] = pRing->aRecs[i & pRing->fMask];
+    ASMCompilerBarrier();
+
+    /* The slot of the record being written right now is also suspect. */
+    uint64_t const iNow   = ASMAtomicReadU64(&pRing->iNext);
+    uint64_t const iValid = iNow >= cRecs ? iNow - cRecs + 1 : 0;
+    uint64_t const iFirst = RT_MAX(iStart, RT_MIN(iValid, iEnd));
+    if (iFirst != iStart)
+        memmove(paRecs, &paRecs[iFirst - iStart], (size_t)(iEnd - iFirst) * sizeof(paRecs[0]));
+    *pcLost = iFirst;
+    return (uint32_t)(iEnd - iFirst);
+}
+
+
+/**
+ * Adds a name table entry for the binary event trace dump if not already
+ * present.
+ *
+ * @returns VBox status code.
+ * @param   ppaNames    Pointer to the name table array (reallocated).
+ * @param   pcNames     Pointer to the name table entry count.
+ * @param   enmType     The event type.
+ * @param   uKey        The key.
+ */
+static int dbgfR3TraceEvtAddNameKey(DBGFTRACEEVTFILENAME **ppaNames, uint32_t *pcNames, DBGFTRACEEVTTYPE enmType, uint64_t uKey)
+{
+    DBGFTRACEEVTFILENAME *paNames = *ppaNames;
+    uint32_t const        cNames  = *pcNames;
+    for (uint32_t i = 0; i < cNames; i++)
+        if (paNames[i].uKey == uKey && paNames[i].enmType == (uint8_t)enmType)
+            return VINF_SUCCESS;
+
+    if (!(cNames % 64))
+    {
+        void *pvNew = RTMemRealloc(paNames, (cNames + 64) * sizeof(paNames[0]));
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        *ppaNames = paNames = (DBGFTRACEEVTFILENAME *)pvNew;
+    }
+    RT_ZERO(paNames[cNames]);
+    paNames[cNames].uKey    = uKey;
+    paNames[cNames].enmType = (uint8_t)enmType;
+    *pcNames = cNames + 1;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Dumps the binary event trace rings to a file.
+ *
+ * This can be called while the VM is running; events recorded while the dump
+ * is in progress may or may not make it into the file.  See
+ * @ref grp_dbgf_traceevt for the file format.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_DBGF_NO_TRACE_BUFFER if no trace rings were configured.
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pszFilename The output file, replaced if it exists.
+ */
+VMMR3DECL(int) DBGFR3TraceEvtDump(PUVM pUVM, const char *pszFilename)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pszFilename, VERR_INVALID_POINTER);
+    if (!pVM->aCpus[0].pTraceEvtRingR3)
+        return VERR_DBGF_NO_TRACE_BUFFER;
+
+    /*
+     * Take a snapshot of all the rings first so the file is as consistent as
+     * we can make it.
+     */
+    uint32_t const          cRecsPerCpu = pVM->aCpus[0].pTraceEvtRingR3->cRecs;
+    PDBGFTRACEEVTREC        paRecs      = (PDBGFTRACEEVTREC)RTMemAlloc((size_t)pVM->cCpus * cRecsPerCpu * sizeof(paRecs[0]));
+    DBGFTRACEEVTFILECPU    *paCpuHdrs   = (DBGFTRACEEVTFILECPU *)RTMemAllocZ(pVM->cCpus * sizeof(paCpuHdrs[0]));
+    if (!paRecs || !paCpuHdrs)
+    {
+        RTMemFree(paRecs);
+        RTMemFree(paCpuHdrs);
+        return VERR_NO_MEMORY;
+    }
+
+    DBGFTRACEEVTFILEHDR Hdr;
+    RT_ZERO(Hdr);
+    Hdr.uTscDump = ASMReadTSC();
+    RTTIMESPEC Now;
+    Hdr.i64UnixNsDump = RTTimeSpecGetNano(RTTimeNow(&Now));
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        paCpuHdrs[idCpu].idCpu = idCpu;
+        paCpuHdrs[idCpu].cRecs = dbgfR3TraceEvtSnapshot(pVM->aCpus[idCpu].pTraceEvtRingR3, &paRecs[(size_t)idCpu * cRecsPerCpu],
+                                                        &paCpuHdrs[idCpu].cLost);
+    }
+
+    /*
+     * Name the exit types and PDM queues we've got records for.
+     */
+    int                     rc      = VINF_SUCCESS;
+    DBGFTRACEEVTFILENAME   *paNames = NULL;
+    uint32_t                cNames  = 0;
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus && RT_SUCCESS(rc); idCpu++)
+    {
+        PCDBGFTRACEEVTREC paCpuRecs = &paRecs[(size_t)idCpu * cRecsPerCpu];
+        for (uint32_t i = 0; i < paCpuHdrs[idCpu].cRecs && RT_SUCCESS(rc); i++)
+            if (   paCpuRecs[i].enmType == DBGFTRACEEVTTYPE_EXIT
+                || paCpuRecs[i].enmType == DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH)
+                rc = dbgfR3TraceEvtAddNameKey(&paNames, &cNames, (DBGFTRACEEVTTYPE)paCpuRecs[i].enmType, paCpuRecs[i].u64Arg0);
+    }
+    for (uint32_t i = 0; i < cNames && RT_SUCCESS(rc); i++)
+        if (paNames[i].enmType == DBGFTRACEEVTTYPE_EXIT)
+        {
+            char        szFallback[32];
+            const char *pszName = EMR3GetExitName((uint32_t)paNames[i].uKey, szFallback, sizeof(szFallback));
+            RTStrCopy(paNames[i].szName, sizeof(paNames[i].szName), pszName);
+        }
+        else if (PDMR3QueueQueryTraceName(pVM, paNames[i].uKey, paNames[i].szName, sizeof(paNames[i].szName)) == VERR_NOT_FOUND)
+            RTStrPrintf(paNames[i].szName, sizeof(paNames[i].szName), "queue-%RX64", paNames[i].uKey);
+
+    /*
+     * Write the file.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        Hdr.u32Magic   = DBGFTRACEEVTFILEHDR_MAGIC;
+        Hdr.u32Version = DBGFTRACEEVTFILEHDR_VERSION;
+        Hdr.cbHdr      = sizeof(Hdr);
+        Hdr.cbRec      = sizeof(DBGFTRACEEVTREC);
+        Hdr.cCpus      = pVM->cCpus;
+        Hdr.cNames     = cNames;
+        Hdr.u64TscHz   = SUPGetCpuHzFromGip(g_pSUPGlobalInfoPage);
+
+        RTFILE hFile;
+        rc = RTFileOpen(&hFile, pszFilename, RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+        if (RT_SUCCESS(rc))
+        {
+            rc = RTFileWrite(hFile, &Hdr, sizeof(Hdr), NULL);
+            if (RT_SUCCESS(rc) && cNames)
+                rc = RTFileWrite(hFile, paNames, cNames * sizeof(paNames[0]), NULL);
+            for (VMCPUID idCpu = 0; idCpu < pVM->cCpus && RT_SUCCESS(rc); idCpu++)
+            {
+                rc = RTFileWrite(hFile, &paCpuHdrs[idCpu], sizeof(paCpuHdrs[idCpu]), NULL);
+                if (RT_SUCCESS(rc) && paCpuHdrs[idCpu].cRecs)
+                    rc = RTFileWrite(hFile, &paRecs[(size_t)idCpu * cRecsPerCpu],
+                                     paCpuHdrs[idCpu].cRecs * sizeof(DBGFTRACEEVTREC), NULL);
+            }
+            int rc2 = RTFileClose(hFile);
+            if (RT_SUCCESS(rc))
+                rc = rc2;
+            if (RT_FAILURE(rc))
+                RTFileDelete(pszFilename);
+        }
+    }
+    LogRel(("DBGF: Binary event trace dumped to '%s': %Rrc\n", pszFilename, rc));
+
+    RTMemFree(paNames);
+    RTMemFree(paCpuHdrs);
+    RTMemFree(paRecs);
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNDBGFHANDLERINT, Info handler for displaying the binary event trace state.}
+ */
+static DECLCALLBACK(void) dbgfR3TraceEvtInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs)
+{
+    RT_NOREF(pszArgs);
+    if (!pVM->aCpus[0].pTraceEvtRingR3)
+    {
+        pHlp->pfnPrintf(pHlp, "Binary event trace is not configured (/DBGF/TraceEvt/Entries)\n");
+        return;
+    }
+
+    char szConfig[128];
+    int rc = DBGFR3TraceEvtQueryConfig(pVM->pUVM, szConfig, sizeof(szConfig));
+    pHlp->pfnPrintf(pHlp, "Binary event trace: %u records per VCPU, categories: %s\n",
+                    pVM->aCpus[0].pTraceEvtRingR3->cRecs, RT_SUCCESS(rc) && szConfig[0] ? szConfig : "none");
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        PDBGFTRACEEVTRING pRing = pVM->aCpus[idCpu].pTraceEvtRingR3;
+        uint64_t const    cTotal = ASMAtomicReadU64(&pRing->iNext);
+        pHlp->pfnPrintf(pHlp, "  VCPU %u: %'RU64 events recorded, %'RU64 overwritten\n",
+                        idCpu, cTotal, cTotal > pRing->cRecs ? cTotal - pRing->cRecs : 0);
+    }
+}
+
+
+#ifdef VBOX_WITH_DEBUGGER
+
+/**
+ * @callback_method_impl{FNDBGCCMD, The '.traceevt' command.}
+ */
+static DECLCALLBACK(int) dbgfR3TraceEvtCmdConfig(PCDBGCCMD pCmd, PDBGCCMDHLP pCmdHlp, PUVM pUVM, PCDBGCVAR paArgs, unsigned cArgs)
+{
+    DBGC_CMDHLP_REQ_UVM_RET(pCmdHlp, pCmd, pUVM);
+    DBGC_CMDHLP_ASSERT_PARSER_RET(pCmdHlp, pCmd, 0, cArgs == 0 || paArgs[0].enmType == DBGCVAR_TYPE_STRING);
+
+    int rc;
+    if (cArgs == 1)
+    {
+        rc = DBGFR3TraceEvtConfig(pUVM, paArgs[0].u.pszString);
+        if (RT_FAILURE(rc))
+            return DBGCCmdHlpFailRc(pCmdHlp, pCmd, rc, "DBGFR3TraceEvtConfig(,\"%s\")", paArgs[0].u.pszString);
+    }
+
+    char szConfig[128];
+    rc = DBGFR3TraceEvtQueryConfig(pUVM, szConfig, sizeof(szConfig));
+    if (RT_FAILURE(rc))
+        return DBGCCmdHlpFailRc(pCmdHlp, pCmd, rc, "DBGFR3TraceEvtQueryConfig");
+    return DBGCCmdHlpPrintf(pCmdHlp, "traceevt: %s\n", szConfig[0] ? szConfig : "none");
+}
+
+
+/**
+ * @callback_method_impl{FNDBGCCMD, The '.traceevtdump' command.}
+ */
+static DECLCALLBACK(int) dbgfR3TraceEvtCmdDump(PCDBGCCMD pCmd, PDBGCCMDHLP pCmdHlp, PUVM pUVM, PCDBGCVAR paArgs, unsigned cArgs)
+{
+    DBGC_CMDHLP_REQ_UVM_RET(pCmdHlp, pCmd, pUVM);
+    DBGC_CMDHLP_ASSERT_PARSER_RET(pCmdHlp, pCmd, 0, cArgs == 1 && paArgs[0].enmType == DBGCVAR_TYPE_STRING);
+
+    int rc = DBGFR3TraceEvtDump(pUVM, paArgs[0].u.pszString);
+    if (RT_FAILURE(rc))
+        return DBGCCmdHlpFailRc(pCmdHlp, pCmd, rc, "DBGFR3TraceEvtDump(,\"%s\")", paArgs[0].u.pszString);
+    return DBGCCmdHlpPrintf(pCmdHlp, "Wrote the binary event trace to '%s'.\n", paArgs[0].u.pszString);
+}
+
+#endif /* VBOX_WITH_DEBUGGER */
@@ -119,7 +119,7 @@ VMM_INT_DECL(const char *) EMR3GetExitTypeName(EMEXITTYPE enmExitType)
  * @param   pszFallback     Buffer for formatting a numeric fallback.
  * @param   cbFallback      Size of fallback buffer.
  */
-static const char *emR3HistoryGetExitName(uint32_t uFlagsAndType, char *pszFallback, size_t cbFallback)
+VMMR3_INT_DECL(const char *) EMR3GetExitName(uint32_t uFlagsAndType, char *pszFallback, size_t cbFallback)
 {
     const char *pszExitName;
     switch (uFlagsAndType & EMEXIT_F_KIND_MASK)
@@ -281,7 +281,7 @@ static DECLCALLBACK(void) emR3InfoExitHistory(PVM pVM, PCDBGFINFOHLP pHlp, const
 
             /* Get the exit name. */
             char        szExitName[16];
-            const char *pszExitName = emR3HistoryGetExitName(pEntry->uFlagsAndType, szExitName, sizeof(szExitName));
+            const char *pszExitName = EMR3GetExitName(pEntry->uFlagsAndType, szExitName, sizeof(szExitName));
 
             /* Calc delta (negative if reverse order, positive ascending). */
             int64_t offDelta = uPrevTimestamp != 0 && pEntry->uTimestamp != 0 ? pEntry->uTimestamp - uPrevTimestamp : 0;
@@ -22,13 +22,27 @@
 #define LOG_GROUP LOG_GROUP_EM
 #include <VBox/vmm/iem.h>
 #include <VBox/vmm/cpum.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/mm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
 #include "IEMInternal.h"
 #include <VBox/vmm/vm.h>
 #include <VBox/err.h>
 
+#include <iprt/asm.h>
 #include <iprt/asm-amd64-x86.h>
 #include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/string.h>
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+static int  iemR3OpcodeCacheInit(PVM pVM);
+static void iemR3OpcodeCacheTerm(PVM pVM);
+
 
 static const char *iemGetTargetCpuName(uint32_t enmTargetCpu)
 {
@@ -168,13 +182,15 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
         while (iMemMap-- > 0)
             pVCpu->iem.s.aMemMappings[iMemMap].fAccess = IEM_ACCESS_INVALID;
     }
-    return VINF_SUCCESS;
+
+    return iemR3OpcodeCacheInit(pVM);
 }
 
 
 VMMR3DECL(int)      IEMR3Term(PVM pVM)
 {
     NOREF(pVM);
+    iemR3OpcodeCacheTerm(pVM);
 #if defined(VBOX_WITH_STATISTICS) && !defined(DOXYGEN_RUNNING)
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
     {
@@ -194,3 +210,310 @@ VMMR3DECL(void)     IEMR3Relocate(PVM pVM)
             pVM->aCpus[idCpu].iem.s.pStatsRC = MMHyperR3ToRC(pVM, pVM->aCpus[idCpu].iem.s.pStatsCCR3);
 }
 
+
+/**
+ * @callback_method_impl{FNPGMPHYSHANDLER,
+ *      Write access handler for pages in the opcode page cache.}
+ */
+static DECLCALLBACK(VBOXSTRICTRC) iemR3OpcodeCacheWriteHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf,
+                                                               size_t cbBuf, PGMACCESSTYPE enmAccessType,
+                                                               PGMACCESSORIGIN enmOrigin, void *pvUser)
+{
+    RT_NOREF6(pVCpu, pvPhys, pvBuf, cbBuf, enmAccessType, enmOrigin);
+    PIEMOPCODECACHEPAGE pPage  = (PIEMOPCODECACHEPAGE)pvUser;
+    PIEMOPCODECACHE     pCache = pVM->aCpus[0].iem.s.pOpcodeCacheR3;
+    Assert(enmAccessType == PGMACCESSTYPE_WRITE);
+    Assert(pPage->GCPhys == (GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK));
+
+    /*
+     * Invalidate the page and get out of the way until someone executes
+     * code from it again.  We're called with the PGM lock held, so the
+     * cache critsect must not be touched here.
+     */
+    ASMAtomicWriteBool(&pPage->fStale, true);
+    ASMAtomicAddU32(&pPage->uSeq, 2);
+    ASMAtomicIncU32(&pPage->cWrites);
+    STAM_REL_COUNTER_INC(&pCache->StatWriteInvalidations);
+
+    int rc = PGMHandlerPhysicalPageTempOff(pVM, pPage->GCPhys, pPage->GCPhys);
+    AssertRC(rc);
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
+
+
+/**
+ * Gets the cache page for the given guest physical page, filling it if
+ * necessary.
+ *
+ * @returns Pointer to the cache page, NULL if the page cannot be cached.
+ * @param   pVM         The cross context VM structure.
+ * @param   pCache      The opcode page cache.
+ * @param   pHint       The hint of the calling VCPU (statistics).
+ * @param   GCPhys      The guest physical page address.
+ * @param   puSeq       Where to return the sequence number the content is
+ *                      valid for.
+ */
+static PIEMOPCODECACHEPAGE iemR3OpcodeCacheGetPage(PVM pVM, PIEMOPCODECACHE pCache, PIEMOPCODECACHEHINT pHint,
+                                                   RTGCPHYS GCPhys, uint32_t *puSeq)
+{
+    PIEMOPCODECACHEPAGE pPage = &pCache->paPages[(GCPhys >> PAGE_SHIFT) & (pCache->cPages - 1)];
+    RTCritSectEnter(&pCache->CritSect);
+
+    if (pPage->GCPhys == GCPhys)
+    {
+        if (!ASMAtomicReadBool(&pPage->fStale))
+        {
+            *puSeq = ASMAtomicReadU32(&pPage->uSeq);
+            RTCritSectLeave(&pCache->CritSect);
+            return pPage;
+        }
+        if (ASMAtomicReadU32(&pPage->cWrites) >= IEM_OPCODE_CACHE_MAX_WRITES)
+        {
+            RTCritSectLeave(&pCache->CritSect);
+            return NULL;
+        }
+
+        /* Re-arm the write monitoring before reading the new content.  The
+           stale flag must be cleared before the handler is armed, otherwise
+           a write hitting the page in between would go unnoticed. */
+        ASMAtomicIncU32(&pPage->uSeq);
+        ASMAtomicWriteBool(&pPage->fStale, false);
+        int rc = PGMHandlerPhysicalReset(pVM, GCPhys);
+        AssertRC(rc);
+    }
+    else
+    {
+        /*
+         * Only plain RAM pages are cached, ROM and MMIO pages have their own
+         * handlers or aren't backed by memory we can monitor.
+         */
+        if (PGMPhysGetPageType(pVM, GCPhys) != PGMPAGETYPE_RAM)
+        {
+            RTCritSectLeave(&pCache->CritSect);
+            return NULL;
+        }
+
+        ASMAtomicIncU32(&pPage->uSeq);
+        if (pPage->fMonitored)
+        {
+            int rc = PGMHandlerPhysicalDeregister(pVM, pPage->GCPhys);
+            AssertRC(rc);
+            pPage->fMonitored = false;
+            STAM_REL_COUNTER_INC(&pCache->StatEvictions);
+        }
+
+        pPage->GCPhys = GCPhys;
+        ASMAtomicWriteU32(&pPage->cWrites, 0);
+        ASMAtomicWriteBool(&pPage->fStale, false);
+        int rc = PGMHandlerPhysicalRegister(pVM, GCPhys, GCPhys + PAGE_OFFSET_MASK, pCache->hWriteHandlerType,
+                                            pPage, NIL_RTR0PTR, NIL_RTRCPTR, "IEM opcode cache");
+        if (RT_FAILURE(rc))
+        {
+            /* Probably some other handler on the page already. */
+            pPage->GCPhys = NIL_RTGCPHYS;
+            ASMAtomicIncU32(&pPage->uSeq);
+            RTCritSectLeave(&pCache->CritSect);
+            return NULL;
+        }
+        pPage->fMonitored = true;
+    }
+
+    /*
+     * Fill it.  The sequence number is odd while doing this.  Should the
+     * guest write the page after the handler was armed, we'll find fStale set
+     * afterwards and the sequence number will have moved on.
+     */
+    Assert(ASMAtomicReadU32(&pPage->uSeq) & 1);
+    int rc = PGMPhysSimpleReadGCPhys(pVM, pPage->abPage, GCPhys, PAGE_SIZE);
+    uint32_t const uSeq = ASMAtomicIncU32(&pPage->uSeq);
+    RTCritSectLeave(&pCache->CritSect);
+    if (RT_SUCCESS(rc) && !ASMAtomicReadBool(&pPage->fStale))
+    {
+        STAM_REL_COUNTER_INC(&pHint->StatFills);
+        *puSeq = uSeq;
+        return pPage;
+    }
+    return NULL;
+}
+
+
+/**
+ * Looks up the opcode cache page for a linear code page, updating the VCPU
+ * hint.
+ *
+ * Called by iemOpcodeCacheTryRead when the hint doesn't match.
+ *
+ * @returns true if the hint now points to a cache page, false if the page
+ *          isn't cachable or the translation failed.
+ * @param   pVCpu       The cross context virtual CPU structure of the
+ *                      calling thread.
+ * @param   pCache      The opcode page cache.
+ * @param   pHint       The hint of the calling VCPU.
+ * @param   GCPtrPage   The linear address of the code page.
+ */
+bool iemR3OpcodeCacheLookup(PVMCPU pVCpu, PIEMOPCODECACHE pCache, PIEMOPCODECACHEHINT pHint, RTGCPTR GCPtrPage)
+{
+    STAM_REL_COUNTER_INC(&pHint->StatLookups);
+    pHint->GCPtrPage = NIL_RTGCPTR;
+
+    /* Leave the page fault business to the normal code path. */
+    RTGCPHYS GCPhys;
+    uint64_t fFlags;
+    int rc = PGMGstGetPage(pVCpu, GCPtrPage, &fFlags, &GCPhys);
+    if (RT_FAILURE(rc))
+        return false;
+
+    uint32_t            uSeq  = 0;
+    PIEMOPCODECACHEPAGE pPage = iemR3OpcodeCacheGetPage(pVCpu->CTX_SUFF(pVM), pCache, pHint,
+                                                        GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK, &uSeq);
+    if (!pPage)
+        STAM_REL_COUNTER_INC(&pHint->StatUncachable);
+
+    /* Cache negative results too, so uncachable pages don't cost us a page
+       walk per instruction. */
+    pHint->pPage     = pPage;
+    pHint->uSeq      = uSeq;
+    pHint->fUser     = RT_BOOL(fFlags & X86_PTE_US);
+    pHint->fNoExec   = RT_BOOL(fFlags & X86_PTE_PAE_NX);
+    pHint->uRev      = pVCpu->iem.s.uOpcodeCacheRev;
+    pHint->GCPtrPage = GCPtrPage;
+    return pPage != NULL;
+}
+
+
+/**
+ * Invalidates the whole opcode page cache.
+ *
+ * This is used when guest memory is changed behind the access handlers' back.
+ * The write monitoring is left as is, it'll be reset on the next fill.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @thread  Any.
+ */
+void iemR3OpcodeCacheFlush(PVM pVM)
+{
+    PIEMOPCODECACHE pCache = pVM->aCpus[0].iem.s.pOpcodeCacheR3;
+    if (pCache)
+    {
+        for (uint32_t i = 0; i < pCache->cPages; i++)
+        {
+            PIEMOPCODECACHEPAGE pPage = &pCache->paPages[i];
+            if (pPage->GCPhys != NIL_RTGCPHYS)
+            {
+                ASMAtomicWriteBool(&pPage->fStale, true);
+                ASMAtomicAddU32(&pPage->uSeq, 2);
+            }
+        }
+        STAM_REL_COUNTER_INC(&pCache->StatFlushes);
+    }
+}
+
+
+/**
+ * Initializes the opcode page cache.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ */
+static int iemR3OpcodeCacheInit(PVM pVM)
+{
+    PCFGMNODE pCfgIem = CFGMR3GetChild(CFGMR3GetRoot(pVM), "IEM");
+
+    /** @cfgm{/IEM/OpcodeCache, bool, true for IEM and NEM, false for HM}
+     * Whether to cache the opcode bytes of executed guest pages in ring-3.
+     * Pages in the cache are write monitored, which is cheap when IEM does
+     * most of the executing but means extra exits when using HM.  Not
+     * available with raw-mode, as PATM needs to see the original
+     * instructions. */
+    bool fEnabled;
+    int rc = CFGMR3QueryBoolDef(pCfgIem, "OpcodeCache", &fEnabled, !VM_IS_HM_ENABLED(pVM));
+    AssertLogRelRCReturn(rc, rc);
+    if (!fEnabled || VM_IS_RAW_MODE_ENABLED(pVM))
+        return VINF_SUCCESS;
+
+    /** @cfgm{/IEM/OpcodeCachePages, uint32_t, 64, 1, 1024}
+     * The number of pages in the opcode page cache, power of two. */
+    uint32_t cPages;
+    rc = CFGMR3QueryU32Def(pCfgIem, "OpcodeCachePages", &cPages, IEM_OPCODE_CACHE_DEF_PAGES);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(   cPages >= 1
+                          && cPages <= IEM_OPCODE_CACHE_MAX_PAGES
+                          && RT_IS_POWER_OF_TWO(cPages),
+                          ("OpcodeCachePages=%u\n", cPages), VERR_OUT_OF_RANGE);
+
+    PIEMOPCODECACHE pCache = (PIEMOPCODECACHE)MMR3HeapAllocZ(pVM, MM_TAG_IEM, RT_UOFFSETOF_DYN(IEMOPCODECACHE, aHints[pVM->cCpus]));
+    AssertLogRelReturn(pCache, VERR_NO_MEMORY);
+    pCache->hWriteHandlerType = NIL_PGMPHYSHANDLERTYPE;
+    pCache->cPages   = cPages;
+    pCache->paPages  = (PIEMOPCODECACHEPAGE)MMR3HeapAllocZ(pVM, MM_TAG_IEM, sizeof(pCache->paPages[0]) * cPages);
+    AssertLogRelMsgReturnStmt(pCache->paPages, ("cPages=%u\n", cPages), MMR3HeapFree(pCache), VERR_NO_MEMORY);
+    for (uint32_t i = 0; i < cPages; i++)
+        pCache->paPages[i].GCPhys = NIL_RTGCPHYS;
+
+    rc = RTCritSectInit(&pCache->CritSect);
+    if (RT_SUCCESS(rc))
+    {
+        rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_WRITE,
+                                              iemR3OpcodeCacheWriteHandler,
+                                              NULL /* pszModR0 */, NULL /* pszHandlerR0 */, NULL /* pszPfHandlerR0 */,
+                                              NULL /* pszModRC */, NULL /* pszHandlerRC */, NULL /* pszPfHandlerRC */,
+                                              "IEM opcode cache", &pCache->hWriteHandlerType);
+        if (RT_SUCCESS(rc))
+        {
+            for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+            {
+                PIEMOPCODECACHEHINT pHint = &pCache->aHints[idCpu];
+                pHint->GCPtrPage = NIL_RTGCPTR;
+                pVM->aCpus[idCpu].iem.s.pOpcodeCacheR3 = pCache;
+
+                STAMR3RegisterF(pVM, &pHint->StatHintHits,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "Opcode fetches satisfied by the linear page hint", "/IEM/CPU%u/OpcodeCache-HintHits", idCpu);
+                STAMR3RegisterF(pVM, &pHint->StatLookups,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "Opcode cache lookups (page walks)",                "/IEM/CPU%u/OpcodeCache-Lookups", idCpu);
+                STAMR3RegisterF(pVM, &pHint->StatFills,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "Opcode cache pages (re)filled",                    "/IEM/CPU%u/OpcodeCache-Fills", idCpu);
+                STAMR3RegisterF(pVM, &pHint->StatUncachable, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "Lookups of pages that cannot be cached",           "/IEM/CPU%u/OpcodeCache-Uncachable", idCpu);
+            }
+            STAMR3Register(pVM, &pCache->StatWriteInvalidations, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                           "/IEM/OpcodeCache/WriteInvalidations", STAMUNIT_OCCURENCES, "Cache pages invalidated by guest writes");
+            STAMR3Register(pVM, &pCache->StatEvictions,          STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                           "/IEM/OpcodeCache/Evictions",          STAMUNIT_OCCURENCES, "Cache pages reused for another guest page");
+            STAMR3Register(pVM, &pCache->StatFlushes,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                           "/IEM/OpcodeCache/Flushes",            STAMUNIT_OCCURENCES, "Full cache invalidations");
+            LogRel(("IEM: Opcode page cache enabled, %u pages\n", cPages));
+            return VINF_SUCCESS;
+        }
+        RTCritSectDelete(&pCache->CritSect);
+    }
+    MMR3HeapFree(pCache->paPages);
+    MMR3HeapFree(pCache);
+    return rc;
+}
+
+
+/**
+ * Terminates the opcode page cache.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+static void iemR3OpcodeCacheTerm(PVM pVM)
+{
+    PIEMOPCODECACHE pCache = pVM->aCpus[0].iem.s.pOpcodeCacheR3;
+    if (pCache)
+    {
+        for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+            pVM->aCpus[idCpu].iem.s.pOpcodeCacheR3 = NULL;
+
+        for (uint32_t i = 0; i < pCache->cPages; i++)
+            if (pCache->paPages[i].fMonitored)
+            {
+                PGMHandlerPhysicalDeregister(pVM, pCache->paPages[i].GCPhys);
+                pCache->paPages[i].fMonitored = false;
+            }
+        RTCritSectDelete(&pCache->CritSect);
+        MMR3HeapFree(pCache->paPages);
+        MMR3HeapFree(pCache);
+    }
+}
+
@@ -237,6 +237,21 @@ VMMR3_INT_DECL(int) IOMR3Init(PVM pVM)
             STAM_REG(pVM, &pVM->iom.s.StatInstOut,            STAMTYPE_COUNTER, "/IOM/IOWork/Out",                          STAMUNIT_OCCURENCES,     "Counter of any OUT instructions.");
             STAM_REG(pVM, &pVM->iom.s.StatInstIns,            STAMTYPE_COUNTER, "/IOM/IOWork/Ins",                          STAMUNIT_OCCURENCES,     "Counter of any INS instructions.");
             STAM_REG(pVM, &pVM->iom.s.StatInstOuts,           STAMTYPE_COUNTER, "/IOM/IOWork/Outs",                         STAMUNIT_OCCURENCES,     "Counter of any OUTS instructions.");
+
+            for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+            {
+                PVMCPU pVCpu = &pVM->aCpus[iCpu];
+                STAMR3RegisterF(pVM, &pVCpu->iom.s.StatIOPortCacheHits,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "I/O port range lookups satisfied by the range cache.", "/IOM/CPU%u/RangeCache/IOPortHits", iCpu);
+                STAMR3RegisterF(pVM, &pVCpu->iom.s.StatIOPortCacheMisses, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "I/O port range lookups that had to search the tree.", "/IOM/CPU%u/RangeCache/IOPortMisses", iCpu);
+                STAMR3RegisterF(pVM, &pVCpu->iom.s.StatIOPortLockFree,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "I/O port accesses dispatched without taking the IOM lock.", "/IOM/CPU%u/RangeCache/IOPortLockFree", iCpu);
+                STAMR3RegisterF(pVM, &pVCpu->iom.s.StatMMIOCacheHits,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "MMIO range lookups satisfied by the range cache.", "/IOM/CPU%u/RangeCache/MMIOHits", iCpu);
+                STAMR3RegisterF(pVM, &pVCpu->iom.s.StatMMIOCacheMisses,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                "MMIO range lookups that had to search the tree.", "/IOM/CPU%u/RangeCache/MMIOMisses", iCpu);
+            }
         }
     }
 
@@ -260,32 +275,31 @@ static void iomR3FlushCache(PVM pVM)
      * critical section, we can exclude all other EMTs by grabbing exclusive
      * access to the critical section and then safely update the caches of
      * other EMTs.
-     * (1) The irrelvant access not holding the lock is in assertion code.
+     * (1) The irrelvant access not holding the lock is in assertion code and
+     *     the lock-free I/O port fast path, which revalidates what it read
+     *     from the range caches against IOM::uRangeGen.
+     *
+     * The range caches themselves are invalidated by bumping the generation,
+     * each EMT flushes its own on the next locked lookup.  The caller must
+     * keep owning the lock while changing or freeing ranges.
      */
     IOM_LOCK_EXCL(pVM);
+    ASMAtomicIncU32(&pVM->iom.s.uRangeGen);
+
     VMCPUID iCpu = pVM->cCpus;
     while (iCpu-- > 0)
     {
         PVMCPU pVCpu = &pVM->aCpus[iCpu];
-        pVCpu->iom.s.pRangeLastReadR0  = NIL_RTR0PTR;
-        pVCpu->iom.s.pRangeLastWriteR0 = NIL_RTR0PTR;
         pVCpu->iom.s.pStatsLastReadR0  = NIL_RTR0PTR;
         pVCpu->iom.s.pStatsLastWriteR0 = NIL_RTR0PTR;
-        pVCpu->iom.s.pMMIORangeLastR0  = NIL_RTR0PTR;
         pVCpu->iom.s.pMMIOStatsLastR0  = NIL_RTR0PTR;
 
-        pVCpu->iom.s.pRangeLastReadR3  = NULL;
-        pVCpu->iom.s.pRangeLastWriteR3 = NULL;
         pVCpu->iom.s.pStatsLastReadR3  = NULL;
         pVCpu->iom.s.pStatsLastWriteR3 = NULL;
-        pVCpu->iom.s.pMMIORangeLastR3  = NULL;
         pVCpu->iom.s.pMMIOStatsLastR3  = NULL;
 
-        pVCpu->iom.s.pRangeLastReadRC  = NIL_RTRCPTR;
-        pVCpu->iom.s.pRangeLastWriteRC = NIL_RTRCPTR;
         pVCpu->iom.s.pStatsLastReadRC  = NIL_RTRCPTR;
         pVCpu->iom.s.pStatsLastWriteRC = NIL_RTRCPTR;
-        pVCpu->iom.s.pMMIORangeLastRC  = NIL_RTRCPTR;
         pVCpu->iom.s.pMMIOStatsLastRC  = NIL_RTRCPTR;
     }
 
@@ -326,17 +340,16 @@ VMMR3_INT_DECL(void) IOMR3Relocate(PVM pVM, RTGCINTPTR offDelta)
     RTAvlroGCPhysDoWithAll(&pVM->iom.s.pTreesR3->MMIOTree,     true, iomR3RelocateMMIOCallback,   &offDelta);
 
     /*
-     * Reset the raw-mode cache (don't bother relocating it).
+     * Reset the raw-mode cache (don't bother relocating it).  Bumping the
+     * generation takes care of the range caches.
      */
+    ASMAtomicIncU32(&pVM->iom.s.uRangeGen);
     VMCPUID iCpu = pVM->cCpus;
     while (iCpu-- > 0)
     {
         PVMCPU pVCpu = &pVM->aCpus[iCpu];
-        pVCpu->iom.s.pRangeLastReadRC  = NIL_RTRCPTR;
-        pVCpu->iom.s.pRangeLastWriteRC = NIL_RTRCPTR;
         pVCpu->iom.s.pStatsLastReadRC  = NIL_RTRCPTR;
         pVCpu->iom.s.pStatsLastWriteRC = NIL_RTRCPTR;
-        pVCpu->iom.s.pMMIORangeLastRC  = NIL_RTRCPTR;
         pVCpu->iom.s.pMMIOStatsLastRC  = NIL_RTRCPTR;
     }
 }
@@ -80,6 +80,9 @@ VMMR3_INT_DECL(int) NEMR3InitConfig(PVM pVM)
                                   "|Allow64BitGuests"
 #ifdef RT_OS_WINDOWS
                                   "|UseRing0Runloop"
+#endif
+#ifdef RT_OS_LINUX
+                                  "|UseKvm"
 #endif
                                   ,
                                   "" /* pszValidNodes */, "NEM" /* pszWho */, 0 /* uInstance */);
@@ -118,6 +121,17 @@ VMMR3_INT_DECL(int) NEMR3InitConfig(PVM pVM)
     pVM->nem.s.fUseRing0Runloop = fUseRing0Runloop;
 #endif
 
+#ifdef RT_OS_LINUX
+    /** @cfgm{/NEM/UseKvm, bool, false}
+     * Whether to execute the guest using the Linux kernel virtual machine
+     * (/dev/kvm).  KVM and the VT-x/AMD-V support in our own kernel module
+     * cannot be active at the same time, so this must be explicitly enabled. */
+    bool fUseKvm = false;
+    rc = CFGMR3QueryBoolDef(pCfgNem, "UseKvm", &fUseKvm, false);
+    AssertLogRelRCReturn(rc, rc);
+    pVM->nem.s.fUseKvm = fUseKvm;
+#endif
+
     return VINF_SUCCESS;
 }
 
@@ -333,7 +347,7 @@ VMMR3_INT_DECL(void) NEMR3ResetCpu(PVMCPU pVCpu, bool fInitIpi)
 VMMR3_INT_DECL(bool) NEMR3NeedSpecialTscMode(PVM pVM)
 {
 #ifdef VBOX_WITH_NATIVE_NEM
-# ifdef RT_OS_WINDOWS
+# if defined(RT_OS_WINDOWS) || defined(RT_OS_LINUX)
     if (VM_IS_NEM_ENABLED(pVM))
         return true;
 # endif
@@ -0,0 +1,2116 @@
+/* $Id$ */
+/** @file
+ * NEM - Native execution manager, native ring-3 Linux backend (KVM).
+ *
+ * Log group 2: Exit logging.
+ * Log group 3: Log context on exit.
+ * Log group 5: Ring-3 memory management
+ */
+
+/*
+ * Copyright (C) 2018 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_NEM
+#define VMCPU_INCL_CPUM_GST_CTX
+#include <VBox/vmm/nem.h>
+#include <VBox/vmm/iem.h>
+#include <VBox/vmm/em.h>
+#include <VBox/vmm/apic.h>
+#include <VBox/vmm/pdm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/iom.h>
+#include <VBox/vmm/tm.h>
+#include <VBox/vmm/trpm.h>
+#include <VBox/vmm/dbgf.h>
+#include "NEMInternal.h"
+#include <VBox/vmm/vm.h>
+
+#include <iprt/asm.h>
+#include <iprt/asm-amd64-x86.h>
+#include <iprt/critsect.h>
+#include <iprt/err.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/x86.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/kvm.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The guest physical address of the three pages KVM needs for the real mode
+ *  TSS on VT-x hosts without unrestricted guest support.  Same as QEMU uses,
+ *  well clear of anything our devices and firmwares map. */
+#define NEM_LNX_TSS_ADDR                    UINT64_C(0xfeffd000)
+/** The guest physical address of the identity mapped page table KVM needs on
+ *  VT-x hosts without unrestricted guest support. */
+#define NEM_LNX_IDENTITY_MAP_ADDR           UINT64_C(0xfeffc000)
+/** Upper limit on the number of memory slots we manage. */
+#define NEM_LNX_MAX_SLOTS                   UINT32_C(4096)
+/** Maximum number of CPUID entries we hand KVM. */
+#define NEM_LNX_MAX_CPUID_ENTRIES           256
+
+/** @name The CPUMCTX_EXTRN_XXX groups matching the KVM state ioctls.
+ * We always import and export a group as a whole.
+ * @{ */
+/** KVM_GET_REGS / KVM_SET_REGS. */
+#define NEM_LNX_EXTRN_REGS      (CPUMCTX_EXTRN_GPRS_MASK | CPUMCTX_EXTRN_RIP | CPUMCTX_EXTRN_RFLAGS)
+/** KVM_GET_SREGS / KVM_SET_SREGS. */
+#define NEM_LNX_EXTRN_SREGS     (  CPUMCTX_EXTRN_SREG_MASK | CPUMCTX_EXTRN_TABLE_MASK | CPUMCTX_EXTRN_CR_MASK \
+                                 | CPUMCTX_EXTRN_APIC_TPR | CPUMCTX_EXTRN_EFER)
+/** KVM_GET_XSAVE / KVM_SET_XSAVE + KVM_GET_XCRS / KVM_SET_XCRS. */
+#define NEM_LNX_EXTRN_FPU       (CPUMCTX_EXTRN_X87 | CPUMCTX_EXTRN_SSE_AVX | CPUMCTX_EXTRN_OTHER_XSAVE | CPUMCTX_EXTRN_XCRx)
+/** KVM_GET_DEBUGREGS / KVM_SET_DEBUGREGS. */
+#define NEM_LNX_EXTRN_DEBUG     CPUMCTX_EXTRN_DR_MASK
+/** KVM_GET_MSRS / KVM_SET_MSRS. */
+#define NEM_LNX_EXTRN_MSRS      (  CPUMCTX_EXTRN_KERNEL_GS_BASE | CPUMCTX_EXTRN_SYSCALL_MSRS | CPUMCTX_EXTRN_SYSENTER_MSRS \
+                                 | CPUMCTX_EXTRN_TSC_AUX | CPUMCTX_EXTRN_OTHER_MSRS)
+/** KVM_GET_VCPU_EVENTS / KVM_SET_VCPU_EVENTS. */
+#define NEM_LNX_EXTRN_EVENTS    CPUMCTX_EXTRN_NEM_LNX_EVENTS
+/** Everything KVM keeps for us. */
+#define NEM_LNX_EXTRN_ALL       (  NEM_LNX_EXTRN_REGS | NEM_LNX_EXTRN_SREGS | NEM_LNX_EXTRN_FPU | NEM_LNX_EXTRN_DEBUG \
+                                 | NEM_LNX_EXTRN_MSRS | NEM_LNX_EXTRN_EVENTS)
+/** @} */
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/** KVM_GET_MSRS / KVM_SET_MSRS buffer with room for the MSRs we sync.
+ * Mirrors struct kvm_msrs, which ends with a flexible array. */
+typedef struct NEMLNXMSRS
+{
+    struct
+    {
+        uint32_t            nmsrs;
+        uint32_t            pad;
+    }                       Hdr;
+    struct kvm_msr_entry    aEntries[16];
+} NEMLNXMSRS;
+AssertCompileSize(struct kvm_msrs, 8);
+AssertCompileMemberOffset(NEMLNXMSRS, aEntries, sizeof(struct kvm_msrs));
+
+/** KVM_SET_CPUID2 buffer, mirrors struct kvm_cpuid2. */
+typedef struct NEMLNXCPUID
+{
+    struct
+    {
+        uint32_t            nent;
+        uint32_t            padding;
+    }                       Hdr;
+    struct kvm_cpuid_entry2 aEntries[NEM_LNX_MAX_CPUID_ENTRIES];
+} NEMLNXCPUID;
+AssertCompileSize(struct kvm_cpuid2, 8);
+AssertCompileMemberOffset(NEMLNXCPUID, aEntries, sizeof(struct kvm_cpuid2));
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+static int  nemR3LnxImportState(PVMCPU pVCpu, uint64_t fWhat);
+static void nemR3LnxUnmapRange(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb);
+static void nemR3LnxPremap(PVM pVM, PVMCPU pVCpu);
+
+
+
+/**
+ * Worker for nemR3NativeInit that opens /dev/kvm and checks the API version
+ * and the capabilities we depend on.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   pErrInfo        Where to always return error info.
+ */
+static int nemR3LnxInitProbe(PVM pVM, PRTERRINFO pErrInfo)
+{
+    int fdKvm = open("/dev/kvm", O_RDWR | O_CLOEXEC);
+    if (fdKvm < 0)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_NOT_AVAILABLE, "Failed to open /dev/kvm: %Rrc", RTErrConvertFromErrno(errno));
+    pVM->nem.s.fdKvm = fdKvm;
+
+    int iApiVersion = ioctl(fdKvm, KVM_GET_API_VERSION, 0);
+    if (iApiVersion != KVM_API_VERSION)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_MISSING_KERNEL_API, "Unsupported KVM API version %d, expected %d",
+                             iApiVersion, KVM_API_VERSION);
+
+    static const struct { int iCap; const char *pszName; } s_aRequired[] =
+    {
+        { KVM_CAP_USER_MEMORY,      "KVM_CAP_USER_MEMORY" },
+        { KVM_CAP_READONLY_MEM,     "KVM_CAP_READONLY_MEM" },
+        { KVM_CAP_IMMEDIATE_EXIT,   "KVM_CAP_IMMEDIATE_EXIT" },
+        { KVM_CAP_SET_TSS_ADDR,     "KVM_CAP_SET_TSS_ADDR" },
+        { KVM_CAP_EXT_CPUID,        "KVM_CAP_EXT_CPUID" },
+        { KVM_CAP_VCPU_EVENTS,      "KVM_CAP_VCPU_EVENTS" },
+        { KVM_CAP_DEBUGREGS,        "KVM_CAP_DEBUGREGS" },
+        { KVM_CAP_XSAVE,            "KVM_CAP_XSAVE" },
+    };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_aRequired); i++)
+        if (ioctl(fdKvm, KVM_CHECK_EXTENSION, s_aRequired[i].iCap) <= 0)
+            return RTErrInfoSetF(pErrInfo, VERR_NEM_MISSING_KERNEL_API, "The host KVM lacks %s", s_aRequired[i].pszName);
+    pVM->nem.s.fHasXcrs = ioctl(fdKvm, KVM_CHECK_EXTENSION, KVM_CAP_XCRS) > 0;
+
+    int cbVCpuMmap = ioctl(fdKvm, KVM_GET_VCPU_MMAP_SIZE, 0);
+    if (cbVCpuMmap < (int)sizeof(struct kvm_run))
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_INIT_FAILED, "KVM_GET_VCPU_MMAP_SIZE returned %d", cbVCpuMmap);
+    pVM->nem.s.cbVCpuMmap = (uint32_t)cbVCpuMmap;
+
+    int cMaxVCpus = ioctl(fdKvm, KVM_CHECK_EXTENSION, KVM_CAP_MAX_VCPUS);
+    if (cMaxVCpus <= 0)
+        cMaxVCpus = ioctl(fdKvm, KVM_CHECK_EXTENSION, KVM_CAP_NR_VCPUS);
+    if (cMaxVCpus > 0 && pVM->cCpus > (uint32_t)cMaxVCpus)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_INIT_FAILED, "The host KVM supports only %d vCPUs, %u configured",
+                             cMaxVCpus, pVM->cCpus);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Worker for nemR3NativeInit that creates the KVM VM, the vCPUs and the memory
+ * slot table.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   pErrInfo        Where to always return error info.
+ */
+static int nemR3LnxInitCreateVm(PVM pVM, PRTERRINFO pErrInfo)
+{
+    int fdVm = ioctl(pVM->nem.s.fdKvm, KVM_CREATE_VM, 0);
+    if (fdVm < 0)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_VM_CREATE_FAILED, "KVM_CREATE_VM failed: %Rrc", RTErrConvertFromErrno(errno));
+    pVM->nem.s.fdVm = fdVm;
+
+    /* Real mode support on older VT-x CPUs needs these. */
+    if (ioctl(fdVm, KVM_SET_TSS_ADDR, (unsigned long)NEM_LNX_TSS_ADDR) < 0)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_VM_CREATE_FAILED, "KVM_SET_TSS_ADDR failed: %Rrc", RTErrConvertFromErrno(errno));
+    if (ioctl(fdVm, KVM_CHECK_EXTENSION, KVM_CAP_SET_IDENTITY_MAP_ADDR) > 0)
+    {
+        uint64_t uIdentityMapAddr = NEM_LNX_IDENTITY_MAP_ADDR;
+        if (ioctl(fdVm, KVM_SET_IDENTITY_MAP_ADDR, &uIdentityMapAddr) < 0)
+            return RTErrInfoSetF(pErrInfo, VERR_NEM_VM_CREATE_FAILED, "KVM_SET_IDENTITY_MAP_ADDR failed: %Rrc",
+                                 RTErrConvertFromErrno(errno));
+    }
+
+    /*
+     * The memory slot table.
+     */
+    int cMaxSlots = ioctl(fdVm, KVM_CHECK_EXTENSION, KVM_CAP_NR_MEMSLOTS);
+    if (cMaxSlots < 32)
+        return RTErrInfoSetF(pErrInfo, VERR_NEM_INIT_FAILED, "The host KVM supports only %d memory slots", cMaxSlots);
+    uint32_t const cSlots = RT_MIN((uint32_t)cMaxSlots, NEM_LNX_MAX_SLOTS) & ~UINT32_C(31);
+
+    PNEMLNXMEMSLOTS pMemSlots = (PNEMLNXMEMSLOTS)RTMemAllocZ(sizeof(*pMemSlots));
+    AssertReturn(pMemSlots, VERR_NO_MEMORY);
+    pMemSlots->cMaxSlots  = cSlots;
+    pMemSlots->paSlots    = (PNEMLNXMEMSLOT)RTMemAllocZ(sizeof(pMemSlots->paSlots[0]) * cSlots);
+    pMemSlots->pbmUsedIds = (uint32_t *)RTMemAllocZ(cSlots / 8);
+    if (!pMemSlots->paSlots || !pMemSlots->pbmUsedIds)
+    {
+        RTMemFree(pMemSlots->paSlots);
+        RTMemFree(pMemSlots->pbmUsedIds);
+        RTMemFree(pMemSlots);
+        return VERR_NO_MEMORY;
+    }
+    int rc = RTCritSectInit(&pMemSlots->CritSect);
+    if (RT_FAILURE(rc))
+    {
+        RTMemFree(pMemSlots->paSlots);
+        RTMemFree(pMemSlots->pbmUsedIds);
+        RTMemFree(pMemSlots);
+        return rc;
+    }
+    pVM->nem.s.pMemSlots = pMemSlots;
+
+    /*
+     * The vCPUs and their kvm_run mappings.
+     */
+    for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+    {
+        PVMCPU pVCpu = &pVM->aCpus[iCpu];
+        int fdVCpu = ioctl(fdVm, KVM_CREATE_VCPU, (unsigned long)iCpu);
+        if (fdVCpu < 0)
+            return RTErrInfoSetF(pErrInfo, VERR_NEM_VM_CREATE_FAILED, "KVM_CREATE_VCPU(%u) failed: %Rrc",
+                                 iCpu, RTErrConvertFromErrno(errno));
+        pVCpu->nem.s.fdVCpu = fdVCpu;
+
+        void *pvRun = mmap(NULL, pVM->nem.s.cbVCpuMmap, PROT_READ | PROT_WRITE, MAP_SHARED, fdVCpu, 0);
+        if (pvRun == MAP_FAILED)
+            return RTErrInfoSetF(pErrInfo, VERR_NEM_VM_CREATE_FAILED, "Failed to map kvm_run for vCPU %u: %Rrc",
+                                 iCpu, RTErrConvertFromErrno(errno));
+        pVCpu->nem.s.pRun = (struct kvm_run *)pvRun;
+    }
+
+    LogRel(("NEM: Created KVM VM with %u vCPUs and up to %u memory slots (host limit %d)\n",
+            pVM->cCpus, cSlots, cMaxSlots));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Makes sure the APIC and firmware will not try use X2APIC mode, since the
+ * x2APIC MSRs are only handled by the in-kernel KVM local APIC.
+ *
+ * @returns VBox status code
+ * @param   pVM             The cross context VM structure.
+ */
+static int nemR3LnxDisableX2Apic(PVM pVM)
+{
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "/Devices/apic/0/Config");
+    if (pCfg)
+    {
+        uint8_t bMode = 0;
+        int rc = CFGMR3QueryU8(pCfg, "Mode", &bMode);
+        AssertLogRelMsgReturn(RT_SUCCESS(rc) || rc == VERR_CFGM_VALUE_NOT_FOUND, ("%Rrc\n", rc), rc);
+        if (RT_SUCCESS(rc) && bMode == PDMAPICMODE_X2APIC)
+        {
+            LogRel(("NEM: Adjusting APIC configuration from X2APIC to APIC max mode.  X2APIC is not supported with KVM!\n"));
+            rc = CFGMR3RemoveValue(pCfg, "Mode");
+            rc = CFGMR3InsertInteger(pCfg, "Mode", PDMAPICMODE_APIC);
+            AssertLogRelRCReturn(rc, rc);
+        }
+    }
+
+    static const char * const s_apszFirmwareConfigs[] =
+    {
+        "/Devices/efi/0/Config",
+        "/Devices/pcbios/0/Config",
+    };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_apszFirmwareConfigs); i++)
+    {
+        pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), s_apszFirmwareConfigs[i]);
+        if (pCfg)
+        {
+            uint8_t bMode = 0;
+            int rc = CFGMR3QueryU8(pCfg, "APIC", &bMode);
+            AssertLogRelMsgReturn(RT_SUCCESS(rc) || rc == VERR_CFGM_VALUE_NOT_FOUND, ("%Rrc\n", rc), rc);
+            if (RT_SUCCESS(rc) && bMode == 2)
+            {
+                LogRel(("NEM: Adjusting %s/APIC from 2 (X2APIC) to 1 (APIC).\n", s_apszFirmwareConfigs[i]));
+                rc = CFGMR3RemoveValue(pCfg, "APIC");
+                rc = CFGMR3InsertInteger(pCfg, "APIC", 1);
+                AssertLogRelRCReturn(rc, rc);
+            }
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Try initialize the native API.
+ *
+ * This may only do part of the job, more can be done in
+ * nemR3NativeInitAfterCPUM() and nemR3NativeInitCompleted().
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   fFallback       Whether we're in fallback mode or use-NEM mode. In
+ *                          the latter we'll fail if we cannot initialize.
+ * @param   fForced         Whether the HMForced flag is set and we should
+ *                          fail if we cannot initialize.
+ */
+int nemR3NativeInit(PVM pVM, bool fFallback, bool fForced)
+{
+    /*
+     * Some state init.
+     */
+    pVM->nem.s.fA20Enabled = true;
+    pVM->nem.s.fdKvm       = -1;
+    pVM->nem.s.fdVm        = -1;
+    for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+    {
+        pVM->aCpus[iCpu].nem.s.fdVCpu     = -1;
+        pVM->aCpus[iCpu].nem.s.hEmtThread = NIL_RTTHREAD;
+    }
+
+    /*
+     * Error state.
+     * The error message will be non-empty on failure and 'rc' will be set too.
+     */
+    RTERRINFOSTATIC ErrInfo;
+    PRTERRINFO pErrInfo = RTErrInfoInitStatic(&ErrInfo);
+    int rc = VINF_SUCCESS;
+    if (pVM->nem.s.fUseKvm)
+    {
+        rc = nemR3LnxInitProbe(pVM, pErrInfo);
+        if (RT_SUCCESS(rc))
+        {
+            rc = nemR3LnxInitCreateVm(pVM, pErrInfo);
+            if (RT_SUCCESS(rc))
+            {
+                VM_SET_MAIN_EXECUTION_ENGINE(pVM, VM_EXEC_ENGINE_NATIVE_API);
+                Log(("NEM: Marked active!\n"));
+                nemR3LnxDisableX2Apic(pVM);
+
+                /* Register release statistics */
+                STAMR3Register(pVM, &pVM->nem.s.StatMemSlotMap,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, "/NEM/MemSlotMap",
+                               STAMUNIT_OCCURENCES, "Number of KVM memory slots created");
+                STAMR3Register(pVM, &pVM->nem.s.StatMemSlotUnmap, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, "/NEM/MemSlotUnmap",
+                               STAMUNIT_OCCURENCES, "Number of KVM memory slots dropped");
+                for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+                {
+                    PNEMCPU pNemCpu = &pVM->aCpus[iCpu].nem.s;
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitPortIo,          STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of port I/O exits",               "/NEM/CPU%u/ExitPortIo", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitMmio,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of MMIO exits",                   "/NEM/CPU%u/ExitMmio", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitMmioMapped,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of MMIO exits mapping guest RAM", "/NEM/CPU%u/ExitMmioMapped", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitHalt,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of HLT exits",                    "/NEM/CPU%u/ExitHalt", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitInterruptWindow, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of interrupt window exits",       "/NEM/CPU%u/ExitInterruptWindow", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitShutdown,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of shutdown (triple fault) exits", "/NEM/CPU%u/ExitShutdown", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitEmulationFailure,STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of KVM emulation failure exits",  "/NEM/CPU%u/ExitEmulationFailure", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExitIntr,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of KVM_RUN calls interrupted",    "/NEM/CPU%u/ExitIntr", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatInjectInterrupt,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of interrupts injected",          "/NEM/CPU%u/InjectInterrupt", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatInjectNmi,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of NMIs injected",                "/NEM/CPU%u/InjectNmi", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatBreakOnFFPre,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of pre execution FF breaks",      "/NEM/CPU%u/BreakOnFFPre", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatBreakOnFFPost,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of post execution FF breaks",     "/NEM/CPU%u/BreakOnFFPost", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatBreakOnCancel,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of cancel execution breaks",      "/NEM/CPU%u/BreakOnCancel", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatBreakOnStatus,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of status code breaks",           "/NEM/CPU%u/BreakOnStatus", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatExport,              STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of state exports",                "/NEM/CPU%u/Export", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatImportOnDemand,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of on-demand state imports",      "/NEM/CPU%u/ImportOnDemand", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatImportOnReturn,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of state imports on loop return", "/NEM/CPU%u/ImportOnReturn", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatImportOnReturnSkipped, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of skipped state imports on loop return", "/NEM/CPU%u/ImportOnReturnSkipped", iCpu);
+                    STAMR3RegisterF(pVM, &pNemCpu->StatQueryCpuTick,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of TSC queries",                  "/NEM/CPU%u/QueryCpuTick", iCpu);
+                }
+            }
+        }
+    }
+    else
+        RTErrInfoSet(pErrInfo, VERR_NEM_NOT_ENABLED, "The KVM backend is not enabled (/NEM/UseKvm)");
+
+    /*
+     * We only fail if in forced mode, otherwise just log the complaint and return.
+     */
+    Assert(pVM->bMainExecutionEngine == VM_EXEC_ENGINE_NATIVE_API || RTErrInfoIsSet(pErrInfo));
+    if (   (fForced || !fFallback)
+        && pVM->bMainExecutionEngine != VM_EXEC_ENGINE_NATIVE_API)
+        return VMSetError(pVM, RT_SUCCESS_NP(rc) ? VERR_NEM_NOT_AVAILABLE : rc, RT_SRC_POS, "%s", pErrInfo->pszMsg);
+
+    if (RTErrInfoIsSet(pErrInfo))
+        LogRel(("NEM: Not available: %s\n", pErrInfo->pszMsg));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * This is called after CPUMR3Init is done.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle..
+ */
+int nemR3NativeInitAfterCPUM(PVM pVM)
+{
+    AssertReturn(pVM->nem.s.fdVm >= 0, VERR_WRONG_ORDER);
+    AssertReturn(pVM->bMainExecutionEngine == VM_EXEC_ENGINE_NATIVE_API, VERR_WRONG_ORDER);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Hands the guest CPUID leaves as configured by CPUM to KVM.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   pVCpu           The cross context virtual CPU structure.
+ */
+static int nemR3LnxSetCpuId(PVM pVM, PVMCPU pVCpu)
+{
+    NEMLNXCPUID *pCpuId = (NEMLNXCPUID *)RTMemTmpAllocZ(sizeof(*pCpuId));
+    AssertReturn(pCpuId, VERR_NO_TMP_MEMORY);
+
+    uint32_t cEntries = 0;
+    static uint32_t const s_auRangeBases[] = { UINT32_C(0x00000000), UINT32_C(0x80000000) };
+    for (unsigned iRange = 0; iRange < RT_ELEMENTS(s_auRangeBases); iRange++)
+    {
+        uint32_t uMax, uIgn;
+        CPUMGetGuestCpuId(pVCpu, s_auRangeBases[iRange], 0, &uMax, &uIgn, &uIgn, &uIgn);
+        if (uMax < s_auRangeBases[iRange] || uMax - s_auRangeBases[iRange] > 0xff)
+            continue;
+        for (uint32_t uLeaf = s_auRangeBases[iRange]; uLeaf <= uMax; uLeaf++)
+        {
+            /* Leaves with sub-leaves; include every non-empty one. */
+            bool const fIndexed = uLeaf == 4 || uLeaf == 7 || uLeaf == 0xb || uLeaf == 0xd || uLeaf == 0xf
+                               || uLeaf == 0x10 || uLeaf == 0x14 || uLeaf == UINT32_C(0x8000001d);
+            uint32_t const cSubLeaves = fIndexed ? 64 : 1;
+            for (uint32_t uSubLeaf = 0; uSubLeaf < cSubLeaves && cEntries < RT_ELEMENTS(pCpuId->aEntries); uSubLeaf++)
+            {
+                struct kvm_cpuid_entry2 *pEntry = &pCpuId->aEntries[cEntries];
+                CPUMGetGuestCpuId(pVCpu, uLeaf, uSubLeaf, &pEntry->eax, &pEntry->ebx, &pEntry->ecx, &pEntry->edx);
+                if (uSubLeaf > 0 && !pEntry->eax && !pEntry->ebx && !pEntry->ecx && !pEntry->edx)
+                    continue;
+                pEntry->function = uLeaf;
+                pEntry->index    = uSubLeaf;
+                pEntry->flags    = fIndexed ? KVM_CPUID_FLAG_SIGNIFCANT_INDEX : 0;
+                if (uLeaf == 1)
+                    /* The x2APIC, TSC deadline timer and MONITOR/MWAIT all need the in-kernel APIC. */
+                    pEntry->ecx &= ~(X86_CPUID_FEATURE_ECX_X2APIC | X86_CPUID_FEATURE_ECX_TSCDEADL | X86_CPUID_FEATURE_ECX_MONITOR);
+                cEntries++;
+            }
+        }
+    }
+
+    pCpuId->Hdr.nent = cEntries;
+    int rc = VINF_SUCCESS;
+    if (ioctl(pVCpu->nem.s.fdVCpu, KVM_SET_CPUID2, pCpuId) < 0)
+    {
+        rc = RTErrConvertFromErrno(errno);
+        LogRel(("NEM: KVM_SET_CPUID2 failed for vCPU %u with %u entries: %Rrc\n", pVCpu->idCpu, cEntries, rc));
+    }
+    RTMemTmpFree(pCpuId);
+    RT_NOREF(pVM);
+    return rc;
+}
+
+
+int nemR3NativeInitCompleted(PVM pVM, VMINITCOMPLETED enmWhat)
+{
+    if (enmWhat == VMINITCOMPLETED_RING3)
+    {
+        /*
+         * CPUM has settled the CPUID leaves by now and KVM wants them before
+         * the first KVM_RUN.
+         */
+        for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+        {
+            int rc = nemR3LnxSetCpuId(pVM, &pVM->aCpus[iCpu]);
+            if (RT_FAILURE(rc))
+                return VMSetError(pVM, rc, RT_SRC_POS, "Failed to set the CPUID leaves of vCPU %u: %Rrc", iCpu, rc);
+        }
+
+        /* Map guest RAM and ROM ahead of the first access, KVM cannot fetch
+           instructions or walk page tables in memory it has no slots for. */
+        ASMAtomicWriteBool(&pVM->nem.s.pMemSlots->fPremapPending, true);
+    }
+    else if (enmWhat == VMINITCOMPLETED_RING0)
+    {
+        /* Ring-0 can hand out pages now, so do the bulk of the mapping here on
+           EMT(0).  The pending flag stays set so the first run picks up
+           whatever loading a saved state or the devices changed since. */
+        nemR3LnxPremap(pVM, &pVM->aCpus[0]);
+    }
+    return VINF_SUCCESS;
+}
+
+
+int nemR3NativeTerm(PVM pVM)
+{
+    for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+    {
+        PVMCPU pVCpu = &pVM->aCpus[iCpu];
+        if (pVCpu->nem.s.pRun)
+        {
+            munmap(pVCpu->nem.s.pRun, pVM->nem.s.cbVCpuMmap);
+            pVCpu->nem.s.pRun = NULL;
+        }
+        if (pVCpu->nem.s.fdVCpu >= 0)
+        {
+            close(pVCpu->nem.s.fdVCpu);
+            pVCpu->nem.s.fdVCpu = -1;
+        }
+    }
+
+    if (pVM->nem.s.fdVm >= 0)
+    {
+        LogRel(("NEM: Destroying KVM VM...\n"));
+        close(pVM->nem.s.fdVm);
+        pVM->nem.s.fdVm = -1;
+    }
+    if (pVM->nem.s.fdKvm >= 0)
+    {
+        close(pVM->nem.s.fdKvm);
+        pVM->nem.s.fdKvm = -1;
+    }
+
+    PNEMLNXMEMSLOTS pMemSlots = pVM->nem.s.pMemSlots;
+    if (pMemSlots)
+    {
+        pVM->nem.s.pMemSlots = NULL;
+        RTCritSectDelete(&pMemSlots->CritSect);
+        RTMemFree(pMemSlots->paSlots);
+        RTMemFree(pMemSlots->pbmUsedIds);
+        RTMemFree(pMemSlots);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * VM reset notification.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+void nemR3NativeReset(PVM pVM)
+{
+    /* The RAM reset dropped most slots, map it all again before running. */
+    pVM->nem.s.fA20Enabled = true;
+    if (pVM->nem.s.pMemSlots)
+        ASMAtomicWriteBool(&pVM->nem.s.pMemSlots->fPremapPending, true);
+}
+
+
+/**
+ * Reset CPU due to INIT IPI or hot (un)plugging.
+ *
+ * @param   pVCpu       The cross context virtual CPU structure of the CPU being
+ *                      reset.
+ * @param   fInitIpi    Whether this is the INIT IPI or hot (un)plugging case.
+ */
+void nemR3NativeResetCpu(PVMCPU pVCpu, bool fInitIpi)
+{
+    /* CPUM has reset the context, make sure we push all of it to KVM and
+       forget about any pending I/O completion. */
+    pVCpu->nem.s.fPendingIoCompletion = false;
+    pVCpu->cpum.GstCtx.fExtrn = 0;
+    RT_NOREF(fInitIpi);
+}
+
+
+/*
+ *
+ * Memory slot management.
+ * Memory slot management.
+ * Memory slot management.
+ *
+ */
+
+/**
+ * Looks up the slot table index of the first slot ending after @a GCPhys.
+ *
+ * @returns Index into paSlots, cSlots if none.
+ * @param   pMemSlots   The memory slot table, owner.
+ * @param   GCPhys      The guest physical address.
+ */
+static uint32_t nemR3LnxSlotLookup(PNEMLNXMEMSLOTS pMemSlots, RTGCPHYS GCPhys)
+{
+    uint32_t iStart = 0;
+    uint32_t iEnd   = pMemSlots->cSlots;
+    while (iStart < iEnd)
+    {
+        uint32_t const iMid = iStart + (iEnd - iStart) / 2;
+        PNEMLNXMEMSLOT pSlot = &pMemSlots->paSlots[iMid];
+        if (GCPhys >= pSlot->GCPhys + pSlot->cb)
+            iStart = iMid + 1;
+        else
+            iEnd = iMid;
+    }
+    return iStart;
+}
+
+
+/**
+ * Removes the slot at @a iSlot from KVM and the table.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pMemSlots   The memory slot table, owner.
+ * @param   iSlot       The table index.
+ */
+static void nemR3LnxSlotRemove(PVM pVM, PNEMLNXMEMSLOTS pMemSlots, uint32_t iSlot)
+{
+    PNEMLNXMEMSLOT pSlot = &pMemSlots->paSlots[iSlot];
+    struct kvm_userspace_memory_region Region;
+    RT_ZERO(Region);
+    Region.slot            = pSlot->idSlot;
+    Region.guest_phys_addr = pSlot->GCPhys;
+    Region.memory_size     = 0;
+    if (ioctl(pVM->nem.s.fdVm, KVM_SET_USER_MEMORY_REGION, &Region) < 0)
+        AssertLogRelMsgFailed(("NEM: Deleting memory slot %u (%RGp LB %RGp) failed: %d\n",
+                               pSlot->idSlot, pSlot->GCPhys, pSlot->cb, errno));
+    Log5(("nemR3LnxSlotRemove: #%u %RGp LB %RGp\n", pSlot->idSlot, pSlot->GCPhys, pSlot->cb));
+
+    ASMBitClear(pMemSlots->pbmUsedIds, pSlot->idSlot);
+    pMemSlots->cSlots--;
+    if (iSlot < pMemSlots->cSlots)
+        memmove(pSlot, pSlot + 1, (pMemSlots->cSlots - iSlot) * sizeof(*pSlot));
+    STAM_REL_COUNTER_INC(&pVM->nem.s.StatMemSlotUnmap);
+}
+
+
+/**
+ * Drops all memory slots overlapping the given range.
+ *
+ * The generation is bumped even when no slot is dropped, as the range may be
+ * part of a run nemR3LnxMapRun is about to install.
+ *
+ * May be called with the PGM lock held.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The start of the range.
+ * @param   cb          The size of the range.
+ */
+static void nemR3LnxUnmapRange(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb)
+{
+    PNEMLNXMEMSLOTS pMemSlots = pVM->nem.s.pMemSlots;
+    if (!pMemSlots)
+        return;
+    RTCritSectEnter(&pMemSlots->CritSect);
+    ASMAtomicIncU32(&pMemSlots->uGeneration);
+
+    uint32_t iSlot = nemR3LnxSlotLookup(pMemSlots, GCPhys);
+    while (   iSlot < pMemSlots->cSlots
+           && pMemSlots->paSlots[iSlot].GCPhys < GCPhys + cb)
+        nemR3LnxSlotRemove(pVM, pMemSlots, iSlot);
+
+    RTCritSectLeave(&pMemSlots->CritSect);
+}
+
+
+/**
+ * Gets the page information for mapping decisions, optionally allocating zero
+ * RAM pages so they can be mapped writable.
+ *
+ * @returns true if the page can be mapped, false if all access must be
+ *          emulated.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure, optional.
+ * @param   GCPhys      The page address.
+ * @param   fAllocate   Whether to allocate zero RAM pages.
+ * @param   pfWritable  Where to return whether the page can be mapped writable.
+ * @param   ppvR3       Where to return the ring-3 address of the page.
+ */
+static bool nemR3LnxQueryMappablePage(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, bool fAllocate, bool *pfWritable, void **ppvR3)
+{
+    if (!pVM->nem.s.fA20Enabled && NEM_LNX_IS_SUBJECT_TO_A20(GCPhys))
+        return false;
+
+    PGMPHYSNEMPAGEINFO Info;
+    int rc = PGMPhysNemPageInfoChecker(pVM, pVCpu, GCPhys, false /*fMakeWritable*/, &Info, NULL, NULL);
+    if (RT_FAILURE(rc) || Info.fNemProt == NEM_PAGE_PROT_NONE)
+        return false;
+    if (   fAllocate
+        && !(Info.fNemProt & NEM_PAGE_PROT_WRITE)
+        && Info.fZeroPage
+        && !Info.fHasHandlers
+        && Info.enmType == PGMPAGETYPE_RAM)
+    {
+        /* Untouched RAM.  Allocate it now rather than mapping the shared zero page. */
+        rc = PGMPhysNemPageInfoChecker(pVM, pVCpu, GCPhys, true /*fMakeWritable*/, &Info, NULL, NULL);
+        if (RT_FAILURE(rc) || Info.fNemProt == NEM_PAGE_PROT_NONE)
+            return false;
+    }
+
+    PGMPAGEMAPLOCK Lock;
+    if (Info.fNemProt & NEM_PAGE_PROT_WRITE)
+    {
+        rc = PGMPhysGCPhys2CCPtr(pVM, GCPhys, ppvR3, &Lock);
+        *pfWritable = true;
+    }
+    else
+    {
+        rc = PGMPhysGCPhys2CCPtrReadOnly(pVM, GCPhys, (void const **)ppvR3, &Lock);
+        *pfWritable = false;
+    }
+    if (RT_FAILURE(rc))
+        return false;
+    PGMPhysReleasePageMappingLock(pVM, &Lock);
+    return true;
+}
+
+
+/**
+ * Maps the run of host contiguous pages with the same access rights around
+ * @a GCPhys into a new KVM memory slot.
+ *
+ * The run is confined to the naturally aligned NEM_LNX_MAX_SLOT_PAGES window
+ * containing the page and stops at existing slots.
+ *
+ * @returns VBox status code.
+ * @retval  VINF_SUCCESS if mapped or if the page isn't mappable.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure, optional.
+ * @param   GCPhys      The guest physical address.
+ * @param   pfMapped    Where to return whether a slot was created.  Optional.
+ * @param   pGCPhysEnd  Where to return the end of the run examined.  Optional.
+ */
+static int nemR3LnxMapRun(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, bool *pfMapped, PRTGCPHYS pGCPhysEnd)
+{
+    PNEMLNXMEMSLOTS pMemSlots = pVM->nem.s.pMemSlots;
+    if (pfMapped)
+        *pfMapped = false;
+    GCPhys &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    if (pGCPhysEnd)
+        *pGCPhysEnd = GCPhys + PAGE_SIZE;
+
+    /*
+     * Work out the window bounds, clipped by neighbouring slots.
+     */
+    RTGCPHYS const cbWindow   = (RTGCPHYS)NEM_LNX_MAX_SLOT_PAGES << PAGE_SHIFT;
+    RTGCPHYS       GCPhysLow  = GCPhys & ~(cbWindow - 1);
+    RTGCPHYS       GCPhysHigh = GCPhysLow + cbWindow;
+    RTCritSectEnter(&pMemSlots->CritSect);
+    uint32_t iSlot = nemR3LnxSlotLookup(pMemSlots, GCPhys);
+    if (iSlot < pMemSlots->cSlots)
+    {
+        PNEMLNXMEMSLOT pSlot = &pMemSlots->paSlots[iSlot];
+        if (pSlot->GCPhys <= GCPhys)
+        {
+            /* Already mapped (another vCPU beat us to it). */
+            if (pGCPhysEnd)
+                *pGCPhysEnd = pSlot->GCPhys + pSlot->cb;
+            RTCritSectLeave(&pMemSlots->CritSect);
+            return VINF_SUCCESS;
+        }
+        GCPhysHigh = RT_MIN(GCPhysHigh, pSlot->GCPhys);
+    }
+    if (iSlot > 0)
+    {
+        PNEMLNXMEMSLOT pSlot = &pMemSlots->paSlots[iSlot - 1];
+        GCPhysLow = RT_MAX(GCPhysLow, pSlot->GCPhys + pSlot->cb);
+    }
+    bool const fFull = pMemSlots->cSlots >= pMemSlots->cMaxSlots;
+    RTCritSectLeave(&pMemSlots->CritSect);
+    if (fFull)
+    {
+        LogRelMax(8, ("NEM: Out of KVM memory slots (%u), emulating access to %RGp\n", pMemSlots->cMaxSlots, GCPhys));
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * The page itself decides the access rights of the run, then grow it
+     * both ways.  This calls into PGM and must therefore not own the slot
+     * table critical section (lock order).
+     */
+    bool  fWritable;
+    void *pvPage;
+    if (!nemR3LnxQueryMappablePage(pVM, pVCpu, GCPhys, true /*fAllocate*/, &fWritable, &pvPage))
+        return VINF_SUCCESS;
+
+    RTGCPHYS GCPhysFirst = GCPhys;
+    uint8_t *pbFirst     = (uint8_t *)pvPage;
+    while (GCPhysFirst > GCPhysLow)
+    {
+        bool  fWritable2;
+        void *pv2;
+        if (   !nemR3LnxQueryMappablePage(pVM, pVCpu, GCPhysFirst - PAGE_SIZE, true /*fAllocate*/, &fWritable2, &pv2)
+            || fWritable2 != fWritable
+            || (uint8_t *)pv2 != pbFirst - PAGE_SIZE)
+            break;
+        GCPhysFirst -= PAGE_SIZE;
+        pbFirst     -= PAGE_SIZE;
+    }
+    RTGCPHYS GCPhysEnd = GCPhys + PAGE_SIZE;
+    while (GCPhysEnd < GCPhysHigh)
+    {
+        bool  fWritable2;
+        void *pv2;
+        if (   !nemR3LnxQueryMappablePage(pVM, pVCpu, GCPhysEnd, true /*fAllocate*/, &fWritable2, &pv2)
+            || fWritable2 != fWritable
+            || (uint8_t *)pv2 != pbFirst + (GCPhysEnd - GCPhysFirst))
+            break;
+        GCPhysEnd += PAGE_SIZE;
+    }
+    if (pGCPhysEnd)
+        *pGCPhysEnd = GCPhysEnd;
+
+    /*
+     * Allocating the zero pages above drops slots through the NEM
+     * notifications, bumping the generation.  So, only take the snapshot now
+     * and check that the run is unchanged without allocating anything.
+     */
+    uint32_t const uGeneration = ASMAtomicReadU32(&pMemSlots->uGeneration);
+    for (RTGCPHYS GCPhysCur = GCPhysFirst; GCPhysCur < GCPhysEnd; GCPhysCur += PAGE_SIZE)
+    {
+        bool  fWritable2;
+        void *pv2;
+        if (   !nemR3LnxQueryMappablePage(pVM, pVCpu, GCPhysCur, false /*fAllocate*/, &fWritable2, &pv2)
+            || fWritable2 != fWritable
+            || (uint8_t *)pv2 != pbFirst + (GCPhysCur - GCPhysFirst))
+        {
+            Log5(("nemR3LnxMapRun: %RGp changed while examining %RGp LB %RGp\n", GCPhysCur, GCPhysFirst, GCPhysEnd - GCPhysFirst));
+            return VINF_SUCCESS;
+        }
+    }
+
+    /*
+     * Install it unless PGM changed something while we weren't looking.
+     */
+    int rc = VINF_SUCCESS;
+    RTCritSectEnter(&pMemSlots->CritSect);
+    if (   ASMAtomicReadU32(&pMemSlots->uGeneration) == uGeneration
+        && pMemSlots->cSlots < pMemSlots->cMaxSlots)
+    {
+        iSlot = nemR3LnxSlotLookup(pMemSlots, GCPhysFirst);
+        if (   iSlot >= pMemSlots->cSlots
+            || pMemSlots->paSlots[iSlot].GCPhys >= GCPhysEnd)
+        {
+            int32_t const idSlot = ASMBitFirstClear(pMemSlots->pbmUsedIds, pMemSlots->cMaxSlots);
+            Assert(idSlot >= 0);
+
+            struct kvm_userspace_memory_region Region;
+            RT_ZERO(Region);
+            Region.slot            = (uint32_t)idSlot;
+            Region.flags           = fWritable ? 0 : KVM_MEM_READONLY;
+            Region.guest_phys_addr = GCPhysFirst;
+            Region.memory_size     = GCPhysEnd - GCPhysFirst;
+            Region.userspace_addr  = (uintptr_t)pbFirst;
+            if (idSlot >= 0 && ioctl(pVM->nem.s.fdVm, KVM_SET_USER_MEMORY_REGION, &Region) >= 0)
+            {
+                ASMBitSet(pMemSlots->pbmUsedIds, idSlot);
+                PNEMLNXMEMSLOT pSlot = &pMemSlots->paSlots[iSlot];
+                if (iSlot < pMemSlots->cSlots)
+                    memmove(pSlot + 1, pSlot, (pMemSlots->cSlots - iSlot) * sizeof(*pSlot));
+                pSlot->GCPhys    = GCPhysFirst;
+                pSlot->cb        = GCPhysEnd - GCPhysFirst;
+                pSlot->pvR3      = pbFirst;
+                pSlot->idSlot    = (uint32_t)idSlot;
+                pSlot->fWritable = fWritable;
+                pMemSlots->cSlots++;
+                STAM_REL_COUNTER_INC(&pVM->nem.s.StatMemSlotMap);
+                if (pfMapped)
+                    *pfMapped = true;
+                Log5(("nemR3LnxMapRun: #%u %RGp LB %RGp %s -> %p\n", idSlot, GCPhysFirst, GCPhysEnd - GCPhysFirst,
+                      fWritable ? "RW" : "RO", pbFirst));
+            }
+            else
+            {
+                rc = RTErrConvertFromErrno(errno);
+                LogRelMax(32, ("NEM: Creating memory slot for %RGp LB %RGp failed: %Rrc\n",
+                               GCPhysFirst, GCPhysEnd - GCPhysFirst, rc));
+                rc = VINF_SUCCESS; /* Not fatal, the accesses will be emulated. */
+            }
+        }
+    }
+    RTCritSectLeave(&pMemSlots->CritSect);
+    return rc;
+}
+
+
+/**
+ * Maps all the registered RAM and ROM ranges.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ */
+static void nemR3LnxPremap(PVM pVM, PVMCPU pVCpu)
+{
+    PNEMLNXMEMSLOTS pMemSlots = pVM->nem.s.pMemSlots;
+    for (uint32_t i = 0; i < pMemSlots->cPremapRanges; i++)
+    {
+        RTGCPHYS       GCPhys    = pMemSlots->aPremapRanges[i].GCPhys;
+        RTGCPHYS const GCPhysEnd = GCPhys + pMemSlots->aPremapRanges[i].cb;
+        while (GCPhys < GCPhysEnd)
+        {
+            RTGCPHYS GCPhysNext = GCPhys + PAGE_SIZE;
+            nemR3LnxMapRun(pVM, pVCpu, GCPhys, NULL, &GCPhysNext);
+            GCPhys = RT_MAX(GCPhysNext, GCPhys + PAGE_SIZE);
+        }
+    }
+    LogRel(("NEM: Pre-mapped guest memory using %u KVM memory slots\n", pMemSlots->cSlots));
+}
+
+
+/**
+ * Records a range for pre-mapping.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The start of the range.
+ * @param   cb          The size of the range.
+ */
+static void nemR3LnxAddPremapRange(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb)
+{
+    PNEMLNXMEMSLOTS pMemSlots = pVM->nem.s.pMemSlots;
+    if (!pMemSlots)
+        return;
+    RTCritSectEnter(&pMemSlots->CritSect);
+    if (pMemSlots->cPremapRanges < RT_ELEMENTS(pMemSlots->aPremapRanges))
+    {
+        pMemSlots->aPremapRanges[pMemSlots->cPremapRanges].GCPhys = GCPhys;
+        pMemSlots->aPremapRanges[pMemSlots->cPremapRanges].cb     = cb;
+        pMemSlots->cPremapRanges++;
+    }
+    else
+        LogRel(("NEM: Too many ranges, %RGp LB %RGp will be mapped on demand\n", GCPhys, cb));
+    RTCritSectLeave(&pMemSlots->CritSect);
+}
+
+
+int nemR3NativeNotifyPhysRamRegister(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb)
+{
+    Log5(("nemR3NativeNotifyPhysRamRegister: %RGp LB %RGp\n", GCPhys, cb));
+    nemR3LnxAddPremapRange(pVM, GCPhys, cb);
+    return VINF_SUCCESS;
+}
+
+
+int nemR3NativeNotifyPhysMmioExMap(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb, uint32_t fFlags, void *pvMmio2)
+{
+    Log5(("nemR3NativeNotifyPhysMmioExMap: %RGp LB %RGp fFlags=%#x pvMmio2=%p\n", GCPhys, cb, fFlags, pvMmio2));
+    /* MMIO2 is mapped on the first access; plain MMIO replacing RAM must go. */
+    nemR3LnxUnmapRange(pVM, GCPhys, cb);
+    RT_NOREF(fFlags, pvMmio2);
+    return VINF_SUCCESS;
+}
+
+
+int nemR3NativeNotifyPhysMmioExUnmap(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb, uint32_t fFlags)
+{
+    Log5(("nemR3NativeNotifyPhysMmioExUnmap: %RGp LB %RGp fFlags=%#x\n", GCPhys, cb, fFlags));
+    nemR3LnxUnmapRange(pVM, GCPhys, cb);
+    RT_NOREF(fFlags);
+    return VINF_SUCCESS;
+}
+
+
+int nemR3NativeNotifyPhysRomRegisterEarly(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb, uint32_t fFlags)
+{
+    Log5(("nemR3NativeNotifyPhysRomRegisterEarly: %RGp LB %RGp fFlags=%#x\n", GCPhys, cb, fFlags));
+    nemR3LnxUnmapRange(pVM, GCPhys, cb);
+    RT_NOREF(fFlags);
+    return VINF_SUCCESS;
+}
+
+
+int nemR3NativeNotifyPhysRomRegisterLate(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb, uint32_t fFlags)
+{
+    Log5(("nemR3NativeNotifyPhysRomRegisterLate: %RGp LB %RGp fFlags=%#x\n", GCPhys, cb, fFlags));
+    nemR3LnxAddPremapRange(pVM, GCPhys, cb);
+    RT_NOREF(fFlags);
+    return VINF_SUCCESS;
+}
+
+
+void nemR3NativeNotifySetA20(PVMCPU pVCpu, bool fEnabled)
+{
+    Log(("nemR3NativeNotifySetA20: fEnabled=%RTbool\n", fEnabled));
+    PVM pVM = pVCpu->CTX_SUFF(pVM);
+    if (pVM->nem.s.fA20Enabled != fEnabled)
+    {
+        pVM->nem.s.fA20Enabled = fEnabled;
+        nemR3LnxUnmapRange(pVM, _1M, _64K);
+    }
+}
+
+
+void nemHCNativeNotifyHandlerPhysicalRegister(PVM pVM, PGMPHYSHANDLERKIND enmKind, RTGCPHYS GCPhys, RTGCPHYS cb)
+{
+    Log5(("nemHCNativeNotifyHandlerPhysicalRegister: %RGp LB %RGp enmKind=%d\n", GCPhys, cb, enmKind));
+    nemR3LnxUnmapRange(pVM, GCPhys, cb);
+    NOREF(enmKind);
+}
+
+
+void nemHCNativeNotifyHandlerPhysicalDeregister(PVM pVM, PGMPHYSHANDLERKIND enmKind, RTGCPHYS GCPhys, RTGCPHYS cb,
+                                                int fRestoreAsRAM, bool fRestoreAsRAM2)
+{
+    Log5(("nemHCNativeNotifyHandlerPhysicalDeregister: %RGp LB %RGp enmKind=%d fRestoreAsRAM=%d fRestoreAsRAM2=%d\n",
+          GCPhys, cb, enmKind, fRestoreAsRAM, fRestoreAsRAM2));
+    nemR3LnxUnmapRange(pVM, GCPhys, cb);
+    NOREF(enmKind); NOREF(fRestoreAsRAM); NOREF(fRestoreAsRAM2);
+}
+
+
+void nemHCNativeNotifyHandlerPhysicalModify(PVM pVM, PGMPHYSHANDLERKIND enmKind, RTGCPHYS GCPhysOld,
+                                            RTGCPHYS GCPhysNew, RTGCPHYS cb, bool fRestoreAsRAM)
+{
+    Log5(("nemHCNativeNotifyHandlerPhysicalModify: %RGp LB %RGp -> %RGp enmKind=%d fRestoreAsRAM=%d\n",
+          GCPhysOld, cb, GCPhysNew, enmKind, fRestoreAsRAM));
+    nemR3LnxUnmapRange(pVM, GCPhysOld, cb);
+    nemR3LnxUnmapRange(pVM, GCPhysNew, cb);
+    NOREF(enmKind); NOREF(fRestoreAsRAM);
+}
+
+
+int nemHCNativeNotifyPhysPageAllocated(PVM pVM, RTGCPHYS GCPhys, RTHCPHYS HCPhys, uint32_t fPageProt,
+                                       PGMPAGETYPE enmType, uint8_t *pu2State)
+{
+    Log5(("nemHCNativeNotifyPhysPageAllocated: %RGp HCPhys=%RHp fPageProt=%#x enmType=%d\n",
+          GCPhys, HCPhys, fPageProt, enmType));
+    nemR3LnxUnmapRange(pVM, GCPhys, PAGE_SIZE);
+    RT_NOREF(HCPhys, fPageProt, enmType, pu2State);
+    return VINF_SUCCESS;
+}
+
+
+void nemHCNativeNotifyPhysPageProtChanged(PVM pVM, RTGCPHYS GCPhys, RTHCPHYS HCPhys, uint32_t fPageProt,
+                                          PGMPAGETYPE enmType, uint8_t *pu2State)
+{
+    Log5(("nemHCNativeNotifyPhysPageProtChanged: %RGp HCPhys=%RHp fPageProt=%#x enmType=%d\n",
+          GCPhys, HCPhys, fPageProt, enmType));
+    nemR3LnxUnmapRange(pVM, GCPhys, PAGE_SIZE);
+    RT_NOREF(HCPhys, fPageProt, enmType, pu2State);
+}
+
+
+void nemHCNativeNotifyPhysPageChanged(PVM pVM, RTGCPHYS GCPhys, RTHCPHYS HCPhysPrev, RTHCPHYS HCPhysNew, uint32_t fPageProt,
+                                      PGMPAGETYPE enmType, uint8_t *pu2State)
+{
+    Log5(("nemHCNativeNotifyPhysPageChanged: %RGp HCPhys=%RHp->%RHp fPageProt=%#x enmType=%d\n",
+          GCPhys, HCPhysPrev, HCPhysNew, fPageProt, enmType));
+    nemR3LnxUnmapRange(pVM, GCPhys, PAGE_SIZE);
+    RT_NOREF(HCPhysPrev, HCPhysNew, fPageProt, enmType, pu2State);
+}
+
+
+/*
+ *
+ * State import and export.
+ * State import and export.
+ * State import and export.
+ *
+ */
+
+/**
+ * Lets KVM finish the instruction of a port I/O or MMIO exit without running
+ * any further guest code, so the registers it hands out are consistent.
+ *
+ * @returns VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ */
+static int nemR3LnxCompletePendingIo(PVMCPU pVCpu)
+{
+    struct kvm_run *pRun = pVCpu->nem.s.pRun;
+    ASMAtomicWriteU8(&pRun->immediate_exit, 1);
+    int rcLnx = ioctl(pVCpu->nem.s.fdVCpu, KVM_RUN, 0);
+    int iErrno = errno;
+    ASMAtomicWriteU8(&pRun->immediate_exit, 0);
+    pVCpu->nem.s.fPendingIoCompletion = false;
+    AssertLogRelMsgReturn(rcLnx < 0 && iErrno == EINTR, ("KVM_RUN(immediate_exit) -> %d errno=%d\n", rcLnx, iErrno),
+                          VERR_NEM_IPE_4);
+    return VINF_SUCCESS;
+}
+
+
+/** Converts a KVM segment register to a CPUM one. */
+DECLINLINE(void) nemR3LnxSegFromKvm(PCPUMSELREG pSReg, struct kvm_segment const *pKvmSeg)
+{
+    pSReg->Sel          = pKvmSeg->selector;
+    pSReg->ValidSel     = pKvmSeg->selector;
+    pSReg->fFlags       = CPUMSELREG_FLAGS_VALID;
+    pSReg->u64Base      = pKvmSeg->base;
+    pSReg->u32Limit     = pKvmSeg->limit;
+    pSReg->Attr.u       = 0;
+    pSReg->Attr.n.u4Type        = pKvmSeg->type;
+    pSReg->Attr.n.u1DescType    = pKvmSeg->s;
+    pSReg->Attr.n.u2Dpl         = pKvmSeg->dpl;
+    pSReg->Attr.n.u1Present     = pKvmSeg->present;
+    pSReg->Attr.n.u1Available   = pKvmSeg->avl;
+    pSReg->Attr.n.u1Long        = pKvmSeg->l;
+    pSReg->Attr.n.u1DefBig      = pKvmSeg->db;
+    pSReg->Attr.n.u1Granularity = pKvmSeg->g;
+    pSReg->Attr.n.u1Unusable    = pKvmSeg->unusable;
+}
+
+
+/** Converts a CPUM segment register to a KVM one. */
+DECLINLINE(void) nemR3LnxSegToKvm(struct kvm_segment *pKvmSeg, PCCPUMSELREG pSReg)
+{
+    pKvmSeg->base       = pSReg->u64Base;
+    pKvmSeg->limit      = pSReg->u32Limit;
+    pKvmSeg->selector   = pSReg->Sel;
+    pKvmSeg->type       = pSReg->Attr.n.u4Type;
+    pKvmSeg->s          = pSReg->Attr.n.u1DescType;
+    pKvmSeg->dpl        = pSReg->Attr.n.u2Dpl;
+    pKvmSeg->present    = pSReg->Attr.n.u1Present;
+    pKvmSeg->avl        = pSReg->Attr.n.u1Available;
+    pKvmSeg->l          = pSReg->Attr.n.u1Long;
+    pKvmSeg->db         = pSReg->Attr.n.u1DefBig;
+    pKvmSeg->g          = pSReg->Attr.n.u1Granularity;
+    pKvmSeg->unusable   = pSReg->Attr.n.u1Unusable;
+    pKvmSeg->padding    = 0;
+}
+
+
+/**
+ * Fills in the MSR indexes we sync with KVM.
+ *
+ * @returns Number of entries.
+ * @param   pMsrs       The MSR buffer.
+ */
+static uint32_t nemR3LnxInitMsrIndexes(NEMLNXMSRS *pMsrs)
+{
+    static uint32_t const s_auMsrs[] =
+    {
+        MSR_K6_STAR, MSR_K8_LSTAR, MSR_K8_CSTAR, MSR_K8_SF_MASK, MSR_K8_KERNEL_GS_BASE,
+        MSR_IA32_SYSENTER_CS, MSR_IA32_SYSENTER_EIP, MSR_IA32_SYSENTER_ESP, MSR_K8_TSC_AUX, MSR_IA32_CR_PAT,
+    };
+    AssertCompile(RT_ELEMENTS(s_auMsrs) <= RT_ELEMENTS(pMsrs->aEntries));
+    RT_ZERO(*pMsrs);
+    for (uint32_t i = 0; i < RT_ELEMENTS(s_auMsrs); i++)
+        pMsrs->aEntries[i].index = s_auMsrs[i];
+    pMsrs->Hdr.nmsrs = RT_ELEMENTS(s_auMsrs);
+    return RT_ELEMENTS(s_auMsrs);
+}
+
+
+/**
+ * Imports state from KVM into CPUMCTX.
+ *
+ * @returns VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ * @param   fWhat       What to import, CPUMCTX_EXTRN_XXX.  Widened to whole
+ *                      KVM state groups.
+ */
+static int nemR3LnxImportState(PVMCPU pVCpu, uint64_t fWhat)
+{
+    PVM const pVM    = pVCpu->CTX_SUFF(pVM);
+    int const fdVCpu = pVCpu->nem.s.fdVCpu;
+    fWhat &= pVCpu->cpum.GstCtx.fExtrn & NEM_LNX_EXTRN_ALL;
+    if (!fWhat)
+        return VINF_SUCCESS;
+
+    /* Setting the special registers clears KVM's pending interrupt, so the
+       events must travel with them.  The interrupt shadow needs RIP. */
+    if (fWhat & (NEM_LNX_EXTRN_SREGS | NEM_LNX_EXTRN_EVENTS))
+        fWhat |= NEM_LNX_EXTRN_SREGS | NEM_LNX_EXTRN_EVENTS | NEM_LNX_EXTRN_REGS;
+    if (fWhat & NEM_LNX_EXTRN_REGS)     fWhat |= NEM_LNX_EXTRN_REGS;
+    if (fWhat & NEM_LNX_EXTRN_FPU)      fWhat |= NEM_LNX_EXTRN_FPU;
+    if (fWhat & NEM_LNX_EXTRN_DEBUG)    fWhat |= NEM_LNX_EXTRN_DEBUG;
+    if (fWhat & NEM_LNX_EXTRN_MSRS)     fWhat |= NEM_LNX_EXTRN_MSRS;
+    fWhat &= pVCpu->cpum.GstCtx.fExtrn;
+
+    if (pVCpu->nem.s.fPendingIoCompletion)
+    {
+        int rc = nemR3LnxCompletePendingIo(pVCpu);
+        AssertRCReturn(rc, rc);
+    }
+
+    PCPUMCTX pCtx = &pVCpu->cpum.GstCtx;
+    if (fWhat & NEM_LNX_EXTRN_REGS)
+    {
+        struct kvm_regs Regs;
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_GET_REGS, &Regs) >= 0, ("KVM_GET_REGS -> %d\n", errno),
+                              VERR_NEM_GET_REGISTERS_FAILED);
+        pCtx->rax = Regs.rax;   pCtx->rcx = Regs.rcx;   pCtx->rdx = Regs.rdx;   pCtx->rbx = Regs.rbx;
+        pCtx->rsp = Regs.rsp;   pCtx->rbp = Regs.rbp;   pCtx->rsi = Regs.rsi;   pCtx->rdi = Regs.rdi;
+        pCtx->r8  = Regs.r8;    pCtx->r9  = Regs.r9;    pCtx->r10 = Regs.r10;   pCtx->r11 = Regs.r11;
+        pCtx->r12 = Regs.r12;   pCtx->r13 = Regs.r13;   pCtx->r14 = Regs.r14;   pCtx->r15 = Regs.r15;
+        pCtx->rip = Regs.rip;
+        pCtx->rflags.u = Regs.rflags;
+    }
+
+    bool fMaybeChangedMode = false;
+    bool fUpdateCr3        = false;
+    if (fWhat & NEM_LNX_EXTRN_SREGS)
+    {
+        struct kvm_sregs SRegs;
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_GET_SREGS, &SRegs) >= 0, ("KVM_GET_SREGS -> %d\n", errno),
+                              VERR_NEM_GET_REGISTERS_FAILED);
+        nemR3LnxSegFromKvm(&pCtx->es, &SRegs.es);
+        nemR3LnxSegFromKvm(&pCtx->cs, &SRegs.cs);
+        nemR3LnxSegFromKvm(&pCtx->ss, &SRegs.ss);
+        nemR3LnxSegFromKvm(&pCtx->ds, &SRegs.ds);
+        nemR3LnxSegFromKvm(&pCtx->fs, &SRegs.fs);
+        nemR3LnxSegFromKvm(&pCtx->gs, &SRegs.gs);
+        nemR3LnxSegFromKvm(&pCtx->ldtr, &SRegs.ldt);
+        nemR3LnxSegFromKvm(&pCtx->tr, &SRegs.tr);
+        pCtx->gdtr.cbGdt = SRegs.gdt.limit;
+        pCtx->gdtr.pGdt  = SRegs.gdt.base;
+        pCtx->idtr.cbIdt = SRegs.idt.limit;
+        pCtx->idtr.pIdt  = SRegs.idt.base;
+        if (pCtx->cr0 != SRegs.cr0)
+        {
+            CPUMSetGuestCR0(pVCpu, SRegs.cr0);
+            fMaybeChangedMode = true;
+        }
+        pCtx->cr2 = SRegs.cr2;
+        if (pCtx->cr3 != SRegs.cr3)
+        {
+            CPUMSetGuestCR3(pVCpu, SRegs.cr3);
+            fUpdateCr3 = true;
+        }
+        if (pCtx->cr4 != SRegs.cr4)
+        {
+            CPUMSetGuestCR4(pVCpu, SRegs.cr4);
+            fMaybeChangedMode = true;
+        }
+        if (pCtx->msrEFER != SRegs.efer)
+        {
+            pCtx->msrEFER = SRegs.efer;
+            fMaybeChangedMode = true;
+        }
+        APICSetTpr(pVCpu, (uint8_t)(SRegs.cr8 << 4));
+    }
+
+    if (fWhat & NEM_LNX_EXTRN_FPU)
+    {
+        struct kvm_xsave *pXSave = (struct kvm_xsave *)RTMemTmpAlloc(sizeof(*pXSave));
+        AssertReturn(pXSave, VERR_NO_TMP_MEMORY);
+        if (ioctl(fdVCpu, KVM_GET_XSAVE, pXSave) < 0)
+        {
+            RTMemTmpFree(pXSave);
+            AssertLogRelMsgFailedReturn(("KVM_GET_XSAVE -> %d\n", errno), VERR_NEM_GET_REGISTERS_FAILED);
+        }
+        uint8_t const *pbXSave = (uint8_t const *)&pXSave->region[0];
+        PX86XSAVEAREA  pXState = pCtx->CTX_SUFF(pXState);
+        memcpy(&pXState->x87, pbXSave, sizeof(pXState->x87));
+        if (pCtx->fXStateMask)
+        {
+            memcpy(&pXState->Hdr, pbXSave + RT_UOFFSETOF(X86XSAVEAREA, Hdr), sizeof(pXState->Hdr));
+            if (pCtx->fXStateMask & RT_BIT_64(XSAVE_C_YMM_BIT))
+            {
+                uint16_t const offYmm = pCtx->aoffXState[XSAVE_C_YMM_BIT];
+                memcpy((uint8_t *)pXState + offYmm, pbXSave + offYmm, sizeof(X86XSAVEYMMHI));
+            }
+        }
+        RTMemTmpFree(pXSave);
+
+        if (pVM->nem.s.fHasXcrs)
+        {
+            struct kvm_xcrs Xcrs;
+            AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_GET_XCRS, &Xcrs) >= 0, ("KVM_GET_XCRS -> %d\n", errno),
+                                  VERR_NEM_GET_REGISTERS_FAILED);
+            for (uint32_t i = 0; i < Xcrs.nr_xcrs && i < RT_ELEMENTS(Xcrs.xcrs); i++)
+                if (Xcrs.xcrs[i].xcr < RT_ELEMENTS(pCtx->aXcr))
+                    pCtx->aXcr[Xcrs.xcrs[i].xcr] = Xcrs.xcrs[i].value;
+        }
+    }
+
+    if (fWhat & NEM_LNX_EXTRN_DEBUG)
+    {
+        struct kvm_debugregs DbgRegs;
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_GET_DEBUGREGS, &DbgRegs) >= 0, ("KVM_GET_DEBUGREGS -> %d\n", errno),
+                              VERR_NEM_GET_REGISTERS_FAILED);
+        pCtx->dr[0] = DbgRegs.db[0];
+        pCtx->dr[1] = DbgRegs.db[1];
+        pCtx->dr[2] = DbgRegs.db[2];
+        pCtx->dr[3] = DbgRegs.db[3];
+        pCtx->dr[6] = DbgRegs.dr6;
+        if (pCtx->dr[7] != DbgRegs.dr7)
+        {
+            pCtx->fExtrn &= ~CPUMCTX_EXTRN_DR7;
+            CPUMSetGuestDR7(pVCpu, DbgRegs.dr7);
+        }
+    }
+
+    if (fWhat & NEM_LNX_EXTRN_MSRS)
+    {
+        NEMLNXMSRS Msrs;
+        uint32_t const cMsrs = nemR3LnxInitMsrIndexes(&Msrs);
+        int rcLnx = ioctl(fdVCpu, KVM_GET_MSRS, &Msrs);
+        AssertLogRelMsgReturn(rcLnx == (int)cMsrs, ("KVM_GET_MSRS -> %d (errno %d), expected %u\n", rcLnx, errno, cMsrs),
+                              VERR_NEM_GET_REGISTERS_FAILED);
+        PCPUMCTXMSRS pCtxMsrs = CPUMQueryGuestCtxMsrsPtr(pVCpu);
+        for (uint32_t i = 0; i < cMsrs; i++)
+        {
+            uint64_t const uValue = Msrs.aEntries[i].data;
+            switch (Msrs.aEntries[i].index)
+            {
+                case MSR_K6_STAR:               pCtx->msrSTAR         = uValue; break;
+                case MSR_K8_LSTAR:              pCtx->msrLSTAR        = uValue; break;
+                case MSR_K8_CSTAR:              pCtx->msrCSTAR        = uValue; break;
+                case MSR_K8_SF_MASK:            pCtx->msrSFMASK       = uValue; break;
+                case MSR_K8_KERNEL_GS_BASE:     pCtx->msrKERNELGSBASE = uValue; break;
+                case MSR_IA32_SYSENTER_CS:      pCtx->SysEnter.cs     = uValue; break;
+                case MSR_IA32_SYSENTER_EIP:     pCtx->SysEnter.eip    = uValue; break;
+                case MSR_IA32_SYSENTER_ESP:     pCtx->SysEnter.esp    = uValue; break;
+                case MSR_K8_TSC_AUX:            pCtxMsrs->msr.TscAux  = uValue; break;
+                case MSR_IA32_CR_PAT:           pCtx->msrPAT          = uValue; break;
+            }
+        }
+    }
+
+    if (fWhat & NEM_LNX_EXTRN_EVENTS)
+    {
+        struct kvm_vcpu_events Events;
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_GET_VCPU_EVENTS, &Events) >= 0, ("KVM_GET_VCPU_EVENTS -> %d\n", errno),
+                              VERR_NEM_GET_REGISTERS_FAILED);
+        if (Events.interrupt.shadow)
+            EMSetInhibitInterruptsPC(pVCpu, pCtx->rip);
+        else if (VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INHIBIT_INTERRUPTS))
+            VMCPU_FF_CLEAR(pVCpu, VMCPU_FF_INHIBIT_INTERRUPTS);
+        if (Events.nmi.masked)
+            VMCPU_FF_SET(pVCpu, VMCPU_FF_BLOCK_NMIS);
+        else
+            VMCPU_FF_CLEAR(pVCpu, VMCPU_FF_BLOCK_NMIS);
+        if (Events.nmi.pending)
+            VMCPU_FF_SET(pVCpu, VMCPU_FF_INTERRUPT_NMI);
+
+        /* Events KVM accepted but didn't deliver yet are handed to TRPM, from
+           where IEM or the next export picks them up. */
+        if (!TRPMHasTrap(pVCpu))
+        {
+            if (Events.exception.injected)
+            {
+                TRPMAssertTrap(pVCpu, Events.exception.nr, TRPM_TRAP);
+                if (Events.exception.has_error_code)
+                    TRPMSetErrorCode(pVCpu, Events.exception.error_code);
+            }
+            else if (Events.interrupt.injected)
+                TRPMAssertTrap(pVCpu, Events.interrupt.nr, Events.interrupt.soft ? TRPM_SOFTWARE_INT : TRPM_HARDWARE_INT);
+            else if (Events.nmi.injected)
+                TRPMAssertTrap(pVCpu, X86_XCPT_NMI, TRPM_HARDWARE_INT);
+        }
+    }
+
+    pCtx->fExtrn &= ~fWhat;
+    if (!(pCtx->fExtrn & NEM_LNX_EXTRN_ALL))
+        pCtx->fExtrn = 0;
+
+    if (fMaybeChangedMode)
+    {
+        int rc = PGMChangeMode(pVCpu, pCtx->cr0, pCtx->cr4, pCtx->msrEFER);
+        AssertMsgReturn(rc == VINF_SUCCESS, ("rc=%Rrc\n", rc), RT_FAILURE_NP(rc) ? rc : VERR_NEM_IPE_1);
+    }
+    if (fUpdateCr3)
+    {
+        int rc = PGMUpdateCR3(pVCpu, pCtx->cr3);
+        AssertMsgReturn(rc == VINF_SUCCESS, ("rc=%Rrc\n", rc), RT_FAILURE_NP(rc) ? rc : VERR_NEM_IPE_2);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Pushes the state groups CPUMCTX owns (fExtrn clear) to KVM.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ */
+static int nemR3LnxExportState(PVM pVM, PVMCPU pVCpu)
+{
+    PCPUMCTX  pCtx   = &pVCpu->cpum.GstCtx;
+    int const fdVCpu = pVCpu->nem.s.fdVCpu;
+    uint64_t const fLocal = ~pCtx->fExtrn & NEM_LNX_EXTRN_ALL;
+    Assert(!pVCpu->nem.s.fPendingIoCompletion);
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExport);
+
+    if (fLocal & NEM_LNX_EXTRN_REGS)
+    {
+        struct kvm_regs Regs;
+        Regs.rax = pCtx->rax;   Regs.rcx = pCtx->rcx;   Regs.rdx = pCtx->rdx;   Regs.rbx = pCtx->rbx;
+        Regs.rsp = pCtx->rsp;   Regs.rbp = pCtx->rbp;   Regs.rsi = pCtx->rsi;   Regs.rdi = pCtx->rdi;
+        Regs.r8  = pCtx->r8;    Regs.r9  = pCtx->r9;    Regs.r10 = pCtx->r10;   Regs.r11 = pCtx->r11;
+        Regs.r12 = pCtx->r12;   Regs.r13 = pCtx->r13;   Regs.r14 = pCtx->r14;   Regs.r15 = pCtx->r15;
+        Regs.rip = pCtx->rip;
+        Regs.rflags = pCtx->rflags.u;
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_SET_REGS, &Regs) >= 0, ("KVM_SET_REGS -> %d\n", errno),
+                              VERR_NEM_SET_REGISTERS_FAILED);
+    }
+
+    if (fLocal & NEM_LNX_EXTRN_SREGS)
+    {
+        struct kvm_sregs SRegs;
+        RT_ZERO(SRegs);
+        nemR3LnxSegToKvm(&SRegs.es, &pCtx->es);
+        nemR3LnxSegToKvm(&SRegs.cs, &pCtx->cs);
+        nemR3LnxSegToKvm(&SRegs.ss, &pCtx->ss);
+        nemR3LnxSegToKvm(&SRegs.ds, &pCtx->ds);
+        nemR3LnxSegToKvm(&SRegs.fs, &pCtx->fs);
+        nemR3LnxSegToKvm(&SRegs.gs, &pCtx->gs);
+        nemR3LnxSegToKvm(&SRegs.ldt, &pCtx->ldtr);
+        nemR3LnxSegToKvm(&SRegs.tr, &pCtx->tr);
+        SRegs.gdt.base  = pCtx->gdtr.pGdt;
+        SRegs.gdt.limit = pCtx->gdtr.cbGdt;
+        SRegs.idt.base  = pCtx->idtr.pIdt;
+        SRegs.idt.limit = pCtx->idtr.cbIdt;
+        SRegs.cr0       = pCtx->cr0;
+        SRegs.cr2       = pCtx->cr2;
+        SRegs.cr3       = pCtx->cr3;
+        SRegs.cr4       = pCtx->cr4;
+        SRegs.efer      = pCtx->msrEFER;
+        uint8_t u8Tpr = 0;
+        APICGetTpr(pVCpu, &u8Tpr, NULL, NULL);
+        SRegs.cr8       = u8Tpr >> 4;
+        SRegs.apic_base = APICGetBaseMsrNoCheck(pVCpu);
+        /* interrupt_bitmap stays zero, pending interrupts travel via the events. */
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_SET_SREGS, &SRegs) >= 0, ("KVM_SET_SREGS -> %d\n", errno),
+                              VERR_NEM_SET_REGISTERS_FAILED);
+    }
+
+    if (fLocal & NEM_LNX_EXTRN_FPU)
+    {
+        struct kvm_xsave *pXSave = (struct kvm_xsave *)RTMemTmpAllocZ(sizeof(*pXSave));
+        AssertReturn(pXSave, VERR_NO_TMP_MEMORY);
+        uint8_t       *pbXSave = (uint8_t *)&pXSave->region[0];
+        PCX86XSAVEAREA pXState = pCtx->CTX_SUFF(pXState);
+        memcpy(pbXSave, &pXState->x87, sizeof(pXState->x87));
+        if (pCtx->fXStateMask)
+        {
+            memcpy(pbXSave + RT_UOFFSETOF(X86XSAVEAREA, Hdr), &pXState->Hdr, sizeof(pXState->Hdr));
+            if (pCtx->fXStateMask & RT_BIT_64(XSAVE_C_YMM_BIT))
+            {
+                uint16_t const offYmm = pCtx->aoffXState[XSAVE_C_YMM_BIT];
+                memcpy(pbXSave + offYmm, (uint8_t const *)pXState + offYmm, sizeof(X86XSAVEYMMHI));
+            }
+        }
+        else
+            ((PX86XSAVEAREA)pbXSave)->Hdr.bmXState = XSAVE_C_X87 | XSAVE_C_SSE;
+        int rcLnx = ioctl(fdVCpu, KVM_SET_XSAVE, pXSave);
+        int iErrno = errno;
+        RTMemTmpFree(pXSave);
+        AssertLogRelMsgReturn(rcLnx >= 0, ("KVM_SET_XSAVE -> %d\n", iErrno), VERR_NEM_SET_REGISTERS_FAILED);
+
+        if (pVM->nem.s.fHasXcrs && pCtx->fXStateMask)
+        {
+            struct kvm_xcrs Xcrs;
+            RT_ZERO(Xcrs);
+            Xcrs.nr_xcrs         = 1;
+            Xcrs.xcrs[0].xcr     = 0;
+            Xcrs.xcrs[0].value   = pCtx->aXcr[0];
+            AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_SET_XCRS, &Xcrs) >= 0, ("KVM_SET_XCRS -> %d\n", errno),
+                                  VERR_NEM_SET_REGISTERS_FAILED);
+        }
+    }
+
+    if (fLocal & NEM_LNX_EXTRN_DEBUG)
+    {
+        struct kvm_debugregs DbgRegs;
+        RT_ZERO(DbgRegs);
+        DbgRegs.db[0] = pCtx->dr[0];
+        DbgRegs.db[1] = pCtx->dr[1];
+        DbgRegs.db[2] = pCtx->dr[2];
+        DbgRegs.db[3] = pCtx->dr[3];
+        DbgRegs.dr6   = pCtx->dr[6];
+        DbgRegs.dr7   = pCtx->dr[7];
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_SET_DEBUGREGS, &DbgRegs) >= 0, ("KVM_SET_DEBUGREGS -> %d\n", errno),
+                              VERR_NEM_SET_REGISTERS_FAILED);
+    }
+
+    if (fLocal & NEM_LNX_EXTRN_MSRS)
+    {
+        NEMLNXMSRS Msrs;
+        uint32_t const cMsrs = nemR3LnxInitMsrIndexes(&Msrs);
+        PCPUMCTXMSRS pCtxMsrs = CPUMQueryGuestCtxMsrsPtr(pVCpu);
+        for (uint32_t i = 0; i < cMsrs; i++)
+            switch (Msrs.aEntries[i].index)
+            {
+                case MSR_K6_STAR:               Msrs.aEntries[i].data = pCtx->msrSTAR; break;
+                case MSR_K8_LSTAR:              Msrs.aEntries[i].data = pCtx->msrLSTAR; break;
+                case MSR_K8_CSTAR:              Msrs.aEntries[i].data = pCtx->msrCSTAR; break;
+                case MSR_K8_SF_MASK:            Msrs.aEntries[i].data = pCtx->msrSFMASK; break;
+                case MSR_K8_KERNEL_GS_BASE:     Msrs.aEntries[i].data = pCtx->msrKERNELGSBASE; break;
+                case MSR_IA32_SYSENTER_CS:      Msrs.aEntries[i].data = pCtx->SysEnter.cs; break;
+                case MSR_IA32_SYSENTER_EIP:     Msrs.aEntries[i].data = pCtx->SysEnter.eip; break;
+                case MSR_IA32_SYSENTER_ESP:     Msrs.aEntries[i].data = pCtx->SysEnter.esp; break;
+                case MSR_K8_TSC_AUX:            Msrs.aEntries[i].data = pCtxMsrs->msr.TscAux; break;
+                case MSR_IA32_CR_PAT:           Msrs.aEntries[i].data = pCtx->msrPAT; break;
+            }
+        int rcLnx = ioctl(fdVCpu, KVM_SET_MSRS, &Msrs);
+        AssertLogRelMsgReturn(rcLnx == (int)cMsrs, ("KVM_SET_MSRS -> %d (errno %d), expected %u\n", rcLnx, errno, cMsrs),
+                              VERR_NEM_SET_REGISTERS_FAILED);
+    }
+
+    if (fLocal & NEM_LNX_EXTRN_EVENTS)
+    {
+        struct kvm_vcpu_events Events;
+        RT_ZERO(Events);
+        Events.flags = KVM_VCPUEVENT_VALID_SHADOW | KVM_VCPUEVENT_VALID_NMI_PENDING;
+        if (   VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INHIBIT_INTERRUPTS)
+            && EMGetInhibitInterruptsPC(pVCpu) == pCtx->rip)
+            Events.interrupt.shadow = KVM_X86_SHADOW_INT_MOV_SS;
+        Events.nmi.masked = VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_BLOCK_NMIS);
+
+        if (TRPMHasTrap(pVCpu))
+        {
+            uint8_t     bVector;
+            TRPMEVENT   enmType;
+            RTGCUINT    uErrCode;
+            RTGCUINTPTR uCr2;
+            uint8_t     cbInstr;
+            int rc = TRPMQueryTrapAll(pVCpu, &bVector, &enmType, &uErrCode, &uCr2, &cbInstr);
+            AssertRCReturn(rc, rc);
+            if (enmType == TRPM_TRAP)
+            {
+                Events.exception.injected = 1;
+                Events.exception.nr       = bVector;
+                switch (bVector)
+                {
+                    case X86_XCPT_DF: case X86_XCPT_TS: case X86_XCPT_NP: case X86_XCPT_SS:
+                    case X86_XCPT_GP: case X86_XCPT_PF: case X86_XCPT_AC:
+                        Events.exception.has_error_code = 1;
+                        Events.exception.error_code     = (uint32_t)uErrCode;
+                        break;
+                }
+            }
+            else if (enmType == TRPM_HARDWARE_INT && bVector == X86_XCPT_NMI)
+                Events.nmi.injected = 1;
+            else
+            {
+                /** @todo KVM has no way of passing the instruction length of software
+                 *        interrupts, so we depend on them being re-executed. */
+                Events.interrupt.injected = 1;
+                Events.interrupt.nr       = bVector;
+                Events.interrupt.soft     = enmType == TRPM_SOFTWARE_INT;
+            }
+            TRPMResetTrap(pVCpu);
+        }
+        AssertLogRelMsgReturn(ioctl(fdVCpu, KVM_SET_VCPU_EVENTS, &Events) >= 0, ("KVM_SET_VCPU_EVENTS -> %d\n", errno),
+                              VERR_NEM_SET_REGISTERS_FAILED);
+    }
+
+    pCtx->fExtrn = CPUMCTX_EXTRN_KEEPER_NEM | NEM_LNX_EXTRN_ALL;
+    pVCpu->nem.s.fStateExported = true;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Interface for importing state on demand (used by IEM).
+ *
+ * @returns VBox status code.
+ * @param   pVCpu       The cross context CPU structure.
+ * @param   fWhat       What to import, CPUMCTX_EXTRN_XXX.
+ */
+VMM_INT_DECL(int) NEMImportStateOnDemand(PVMCPU pVCpu, uint64_t fWhat)
+{
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatImportOnDemand);
+    return nemR3LnxImportState(pVCpu, fWhat);
+}
+
+
+/**
+ * Query the CPU tick counter and optionally the TSC_AUX MSR value.
+ *
+ * @returns VBox status code.
+ * @param   pVCpu       The cross context CPU structure.
+ * @param   pcTicks     Where to return the CPU tick count.
+ * @param   puAux       Where to return the TSC_AUX register value.
+ */
+VMM_INT_DECL(int) NEMHCQueryCpuTick(PVMCPU pVCpu, uint64_t *pcTicks, uint32_t *puAux)
+{
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatQueryCpuTick);
+
+    NEMLNXMSRS Msrs;
+    RT_ZERO(Msrs);
+    Msrs.Hdr.nmsrs           = 2;
+    Msrs.aEntries[0].index   = MSR_IA32_TSC;
+    Msrs.aEntries[1].index   = MSR_K8_TSC_AUX;
+    int rcLnx = ioctl(pVCpu->nem.s.fdVCpu, KVM_GET_MSRS, &Msrs);
+    AssertLogRelMsgReturn(rcLnx == 2, ("KVM_GET_MSRS(TSC) -> %d (errno %d)\n", rcLnx, errno), VERR_NEM_GET_REGISTERS_FAILED);
+
+    *pcTicks = Msrs.aEntries[0].data;
+    if (puAux)
+        *puAux = pVCpu->cpum.GstCtx.fExtrn & CPUMCTX_EXTRN_TSC_AUX
+               ? (uint32_t)Msrs.aEntries[1].data : CPUMGetGuestTscAux(pVCpu);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Resumes CPU clock (TSC) on all virtual CPUs.
+ *
+ * This is called by TM when the VM is started, restored, resumed or similar.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   pVCpu           The cross context CPU structure of the calling EMT.
+ * @param   uPausedTscValue The TSC value at the time of pausing.
+ */
+VMM_INT_DECL(int) NEMHCResumeCpuTickOnAll(PVM pVM, PVMCPU pVCpu, uint64_t uPausedTscValue)
+{
+    VMCPU_ASSERT_EMT_RETURN(pVCpu, VERR_VM_THREAD_NOT_EMT);
+    AssertReturn(VM_IS_NEM_ENABLED(pVM), VERR_NEM_IPE_9);
+
+    /* Do the first CPU and then the others, adjusting for the elapsed host
+       TSC and keeping fingers crossed that we don't introduce much drift. */
+    uint64_t const uFirstTsc = ASMReadTSC();
+    for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+    {
+        NEMLNXMSRS Msrs;
+        RT_ZERO(Msrs);
+        Msrs.Hdr.nmsrs         = 1;
+        Msrs.aEntries[0].index = MSR_IA32_TSC;
+        Msrs.aEntries[0].data  = uPausedTscValue + (iCpu > 0 ? ASMReadTSC() - uFirstTsc : 0);
+        int rcLnx = ioctl(pVM->aCpus[iCpu].nem.s.fdVCpu, KVM_SET_MSRS, &Msrs);
+        AssertLogRelMsgReturn(rcLnx == 1, ("KVM_SET_MSRS(TSC) on vCPU %u -> %d (errno %d)\n", iCpu, rcLnx, errno),
+                              VERR_NEM_SET_TSC);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/*
+ *
+ * The run loop.
+ * The run loop.
+ * The run loop.
+ *
+ */
+
+/**
+ * Handles a KVM_EXIT_IO exit.
+ *
+ * KVM completes the instruction (RIP, RAX, string registers) on the next
+ * KVM_RUN, so no register state is needed here.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ * @param   pRun        The kvm_run structure.
+ */
+static VBOXSTRICTRC nemR3LnxHandleExitIoPort(PVM pVM, PVMCPU pVCpu, struct kvm_run *pRun)
+{
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitPortIo);
+    uint8_t * const pbData = (uint8_t *)pRun + pRun->io.data_offset;
+    uint8_t const   cbValue = pRun->io.size;
+    AssertMsgReturn(cbValue == 1 || cbValue == 2 || cbValue == 4, ("%u\n", cbValue), VERR_NEM_IPE_3);
+    pVCpu->nem.s.fPendingIoCompletion = true;
+
+    /*
+     * KVM has already completed the whole (REP) instruction, so every element
+     * must be done.  Only stop on real failures, and pass up the most important
+     * informational status (lower VINF_EM_XXX values take precedence).
+     */
+    VBOXSTRICTRC rcStrict = VINF_SUCCESS;
+    for (uint32_t i = 0; i < pRun->io.count; i++)
+    {
+        uint8_t *pbValue = pbData + i * cbValue;
+        VBOXSTRICTRC rcStrict2;
+        if (pRun->io.direction == KVM_EXIT_IO_OUT)
+        {
+            uint32_t uValue = 0;
+            memcpy(&uValue, pbValue, cbValue);
+            rcStrict2 = IOMIOPortWrite(pVM, pVCpu, pRun->io.port, uValue, cbValue);
+            Log4(("IOExit/%u: OUT %#x, %#x LB %u rcStrict=%Rrc\n",
+                  pVCpu->idCpu, pRun->io.port, uValue, cbValue, VBOXSTRICTRC_VAL(rcStrict2) ));
+        }
+        else
+        {
+            uint32_t uValue = 0;
+            rcStrict2 = IOMIOPortRead(pVM, pVCpu, pRun->io.port, &uValue, cbValue);
+            Log4(("IOExit/%u: IN %#x LB %u -> %#x, rcStrict=%Rrc\n",
+                  pVCpu->idCpu, pRun->io.port, cbValue, uValue, VBOXSTRICTRC_VAL(rcStrict2) ));
+            if (IOM_SUCCESS(rcStrict2))
+                memcpy(pbValue, &uValue, cbValue);
+        }
+        if (rcStrict2 != VINF_SUCCESS)
+        {
+            if (RT_FAILURE_NP(VBOXSTRICTRC_VAL(rcStrict2)))
+                return rcStrict2;
+            if (   rcStrict == VINF_SUCCESS
+                || rcStrict2 < rcStrict)
+                rcStrict = rcStrict2;
+        }
+    }
+    return rcStrict;
+}
+
+
+/**
+ * Handles a KVM_EXIT_MMIO exit.
+ *
+ * These are accesses to guest physical memory without a memory slot.  The
+ * access is always completed here via PGM, which takes care of access
+ * handlers and MMIO.  If the page is ordinary memory, a slot is set up so the
+ * following accesses don't exit.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ * @param   pRun        The kvm_run structure.
+ */
+static VBOXSTRICTRC nemR3LnxHandleExitMmio(PVM pVM, PVMCPU pVCpu, struct kvm_run *pRun)
+{
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitMmio);
+    RTGCPHYS GCPhys = pRun->mmio.phys_addr;
+    uint32_t cb     = pRun->mmio.len;
+    AssertMsgReturn(cb <= sizeof(pRun->mmio.data), ("%u\n", cb), VERR_NEM_IPE_3);
+    if (!pVM->nem.s.fA20Enabled && NEM_LNX_IS_SUBJECT_TO_A20(GCPhys))
+        GCPhys -= _1M;
+    pVCpu->nem.s.fPendingIoCompletion = true;
+
+    VBOXSTRICTRC rcStrict;
+    if (pRun->mmio.is_write)
+        rcStrict = PGMPhysWrite(pVM, GCPhys, pRun->mmio.data, cb, PGMACCESSORIGIN_HM);
+    else
+        rcStrict = PGMPhysRead(pVM, GCPhys, pRun->mmio.data, cb, PGMACCESSORIGIN_HM);
+    Log4(("MmioExit/%u: %RGp LB %u %s rcStrict=%Rrc\n", pVCpu->idCpu, GCPhys, cb,
+          pRun->mmio.is_write ? "write" : "read", VBOXSTRICTRC_VAL(rcStrict) ));
+
+    bool fMapped = false;
+    int rc = nemR3LnxMapRun(pVM, pVCpu, pRun->mmio.phys_addr, &fMapped, NULL);
+    if (fMapped)
+        STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitMmioMapped);
+    if (RT_FAILURE(rc) && rcStrict == VINF_SUCCESS)
+        rcStrict = rc;
+    return rcStrict;
+}
+
+
+/**
+ * Handles KVM_INTERNAL_ERROR_EMULATION.
+ *
+ * KVM cannot emulate instructions it cannot fetch, which is what happens when
+ * the code lives in memory without a slot (ROM after reset, pages PGM just
+ * replaced).  Try map the page at CS:RIP and retry, fall back on IEM if that
+ * doesn't help.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ */
+static VBOXSTRICTRC nemR3LnxHandleExitEmulationFailure(PVM pVM, PVMCPU pVCpu)
+{
+    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitEmulationFailure);
+    int rc = nemR3LnxImportState(pVCpu, CPUMCTX_EXTRN_ALL | CPUMCTX_EXTRN_NEM_LNX_EVENTS);
+    AssertRCReturn(rc, rc);
+
+    RTGCPHYS GCPhys;
+    rc = PGMPhysGCPtr2GCPhys(pVCpu, pVCpu->cpum.GstCtx.cs.u64Base + pVCpu->cpum.GstCtx.rip, &GCPhys);
+    if (RT_SUCCESS(rc))
+    {
+        bool fMapped = false;
+        rc = nemR3LnxMapRun(pVM, pVCpu, GCPhys, &fMapped, NULL);
+        if (RT_SUCCESS(rc) && fMapped)
+            return VINF_SUCCESS;
+    }
+
+    Log(("NEM/%u: KVM emulation failure at %04x:%08RX64, using IEM\n",
+         pVCpu->idCpu, pVCpu->cpum.GstCtx.cs.Sel, pVCpu->cpum.GstCtx.rip));
+    return IEMExecOne(pVCpu);
+}
+
+
+/**
+ * Handles a KVM exit.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ * @param   pRun        The kvm_run structure.
+ */
+static VBOXSTRICTRC nemR3LnxHandleExit(PVM pVM, PVMCPU pVCpu, struct kvm_run *pRun)
+{
+    /* The TPR is cheap to keep in sync, the APIC needs it for PDMGetInterrupt. */
+    if (pVCpu->cpum.GstCtx.fExtrn & CPUMCTX_EXTRN_APIC_TPR)
+        APICSetTpr(pVCpu, (uint8_t)(pRun->cr8 << 4));
+
+    switch (pRun->exit_reason)
+    {
+        case KVM_EXIT_IO:
+            return nemR3LnxHandleExitIoPort(pVM, pVCpu, pRun);
+
+        case KVM_EXIT_MMIO:
+            return nemR3LnxHandleExitMmio(pVM, pVCpu, pRun);
+
+        case KVM_EXIT_HLT:
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitHalt);
+            return VINF_EM_HALT;
+
+        case KVM_EXIT_IRQ_WINDOW_OPEN:
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitInterruptWindow);
+            return VINF_SUCCESS;
+
+        case KVM_EXIT_INTR:
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitIntr);
+            return VINF_SUCCESS;
+
+        case KVM_EXIT_SHUTDOWN:
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitShutdown);
+            return VINF_EM_TRIPLE_FAULT;
+
+        case KVM_EXIT_SYSTEM_EVENT:
+            if (pRun->system_event.type == KVM_SYSTEM_EVENT_RESET)
+                return VINF_EM_RESET;
+            if (pRun->system_event.type == KVM_SYSTEM_EVENT_SHUTDOWN)
+                return VINF_EM_OFF;
+            AssertLogRelMsgFailedReturn(("NEM/%u: Unexpected KVM system event %u\n", pVCpu->idCpu, pRun->system_event.type),
+                                        VERR_NEM_IPE_5);
+
+        case KVM_EXIT_INTERNAL_ERROR:
+            if (pRun->internal.suberror == KVM_INTERNAL_ERROR_EMULATION)
+                return nemR3LnxHandleExitEmulationFailure(pVM, pVCpu);
+            AssertLogRelMsgFailedReturn(("NEM/%u: KVM internal error %u (ndata=%u data0=%#RX64)\n", pVCpu->idCpu,
+                                         pRun->internal.suberror, pRun->internal.ndata,
+                                         pRun->internal.ndata ? (uint64_t)pRun->internal.data[0] : 0),
+                                        VERR_NEM_IPE_6);
+
+        case KVM_EXIT_FAIL_ENTRY:
+            AssertLogRelMsgFailedReturn(("NEM/%u: KVM entry failed, hardware reason %#RX64\n", pVCpu->idCpu,
+                                         (uint64_t)pRun->fail_entry.hardware_entry_failure_reason),
+                                        VERR_NEM_IPE_7);
+
+        default:
+            AssertLogRelMsgFailedReturn(("NEM/%u: Unexpected KVM exit reason %u\n", pVCpu->idCpu, pRun->exit_reason),
+                                        VERR_NEM_IPE_8);
+    }
+}
+
+
+/**
+ * Deals with pending interrupts and NMIs before entering the guest.
+ *
+ * We use the user space irqchip model: interrupts are acknowledged from our
+ * PIC/APIC devices only when KVM reports that the guest can take them, and
+ * otherwise we ask KVM for an interrupt window exit.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure.
+ * @param   pRun        The kvm_run structure.
+ */
+static VBOXSTRICTRC nemR3LnxHandleInterruptFF(PVM pVM, PVMCPU pVCpu, struct kvm_run *pRun)
+{
+    RT_NOREF_PV(pVM);
+    if (VMCPU_FF_TEST_AND_CLEAR(pVCpu, VMCPU_FF_UPDATE_APIC))
+        APICUpdatePendingInterrupts(pVCpu);
+
+    /* We don't currently implement SMIs. */
+    AssertReturn(!VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INTERRUPT_SMI), VERR_NEM_IPE_0);
+
+    /* NMIs are queued in KVM which takes care of the blocking. */
+    if (VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INTERRUPT_NMI))
+    {
+        AssertLogRelMsgReturn(ioctl(pVCpu->nem.s.fdVCpu, KVM_NMI, 0) >= 0, ("KVM_NMI -> %d\n", errno), VERR_NEM_IPE_0);
+        VMCPU_FF_CLEAR(pVCpu, VMCPU_FF_INTERRUPT_NMI);
+        STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatInjectNmi);
+    }
+
+    pRun->request_interrupt_window = 0;
+    if (VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INTERRUPT_APIC | VMCPU_FF_INTERRUPT_PIC))
+    {
+        /* The window information is stale after an export or while KVM
+           still has an event to deliver. */
+        if (   pRun->ready_for_interrupt_injection
+            && pRun->if_flag
+            && !pVCpu->nem.s.fStateExported
+            && !TRPMHasTrap(pVCpu))
+        {
+            uint8_t bInterrupt;
+            int rc = PDMGetInterrupt(pVCpu, &bInterrupt);
+            if (RT_SUCCESS(rc))
+            {
+                struct kvm_interrupt Irq;
+                Irq.irq = bInterrupt;
+                if (ioctl(pVCpu->nem.s.fdVCpu, KVM_INTERRUPT, &Irq) < 0)
+                {
+                    /* Keep it in TRPM, the next export will inject it. */
+                    LogRel(("NEM/%u: KVM_INTERRUPT(%#x) failed: %d\n", pVCpu->idCpu, bInterrupt, errno));
+                    int rc2 = nemR3LnxImportState(pVCpu, NEM_LNX_EXTRN_ALL);
+                    AssertRCReturn(rc2, rc2);
+                    TRPMAssertTrap(pVCpu, bInterrupt, TRPM_HARDWARE_INT);
+                }
+                else
+                    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatInjectInterrupt);
+                Log8(("Injected interrupt %#x on %u\n", bInterrupt, pVCpu->idCpu));
+            }
+            else if (rc == VERR_APIC_INTR_MASKED_BY_TPR)
+                /** @todo With the user space irqchip KVM doesn't tell us when the
+                 *        guest lowers CR8, we pick it up on the next exit. */
+                Log8(("VERR_APIC_INTR_MASKED_BY_TPR on %u\n", pVCpu->idCpu));
+            else
+                Log8(("PDMGetInterrupt failed -> %d\n", rc));
+        }
+        else
+            pRun->request_interrupt_window = 1;
+    }
+    return VINF_SUCCESS;
+}
+
+
+VBOXSTRICTRC nemR3NativeRunGC(PVM pVM, PVMCPU pVCpu)
+{
+    LogFlow(("NEM/%u: %04x:%08RX64 efl=%#08RX64 <=\n", pVCpu->idCpu, pVCpu->cpum.GstCtx.cs.Sel, pVCpu->cpum.GstCtx.rip, pVCpu->cpum.GstCtx.rflags));
+    struct kvm_run *pRun = pVCpu->nem.s.pRun;
+    if (pVCpu->nem.s.hEmtThread == NIL_RTTHREAD)
+        pVCpu->nem.s.hEmtThread = RTThreadSelf();
+
+    /*
+     * (Re)map guest memory after init and reset.
+     */
+    if (   ASMAtomicReadBool(&pVM->nem.s.pMemSlots->fPremapPending)
+        && ASMAtomicCmpXchgBool(&pVM->nem.s.pMemSlots->fPremapPending, false, true))
+        nemR3LnxPremap(pVM, pVCpu);
+
+    /*
+     * Try switch to NEM runloop state.
+     */
+    if (VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED_EXEC_NEM, VMCPUSTATE_STARTED))
+    { /* likely */ }
+    else
+    {
+        VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED_EXEC_NEM, VMCPUSTATE_STARTED_EXEC_NEM_CANCELED);
+        LogFlow(("NEM/%u: returning immediately because canceled\n", pVCpu->idCpu));
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * The run loop.
+     *
+     * Port I/O and MMIO exits are completed by KVM on the next KVM_RUN, so
+     * the register state stays in KVM until somebody actually asks for it.
+     */
+    const bool      fSingleStepping = DBGFIsStepping(pVCpu);
+    VBOXSTRICTRC    rcStrict        = VINF_SUCCESS;
+    for (;;)
+    {
+        /* Clear any stale cancellation first; NEMR3NotifyFF sets it again if a
+           force flag shows up after the checks below. */
+        ASMAtomicWriteU8(&pRun->immediate_exit, 0);
+        pVCpu->nem.s.fStateExported = false;
+
+        /*
+         * Make sure KVM has the whole state, then deal with interrupts.
+         */
+        if ((pVCpu->cpum.GstCtx.fExtrn & NEM_LNX_EXTRN_ALL) != NEM_LNX_EXTRN_ALL)
+        {
+            int rc2 = nemR3LnxExportState(pVM, pVCpu);
+            if (RT_FAILURE(rc2))
+            {
+                rcStrict = rc2;
+                STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnStatus);
+                break;
+            }
+        }
+        if (VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INTERRUPT_APIC | VMCPU_FF_UPDATE_APIC | VMCPU_FF_INTERRUPT_PIC
+                                     | VMCPU_FF_INTERRUPT_NMI  | VMCPU_FF_INTERRUPT_SMI))
+        {
+            rcStrict = nemR3LnxHandleInterruptFF(pVM, pVCpu, pRun);
+            if (rcStrict != VINF_SUCCESS)
+            {
+                LogFlow(("NEM/%u: breaking: nemR3LnxHandleInterruptFF -> %Rrc\n", pVCpu->idCpu, VBOXSTRICTRC_VAL(rcStrict) ));
+                STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnStatus);
+                break;
+            }
+            /* A failed KVM_INTERRUPT may have pulled the state back. */
+            if ((pVCpu->cpum.GstCtx.fExtrn & NEM_LNX_EXTRN_ALL) != NEM_LNX_EXTRN_ALL)
+                continue;
+        }
+        else
+            pRun->request_interrupt_window = 0;
+
+        /*
+         * Poll timers and run for a bit.
+         */
+        uint64_t offDeltaIgnored;
+        TMTimerPollGIP(pVM, pVCpu, &offDeltaIgnored);
+        if (   !VM_FF_IS_PENDING(pVM, VM_FF_EMT_RENDEZVOUS | VM_FF_TM_VIRTUAL_SYNC)
+            && !VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_HM_TO_R3_MASK))
+        {
+            if (VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED_EXEC_NEM_WAIT, VMCPUSTATE_STARTED_EXEC_NEM))
+            {
+                uint8_t u8Tpr = 0;
+                APICGetTpr(pVCpu, &u8Tpr, NULL, NULL);
+                pRun->cr8 = u8Tpr >> 4;
+
+                int rcLnx  = ioctl(pVCpu->nem.s.fdVCpu, KVM_RUN, 0);
+                int iErrno = errno;
+                VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED_EXEC_NEM, VMCPUSTATE_STARTED_EXEC_NEM_WAIT);
+                pVCpu->nem.s.fPendingIoCompletion = false;
+                if (rcLnx >= 0)
+                {
+                    rcStrict = nemR3LnxHandleExit(pVM, pVCpu, pRun);
+                    if (rcStrict == VINF_SUCCESS)
+                    { /* hopefully likely */ }
+                    else
+                    {
+                        LogFlow(("NEM/%u: breaking: nemR3LnxHandleExit -> %Rrc\n", pVCpu->idCpu, VBOXSTRICTRC_VAL(rcStrict) ));
+                        STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnStatus);
+                        break;
+                    }
+                }
+                else if (iErrno == EINTR || iErrno == EAGAIN)
+                    STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatExitIntr);
+                else
+                {
+                    LogRel(("NEM/%u: KVM_RUN failed: %d\n", pVCpu->idCpu, iErrno));
+                    rcStrict = VERR_NEM_IPE_0;
+                    break;
+                }
+
+                /*
+                 * If no relevant FFs are pending, loop.
+                 */
+                if (   !VM_FF_IS_PENDING(   pVM,   !fSingleStepping ? VM_FF_HP_R0_PRE_HM_MASK    : VM_FF_HP_R0_PRE_HM_STEP_MASK)
+                    && !VMCPU_FF_IS_PENDING(pVCpu, !fSingleStepping ? VMCPU_FF_HP_R0_PRE_HM_MASK : VMCPU_FF_HP_R0_PRE_HM_STEP_MASK) )
+                    continue;
+
+                LogFlow(("NEM/%u: breaking: pending FF (%#x / %#x)\n",
+                         pVCpu->idCpu, pVM->fGlobalForcedActions, pVCpu->fLocalForcedActions));
+                STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnFFPost);
+            }
+            else
+            {
+                LogFlow(("NEM/%u: breaking: canceled %d (pre exec)\n", pVCpu->idCpu, VMCPU_GET_STATE(pVCpu) ));
+                STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnCancel);
+            }
+        }
+        else
+        {
+            LogFlow(("NEM/%u: breaking: pending FF (pre exec)\n", pVCpu->idCpu));
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatBreakOnFFPre);
+        }
+        break;
+    } /* the run loop */
+
+    if (!VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED, VMCPUSTATE_STARTED_EXEC_NEM))
+        VMCPU_CMPXCHG_STATE(pVCpu, VMCPUSTATE_STARTED, VMCPUSTATE_STARTED_EXEC_NEM_CANCELED);
+
+    /*
+     * Import what EM is likely to need.
+     */
+    if (pVCpu->cpum.GstCtx.fExtrn & NEM_LNX_EXTRN_ALL)
+    {
+        uint64_t fImport = IEM_CPUMCTX_EXTRN_MUST_MASK | CPUMCTX_EXTRN_NEM_LNX_EVENTS;
+        if (   (rcStrict >= VINF_EM_FIRST && rcStrict <= VINF_EM_LAST)
+            || RT_FAILURE(rcStrict))
+            fImport = NEM_LNX_EXTRN_ALL;
+        else if (VMCPU_FF_IS_PENDING(pVCpu, VMCPU_FF_INTERRUPT_PIC | VMCPU_FF_INTERRUPT_APIC
+                                          | VMCPU_FF_INTERRUPT_NMI | VMCPU_FF_INTERRUPT_SMI))
+            fImport |= IEM_CPUMCTX_EXTRN_XCPT_MASK;
+
+        if (pVCpu->cpum.GstCtx.fExtrn & fImport)
+        {
+            int rc2 = nemR3LnxImportState(pVCpu, fImport);
+            if (RT_FAILURE(rc2) && RT_SUCCESS(rcStrict))
+                rcStrict = rc2;
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatImportOnReturn);
+        }
+        else
+            STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatImportOnReturnSkipped);
+    }
+    else
+        STAM_REL_COUNTER_INC(&pVCpu->nem.s.StatImportOnReturnSkipped);
+
+    LogFlow(("NEM/%u: %04x:%08RX64 efl=%#08RX64 => %Rrc\n",
+             pVCpu->idCpu, pVCpu->cpum.GstCtx.cs.Sel, pVCpu->cpum.GstCtx.rip, pVCpu->cpum.GstCtx.rflags, VBOXSTRICTRC_VAL(rcStrict) ));
+    return rcStrict;
+}
+
+
+bool nemR3NativeCanExecuteGuest(PVM pVM, PVMCPU pVCpu)
+{
+    NOREF(pVM); NOREF(pVCpu);
+    return true;
+}
+
+
+bool nemR3NativeSetSingleInstruction(PVM pVM, PVMCPU pVCpu, bool fEnable)
+{
+    NOREF(pVM); NOREF(pVCpu); NOREF(fEnable);
+    return false;
+}
+
+
+/**
+ * Forced flag notification call from VMEmt.h.
+ *
+ * This is only called when pVCpu is in the VMCPUSTATE_STARTED_EXEC_NEM state.
+ *
+ * @param   pVM             The cross context VM structure.
+ * @param   pVCpu           The cross context virtual CPU structure of the CPU
+ *                          to be notified.
+ * @param   fFlags          Notification flags, VMNOTIFYFF_FLAGS_XXX.
+ */
+void nemR3NativeNotifyFF(PVM pVM, PVMCPU pVCpu, uint32_t fFlags)
+{
+    /* immediate_exit covers the window before KVM_RUN, the signal kicks the
+       EMT out of the guest if it is already in there. */
+    Log8(("nemR3NativeNotifyFF: canceling %u\n", pVCpu->idCpu));
+    ASMAtomicWriteU8(&pVCpu->nem.s.pRun->immediate_exit, 1);
+    RTTHREAD hEmtThread = pVCpu->nem.s.hEmtThread;
+    if (   hEmtThread != NIL_RTTHREAD
+        && hEmtThread != RTThreadSelf())
+    {
+        int rc = RTThreadPoke(hEmtThread);
+        AssertRC(rc);
+    }
+    RT_NOREF(pVM, fFlags);
+}
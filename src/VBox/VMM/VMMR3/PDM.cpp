@@ -228,6 +228,13 @@
  * exectuing in ring-0 and making the hardware assisted execution mode more
  * efficient. (Raw-mode won't benefit much from this, naturally.)
  *
+ * Contended enters spin for a while before blocking in ring-3 and ring-0.  The
+ * spin budget of each section follows the average time it is held, so short
+ * sections spin and long ones block right away.  With /PDM/CritSect/Profiling
+ * set, the wait times and the top contending call sites are profiled per
+ * section, see the /PDM/CritSects/ statistics and the 'critsectprof' info
+ * handler.
+ *
  * @see grp_pdm_critsect
  *
  *
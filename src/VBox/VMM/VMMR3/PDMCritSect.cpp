@@ -23,6 +23,8 @@
 #include "PDMInternal.h"
 #include <VBox/vmm/pdmcritsect.h>
 #include <VBox/vmm/pdmcritsectrw.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
@@ -31,18 +33,45 @@
 #include <VBox/log.h>
 #include <VBox/sup.h>
 #include <iprt/asm.h>
+#include <iprt/asm-math.h>
 #include <iprt/assert.h>
 #include <iprt/lockvalidator.h>
+#include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/sort.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
 
 
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Critical section entry collected by pdmR3CritSectInfoProf.
+ */
+typedef struct PDMCRITSECTPROFENTRY
+{
+    /** The section name. */
+    const char         *pszName;
+    /** The profiling data. */
+    PPDMCRITSECTPROF    pProf;
+    /** Ring-3 contention count. */
+    uint64_t            cContentionR3;
+    /** Ring-0/raw-mode contention count. */
+    uint64_t            cContentionRZ;
+    /** Set if this is a read/write critical section. */
+    bool                fRw;
+} PDMCRITSECTPROFENTRY;
+/** Pointer to a critical section entry collected by pdmR3CritSectInfoProf. */
+typedef PDMCRITSECTPROFENTRY *PPDMCRITSECTPROFENTRY;
+
+
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 static int pdmR3CritSectDeleteOne(PVM pVM, PUVM pUVM, PPDMCRITSECTINT pCritSect, PPDMCRITSECTINT pPrev, bool fFinal);
 static int pdmR3CritSectRwDeleteOne(PVM pVM, PUVM pUVM, PPDMCRITSECTRWINT pCritSect, PPDMCRITSECTRWINT pPrev, bool fFinal);
-
+static FNDBGFHANDLERINT pdmR3CritSectInfoProf;
 
 
 /**
@@ -56,10 +85,109 @@ int pdmR3CritSectBothInitStats(PVM pVM)
     RT_NOREF_PV(pVM);
     STAM_REG(pVM, &pVM->pdm.s.StatQueuedCritSectLeaves, STAMTYPE_COUNTER, "/PDM/QueuedCritSectLeaves", STAMUNIT_OCCURENCES,
              "Number of times a critical section leave request needed to be queued for ring-3 execution.");
+    DBGFR3InfoRegisterInternal(pVM, "critsectprof",
+                               "Displays the contention profile of the critical sections, worst first. "
+                               "Sections without contention are skipped unless a name pattern is given.",
+                               pdmR3CritSectInfoProf);
     return VINF_SUCCESS;
 }
 
 
+/**
+ * Allocates and registers the adaptive spinning and contention profiling data
+ * of a critical section or read/write critical section.
+ *
+ * Failures are not fatal, the section will simply do without.  Read/write
+ * sections don't spin, so they only get the data with contention profiling.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   ppProfR3    Where to return the ring-3 pointer.
+ * @param   ppProfR0    Where to return the ring-0 pointer.
+ * @param   pszPrefix   The statistics prefix of the section.
+ * @param   pszName     The section name.
+ * @param   fSpin       Whether the section does adaptive spinning.
+ */
+static void pdmR3CritSectProfInit(PVM pVM, R3PTRTYPE(PPDMCRITSECTPROF) *ppProfR3, R0PTRTYPE(PPDMCRITSECTPROF) *ppProfR0,
+                                  const char *pszPrefix, const char *pszName, bool fSpin)
+{
+    *ppProfR3 = NULL;
+    *ppProfR0 = NIL_RTR0PTR;
+
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "PDM/CritSect");
+
+    /** @cfgm{/PDM/CritSect/Profiling, bool, false}
+     * Enables contention profiling (wait time histogram and top contending call
+     * sites) for the PDM critical sections.  This takes about 2KB of hyper heap
+     * per section. */
+    bool fWaitProf;
+    int rc = CFGMR3QueryBoolDef(pCfg, "Profiling", &fWaitProf, false);
+    AssertLogRelRCReturnVoid(rc);
+    if (!fSpin && !fWaitProf)
+        return;
+
+    /** @cfgm{/PDM/CritSect/MaxSpinNs, uint32_t, 10000}
+     * The upper limit of the adaptive spin budget in nanoseconds.  Sections
+     * held longer than half of this on average go straight to blocking.  Zero
+     * disables spinning, as does running on a uni-processor host. */
+    uint32_t cNsSpinMax;
+    rc = CFGMR3QueryU32Def(pCfg, "MaxSpinNs", &cNsSpinMax, 10000);
+    AssertLogRelRCReturnVoid(rc);
+
+    PPDMCRITSECTPROF pProf;
+    rc = MMHyperAlloc(pVM, fWaitProf ? sizeof(*pProf) : RT_UOFFSETOF(PDMCRITSECTPROF, StatWait), 64, MM_TAG_PDM, (void **)&pProf);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PDMCritSect: Failed to allocate profiling data for '%s': %Rrc\n", pszName, rc));
+        return;
+    }
+
+    uint64_t const u64CpuHz = SUPGetCpuHzFromGip(g_pSUPGlobalInfoPage);
+    if (   fSpin
+        && RTMpGetOnlineCount() > 1
+        && u64CpuHz != 0
+        && u64CpuHz != UINT64_MAX)
+    {
+        uint64_t const cTicksSpinMax = ASMMultU64ByU32DivByU32(u64CpuHz, cNsSpinMax, RT_NS_1SEC);
+        pProf->cTicksSpinMax = (uint32_t)RT_MIN(cTicksSpinMax, UINT32_MAX);
+    }
+    pProf->cTicksSpin = pProf->cTicksSpinMax / 4;
+    pProf->fWaitProf  = fWaitProf;
+
+    if (fSpin)
+    {
+        STAMR3RegisterF(pVM, &pProf->cTicksHoldAvg,  STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS,      "Average hold time.",            "%s/%s/HoldAvg", pszPrefix, pszName);
+        STAMR3RegisterF(pVM, (void *)&pProf->cTicksSpin, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS,      "Current adaptive spin budget.", "%s/%s/SpinBudget", pszPrefix, pszName);
+        STAMR3RegisterF(pVM, &pProf->StatSpinHits,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Contended enters which got the section while spinning.", "%s/%s/SpinHits", pszPrefix, pszName);
+        STAMR3RegisterF(pVM, &pProf->StatSpinMisses, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Contended enters which had to block.", "%s/%s/SpinMisses", pszPrefix, pszName);
+    }
+    if (fWaitProf)
+        STAMR3RegisterF(pVM, &pProf->StatWait, STAMTYPE_HISTOGRAM, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Time spent getting the section when contended.", "%s/%s/Wait", pszPrefix, pszName);
+
+    *ppProfR3 = pProf;
+    *ppProfR0 = MMHyperR3ToR0(pVM, pProf);
+}
+
+
+/**
+ * Frees the profiling data of a critical section or read/write critical section.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   ppProfR3    The ring-3 pointer.
+ * @param   ppProfR0    The ring-0 pointer.
+ * @param   fFinal      Set if this is the final call, the hyper heap goes
+ *                      away with the VM then.
+ */
+static void pdmR3CritSectProfTerm(PVM pVM, R3PTRTYPE(PPDMCRITSECTPROF) *ppProfR3, R0PTRTYPE(PPDMCRITSECTPROF) *ppProfR0,
+                                  bool fFinal)
+{
+    PPDMCRITSECTPROF pProf = *ppProfR3;
+    *ppProfR3 = NULL;
+    *ppProfR0 = NIL_RTR0PTR;
+    if (pProf && !fFinal)
+        MMHyperFree(pVM, pProf);
+}
+
+
 /**
  * Relocates all the critical sections.
  *
@@ -185,6 +313,8 @@ static int pdmR3CritSectInitOne(PVM pVM, PPDMCRITSECTINT pCritSect, void *pvKey,
                 pCritSect->fUsedByTimerOrSimilar     = false;
                 pCritSect->hEventToSignal            = NIL_SUPSEMEVENT;
                 pCritSect->pszName                   = pszName;
+                pCritSect->pProfR3                   = NULL;
+                pCritSect->pProfR0                   = NIL_RTR0PTR;
 
                 STAMR3RegisterF(pVM, &pCritSect->StatContentionRZLock,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSects/%s/ContentionRZLock", pCritSect->pszName);
                 STAMR3RegisterF(pVM, &pCritSect->StatContentionRZUnlock,STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSects/%s/ContentionRZUnlock", pCritSect->pszName);
@@ -192,6 +322,8 @@ static int pdmR3CritSectInitOne(PVM pVM, PPDMCRITSECTINT pCritSect, void *pvKey,
 #ifdef VBOX_WITH_STATISTICS
                 STAMR3RegisterF(pVM, &pCritSect->StatLocked,        STAMTYPE_PROFILE_ADV, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_OCCURENCE, NULL, "/PDM/CritSects/%s/Locked", pCritSect->pszName);
 #endif
+                /* Must be done after the above as the hyper heap lock is one of us. */
+                pdmR3CritSectProfInit(pVM, &pCritSect->pProfR3, &pCritSect->pProfR0, "/PDM/CritSects", pszName, true /*fSpin*/);
 
                 PUVM pUVM = pVM->pUVM;
                 RTCritSectEnter(&pUVM->pdm.s.ListCritSect);
@@ -279,6 +411,8 @@ static int pdmR3CritSectRwInitOne(PVM pVM, PPDMCRITSECTRWINT pCritSect, void *pv
                     pCritSect->pVMRC                     = pVM->pVMRC;
                     pCritSect->pvKey                     = pvKey;
                     pCritSect->pszName                   = pszName;
+                    pCritSect->pProfR3                   = NULL;
+                    pCritSect->pProfR0                   = NIL_RTR0PTR;
 
                     STAMR3RegisterF(pVM, &pCritSect->StatContentionRZEnterExcl,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSectsRw/%s/ContentionRZEnterExcl", pCritSect->pszName);
                     STAMR3RegisterF(pVM, &pCritSect->StatContentionRZLeaveExcl,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSectsRw/%s/ContentionRZLeaveExcl", pCritSect->pszName);
@@ -293,6 +427,7 @@ static int pdmR3CritSectRwInitOne(PVM pVM, PPDMCRITSECTRWINT pCritSect, void *pv
 #ifdef VBOX_WITH_STATISTICS
                     STAMR3RegisterF(pVM, &pCritSect->StatWriteLocked,         STAMTYPE_PROFILE_ADV, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_OCCURENCE, NULL, "/PDM/CritSectsRw/%s/WriteLocked", pCritSect->pszName);
 #endif
+                    pdmR3CritSectProfInit(pVM, &pCritSect->pProfR3, &pCritSect->pProfR0, "/PDM/CritSectsRw", pszName, false /*fSpin*/);
 
                     PUVM pUVM = pVM->pUVM;
                     RTCritSectEnter(&pUVM->pdm.s.ListCritSect);
@@ -527,6 +662,7 @@ static int pdmR3CritSectDeleteOne(PVM pVM, PUVM pUVM, PPDMCRITSECTINT pCritSect,
     int rc = SUPSemEventClose(pVM->pSession, hEvent);
     AssertRC(rc);
     RTLockValidatorRecExclDestroy(&pCritSect->Core.pValidatorRec);
+    pdmR3CritSectProfTerm(pVM, &pCritSect->pProfR3, &pCritSect->pProfR0, fFinal);
     pCritSect->pNext   = NULL;
     pCritSect->pvKey   = NULL;
     pCritSect->pVMR3   = NULL;
@@ -597,6 +733,7 @@ static int pdmR3CritSectRwDeleteOne(PVM pVM, PUVM pUVM, PPDMCRITSECTRWINT pCritS
 
     RTLockValidatorRecSharedDestroy(&pCritSect->Core.pValidatorRead);
     RTLockValidatorRecExclDestroy(&pCritSect->Core.pValidatorWrite);
+    pdmR3CritSectProfTerm(pVM, &pCritSect->pProfR3, &pCritSect->pProfR0, fFinal);
 
     pCritSect->pNext   = NULL;
     pCritSect->pvKey   = NULL;
@@ -1076,3 +1213,181 @@ VMMR3DECL(RCPTRTYPE(PPDMCRITSECT))  PDMR3CritSectGetNopRC(PVM pVM)
     return MMHyperR3ToRC(pVM, &pVM->pdm.s.NopCritSect);
 }
 
+
+
+/**
+ * Converts TSC ticks to nanoseconds for pdmR3CritSectInfoProf.
+ *
+ * @returns Nanoseconds, or @a cTicks if the TSC frequency is unknown.
+ * @param   cTicks      The number of ticks.
+ * @param   cMHz        The TSC frequency in MHz, 0 if unknown.
+ */
+static uint64_t pdmR3CritSectTicksToNs(uint64_t cTicks, uint64_t cMHz)
+{
+    return cMHz ? cTicks * 1000 / cMHz : cTicks;
+}
+
+
+/**
+ * @callback_method_impl{FNRTSORTCMP, Sorts PDMCRITSECTPROFENTRY by total wait time, worst first.}
+ */
+static DECLCALLBACK(int) pdmR3CritSectProfEntryCompare(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    PDMCRITSECTPROFENTRY const *pEntry1 = (PDMCRITSECTPROFENTRY const *)pvElement1;
+    PDMCRITSECTPROFENTRY const *pEntry2 = (PDMCRITSECTPROFENTRY const *)pvElement2;
+    uint64_t const              cTicks1 = pEntry1->pProf->StatWait.Core.cTicks;
+    uint64_t const              cTicks2 = pEntry2->pProf->StatWait.Core.cTicks;
+    RT_NOREF(pvUser);
+    return cTicks1 > cTicks2 ? -1 : cTicks1 < cTicks2 ? 1 : 0;
+}
+
+
+/**
+ * Displays the profile of one critical section.
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pHlp        The info helpers.
+ * @param   pEntry      The section.
+ * @param   cMHz        The TSC frequency in MHz, 0 if unknown.
+ */
+static void pdmR3CritSectInfoProfOne(PUVM pUVM, PCDBGFINFOHLP pHlp, PPDMCRITSECTPROFENTRY pEntry, uint64_t cMHz)
+{
+    PPDMCRITSECTPROF const pProf  = pEntry->pProf;
+    const char * const     pszUnit = cMHz ? "ns" : "ticks";
+
+    uint64_t const cWaits = pProf->StatWait.Core.cPeriods;
+    pHlp->pfnPrintf(pHlp,
+                    "%s%s: contention R3=%RU64 RZ=%RU64\n"
+                    "  wait: count=%RU64 total=%RU64 %s avg=%RU64 %s max=%RU64 %s\n",
+                    pEntry->pszName, pEntry->fRw ? " (rw)" : "", pEntry->cContentionR3, pEntry->cContentionRZ,
+                    cWaits,
+                    pdmR3CritSectTicksToNs(pProf->StatWait.Core.cTicks, cMHz), pszUnit,
+                    pdmR3CritSectTicksToNs(cWaits ? pProf->StatWait.Core.cTicks / cWaits : 0, cMHz), pszUnit,
+                    pdmR3CritSectTicksToNs(pProf->StatWait.Core.cTicksMax, cMHz), pszUnit);
+    if (!pEntry->fRw)
+        pHlp->pfnPrintf(pHlp, "  spin: hits=%RU64 misses=%RU64 budget=%RU64 %s hold-avg=%RU64 %s\n",
+                        pProf->StatSpinHits.c, pProf->StatSpinMisses.c,
+                        pdmR3CritSectTicksToNs(pProf->cTicksSpin, cMHz), pszUnit,
+                        pdmR3CritSectTicksToNs(pProf->cTicksHoldAvg, cMHz), pszUnit);
+
+    pHlp->pfnPrintf(pHlp, "  wait: p50=%RU64 %s p90=%RU64 %s p99=%RU64 %s\n",
+                    pdmR3CritSectTicksToNs(STAMR3HistogramPercentile(&pProf->StatWait, 5000), cMHz), pszUnit,
+                    pdmR3CritSectTicksToNs(STAMR3HistogramPercentile(&pProf->StatWait, 9000), cMHz), pszUnit,
+                    pdmR3CritSectTicksToNs(STAMR3HistogramPercentile(&pProf->StatWait, 9900), cMHz), pszUnit);
+
+    /*
+     * The contending call sites, most frequent first.
+     */
+    PDMCRITSECTCALLER aCallers[PDMCRITSECTPROF_CALLERS];
+    memcpy(aCallers, pProf->aCallers, sizeof(aCallers));
+    for (unsigned i = 0; i < RT_ELEMENTS(aCallers); i++)
+    {
+        unsigned iMax = i;
+        for (unsigned j = i + 1; j < RT_ELEMENTS(aCallers); j++)
+            if (aCallers[j].cHits > aCallers[iMax].cHits)
+                iMax = j;
+        if (!aCallers[iMax].cHits)
+            break;
+        PDMCRITSECTCALLER const Caller = aCallers[iMax];
+        aCallers[iMax] = aCallers[i];
+
+        PRTDBGSYMBOL pSym    = NULL;
+        RTGCINTPTR   offDisp = 0;
+        if (Caller.fRing0)
+        {
+            DBGFADDRESS Addr;
+            DBGFR3AddrFromFlat(pUVM, &Addr, Caller.uAddr);
+            pSym = DBGFR3AsSymbolByAddrA(pUVM, DBGF_AS_R0, &Addr,
+                                         RTDBGSYMADDR_FLAGS_LESS_OR_EQUAL | RTDBGSYMADDR_FLAGS_SKIP_ABS_IN_DEFERRED,
+                                         &offDisp, NULL);
+        }
+        if (pSym)
+            pHlp->pfnPrintf(pHlp, "  caller: %s %RHv %s+%#RX64 hits=%u\n", Caller.fRing0 ? "R0" : "R3", Caller.uAddr,
+                            pSym->szName, (uint64_t)offDisp, Caller.cHits);
+        else
+            pHlp->pfnPrintf(pHlp, "  caller: %s %RHv hits=%u\n", Caller.fRing0 ? "R0" : "R3", Caller.uAddr, Caller.cHits);
+        RTDbgSymbolFree(pSym);
+    }
+}
+
+
+/**
+ * @callback_method_impl{FNDBGFHANDLERINT,
+ *      Displays the contention profile of the critical sections, worst first.
+ *      The argument is an optional simple name pattern.}
+ */
+static DECLCALLBACK(void) pdmR3CritSectInfoProf(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs)
+{
+    PUVM pUVM = pVM->pUVM;
+    if (pszArgs)
+    {
+        pszArgs = RTStrStripL(pszArgs);
+        if (!*pszArgs)
+            pszArgs = NULL;
+    }
+
+    uint64_t const u64CpuHz = SUPGetCpuHzFromGip(g_pSUPGlobalInfoPage);
+    uint64_t const cMHz     = u64CpuHz != UINT64_MAX ? u64CpuHz / RT_NS_1MS : 0;
+
+    /*
+     * Collect the sections of interest so we can sort them.
+     */
+    RTCritSectEnter(&pUVM->pdm.s.ListCritSect);
+
+    size_t cEntries = 0;
+    for (PPDMCRITSECTINT pCur = pUVM->pdm.s.pCritSects; pCur; pCur = pCur->pNext)
+        cEntries++;
+    for (PPDMCRITSECTRWINT pCur = pUVM->pdm.s.pRwCritSects; pCur; pCur = pCur->pNext)
+        cEntries++;
+
+    PPDMCRITSECTPROFENTRY paEntries = (PPDMCRITSECTPROFENTRY)RTMemTmpAllocZ(sizeof(paEntries[0]) * RT_MAX(cEntries, 1));
+    if (!paEntries)
+    {
+        RTCritSectLeave(&pUVM->pdm.s.ListCritSect);
+        pHlp->pfnPrintf(pHlp, "Out of memory!\n");
+        return;
+    }
+
+    size_t i = 0;
+    for (PPDMCRITSECTINT pCur = pUVM->pdm.s.pCritSects; pCur && i < cEntries; pCur = pCur->pNext)
+        if (   pCur->pProfR3
+            && pCur->pProfR3->fWaitProf
+            && (pszArgs ? RTStrSimplePatternMatch(pszArgs, pCur->pszName) : pCur->pProfR3->StatWait.Core.cPeriods > 0))
+        {
+            paEntries[i].pszName       = pCur->pszName;
+            paEntries[i].pProf         = pCur->pProfR3;
+            paEntries[i].cContentionR3 = pCur->StatContentionR3.c;
+            paEntries[i].cContentionRZ = pCur->StatContentionRZLock.c;
+            paEntries[i].fRw           = false;
+            i++;
+        }
+    for (PPDMCRITSECTRWINT pCur = pUVM->pdm.s.pRwCritSects; pCur && i < cEntries; pCur = pCur->pNext)
+        if (   pCur->pProfR3
+            && pCur->pProfR3->fWaitProf
+            && (pszArgs ? RTStrSimplePatternMatch(pszArgs, pCur->pszName) : pCur->pProfR3->StatWait.Core.cPeriods > 0))
+        {
+            paEntries[i].pszName       = pCur->pszName;
+            paEntries[i].pProf         = pCur->pProfR3;
+            paEntries[i].cContentionR3 = pCur->StatContentionR3EnterExcl.c   + pCur->StatContentionR3EnterShared.c;
+            paEntries[i].cContentionRZ = pCur->StatContentionRZEnterExcl.c   + pCur->StatContentionRZEnterShared.c;
+            paEntries[i].fRw           = true;
+            i++;
+        }
+    cEntries = i;
+    RTSortShell(paEntries, cEntries, sizeof(paEntries[0]), pdmR3CritSectProfEntryCompare, NULL);
+
+    /*
+     * Display them.
+     */
+    if (   !cEntries
+        && !(pUVM->pdm.s.pCritSects && pUVM->pdm.s.pCritSects->pProfR3 && pUVM->pdm.s.pCritSects->pProfR3->fWaitProf))
+        pHlp->pfnPrintf(pHlp, "Contention profiling is disabled, see /PDM/CritSect/Profiling.\n");
+    else
+        pHlp->pfnPrintf(pHlp, "%zu critical section(s)%s, TSC at %RU64 MHz\n",
+                        cEntries, pszArgs ? " matching" : " with contention", cMHz);
+    for (i = 0; i < cEntries; i++)
+        pdmR3CritSectInfoProfOne(pUVM, pHlp, &paEntries[i], cMHz);
+
+    RTCritSectLeave(&pUVM->pdm.s.ListCritSect);
+    RTMemTmpFree(paEntries);
+}
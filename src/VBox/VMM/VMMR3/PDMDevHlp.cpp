@@ -1989,6 +1989,31 @@ static DECLCALLBACK(int) pdmR3DevHlp_QueueCreate(PPDMDEVINS pDevIns, size_t cbIt
 }
 
 
+/** @interface_method_impl{PDMDEVHLPR3,pfnQueueCreateBatch} */
+static DECLCALLBACK(int) pdmR3DevHlp_QueueCreateBatch(PPDMDEVINS pDevIns, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
+                                                      PFNPDMQUEUEDEVBATCH pfnCallback, bool fRZEnabled, const char *pszName,
+                                                      PPDMQUEUE *ppQueue)
+{
+    PDMDEV_ASSERT_DEVINS(pDevIns);
+    LogFlow(("pdmR3DevHlp_QueueCreateBatch: caller='%s'/%d: cbItem=%#x cItems=%#x cMilliesInterval=%u pfnCallback=%p fRZEnabled=%RTbool pszName=%p:{%s} ppQueue=%p\n",
+             pDevIns->pReg->szName, pDevIns->iInstance, cbItem, cItems, cMilliesInterval, pfnCallback, fRZEnabled, pszName, pszName, ppQueue));
+
+    PVM pVM = pDevIns->Internal.s.pVMR3;
+    VM_ASSERT_EMT(pVM);
+
+    if (pDevIns->iInstance > 0)
+    {
+        pszName = MMR3HeapAPrintf(pVM, MM_TAG_PDM_DEVICE_DESC, "%s_%u", pszName, pDevIns->iInstance);
+        AssertLogRelReturn(pszName, VERR_NO_MEMORY);
+    }
+
+    int rc = PDMR3QueueCreateDeviceBatch(pVM, pDevIns, cbItem, cItems, cMilliesInterval, pfnCallback, fRZEnabled, pszName, ppQueue);
+
+    LogFlow(("pdmR3DevHlp_QueueCreateBatch: caller='%s'/%d: returns %Rrc *ppQueue=%p\n", pDevIns->pReg->szName, pDevIns->iInstance, rc, *ppQueue));
+    return rc;
+}
+
+
 /** @interface_method_impl{PDMDEVHLPR3,pfnCritSectInit} */
 static DECLCALLBACK(int) pdmR3DevHlp_CritSectInit(PPDMDEVINS pDevIns, PPDMCRITSECT pCritSect, RT_SRC_POS_DECL,
                                                   const char *pszNameFmt, va_list va)
@@ -3725,7 +3750,7 @@ const PDMDEVHLPR3 g_pdmR3DevHlpTrusted =
     pdmR3DevHlp_CallR0,
     pdmR3DevHlp_VMGetSuspendReason,
     pdmR3DevHlp_VMGetResumeReason,
-    0,
+    pdmR3DevHlp_QueueCreateBatch,
     0,
     0,
     0,
@@ -3995,7 +4020,7 @@ const PDMDEVHLPR3 g_pdmR3DevHlpUnTrusted =
     pdmR3DevHlp_CallR0,
     pdmR3DevHlp_VMGetSuspendReason,
     pdmR3DevHlp_VMGetResumeReason,
-    0,
+    pdmR3DevHlp_QueueCreateBatch,
     0,
     0,
     0,
@@ -4029,51 +4054,74 @@ const PDMDEVHLPR3 g_pdmR3DevHlpUnTrusted =
 
 
 /**
- * Queue consumer callback for internal component.
+ * Batched queue consumer callback for the DevHlp queue.
  *
- * @returns Success indicator.
- *          If false the item will not be removed and the flushing will stop.
+ * Consecutive ISA and PCI IRQ changes are done while holding the PDM lock,
+ * saving a lock round trip per item when ring-0 queues up a bunch of them.
+ *
+ * @returns Number of items consumed, always all of them.
  * @param   pVM         The cross context VM structure.
- * @param   pItem       The item to consume. Upon return this item will be freed.
+ * @param   papItems    The items to consume. Upon return they will be freed.
+ * @param   cItems      The number of items.
  */
-DECLCALLBACK(bool) pdmR3DevHlpQueueConsumer(PVM pVM, PPDMQUEUEITEMCORE pItem)
+DECLCALLBACK(uint32_t) pdmR3DevHlpQueueConsumer(PVM pVM, PPDMQUEUEITEMCORE *papItems, uint32_t cItems)
 {
-    PPDMDEVHLPTASK pTask = (PPDMDEVHLPTASK)pItem;
-    LogFlow(("pdmR3DevHlpQueueConsumer: enmOp=%d pDevIns=%p\n", pTask->enmOp, pTask->pDevInsR3));
-    switch (pTask->enmOp)
+    bool fLocked = false;
+    for (uint32_t i = 0; i < cItems; i++)
     {
-        case PDMDEVHLPTASKOP_ISA_SET_IRQ:
-            PDMIsaSetIrq(pVM, pTask->u.IsaSetIRQ.iIrq, pTask->u.IsaSetIRQ.iLevel, pTask->u.IsaSetIRQ.uTagSrc);
-            break;
-
-        case PDMDEVHLPTASKOP_PCI_SET_IRQ:
+        PPDMDEVHLPTASK pTask = (PPDMDEVHLPTASK)papItems[i];
+        LogFlow(("pdmR3DevHlpQueueConsumer: enmOp=%d pDevIns=%p\n", pTask->enmOp, pTask->pDevInsR3));
+        switch (pTask->enmOp)
         {
-            /* Same as pdmR3DevHlp_PCISetIrq, except we've got a tag already. */
-            PPDMPCIDEV pPciDev = pTask->u.PciSetIRQ.pPciDevR3;
-            if (pPciDev)
+            case PDMDEVHLPTASKOP_ISA_SET_IRQ:
+                if (!fLocked)
+                {
+                    pdmLock(pVM);
+                    fLocked = true;
+                }
+                PDMIsaSetIrq(pVM, pTask->u.IsaSetIRQ.iIrq, pTask->u.IsaSetIRQ.iLevel, pTask->u.IsaSetIRQ.uTagSrc);
+                break;
+
+            case PDMDEVHLPTASKOP_PCI_SET_IRQ:
             {
-                PPDMPCIBUS pBus = pPciDev->Int.s.pPdmBusR3;
-                Assert(pBus);
-
-                pdmLock(pVM);
-                pBus->pfnSetIrqR3(pBus->pDevInsR3, pPciDev, pTask->u.PciSetIRQ.iIrq,
-                                  pTask->u.PciSetIRQ.iLevel, pTask->u.PciSetIRQ.uTagSrc);
-                pdmUnlock(pVM);
+                /* Same as pdmR3DevHlp_PCISetIrq, except we've got a tag already. */
+                PPDMPCIDEV pPciDev = pTask->u.PciSetIRQ.pPciDevR3;
+                if (pPciDev)
+                {
+                    PPDMPCIBUS pBus = pPciDev->Int.s.pPdmBusR3;
+                    Assert(pBus);
+
+                    if (!fLocked)
+                    {
+                        pdmLock(pVM);
+                        fLocked = true;
+                    }
+                    pBus->pfnSetIrqR3(pBus->pDevInsR3, pPciDev, pTask->u.PciSetIRQ.iIrq,
+                                      pTask->u.PciSetIRQ.iLevel, pTask->u.PciSetIRQ.uTagSrc);
+                }
+                else
+                    AssertReleaseMsgFailed(("No PCI device registered!\n"));
+                break;
             }
-            else
-                AssertReleaseMsgFailed(("No PCI device registered!\n"));
-            break;
-        }
-
-        case PDMDEVHLPTASKOP_IOAPIC_SET_IRQ:
-            PDMIoApicSetIrq(pVM, pTask->u.IoApicSetIRQ.iIrq, pTask->u.IoApicSetIRQ.iLevel, pTask->u.IoApicSetIRQ.uTagSrc);
-            break;
 
-        default:
-            AssertReleaseMsgFailed(("Invalid operation %d\n", pTask->enmOp));
-            break;
+            case PDMDEVHLPTASKOP_IOAPIC_SET_IRQ:
+                /* The I/O APIC doesn't need the PDM lock, don't hold it across the call. */
+                if (fLocked)
+                {
+                    pdmUnlock(pVM);
+                    fLocked = false;
+                }
+                PDMIoApicSetIrq(pVM, pTask->u.IoApicSetIRQ.iIrq, pTask->u.IoApicSetIRQ.iLevel, pTask->u.IoApicSetIRQ.uTagSrc);
+                break;
+
+            default:
+                AssertReleaseMsgFailed(("Invalid operation %d\n", pTask->enmOp));
+                break;
+        }
     }
-    return true;
+    if (fLocked)
+        pdmUnlock(pVM);
+    return cItems;
 }
 
 /** @} */
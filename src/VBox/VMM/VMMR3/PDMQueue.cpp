@@ -23,6 +23,8 @@
 #include "PDMInternal.h"
 #include <VBox/vmm/pdm.h>
 #include <VBox/vmm/mm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/dbgftrace.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -33,6 +35,7 @@
 #include <VBox/log.h>
 #include <iprt/asm.h>
 #include <iprt/assert.h>
+#include <iprt/string.h>
 #include <iprt/thread.h>
 
 
@@ -70,10 +73,16 @@ static int pdmR3QueueCreate(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cM
     AssertMsgReturn(cItems >= 1 && cItems <= _64K, ("cItems=%u\n", cItems), VERR_OUT_OF_RANGE);
 
     /*
-     * Align the item size and calculate the structure size.
+     * Align the item size and calculate the structure size.  The structure is
+     * followed by the pending ring and then the items.
      */
     cbItem = RT_ALIGN(cbItem, sizeof(RTUINTPTR));
-    size_t cb = cbItem * cItems + RT_ALIGN_Z(RT_UOFFSETOF_DYN(PDMQUEUE, aFreeItems[cItems + PDMQUEUE_FREE_SLACK]), 16);
+    uint32_t cPendingRing = 1;
+    while (cPendingRing < cItems)
+        cPendingRing <<= 1;
+    uint32_t const offPending = RT_ALIGN_32(RT_UOFFSETOF_DYN(PDMQUEUE, aFreeItems[cItems + PDMQUEUE_FREE_SLACK]), 16);
+    uint32_t const offItems   = RT_ALIGN_32(offPending + cPendingRing * sizeof(uint32_t), 16);
+    size_t cb = offItems + cbItem * cItems;
     PPDMQUEUE pQueue;
     int rc;
     if (fRZEnabled)
@@ -94,14 +103,16 @@ static int pdmR3QueueCreate(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cM
     //pQueue->pTimer = NULL;
     pQueue->cbItem = (uint32_t)cbItem;
     pQueue->cItems = cItems;
-    //pQueue->pPendingR3 = NULL;
-    //pQueue->pPendingR0 = NULL;
-    //pQueue->pPendingRC = NULL;
     pQueue->iFreeHead = cItems;
     //pQueue->iFreeTail = 0;
-    PPDMQUEUEITEMCORE pItem = (PPDMQUEUEITEMCORE)((char *)pQueue + RT_ALIGN_Z(RT_UOFFSETOF_DYN(PDMQUEUE, aFreeItems[cItems + PDMQUEUE_FREE_SLACK]), 16));
-    for (unsigned i = 0; i < cItems; i++, pItem = (PPDMQUEUEITEMCORE)((char *)pItem + cbItem))
+    pQueue->offPending = offPending;
+    pQueue->fPendingMask = cPendingRing - 1;
+    //pQueue->iPendingHead = 0;
+    //pQueue->iPendingTail = 0;
+    pQueue->offItems = offItems;
+    for (unsigned i = 0; i < cItems; i++)
     {
+        PPDMQUEUEITEMCORE pItem = PDMQUEUE_ITEM(pQueue, i);
         pQueue->aFreeItems[i].pItemR3 = pItem;
         if (fRZEnabled)
         {
@@ -174,10 +185,15 @@ static int pdmR3QueueCreate(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cM
      */
     STAMR3RegisterF(pVM, &pQueue->cbItem,               STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,        "Item size.",                       "/PDM/Queue/%s/cbItem",         pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->cItems,               STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Queue size.",                      "/PDM/Queue/%s/cItems",         pQueue->pszName);
-    STAMR3RegisterF(pVM, &pQueue->StatAllocFailures,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "PDMQueueAlloc failures.",          "/PDM/Queue/%s/AllocFailures",  pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatAllocFailures,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "PDMQueueAlloc failures (producer back-pressure).", "/PDM/Queue/%s/AllocFailures", pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->StatInsert,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Calls to PDMQueueInsert.",         "/PDM/Queue/%s/Insert",         pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatInsertCongested,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Inserts with the queue 3/4 full or more.", "/PDM/Queue/%s/InsertCongested", pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatInsertExpedite,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Inserts expediting the timer.",    "/PDM/Queue/%s/InsertExpedite", pQueue->pszName);
+    STAMR3RegisterF(pVM, (void *)&pQueue->cPendingMax,  STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,      "High water mark of pending items.", "/PDM/Queue/%s/PendingMax",    pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->StatFlush,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Calls to pdmR3QueueFlush.",        "/PDM/Queue/%s/Flush",          pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->StatFlushLeftovers,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Left over items after flush.",     "/PDM/Queue/%s/FlushLeftovers", pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatFlushBatches,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Item batches handed to the consumer.", "/PDM/Queue/%s/FlushBatches", pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatFlushItems,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Items consumed.",                  "/PDM/Queue/%s/FlushItems",     pQueue->pszName);
 #ifdef VBOX_WITH_STATISTICS
     STAMR3RegisterF(pVM, &pQueue->StatFlushPrf,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Profiling pdmR3QueueFlush.",       "/PDM/Queue/%s/FlushPrf",       pQueue->pszName);
     STAMR3RegisterF(pVM, (void *)&pQueue->cStatPending, STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Pending items.",                   "/PDM/Queue/%s/Pending",        pQueue->pszName);
@@ -239,6 +255,54 @@ VMMR3_INT_DECL(int) PDMR3QueueCreateDevice(PVM pVM, PPDMDEVINS pDevIns, size_t c
 }
 
 
+/**
+ * Create a queue with a device owner and a batched consumer callback.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pDevIns             Device instance.
+ * @param   cbItem              Size a queue item.
+ * @param   cItems              Number of items in the queue.
+ * @param   cMilliesInterval    Number of milliseconds between polling the queue.
+ *                              If 0 then the emulation thread will be notified whenever an item arrives.
+ * @param   pfnCallback         The consumer function, receiving up to
+ *                              PDMQUEUE_MAX_BATCH items per call.
+ * @param   fRZEnabled          Set if the queue must be usable from RC/R0.
+ * @param   pszName             The queue name. Unique. Not copied.
+ * @param   ppQueue             Where to store the queue handle on success.
+ * @thread  Emulation thread only.
+ */
+VMMR3_INT_DECL(int) PDMR3QueueCreateDeviceBatch(PVM pVM, PPDMDEVINS pDevIns, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
+                                                PFNPDMQUEUEDEVBATCH pfnCallback, bool fRZEnabled, const char *pszName, PPDMQUEUE *ppQueue)
+{
+    LogFlow(("PDMR3QueueCreateDeviceBatch: pDevIns=%p cbItem=%d cItems=%d cMilliesInterval=%d pfnCallback=%p fRZEnabled=%RTbool pszName=%s\n",
+             pDevIns, cbItem, cItems, cMilliesInterval, pfnCallback, fRZEnabled, pszName));
+
+    /*
+     * Validate input.
+     */
+    VMCPU_ASSERT_EMT(&pVM->aCpus[0]);
+    AssertPtrReturn(pfnCallback, VERR_INVALID_POINTER);
+
+    /*
+     * Create the queue.
+     */
+    PPDMQUEUE pQueue;
+    int rc = pdmR3QueueCreate(pVM, cbItem, cItems, cMilliesInterval, fRZEnabled, pszName, &pQueue);
+    if (RT_SUCCESS(rc))
+    {
+        pQueue->enmType = PDMQUEUETYPE_DEV;
+        pQueue->u.Dev.pDevIns = pDevIns;
+        pQueue->u.Dev.pfnCallbackBatch = pfnCallback;
+
+        *ppQueue = pQueue;
+        Log(("PDM: Created batched device queue %p; cbItem=%d cItems=%d cMillies=%d pfnCallback=%p pDevIns=%p\n",
+             pQueue, cbItem, cItems, cMilliesInterval, pfnCallback, pDevIns));
+    }
+    return rc;
+}
+
+
 /**
  * Create a queue with a driver owner.
  *
@@ -330,6 +394,52 @@ VMMR3_INT_DECL(int) PDMR3QueueCreateInternal(PVM pVM, size_t cbItem, uint32_t cI
 }
 
 
+/**
+ * Create a queue with an internal owner and a batched consumer callback.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   cbItem              Size a queue item.
+ * @param   cItems              Number of items in the queue.
+ * @param   cMilliesInterval    Number of milliseconds between polling the queue.
+ *                              If 0 then the emulation thread will be notified whenever an item arrives.
+ * @param   pfnCallback         The consumer function, receiving up to
+ *                              PDMQUEUE_MAX_BATCH items per call.
+ * @param   fRZEnabled          Set if the queue must be usable from RC/R0.
+ * @param   pszName             The queue name. Unique. Not copied.
+ * @param   ppQueue             Where to store the queue handle on success.
+ * @thread  Emulation thread only.
+ */
+VMMR3_INT_DECL(int) PDMR3QueueCreateInternalBatch(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cMilliesInterval,
+                                                  PFNPDMQUEUEINTBATCH pfnCallback, bool fRZEnabled, const char *pszName, PPDMQUEUE *ppQueue)
+{
+    LogFlow(("PDMR3QueueCreateInternalBatch: cbItem=%d cItems=%d cMilliesInterval=%d pfnCallback=%p fRZEnabled=%RTbool pszName=%s\n",
+             cbItem, cItems, cMilliesInterval, pfnCallback, fRZEnabled, pszName));
+
+    /*
+     * Validate input.
+     */
+    VMCPU_ASSERT_EMT(&pVM->aCpus[0]);
+    AssertPtrReturn(pfnCallback, VERR_INVALID_POINTER);
+
+    /*
+     * Create the queue.
+     */
+    PPDMQUEUE pQueue;
+    int rc = pdmR3QueueCreate(pVM, cbItem, cItems, cMilliesInterval, fRZEnabled, pszName, &pQueue);
+    if (RT_SUCCESS(rc))
+    {
+        pQueue->enmType = PDMQUEUETYPE_INTERNAL;
+        pQueue->u.Int.pfnCallbackBatch = pfnCallback;
+
+        *ppQueue = pQueue;
+        Log(("PDM: Created batched internal queue %p; cbItem=%d cItems=%d cMillies=%d pfnCallback=%p\n",
+             pQueue, cbItem, cItems, cMilliesInterval, pfnCallback));
+    }
+    return rc;
+}
+
+
 /**
  * Create a queue with an external owner.
  *
@@ -445,7 +555,7 @@ VMMR3_INT_DECL(int) PDMR3QueueDestroy(PPDMQUEUE pQueue)
     /*
      * Deregister statistics.
      */
-    STAMR3DeregisterF(pVM->pUVM, "/PDM/Queue/%s/cbItem", pQueue->pszName);
+    STAMR3DeregisterF(pVM->pUVM, "/PDM/Queue/%s/*", pQueue->pszName);
 
     /*
      * Destroy the timer and free it.
@@ -580,6 +690,7 @@ VMMR3_INT_DECL(int) PDMR3QueueDestroyDriver(PVM pVM, PPDMDRVINS pDrvIns)
  */
 void pdmR3QueueRelocate(PVM pVM, RTGCINTPTR offDelta)
 {
+    RT_NOREF(offDelta);
     /*
      * Process the queues.
      */
@@ -594,19 +705,7 @@ void pdmR3QueueRelocate(PVM pVM, RTGCINTPTR offDelta)
             {
                 pQueue->pVMRC = pVM->pVMRC;
 
-                /* Pending RC items. */
-                if (pQueue->pPendingRC)
-                {
-                    pQueue->pPendingRC += offDelta;
-                    PPDMQUEUEITEMCORE pCur = (PPDMQUEUEITEMCORE)MMHyperRCToR3(pVM, pQueue->pPendingRC);
-                    while (pCur->pNextRC)
-                    {
-                        pCur->pNextRC += offDelta;
-                        pCur = (PPDMQUEUEITEMCORE)MMHyperRCToR3(pVM, pCur->pNextRC);
-                    }
-                }
-
-                /* The free items. */
+                /* The free items. (The pending ring uses indexes and needs no relocating.) */
                 uint32_t i = pQueue->iFreeTail;
                 while (i != pQueue->iFreeHead)
                 {
@@ -653,9 +752,14 @@ VMMR3_INT_DECL(void) PDMR3QueueFlushAll(PVM pVM)
         ASMAtomicBitClear(&pVM->pdm.s.fQueueFlushing, PDM_QUEUE_FLUSH_FLAG_PENDING_BIT);
 
         for (PPDMQUEUE pCur = pVM->pUVM->pdm.s.pQueuesForced; pCur; pCur = pCur->pNext)
-            if (    pCur->pPendingR3
-                ||  pCur->pPendingR0
-                ||  pCur->pPendingRC)
+            if (PDMQUEUE_IS_PENDING(pCur))
+                pdmR3QueueFlush(pCur);
+
+        /* Timer driven queues which someone wants flushed sooner (PDMQueueInsertEx). */
+        for (PPDMQUEUE pCur = pVM->pUVM->pdm.s.pQueuesTimer; pCur; pCur = pCur->pNext)
+            if (   ASMAtomicUoReadBool(&pCur->fExpedite)
+                && ASMAtomicXchgBool(&pCur->fExpedite, false)
+                && PDMQUEUE_IS_PENDING(pCur))
                 pdmR3QueueFlush(pCur);
 
         ASMAtomicBitClear(&pVM->pdm.s.fQueueFlushing, PDM_QUEUE_FLUSH_FLAG_ACTIVE_BIT);
@@ -670,164 +774,158 @@ VMMR3_INT_DECL(void) PDMR3QueueFlushAll(PVM pVM)
 
 
 /**
- * Process pending items in one queue.
+ * Gets the name of the queue identified by the key used in the binary event
+ * trace (DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH).
  *
- * @returns Success indicator.
- *          If false the item the consumer said "enough!".
- * @param   pQueue  The queue.
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if no such queue (anymore).
+ * @param   pVM         The cross context VM structure.
+ * @param   uKey        The queue key.
+ * @param   pszName     Where to return the name.
+ * @param   cbName      The size of the name buffer.
  */
-static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
+VMMR3_INT_DECL(int) PDMR3QueueQueryTraceName(PVM pVM, uint64_t uKey, char *pszName, size_t cbName)
 {
-    STAM_PROFILE_START(&pQueue->StatFlushPrf,p);
-
-    /*
-     * Get the lists.
-     */
-    PPDMQUEUEITEMCORE pItems   = ASMAtomicXchgPtrT(&pQueue->pPendingR3, NULL, PPDMQUEUEITEMCORE);
-    RTRCPTR           pItemsRC = ASMAtomicXchgRCPtr(&pQueue->pPendingRC, NIL_RTRCPTR);
-    RTR0PTR           pItemsR0 = ASMAtomicXchgR0Ptr(&pQueue->pPendingR0, NIL_RTR0PTR);
-
-    AssertMsgReturn(   pItemsR0
-                    || pItemsRC
-                    || pItems,
-                    ("Someone is racing us? This shouldn't happen!\n"),
-                    true);
-
-    /*
-     * Reverse the list (it's inserted in LIFO order to avoid semaphores, remember).
-     */
-    PPDMQUEUEITEMCORE pCur = pItems;
-    pItems = NULL;
-    while (pCur)
-    {
-        PPDMQUEUEITEMCORE pInsert = pCur;
-        pCur = pCur->pNextR3;
-        pInsert->pNextR3 = pItems;
-        pItems = pInsert;
-    }
-
-    /*
-     * Do the same for any pending RC items.
-     */
-    while (pItemsRC)
-    {
-        PPDMQUEUEITEMCORE pInsert = (PPDMQUEUEITEMCORE)MMHyperRCToR3(pQueue->pVMR3, pItemsRC);
-        pItemsRC = pInsert->pNextRC;
-        pInsert->pNextRC = NIL_RTRCPTR;
-        pInsert->pNextR3 = pItems;
-        pItems = pInsert;
-    }
+    PUVM pUVM = pVM->pUVM;
+    int  rc   = VERR_NOT_FOUND;
+    pdmLock(pVM);
+    for (unsigned iList = 0; iList < 2 && rc == VERR_NOT_FOUND; iList++)
+        for (PPDMQUEUE pCur = iList == 0 ? pUVM->pdm.s.pQueuesForced : pUVM->pdm.s.pQueuesTimer; pCur; pCur = pCur->pNext)
+            if ((uintptr_t)pCur == uKey)
+            {
+                rc = RTStrCopy(pszName, cbName, pCur->pszName);
+                break;
+            }
+    pdmUnlock(pVM);
+    return rc;
+}
 
-    /*
-     * Do the same for any pending R0 items.
-     */
-    while (pItemsR0)
-    {
-        PPDMQUEUEITEMCORE pInsert = (PPDMQUEUEITEMCORE)MMHyperR0ToR3(pQueue->pVMR3, pItemsR0);
-        pItemsR0 = pInsert->pNextR0;
-        pInsert->pNextR0 = NIL_RTR0PTR;
-        pInsert->pNextR3 = pItems;
-        pItems = pInsert;
-    }
 
-    /*
-     * Feed the items to the consumer function.
-     */
-    Log2(("pdmR3QueueFlush: pQueue=%p enmType=%d pItems=%p\n", pQueue, pQueue->enmType, pItems));
+/**
+ * Hands a batch of items to the consumer.
+ *
+ * @returns Number of items consumed, starting with the first one.
+ * @param   pQueue      The queue.
+ * @param   papItems    The items.
+ * @param   cItems      Number of items, at least one.
+ */
+static uint32_t pdmR3QueueConsume(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE *papItems, uint32_t cItems)
+{
+    uint32_t i = 0;
     switch (pQueue->enmType)
     {
         case PDMQUEUETYPE_DEV:
-            while (pItems)
-            {
-                if (!pQueue->u.Dev.pfnCallback(pQueue->u.Dev.pDevIns, pItems))
-                    break;
-                pCur = pItems;
-                pItems = pItems->pNextR3;
-                pdmR3QueueFreeItem(pQueue, pCur);
-            }
+            if (pQueue->u.Dev.pfnCallbackBatch)
+                i = pQueue->u.Dev.pfnCallbackBatch(pQueue->u.Dev.pDevIns, papItems, cItems);
+            else
+                while (i < cItems && pQueue->u.Dev.pfnCallback(pQueue->u.Dev.pDevIns, papItems[i]))
+                    i++;
             break;
 
         case PDMQUEUETYPE_DRV:
-            while (pItems)
-            {
-                if (!pQueue->u.Drv.pfnCallback(pQueue->u.Drv.pDrvIns, pItems))
-                    break;
-                pCur = pItems;
-                pItems = pItems->pNextR3;
-                pdmR3QueueFreeItem(pQueue, pCur);
-            }
+            while (i < cItems && pQueue->u.Drv.pfnCallback(pQueue->u.Drv.pDrvIns, papItems[i]))
+                i++;
             break;
 
         case PDMQUEUETYPE_INTERNAL:
-            while (pItems)
-            {
-                if (!pQueue->u.Int.pfnCallback(pQueue->pVMR3, pItems))
-                    break;
-                pCur = pItems;
-                pItems = pItems->pNextR3;
-                pdmR3QueueFreeItem(pQueue, pCur);
-            }
+            if (pQueue->u.Int.pfnCallbackBatch)
+                i = pQueue->u.Int.pfnCallbackBatch(pQueue->pVMR3, papItems, cItems);
+            else
+                while (i < cItems && pQueue->u.Int.pfnCallback(pQueue->pVMR3, papItems[i]))
+                    i++;
             break;
 
         case PDMQUEUETYPE_EXTERNAL:
-            while (pItems)
-            {
-                if (!pQueue->u.Ext.pfnCallback(pQueue->u.Ext.pvUser, pItems))
-                    break;
-                pCur = pItems;
-                pItems = pItems->pNextR3;
-                pdmR3QueueFreeItem(pQueue, pCur);
-            }
+            while (i < cItems && pQueue->u.Ext.pfnCallback(pQueue->u.Ext.pvUser, papItems[i]))
+                i++;
             break;
 
         default:
             AssertMsgFailed(("Invalid queue type %d\n", pQueue->enmType));
             break;
     }
+    AssertMsgReturn(i <= cItems, ("%s: i=%u cItems=%u\n", pQueue->pszName, i, cItems), cItems);
+    return i;
+}
+
+
+/**
+ * Process pending items in one queue.
+ *
+ * The items are taken from the pending ring in insertion order and handed to
+ * the consumer in batches of up to PDMQUEUE_MAX_BATCH.  An item is only
+ * removed from the ring after it has been consumed, so whatever the consumer
+ * refuses stays at the head of the queue for the next flush.
+ *
+ * @returns Success indicator.
+ *          If false the item the consumer said "enough!".
+ * @param   pQueue  The queue.
+ */
+static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
+{
+    /* There can only be one consumer; the timer and PDMR3QueueFlushAll may race us. */
+    if (!ASMAtomicCmpXchgBool(&pQueue->fFlushing, true, false))
+        return true;
+    STAM_PROFILE_START(&pQueue->StatFlushPrf,p);
+    STAM_REL_COUNTER_INC(&pQueue->StatFlush);
 
     /*
-     * Success?
+     * Feed the items to the consumer function.  Items inserted after we've
+     * read the head index are left for the next flush, their producers will
+     * make sure it happens.
      */
-    if (pItems)
+    Log2(("pdmR3QueueFlush: pQueue=%p enmType=%d iPendingTail=%#x iPendingHead=%#x\n",
+          pQueue, pQueue->enmType, pQueue->iPendingTail, pQueue->iPendingHead));
+    PVMCPU              pVCpu       = VMMGetCpu(pQueue->pVMR3);
+    uint64_t const      uTscTrace   = pVCpu ? DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_PDM_QUEUE) : 0;
+    uint32_t volatile  *pau32Ring   = PDMQUEUE_PENDING_RING(pQueue);
+    uint32_t const      fMask       = pQueue->fPendingMask;
+    uint32_t const      iHead       = ASMAtomicReadU32(&pQueue->iPendingHead);
+    uint32_t            iTail       = pQueue->iPendingTail;
+    bool                fLeftovers  = false;
+    while (iTail != iHead)
     {
-        /*
-         * Reverse the list.
-         */
-        pCur = pItems;
-        pItems = NULL;
-        while (pCur)
+        PPDMQUEUEITEMCORE apItems[PDMQUEUE_MAX_BATCH];
+        uint32_t          cItems = 0;
+        do
         {
-            PPDMQUEUEITEMCORE pInsert = pCur;
-            pCur = pInsert->pNextR3;
-            pInsert->pNextR3 = pItems;
-            pItems = pInsert;
-        }
+            /* Stop at a slot the producer has reserved but not yet filled in. */
+            uint32_t const uEntry = ASMAtomicReadU32(&pau32Ring[(iTail + cItems) & fMask]);
+            if (!uEntry)
+                break;
+            AssertMsgBreak(uEntry <= pQueue->cItems, ("%s: uEntry=%#x\n", pQueue->pszName, uEntry));
+            apItems[cItems++] = PDMQUEUE_ITEM(pQueue, uEntry - 1);
+        } while (cItems < RT_ELEMENTS(apItems) && iTail + cItems != iHead);
+        if (!cItems)
+            break;
 
-        /*
-         * Insert the list at the tail of the pending list.
-         */
-        for (;;)
+        uint32_t const cConsumed = pdmR3QueueConsume(pQueue, apItems, cItems);
+        STAM_REL_COUNTER_INC(&pQueue->StatFlushBatches);
+        STAM_REL_COUNTER_ADD(&pQueue->StatFlushItems, cConsumed);
+
+        /* Clear the slots before freeing the items so they can't be reused too early. */
+        for (uint32_t i = 0; i < cConsumed; i++)
         {
-            if (ASMAtomicCmpXchgPtr(&pQueue->pPendingR3, pItems, NULL))
-                break;
-            PPDMQUEUEITEMCORE pPending = ASMAtomicXchgPtrT(&pQueue->pPendingR3, NULL, PPDMQUEUEITEMCORE);
-            if (pPending)
-            {
-                pCur = pPending;
-                while (pCur->pNextR3)
-                    pCur = pCur->pNextR3;
-                pCur->pNextR3 = pItems;
-                pItems = pPending;
-            }
+            ASMAtomicWriteU32(&pau32Ring[(iTail + i) & fMask], 0);
+            pdmR3QueueFreeItem(pQueue, apItems[i]);
         }
+        iTail += cConsumed;
+        ASMAtomicWriteU32(&pQueue->iPendingTail, iTail);
 
-        STAM_REL_COUNTER_INC(&pQueue->StatFlushLeftovers);
-        STAM_PROFILE_STOP(&pQueue->StatFlushPrf,p);
-        return false;
+        if (cConsumed < cItems)
+        {
+            fLeftovers = true;
+            break;
+        }
     }
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH, uTscTrace, 0, 0, (uintptr_t)pQueue, 0);
 
+    if (fLeftovers)
+        STAM_REL_COUNTER_INC(&pQueue->StatFlushLeftovers);
     STAM_PROFILE_STOP(&pQueue->StatFlushPrf,p);
-    return true;
+    ASMAtomicWriteBool(&pQueue->fFlushing, false);
+    return !fLeftovers;
 }
 
 
@@ -870,9 +968,7 @@ static DECLCALLBACK(void) pdmR3QueueTimer(PVM pVM, PTMTIMER pTimer, void *pvUser
     PPDMQUEUE pQueue = (PPDMQUEUE)pvUser;
     Assert(pTimer == pQueue->pTimer); NOREF(pTimer); NOREF(pVM);
 
-    if (   pQueue->pPendingR3
-        || pQueue->pPendingR0
-        || pQueue->pPendingRC)
+    if (PDMQUEUE_IS_PENDING(pQueue))
         pdmR3QueueFlush(pQueue);
     int rc = TMTimerSetMillies(pQueue->pTimer, pQueue->cMilliesInterval);
     AssertRC(rc);
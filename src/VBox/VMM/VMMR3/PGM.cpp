@@ -618,6 +618,7 @@
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/cpum.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/sup.h>
 #include <VBox/vmm/mm.h>
@@ -885,6 +886,73 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
     rc = CFGMR3QueryBoolDef(pCfgPGM, "ZeroRamPagesOnReset", &pVM->pgm.s.fZeroRamPagesOnReset, true);
     AssertLogRelRCReturn(rc, rc);
 
+    /** @cfgm{/PGM/LargePageBacking, string, "gmm"}
+     * Where the memory for large guest RAM pages (/HM/LargePages) comes from.
+     * "gmm" uses physically contiguous memory allocated by the GMM in ring-0,
+     * which is mapped into ring-3 using small pages.  "thp" (transparent huge
+     * pages) and "hugetlb" (the hugetlbfs pool, see /proc/sys/vm/nr_hugepages)
+     * allocate the memory in ring-3 and seed it into the GMM, so that both the
+     * nested paging tables and ring-3 use large page mappings.  The latter two
+     * are only available on Linux hosts, and fall back on "gmm" whenever the
+     * host cannot provide a large page. */
+    char szLargePageBacking[16];
+    rc = CFGMR3QueryStringDef(pCfgPGM, "LargePageBacking", szLargePageBacking, sizeof(szLargePageBacking), "gmm");
+    AssertLogRelRCReturn(rc, rc);
+    if (!RTStrICmp(szLargePageBacking, "gmm"))
+        pVM->pgm.s.enmLargePageBacking = PGMLARGEPAGEBACKING_GMM;
+    else if (!RTStrICmp(szLargePageBacking, "thp"))
+        pVM->pgm.s.enmLargePageBacking = PGMLARGEPAGEBACKING_THP;
+    else if (!RTStrICmp(szLargePageBacking, "hugetlb"))
+        pVM->pgm.s.enmLargePageBacking = PGMLARGEPAGEBACKING_HUGETLB;
+    else
+        AssertLogRelMsgFailedReturn(("Configuration error: Invalid /PGM/LargePageBacking value \"%s\"\n", szLargePageBacking),
+                                    VERR_INVALID_PARAMETER);
+#ifndef RT_OS_LINUX
+    if (pVM->pgm.s.enmLargePageBacking != PGMLARGEPAGEBACKING_GMM)
+    {
+        LogRel(("PGM: LargePageBacking=%s is not supported on this host, using gmm\n", szLargePageBacking));
+        pVM->pgm.s.enmLargePageBacking = PGMLARGEPAGEBACKING_GMM;
+    }
+#endif
+
+    /** @cfgm{/PGM/LazyRestore, boolean, false}
+     * Whether to keep RAM pages in a separate page file next to the saved state
+     * file ("<state>.pages") and to fault them in on demand after the VM has
+     * been resumed from it.  Saved states using a page file are always loaded,
+     * this only controls whether the pages are read upfront. */
+    rc = CFGMR3QueryBoolDef(pCfgPGM, "LazyRestore", &pVM->pgm.s.LazyRestore.fEnabled, false);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/LiveSave/DeltaCacheSize, uint64_t, 64MB}
+     * The size of the cache of sent pages kept during live save (e.g.
+     * teleportation).  Pages which are dirtied again and still in the cache
+     * are sent as a delta against the previous copy when that is smaller.  0
+     * disables delta encoding.  Not used when writing a RAM page file. */
+    rc = CFGMR3QueryU64Def(CFGMR3GetChild(pCfgPGM, "LiveSave"), "DeltaCacheSize", &pVM->pgm.s.LiveSave.cbDeltaCacheMax, _64M);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/PageFusion/ContentScan, boolean, false}
+     * Whether to periodically scan guest RAM for pages with identical content
+     * (in this or other VMs) and merge them copy-on-write.  Requires
+     * /PageFusionAllowed. */
+    PCFGMNODE pCfgPageFusion = CFGMR3GetChild(pCfgPGM, "PageFusion");
+    rc = CFGMR3QueryBoolDef(pCfgPageFusion, "ContentScan", &pVM->pgm.s.Dedup.fEnabled, false);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/PageFusion/PagesPerScan, uint32_t, 1024, 1, 262144}
+     * The max number of guest pages the content scanner examines per pass. */
+    rc = CFGMR3QueryU32Def(pCfgPageFusion, "PagesPerScan", &pVM->pgm.s.Dedup.cPagesPerScan, 1024);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.Dedup.cPagesPerScan >= 1 && pVM->pgm.s.Dedup.cPagesPerScan <= _256K,
+                          ("PagesPerScan=%u\n", pVM->pgm.s.Dedup.cPagesPerScan), VERR_OUT_OF_RANGE);
+
+    /** @cfgm{/PGM/PageFusion/IntervalMs, uint32_t, 1000, 10, 3600000}
+     * The interval between content scanner passes in milliseconds. */
+    rc = CFGMR3QueryU32Def(pCfgPageFusion, "IntervalMs", &pVM->pgm.s.Dedup.cMsInterval, 1000);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.Dedup.cMsInterval >= 10 && pVM->pgm.s.Dedup.cMsInterval <= RT_MS_1HOUR,
+                          ("IntervalMs=%u\n", pVM->pgm.s.Dedup.cMsInterval), VERR_OUT_OF_RANGE);
+
 #ifdef VBOX_WITH_STATISTICS
     /*
      * Allocate memory for the statistics before someone tries to use them.
@@ -989,6 +1057,12 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
                                               "ROM write protection",
                                               &pVM->pgm.s.hRomPhysHandlerType);
 
+    /*
+     * Register the physical access handler trapping pages pending lazy restore.
+     */
+    if (RT_SUCCESS(rc))
+        rc = pgmR3LazyRestoreInit(pVM);
+
     /*
      * Init the paging.
      */
@@ -1262,8 +1336,20 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG(pVM, &pPGM->StatLargePageReused,                STAMTYPE_COUNTER, "/PGM/LargePage/Reused",              STAMUNIT_OCCURENCES, "The number of times we've reused a large page.");
     STAM_REL_REG(pVM, &pPGM->StatLargePageRefused,               STAMTYPE_COUNTER, "/PGM/LargePage/Refused",             STAMUNIT_OCCURENCES, "The number of times we couldn't use a large page.");
     STAM_REL_REG(pVM, &pPGM->StatLargePageRecheck,               STAMTYPE_COUNTER, "/PGM/LargePage/Recheck",             STAMUNIT_OCCURENCES, "The number of times we've rechecked a disabled large page.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageGmm,                   STAMTYPE_COUNTER, "/PGM/LargePage/Backing/Gmm",         STAMUNIT_OCCURENCES, "The number of large pages allocated by GMM in ring-0.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageSeeded,                STAMTYPE_COUNTER, "/PGM/LargePage/Backing/Seeded",      STAMUNIT_OCCURENCES, "The number of large pages seeded with ring-3 host large page memory.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageRecycled,              STAMTYPE_COUNTER, "/PGM/LargePage/Backing/Recycled",    STAMUNIT_OCCURENCES, "The number of large pages recycled from previously seeded memory.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageSeedFailed,            STAMTYPE_COUNTER, "/PGM/LargePage/Backing/SeedFailed",  STAMUNIT_OCCURENCES, "The number of times ring-3 failed to provide host large page memory.");
 
     STAM_REL_REG(pVM, &pPGM->StatShModCheck,                     STAMTYPE_PROFILE, "/PGM/ShMod/Check",                   STAMUNIT_TICKS_PER_CALL, "Profiles the shared module checking.");
+    STAM_REL_REG(pVM, &pPGM->StatDedupScan,                      STAMTYPE_PROFILE, "/PGM/PageFusion/Scan",               STAMUNIT_TICKS_PER_CALL, "Profiles the content scan passes.");
+    STAM_REL_REG(pVM, &pPGM->StatDedupScanned,                   STAMTYPE_COUNTER, "/PGM/PageFusion/Scanned",            STAMUNIT_PAGES,          "Pages hashed by the content scanner.");
+    STAM_REL_REG(pVM, &pPGM->StatDedupMerged,                    STAMTYPE_COUNTER, "/PGM/PageFusion/Merged",             STAMUNIT_PAGES,          "Pages replaced by an identical shared page (memory saved).");
+    STAM_REL_REG(pVM, &pPGM->StatDedupConverted,                 STAMTYPE_COUNTER, "/PGM/PageFusion/Converted",          STAMUNIT_PAGES,          "Pages converted into shared reference copies.");
+    STAM_REL_REG(pVM, &pPGM->StatDedupZero,                      STAMTYPE_COUNTER, "/PGM/PageFusion/ZeroSkipped",        STAMUNIT_PAGES,          "Zero filled pages skipped by the content scanner.");
+    STAM_REL_REG(pVM, (void *)&pPGM->LazyRestore.cPendingPages,  STAMTYPE_U32,     "/PGM/LazyRestore/PendingPages",      STAMUNIT_PAGES,          "The number of pages still to be read from the saved state page file.");
+    STAM_REL_REG(pVM, &pPGM->StatLazyRestoreFaults,              STAMTYPE_PROFILE, "/PGM/LazyRestore/Faults",            STAMUNIT_TICKS_PER_CALL, "Profiles pages restored on demand.");
+    STAM_REL_REG(pVM, &pPGM->StatLazyRestoreStreamed,            STAMTYPE_COUNTER, "/PGM/LazyRestore/Streamed",          STAMUNIT_PAGES,          "Pages restored by the background streamer.");
 
     /* Live save */
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.fActive,              STAMTYPE_U8,      "/PGM/LiveSave/fActive",              STAMUNIT_COUNT,     "Active or not.");
@@ -1272,6 +1358,9 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDirtyPagesShort,     STAMTYPE_U32,     "/PGM/LiveSave/cDirtyPagesShort",     STAMUNIT_COUNT,     "Short term dirty page average.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cPagesPerSecond,      STAMTYPE_U32,     "/PGM/LiveSave/cPagesPerSecond",      STAMUNIT_COUNT,     "Pages per second.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cSavedPages,          STAMTYPE_U64,     "/PGM/LiveSave/cSavedPages",          STAMUNIT_COUNT,     "The total number of saved pages.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cFullRamScans,        STAMTYPE_U32,     "/PGM/LiveSave/cFullRamScans",        STAMUNIT_COUNT,     "RAM scans that looked at every page instead of using the dirty bitmaps.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDeltaPages,          STAMTYPE_U64,     "/PGM/LiveSave/cDeltaPages",          STAMUNIT_COUNT,     "Re-sent pages encoded as a delta against the previous copy.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cbDeltaSaved,         STAMTYPE_U64,     "/PGM/LiveSave/cbDeltaSaved",         STAMUNIT_BYTES,     "Bytes not sent thanks to delta encoding.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cReadyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cReadPages",       STAMUNIT_COUNT,     "RAM: Ready pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cDirtyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cDirtyPages",      STAMUNIT_COUNT,     "RAM: Dirty pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cZeroPages,       STAMTYPE_U32,     "/PGM/LiveSave/Ram/cZeroPages",       STAMUNIT_COUNT,     "RAM: Ready zero pages.");
@@ -1350,6 +1439,8 @@ static int pgmR3InitStats(PVM pVM)
     PGM_REG_COUNTER(&pStats->StatR3PhysHandlerLookupHits,       "/PGM/R3/PhysHandlerLookupHits",      "The number of cache hits when looking up physical handlers.");
     PGM_REG_COUNTER(&pStats->StatRZPhysHandlerLookupMisses,     "/PGM/RZ/PhysHandlerLookupMisses",    "The number of cache misses when looking up physical handlers.");
     PGM_REG_COUNTER(&pStats->StatR3PhysHandlerLookupMisses,     "/PGM/R3/PhysHandlerLookupMisses",    "The number of cache misses when looking up physical handlers.");
+    PGM_REG_COUNTER(&pStats->StatRZPhysHandlerLookupIdx,        "/PGM/RZ/PhysHandlerLookupIdx",       "The number of cache misses resolved by the per-range handler index.");
+    PGM_REG_COUNTER(&pStats->StatR3PhysHandlerLookupIdx,        "/PGM/R3/PhysHandlerLookupIdx",       "The number of cache misses resolved by the per-range handler index.");
     PGM_REG_PROFILE(&pStats->StatRZVirtHandlerSearchByPhys,     "/PGM/RZ/VirtHandlerSearchByPhys",    "Profiling of pgmHandlerVirtualFindByPhysAddr.");
     PGM_REG_PROFILE(&pStats->StatR3VirtHandlerSearchByPhys,     "/PGM/R3/VirtHandlerSearchByPhys",    "Profiling of pgmHandlerVirtualFindByPhysAddr.");
 
@@ -1825,6 +1916,11 @@ VMMR3_INT_DECL(int) PGMR3InitCompleted(PVM pVM, VMINITCOMPLETED enmWhat)
 #endif
             break;
 
+#ifdef VBOX_WITH_PAGE_SHARING
+        case VMINITCOMPLETED_RING0:
+            return pgmR3SharedPageScanInit(pVM);
+#endif
+
         default:
             /* shut up gcc */
             break;
@@ -2108,6 +2204,8 @@ VMMR3_INT_DECL(void) PGMR3Reset(PVM pVM)
     LogFlow(("PGMR3Reset:\n"));
     VM_ASSERT_EMT(pVM);
 
+    pgmR3LazyRestoreReset(pVM);
+
     pgmLock(pVM);
 
     /*
@@ -2210,6 +2308,8 @@ VMMR3_INT_DECL(void) PGMR3MemSetup(PVM pVM, bool fAtReset)
         AssertReleaseRC(rc);
 
         pgmUnlock(pVM);
+
+        IEMTlbInvalidateAllPhysicalAllCpus(pVM);
     }
 }
 
@@ -2244,6 +2344,8 @@ VMMR3_INT_DECL(void) PGMR3ResetNoMorePhysWritesFlag(PVM pVM)
  */
 VMMR3DECL(int) PGMR3Term(PVM pVM)
 {
+    pgmR3LazyRestoreTerm(pVM);
+
     /* Must free shared pages here. */
     pgmLock(pVM);
     pgmR3PhysRamTerm(pVM);
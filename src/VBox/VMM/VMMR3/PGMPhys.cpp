@@ -47,6 +47,10 @@
 #include <iprt/thread.h>
 #include <iprt/string.h>
 #include <iprt/system.h>
+#if defined(RT_OS_LINUX) && defined(PGM_WITH_LARGE_PAGES)
+# include <errno.h>
+# include <sys/mman.h>
+#endif
 
 
 /*********************************************************************************************************************************
@@ -857,6 +861,7 @@ static void pgmR3PhysUnlinkRamRange2(PVM pVM, PPGMRAMRANGE pRam, PPGMRAMRANGE pP
     ASMAtomicIncU32(&pVM->pgm.s.idRamRangesGen);
 
     pgmR3PhysRebuildRamRangeSearchTrees(pVM);
+    pgmR3PhysHandlerIdxFree(pRam);
     pgmUnlock(pVM);
 }
 
@@ -886,6 +891,26 @@ static void pgmR3PhysUnlinkRamRange(PVM pVM, PPGMRAMRANGE pRam)
 }
 
 
+/**
+ * Frees the physical handler index of a RAM range, if any.
+ *
+ * @param   pRam        The RAM range.
+ */
+void pgmR3PhysHandlerIdxFree(PPGMRAMRANGE pRam)
+{
+    int32_t *paoffHandlers = pRam->paoffPhysHandlersR3;
+    if (paoffHandlers)
+    {
+        pRam->paoffPhysHandlersR3 = NULL;
+        pRam->paoffPhysHandlersR0 = NIL_RTR0PTR;
+        pRam->fFlags &= ~PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE;
+        size_t const cbIdx = RT_ALIGN_Z((size_t)(pRam->cb >> PAGE_SHIFT) * sizeof(int32_t), PAGE_SIZE);
+        int rc = SUPR3PageFreeEx(paoffHandlers, cbIdx >> PAGE_SHIFT);
+        AssertRC(rc);
+    }
+}
+
+
 /**
  * Frees a range of pages, replacing them with ZERO pages of the specified type.
  *
@@ -1480,6 +1505,8 @@ static void pgmR3PhysInitAndLinkRamRange(PVM pVM, PPGMRAMRANGE pNew, RTGCPHYS GC
     pNew->fFlags        = RCPtrNew != NIL_RTRCPTR ? PGM_RAM_RANGE_FLAGS_FLOATING : 0;
     pNew->pvR3          = NULL;
     pNew->paLSPages     = NULL;
+    pNew->paoffPhysHandlersR3 = NULL;
+    pNew->paoffPhysHandlersR0 = NIL_RTR0PTR;
 
     uint32_t const cPages = pNew->cb >> PAGE_SHIFT;
     RTGCPHYS iPage = cPages;
@@ -1853,7 +1880,7 @@ void pgmR3PhysAssertSharedPageChecksums(PVM pVM)
                 PPGMPAGE pPage = &pRam->aPages[iPage];
                 if (PGM_PAGE_IS_SHARED(pPage))
                 {
-                    uint32_t u32Checksum = pPage->s.u2Unused0/* | ((uint32_t)pPage->s.u2Unused1 << 8)*/;
+                    uint32_t u32Checksum = pPage->s.u1Unused0;
                     if (!u32Checksum)
                     {
                         RTGCPHYS    GCPhysPage  = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
@@ -1863,9 +1890,9 @@ void pgmR3PhysAssertSharedPageChecksums(PVM pVM)
                         {
                             uint32_t u32Checksum2 = RTCrc32(pvPage, PAGE_SIZE);
 # if 0
-                            AssertMsg((u32Checksum2 & /*UINT32_C(0x00000303)*/ 0x3) == u32Checksum, ("GCPhysPage=%RGp\n", GCPhysPage));
+                            AssertMsg((u32Checksum2 & 0x1) == u32Checksum, ("GCPhysPage=%RGp\n", GCPhysPage));
 # else
-                            if ((u32Checksum2 & /*UINT32_C(0x00000303)*/ 0x3) == u32Checksum)
+                            if ((u32Checksum2 & 0x1) == u32Checksum)
                                 LogFlow(("shpg %#x @ %RGp %#x [OK]\n", PGM_PAGE_GET_PAGEID(pPage), GCPhysPage, u32Checksum2));
                             else
                                 AssertMsgFailed(("shpg %#x @ %RGp %#x\n", PGM_PAGE_GET_PAGEID(pPage), GCPhysPage, u32Checksum2));
@@ -2140,6 +2167,8 @@ int pgmR3PhysRamTerm(PVM pVM)
                     AssertFailed();
             }
         } /* for each page */
+
+        pgmR3PhysHandlerIdxFree(pRam);
     }
 
     /*
@@ -2280,6 +2309,8 @@ VMMR3DECL(int) PGMR3PhysMMIORegister(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb, PGMP
         pNew->fFlags        = PGM_RAM_RANGE_FLAGS_AD_HOC_MMIO;
         pNew->pvR3          = NULL;
         pNew->paLSPages     = NULL;
+        pNew->paoffPhysHandlersR3 = NULL;
+        pNew->paoffPhysHandlersR0 = NIL_RTR0PTR;
 
         uint32_t iPage = cPages;
         while (iPage-- > 0)
@@ -2706,6 +2737,7 @@ static int pgmR3PhysMMIOExCreate(PVM pVM, PPDMDEVINS pDevIns, uint32_t iSubDev,
         pNew->RamRange.fFlags      |= PGM_RAM_RANGE_FLAGS_AD_HOC_MMIO_EX;
         //pNew->RamRange.pvR3       = NULL;
         //pNew->RamRange.paLSPages  = NULL;
+        //pNew->RamRange.paoffPhysHandlersR3 = NULL;
 
         *ppNext = pNew;
         ASMCompilerBarrier();
@@ -4047,6 +4079,8 @@ static int pgmR3PhysRomRegisterLocked(PVM pVM, PPDMDEVINS pDevIns, RTGCPHYS GCPh
                 pRamNew->fFlags        = PGM_RAM_RANGE_FLAGS_AD_HOC_ROM;
                 pRamNew->pvR3          = NULL;
                 pRamNew->paLSPages     = NULL;
+                pRamNew->paoffPhysHandlersR3 = NULL;
+                pRamNew->paoffPhysHandlersR0 = NIL_RTR0PTR;
 
                 PPGMPAGE pPage = &pRamNew->aPages[0];
                 for (uint32_t iPage = 0; iPage < cPages; iPage++, pPage++, pRomPage++)
@@ -4954,6 +4988,132 @@ VMMR3DECL(void) PGMR3PhysChunkInvalidateTLB(PVM pVM)
 }
 
 
+#ifdef PGM_WITH_LARGE_PAGES
+
+/**
+ * Allocates a large page (2MB) sized and aligned block of ring-3 memory that
+ * is backed by a host large page, for seeding into GMM.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   ppv         Where to return the address of the block.
+ */
+static int pgmR3PhysLargePageBackingAlloc(PVM pVM, void **ppv)
+{
+# ifdef RT_OS_LINUX
+    void *pv;
+    if (pVM->pgm.s.enmLargePageBacking == PGMLARGEPAGEBACKING_HUGETLB)
+    {
+        /* hugetlbfs mappings are always aligned on the huge page size. */
+        int fFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#  ifdef MAP_HUGE_2MB
+        fFlags |= MAP_HUGE_2MB;
+#  endif
+        pv = mmap(NULL, _2M, PROT_READ | PROT_WRITE, fFlags, -1, 0);
+        if (pv == MAP_FAILED)
+            return RTErrConvertFromErrno(errno);
+    }
+    else
+    {
+        /* Over-allocate, trim to an aligned block and ask for a transparent huge page. */
+        Assert(pVM->pgm.s.enmLargePageBacking == PGMLARGEPAGEBACKING_THP);
+        uint8_t *pbMap = (uint8_t *)mmap(NULL, _4M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pbMap == (uint8_t *)MAP_FAILED)
+            return RTErrConvertFromErrno(errno);
+        uint8_t *pbAligned = (uint8_t *)RT_ALIGN_P(pbMap, _2M);
+        if (pbAligned != pbMap)
+            munmap(pbMap, pbAligned - pbMap);
+        munmap(pbAligned + _2M, pbMap + _4M - (pbAligned + _2M));
+        pv = pbAligned;
+
+        if (madvise(pv, _2M, MADV_HUGEPAGE) != 0)
+        {
+            int rc = RTErrConvertFromErrno(errno);
+            munmap(pv, _2M);
+            return rc;
+        }
+    }
+
+    /* Fault it in, GMM checks that we got a large page when locking it down. */
+    *(uint8_t volatile *)pv = 0;
+    *ppv = pv;
+    return VINF_SUCCESS;
+# else
+    RT_NOREF(pVM, ppv);
+    return VERR_NOT_SUPPORTED;
+# endif
+}
+
+
+/**
+ * Frees a block allocated by pgmR3PhysLargePageBackingAlloc that GMM refused.
+ *
+ * @param   pv          The block.
+ */
+static void pgmR3PhysLargePageBackingFree(void *pv)
+{
+# ifdef RT_OS_LINUX
+    munmap(pv, _2M);
+# else
+    RT_NOREF(pv);
+# endif
+}
+
+
+/**
+ * Gets a large handy page backed by ring-3 supplied host large page memory,
+ * falling back on the GMM allocator if the host cannot provide one.
+ *
+ * The seeded memory is owned by GMM from then on.  Like the chunks seeded in
+ * legacy allocation mode it's never returned to ring-3, GMM recycles it for
+ * new large pages and unlocks it when the VM is destroyed.
+ *
+ * @returns VBox status code, see VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE.
+ * @param   pVM         The cross context VM structure.
+ */
+static int pgmR3PhysSeedLargeHandyPage(PVM pVM)
+{
+    int rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_SEED_LARGE_HANDY_PAGE, 0 /*NIL_RTR3PTR*/, NULL);
+    if (RT_SUCCESS(rc))
+    {
+        STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageRecycled);
+        return rc;
+    }
+    if (rc != VERR_GMM_SEED_ME)
+        return rc;
+
+    /* Once the host has failed us, don't waste time on mmap/madvise and
+       locking down small pages for every new large page. */
+    if (!pVM->pgm.s.fLargePageBackingUnavailable)
+    {
+        void *pv;
+        rc = pgmR3PhysLargePageBackingAlloc(pVM, &pv);
+        if (RT_SUCCESS(rc))
+        {
+            rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_SEED_LARGE_HANDY_PAGE, (uintptr_t)pv, NULL);
+            if (RT_SUCCESS(rc))
+            {
+                STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageSeeded);
+                return rc;
+            }
+            pgmR3PhysLargePageBackingFree(pv);
+        }
+        if (rc == VERR_GMM_HIT_VM_ACCOUNT_LIMIT)
+            return rc;
+        LogRel(("PGM: Failed to get a host large page for guest RAM (%Rrc), using GMM large pages instead\n", rc));
+        pVM->pgm.s.fLargePageBackingUnavailable = true;
+    }
+    STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageSeedFailed);
+
+    rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE, 0, NULL);
+    if (RT_SUCCESS(rc))
+        STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageGmm);
+    return rc;
+}
+
+#endif /* PGM_WITH_LARGE_PAGES */
+
+
 /**
  * Response to VMMCALLRING3_PGM_ALLOCATE_LARGE_HANDY_PAGE to allocate a large
  * (2MB) page for use with a nested paging PDE.
@@ -4974,7 +5134,15 @@ VMMR3DECL(int) PGMR3PhysAllocateLargeHandyPage(PVM pVM, RTGCPHYS GCPhys)
 
     STAM_PROFILE_START(&pVM->pgm.s.CTX_SUFF(pStats)->StatAllocLargePage, a);
     u64TimeStamp1 = RTTimeMilliTS();
-    int rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE, 0, NULL);
+    int rc;
+    if (pVM->pgm.s.enmLargePageBacking == PGMLARGEPAGEBACKING_GMM)
+    {
+        rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE, 0, NULL);
+        if (RT_SUCCESS(rc))
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageGmm);
+    }
+    else
+        rc = pgmR3PhysSeedLargeHandyPage(pVM);
     u64TimeStamp2 = RTTimeMilliTS();
     STAM_PROFILE_STOP(&pVM->pgm.s.CTX_SUFF(pStats)->StatAllocLargePage, a);
     if (RT_SUCCESS(rc))
@@ -5024,6 +5192,7 @@ VMMR3DECL(int) PGMR3PhysAllocateLargeHandyPage(PVM pVM, RTGCPHYS GCPhys)
                 PGM_PAGE_SET_PDE_TYPE(pVM, pPage, PGM_PAGE_PDE_TYPE_PDE);
                 PGM_PAGE_SET_PTE_INDEX(pVM, pPage, 0);
                 PGM_PAGE_SET_TRACKING(pVM, pPage, 0);
+                pgmPhysPageMarkLiveSaveDirty(pVM, pPage, GCPhys);
 
                 /* Somewhat dirty assumption that page ids are increasing. */
                 idPage++;
@@ -5323,6 +5492,7 @@ int pgmPhysFreePage(PVM pVM, PGMMFREEPAGESREQ pReq, uint32_t *pcPendingPages, PP
     PGM_PAGE_SET_PDE_TYPE(pVM, pPage, PGM_PAGE_PDE_TYPE_DONTCARE);
     PGM_PAGE_SET_PTE_INDEX(pVM, pPage, 0);
     PGM_PAGE_SET_TRACKING(pVM, pPage, 0);
+    pgmPhysPageMarkLiveSaveDirty(pVM, pPage, GCPhys);
 
     /* Flush physical page map TLB entry. */
     pgmPhysInvalidatePageMapTLBEntry(pVM, GCPhys);
@@ -21,6 +21,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_PGM
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/vmm/pdmdrv.h>
@@ -32,21 +33,34 @@
 #include <VBox/param.h>
 #include <VBox/err.h>
 #include <VBox/vmm/ftm.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/vmm/pgmdelta.h>
+#include <VBox/vmm/vmapi.h>
 
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/crc.h>
+#include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/path.h>
+#include <iprt/semaphore.h>
 #include <iprt/sha.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
+#include <iprt/time.h>
 
 
 /*********************************************************************************************************************************
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 16
+/** Saved state data unit version before re-sent RAM pages could be delta
+ *  encoded (PGM_STATE_REC_RAM_DELTA). */
+#define PGM_SAVED_STATE_VERSION_PRE_DELTA       15
+/** Saved state data unit version before RAM pages could be kept in a separate
+ *  page file (PGM_STATE_REC_RAM_PAGEFILE). */
+#define PGM_SAVED_STATE_VERSION_PRE_PAGE_FILE   14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -87,8 +101,14 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** Raw page stored in the RAM page file at offset GCPhys. No data. */
+#define PGM_STATE_REC_RAM_PAGEFILE      UINT8_C(0x09)
+/** Raw page encoded as a delta against the content sent by an earlier record
+ *  for the same page (see PGMDeltaEncode).  The 16-bit delta size precedes
+ *  the delta bytes. */
+#define PGM_STATE_REC_RAM_DELTA         UINT8_C(0x0a)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_DELTA
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -103,6 +123,30 @@
 /** The CRC-32 for a zero half page. */
 #define PGM_STATE_CRC32_ZERO_HALF_PAGE  UINT32_C(0xf1e8ba9e)
 
+/** @name Lazy restore
+ * @{ */
+/** The suffix appended to the saved state file name to get the RAM page file.
+ * Main knows it as well, see Machine::i_getSavedStatePageFilename. */
+#define PGM_LAZY_RESTORE_FILE_SUFFIX    ".pages"
+/** The number of pages the streamer thread reads ahead per batch. */
+#define PGM_LAZY_RESTORE_BATCH          64
+/** The size of the window (in pages) around a fault which the streamer
+ * prefers over the linear sweep.  Power of two. */
+#define PGM_LAZY_RESTORE_FAULT_WINDOW   512
+/** The max number of restored pages a handler range will bridge before it is
+ * split in two. */
+#define PGM_LAZY_RESTORE_MAX_GAP        16
+/** @} */
+
+/** @name Live save delta encoding
+ * @{ */
+/** The max size of a PGM_STATE_REC_RAM_DELTA payload.  Pages that changed
+ * too much to fit are sent raw. */
+#define PGM_STATE_DELTA_MAX_SIZE        (PAGE_SIZE / 2)
+/** The min number of pages in the delta page cache. */
+#define PGM_STATE_DELTA_MIN_PAGES       256
+/** @} */
+
 
 
 /** @name Old Page types used in older saved states.
@@ -149,6 +193,83 @@ typedef struct
 } PGMOLD;
 
 
+/**
+ * Ring-3 lazy restore state, see PGM::LazyRestore.
+ *
+ * Allocated the first time a RAM page file is written or read and kept
+ * around until the VM is destroyed.
+ */
+typedef struct PGMLAZYRESTORE
+{
+    /** The page file written by the current save operation. */
+    RTFILE                          hSaveFile;
+    /** The page file pending pages are restored from. */
+    RTFILE                          hLoadFile;
+    /** Bitmap of the pages pending restore, indexed by guest page frame number. */
+    uint64_t                       *pbmPending;
+    /** The number of bits in pbmPending (multiple of 64). */
+    uint32_t                        cBitmapPages;
+    /** The number of access handlers registered. */
+    uint32_t                        cHandlers;
+    /** The number of entries allocated for paGCPhysHandlers. */
+    uint32_t                        cHandlersAlloc;
+    /** Set while a batch is queued for installation by an EMT. */
+    bool volatile                   fBatchPending;
+    /** Tells the streamer thread to quit. */
+    bool volatile                   fShutdown;
+    /** The start addresses of the access handlers covering the pending pages. */
+    PRTGCPHYS                       paGCPhysHandlers;
+    /** The most recently faulted in page, NIL_RTGCPHYS if none since the
+     * streamer last looked. */
+    RTGCPHYS volatile               GCPhysLastFault;
+    /** The streamer thread. */
+    RTTHREAD                        hThread;
+    /** Signalled when a batch has been installed. */
+    RTSEMEVENT                      hEvtBatchDone;
+    /** The nanosecond timestamp of when the VM was allowed to run. */
+    uint64_t                        nsStart;
+    /** The number of pages pending when the VM was allowed to run. */
+    uint32_t                        cStartPages;
+    /** The number of pages in the current batch. */
+    uint32_t                        cBatchPages;
+    /** The guest addresses of the pages in the current batch. */
+    RTGCPHYS                        aBatchGCPhys[PGM_LAZY_RESTORE_BATCH];
+    /** The name of the page file being written. */
+    char                            szSaveFile[RTPATH_MAX];
+    /** The name of the page file being read. */
+    char                            szLoadFile[RTPATH_MAX];
+    /** The name of the saved state szLoadFile belongs to. */
+    char                            szLoadStateFile[RTPATH_MAX];
+    /** The contents of the pages in the current batch. */
+    uint8_t                         abBatch[PGM_LAZY_RESTORE_BATCH][PAGE_SIZE];
+} PGMLAZYRESTORE;
+/** Pointer to the ring-3 lazy restore state. */
+typedef PGMLAZYRESTORE *PPGMLAZYRESTORE;
+
+
+/**
+ * Live save delta page cache, see PGM::LiveSave::pDeltaCacheR3.
+ *
+ * Direct mapped by guest page frame number.  Each slot holds the content of
+ * the page last sent for that frame, which is what the target will apply a
+ * PGM_STATE_REC_RAM_DELTA record to.
+ */
+typedef struct PGMLIVESAVEDELTACACHE
+{
+    /** The number of slots (power of two). */
+    uint32_t                        cEntries;
+    /** The guest address of the page held by each slot, NIL_RTGCPHYS if
+     * the slot is unused. */
+    PRTGCPHYS                       paGCPhys;
+    /** The page copies (cEntries * PAGE_SIZE, page aligned). */
+    uint8_t                        *pbPages;
+    /** Scratch buffer for the encoded delta. */
+    uint8_t                         abDelta[PGM_STATE_DELTA_MAX_SIZE];
+} PGMLIVESAVEDELTACACHE;
+/** Pointer to the live save delta page cache. */
+typedef PGMLIVESAVEDELTACACHE *PPGMLIVESAVEDELTACACHE;
+
+
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
 *********************************************************************************************************************************/
@@ -1073,6 +1194,72 @@ static void pgmR3DoneMmio2Pages(PVM pVM)
 }
 
 
+/**
+ * Allocates a live save dirty bitmap for a RAM range.
+ *
+ * The bitmap is accessible from ring-0 when possible, so that pages dirtied
+ * there can be recorded without going to ring-3.  All bits are initially set
+ * since the first scan must look at every page.
+ *
+ * @returns Pointer to the ring-3 mapping of the bitmap, NULL on failure.
+ * @param   pVM                 The cross context VM structure.
+ * @param   cPages              The number of pages in the RAM range.
+ * @param   pR0Ptr              Where to return the ring-0 mapping,
+ *                              NIL_RTR0PTR if not available.
+ */
+static uint64_t *pgmR3LiveDirtyBitmapAlloc(PVM pVM, uint32_t cPages, PRTR0PTR pR0Ptr)
+{
+    size_t const cbBitmap = RT_ALIGN_Z(RT_ALIGN_32(cPages, 64) / 8, PAGE_SIZE);
+    RTR0PTR      R0Ptr    = NIL_RTR0PTR;
+    void        *pvBitmap = NULL;
+    int rc = SUPR3PageAllocEx(cbBitmap >> PAGE_SHIFT, 0 /*fFlags*/, &pvBitmap,
+#if defined(VBOX_WITH_MORE_RING0_MEM_MAPPINGS)
+                              &R0Ptr,
+#elif defined(VBOX_WITH_2X_4GB_ADDR_SPACE)
+                              VM_IS_HM_OR_NEM_ENABLED(pVM) ? &R0Ptr : NULL,
+#else
+                              NULL,
+#endif
+                              NULL /*paPages*/);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Failed to allocate a %zu byte live save dirty bitmap: %Rrc\n", cbBitmap, rc));
+        *pR0Ptr = NIL_RTR0PTR;
+        return NULL;
+    }
+#if defined(VBOX_WITH_MORE_RING0_MEM_MAPPINGS)
+    Assert(R0Ptr != NIL_RTR0PTR);
+#elif defined(VBOX_WITH_2X_4GB_ADDR_SPACE)
+    if (!VM_IS_HM_OR_NEM_ENABLED(pVM))
+        R0Ptr = NIL_RTR0PTR;
+#else
+    R0Ptr = (uintptr_t)pvBitmap;
+#endif
+    RT_NOREF(pVM);
+
+    ASMMemZero32(pvBitmap, cbBitmap);
+    ASMBitSetRange(pvBitmap, 0, (int32_t)cPages);
+    *pR0Ptr = R0Ptr;
+    return (uint64_t *)pvBitmap;
+}
+
+
+/**
+ * Frees a bitmap allocated by pgmR3LiveDirtyBitmapAlloc.
+ *
+ * @param   pbmDirty            The bitmap, NULL is ignored.
+ * @param   cPages              The number of pages in the RAM range.
+ */
+static void pgmR3LiveDirtyBitmapFree(uint64_t *pbmDirty, uint32_t cPages)
+{
+    if (pbmDirty)
+    {
+        int rc = SUPR3PageFreeEx(pbmDirty, RT_ALIGN_Z(RT_ALIGN_32(cPages, 64) / 8, PAGE_SIZE) >> PAGE_SHIFT);
+        AssertRC(rc);
+    }
+}
+
+
 /**
  * Prepares the RAM pages for a live save.
  *
@@ -1107,15 +1294,21 @@ static int pgmR3PrepRamPages(PVM pVM)
                 PPGMLIVESAVERAMPAGE paLSPages = (PPGMLIVESAVERAMPAGE)MMR3HeapAllocZ(pVM, MM_TAG_PGM, cPages * sizeof(PGMLIVESAVERAMPAGE));
                 if (!paLSPages)
                     return VERR_NO_MEMORY;
+                /* The dirty bitmap is optional, without it the range is scanned in full. */
+                RTR0PTR         pbmDirtyR0;
+                uint64_t       *pbmDirtyR3 = pgmR3LiveDirtyBitmapAlloc(pVM, cPages, &pbmDirtyR0);
                 pgmLock(pVM);
                 if (pVM->pgm.s.idRamRangesGen != idRamRangesGen)
                 {
                     pgmUnlock(pVM);
                     MMR3HeapFree(paLSPages);
+                    pgmR3LiveDirtyBitmapFree(pbmDirtyR3, cPages);
                     pgmLock(pVM);
                     break;              /* try again */
                 }
-                pCur->paLSPages = paLSPages;
+                pCur->paLSPages    = paLSPages;
+                pCur->pbmLSDirtyR3 = pbmDirtyR3;
+                pCur->pbmLSDirtyR0 = pbmDirtyR0;
 
                 /*
                  * Initialize the array.
@@ -1207,6 +1400,10 @@ static int pgmR3PrepRamPages(PVM pVM)
             }
         }
     } while (pCur);
+
+    /* From now on page changes must be recorded in the dirty bitmaps. */
+    pVM->pgm.s.LiveSave.fDirtyBitmapsIncomplete = false;
+    pVM->pgm.s.LiveSave.fDirtyBitmaps           = true;
     pgmUnlock(pVM);
 
     return VINF_SUCCESS;
@@ -1286,269 +1483,1303 @@ static void pgmR3StateCalcCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVESA
     int rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, &pCur->aPages[iPage], GCPhys, &pvPage, &PgMpLck);
     if (RT_SUCCESS(rc))
     {
-        paLSPages[iPage].u32Crc = RTCrc32(pvPage, PAGE_SIZE);
-        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+        paLSPages[iPage].u32Crc = RTCrc32(pvPage, PAGE_SIZE);
+        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+    }
+    else
+        paLSPages[iPage].u32Crc = UINT32_MAX; /* Invalid */
+}
+
+
+/**
+ * Verifies the CRC-32 for a page given it's raw bits.
+ *
+ * @param   pvPage              The page bits.
+ * @param   pCur                The current RAM range.
+ * @param   paLSPages           The current array of live save page tracking
+ *                              structures.
+ * @param   iPage               The page index.
+ */
+static void pgmR3StateVerifyCrc32ForPage(void const *pvPage, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage, const  char *pszWhere)
+{
+    if (paLSPages[iPage].u32Crc != UINT32_MAX)
+    {
+        uint32_t u32Crc = RTCrc32(pvPage, PAGE_SIZE);
+        Assert(   (   !PGM_PAGE_IS_ZERO(&pCur->aPages[iPage])
+                   && !PGM_PAGE_IS_BALLOONED(&pCur->aPages[iPage]))
+               || u32Crc == PGM_STATE_CRC32_ZERO_PAGE);
+        AssertMsg(paLSPages[iPage].u32Crc == u32Crc,
+                  ("%08x != %08x for %RGp %R[pgmpage] %s\n", paLSPages[iPage].u32Crc, u32Crc,
+                   pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage], pszWhere));
+    }
+}
+
+
+/**
+ * Verifies the CRC-32 for a RAM page.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pCur                The current RAM range.
+ * @param   paLSPages           The current array of live save page tracking
+ *                              structures.
+ * @param   iPage               The page index.
+ */
+static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage, const char *pszWhere)
+{
+    if (paLSPages[iPage].u32Crc != UINT32_MAX)
+    {
+        RTGCPHYS        GCPhys = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        PGMPAGEMAPLOCK  PgMpLck;
+        void const     *pvPage;
+        int rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, &pCur->aPages[iPage], GCPhys, &pvPage, &PgMpLck);
+        if (RT_SUCCESS(rc))
+        {
+            pgmR3StateVerifyCrc32ForPage(pvPage, pCur, paLSPages, iPage, pszWhere);
+            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+        }
+    }
+}
+
+#endif /* PGMLIVESAVERAMPAGE_WITH_CRC32 */
+/**
+ * Scans a RAM page for modifications and reprotects it.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pCur                The current RAM range.
+ * @param   paLSPages           The current array of live save page tracking
+ *                              structures.
+ * @param   iPage               The page index.
+ */
+static void pgmR3ScanRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage)
+{
+    /* Skip already ignored pages. */
+    if (paLSPages[iPage].fIgnore)
+        return;
+
+    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
+    {
+        /*
+         * A RAM page.
+         */
+        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
+        {
+            case PGM_PAGE_STATE_ALLOCATED:
+                /** @todo Optimize this: Don't always re-enable write
+                 * monitoring if the page is known to be very busy. */
+                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
+                {
+                    AssertMsg(paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                    Assert(pVM->pgm.s.cWrittenToPages > 0);
+                    pVM->pgm.s.cWrittenToPages--;
+                }
+                else
+                {
+                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    pVM->pgm.s.LiveSave.Ram.cMonitoredPages++;
+                }
+
+                if (!paLSPages[iPage].fDirty)
+                {
+                    pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                    if (paLSPages[iPage].fZero)
+                        pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+                    pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                }
+
+                pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
+                                        pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+                paLSPages[iPage].fWriteMonitored        = 1;
+                paLSPages[iPage].fWriteMonitoredJustNow = 1;
+                paLSPages[iPage].fDirty                 = 1;
+                paLSPages[iPage].fZero                  = 0;
+                paLSPages[iPage].fShared                = 0;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+#endif
+                break;
+
+            case PGM_PAGE_STATE_WRITE_MONITORED:
+                Assert(paLSPages[iPage].fWriteMonitored);
+                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
+                {
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    if (paLSPages[iPage].fWriteMonitoredJustNow)
+                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+                    else
+                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
+#endif
+                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
+                }
+                else
+                {
+                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+#endif
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                    }
+                }
+                break;
+
+            case PGM_PAGE_STATE_ZERO:
+            case PGM_PAGE_STATE_BALLOONED:
+                if (!paLSPages[iPage].fZero)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 1;
+                    paLSPages[iPage].fShared = 0;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
+#endif
+                }
+                break;
+
+            case PGM_PAGE_STATE_SHARED:
+                if (!paLSPages[iPage].fShared)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        if (paLSPages[iPage].fZero)
+                            pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 0;
+                    paLSPages[iPage].fShared = 1;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+#endif
+                }
+                break;
+        }
+    }
+    else
+    {
+        /*
+         * All other types => Ignore the page.
+         */
+        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
+        paLSPages[iPage].fIgnore = 1;
+        if (paLSPages[iPage].fWriteMonitored)
+        {
+            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
+             *        pages! */
+            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
+            {
+                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
+                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
+                Assert(pVM->pgm.s.cMonitoredPages > 0);
+                pVM->pgm.s.cMonitoredPages--;
+            }
+            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
+            {
+                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                Assert(pVM->pgm.s.cWrittenToPages > 0);
+                pVM->pgm.s.cWrittenToPages--;
+            }
+            pVM->pgm.s.LiveSave.Ram.cMonitoredPages--;
+        }
+
+        /** @todo the counting doesn't quite work out here. fix later? */
+        if (paLSPages[iPage].fDirty)
+            pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
+        else
+        {
+            pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+            if (paLSPages[iPage].fZero)
+                pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+        }
+        pVM->pgm.s.LiveSave.cIgnoredPages++;
+    }
+}
+
+
+/**
+ * Scan for RAM page modifications and reprotect them.
+ *
+ * Outside the final pass, RAM ranges with a dirty bitmap only have the pages
+ * recorded there looked at (see pgmPhysPageMarkLiveSaveDirty).  Pages which
+ * must be revisited by the next pass because they were write monitored just
+ * now are put back into the bitmap.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   fFinalPass          Whether this is the final pass or not.
+ */
+static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
+{
+    /*
+     * The RAM.
+     */
+    RTGCPHYS GCPhysCur = 0;
+    PPGMRAMRANGE pCur;
+    pgmLock(pVM);
+
+    /* Use the dirty bitmaps unless a page was changed in a context where
+       they're not accessible.  The final pass always looks at every page. */
+    bool const fFullScan = fFinalPass
+                        || !pVM->pgm.s.LiveSave.fDirtyBitmaps
+                        || ASMAtomicXchgBool(&pVM->pgm.s.LiveSave.fDirtyBitmapsIncomplete, false);
+    if (fFullScan)
+        pVM->pgm.s.LiveSave.cFullRamScans++;
+
+    do
+    {
+        uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        {
+            if (    pCur->GCPhysLast > GCPhysCur
+                && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            {
+                PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
+                uint64_t        *pbmDirty  = !fFinalPass ? pCur->pbmLSDirtyR3 : NULL;
+                uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
+                uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
+                GCPhysCur = 0;
+                if (!pbmDirty || fFullScan)
+                {
+                    for (; iPage < cPages; iPage++)
+                    {
+                        /* Do yield first. */
+                        if (   !fFinalPass
+#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
+                            && (iPage & 0x7ff) == 0x100
+#endif
+                            && PDMR3CritSectYield(&pVM->pgm.s.CritSectX)
+                            && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
+                        {
+                            GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+                            break; /* restart */
+                        }
+
+                        pgmR3ScanRamPage(pVM, pCur, paLSPages, iPage);
+
+                        /* Keep the bitmap in sync for the next pass. */
+                        if (pbmDirty)
+                        {
+                            if (paLSPages[iPage].fWriteMonitoredJustNow)
+                                ASMBitSet(pbmDirty, iPage);
+                            else
+                                ASMBitClear(pbmDirty, iPage);
+                        }
+                    } /* for each page in range */
+                }
+                else
+                {
+                    /*
+                     * Walk the dirty bitmap a 64-bit word at a time.  We only
+                     * yield between words so no recorded change is lost when
+                     * restarting.
+                     */
+                    uint32_t const cWords = RT_ALIGN_32(cPages, 64) / 64;
+                    for (uint32_t iWord = iPage / 64; iWord < cWords; iWord++)
+                    {
+                        if (   (iWord & 0x1f) == 0x4
+                            && PDMR3CritSectYield(&pVM->pgm.s.CritSectX)
+                            && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
+                        {
+                            GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iWord << (6 + PAGE_SHIFT));
+                            break; /* restart */
+                        }
+
+                        uint64_t fDirty = pbmDirty[iWord];
+                        if (!fDirty)
+                            continue;
+                        pbmDirty[iWord] = 0;
+                        do
+                        {
+                            uint32_t const iPageDirty = iWord * 64 + ASMBitFirstSetU64(fDirty) - 1;
+                            fDirty &= fDirty - 1;
+                            Assert(iPageDirty < cPages);
+
+                            pgmR3ScanRamPage(pVM, pCur, paLSPages, iPageDirty);
+                            if (paLSPages[iPageDirty].fWriteMonitoredJustNow)
+                                ASMBitSet(pbmDirty, iPageDirty);
+                        } while (fDirty);
+                    } /* for each bitmap word */
+                }
+
+                if (GCPhysCur != 0)
+                    break; /* Yield + ramrange change */
+                GCPhysCur = pCur->GCPhysLast;
+            }
+        } /* for each range */
+    } while (pCur);
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * Gets the lazy restore state, allocating it on first use.
+ *
+ * @returns Pointer to the state, NULL if out of memory.
+ * @param   pVM                 The cross context VM structure.
+ */
+static PPGMLAZYRESTORE pgmR3LazyRestoreGetState(PVM pVM)
+{
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (!pState)
+    {
+        pState = (PPGMLAZYRESTORE)MMR3HeapAllocZ(pVM, MM_TAG_PGM, sizeof(*pState));
+        if (!pState)
+            return NULL;
+        int rc = RTSemEventCreate(&pState->hEvtBatchDone);
+        if (RT_FAILURE(rc))
+        {
+            MMR3HeapFree(pState);
+            return NULL;
+        }
+        pState->hSaveFile       = NIL_RTFILE;
+        pState->hLoadFile       = NIL_RTFILE;
+        pState->hThread         = NIL_RTTHREAD;
+        pState->GCPhysLastFault = NIL_RTGCPHYS;
+        pVM->pgm.s.LazyRestore.pStateR3 = pState;
+    }
+    return pState;
+}
+
+
+/**
+ * Creates the RAM page file for a save operation if configured and possible.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ */
+static int pgmR3LazyRestoreOpenSaveFile(PVM pVM, PSSMHANDLE pSSM)
+{
+    if (!pVM->pgm.s.LazyRestore.fEnabled)
+        return VINF_SUCCESS;
+    const char *pszStateFile = SSMR3HandleFilename(pSSM);
+    if (!pszStateFile)
+        return VINF_SUCCESS; /* Teleportation and other streams keep all pages inline. */
+
+    PPGMLAZYRESTORE pState = pgmR3LazyRestoreGetState(pVM);
+    AssertReturn(pState, VERR_NO_MEMORY);
+    if (pState->hSaveFile != NIL_RTFILE)
+        return VINF_SUCCESS;
+
+    int rc = RTStrCopy(pState->szSaveFile, sizeof(pState->szSaveFile), pszStateFile);
+    if (RT_SUCCESS(rc))
+        rc = RTStrCat(pState->szSaveFile, sizeof(pState->szSaveFile), PGM_LAZY_RESTORE_FILE_SUFFIX);
+    if (RT_SUCCESS(rc))
+        rc = RTFileOpen(&pState->hSaveFile, pState->szSaveFile, RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Failed to create the RAM page file '%s': %Rrc\n", pState->szSaveFile, rc));
+        pState->hSaveFile = NIL_RTFILE;
+        return rc;
+    }
+    LogRel(("PGM: Saving RAM pages to '%s'\n", pState->szSaveFile));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Closes the RAM page file of a save operation.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   fDelete             Whether to delete it (failed or cancelled save).
+ */
+static void pgmR3LazyRestoreCloseSaveFile(PVM pVM, bool fDelete)
+{
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (!pState || pState->hSaveFile == NIL_RTFILE)
+        return;
+    RTFileClose(pState->hSaveFile);
+    pState->hSaveFile = NIL_RTFILE;
+    if (fDelete)
+        RTFileDelete(pState->szSaveFile);
+}
+
+
+/**
+ * Checks if a RAM page is all zeros.
+ *
+ * Unlike ASMMemIsZeroPage this ORs together 64 bytes at a time without
+ * branching, which the compiler turns into vector instructions.  Most pages
+ * being saved are not zero, so bailing out early buys little.
+ *
+ * @returns true if zero, false if not.
+ * @param   pvPage              The page.
+ */
+DECLINLINE(bool) pgmR3StateIsZeroPage(void const *pvPage)
+{
+    uint64_t const *pu64 = (uint64_t const *)pvPage;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 8)
+        if (  pu64[i]     | pu64[i + 1] | pu64[i + 2] | pu64[i + 3]
+            | pu64[i + 4] | pu64[i + 5] | pu64[i + 6] | pu64[i + 7])
+            return false;
+    return true;
+}
+
+
+/**
+ * Allocates the live save delta page cache if configured and applicable.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ */
+static int pgmR3LiveDeltaCacheAlloc(PVM pVM)
+{
+    Assert(!pVM->pgm.s.LiveSave.pDeltaCacheR3);
+    pVM->pgm.s.LiveSave.cDeltaPages  = 0;
+    pVM->pgm.s.LiveSave.cbDeltaSaved = 0;
+
+    /* The page file is written in place, there is nothing to delta against. */
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (pState && pState->hSaveFile != NIL_RTFILE)
+        return VINF_SUCCESS;
+
+    /* No point in having more slots than RAM pages.  Rounding down to a power
+       of two keeps the slot calculation cheap. */
+    uint64_t cPages = RT_MIN(pVM->pgm.s.LiveSave.cbDeltaCacheMax, MMR3PhysGetRamSize(pVM)) >> PAGE_SHIFT;
+    if (cPages < PGM_STATE_DELTA_MIN_PAGES)
+        return VINF_SUCCESS;
+    cPages = RT_MIN(cPages, _1G >> PAGE_SHIFT);
+    uint32_t cEntries = 1;
+    while (cEntries * 2 <= cPages)
+        cEntries *= 2;
+
+    PPGMLIVESAVEDELTACACHE pCache = (PPGMLIVESAVEDELTACACHE)RTMemAllocZ(sizeof(*pCache));
+    if (pCache)
+    {
+        pCache->cEntries = cEntries;
+        pCache->paGCPhys = (PRTGCPHYS)RTMemAlloc(sizeof(pCache->paGCPhys[0]) * cEntries);
+        pCache->pbPages  = (uint8_t *)RTMemPageAlloc((size_t)cEntries * PAGE_SIZE);
+        if (pCache->paGCPhys && pCache->pbPages)
+        {
+            for (uint32_t i = 0; i < cEntries; i++)
+                pCache->paGCPhys[i] = NIL_RTGCPHYS;
+            pVM->pgm.s.LiveSave.pDeltaCacheR3 = pCache;
+            LogRel(("PGM: Live save delta page cache: %u pages\n", cEntries));
+            return VINF_SUCCESS;
+        }
+        RTMemPageFree(pCache->pbPages, (size_t)cEntries * PAGE_SIZE);
+        RTMemFree(pCache->paGCPhys);
+        RTMemFree(pCache);
+    }
+
+    /* Not fatal, the pages will just be sent in full. */
+    LogRel(("PGM: Failed to allocate a %u page live save delta cache\n", cEntries));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Frees the live save delta page cache.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static void pgmR3LiveDeltaCacheFree(PVM pVM)
+{
+    PPGMLIVESAVEDELTACACHE pCache = pVM->pgm.s.LiveSave.pDeltaCacheR3;
+    if (!pCache)
+        return;
+    pVM->pgm.s.LiveSave.pDeltaCacheR3 = NULL;
+    if (pVM->pgm.s.LiveSave.cDeltaPages)
+        LogRel(("PGM: Live save sent %RU64 pages as deltas, saving %RU64 bytes\n",
+                pVM->pgm.s.LiveSave.cDeltaPages, pVM->pgm.s.LiveSave.cbDeltaSaved));
+    RTMemPageFree(pCache->pbPages, (size_t)pCache->cEntries * PAGE_SIZE);
+    RTMemFree(pCache->paGCPhys);
+    RTMemFree(pCache);
+}
+
+
+/**
+ * Forgets any copy of a page held by the delta page cache.
+ *
+ * Called when a page is saved as a zero or ballooned page, since the target
+ * no longer has the content a later delta would be encoded against.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   GCPhys              The address of the page.
+ */
+DECLINLINE(void) pgmR3LiveDeltaCacheInvalidate(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMLIVESAVEDELTACACHE pCache = pVM->pgm.s.LiveSave.pDeltaCacheR3;
+    if (pCache)
+    {
+        uint32_t const iEntry = (uint32_t)(GCPhys >> PAGE_SHIFT) & (pCache->cEntries - 1);
+        if (pCache->paGCPhys[iEntry] == GCPhys)
+            pCache->paGCPhys[iEntry] = NIL_RTGCPHYS;
+    }
+}
+
+
+/**
+ * Saves a non-zero RAM page, either inline, as a delta or via the RAM page
+ * file.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ * @param   GCPhys              The address of the page.
+ * @param   GCPhysLast          The address of the previously saved page.
+ * @param   pbPage              The page content.
+ * @param   pfSkipped           Set to true if nothing was saved because the
+ *                              target already has this content.
+ */
+static int pgmR3SaveRamPageRaw(PVM pVM, PSSMHANDLE pSSM, RTGCPHYS GCPhys, RTGCPHYS GCPhysLast, uint8_t const *pbPage,
+                               bool *pfSkipped)
+{
+    int             rc;
+    uint8_t         u8RecType = PGM_STATE_REC_RAM_RAW;
+    uint32_t        cbDelta   = 0;
+    PPGMLAZYRESTORE pState    = pVM->pgm.s.LazyRestore.pStateR3;
+    PPGMLIVESAVEDELTACACHE pCache = pVM->pgm.s.LiveSave.pDeltaCacheR3;
+    if (pState && pState->hSaveFile != NIL_RTFILE)
+    {
+        /* The page file is indexed by guest physical address, so pages saved
+           again in a later pass simply overwrite the older copy. */
+        rc = RTFileWriteAt(pState->hSaveFile, GCPhys, pbPage, PAGE_SIZE, NULL);
+        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc), rc);
+        u8RecType = PGM_STATE_REC_RAM_PAGEFILE;
+    }
+    else if (pCache)
+    {
+        /*
+         * Try encode it against the copy sent previously, then update the
+         * cache with what the target will have after this record.
+         */
+        uint32_t const iEntry       = (uint32_t)(GCPhys >> PAGE_SHIFT) & (pCache->cEntries - 1);
+        uint8_t       *pbCachedPage = &pCache->pbPages[(size_t)iEntry * PAGE_SIZE];
+        if (pCache->paGCPhys[iEntry] == GCPhys)
+        {
+            cbDelta = PGMDeltaEncode(pbCachedPage, pbPage, PAGE_SIZE, pCache->abDelta, sizeof(pCache->abDelta));
+            if (!cbDelta)
+            {
+                *pfSkipped = true;
+                pVM->pgm.s.LiveSave.cDeltaPages++;
+                pVM->pgm.s.LiveSave.cbDeltaSaved += PAGE_SIZE;
+                return VINF_SUCCESS;
+            }
+            if (cbDelta != UINT32_MAX)
+                u8RecType = PGM_STATE_REC_RAM_DELTA;
+        }
+        pCache->paGCPhys[iEntry] = GCPhys;
+        memcpy(pbCachedPage, pbPage, PAGE_SIZE);
+    }
+
+    if (GCPhys == GCPhysLast + PAGE_SIZE)
+        rc = SSMR3PutU8(pSSM, u8RecType);
+    else
+    {
+        SSMR3PutU8(pSSM, u8RecType | PGM_STATE_REC_FLAG_ADDR);
+        rc = SSMR3PutGCPhys(pSSM, GCPhys);
+    }
+    if (u8RecType == PGM_STATE_REC_RAM_RAW)
+        rc = SSMR3PutMem(pSSM, pbPage, PAGE_SIZE);
+    else if (u8RecType == PGM_STATE_REC_RAM_DELTA)
+    {
+        SSMR3PutU16(pSSM, (uint16_t)cbDelta);
+        rc = SSMR3PutMem(pSSM, pCache->abDelta, cbDelta);
+        pVM->pgm.s.LiveSave.cDeltaPages++;
+        pVM->pgm.s.LiveSave.cbDeltaSaved += PAGE_SIZE - sizeof(uint16_t) - cbDelta;
+    }
+    return rc;
+}
+
+
+/**
+ * Opens the RAM page file belonging to the saved state being loaded.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ * @param   ppState             Where to return the lazy restore state.
+ */
+static int pgmR3LazyRestoreOpenLoadFile(PVM pVM, PSSMHANDLE pSSM, PPGMLAZYRESTORE *ppState)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMLAZYRESTORE pState = pgmR3LazyRestoreGetState(pVM);
+    AssertReturn(pState, VERR_NO_MEMORY);
+    *ppState = pState;
+    if (pState->hLoadFile != NIL_RTFILE)
+        return VINF_SUCCESS;
+
+    const char *pszStateFile = SSMR3HandleFilename(pSSM);
+    if (!pszStateFile)
+        return SSMR3SetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
+                                 N_("RAM page file records in a saved state stream"));
+    int rc = RTStrCopy(pState->szLoadStateFile, sizeof(pState->szLoadStateFile), pszStateFile);
+    if (RT_SUCCESS(rc))
+        rc = RTStrCopy(pState->szLoadFile, sizeof(pState->szLoadFile), pszStateFile);
+    if (RT_SUCCESS(rc))
+        rc = RTStrCat(pState->szLoadFile, sizeof(pState->szLoadFile), PGM_LAZY_RESTORE_FILE_SUFFIX);
+    if (RT_SUCCESS(rc))
+        rc = RTFileOpen(&pState->hLoadFile, pState->szLoadFile,
+                        RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | RTFILE_O_DENY_NOT_DELETE);
+    if (RT_FAILURE(rc))
+    {
+        pState->hLoadFile = NIL_RTFILE;
+        return SSMR3SetLoadError(pSSM, rc, RT_SRC_POS, N_("Failed to open the RAM page file '%s'"), pState->szLoadFile);
+    }
+
+    /*
+     * Size the pending bitmap according to the current RAM layout.
+     */
+    RTGCPHYS GCPhysEnd = 0;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
+        GCPhysEnd = RT_MAX(GCPhysEnd, pRam->GCPhysLast + 1);
+    uint32_t const cBitmapPages = RT_ALIGN_32((uint32_t)(GCPhysEnd >> PAGE_SHIFT), 64);
+    if (cBitmapPages > pState->cBitmapPages)
+    {
+        Assert(!pVM->pgm.s.LazyRestore.cPendingPages);
+        RTMemFree(pState->pbmPending);
+        pState->cBitmapPages = 0;
+        pState->pbmPending   = (uint64_t *)RTMemAllocZ(cBitmapPages / 8);
+        AssertReturn(pState->pbmPending, VERR_NO_MEMORY);
+        pState->cBitmapPages = cBitmapPages;
+    }
+    LogRel(("PGM: Restoring RAM pages from '%s'%s\n", pState->szLoadFile, pVM->pgm.s.LazyRestore.fEnabled ? " (lazily)" : ""));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Turns off access handling for a restored page.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   GCPhys              The address of the page.
+ */
+static void pgmR3LazyRestoreDisarmPage(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMPHYSHANDLER pHandler = pgmHandlerPhysicalLookup(pVM, GCPhys);
+    if (   pHandler
+        && pHandler->hType == pVM->pgm.s.LazyRestore.hHandlerType)
+        PGMHandlerPhysicalPageTempOff(pVM, pHandler->Core.Key, GCPhys);
+}
+
+
+/**
+ * Drops a page from the pending set without touching its content.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The address of the page.
+ */
+static void pgmR3LazyRestoreForgetPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    Assert(PGM_PAGE_IS_LAZY_RESTORE(pPage));
+
+    PGM_PAGE_CLEAR_LAZY_RESTORE(pPage);
+    ASMBitClear(pState->pbmPending, (int32_t)(GCPhys >> PAGE_SHIFT));
+    ASMAtomicDecU32(&pVM->pgm.s.LazyRestore.cPendingPages);
+}
+
+
+/**
+ * Restores a pending page.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pState              The lazy restore state.
+ * @param   pPage               The page.
+ * @param   GCPhys              The address of the page.
+ * @param   pbSrc               The page content if already read, NULL to read
+ *                              it from the page file.
+ */
+static int pgmR3LazyRestorePageWorker(PVM pVM, PPGMLAZYRESTORE pState, PPGMPAGE pPage, RTGCPHYS GCPhys, uint8_t const *pbSrc)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    /* Clear the indicator first so the mapping below doesn't recurse. */
+    pgmR3LazyRestoreForgetPage(pVM, pPage, GCPhys);
+
+    int rc = VINF_SUCCESS;
+    if (!PGM_PAGE_IS_BALLOONED(pPage))
+    {
+        rc = pgmPhysPageMakeWritable(pVM, pPage, GCPhys);
+        if (RT_SUCCESS(rc))
+        {
+            void *pvDst;
+            rc = pgmPhysPageMap(pVM, pPage, GCPhys, &pvDst);
+            if (RT_SUCCESS(rc))
+            {
+                if (pbSrc)
+                    memcpy(pvDst, pbSrc, PAGE_SIZE);
+                else
+                    rc = RTFileReadAt(pState->hLoadFile, GCPhys, pvDst, PAGE_SIZE, NULL);
+            }
+        }
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("PGM: Failed to restore page %RGp from '%s': %Rrc\n", GCPhys, pState->szLoadFile, rc));
+            VMSetRuntimeError(pVM, VMSETRTERR_FLAGS_FATAL, "PGMLazyRestore",
+                              N_("Failed to restore guest RAM from the saved state page file '%s' (%Rrc)"),
+                              pState->szLoadFile, rc);
+            return rc;
+        }
+    }
+
+    pgmR3LazyRestoreDisarmPage(pVM, GCPhys);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Restores a pending page on demand, called when the page is being mapped.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The address of the page.
+ *
+ * @remarks Called from within the PGM critical section.
+ */
+int pgmR3PhysLazyRestorePage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    AssertLogRelReturn(pState && pState->hLoadFile != NIL_RTFILE, VERR_PGM_PHYS_PAGE_MAP_IPE_1);
+
+    STAM_REL_PROFILE_START(&pVM->pgm.s.StatLazyRestoreFaults, a);
+    int rc = pgmR3LazyRestorePageWorker(pVM, pState, pPage, GCPhys, NULL);
+    STAM_REL_PROFILE_STOP(&pVM->pgm.s.StatLazyRestoreFaults, a);
+
+    /* Let the streamer know where the guest is looking. */
+    ASMAtomicWriteU64(&pState->GCPhysLastFault, GCPhys);
+    return rc;
+}
+
+
+/**
+ * Response to VMMCALLRING3_PGM_LAZY_RESTORE_PAGE.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The address of the page to restore.
+ *
+ * @thread  EMT.
+ */
+VMMR3_INT_DECL(int) PGMR3PhysLazyRestorePage(PVM pVM, RTGCPHYS GCPhys)
+{
+    pgmLock(pVM);
+    int      rc    = VINF_SUCCESS;
+    PPGMPAGE pPage = pgmPhysGetPage(pVM, GCPhys);
+    if (pPage && PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        rc = pgmR3PhysLazyRestorePage(pVM, pPage, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK);
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNPGMPHYSHANDLER,
+ *      Access handler covering the pages pending lazy restore.}
+ *
+ * The caller has already mapped the page, which restored it via
+ * pgmPhysPageMapCommon and disarmed the handler for the page.
+ */
+static DECLCALLBACK(VBOXSTRICTRC)
+pgmR3LazyRestoreAccessHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                              PGMACCESSTYPE enmAccessType, PGMACCESSORIGIN enmOrigin, void *pvUser)
+{
+    RT_NOREF(pVCpu, pvPhys, pvBuf, cbBuf, enmAccessType, enmOrigin, pvUser);
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    RTGCPHYS const GCPhysPage = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    PPGMPAGE       pPage      = pgmPhysGetPage(pVM, GCPhysPage);
+    if (pPage && PGM_PAGE_IS_LAZY_RESTORE(pPage))
+    {
+        int rc = pgmR3PhysLazyRestorePage(pVM, pPage, GCPhysPage);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    else
+        pgmR3LazyRestoreDisarmPage(pVM, GCPhysPage);
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
+
+
+/**
+ * Handles a PGM_STATE_REC_RAM_PAGEFILE record.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ * @param   pPage               The page.
+ * @param   GCPhys              The address of the page.
+ */
+static int pgmR3LoadPageFromPageFile(PVM pVM, PSSMHANDLE pSSM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PPGMLAZYRESTORE pState;
+    int rc = pgmR3LazyRestoreOpenLoadFile(pVM, pSSM, &pState);
+    if (RT_FAILURE(rc))
+        return rc;
+    AssertLogRelMsgReturn(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM, ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage),
+                          VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+
+    /*
+     * Defer it if we can.  Pages covered by other access handlers are read
+     * right away since we can't stack our handler on top of theirs.
+     */
+    if (   pVM->pgm.s.LazyRestore.fEnabled
+        && !PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(pPage)
+        && (GCPhys >> PAGE_SHIFT) < pState->cBitmapPages)
+    {
+        if (PGM_PAGE_IS_BALLOONED(pPage))
+            PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ZERO);
+        if (!PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        {
+            PGM_PAGE_SET_LAZY_RESTORE(pPage);
+            ASMBitSet(pState->pbmPending, (int32_t)(GCPhys >> PAGE_SHIFT));
+            ASMAtomicIncU32(&pVM->pgm.s.LazyRestore.cPendingPages);
+        }
+        return VINF_SUCCESS;
+    }
+
+    PGMPAGEMAPLOCK PgMpLck;
+    void          *pvDstPage;
+    rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+    AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+    rc = RTFileReadAt(pState->hLoadFile, GCPhys, pvDstPage, PAGE_SIZE, NULL);
+    pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+    if (RT_FAILURE(rc))
+        return SSMR3SetLoadError(pSSM, rc, RT_SRC_POS, N_("Failed to read page %RGp from '%s'"), GCPhys, pState->szLoadFile);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Covers a run of pending pages with an access handler.
+ *
+ * Falls back on restoring the pages right away if the handler cannot be
+ * registered.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pState              The lazy restore state.
+ * @param   pRam                The RAM range.
+ * @param   iFirst              The first pending page in the run.
+ * @param   iLast               The last pending page in the run.
+ */
+static int pgmR3LazyRestoreArmRun(PVM pVM, PPGMLAZYRESTORE pState, PPGMRAMRANGE pRam, uint32_t iFirst, uint32_t iLast)
+{
+    RTGCPHYS const GCPhysFirst = pRam->GCPhys + ((RTGCPHYS)iFirst << PAGE_SHIFT);
+    RTGCPHYS const GCPhysLast  = pRam->GCPhys + ((RTGCPHYS)iLast  << PAGE_SHIFT) + PAGE_OFFSET_MASK;
+
+    int rc = VINF_SUCCESS;
+    if (pState->cHandlers >= pState->cHandlersAlloc)
+    {
+        uint32_t const cNew  = pState->cHandlersAlloc ? pState->cHandlersAlloc * 2 : 64;
+        void          *pvNew = RTMemRealloc(pState->paGCPhysHandlers, cNew * sizeof(pState->paGCPhysHandlers[0]));
+        if (pvNew)
+        {
+            pState->paGCPhysHandlers = (PRTGCPHYS)pvNew;
+            pState->cHandlersAlloc   = cNew;
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
+    if (RT_SUCCESS(rc))
+        rc = PGMHandlerPhysicalRegister(pVM, GCPhysFirst, GCPhysLast, pVM->pgm.s.LazyRestore.hHandlerType,
+                                        NIL_RTR3PTR, NIL_RTR0PTR, NIL_RTRCPTR, "Lazy restore");
+    if (RT_SUCCESS(rc))
+    {
+        pState->paGCPhysHandlers[pState->cHandlers++] = GCPhysFirst;
+        for (uint32_t iPage = iFirst + 1; iPage < iLast; iPage++)
+            if (!PGM_PAGE_IS_LAZY_RESTORE(&pRam->aPages[iPage]))
+                PGMHandlerPhysicalPageTempOff(pVM, GCPhysFirst, pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+        return VINF_SUCCESS;
+    }
+
+    LogRel(("PGM: Failed to register lazy restore handler for %RGp-%RGp (%Rrc), restoring now\n", GCPhysFirst, GCPhysLast, rc));
+    for (uint32_t iPage = iFirst; iPage <= iLast; iPage++)
+    {
+        PPGMPAGE pPage = &pRam->aPages[iPage];
+        if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        {
+            rc = pgmR3LazyRestorePageWorker(pVM, pState, pPage, pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), NULL);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Picks pending pages for the next streamer batch.
+ *
+ * @returns The new number of pages in the batch.
+ * @param   pState              The lazy restore state.
+ * @param   piPage              The page frame number to start looking at.  Updated.
+ * @param   iEnd                The page frame number to stop at.
+ * @param   cPages              The number of pages already in the batch.
+ */
+static uint32_t pgmR3LazyRestorePickPages(PPGMLAZYRESTORE pState, uint32_t *piPage, uint32_t iEnd, uint32_t cPages)
+{
+    uint32_t iPage = *piPage;
+    while (   cPages < PGM_LAZY_RESTORE_BATCH
+           && iPage < iEnd)
+    {
+        int32_t const iBit = iPage
+                           ? ASMBitNextSet(pState->pbmPending, pState->cBitmapPages, iPage - 1)
+                           : ASMBitFirstSet(pState->pbmPending, pState->cBitmapPages);
+        if (iBit < 0 || (uint32_t)iBit >= iEnd)
+        {
+            iPage = iEnd;
+            break;
+        }
+        pState->aBatchGCPhys[cPages++] = (RTGCPHYS)iBit << PAGE_SHIFT;
+        iPage = (uint32_t)iBit + 1;
+    }
+    *piPage = iPage;
+    return cPages;
+}
+
+
+/**
+ * EMT worker for pgmR3LazyRestoreThread that installs a batch of pages.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   idGeneration        The lazy restore generation the batch belongs to.
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreInstallBatch(PVM pVM, uint32_t idGeneration)
+{
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    pgmLock(pVM);
+    if (   pVM->pgm.s.LazyRestore.fActive
+        && pVM->pgm.s.LazyRestore.idGeneration == idGeneration)
+    {
+        for (uint32_t i = 0; i < pState->cBatchPages; i++)
+        {
+            RTGCPHYS const GCPhys = pState->aBatchGCPhys[i];
+            PPGMPAGE       pPage  = pgmPhysGetPage(pVM, GCPhys);
+            if (pPage && PGM_PAGE_IS_LAZY_RESTORE(pPage))
+            {
+                int rc = pgmR3LazyRestorePageWorker(pVM, pState, pPage, GCPhys, &pState->abBatch[i][0]);
+                if (RT_FAILURE(rc))
+                    break;
+                STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLazyRestoreStreamed);
+            }
+        }
+
+        ASMAtomicWriteBool(&pState->fBatchPending, false);
+        RTSemEventSignal(pState->hEvtBatchDone);
+    }
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * Stops lazy restoring.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   fComplete           Whether to restore the remaining pages (true)
+ *                              or to just forget about them (false, the
+ *                              memory is about to be reset or reloaded).
+ */
+static void pgmR3LazyRestoreStop(PVM pVM, bool fComplete)
+{
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (!pState || pState->hLoadFile == NIL_RTFILE)
+        return;
+
+    /*
+     * Stop the streamer first.  It never takes the PGM lock, so it's safe to
+     * wait for it while owning it.
+     */
+    pgmLock(pVM);
+    ASMAtomicIncU32(&pVM->pgm.s.LazyRestore.idGeneration);
+    if (pState->hThread != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pState->fShutdown, true);
+        RTSemEventSignal(pState->hEvtBatchDone);
+        int rc = RTThreadWait(pState->hThread, RT_MS_1MIN, NULL);
+        AssertLogRelRC(rc);
+        pState->hThread = NIL_RTTHREAD;
     }
-    else
-        paLSPages[iPage].u32Crc = UINT32_MAX; /* Invalid */
+    ASMAtomicWriteBool(&pState->fBatchPending, false);
+
+    /*
+     * Deal with the remaining pages before dropping the handlers, otherwise
+     * another vCPU could see the zero page in their place.
+     */
+    uint32_t const cLeft = pVM->pgm.s.LazyRestore.cPendingPages;
+    int32_t        iBit  = cLeft ? ASMBitFirstSet(pState->pbmPending, pState->cBitmapPages) : -1;
+    while (iBit >= 0)
+    {
+        RTGCPHYS const GCPhys = (RTGCPHYS)iBit << PAGE_SHIFT;
+        PPGMPAGE       pPage  = pgmPhysGetPage(pVM, GCPhys);
+        AssertLogRelMsgBreak(pPage && PGM_PAGE_IS_LAZY_RESTORE(pPage), ("%RGp\n", GCPhys));
+        if (   !fComplete
+            || RT_FAILURE(pgmR3LazyRestorePageWorker(pVM, pState, pPage, GCPhys, NULL)))
+        {
+            /* Already reported by the worker, don't repeat it for every page. */
+            if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+                pgmR3LazyRestoreForgetPage(pVM, pPage, GCPhys);
+            fComplete = false;
+        }
+        iBit = ASMBitNextSet(pState->pbmPending, pState->cBitmapPages, (uint32_t)iBit);
+    }
+    Assert(!pVM->pgm.s.LazyRestore.cPendingPages || !fComplete);
+    ASMMemZero32(pState->pbmPending, pState->cBitmapPages / 8);
+    ASMAtomicWriteU32(&pVM->pgm.s.LazyRestore.cPendingPages, 0);
+
+    for (uint32_t i = 0; i < pState->cHandlers; i++)
+    {
+        int rc = PGMHandlerPhysicalDeregister(pVM, pState->paGCPhysHandlers[i]);
+        AssertLogRelRC(rc);
+    }
+    pState->cHandlers = 0;
+    ASMAtomicWriteBool(&pVM->pgm.s.LazyRestore.fActive, false);
+    pgmUnlock(pVM);
+
+    /*
+     * Close the page file.  Main deletes it together with the saved state
+     * file (see Machine::i_deleteSavedStateFiles), which it may do while we
+     * are still reading from it.  Take care of it ourselves anyway should
+     * the saved state file be gone and the page file left behind.
+     */
+    RTFileClose(pState->hLoadFile);
+    pState->hLoadFile = NIL_RTFILE;
+    if (!RTFileExists(pState->szLoadStateFile))
+        RTFileDelete(pState->szLoadFile);
+
+    if (pState->nsStart)
+        LogRel(("PGM: Lazy restore %s after %'RU64 ms: %u of %u pages left over\n", fComplete ? "completed" : "cancelled",
+                (RTTimeNanoTS() - pState->nsStart) / RT_NS_1MS, fComplete ? 0 : cLeft, pState->cStartPages));
+    pState->nsStart = 0;
 }
 
 
 /**
- * Verifies the CRC-32 for a page given it's raw bits.
+ * EMT worker for pgmR3LazyRestoreThread that cleans up when all pages are in.
  *
- * @param   pvPage              The page bits.
- * @param   pCur                The current RAM range.
- * @param   paLSPages           The current array of live save page tracking
- *                              structures.
- * @param   iPage               The page index.
+ * @param   pVM                 The cross context VM structure.
+ * @param   idGeneration        The lazy restore generation the streamer served.
  */
-static void pgmR3StateVerifyCrc32ForPage(void const *pvPage, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage, const  char *pszWhere)
+static DECLCALLBACK(void) pgmR3LazyRestoreFinish(PVM pVM, uint32_t idGeneration)
 {
-    if (paLSPages[iPage].u32Crc != UINT32_MAX)
-    {
-        uint32_t u32Crc = RTCrc32(pvPage, PAGE_SIZE);
-        Assert(   (   !PGM_PAGE_IS_ZERO(&pCur->aPages[iPage])
-                   && !PGM_PAGE_IS_BALLOONED(&pCur->aPages[iPage]))
-               || u32Crc == PGM_STATE_CRC32_ZERO_PAGE);
-        AssertMsg(paLSPages[iPage].u32Crc == u32Crc,
-                  ("%08x != %08x for %RGp %R[pgmpage] %s\n", paLSPages[iPage].u32Crc, u32Crc,
-                   pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage], pszWhere));
-    }
+    if (   pVM->pgm.s.LazyRestore.fActive
+        && pVM->pgm.s.LazyRestore.idGeneration == idGeneration)
+        pgmR3LazyRestoreStop(pVM, true /*fComplete*/);
 }
 
 
 /**
- * Verifies the CRC-32 for a RAM page.
+ * @callback_method_impl{FNRTTHREAD,
+ *      Streams the pending pages in while the VM runs.}
  *
- * @param   pVM                 The cross context VM structure.
- * @param   pCur                The current RAM range.
- * @param   paLSPages           The current array of live save page tracking
- *                              structures.
- * @param   iPage               The page index.
+ * The page file is read here without holding any locks.  The pages are then
+ * installed by an EMT, which rechecks that each one is still pending.  Pages
+ * near the most recent fault are preferred over the linear sweep since the
+ * guest is likely to touch those next.
  */
-static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage, const char *pszWhere)
+static DECLCALLBACK(int) pgmR3LazyRestoreThread(RTTHREAD hThreadSelf, void *pvUser)
 {
-    if (paLSPages[iPage].u32Crc != UINT32_MAX)
+    PVM             pVM          = (PVM)pvUser;
+    PPGMLAZYRESTORE pState       = pVM->pgm.s.LazyRestore.pStateR3;
+    uint32_t const  idGeneration = pVM->pgm.s.LazyRestore.idGeneration;
+    uint32_t        iSweep       = 0;
+    RT_NOREF(hThreadSelf);
+
+    while (   !ASMAtomicReadBool(&pState->fShutdown)
+           && ASMAtomicReadU32(&pVM->pgm.s.LazyRestore.cPendingPages) > 0)
     {
-        RTGCPHYS        GCPhys = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
-        PGMPAGEMAPLOCK  PgMpLck;
-        void const     *pvPage;
-        int rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, &pCur->aPages[iPage], GCPhys, &pvPage, &PgMpLck);
-        if (RT_SUCCESS(rc))
+        /*
+         * Pick a batch.
+         */
+        uint32_t       cPages      = 0;
+        RTGCPHYS const GCPhysFault = ASMAtomicXchgU64(&pState->GCPhysLastFault, NIL_RTGCPHYS);
+        if (GCPhysFault != NIL_RTGCPHYS)
         {
-            pgmR3StateVerifyCrc32ForPage(pvPage, pCur, paLSPages, iPage, pszWhere);
-            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+            uint32_t iWindow = (uint32_t)(GCPhysFault >> PAGE_SHIFT) & ~(uint32_t)(PGM_LAZY_RESTORE_FAULT_WINDOW - 1);
+            cPages = pgmR3LazyRestorePickPages(pState, &iWindow, RT_MIN(iWindow + PGM_LAZY_RESTORE_FAULT_WINDOW,
+                                                                        pState->cBitmapPages), cPages);
+        }
+        if (cPages < PGM_LAZY_RESTORE_BATCH)
+        {
+            cPages = pgmR3LazyRestorePickPages(pState, &iSweep, pState->cBitmapPages, cPages);
+            if (iSweep >= pState->cBitmapPages)
+                iSweep = 0;
+        }
+        if (!cPages)
+        {
+            /* An EMT is busy with the last few pages. */
+            RTThreadSleep(1);
+            continue;
+        }
+
+        /*
+         * Read the pages and hand them to an EMT.
+         */
+        int rc = VINF_SUCCESS;
+        for (uint32_t i = 0; i < cPages && RT_SUCCESS(rc); i++)
+            rc = RTFileReadAt(pState->hLoadFile, pState->aBatchGCPhys[i], &pState->abBatch[i][0], PAGE_SIZE, NULL);
+        if (RT_FAILURE(rc))
+        {
+            /* Leave the rest to the faults, they will report the error properly. */
+            LogRel(("PGM: Lazy restore streamer failed to read '%s': %Rrc\n", pState->szLoadFile, rc));
+            return rc;
         }
+
+        pState->cBatchPages = cPages;
+        ASMAtomicWriteBool(&pState->fBatchPending, true);
+        rc = VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreInstallBatch, 2, pVM, idGeneration);
+        if (RT_FAILURE(rc))
+            return rc;
+        while (   ASMAtomicReadBool(&pState->fBatchPending)
+               && !ASMAtomicReadBool(&pState->fShutdown))
+            RTSemEventWait(pState->hEvtBatchDone, 100);
     }
+
+    if (!ASMAtomicReadBool(&pState->fShutdown))
+        VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreFinish, 2, pVM, idGeneration);
+    return VINF_SUCCESS;
 }
 
-#endif /* PGMLIVESAVERAMPAGE_WITH_CRC32 */
 
 /**
- * Scan for RAM page modifications and reprotect them.
+ * Lets the VM run on the deferred pages once loading is complete.
  *
+ * @returns VBox status code.
  * @param   pVM                 The cross context VM structure.
- * @param   fFinalPass          Whether this is the final pass or not.
  */
-static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
+static int pgmR3LazyRestoreStart(PVM pVM)
 {
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (!pState || pState->hLoadFile == NIL_RTFILE)
+        return VINF_SUCCESS;
+    if (!pVM->pgm.s.LazyRestore.cPendingPages)
+    {
+        pgmR3LazyRestoreStop(pVM, true /*fComplete*/);
+        return VINF_SUCCESS;
+    }
+
     /*
-     * The RAM.
+     * Cover the pending pages with access handlers so the guest and devices
+     * cannot get at them without us noticing.  Short gaps of restored pages
+     * are bridged to keep the number of handlers down.
      */
-    RTGCPHYS GCPhysCur = 0;
-    PPGMRAMRANGE pCur;
     pgmLock(pVM);
-    do
+    int rc = VINF_SUCCESS;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam && RT_SUCCESS(rc); pRam = pRam->pNextR3)
     {
-        uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
-        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        uint32_t const cPages = pRam->cb >> PAGE_SHIFT;
+        uint32_t       iPage  = 0;
+        while (iPage < cPages && RT_SUCCESS(rc))
         {
-            if (    pCur->GCPhysLast > GCPhysCur
-                && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            if (!PGM_PAGE_IS_LAZY_RESTORE(&pRam->aPages[iPage]))
             {
-                PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
-                uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
-                uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
-                GCPhysCur = 0;
-                for (; iPage < cPages; iPage++)
-                {
-                    /* Do yield first. */
-                    if (   !fFinalPass
-#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
-                        && (iPage & 0x7ff) == 0x100
-#endif
-                        && PDMR3CritSectYield(&pVM->pgm.s.CritSectX)
-                        && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
-                    {
-                        GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
-                        break; /* restart */
-                    }
+                iPage++;
+                continue;
+            }
 
-                    /* Skip already ignored pages. */
-                    if (paLSPages[iPage].fIgnore)
-                        continue;
+            uint32_t const iFirst = iPage;
+            uint32_t       iLast  = iPage;
+            while (++iPage < cPages)
+            {
+                PPGMPAGE pPage = &pRam->aPages[iPage];
+                if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+                    iLast = iPage;
+                else if (   iPage - iLast > PGM_LAZY_RESTORE_MAX_GAP
+                         || PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+                         || PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(pPage))
+                    break;
+            }
+            rc = pgmR3LazyRestoreArmRun(pVM, pState, pRam, iFirst, iLast);
+        }
+    }
 
-                    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
-                    {
-                        /*
-                         * A RAM page.
-                         */
-                        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
-                        {
-                            case PGM_PAGE_STATE_ALLOCATED:
-                                /** @todo Optimize this: Don't always re-enable write
-                                 * monitoring if the page is known to be very busy. */
-                                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                                {
-                                    AssertMsg(paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                    Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                    pVM->pgm.s.cWrittenToPages--;
-                                }
-                                else
-                                {
-                                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    pVM->pgm.s.LiveSave.Ram.cMonitoredPages++;
-                                }
+    /* The page map TLB may still be caching the zero page for some of them. */
+    pgmPhysInvalidatePageMapTLB(pVM);
 
-                                if (!paLSPages[iPage].fDirty)
-                                {
-                                    pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                    if (paLSPages[iPage].fZero)
-                                        pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                    pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                }
+    if (RT_SUCCESS(rc) && pVM->pgm.s.LazyRestore.cPendingPages)
+    {
+        pState->fShutdown       = false;
+        pState->fBatchPending   = false;
+        pState->GCPhysLastFault = NIL_RTGCPHYS;
+        pState->nsStart         = RTTimeNanoTS();
+        pState->cStartPages     = pVM->pgm.s.LazyRestore.cPendingPages;
+        ASMAtomicIncU32(&pVM->pgm.s.LazyRestore.idGeneration);
+        ASMAtomicWriteBool(&pVM->pgm.s.LazyRestore.fActive, true);
+        rc = RTThreadCreate(&pState->hThread, pgmR3LazyRestoreThread, pVM, 0, RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "PGMLazyRst");
+        if (RT_FAILURE(rc))
+            pState->hThread = NIL_RTTHREAD;
+        else
+            LogRel(("PGM: Lazy restore: %u pages pending, %u handler ranges\n",
+                    pVM->pgm.s.LazyRestore.cPendingPages, pState->cHandlers));
+    }
+    pgmUnlock(pVM);
 
-                                pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
-                                                        pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
-                                paLSPages[iPage].fWriteMonitored        = 1;
-                                paLSPages[iPage].fWriteMonitoredJustNow = 1;
-                                paLSPages[iPage].fDirty                 = 1;
-                                paLSPages[iPage].fZero                  = 0;
-                                paLSPages[iPage].fShared                = 0;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
-#endif
-                                break;
+    /* Without a streamer (or when we ran out of resources), just get it over with. */
+    if (RT_FAILURE(rc) || pState->hThread == NIL_RTTHREAD)
+    {
+        if (RT_FAILURE(rc))
+            LogRel(("PGM: Lazy restore not possible (%Rrc), restoring all pages now\n", rc));
+        pgmR3LazyRestoreStop(pVM, true /*fComplete*/);
+    }
+    return VINF_SUCCESS;
+}
 
-                            case PGM_PAGE_STATE_WRITE_MONITORED:
-                                Assert(paLSPages[iPage].fWriteMonitored);
-                                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
-                                {
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    if (paLSPages[iPage].fWriteMonitoredJustNow)
-                                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
-                                    else
-                                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
-#endif
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
-                                }
-                                else
-                                {
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
-#endif
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                    }
-                                }
-                                break;
 
-                            case PGM_PAGE_STATE_ZERO:
-                            case PGM_PAGE_STATE_BALLOONED:
-                                if (!paLSPages[iPage].fZero)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 1;
-                                    paLSPages[iPage].fShared = 0;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
-#endif
-                                }
-                                break;
+/**
+ * Registers the access handler type used for lazy restoring.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ */
+int pgmR3LazyRestoreInit(PVM pVM)
+{
+    /* Ring-0 and raw-mode defer all accesses to ring-3 where the page file is. */
+    return PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL, pgmR3LazyRestoreAccessHandler,
+                                            NULL, NULL, NULL,
+                                            NULL, NULL, NULL,
+                                            "Lazy restore", &pVM->pgm.s.LazyRestore.hHandlerType);
+}
 
-                            case PGM_PAGE_STATE_SHARED:
-                                if (!paLSPages[iPage].fShared)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        if (paLSPages[iPage].fZero)
-                                            pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 0;
-                                    paLSPages[iPage].fShared = 1;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
-#endif
-                                }
-                                break;
-                        }
-                    }
-                    else
-                    {
-                        /*
-                         * All other types => Ignore the page.
-                         */
-                        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
-                        paLSPages[iPage].fIgnore = 1;
-                        if (paLSPages[iPage].fWriteMonitored)
-                        {
-                            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
-                             *        pages! */
-                            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
-                            {
-                                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
-                                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
-                                Assert(pVM->pgm.s.cMonitoredPages > 0);
-                                pVM->pgm.s.cMonitoredPages--;
-                            }
-                            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                            {
-                                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                pVM->pgm.s.cWrittenToPages--;
-                            }
-                            pVM->pgm.s.LiveSave.Ram.cMonitoredPages--;
-                        }
 
-                        /** @todo the counting doesn't quite work out here. fix later? */
-                        if (paLSPages[iPage].fDirty)
-                            pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
-                        else
-                        {
-                            pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                            if (paLSPages[iPage].fZero)
-                                pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                        }
-                        pVM->pgm.s.LiveSave.cIgnoredPages++;
-                    }
-                } /* for each page in range */
+/**
+ * Cancels or completes lazy restoring ahead of a VM reset.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+void pgmR3LazyRestoreReset(PVM pVM)
+{
+    /* The content only matters if RAM survives the reset. */
+    pgmR3LazyRestoreStop(pVM, !pVM->pgm.s.fZeroRamPagesOnReset);
+}
 
-                if (GCPhysCur != 0)
-                    break; /* Yield + ramrange change */
-                GCPhysCur = pCur->GCPhysLast;
-            }
-        } /* for each range */
-    } while (pCur);
-    pgmUnlock(pVM);
+
+/**
+ * Stops lazy restoring and frees its resources, called by PGMR3Term.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+void pgmR3LazyRestoreTerm(PVM pVM)
+{
+    PPGMLAZYRESTORE pState = pVM->pgm.s.LazyRestore.pStateR3;
+    if (!pState)
+        return;
+    pgmR3LazyRestoreStop(pVM, false /*fComplete*/);
+    pgmR3LazyRestoreCloseSaveFile(pVM, false /*fDelete*/);
+
+    RTSemEventDestroy(pState->hEvtBatchDone);
+    RTMemFree(pState->pbmPending);
+    RTMemFree(pState->paGCPhysHandlers);
+    pVM->pgm.s.LazyRestore.pStateR3 = NULL;
+    MMR3HeapFree(pState);
 }
 
 
@@ -1658,21 +2889,24 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         uint8_t         abPage[PAGE_SIZE];
                         PGMPAGEMAPLOCK  PgMpLck;
                         void const     *pvPage;
+                        bool            fZeroContent = false;
                         rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pCurPage, GCPhys, &pvPage, &PgMpLck);
                         if (RT_SUCCESS(rc))
                         {
-                            memcpy(abPage, pvPage, PAGE_SIZE);
+                            /* Try save some memory when restoring. */
+                            fZeroContent = pgmR3StateIsZeroPage(pvPage);
+                            if (!fZeroContent)
+                                memcpy(abPage, pvPage, PAGE_SIZE);
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
                             if (paLSPages)
-                                pgmR3StateVerifyCrc32ForPage(abPage, pCur, paLSPages, iPage, "save#3");
+                                pgmR3StateVerifyCrc32ForPage(pvPage, pCur, paLSPages, iPage, "save#3");
 #endif
                             pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
                         }
                         pgmUnlock(pVM);
                         AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
 
-                        /* Try save some memory when restoring. */
-                        if (!ASMMemIsZeroPage(pvPage))
+                        if (!fZeroContent)
                         {
                             if (fFTMDeltaSaveActive)
                             {
@@ -1695,19 +2929,11 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                     fSkipped = true;
                             }
                             else
-                            {
-                                if (GCPhys == GCPhysLast + PAGE_SIZE)
-                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW);
-                                else
-                                {
-                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW | PGM_STATE_REC_FLAG_ADDR);
-                                    SSMR3PutGCPhys(pSSM, GCPhys);
-                                }
-                                rc = SSMR3PutMem(pSSM, abPage, PAGE_SIZE);
-                            }
+                                rc = pgmR3SaveRamPageRaw(pVM, pSSM, GCPhys, GCPhysLast, abPage, &fSkipped);
                         }
                         else
                         {
+                            pgmR3LiveDeltaCacheInvalidate(pVM, GCPhys);
                             if (GCPhys == GCPhysLast + PAGE_SIZE)
                                 rc = SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_ZERO);
                             else
@@ -1728,6 +2954,7 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
 #endif
                         pgmUnlock(pVM);
 
+                        pgmR3LiveDeltaCacheInvalidate(pVM, GCPhys);
                         uint8_t u8RecType = fBallooned ? PGM_STATE_REC_RAM_BALLOONED : PGM_STATE_REC_RAM_ZERO;
                         if (GCPhys == GCPhysLast + PAGE_SIZE)
                             rc = SSMR3PutU8(pSSM, u8RecType);
@@ -1788,10 +3015,13 @@ static void pgmR3DoneRamPages(PVM pVM)
      * paLSPages as an indicator of which RAM ranges which we need to scan for
      * write monitored pages.
      */
-    void *pvToFree = NULL;
+    void     *pvToFree        = NULL;
+    uint64_t *pbmToFree       = NULL;
+    uint32_t  cbmToFreePages  = 0;
     PPGMRAMRANGE pCur;
     uint32_t cMonitoredPages = 0;
     pgmLock(pVM);
+    pVM->pgm.s.LiveSave.fDirtyBitmaps = false;
     do
     {
         for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
@@ -1804,6 +3034,8 @@ static void pgmR3DoneRamPages(PVM pVM)
                     pgmUnlock(pVM);
                     MMR3HeapFree(pvToFree);
                     pvToFree = NULL;
+                    pgmR3LiveDirtyBitmapFree(pbmToFree, cbmToFreePages);
+                    pbmToFree = NULL;
                     pgmLock(pVM);
                     if (idRamRangesGen != pVM->pgm.s.idRamRangesGen)
                         break;          /* start over again. */
@@ -1811,6 +3043,10 @@ static void pgmR3DoneRamPages(PVM pVM)
 
                 pvToFree = pCur->paLSPages;
                 pCur->paLSPages = NULL;
+                pbmToFree      = pCur->pbmLSDirtyR3;
+                cbmToFreePages = pCur->cb >> PAGE_SHIFT;
+                pCur->pbmLSDirtyR3 = NULL;
+                pCur->pbmLSDirtyR0 = NIL_RTR0PTR;
 
                 uint32_t iPage = pCur->cb >> PAGE_SHIFT;
                 while (iPage--)
@@ -1837,6 +3073,7 @@ static void pgmR3DoneRamPages(PVM pVM)
 
     MMR3HeapFree(pvToFree);
     pvToFree = NULL;
+    pgmR3LiveDirtyBitmapFree(pbmToFree, cbmToFreePages);
 }
 
 
@@ -2011,6 +3248,14 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
  */
 static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
 {
+    /*
+     * Pages still pending lazy restore would otherwise be saved as zero pages.
+     */
+    pgmR3LazyRestoreStop(pVM, true /*fComplete*/);
+    int rc = pgmR3LazyRestoreOpenSaveFile(pVM, pSSM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Indicate that we will be using the write monitoring.
      */
@@ -2045,13 +3290,13 @@ static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
     /*
      * Per page type.
      */
-    int rc = pgmR3PrepRomPages(pVM);
+    rc = pgmR3PrepRomPages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepMmio2Pages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepRamPages(pVM);
-
-    NOREF(pSSM);
+    if (RT_SUCCESS(rc))
+        rc = pgmR3LiveDeltaCacheAlloc(pVM);
     return rc;
 }
 
@@ -2064,6 +3309,18 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
     int     rc   = VINF_SUCCESS;
     PPGM    pPGM = &pVM->pgm.s;
 
+    /*
+     * Complete any lazy restore and set up the RAM page file (pgmR3LivePrep
+     * has done this already for live saves).
+     */
+    if (!pVM->pgm.s.LiveSave.fActive)
+    {
+        pgmR3LazyRestoreStop(pVM, true /*fComplete*/);
+        rc = pgmR3LazyRestoreOpenSaveFile(pVM, pSSM);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     /*
      * Lock PGM and set the no-more-writes indicator.
      */
@@ -2135,6 +3392,7 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
         pgmR3DoneRomPages(pVM);
         pgmR3DoneMmio2Pages(pVM);
         pgmR3DoneRamPages(pVM);
+        pgmR3LiveDeltaCacheFree(pVM);
     }
 
     /*
@@ -2147,7 +3405,7 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
     pVM->pgm.s.fPhysWriteMonitoringEngaged = false;
     pgmUnlock(pVM);
 
-    NOREF(pSSM);
+    pgmR3LazyRestoreCloseSaveFile(pVM, RT_FAILURE(SSMR3HandleGetStatus(pSSM)));
     return VINF_SUCCESS;
 }
 
@@ -2158,8 +3416,10 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
 static DECLCALLBACK(int) pgmR3LoadPrep(PVM pVM, PSSMHANDLE pSSM)
 {
     /*
-     * Call the reset function to make sure all the memory is cleared.
+     * Call the reset function to make sure all the memory is cleared.  Any
+     * lazy restore in progress is moot as all RAM is about to be reloaded.
      */
+    pgmR3LazyRestoreStop(pVM, false /*fComplete*/);
     PGMR3Reset(pVM);
     pVM->pgm.s.LiveSave.fActive = false;
     NOREF(pSSM);
@@ -2677,6 +3937,8 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_PAGEFILE:
+            case PGM_STATE_REC_RAM_DELTA:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2695,6 +3957,16 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                 rc = pgmPhysGetPageWithHintEx(pVM, GCPhys, &pPage, &pRamHint);
                 AssertLogRelMsgRCReturn(rc, ("rc=%Rrc %RGp\n", rc, GCPhys), rc);
 
+                /* A record from a later pass supersedes a page file record.  Deltas
+                   are never encoded against pages in the page file. */
+                if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+                {
+                    AssertLogRelMsgReturn((u8 & ~PGM_STATE_REC_FLAG_ADDR) != PGM_STATE_REC_RAM_DELTA,
+                                          ("GCPhys=%RGp\n", GCPhys), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                    if ((u8 & ~PGM_STATE_REC_FLAG_ADDR) != PGM_STATE_REC_RAM_PAGEFILE)
+                        pgmR3LazyRestoreForgetPage(pVM, pPage, GCPhys);
+                }
+
                 /*
                  * Take action according to the record type.
                  */
@@ -2782,6 +4054,40 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_PAGEFILE:
+                    {
+                        rc = pgmR3LoadPageFromPageFile(pVM, pSSM, pPage, GCPhys);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        break;
+                    }
+
+                    case PGM_STATE_REC_RAM_DELTA:
+                    {
+                        AssertLogRelMsgReturn(uVersion > PGM_SAVED_STATE_VERSION_PRE_DELTA, ("uVersion=%u\n", uVersion),
+                                              VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        uint16_t cbDelta;
+                        rc = SSMR3GetU16(pSSM, &cbDelta);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(cbDelta > 0 && cbDelta <= PGM_STATE_DELTA_MAX_SIZE, ("GCPhys=%RGp cbDelta=%#x\n", GCPhys, cbDelta),
+                                              VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        uint8_t abDelta[PGM_STATE_DELTA_MAX_SIZE];
+                        rc = SSMR3GetMem(pSSM, abDelta, cbDelta);
+                        if (RT_FAILURE(rc))
+                            return rc;
+
+                        PGMPAGEMAPLOCK PgMpLck;
+                        void          *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+                        rc = PGMDeltaDecode(abDelta, cbDelta, (uint8_t *)pvDstPage, PAGE_SIZE);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp cbDelta=%#x rc=%Rrc\n", GCPhys, cbDelta, rc),
+                                                VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -3144,11 +4450,13 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
      */
     if (   (   uPass != SSM_PASS_FINAL
             && uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAGE_FILE
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
             && uVersion != PGM_SAVED_STATE_VERSION_NO_RAM_CFG)
         || (   uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAGE_FILE
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
@@ -3306,7 +4614,16 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
 static DECLCALLBACK(int) pgmR3LoadDone(PVM pVM, PSSMHANDLE pSSM)
 {
     pVM->pgm.s.fRestoreRomPagesOnReset = true;
-    NOREF(pSSM);
+
+    /* Guest memory was replaced without the access handlers noticing. */
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+
+    /*
+     * Let the VM run on the pages deferred to the RAM page file.
+     */
+    if (RT_SUCCESS(SSMR3HandleGetStatus(pSSM)))
+        return pgmR3LazyRestoreStart(pVM);
+    pgmR3LazyRestoreStop(pVM, false /*fComplete*/);
     return VINF_SUCCESS;
 }
 
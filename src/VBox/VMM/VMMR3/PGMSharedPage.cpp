@@ -22,6 +22,7 @@
 #define LOG_GROUP LOG_GROUP_PGM_SHARED
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/vmm/tm.h>
 #include <VBox/vmm/uvm.h>
 #include "PGMInternal.h"
 #include <VBox/vmm/vm.h>
@@ -272,6 +273,131 @@ VMMR3DECL(int) PGMR3SharedModuleCheckAll(PVM pVM)
 }
 
 
+/**
+ * Rendezvous callback doing one page fusion content scan pass.
+ *
+ * @returns VBox strict status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pVCpu               The cross context virtual CPU structure of the calling EMT.
+ * @param   pvUser              The max number of guest pages to examine.
+ */
+static DECLCALLBACK(VBOXSTRICTRC) pgmR3SharedPageScanRendezvous(PVM pVM, PVMCPU pVCpu, void *pvUser)
+{
+    RT_NOREF(pVCpu);
+
+    /* Flush all pending handy page operations before changing any shared page assignments. */
+    int rc = PGMR3PhysAllocateHandyPages(pVM);
+    AssertRC(rc);
+
+    /*
+     * Lock it here as we can't deal with busy locks in this ring-0 path.
+     */
+    pgmLock(pVM);
+    pgmR3PhysAssertSharedPageChecksums(pVM);
+    rc = GMMR3ScanForDuplicatePages(pVM, (uint32_t)(uintptr_t)pvUser);
+    pgmR3PhysAssertSharedPageChecksums(pVM);
+    pgmUnlock(pVM);
+
+    LogFlow(("pgmR3SharedPageScanRendezvous: cursor=%RGp rc=%Rrc\n", pVM->pgm.s.Dedup.GCPhysCursor, rc));
+    return rc;
+}
+
+
+/**
+ * Does a page fusion content scan pass right away.
+ *
+ * The pass picks up where the previous one stopped, whether or not the
+ * periodic scanning is enabled (/PGM/PageFusion/ContentScan).
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if page fusion isn't allowed or NEM is used.
+ * @param   pVM                 The cross context VM structure.
+ * @param   cMaxPages           The max number of guest pages to examine.
+ */
+VMMR3DECL(int) PGMR3SharedPageScan(PVM pVM, uint32_t cMaxPages)
+{
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    if (    !pVM->pgm.s.fPageFusionAllowed
+        ||  VM_IS_NEM_ENABLED(pVM))
+        return VERR_NOT_SUPPORTED;
+
+    return VMMR3EmtRendezvous(pVM, VMMEMTRENDEZVOUS_FLAGS_TYPE_ONCE, pgmR3SharedPageScanRendezvous,
+                              (void *)(uintptr_t)cMaxPages);
+}
+
+
+/**
+ * Content scan helper (called on the way out).
+ *
+ * Does one pass and rearms the timer for the next one.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+static DECLCALLBACK(void) pgmR3SharedPageScanHelper(PVM pVM)
+{
+    /* Stall the other VCPUs for the same reason as pgmR3CheckSharedModulesHelper. */
+    STAM_REL_PROFILE_START(&pVM->pgm.s.StatDedupScan, a);
+    int rc = PGMR3SharedPageScan(pVM, pVM->pgm.s.Dedup.cPagesPerScan);
+    STAM_REL_PROFILE_STOP(&pVM->pgm.s.StatDedupScan, a);
+    if (RT_SUCCESS(rc))
+    {
+        rc = TMTimerSetMillies(pVM->pgm.s.Dedup.pTimerR3, pVM->pgm.s.Dedup.cMsInterval);
+        AssertRC(rc);
+    }
+    else
+        LogRel(("PGM: Page fusion content scanning stopped: %Rrc\n", rc));
+}
+
+
+/**
+ * @callback_method_impl{FNTMTIMERINT, Kicks off a content scan pass.}
+ */
+static DECLCALLBACK(void) pgmR3SharedPageScanTimer(PVM pVM, PTMTIMER pTimer, void *pvUser)
+{
+    RT_NOREF(pTimer, pvUser);
+
+    /* Can't do rendezvous from the timer callback; perform it on the way out. */
+    int rc = VMR3ReqCallNoWait(pVM, VMCPUID_ANY_QUEUE, (PFNRT)pgmR3SharedPageScanHelper, 1, pVM);
+    AssertLogRelRC(rc);
+}
+
+
+/**
+ * Sets up the page fusion content scanner if configured.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @thread  EMT(0)
+ */
+int pgmR3SharedPageScanInit(PVM pVM)
+{
+    if (!pVM->pgm.s.Dedup.fEnabled)
+        return VINF_SUCCESS;
+    if (!pVM->pgm.s.fPageFusionAllowed)
+    {
+        LogRel(("PGM: /PGM/PageFusion/ContentScan ignored as page fusion isn't allowed\n"));
+        return VINF_SUCCESS;
+    }
+    if (VM_IS_NEM_ENABLED(pVM))
+    {
+        /* NEM isn't told about pages changing backing or becoming read-only. */
+        LogRel(("PGM: /PGM/PageFusion/ContentScan ignored as it isn't supported in NEM mode\n"));
+        pVM->pgm.s.Dedup.fEnabled = false;
+        return VINF_SUCCESS;
+    }
+
+    int rc = TMR3TimerCreateInternal(pVM, TMCLOCK_REAL, pgmR3SharedPageScanTimer, NULL, "PGM Page Fusion Scan",
+                                     &pVM->pgm.s.Dedup.pTimerR3);
+    AssertRCReturn(rc, rc);
+    rc = TMTimerSetMillies(pVM->pgm.s.Dedup.pTimerR3, pVM->pgm.s.Dedup.cMsInterval);
+    AssertRCReturn(rc, rc);
+
+    LogRel(("PGM: Page fusion content scanning enabled: %u pages every %u ms\n",
+            pVM->pgm.s.Dedup.cPagesPerScan, pVM->pgm.s.Dedup.cMsInterval));
+    return VINF_SUCCESS;
+}
+
+
 # ifdef DEBUG
 /**
  * Query the state of a page in a shared module
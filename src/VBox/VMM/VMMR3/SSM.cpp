@@ -112,7 +112,13 @@
  *       - type 5: Named data - length prefixed name followed by the data. This
  *                 type is not implemented yet as we're missing the API part, so
  *                 the type assignment is tentative.
- *       - types 6 thru 15 are current undefined.
+ *       - type 6: Raw data compressed by a selectable codec.  The data is
+ *                 prefixed by a 8-bit codec identifier (SSM_ZIP_CODEC_XXX) and
+ *                 a 8-bit field containing the length of the uncompressed data
+ *                 given in 1KB units.  Streams containing such records have
+ *                 SSMFILEHDR_FLAGS_STREAM_RAW_ZIP set in the header so that
+ *                 older readers refuse them up front.
+ *       - types 7 thru 15 are current undefined.
  *   - bit 4: Important (set), can be skipped (clear).
  *   - bit 5: Undefined flag, must be zero.
  *   - bit 6: Undefined flag, must be zero.
@@ -127,6 +133,12 @@
  * based. The unit header contained the compressed size of the data, i.e. it
  * needed updating after the data was written.)
  *
+ * Each compression block is encoded as a record of its own.  When saving, the
+ * blocks can therefore be compressed by a pool of worker threads (see
+ * SSMZIP), with the EMT only collecting the finished records and writing them
+ * to the stream in the original order.  The codec and the number of threads
+ * are configured via the /SSM/Compression and /SSM/CompressionThreads keys.
+ *
  *
  * @section sec_ssm_future          Future Changes
  *
@@ -145,6 +157,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/pdmcritsect.h>
@@ -161,6 +174,7 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
@@ -192,6 +206,8 @@
 #define SSMFILEHDR_FLAGS_STREAM_CRC32           RT_BIT_32(0)
 /** Indicates that the file was produced by a live save. */
 #define SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE       RT_BIT_32(1)
+/** The stream contains SSM_REC_TYPE_RAW_ZIP records. */
+#define SSMFILEHDR_FLAGS_STREAM_RAW_ZIP         RT_BIT_32(2)
 /** @} */
 
 /** The directory magic. */
@@ -227,12 +243,19 @@
 /** Named data items.
  * A length prefix zero terminated string (i.e. max 255) followed by the data.  */
 #define SSM_REC_TYPE_NAMED                      5
+/** Raw data compressed by the codec given in the record.
+ * The record header is followed by a 8-bit codec identifier (SSM_ZIP_CODEC_XXX)
+ * and a 8-bit field containing the size of the uncompressed data in 1KB units.
+ * The compressed data is after them.  LZF compressed data is always written
+ * as SSM_REC_TYPE_RAW_LZF for the benefit of older readers. */
+#define SSM_REC_TYPE_RAW_ZIP                    6
 /** Macro for validating the record type.
  * This can be used with the flags+type byte, no need to mask out the type first. */
 #define SSM_REC_TYPE_IS_VALID(u8Type)           (   ((u8Type) & SSM_REC_TYPE_MASK) >  SSM_REC_TYPE_INVALID \
-                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_NAMED )
+                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_RAW_ZIP )
 /** @} */
 
+
 /** The flag mask. */
 #define SSM_REC_FLAGS_MASK                      UINT8_C(0xf0)
 /** The record is important if this flag is set, if clear it can be omitted. */
@@ -284,6 +307,22 @@
  * Must be a multiple of 1KB.  */
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
+/** The max size of the record encoding one compression block. */
+#define SSM_ZIP_BLOCK_REC_MAX_SIZE              (1 + 3 + 2 + SSM_ZIP_BLOCK_SIZE)
+AssertCompile(SSM_ZIP_BLOCK_REC_MAX_SIZE < 0x00010000);
+
+/** The max number of compression worker threads. */
+#define SSM_ZIP_MAX_THREADS                     16
+/** The number of compression blocks in one compression work item. */
+#define SSM_ZIP_ITEM_BLOCKS                     16
+/** The max number of chunks in one compression work item.
+ * There is typically a small record in front of each block. */
+#define SSM_ZIP_ITEM_MAX_CHUNKS                 (SSM_ZIP_ITEM_BLOCKS * 2 + 8)
+/** The input buffer size of a compression work item. */
+#define SSM_ZIP_ITEM_IN_SIZE                    (SSM_ZIP_ITEM_BLOCKS * SSM_ZIP_BLOCK_SIZE + _16K)
+/** The output buffer size of a compression work item (worst case).  */
+#define SSM_ZIP_ITEM_OUT_SIZE                   (  SSM_ZIP_ITEM_IN_SIZE \
+                                                 + SSM_ZIP_ITEM_MAX_CHUNKS * (SSM_ZIP_BLOCK_REC_MAX_SIZE - SSM_ZIP_BLOCK_SIZE))
 
 
 /**
@@ -447,6 +486,111 @@ typedef struct SSMSTRM
 typedef SSMSTRM *PSSMSTRM;
 
 
+/**
+ * Compression work item states.
+ */
+typedef enum SSMZIPITEMSTATE
+{
+    /** Unused. */
+    SSMZIPITEMSTATE_FREE = 0,
+    /** Being filled by the EMT. */
+    SSMZIPITEMSTATE_FILLING,
+    /** Waiting for a worker to pick it up. */
+    SSMZIPITEMSTATE_QUEUED,
+    /** Being compressed. */
+    SSMZIPITEMSTATE_BUSY,
+    /** Compressed, waiting for the EMT to write it to the stream. */
+    SSMZIPITEMSTATE_DONE
+} SSMZIPITEMSTATE;
+
+/**
+ * A chunk of input data in a compression work item.
+ */
+typedef struct SSMZIPCHUNK
+{
+    /** Offset into SSMZIPITEM::abIn. */
+    uint32_t                offIn;
+    /** Number of bytes. */
+    uint32_t                cbIn;
+    /** Set if this is a compression block (SSM_ZIP_BLOCK_SIZE), clear if it's
+     * ready made record bytes that should be passed on unchanged. */
+    bool                    fBlock;
+} SSMZIPCHUNK;
+
+/**
+ * A compression work item.
+ *
+ * This collects the data written by the EMT in order, the compression blocks
+ * are encoded as records by a worker thread while the other bytes are just
+ * copied.  The result is written to the stream by the EMT.
+ */
+typedef struct SSMZIPITEM
+{
+    /** The item state (SSMZIPITEMSTATE). */
+    uint32_t volatile       enmState;
+    /** Number of chunks. */
+    uint32_t                cChunks;
+    /** Number of compression blocks. */
+    uint32_t                cBlocks;
+    /** Number of bytes used in abIn. */
+    uint32_t                cbIn;
+    /** Number of bytes produced in abOut. */
+    uint32_t                cbOut;
+    /** Number of bytes the compression blocks were encoded into. */
+    uint32_t                cbBlocksOut;
+    /** The chunks. */
+    SSMZIPCHUNK             aChunks[SSM_ZIP_ITEM_MAX_CHUNKS];
+    /** The input data. */
+    uint8_t                 abIn[SSM_ZIP_ITEM_IN_SIZE];
+    /** The output records. */
+    uint8_t                 abOut[SSM_ZIP_ITEM_OUT_SIZE];
+} SSMZIPITEM;
+/** Pointer to a compression work item. */
+typedef SSMZIPITEM *PSSMZIPITEM;
+
+/**
+ * The compression pipeline of a save operation.
+ *
+ * The work items are used round robin by the EMT, which makes the in order
+ * reassembly trivial: the oldest submitted item is always at iDrain.
+ */
+typedef struct SSMZIP
+{
+    /** The codec (SSM_ZIP_CODEC_XXX). */
+    uint8_t                 uCodec;
+    /** Set when the worker threads should terminate. */
+    bool volatile           fTerminate;
+    /** Number of worker threads. */
+    uint32_t                cThreads;
+    /** Number of work items. */
+    uint32_t                cItems;
+    /** Index of the oldest submitted item. */
+    uint32_t volatile       iDrain;
+    /** Number of submitted items which have not yet been written. */
+    uint32_t                cPending;
+    /** Number of items in the queued state. */
+    uint32_t volatile       cQueued;
+    /** The item being filled by the EMT, NULL if none. */
+    PSSMZIPITEM             pFill;
+    /** Event the workers wait on for work. */
+    RTSEMEVENT              hEvtWork;
+    /** Event signalled by the workers when an item is done. */
+    RTSEMEVENT              hEvtDone;
+    /** Number of compression blocks written. */
+    uint64_t                cBlocks;
+    /** Number of bytes the compression blocks were encoded into. */
+    uint64_t                cbBlocksOut;
+    /** Number of times the EMT had to wait for a worker. */
+    uint64_t                cStalls;
+    /** The worker threads. */
+    RTTHREAD                ahThreads[SSM_ZIP_MAX_THREADS];
+    /** The work items (variable size). */
+    PSSMZIPITEM             apItems[SSM_ZIP_MAX_THREADS * 2 + 2];
+} SSMZIP;
+/** Pointer to a compression pipeline. */
+typedef SSMZIP *PSSMZIP;
+
+
 /**
  * Handle structure.
  */
@@ -514,6 +658,10 @@ typedef struct SSMHANDLE
             uint8_t         abDataBuffer[4096];
             /** The maximum downtime given as milliseconds. */
             uint32_t        cMsMaxDowntime;
+            /** The compression codec (SSM_ZIP_CODEC_XXX). */
+            uint8_t         uZipCodec;
+            /** The compression pipeline, NULL if compressing on the EMT. */
+            PSSMZIP         pZip;
         } Write;
 
         /** Read data. */
@@ -893,6 +1041,7 @@ static int                  ssmR3StrmReadMore(PSSMSTRM pStrm);
 
 #ifndef SSM_STANDALONE
 static int                  ssmR3DataFlushBuffer(PSSMHANDLE pSSM);
+static int                  ssmR3DataFlushAll(PSSMHANDLE pSSM);
 #endif
 static int                  ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM);
 
@@ -914,6 +1063,53 @@ VMMR3_INT_DECL(void) SSMR3Term(PVM pVM)
 }
 
 
+/**
+ * Reads the compression configuration.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ */
+static int ssmR3ZipConfig(PVM pVM)
+{
+    PCFGMNODE pCfgSSM = CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM");
+
+    /** @cfgm{/SSM/Compression, string, "lzf"}
+     * The codec used for compressing the saved state data: "lzf", "zlib" or
+     * "none".  Saved states compressed with zlib cannot be loaded by VirtualBox
+     * versions predating this setting. */
+    char szCodec[16];
+    int rc = CFGMR3QueryStringDef(pCfgSSM, "Compression", szCodec, sizeof(szCodec), "lzf");
+    AssertLogRelRCReturn(rc, rc);
+    if (!RTStrICmp(szCodec, "lzf"))
+        pVM->ssm.s.uZipCodec = SSM_ZIP_CODEC_LZF;
+    else if (!RTStrICmp(szCodec, "zlib"))
+        pVM->ssm.s.uZipCodec = SSM_ZIP_CODEC_ZLIB;
+    else if (!RTStrICmp(szCodec, "none"))
+        pVM->ssm.s.uZipCodec = SSM_ZIP_CODEC_NONE;
+    else
+        return VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                          N_("Unknown /SSM/Compression value '%s', expected 'lzf', 'zlib' or 'none'"), szCodec);
+
+    /** @cfgm{/SSM/CompressionThreads, uint32_t, host CPUs - 1}
+     * The number of worker threads compressing the saved state data while
+     * the EMT carries on with the saving.  Zero means compressing on the EMT.
+     * The default is one less than the number of online host CPUs, capped at
+     * 16. */
+    RTCPUID cCpus = RTMpGetOnlineCount();
+    uint32_t cThreadsDef = RT_MIN(cCpus > 1 ? cCpus - 1 : 0, SSM_ZIP_MAX_THREADS);
+    uint32_t cThreads;
+    rc = CFGMR3QueryU32Def(pCfgSSM, "CompressionThreads", &cThreads, cThreadsDef);
+    AssertLogRelRCReturn(rc, rc);
+    if (cThreads > SSM_ZIP_MAX_THREADS)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          N_("/SSM/CompressionThreads is out of range: %u, max %u"), cThreads, SSM_ZIP_MAX_THREADS);
+    pVM->ssm.s.cZipThreads = cThreads;
+
+    LogRel(("SSM: Compression=%s CompressionThreads=%u\n", szCodec, cThreads));
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Performs lazy initialization of the SSM.
  *
@@ -937,6 +1133,12 @@ static int ssmR3LazyInit(PVM pVM)
                                    NULL /*pfnSavePrep*/, NULL /*pfnSaveExec*/,     NULL /*pfnSaveDone*/,
                                    NULL /*pfnSavePrep*/, ssmR3LiveControlLoadExec, NULL /*pfnSaveDone*/);
 
+    /*
+     * Get the compression settings.
+     */
+    if (RT_SUCCESS(rc))
+        rc = ssmR3ZipConfig(pVM);
+
     /*
      * Initialize the cancellation critsect now.
      */
@@ -945,6 +1147,12 @@ static int ssmR3LazyInit(PVM pVM)
     if (RT_SUCCESS(rc))
     {
         STAM_REL_REG_USED(pVM, &pVM->ssm.s.uPass, STAMTYPE_U32, "/SSM/uPass", STAMUNIT_COUNT, "Current pass");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBlocks,   STAMTYPE_COUNTER, "/SSM/Zip/Blocks",   STAMUNIT_OCCURENCES,
+                     "Compression blocks handed to the worker threads.");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBytesOut, STAMTYPE_COUNTER, "/SSM/Zip/BytesOut", STAMUNIT_BYTES,
+                     "Bytes the compression blocks were encoded into by the worker threads.");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipStalls,   STAMTYPE_COUNTER, "/SSM/Zip/Stalls",   STAMUNIT_OCCURENCES,
+                     "Times the EMT had to wait for a compression worker.");
     }
 
     pVM->ssm.s.fInitialized = RT_SUCCESS(rc);
@@ -3272,6 +3480,487 @@ DECLINLINE(bool) ssmR3IsHostMsc32(PSSMHANDLE pSSM)
 
 #ifndef SSM_STANDALONE
 
+/**
+ * Encodes one compression block as a data record.
+ *
+ * This is used both when compressing on the EMT and by the compression
+ * worker threads.
+ *
+ * @returns The size of the record.
+ * @param   uCodec          The codec, SSM_ZIP_CODEC_XXX.
+ * @param   pvBlock         The block, SSM_ZIP_BLOCK_SIZE bytes.
+ * @param   pbRec           Where to put the record.  This must have room for
+ *                          SSM_ZIP_BLOCK_REC_MAX_SIZE bytes.
+ */
+static size_t ssmR3ZipEncodeBlock(uint8_t uCodec, void const *pvBlock, uint8_t *pbRec)
+{
+    /*
+     * Zero block.
+     */
+    if (ASMMemIsZero(pvBlock, SSM_ZIP_BLOCK_SIZE))
+    {
+        pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
+        pbRec[1] = 1;
+        pbRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
+        return 3;
+    }
+
+    /*
+     * Compress it, falling back on a raw record if it doesn't pay off.
+     */
+    size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
+    int    rc    = VERR_NOT_SUPPORTED;
+    switch (uCodec)
+    {
+        case SSM_ZIP_CODEC_LZF:
+            rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
+                                    pvBlock, SSM_ZIP_BLOCK_SIZE,
+                                    pbRec + 1 + 3 + 1, cbRec, &cbRec);
+            if (RT_SUCCESS(rc))
+            {
+                pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
+                pbRec[4] = SSM_ZIP_BLOCK_SIZE / _1K;
+                cbRec += 1;
+            }
+            break;
+
+        case SSM_ZIP_CODEC_ZLIB:
+            rc = RTZipBlockCompress(RTZIPTYPE_ZLIB, RTZIPLEVEL_FAST, 0 /*fFlags*/,
+                                    pvBlock, SSM_ZIP_BLOCK_SIZE,
+                                    pbRec + 1 + 3 + 2, cbRec, &cbRec);
+            if (RT_SUCCESS(rc))
+            {
+                pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZIP;
+                pbRec[4] = SSM_ZIP_CODEC_ZLIB;
+                pbRec[5] = SSM_ZIP_BLOCK_SIZE / _1K;
+                cbRec += 2;
+            }
+            break;
+
+        default:
+            break;
+    }
+    if (RT_FAILURE(rc))
+    {
+        pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
+        memcpy(&pbRec[4], pvBlock, SSM_ZIP_BLOCK_SIZE);
+        cbRec = SSM_ZIP_BLOCK_SIZE;
+    }
+    pbRec[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
+    pbRec[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
+    pbRec[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
+    return cbRec + 1 + 3;
+}
+
+
+/**
+ * Encodes the content of a compression work item.
+ *
+ * @param   pZip            The compression pipeline.
+ * @param   pItem           The work item.
+ */
+static void ssmR3ZipProcessItem(PSSMZIP pZip, PSSMZIPITEM pItem)
+{
+    uint32_t offOut      = 0;
+    uint32_t cbBlocksOut = 0;
+    for (uint32_t i = 0; i < pItem->cChunks; i++)
+    {
+        SSMZIPCHUNK const *pChunk = &pItem->aChunks[i];
+        if (pChunk->fBlock)
+        {
+            size_t cbRec = ssmR3ZipEncodeBlock(pZip->uCodec, &pItem->abIn[pChunk->offIn], &pItem->abOut[offOut]);
+            offOut      += (uint32_t)cbRec;
+            cbBlocksOut += (uint32_t)cbRec;
+        }
+        else
+        {
+            memcpy(&pItem->abOut[offOut], &pItem->abIn[pChunk->offIn], pChunk->cbIn);
+            offOut += pChunk->cbIn;
+        }
+        Assert(offOut <= sizeof(pItem->abOut));
+    }
+    pItem->cbOut       = offOut;
+    pItem->cbBlocksOut = cbBlocksOut;
+}
+
+
+/**
+ * Tries to claim a queued work item and encode it.
+ *
+ * @returns true if an item was processed, false if nothing was queued.
+ * @param   pZip            The compression pipeline.
+ * @param   pItem           The work item to try.
+ */
+static bool ssmR3ZipTryProcessItem(PSSMZIP pZip, PSSMZIPITEM pItem)
+{
+    if (!ASMAtomicCmpXchgU32(&pItem->enmState, SSMZIPITEMSTATE_BUSY, SSMZIPITEMSTATE_QUEUED))
+        return false;
+
+    /* Wake up a sibling if there is more work queued. */
+    if (ASMAtomicDecU32(&pZip->cQueued) > 0)
+        RTSemEventSignal(pZip->hEvtWork);
+
+    ssmR3ZipProcessItem(pZip, pItem);
+
+    ASMAtomicWriteU32(&pItem->enmState, SSMZIPITEMSTATE_DONE);
+    RTSemEventSignal(pZip->hEvtDone);
+    return true;
+}
+
+
+/**
+ * Compression worker thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThread         The thread handle.
+ * @param   pvUser          The compression pipeline.
+ */
+static DECLCALLBACK(int) ssmR3ZipThread(RTTHREAD hThread, void *pvUser)
+{
+    PSSMZIP pZip = (PSSMZIP)pvUser;
+    RT_NOREF(hThread);
+
+    while (!ASMAtomicReadBool(&pZip->fTerminate))
+    {
+        /* Scan the items starting with the oldest so they complete roughly in order. */
+        bool           fFound = false;
+        uint32_t const cItems = pZip->cItems;
+        uint32_t       iItem  = ASMAtomicReadU32(&pZip->iDrain) % cItems;
+        for (uint32_t i = 0; i < cItems; i++, iItem = (iItem + 1) % cItems)
+            if (ssmR3ZipTryProcessItem(pZip, pZip->apItems[iItem]))
+                fFound = true;
+        if (!fFound)
+            RTSemEventWait(pZip->hEvtWork, RT_INDEFINITE_WAIT);
+    }
+
+    /* Pass on the termination signal. */
+    RTSemEventSignal(pZip->hEvtWork);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates the compression pipeline for a save operation.
+ *
+ * Failure is not fatal, the caller just compresses on the EMT then.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   cThreads        The number of worker threads.
+ */
+static int ssmR3ZipCreate(PSSMHANDLE pSSM, uint32_t cThreads)
+{
+    Assert(cThreads > 0 && cThreads <= SSM_ZIP_MAX_THREADS);
+    PSSMZIP pZip = (PSSMZIP)RTMemAllocZ(sizeof(*pZip));
+    if (!pZip)
+        return VERR_NO_MEMORY;
+    pZip->uCodec   = pSSM->u.Write.uZipCodec;
+    pZip->hEvtWork = NIL_RTSEMEVENT;
+    pZip->hEvtDone = NIL_RTSEMEVENT;
+    for (uint32_t i = 0; i < RT_ELEMENTS(pZip->ahThreads); i++)
+        pZip->ahThreads[i] = NIL_RTTHREAD;
+    pSSM->u.Write.pZip = pZip;
+
+    /* Two items per thread keeps the workers busy while the EMT fills the next one. */
+    int rc = VINF_SUCCESS;
+    pZip->cItems = cThreads * 2 + 2;
+    AssertCompile(RT_ELEMENTS(pZip->apItems) >= SSM_ZIP_MAX_THREADS * 2 + 2);
+    for (uint32_t i = 0; i < pZip->cItems && RT_SUCCESS(rc); i++)
+    {
+        pZip->apItems[i] = (PSSMZIPITEM)RTMemAlloc(sizeof(SSMZIPITEM));
+        if (pZip->apItems[i])
+            pZip->apItems[i]->enmState = SSMZIPITEMSTATE_FREE;
+        else
+            rc = VERR_NO_MEMORY;
+    }
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pZip->hEvtWork);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pZip->hEvtDone);
+    for (uint32_t i = 0; i < cThreads && RT_SUCCESS(rc); i++)
+    {
+        rc = RTThreadCreateF(&pZip->ahThreads[i], ssmR3ZipThread, pZip, 0, RTTHREADTYPE_DEFAULT,
+                             RTTHREADFLAGS_WAITABLE, "SSMZip%u", i);
+        if (RT_SUCCESS(rc))
+            pZip->cThreads++;
+    }
+    return rc;
+}
+
+
+/**
+ * Destroys the compression pipeline, discarding any pending data.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3ZipDestroy(PSSMHANDLE pSSM)
+{
+    PSSMZIP pZip = pSSM->u.Write.pZip;
+    if (!pZip)
+        return;
+    pSSM->u.Write.pZip = NULL;
+
+    if (pZip->cBlocks)
+        LogRel(("SSM: Compressed %'RU64 blocks into %'RU64 bytes using %u threads, the EMT waited %'RU64 times\n",
+                pZip->cBlocks, pZip->cbBlocksOut, pZip->cThreads, pZip->cStalls));
+
+    ASMAtomicWriteBool(&pZip->fTerminate, true);
+    if (pZip->hEvtWork != NIL_RTSEMEVENT)
+        RTSemEventSignal(pZip->hEvtWork);
+    for (uint32_t i = 0; i < pZip->cThreads; i++)
+    {
+        int rc = RTThreadWait(pZip->ahThreads[i], RT_MS_1MIN, NULL);
+        AssertLogRelRC(rc);
+    }
+    RTSemEventDestroy(pZip->hEvtWork);
+    RTSemEventDestroy(pZip->hEvtDone);
+    for (uint32_t i = 0; i < pZip->cItems; i++)
+        RTMemFree(pZip->apItems[i]);
+    RTMemFree(pZip);
+}
+
+
+/**
+ * Checks if the compression pipeline holds data not yet written to the
+ * stream.
+ *
+ * @returns true if data is pending, false if not.
+ * @param   pZip            The compression pipeline.  NULL is fine.
+ */
+DECLINLINE(bool) ssmR3ZipHasPending(PSSMZIP pZip)
+{
+    return pZip
+        && (pZip->cPending > 0 || pZip->pFill);
+}
+
+
+/**
+ * Writes the oldest submitted work item to the stream.
+ *
+ * @returns VBox status code, VINF_TRY_AGAIN if the item isn't done and @a fWait
+ *          is false.  Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pZip            The compression pipeline.
+ * @param   fWait           Whether to wait for the item to complete.
+ */
+static int ssmR3ZipWriteOldest(PSSMHANDLE pSSM, PSSMZIP pZip, bool fWait)
+{
+    Assert(pZip->cPending > 0);
+    PSSMZIPITEM pItem = pZip->apItems[pZip->iDrain];
+    if (ASMAtomicReadU32(&pItem->enmState) != SSMZIPITEMSTATE_DONE)
+    {
+        if (!fWait)
+            return VINF_TRY_AGAIN;
+
+        /* Rather than waiting idly, do the job ourselves if no worker has gotten to it yet. */
+        if (!ssmR3ZipTryProcessItem(pZip, pItem))
+        {
+            pZip->cStalls++;
+            STAM_REL_COUNTER_INC(&pSSM->pVM->ssm.s.StatZipStalls);
+            while (ASMAtomicReadU32(&pItem->enmState) != SSMZIPITEMSTATE_DONE)
+                RTSemEventWait(pZip->hEvtDone, RT_INDEFINITE_WAIT);
+        }
+    }
+
+    /*
+     * Write it and advance.
+     */
+    int rc = ssmR3StrmWrite(&pSSM->Strm, &pItem->abOut[0], pItem->cbOut);
+    pSSM->offUnit     += pItem->cbOut;
+    pZip->cBlocks     += pItem->cBlocks;
+    pZip->cbBlocksOut += pItem->cbBlocksOut;
+    STAM_REL_COUNTER_ADD(&pSSM->pVM->ssm.s.StatZipBlocks, pItem->cBlocks);
+    STAM_REL_COUNTER_ADD(&pSSM->pVM->ssm.s.StatZipBytesOut, pItem->cbBlocksOut);
+
+    ASMAtomicWriteU32(&pItem->enmState, SSMZIPITEMSTATE_FREE);
+    ASMAtomicWriteU32(&pZip->iDrain, (pZip->iDrain + 1) % pZip->cItems);
+    pZip->cPending--;
+
+    if (RT_FAILURE(rc) && RT_SUCCESS(pSSM->rc))
+        pSSM->rc = rc;
+    return rc;
+}
+
+
+/**
+ * Submits the work item being filled to the worker threads.
+ *
+ * Any completed items are written to the stream while at it.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pZip            The compression pipeline.
+ */
+static int ssmR3ZipSubmit(PSSMHANDLE pSSM, PSSMZIP pZip)
+{
+    PSSMZIPITEM pItem = pZip->pFill;
+    if (pItem)
+    {
+        pZip->pFill = NULL;
+        pZip->cPending++;
+        ASMAtomicIncU32(&pZip->cQueued);
+        ASMAtomicWriteU32(&pItem->enmState, SSMZIPITEMSTATE_QUEUED);
+        RTSemEventSignal(pZip->hEvtWork);
+    }
+
+    int rc = VINF_SUCCESS;
+    while (pZip->cPending > 0)
+    {
+        rc = ssmR3ZipWriteOldest(pSSM, pZip, false /*fWait*/);
+        if (rc != VINF_SUCCESS)
+            break;
+    }
+    return RT_FAILURE(rc) ? rc : VINF_SUCCESS;
+}
+
+
+/**
+ * Gets the work item to fill, starting a new one if necessary.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pZip            The compression pipeline.
+ * @param   ppItem          Where to return the item.
+ */
+static int ssmR3ZipGetFillItem(PSSMHANDLE pSSM, PSSMZIP pZip, PSSMZIPITEM *ppItem)
+{
+    PSSMZIPITEM pItem = pZip->pFill;
+    if (!pItem)
+    {
+        /* The items are used in ring order, so we may have to wait for the oldest one. */
+        if (pZip->cPending >= pZip->cItems)
+        {
+            int rc = ssmR3ZipWriteOldest(pSSM, pZip, true /*fWait*/);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+        pItem = pZip->apItems[(pZip->iDrain + pZip->cPending) % pZip->cItems];
+        Assert(pItem->enmState == SSMZIPITEMSTATE_FREE);
+        pItem->enmState    = SSMZIPITEMSTATE_FILLING;
+        pItem->cChunks     = 0;
+        pItem->cBlocks     = 0;
+        pItem->cbIn        = 0;
+        pItem->cbOut       = 0;
+        pItem->cbBlocksOut = 0;
+        pZip->pFill        = pItem;
+    }
+    *ppItem = pItem;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues ready made record bytes in the compression pipeline.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBuf           The bytes.
+ * @param   cbBuf           The number of bytes.
+ */
+static int ssmR3ZipQueueRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
+{
+    PSSMZIP pZip = pSSM->u.Write.pZip;
+    while (cbBuf > 0)
+    {
+        PSSMZIPITEM pItem;
+        int rc = ssmR3ZipGetFillItem(pSSM, pZip, &pItem);
+        if (RT_FAILURE(rc))
+            return rc;
+
+        /* Extend the previous chunk if it's raw, otherwise start a new one. */
+        SSMZIPCHUNK *pChunk = pItem->cChunks ? &pItem->aChunks[pItem->cChunks - 1] : NULL;
+        if (!pChunk || pChunk->fBlock)
+        {
+            if (   pItem->cChunks >= RT_ELEMENTS(pItem->aChunks)
+                || pItem->cbIn >= sizeof(pItem->abIn))
+            {
+                rc = ssmR3ZipSubmit(pSSM, pZip);
+                if (RT_FAILURE(rc))
+                    return rc;
+                continue;
+            }
+            pChunk = &pItem->aChunks[pItem->cChunks++];
+            pChunk->offIn  = pItem->cbIn;
+            pChunk->cbIn   = 0;
+            pChunk->fBlock = false;
+        }
+        else if (pItem->cbIn >= sizeof(pItem->abIn))
+        {
+            rc = ssmR3ZipSubmit(pSSM, pZip);
+            if (RT_FAILURE(rc))
+                return rc;
+            continue;
+        }
+
+        size_t cbChunk = RT_MIN(cbBuf, sizeof(pItem->abIn) - pItem->cbIn);
+        memcpy(&pItem->abIn[pItem->cbIn], pvBuf, cbChunk);
+        pItem->cbIn   += (uint32_t)cbChunk;
+        pChunk->cbIn  += (uint32_t)cbChunk;
+        pvBuf          = (uint8_t const *)pvBuf + cbChunk;
+        cbBuf         -= cbChunk;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues a compression block in the compression pipeline.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBlock         The block, SSM_ZIP_BLOCK_SIZE bytes.
+ */
+static int ssmR3ZipQueueBlock(PSSMHANDLE pSSM, const void *pvBlock)
+{
+    PSSMZIP     pZip = pSSM->u.Write.pZip;
+    PSSMZIPITEM pItem;
+    int rc = ssmR3ZipGetFillItem(pSSM, pZip, &pItem);
+    if (    RT_SUCCESS(rc)
+        &&  (   pItem->cChunks >= RT_ELEMENTS(pItem->aChunks)
+             || pItem->cbIn + SSM_ZIP_BLOCK_SIZE > sizeof(pItem->abIn)))
+    {
+        rc = ssmR3ZipSubmit(pSSM, pZip);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3ZipGetFillItem(pSSM, pZip, &pItem);
+    }
+    if (RT_FAILURE(rc))
+        return rc;
+
+    SSMZIPCHUNK *pChunk = &pItem->aChunks[pItem->cChunks++];
+    pChunk->offIn  = pItem->cbIn;
+    pChunk->cbIn   = SSM_ZIP_BLOCK_SIZE;
+    pChunk->fBlock = true;
+    memcpy(&pItem->abIn[pItem->cbIn], pvBlock, SSM_ZIP_BLOCK_SIZE);
+    pItem->cbIn   += SSM_ZIP_BLOCK_SIZE;
+
+    /* Get the workers going as soon as there is a decent amount of work. */
+    if (++pItem->cBlocks >= SSM_ZIP_ITEM_BLOCKS)
+        rc = ssmR3ZipSubmit(pSSM, pZip);
+    return rc;
+}
+
+
+/**
+ * Writes everything in the compression pipeline to the stream.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3ZipFlush(PSSMHANDLE pSSM)
+{
+    PSSMZIP pZip = pSSM->u.Write.pZip;
+    if (!ssmR3ZipHasPending(pZip))
+        return pSSM->rc;
+    if (RT_FAILURE(pSSM->rc))
+        return pSSM->rc;
+
+    int rc = ssmR3ZipSubmit(pSSM, pZip);
+    while (pZip->cPending > 0 && RT_SUCCESS(rc))
+        rc = ssmR3ZipWriteOldest(pSSM, pZip, true /*fWait*/);
+    return rc;
+}
+
+
 /**
  * Finishes a data unit.
  * All buffers and compressor instances are flushed and destroyed.
@@ -3282,7 +3971,7 @@ DECLINLINE(bool) ssmR3IsHostMsc32(PSSMHANDLE pSSM)
 static int ssmR3DataWriteFinish(PSSMHANDLE pSSM)
 {
     //Log2(("ssmR3DataWriteFinish: %#010llx start\n", ssmR3StrmTell(&pSSM->Strm)));
-    int rc = ssmR3DataFlushBuffer(pSSM);
+    int rc = ssmR3DataFlushAll(pSSM);
     if (RT_SUCCESS(rc))
     {
         pSSM->offUnit     = UINT64_MAX;
@@ -3330,6 +4019,12 @@ static int ssmR3DataWriteRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
     if (RT_FAILURE(pSSM->rc))
         return pSSM->rc;
 
+    /*
+     * Keep the order if there are blocks being compressed by the workers.
+     */
+    if (ssmR3ZipHasPending(pSSM->u.Write.pZip))
+        return ssmR3ZipQueueRaw(pSSM, pvBuf, cbBuf);
+
     /*
      * Write the data item in 1MB chunks for progress indicator reasons.
      */
@@ -3445,6 +4140,24 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Flushes the buffered data and the compression pipeline.
+ *
+ * This must be called before anything depending on the stream position or
+ * the stream CRC, like the termination record.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataFlushAll(PSSMHANDLE pSSM)
+{
+    int rc = ssmR3DataFlushBuffer(pSSM);
+    if (RT_SUCCESS(rc))
+        rc = ssmR3ZipFlush(pSSM);
+    return rc;
+}
+
+
 /**
  * ssmR3DataWrite worker that writes big stuff.
  *
@@ -3461,49 +4174,29 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
         pSSM->offUnitUser += cbBuf;
 
         /*
-         * Split it up into compression blocks.
+         * Split it up into compression blocks and hand them to the workers, or
+         * compress them right here if there aren't any.
          */
         for (;;)
         {
-            AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
-            if (    cbBuf >= SSM_ZIP_BLOCK_SIZE
-                && (    ((uintptr_t)pvBuf & 0xf)
-                    ||  !ASMMemIsZeroPage(pvBuf))
-               )
+            if (cbBuf >= SSM_ZIP_BLOCK_SIZE)
             {
-                /*
-                 * Compress it.
-                 */
-                AssertCompile(1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE < 0x00010000);
-                uint8_t *pb;
-                rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, 1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE, &pb);
-                if (RT_FAILURE(rc))
-                    break;
-                size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
-                rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
-                                        pvBuf, SSM_ZIP_BLOCK_SIZE,
-                                        pb + 1 + 3 + 1, cbRec, &cbRec);
-                if (RT_SUCCESS(rc))
-                {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
-                    pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
-                    cbRec += 1;
-                }
+                if (pSSM->u.Write.pZip)
+                    rc = ssmR3ZipQueueBlock(pSSM, pvBuf);
                 else
                 {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
-                    memcpy(&pb[4], pvBuf, SSM_ZIP_BLOCK_SIZE);
-                    cbRec = SSM_ZIP_BLOCK_SIZE;
+                    uint8_t *pb;
+                    rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, SSM_ZIP_BLOCK_REC_MAX_SIZE, &pb);
+                    if (RT_FAILURE(rc))
+                        break;
+                    size_t cbRec = ssmR3ZipEncodeBlock(pSSM->u.Write.uZipCodec, pvBuf, pb);
+                    Log3(("ssmR3DataWriteBig: %08llx|%08llx: Type=%02x cbRec=%#x\n",
+                          ssmR3StrmTell(&pSSM->Strm), pSSM->offUnit, pb[0] & SSM_REC_TYPE_MASK, cbRec));
+                    rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
+                    pSSM->offUnit += cbRec;
                 }
-                pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
-                pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
-                pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
-                cbRec += 1 + 3;
-                rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
                 if (RT_FAILURE(rc))
                     break;
-
-                pSSM->offUnit += cbRec;
                 ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
 
                 /* advance */
@@ -3512,27 +4205,6 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                 cbBuf -= SSM_ZIP_BLOCK_SIZE;
                 pvBuf = (uint8_t const*)pvBuf + SSM_ZIP_BLOCK_SIZE;
             }
-            else if (cbBuf >= SSM_ZIP_BLOCK_SIZE)
-            {
-                /*
-                 * Zero block.
-                 */
-                uint8_t abRec[3];
-                abRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
-                abRec[1] = 1;
-                abRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
-                Log3(("ssmR3DataWriteBig: %08llx|%08llx/%08x: ZERO\n", ssmR3StrmTell(&pSSM->Strm) + 2, pSSM->offUnit + 2, 1));
-                rc = ssmR3DataWriteRaw(pSSM, &abRec[0], sizeof(abRec));
-                if (RT_FAILURE(rc))
-                    break;
-
-                /* advance */
-                ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
-                if (cbBuf == SSM_ZIP_BLOCK_SIZE)
-                    return VINF_SUCCESS;
-                cbBuf -= SSM_ZIP_BLOCK_SIZE;
-                pvBuf = (uint8_t const*)pvBuf + SSM_ZIP_BLOCK_SIZE;
-            }
             else
             {
                 /*
@@ -4434,7 +5106,7 @@ static int ssmR3LiveControlEmit(PSSMHANDLE pSSM, long double lrdPct, uint32_t uP
         AssertMsg(u16PartsPerTenThousand <= 10000, ("%u\n", u16PartsPerTenThousand));
         ssmR3DataWrite(pSSM, &u16PartsPerTenThousand, sizeof(u16PartsPerTenThousand));
 
-        rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+        rc = ssmR3DataFlushAll(pSSM); /* will return SSMHANDLE::rc if it is set */
         if (RT_SUCCESS(rc))
         {
             /*
@@ -4583,6 +5255,7 @@ static int ssmR3SaveDoClose(PVM pVM, PSSMHANDLE pSSM)
      * Make it non-cancellable, close the stream and delete the file on failure.
      */
     ssmR3SetCancellable(pVM, pSSM, false);
+    ssmR3ZipDestroy(pSSM);
     int rc = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
     if (RT_SUCCESS(rc))
         rc = pSSM->rc;
@@ -4909,7 +5582,7 @@ static int ssmR3SaveDoExecRun(PVM pVM, PSSMHANDLE pSSM)
         if (RT_FAILURE(rc) && RT_SUCCESS_NP(pSSM->rc))
             pSSM->rc = rc;
         else
-            rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+            rc = ssmR3DataFlushAll(pSSM); /* will return SSMHANDLE::rc if it is set */
         if (RT_FAILURE(rc))
         {
             LogRel(("SSM: Execute save failed with rc=%Rrc for data unit '%s'/#%u.\n", rc, pUnit->szName, pUnit->u32Instance));
@@ -5116,6 +5789,8 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
     FileHdr.fFlags       = SSMFILEHDR_FLAGS_STREAM_CRC32;
     if (pSSM->fLiveSave)
         FileHdr.fFlags  |= SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE;
+    if (pSSM->u.Write.uZipCodec == SSM_ZIP_CODEC_ZLIB)
+        FileHdr.fFlags  |= SSMFILEHDR_FLAGS_STREAM_RAW_ZIP;
     FileHdr.cbMaxDecompr = RT_SIZEOFMEMB(SSMHANDLE, u.Read.abDataBuffer);
     FileHdr.u32CRC       = 0;
     FileHdr.u32CRC       = RTCrc32(&FileHdr, sizeof(FileHdr));
@@ -5183,6 +5858,8 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
     pSSM->pszFilename               = pszFilename;
     pSSM->u.Write.offDataBuffer     = 0;
     pSSM->u.Write.cMsMaxDowntime    = UINT32_MAX;
+    pSSM->u.Write.uZipCodec         = pVM->ssm.s.uZipCodec;
+    pSSM->u.Write.pZip              = NULL;
 
     int rc;
     if (pStreamOps)
@@ -5196,6 +5873,20 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
         return rc;
     }
 
+    /*
+     * Start the compression workers.  We can do without them if this fails.
+     */
+    if (   pVM->ssm.s.cZipThreads > 0
+        && pSSM->u.Write.uZipCodec != SSM_ZIP_CODEC_NONE)
+    {
+        rc = ssmR3ZipCreate(pSSM, pVM->ssm.s.cZipThreads);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("SSM: Failed to start %u compression threads, compressing on the EMT: %Rrc\n", pVM->ssm.s.cZipThreads, rc));
+            ssmR3ZipDestroy(pSSM);
+        }
+    }
+
     *ppSSM = pSSM;
     return VINF_SUCCESS;
 }
@@ -5493,7 +6184,7 @@ static int ssmR3LiveDoExecRun(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
         {
             if (rc == VINF_SSM_DONT_CALL_AGAIN)
                 pUnit->fDoneLive = true;
-            rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+            rc = ssmR3DataFlushAll(pSSM); /* will return SSMHANDLE::rc if it is set */
         }
         if (RT_FAILURE(rc))
         {
@@ -5801,6 +6492,7 @@ VMMR3_INT_DECL(int) SSMR3LiveSave(PVM pVM, uint32_t cMsMaxDowntime,
         return VINF_SUCCESS;
     }
     /* bail out. */
+    ssmR3ZipDestroy(pSSM);
     int rc2 = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
     RTMemFree(pSSM);
     rc2 = RTFileDelete(pszFilename);
@@ -6048,15 +6740,48 @@ DECLINLINE(int) ssmR3DataReadV2RawLzfHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
 
 
 /**
- * Reads an LZF block from the stream and decompresses into the specified
- * buffer.
+ * Reads and checks the "header" of a SSM_REC_TYPE_RAW_ZIP record.
+ *
+ * @returns VBox status code. Sets pSSM->rc on error.
+ * @param   pSSM            The saved state handle..
+ * @param   pcbDecompr      Where to store the size of the decompressed data.
+ * @param   penmZipType     Where to store the compression type.
+ */
+static int ssmR3DataReadV2RawZipHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr, RTZIPTYPE *penmZipType)
+{
+    *pcbDecompr  = 0; /* shuts up gcc. */
+    *penmZipType = RTZIPTYPE_INVALID;
+    AssertLogRelMsgReturn(pSSM->u.Read.cbRecLeft > 2, ("%#x\n", pSSM->u.Read.cbRecLeft),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+    uint8_t uCodec;
+    int rc = ssmR3DataReadV2Raw(pSSM, &uCodec, 1);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    pSSM->u.Read.cbRecLeft -= sizeof(uCodec);
+    switch (uCodec)
+    {
+        case SSM_ZIP_CODEC_LZF:     *penmZipType = RTZIPTYPE_LZF; break;
+        case SSM_ZIP_CODEC_ZLIB:    *penmZipType = RTZIPTYPE_ZLIB; break;
+        default:
+            AssertLogRelMsgFailedReturn(("Unknown codec %#x\n", uCodec), pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+    }
+
+    return ssmR3DataReadV2RawLzfHdr(pSSM, pcbDecompr);
+}
+
+
+/**
+ * Reads a compressed block from the stream and decompresses into the
+ * specified buffer.
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   pSSM            The saved state handle.
+ * @param   enmZipType      The compression type.
  * @param   pvDst           Pointer to the output buffer.
  * @param   cbDecompr       The size of the decompressed data.
  */
-static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
+static int ssmR3DataReadV2RawZip(PSSMHANDLE pSSM, RTZIPTYPE enmZipType, void *pvDst, size_t cbDecompr)
 {
     int         rc;
     uint32_t    cbCompr    = pSSM->u.Read.cbRecLeft;
@@ -6083,7 +6808,7 @@ static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
      * Decompress it.
      */
     size_t cbDstActual;
-    rc = RTZipBlockDecompress(RTZIPTYPE_LZF, 0 /*fFlags*/,
+    rc = RTZipBlockDecompress(enmZipType, 0 /*fFlags*/,
                               pb, cbCompr, NULL /*pcbSrcActual*/,
                               pvDst, cbDecompr, &cbDstActual);
     if (RT_SUCCESS(rc))
@@ -6360,20 +7085,24 @@ static int ssmR3DataReadUnbufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_ZIP:
             {
-                int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
+                RTZIPTYPE enmZipType = RTZIPTYPE_LZF;
+                int rc = (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_LZF
+                       ? ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead)
+                       : ssmR3DataReadV2RawZipHdr(pSSM, &cbToRead, &enmZipType);
                 if (RT_FAILURE(rc))
                     return rc;
                 if (cbToRead <= cbBuf)
                 {
-                    rc = ssmR3DataReadV2RawLzf(pSSM, pvBuf, cbToRead);
+                    rc = ssmR3DataReadV2RawZip(pSSM, enmZipType, pvBuf, cbToRead);
                     if (RT_FAILURE(rc))
                         return rc;
                 }
                 else
                 {
                     /* The output buffer is too small, use the data buffer. */
-                    rc = ssmR3DataReadV2RawLzf(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                    rc = ssmR3DataReadV2RawZip(pSSM, enmZipType, &pSSM->u.Read.abDataBuffer[0], cbToRead);
                     if (RT_FAILURE(rc))
                         return rc;
                     pSSM->u.Read.cbDataBuffer  = cbToRead;
@@ -6483,11 +7212,15 @@ static int ssmR3DataReadBufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_ZIP:
             {
-                int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
+                RTZIPTYPE enmZipType = RTZIPTYPE_LZF;
+                int rc = (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_LZF
+                       ? ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead)
+                       : ssmR3DataReadV2RawZipHdr(pSSM, &cbToRead, &enmZipType);
                 if (RT_FAILURE(rc))
                     return rc;
-                rc = ssmR3DataReadV2RawLzf(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                rc = ssmR3DataReadV2RawZip(pSSM, enmZipType, &pSSM->u.Read.abDataBuffer[0], cbToRead);
                 if (RT_FAILURE(rc))
                     return rc;
                 pSSM->u.Read.cbDataBuffer = cbToRead;
@@ -7819,7 +8552,7 @@ static int ssmR3HeaderAndValidate(PSSMHANDLE pSSM, bool fChecksumIt, bool fCheck
                 LogRel(("SSM: Reserved header field isn't zero: %02x\n", uHdr.v2_0.u8Reserved));
                 return VERR_SSM_INTEGRITY;
             }
-            if (uHdr.v2_0.fFlags & ~(SSMFILEHDR_FLAGS_STREAM_CRC32 | SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE))
+            if (uHdr.v2_0.fFlags & ~(SSMFILEHDR_FLAGS_STREAM_CRC32 | SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE | SSMFILEHDR_FLAGS_STREAM_RAW_ZIP))
             {
                 LogRel(("SSM: Unknown header flags: %08x\n", uHdr.v2_0.fFlags));
                 return VERR_SSM_INTEGRITY;
@@ -9632,6 +10365,19 @@ VMMR3DECL(const char *) SSMR3HandleHostOSAndArch(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Gets the name of the saved state file being written or read.
+ *
+ * @returns Pointer to a read only string, NULL if the saved state is a stream
+ *          (teleportation and similar).
+ * @param   pSSM            The saved state handle.
+ */
+VMMR3DECL(const char *) SSMR3HandleFilename(PSSMHANDLE pSSM)
+{
+    return pSSM->pszFilename;
+}
+
+
 #ifndef SSM_STANDALONE
 /**
  * Asynchronously cancels the current SSM operation ASAP.
@@ -147,6 +147,9 @@ static int                  stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3
                                             PFNSTAMR3CALLBACKPRINT pfnPrint, STAMTYPE enmType, STAMVISIBILITY enmVisibility,
                                             const char *pszName, STAMUNIT enmUnit, const char *pszDesc, uint8_t iRefreshGrp);
 static int                  stamR3ResetOne(PSTAMDESC pDesc, void *pvArg);
+static uint64_t             stamR3HistogramBucketMax(unsigned iBucket);
+static void                 stamR3HistogramPercentiles(PCSTAMHISTOGRAM pHistogram, uint32_t const *pauPerMyriads,
+                                                       unsigned cPercentiles, uint64_t *pauPercentiles);
 static DECLCALLBACK(void)   stamR3EnumLogPrintf(PSTAMR3PRINTONEARGS pvArg, const char *pszFormat, ...);
 static DECLCALLBACK(void)   stamR3EnumRelLogPrintf(PSTAMR3PRINTONEARGS pvArg, const char *pszFormat, ...);
 static DECLCALLBACK(void)   stamR3EnumPrintf(PSTAMR3PRINTONEARGS pvArg, const char *pszFormat, ...);
@@ -242,6 +245,8 @@ static const STAMR0SAMPLE g_aGMMStats[] =
     { RT_UOFFSETOF(GMMSTATS, cChunks),                          STAMTYPE_U32,   STAMUNIT_COUNT, "/GMM/cChunks",                     "The number of allocation chunks." },
     { RT_UOFFSETOF(GMMSTATS, cFreedChunks),                     STAMTYPE_U32,   STAMUNIT_COUNT, "/GMM/cFreedChunks",                "The number of freed chunks ever." },
     { RT_UOFFSETOF(GMMSTATS, cShareableModules),                STAMTYPE_U32,   STAMUNIT_COUNT, "/GMM/cShareableModules",           "The number of shareable modules." },
+    { RT_UOFFSETOF(GMMSTATS, cDedupEntries),                    STAMTYPE_U64,   STAMUNIT_COUNT, "/GMM/Dedup/cEntries",              "The number of entries in the content deduplication index." },
+    { RT_UOFFSETOF(GMMSTATS, cDedupMergedPages),                STAMTYPE_U64,   STAMUNIT_PAGES, "/GMM/Dedup/cMergedPages",          "The number of private pages freed by content deduplication merges." },
     { RT_UOFFSETOF(GMMSTATS, VMStats.Reserved.cBasePages),      STAMTYPE_U64,   STAMUNIT_PAGES, "/GMM/VM/Reserved/cBasePages",      "The amount of base memory (RAM, ROM, ++) reserved by the VM." },
     { RT_UOFFSETOF(GMMSTATS, VMStats.Reserved.cShadowPages),    STAMTYPE_U32,   STAMUNIT_PAGES, "/GMM/VM/Reserved/cShadowPages",    "The amount of memory reserved for shadow/nested page tables." },
     { RT_UOFFSETOF(GMMSTATS, VMStats.Reserved.cFixedPages),     STAMTYPE_U32,   STAMUNIT_PAGES, "/GMM/VM/Reserved/cFixedPages",     "The amount of memory reserved for fixed allocations like MMIO2 and the hyper heap." },
@@ -264,6 +269,13 @@ static const STAMR0SAMPLE g_aGMMStats[] =
 };
 
 
+/**
+ * The percentiles reported for STAMTYPE_HISTOGRAM samples, in 1/100 of a
+ * percent: p50, p90, p99 and p99.9.
+ */
+static const uint32_t g_auStamHistogramPerMyriads[] = { 5000, 9000, 9900, 9990 };
+
+
 /**
  * Initializes the STAM.
  *
@@ -342,6 +354,11 @@ VMMR3DECL(int) STAMR3InitUVM(PUVM pUVM)
  */
 VMMR3DECL(void) STAMR3TermUVM(PUVM pUVM)
 {
+    /*
+     * Stop the shared memory export (normally done by vmR3Destroy already).
+     */
+    STAMR3ExportStop(pUVM);
+
     /*
      * Free used memory and the RWLock.
      */
@@ -1416,6 +1433,7 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
         case STAMTYPE_COUNTER:
         case STAMTYPE_PROFILE:
         case STAMTYPE_PROFILE_ADV:
+        case STAMTYPE_HISTOGRAM:
             AssertMsg(!((uintptr_t)pvSample & 7), ("%p - %s\n", pvSample, pszName));
             break;
 
@@ -1490,6 +1508,7 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
 #endif
 
         stamR3ResetOne(pNew, pUVM->pVM);
+        pUVM->stam.s.cGeneration++;
         rc = VINF_SUCCESS;
     }
     else
@@ -1504,10 +1523,12 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
  * Destroys the statistics descriptor, unlinking it and freeing all resources.
  *
  * @returns VINF_SUCCESS
+ * @param   pUVM        Pointer to the user mode VM structure.
  * @param   pCur        The descriptor to destroy.
  */
-static int stamR3DestroyDesc(PSTAMDESC pCur)
+static int stamR3DestroyDesc(PUVM pUVM, PSTAMDESC pCur)
 {
+    pUVM->stam.s.cGeneration++;
     RTListNodeRemove(&pCur->ListEntry);
 #ifdef STAM_WITH_LOOKUP_TREE
     pCur->pLookup->pDesc = NULL; /** @todo free lookup nodes once it's working. */
@@ -1550,7 +1571,7 @@ VMMR3DECL(int)  STAMR3DeregisterByAddr(PUVM pUVM, void *pvSample)
     RTListForEachSafe(&pUVM->stam.s.List, pCur, pNext, STAMDESC, ListEntry)
     {
         if (pCur->u.pv == pvSample)
-            rc = stamR3DestroyDesc(pCur);
+            rc = stamR3DestroyDesc(pUVM, pCur);
     }
 
     STAM_UNLOCK_WR(pUVM);
@@ -1583,7 +1604,7 @@ static int stamR3DeregisterByPattern(PUVM pUVM, const char *pszPat)
             PSTAMDESC pNext = RTListNodeGetNext(&pCur->ListEntry, STAMDESC, ListEntry);
 
             if (RTStrSimplePatternMatch(pszPat, pCur->pszName))
-                rc = stamR3DestroyDesc(pCur);
+                rc = stamR3DestroyDesc(pUVM, pCur);
 
             /* advance. */
             if (pCur == pLast)
@@ -1782,6 +1803,15 @@ static int stamR3ResetOne(PSTAMDESC pDesc, void *pvArg)
             ASMAtomicXchgU64(&pDesc->u.pProfile->cTicksMin, UINT64_MAX);
             break;
 
+        case STAMTYPE_HISTOGRAM:
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->Core.cPeriods, 0);
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->Core.cTicks, 0);
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->Core.cTicksMax, 0);
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->Core.cTicksMin, UINT64_MAX);
+            for (unsigned i = 0; i < RT_ELEMENTS(pDesc->u.pHistogram->acBuckets); i++)
+                ASMAtomicXchgU64(&pDesc->u.pHistogram->acBuckets[i], 0);
+            break;
+
         case STAMTYPE_RATIO_U32_RESET:
             ASMAtomicXchgU32(&pDesc->u.pRatioU32->u32A, 0);
             ASMAtomicXchgU32(&pDesc->u.pRatioU32->u32B, 0);
@@ -1838,6 +1868,86 @@ static int stamR3ResetOne(PSTAMDESC pDesc, void *pvArg)
 }
 
 
+/**
+ * Gets the largest value counted by a histogram bucket.
+ *
+ * @returns Upper bound (inclusive) of the bucket.
+ * @param   iBucket     The bucket index.
+ */
+static uint64_t stamR3HistogramBucketMax(unsigned iBucket)
+{
+    Assert(iBucket < STAMHISTOGRAM_BUCKETS);
+    if (iBucket < STAMHISTOGRAM_SUB_BUCKETS)
+        return iBucket;
+    unsigned const iShift = (iBucket >> STAMHISTOGRAM_SUB_BITS) - 1;
+    uint64_t const uFirst = (uint64_t)(STAMHISTOGRAM_SUB_BUCKETS + (iBucket & (STAMHISTOGRAM_SUB_BUCKETS - 1))) << iShift;
+    return uFirst + (RT_BIT_64(iShift) - 1);
+}
+
+
+/**
+ * Calculates percentiles of a histogram.
+ *
+ * The result is the upper bound of the bucket the percentile falls into,
+ * capped by the max value.  The buckets are read without any locking, so the
+ * result is only as consistent as the histogram is while being updated.
+ *
+ * @param   pHistogram      The histogram.
+ * @param   pauPerMyriads   The percentiles to calculate in 1/100 of a percent,
+ *                          in ascending order.
+ * @param   cPercentiles    The number of percentiles.
+ * @param   pauPercentiles  Where to return the percentiles.
+ */
+static void stamR3HistogramPercentiles(PCSTAMHISTOGRAM pHistogram, uint32_t const *pauPerMyriads,
+                                       unsigned cPercentiles, uint64_t *pauPercentiles)
+{
+    uint64_t acBuckets[STAMHISTOGRAM_BUCKETS];
+    uint64_t cTotal = 0;
+    for (unsigned iBucket = 0; iBucket < STAMHISTOGRAM_BUCKETS; iBucket++)
+    {
+        acBuckets[iBucket] = pHistogram->acBuckets[iBucket];
+        cTotal += acBuckets[iBucket];
+    }
+
+    uint64_t const uMax = pHistogram->Core.cTicksMax;
+    uint64_t       cSeen = 0;
+    unsigned       iBucket = 0;
+    for (unsigned i = 0; i < cPercentiles; i++)
+    {
+        if (!cTotal)
+        {
+            pauPercentiles[i] = 0;
+            continue;
+        }
+
+        /* The rank of the value we're after, rounding up. */
+        uint64_t const cRank = RT_MAX((cTotal * pauPerMyriads[i] + 9999) / 10000, 1);
+        while (cSeen + acBuckets[iBucket] < cRank && iBucket < STAMHISTOGRAM_BUCKETS - 1)
+            cSeen += acBuckets[iBucket++];
+        pauPercentiles[i] = RT_MIN(stamR3HistogramBucketMax(iBucket), uMax);
+    }
+}
+
+
+/**
+ * Calculates a percentile of a histogram.
+ *
+ * @returns The upper bound of the bucket the percentile falls into, capped by
+ *          the max value.  0 if the histogram is empty.
+ * @param   pHistogram      The histogram.
+ * @param   uPerMyriad      The percentile in 1/100 of a percent, e.g. 9900 for
+ *                          the 99th percentile.
+ */
+VMMR3_INT_DECL(uint64_t) STAMR3HistogramPercentile(PCSTAMHISTOGRAM pHistogram, uint32_t uPerMyriad)
+{
+    AssertPtrReturn(pHistogram, 0);
+    AssertReturn(uPerMyriad <= 10000, 0);
+    uint64_t uPercentile;
+    stamR3HistogramPercentiles(pHistogram, &uPerMyriad, 1, &uPercentile);
+    return uPercentile;
+}
+
+
 /**
  * Get a snapshot of the statistics.
  * It's possible to select a subset of the samples.
@@ -1920,6 +2030,32 @@ static int stamR3SnapshotOne(PSTAMDESC pDesc, void *pvArg)
                                  pDesc->u.pProfile->cTicksMax);
             break;
 
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMHISTOGRAM pHistogram = pDesc->u.pHistogram;
+            if (pDesc->enmVisibility == STAMVISIBILITY_USED && pHistogram->Core.cPeriods == 0)
+                return VINF_SUCCESS;
+            uint64_t auPercentiles[RT_ELEMENTS(g_auStamHistogramPerMyriads)];
+            stamR3HistogramPercentiles(pHistogram, g_auStamHistogramPerMyriads, RT_ELEMENTS(auPercentiles), auPercentiles);
+            stamR3SnapshotPrintf(pThis, "<Histogram cPeriods=\"%lld\" cTicks=\"%lld\" cTicksMin=\"%lld\" cTicksMax=\"%lld\""
+                                 " p50=\"%lld\" p90=\"%lld\" p99=\"%lld\" p999=\"%lld\" buckets=\"",
+                                 pHistogram->Core.cPeriods, pHistogram->Core.cTicks, pHistogram->Core.cTicksMin,
+                                 pHistogram->Core.cTicksMax, auPercentiles[0], auPercentiles[1], auPercentiles[2], auPercentiles[3]);
+            /* The non-empty buckets as 'upper-bound:count' pairs. */
+            const char *pszSep = "";
+            for (unsigned iBucket = 0; iBucket < RT_ELEMENTS(pHistogram->acBuckets); iBucket++)
+            {
+                uint64_t const cHits = pHistogram->acBuckets[iBucket];
+                if (cHits)
+                {
+                    stamR3SnapshotPrintf(pThis, "%s%llu:%llu", pszSep, stamR3HistogramBucketMax(iBucket), cHits);
+                    pszSep = " ";
+                }
+            }
+            stamR3SnapshotPrintf(pThis, "\"");
+            break;
+        }
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             if (pDesc->enmVisibility == STAMVISIBILITY_USED && !pDesc->u.pRatioU32->u32A && !pDesc->u.pRatioU32->u32B)
@@ -2300,6 +2436,22 @@ static int stamR3PrintOne(PSTAMDESC pDesc, void *pvArg)
             break;
         }
 
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMHISTOGRAM pHistogram = pDesc->u.pHistogram;
+            if (pDesc->enmVisibility == STAMVISIBILITY_USED && pHistogram->Core.cPeriods == 0)
+                return VINF_SUCCESS;
+
+            uint64_t auPercentiles[RT_ELEMENTS(g_auStamHistogramPerMyriads)];
+            stamR3HistogramPercentiles(pHistogram, g_auStamHistogramPerMyriads, RT_ELEMENTS(auPercentiles), auPercentiles);
+            uint64_t u64 = pHistogram->Core.cPeriods ? pHistogram->Core.cPeriods : 1;
+            pArgs->pfnPrintf(pArgs, "%-32s %8llu %s (%7llu times, p50 %7llu, p90 %7llu, p99 %9llu, p99.9 %9llu, max %9llu)\n",
+                             pDesc->pszName, pHistogram->Core.cTicks / u64, STAMR3GetUnit(pDesc->enmUnit),
+                             pHistogram->Core.cPeriods, auPercentiles[0], auPercentiles[1], auPercentiles[2], auPercentiles[3],
+                             pHistogram->Core.cTicksMax);
+            break;
+        }
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             if (pDesc->enmVisibility == STAMVISIBILITY_USED && !pDesc->u.pRatioU32->u32A && !pDesc->u.pRatioU32->u32B)
@@ -2437,7 +2589,16 @@ static int stamR3EnumOne(PSTAMDESC pDesc, void *pvArg)
     return rc;
 }
 
-static void stamR3RefreshGroup(PUVM pUVM, uint8_t iRefreshGroup, uint64_t *pbmRefreshedGroups)
+/**
+ * Refreshes the samples of a ring-0 statistics group.
+ *
+ * @param   pUVM                Pointer to the user mode VM structure.
+ * @param   iRefreshGroup       The group to refresh (STAM_REFRESH_GRP_XXX).
+ * @param   pbmRefreshedGroups  Bitmap of refreshed groups, updated.
+ * @remarks Called while owning the read lock, which may be temporarily
+ *          dropped to register new samples.
+ */
+void stamR3RefreshGroup(PUVM pUVM, uint8_t iRefreshGroup, uint64_t *pbmRefreshedGroups)
 {
     *pbmRefreshedGroups |= RT_BIT_64(iRefreshGroup);
 
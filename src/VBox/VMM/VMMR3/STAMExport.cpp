@@ -0,0 +1,687 @@
+/* $Id$ */
+/** @file
+ * STAM - The Statistics Manager, Shared Memory Export.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_stam_export    STAM Shared Memory Export
+ *
+ * Getting at the statistics from outside the VM process normally means going
+ * thru Main and STAMR3SnapshotU, which formats every matching sample as XML
+ * while holding the STAM lock.  That is fine for the occasional look, but too
+ * expensive for monitoring tools polling many VMs once a second.
+ *
+ * When /STAM/Export/Enabled is set, a low priority publisher thread copies the
+ * sample values into a shared memory segment at a fixed interval.  The layout
+ * is described in @ref grp_stam_shm: a header, a descriptor table with the
+ * names, types and units, and a value area with raw copies of the samples.
+ * The descriptor table is only rebuilt when samples are registered or
+ * deregistered (STAMUSERPERVM::cGeneration changes), the regular updates only
+ * copy the values.  Readers synchronize with the publisher using the sequence
+ * counter in the header and never block the VM.
+ *
+ * The VBoxStamShm tool (src/VBox/VMM/tools) can list, dump and diff the
+ * exported samples.
+ *
+ * Only POSIX hosts are supported at present.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_STAM
+#include <VBox/vmm/stam.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/mm.h>
+#include "STAMInternal.h"
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/uvm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+
+#include <iprt/assert.h>
+#include <iprt/asm.h>
+#include <iprt/mem.h>
+#include <iprt/process.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
+
+#ifndef RT_OS_WINDOWS
+# include <errno.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The alignment of the descriptor table and value area. */
+#define STAMEXPORT_SECTION_ALIGN    64
+/** The segment size granularity. */
+#define STAMEXPORT_SEGMENT_ALIGN    _64K
+/** How long STAMR3ExportStop waits for the publisher thread before
+ * complaining about it (ms). */
+#define STAMEXPORT_STOP_WARN_MS     (30 * RT_MS_1SEC)
+
+
+#ifndef RT_OS_WINDOWS
+
+/**
+ * Gets the size of the exported value of a sample type.
+ *
+ * @returns Size in bytes, 0 if the type isn't exported.
+ * @param   enmType     The sample type.
+ */
+static uint32_t stamR3ExportValueSize(STAMTYPE enmType)
+{
+    switch (enmType)
+    {
+        case STAMTYPE_COUNTER:
+            return sizeof(STAMCOUNTER);
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:
+            return sizeof(STAMPROFILE);
+        case STAMTYPE_HISTOGRAM:
+            return sizeof(STAMHISTOGRAM);
+        case STAMTYPE_RATIO_U32:
+        case STAMTYPE_RATIO_U32_RESET:
+            return sizeof(STAMRATIOU32);
+        case STAMTYPE_CALLBACK:
+            return STAMSHM_CALLBACK_CCH;
+        case STAMTYPE_U8:
+        case STAMTYPE_U8_RESET:
+        case STAMTYPE_X8:
+        case STAMTYPE_X8_RESET:
+        case STAMTYPE_BOOL:
+        case STAMTYPE_BOOL_RESET:
+            return sizeof(uint8_t);
+        case STAMTYPE_U16:
+        case STAMTYPE_U16_RESET:
+        case STAMTYPE_X16:
+        case STAMTYPE_X16_RESET:
+            return sizeof(uint16_t);
+        case STAMTYPE_U32:
+        case STAMTYPE_U32_RESET:
+        case STAMTYPE_X32:
+        case STAMTYPE_X32_RESET:
+            return sizeof(uint32_t);
+        case STAMTYPE_U64:
+        case STAMTYPE_U64_RESET:
+        case STAMTYPE_X64:
+        case STAMTYPE_X64_RESET:
+            return sizeof(uint64_t);
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * Copies the value of one sample into the segment.
+ *
+ * The samples are updated without any locking, so this is just as consistent
+ * as the other STAM output is.  64-bit fields are read in one go.
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pDesc       The sample descriptor.
+ * @param   pvDst       Where to copy the value (8 byte aligned).
+ * @param   cbDst       The size of the destination.
+ */
+static void stamR3ExportCopyValue(PUVM pUVM, PSTAMDESC pDesc, void *pvDst, uint32_t cbDst)
+{
+    switch (pDesc->enmType)
+    {
+        case STAMTYPE_COUNTER:
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:
+        case STAMTYPE_HISTOGRAM:
+        case STAMTYPE_U64:
+        case STAMTYPE_U64_RESET:
+        case STAMTYPE_X64:
+        case STAMTYPE_X64_RESET:
+        {
+            uint64_t const volatile *pu64Src = (uint64_t const volatile *)pDesc->u.pv;
+            uint64_t                *pu64Dst = (uint64_t *)pvDst;
+            for (uint32_t i = 0; i < cbDst / sizeof(uint64_t); i++)
+                pu64Dst[i] = pu64Src[i];
+            break;
+        }
+
+        case STAMTYPE_RATIO_U32:
+        case STAMTYPE_RATIO_U32_RESET:
+            ((PSTAMRATIOU32)pvDst)->u32A = ASMAtomicUoReadU32(&pDesc->u.pRatioU32->u32A);
+            ((PSTAMRATIOU32)pvDst)->u32B = ASMAtomicUoReadU32(&pDesc->u.pRatioU32->u32B);
+            break;
+
+        case STAMTYPE_CALLBACK:
+        {
+            char *pszDst = (char *)pvDst;
+            pszDst[0] = '\0';
+            pDesc->u.Callback.pfnPrint(pUVM->pVM, pDesc->u.Callback.pvSample, pszDst, cbDst);
+            pszDst[cbDst - 1] = '\0';
+            break;
+        }
+
+        case STAMTYPE_U8:
+        case STAMTYPE_U8_RESET:
+        case STAMTYPE_X8:
+        case STAMTYPE_X8_RESET:
+            *(uint8_t *)pvDst = ASMAtomicUoReadU8(pDesc->u.pu8);
+            break;
+
+        case STAMTYPE_BOOL:
+        case STAMTYPE_BOOL_RESET:
+            *(uint8_t *)pvDst = *(bool volatile *)pDesc->u.pf;
+            break;
+
+        case STAMTYPE_U16:
+        case STAMTYPE_U16_RESET:
+        case STAMTYPE_X16:
+        case STAMTYPE_X16_RESET:
+            *(uint16_t *)pvDst = ASMAtomicUoReadU16(pDesc->u.pu16);
+            break;
+
+        case STAMTYPE_U32:
+        case STAMTYPE_U32_RESET:
+        case STAMTYPE_X32:
+        case STAMTYPE_X32_RESET:
+            *(uint32_t *)pvDst = ASMAtomicUoReadU32(pDesc->u.pu32);
+            break;
+
+        default:
+            AssertMsgFailed(("enmType=%d\n", pDesc->enmType));
+            break;
+    }
+}
+
+
+/**
+ * Makes sure the segment is at least @a cbNeeded bytes big, growing and
+ * remapping it if necessary.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The export state.
+ * @param   cbNeeded    The required segment size.
+ */
+static int stamR3ExportEnsureSize(PSTAMEXPORT pThis, size_t cbNeeded)
+{
+    if (cbNeeded <= pThis->cbMap)
+        return VINF_SUCCESS;
+    AssertReturn(cbNeeded < _1G, VERR_OUT_OF_RANGE);
+
+    size_t const cbNew = RT_ALIGN_Z(cbNeeded + cbNeeded / 4, STAMEXPORT_SEGMENT_ALIGN);
+    if (ftruncate(pThis->fdShm, (off_t)cbNew) != 0)
+        return RTErrConvertFromErrno(errno);
+    void *pvNew = mmap(NULL, cbNew, PROT_READ | PROT_WRITE, MAP_SHARED, pThis->fdShm, 0);
+    if (pvNew == MAP_FAILED)
+        return RTErrConvertFromErrno(errno);
+
+    if (pThis->pbMap)
+        munmap(pThis->pbMap, pThis->cbMap);
+    pThis->pbMap = (uint8_t *)pvNew;
+    pThis->cbMap = cbNew;
+    ASMAtomicWriteU32(&((PSTAMSHMHDR)pvNew)->cbSegment, (uint32_t)cbNew);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Rebuilds the descriptor table, string table and values.
+ *
+ * Caller must hold the STAM read lock and have marked the segment as being
+ * updated (odd sequence number).
+ *
+ * @returns VBox status code.
+ * @param   pThis       The export state.
+ */
+static int stamR3ExportRebuild(PSTAMEXPORT pThis)
+{
+    PUVM pUVM = pThis->pUVM;
+
+    /*
+     * Count the samples and calculate the sizes of the tables.
+     */
+    uint32_t  cDescs    = 0;
+    size_t    cbStrings = 0;
+    size_t    cbValues  = 0;
+    PSTAMDESC pCur;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+    {
+        uint32_t const cbValue = stamR3ExportValueSize(pCur->enmType);
+        if (   !cbValue
+            || (pThis->pszPattern && !RTStrSimplePatternMultiMatch(pThis->pszPattern, RTSTR_MAX,
+                                                                   pCur->pszName, RTSTR_MAX, NULL)))
+            continue;
+        cDescs++;
+        cbStrings += strlen(pCur->pszName) + 1;
+        if (pCur->pszDesc)
+            cbStrings += strlen(pCur->pszDesc) + 1;
+        cbValues  += RT_ALIGN_32(cbValue, 8);
+    }
+
+    if (cDescs > pThis->cDescsAlloc)
+    {
+        uint32_t const cNew = RT_ALIGN_32(cDescs + cDescs / 8, 256);
+        void *pvNew = RTMemRealloc(pThis->papDescs, cNew * sizeof(pThis->papDescs[0]));
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        pThis->papDescs    = (PSTAMDESC *)pvNew;
+        pThis->cDescsAlloc = cNew;
+    }
+
+    size_t const offDescs   = RT_ALIGN_Z(sizeof(STAMSHMHDR), STAMEXPORT_SECTION_ALIGN);
+    size_t const offStrings = offDescs + cDescs * sizeof(STAMSHMDESC);
+    size_t const offValues  = RT_ALIGN_Z(offStrings + cbStrings, STAMEXPORT_SECTION_ALIGN);
+    int rc = stamR3ExportEnsureSize(pThis, offValues + cbValues);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Fill in the tables and copy the values.
+     */
+    uint8_t      *pbMap    = pThis->pbMap;
+    PSTAMSHMHDR   pHdr     = (PSTAMSHMHDR)pbMap;
+    PSTAMSHMDESC  paShm    = (PSTAMSHMDESC)&pbMap[offDescs];
+    char         *pchStr   = (char *)&pbMap[offStrings];
+    uint32_t      offStr   = 0;
+    uint32_t      offValue = 0;
+    uint32_t      iDesc    = 0;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+    {
+        uint32_t const cbValue = stamR3ExportValueSize(pCur->enmType);
+        if (   !cbValue
+            || (pThis->pszPattern && !RTStrSimplePatternMultiMatch(pThis->pszPattern, RTSTR_MAX,
+                                                                   pCur->pszName, RTSTR_MAX, NULL)))
+            continue;
+        AssertBreak(iDesc < cDescs);
+
+        size_t cch = strlen(pCur->pszName) + 1;
+        memcpy(&pchStr[offStr], pCur->pszName, cch);
+        paShm[iDesc].offName = offStr;
+        offStr += (uint32_t)cch;
+
+        if (pCur->pszDesc)
+        {
+            cch = strlen(pCur->pszDesc) + 1;
+            memcpy(&pchStr[offStr], pCur->pszDesc, cch);
+            paShm[iDesc].offDesc = offStr;
+            offStr += (uint32_t)cch;
+        }
+        else
+            paShm[iDesc].offDesc = STAMSHM_NO_DESC;
+
+        paShm[iDesc].offValue = offValue;
+        paShm[iDesc].cbValue  = (uint16_t)cbValue;
+        paShm[iDesc].enmType  = (uint8_t)pCur->enmType;
+        paShm[iDesc].enmUnit  = (uint8_t)pCur->enmUnit;
+        stamR3ExportCopyValue(pUVM, pCur, &pbMap[offValues + offValue], cbValue);
+        offValue += RT_ALIGN_32(cbValue, 8);
+
+        if (pCur->iRefreshGroup != STAM_REFRESH_GRP_NONE)
+            pThis->bmRefreshGroups |= RT_BIT_64(pCur->iRefreshGroup);
+        pThis->papDescs[iDesc++] = pCur;
+    }
+    Assert(iDesc == cDescs);
+    pThis->cDescs = iDesc;
+
+    pHdr->cDescs     = iDesc;
+    pHdr->offDescs   = (uint32_t)offDescs;
+    pHdr->offStrings = (uint32_t)offStrings;
+    pHdr->offValues  = (uint32_t)offValues;
+    pHdr->cbValues   = (uint32_t)cbValues;
+    ASMAtomicIncU32(&pHdr->uLayoutGen);
+
+    pThis->uGenBuilt = pUVM->stam.s.cGeneration;
+    pThis->fRebuild  = false;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Does one update of the segment.
+ *
+ * @param   pThis       The export state.
+ */
+static void stamR3ExportUpdate(PSTAMEXPORT pThis)
+{
+    PUVM        pUVM = pThis->pUVM;
+    PSTAMSHMHDR pHdr = (PSTAMSHMHDR)pThis->pbMap;
+
+    STAM_LOCK_RD(pUVM);
+
+    uint64_t bmRefreshedGroups = 0;
+    for (uint8_t iGroup = 0; iGroup < 64; iGroup++)
+        if (pThis->bmRefreshGroups & RT_BIT_64(iGroup))
+            stamR3RefreshGroup(pUVM, iGroup, &bmRefreshedGroups);
+
+    ASMAtomicIncU32(&pHdr->uSeq);
+    if (   pThis->fRebuild
+        || pThis->uGenBuilt != pUVM->stam.s.cGeneration)
+    {
+        int rc = stamR3ExportRebuild(pThis);
+        if (RT_FAILURE(rc))
+        {
+            /* Leave the segment empty rather than describing samples that may be gone. */
+            LogRelMax(8, ("STAM: Rebuilding the shared memory export failed: %Rrc\n", rc));
+            pThis->fRebuild = true;
+            pThis->cDescs   = 0;
+            pHdr = (PSTAMSHMHDR)pThis->pbMap;
+            pHdr->cDescs    = 0;
+            ASMAtomicIncU32(&pHdr->uLayoutGen);
+        }
+        else
+            pHdr = (PSTAMSHMHDR)pThis->pbMap; /* may have been remapped */
+    }
+    else
+    {
+        uint8_t            *pbValues = &pThis->pbMap[pHdr->offValues];
+        PCSTAMSHMDESC const paShm    = (PCSTAMSHMDESC)&pThis->pbMap[pHdr->offDescs];
+        for (uint32_t i = 0; i < pThis->cDescs && !ASMAtomicUoReadBool(&pThis->fTerminate); i++)
+            stamR3ExportCopyValue(pUVM, pThis->papDescs[i], &pbValues[paShm[i].offValue], paShm[i].cbValue);
+    }
+    pHdr->u64NanoTS = RTTimeNanoTS();
+    pHdr->cUpdates++;
+    ASMAtomicIncU32(&pHdr->uSeq);
+
+    STAM_UNLOCK_RD(pUVM);
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, The publisher thread.}
+ */
+static DECLCALLBACK(int) stamR3ExportThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PSTAMEXPORT pThis = (PSTAMEXPORT)pvUser;
+    RT_NOREF(hThreadSelf);
+
+    while (!ASMAtomicReadBool(&pThis->fTerminate))
+    {
+        stamR3ExportUpdate(pThis);
+        RTSemEventWait(pThis->hEvtWakeup, pThis->cMsInterval);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Removes a segment left behind by a process which is gone.
+ *
+ * Segments of live processes are left alone, so a clashing /STAM/Export/Name
+ * doesn't pull the statistics of another VM from under its readers.  Ours
+ * being the PID in the header means a dead process with the same PID.
+ *
+ * @param   pszName     The segment name.
+ */
+static void stamR3ExportRemoveStale(const char *pszName)
+{
+    int fd = shm_open(pszName, O_RDONLY, 0);
+    if (fd < 0)
+        return;
+
+    bool        fStale = false;
+    struct stat St;
+    if (fstat(fd, &St) == 0 && St.st_size >= (off_t)sizeof(STAMSHMHDR))
+    {
+        void *pv = mmap(NULL, sizeof(STAMSHMHDR), PROT_READ, MAP_SHARED, fd, 0);
+        if (pv != MAP_FAILED)
+        {
+            PCSTAMSHMHDR pHdr = (PCSTAMSHMHDR)pv;
+            if (pHdr->u32Magic == ~STAMSHMHDR_MAGIC)
+                fStale = true;
+            else if (pHdr->u32Magic == STAMSHMHDR_MAGIC)
+                fStale = pHdr->uPid == (uint32_t)RTProcSelf()
+                      || (kill((pid_t)pHdr->uPid, 0) != 0 && errno == ESRCH);
+            munmap(pv, sizeof(STAMSHMHDR));
+        }
+    }
+    close(fd);
+
+    if (fStale)
+    {
+        LogRel(("STAM: Removing the stale shared memory export '%s'\n", pszName));
+        shm_unlink(pszName);
+    }
+}
+
+
+/**
+ * Checks whether the segment name still refers to our segment, i.e. that
+ * nobody has unlinked it and created their own in the mean time.
+ *
+ * @returns true if it does, false if not.
+ * @param   pThis       The export state.
+ */
+static bool stamR3ExportIsOurName(PSTAMEXPORT pThis)
+{
+    struct stat StOurs;
+    if (fstat(pThis->fdShm, &StOurs) != 0)
+        return false;
+    int fd = shm_open(pThis->szName, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat StName;
+    bool const fOurs = fstat(fd, &StName) == 0
+                    && StName.st_dev == StOurs.st_dev
+                    && StName.st_ino == StOurs.st_ino;
+    close(fd);
+    return fOurs;
+}
+
+
+/**
+ * Frees the export state, unlinking the segment if the name is still ours.
+ *
+ * @param   pThis       The export state.  The thread must not be running.
+ */
+static void stamR3ExportDestroy(PSTAMEXPORT pThis)
+{
+    if (pThis->pbMap)
+    {
+        ASMAtomicWriteU32(&((PSTAMSHMHDR)pThis->pbMap)->u32Magic, ~STAMSHMHDR_MAGIC);
+        munmap(pThis->pbMap, pThis->cbMap);
+        pThis->pbMap = NULL;
+    }
+    if (pThis->fdShm >= 0)
+    {
+        if (stamR3ExportIsOurName(pThis))
+            shm_unlink(pThis->szName);
+        close(pThis->fdShm);
+        pThis->fdShm = -1;
+    }
+    if (pThis->hEvtWakeup != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pThis->hEvtWakeup);
+        pThis->hEvtWakeup = NIL_RTSEMEVENT;
+    }
+    RTStrFree(pThis->pszPattern);
+    RTMemFree(pThis->papDescs);
+    RTMemFree(pThis);
+}
+
+#endif /* !RT_OS_WINDOWS */
+
+
+/**
+ * Starts the shared memory export if configured.
+ *
+ * Failing to set up the export is not fatal to the VM, it is only logged.
+ *
+ * @returns VBox status code, only configuration errors are returned.
+ * @param   pVM         The cross context VM structure.
+ * @thread  EMT(0)
+ */
+VMMR3_INT_DECL(int) STAMR3ExportStart(PVM pVM)
+{
+    PUVM pUVM = pVM->pUVM;
+    AssertReturn(!pUVM->stam.s.pExport, VERR_WRONG_ORDER);
+
+    /*
+     * Query the configuration.
+     */
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "STAM/Export");
+
+    /** @cfgm{/STAM/Export/Enabled, bool, false}
+     * Whether to publish the statistics in a shared memory segment for
+     * external monitoring tools. */
+    bool fEnabled;
+    int rc = CFGMR3QueryBoolDef(pCfg, "Enabled", &fEnabled, false);
+    AssertLogRelRCReturn(rc, rc);
+    if (!fEnabled)
+        return VINF_SUCCESS;
+
+#ifdef RT_OS_WINDOWS
+    LogRel(("STAM: Shared memory export is not supported on this host\n"));
+    return VINF_SUCCESS;
+#else
+    /** @cfgm{/STAM/Export/IntervalMs, uint32_t, 1000, 10, 3600000}
+     * The interval between updates of the exported values. */
+    uint32_t cMsInterval;
+    rc = CFGMR3QueryU32Def(pCfg, "IntervalMs", &cMsInterval, RT_MS_1SEC);
+    AssertLogRelRCReturn(rc, rc);
+    if (cMsInterval < 10 || cMsInterval > RT_MS_1HOUR)
+        return VMR3SetError(pUVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                            N_("Configuration error: /STAM/Export/IntervalMs=%u is out of range (10..3600000)"), cMsInterval);
+
+    /** @cfgm{/STAM/Export/Pattern, string, all samples}
+     * Simple pattern(s), separated by '|', selecting the samples to export. */
+    char *pszPattern = NULL;
+    rc = CFGMR3QueryStringAlloc(pCfg, "Pattern", &pszPattern);
+    if (rc == VERR_CFGM_VALUE_NOT_FOUND || rc == VERR_CFGM_NO_PARENT)
+        rc = VINF_SUCCESS;
+    AssertLogRelRCReturn(rc, rc);
+
+    PSTAMEXPORT pThis = (PSTAMEXPORT)RTMemAllocZ(sizeof(*pThis));
+    if (!pThis)
+    {
+        MMR3HeapFree(pszPattern);
+        return VERR_NO_MEMORY;
+    }
+    pThis->pUVM        = pUVM;
+    pThis->hThread     = NIL_RTTHREAD;
+    pThis->hEvtWakeup  = NIL_RTSEMEVENT;
+    pThis->cMsInterval = cMsInterval;
+    pThis->fdShm       = -1;
+    pThis->fRebuild    = true;
+    if (pszPattern)
+    {
+        pThis->pszPattern = RTStrDup(pszPattern);
+        MMR3HeapFree(pszPattern);
+        if (!pThis->pszPattern)
+        {
+            stamR3ExportDestroy(pThis);
+            return VERR_NO_STR_MEMORY;
+        }
+    }
+
+    /** @cfgm{/STAM/Export/Name, string, /VBoxSTAM-<pid>}
+     * The name of the POSIX shared memory object.  Must start with a slash. */
+    char szDefName[sizeof(pThis->szName)];
+    RTStrPrintf(szDefName, sizeof(szDefName), STAMSHM_NAME_PREFIX "%u", (unsigned)RTProcSelf());
+    rc = CFGMR3QueryStringDef(pCfg, "Name", pThis->szName, sizeof(pThis->szName), szDefName);
+    if (RT_SUCCESS(rc) && (pThis->szName[0] != '/' || strchr(&pThis->szName[1], '/')))
+        rc = VERR_INVALID_NAME;
+    if (RT_FAILURE(rc))
+    {
+        stamR3ExportDestroy(pThis);
+        return VMR3SetError(pUVM, rc, RT_SRC_POS, N_("Configuration error: Invalid /STAM/Export/Name value"));
+    }
+
+    /*
+     * Create the segment, replacing any stale one left behind by a process
+     * which has terminated without cleaning up.
+     */
+    stamR3ExportRemoveStale(pThis->szName);
+    pThis->fdShm = shm_open(pThis->szName, O_RDWR | O_CREAT | O_EXCL, 0640);
+    if (pThis->fdShm < 0)
+    {
+        rc = RTErrConvertFromErrno(errno);
+        LogRel(("STAM: Failed to create the shared memory export '%s': %Rrc\n", pThis->szName, rc));
+        stamR3ExportDestroy(pThis);
+        return VINF_SUCCESS;
+    }
+
+    rc = stamR3ExportEnsureSize(pThis, STAMEXPORT_SEGMENT_ALIGN);
+    if (RT_SUCCESS(rc))
+    {
+        PSTAMSHMHDR pHdr = (PSTAMSHMHDR)pThis->pbMap;
+        pHdr->u32Version  = STAMSHMHDR_VERSION;
+        pHdr->cbHdr       = sizeof(STAMSHMHDR);
+        pHdr->cbDesc      = sizeof(STAMSHMDESC);
+        pHdr->offDescs    = RT_ALIGN_32(sizeof(STAMSHMHDR), STAMEXPORT_SECTION_ALIGN);
+        pHdr->offStrings  = pHdr->offDescs;
+        pHdr->offValues   = pHdr->offDescs;
+        pHdr->cMsInterval = cMsInterval;
+        pHdr->uPid        = (uint32_t)RTProcSelf();
+        rc = CFGMR3QueryStringDef(CFGMR3GetRoot(pVM), "Name", pHdr->szVMName, sizeof(pHdr->szVMName), "");
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            rc = VINF_SUCCESS; /* leave it truncated */
+        ASMAtomicWriteU32(&pHdr->u32Magic, STAMSHMHDR_MAGIC);
+
+        rc = RTSemEventCreate(&pThis->hEvtWakeup);
+        if (RT_SUCCESS(rc))
+        {
+            pUVM->stam.s.pExport = pThis;
+            rc = RTThreadCreate(&pThis->hThread, stamR3ExportThread, pThis, 0 /*cbStack*/,
+                                RTTHREADTYPE_INFREQUENT_POLLER, RTTHREADFLAGS_WAITABLE, "StamExport");
+            if (RT_SUCCESS(rc))
+            {
+                LogRel(("STAM: Exporting statistics in '%s' every %u ms (pattern '%s')\n",
+                        pThis->szName, cMsInterval, pThis->pszPattern ? pThis->pszPattern : "*"));
+                return VINF_SUCCESS;
+            }
+            pUVM->stam.s.pExport = NULL;
+        }
+    }
+    LogRel(("STAM: Failed to set up the shared memory export '%s': %Rrc\n", pThis->szName, rc));
+    stamR3ExportDestroy(pThis);
+    return VINF_SUCCESS;
+#endif /* !RT_OS_WINDOWS */
+}
+
+
+/**
+ * Stops the shared memory export, if running, and unlinks the segment.
+ *
+ * The publisher thread reads the samples, so this waits for it however long it
+ * takes (a callback sample may be slow) before the STAM state can go away.
+ *
+ * @param   pUVM        The user mode VM handle.
+ */
+VMMR3_INT_DECL(void) STAMR3ExportStop(PUVM pUVM)
+{
+    PSTAMEXPORT pThis = pUVM->stam.s.pExport;
+    if (!pThis)
+        return;
+    pUVM->stam.s.pExport = NULL;
+
+#ifndef RT_OS_WINDOWS
+    ASMAtomicWriteBool(&pThis->fTerminate, true);
+    RTSemEventSignal(pThis->hEvtWakeup);
+    int rc = RTThreadWait(pThis->hThread, STAMEXPORT_STOP_WARN_MS, NULL);
+    if (rc == VERR_TIMEOUT)
+    {
+        LogRel(("STAM: Still waiting for the export thread to terminate...\n"));
+        rc = RTThreadWait(pThis->hThread, RT_INDEFINITE_WAIT, NULL);
+    }
+    AssertLogRelRC(rc);
+    stamR3ExportDestroy(pThis);
+#endif
+}
+
@@ -152,6 +152,7 @@
 #include <iprt/asm-math.h>
 #include <iprt/assert.h>
 #include <iprt/file.h>
+#include <iprt/rand.h>
 #include <iprt/thread.h>
 #include <iprt/time.h>
 #include <iprt/timer.h>
@@ -1511,6 +1512,11 @@ static int tmr3TimerCreate(PVM pVM, TMCLOCK enmClock, const char *pszDesc, PPTMT
     pTimer->offScheduleNext = 0;
     pTimer->offNext         = 0;
     pTimer->offPrev         = 0;
+    pTimer->offTreeParent   = 0;
+    pTimer->offTreeLeft     = 0;
+    pTimer->offTreeRight    = 0;
+    pTimer->uTreePriority   = RTRandU32();
+    pTimer->u64TreeKey      = 0;
     pTimer->pvUser          = NULL;
     pTimer->pCritSect       = NULL;
     pTimer->pszDesc         = pszDesc;
@@ -1823,21 +1829,7 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
      * Unlink from the active list.
      */
     if (fActive)
-    {
-        const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-        const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-        if (pPrev)
-            TMTIMER_SET_NEXT(pPrev, pNext);
-        else
-        {
-            TMTIMER_SET_HEAD(pQueue, pNext);
-            pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        }
-        if (pNext)
-            TMTIMER_SET_PREV(pNext, pPrev);
-        pTimer->offNext = 0;
-        pTimer->offPrev = 0;
-    }
+        tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
 
     /*
      * Unlink from the schedule list by running it.
@@ -1855,6 +1847,7 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
      * Read to move the timer from the created list and onto the free list.
      */
     Assert(!pTimer->offNext); Assert(!pTimer->offPrev); Assert(!pTimer->offScheduleNext);
+    Assert(!pTimer->offTreeParent); Assert(!pTimer->offTreeLeft); Assert(!pTimer->offTreeRight);
 
     /* unlink from created list */
     if (pTimer->pBigPrev)
@@ -2222,18 +2215,7 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
             Assert(!pTimer->offScheduleNext); /* this can trigger falsely */
 
             /* unlink */
-            const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-            if (pPrev)
-                TMTIMER_SET_NEXT(pPrev, pNext);
-            else
-            {
-                TMTIMER_SET_HEAD(pQueue, pNext);
-                pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-            }
-            if (pNext)
-                TMTIMER_SET_PREV(pNext, pPrev);
-            pTimer->offNext = 0;
-            pTimer->offPrev = 0;
+            tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
 
             /* fire */
             TM_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_DELIVER);
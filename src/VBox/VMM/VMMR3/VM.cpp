@@ -463,13 +463,14 @@ static int vmR3CreateUVM(uint32_t cCpus, PCVMM2USERMETHODS pVmm2UserMethods, PUV
     /*
      * Create and initialize the UVM.
      */
-    PUVM pUVM = (PUVM)RTMemPageAllocZ(RT_UOFFSETOF_DYN(UVM, aCpus[cCpus]));
+    PUVM pUVM = (PUVM)RTMemPageAllocZ(VM_UVM_ALLOC_SIZE(cCpus));
     AssertReturn(pUVM, VERR_NO_MEMORY);
     pUVM->u32Magic          = UVM_MAGIC;
     pUVM->cCpus             = cCpus;
     pUVM->pVmm2UserMethods  = pVmm2UserMethods;
 
     AssertCompile(sizeof(pUVM->vm.s) <= sizeof(pUVM->vm.padding));
+    AssertCompile(sizeof(pUVM->aCpus[0].vm.s) <= sizeof(pUVM->aCpus[0].vm.padding));
 
     pUVM->vm.s.cUvmRefs      = 1;
     pUVM->vm.s.ppAtStateNext = &pUVM->vm.s.pAtState;
@@ -485,6 +486,7 @@ static int vmR3CreateUVM(uint32_t cCpus, PCVMM2USERMETHODS pVmm2UserMethods, PUV
         pUVM->aCpus[i].pUVM   = pUVM;
         pUVM->aCpus[i].idCpu  = i;
     }
+    vmR3ReqInitRingsU(pUVM);
 
     /* Allocate a TLS entry to store the VMINTUSERPERVMCPU pointer. */
     int rc = RTTlsAllocEx(&pUVM->vm.s.idxTLS, NULL);
@@ -520,6 +522,8 @@ static int vmR3CreateUVM(uint32_t cCpus, PCVMM2USERMETHODS pVmm2UserMethods, PUV
                             rc = MMR3InitUVM(pUVM);
                             if (RT_SUCCESS(rc))
                             {
+                                vmR3ReqPreallocU(pUVM);
+
                                 /*
                                  * Start the emulation threads for all VMCPUs.
                                  */
@@ -563,7 +567,7 @@ static int vmR3CreateUVM(uint32_t cCpus, PCVMM2USERMETHODS pVmm2UserMethods, PUV
         }
         RTTlsFree(pUVM->vm.s.idxTLS);
     }
-    RTMemPageFree(pUVM, RT_UOFFSETOF_DYN(UVM, aCpus[pUVM->cCpus]));
+    RTMemPageFree(pUVM, VM_UVM_ALLOC_SIZE(pUVM->cCpus));
     return rc;
 }
 
@@ -917,6 +921,20 @@ static int vmR3InitRing3(PVM pVM, PUVM pUVM)
         AssertRC(rc);
         rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltTimers,          STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_NS_PER_CALL, "Profiling halted state timer tasks.", "/PROF/CPU%d/VM/Halt/Timers", idCpu);
         AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltPoll,            STAMTYPE_PROFILE, STAMVISIBILITY_USED,   STAMUNIT_NS_PER_CALL, "Profiling halted state polling.",    "/PROF/CPU%d/VM/Halt/Poll", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltPollHits,        STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,  "Halts ended while polling.",         "/PROF/CPU%d/VM/Halt/PollHits", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltPollMisses,      STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,  "Halts that had to block after polling.", "/PROF/CPU%d/VM/Halt/PollMisses", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltPollGrow,        STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,  "Times the poll window was grown.",   "/PROF/CPU%d/VM/Halt/PollGrow", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltPollShrink,      STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,  "Times the poll window was shrunk.",  "/PROF/CPU%d/VM/Halt/PollShrink", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.cNsHaltPollWindow,       STAMTYPE_U32,     STAMVISIBILITY_USED,   STAMUNIT_NS,          "The current poll window.",           "/PROF/CPU%d/VM/Halt/PollWindow", idCpu);
+        AssertRC(rc);
+        rc = STAMR3RegisterF(pVM, &pUVM->aCpus[idCpu].vm.s.StatHaltDuration,        STAMTYPE_HISTOGRAM, STAMVISIBILITY_USED, STAMUNIT_NS_PER_CALL, "Halt duration histogram.",       "/PROF/CPU%d/VM/Halt/Duration", idCpu);
+        AssertRC(rc);
     }
 
     STAM_REG(pVM, &pUVM->vm.s.StatReqAllocNew,   STAMTYPE_COUNTER,     "/VM/Req/AllocNew",       STAMUNIT_OCCURENCES,        "Number of VMR3ReqAlloc returning a new packet.");
@@ -927,6 +945,7 @@ static int vmR3InitRing3(PVM pVM, PUVM pUVM)
     STAM_REG(pVM, &pUVM->vm.s.StatReqProcessed,  STAMTYPE_COUNTER,     "/VM/Req/Processed",      STAMUNIT_OCCURENCES,        "Number of processed requests (any queue).");
     STAM_REG(pVM, &pUVM->vm.s.StatReqMoreThan1,  STAMTYPE_COUNTER,     "/VM/Req/MoreThan1",      STAMUNIT_OCCURENCES,        "Number of times there are more than one request on the queue when processing it.");
     STAM_REG(pVM, &pUVM->vm.s.StatReqPushBackRaces, STAMTYPE_COUNTER,  "/VM/Req/PushBackRaces",  STAMUNIT_OCCURENCES,        "Number of push back races.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqRingFull,   STAMTYPE_COUNTER,     "/VM/Req/RingFull",       STAMUNIT_OCCURENCES,        "Number of requests queued on the overflow list because the ring was full.");
 
     /*
      * Init all R3 components, the order here might be important.
@@ -1206,6 +1225,8 @@ static int vmR3InitDoCompleted(PVM pVM, VMINITCOMPLETED enmWhat)
     }
     if (RT_SUCCESS(rc))
         rc = PDMR3InitCompleted(pVM, enmWhat);
+    if (RT_SUCCESS(rc) && enmWhat == VMINITCOMPLETED_RING0)
+        rc = STAMR3ExportStart(pVM);
     return rc;
 }
 
@@ -2461,6 +2482,11 @@ DECLCALLBACK(int) vmR3Destroy(PVM pVM)
         LogRel(("********************* End of statistics **********************\n"));
 //#endif
 
+        /*
+         * Stop exporting statistics before the samples go away.
+         */
+        STAMR3ExportStop(pUVM);
+
         /*
          * Destroy the VM components.
          */
@@ -2539,6 +2565,31 @@ DECLCALLBACK(int) vmR3Destroy(PVM pVM)
 }
 
 
+/**
+ * vmR3DestroyUVM helper that kills the requests left on a request ring.
+ *
+ * @param   pRing       The ring.
+ */
+static void vmR3DestroyKillRing(PVMREQRING pRing)
+{
+    bool   fKilled = false;
+    PVMREQ pReq;
+    while ((pReq = vmR3ReqRingPop(pRing)) != NULL)
+    {
+        AssertLogRelMsgFailed(("Requests pending! VMR3Destroy caller has to serialize this.\n"));
+        ASMAtomicUoWriteS32(&pReq->iStatus, VERR_VM_REQUEST_KILLED);
+        ASMAtomicWriteSize(&pReq->enmState, VMREQSTATE_INVALID);
+        RTSemEventSignal(pReq->EventSem);
+        RTThreadSleep(2);
+        RTSemEventDestroy(pReq->EventSem);
+        fKilled = true;
+    }
+    /* give them a chance to respond before we free the request memory. */
+    if (fKilled)
+        RTThreadSleep(32);
+}
+
+
 /**
  * Destroys the UVM portion.
  *
@@ -2627,6 +2678,8 @@ static void vmR3DestroyUVM(PUVM pUVM, uint32_t cMilliesEMTWait)
     /*
      * Kill all queued requests. (There really shouldn't be any!)
      */
+    vmR3DestroyKillRing(pUVM->vm.s.pPriorityRing);
+    vmR3DestroyKillRing(pUVM->vm.s.pNormalRing);
     for (unsigned i = 0; i < 10; i++)
     {
         PVMREQ pReqHead = ASMAtomicXchgPtrT(&pUVM->vm.s.pPriorityReqs, NULL, PVMREQ);
@@ -2657,6 +2710,8 @@ static void vmR3DestroyUVM(PUVM pUVM, uint32_t cMilliesEMTWait)
     {
         PUVMCPU pUVCpu = &pUVM->aCpus[idCpu];
 
+        vmR3DestroyKillRing(pUVCpu->vm.s.pPriorityRing);
+        vmR3DestroyKillRing(pUVCpu->vm.s.pNormalRing);
         for (unsigned i = 0; i < 10; i++)
         {
             PVMREQ pReqHead = ASMAtomicXchgPtrT(&pUVCpu->vm.s.pPriorityReqs, NULL, PVMREQ);
@@ -3126,7 +3181,7 @@ static void vmR3DoReleaseUVM(PUVM pUVM)
 
     ASMAtomicUoWriteU32(&pUVM->u32Magic, UINT32_MAX);
     RTTlsFree(pUVM->vm.s.idxTLS);
-    RTMemPageFree(pUVM, RT_UOFFSETOF_DYN(UVM, aCpus[pUVM->cCpus]));
+    RTMemPageFree(pUVM, VM_UVM_ALLOC_SIZE(pUVM->cCpus));
 }
 
 
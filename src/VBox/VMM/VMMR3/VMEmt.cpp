@@ -22,6 +22,7 @@
 #define LOG_GROUP LOG_GROUP_VM
 #include <VBox/vmm/tm.h>
 #include <VBox/vmm/dbgf.h>
+#include <VBox/vmm/dbgftrace.h>
 #include <VBox/vmm/em.h>
 #include <VBox/vmm/nem.h>
 #include <VBox/vmm/pdmapi.h>
@@ -119,7 +120,7 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
              * and must therefore service all VMCPUID_ANY requests.
              * See also VMR3Create
              */
-            if (    (pUVM->vm.s.pNormalReqs || pUVM->vm.s.pPriorityReqs)
+            if (    VMINT_REQS_PENDING(&pUVM->vm.s)
                 &&  pUVCpu->idCpu == 0)
             {
                 /*
@@ -128,7 +129,7 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
                 rc = VMR3ReqProcessU(pUVM, VMCPUID_ANY, false /*fPriorityOnly*/);
                 Log(("vmR3EmulationThread: Req rc=%Rrc, VM state %s -> %s\n", rc, VMR3GetStateName(enmBefore), pUVM->pVM ? VMR3GetStateName(pUVM->pVM->enmVMState) : "CREATING"));
             }
-            else if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs)
+            else if (VMINT_REQS_PENDING(&pUVCpu->vm.s))
             {
                 /*
                  * Service execute in specific EMT request.
@@ -169,7 +170,7 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
                 rc = VMMR3EmtRendezvousFF(pVM, &pVM->aCpus[idCpu]);
                 Log(("vmR3EmulationThread: Rendezvous rc=%Rrc, VM state %s -> %s\n", rc, VMR3GetStateName(enmBefore), VMR3GetStateName(pVM->enmVMState)));
             }
-            else if (pUVM->vm.s.pNormalReqs || pUVM->vm.s.pPriorityReqs)
+            else if (VMINT_REQS_PENDING(&pUVM->vm.s))
             {
                 /*
                  * Service execute in any EMT request.
@@ -177,7 +178,7 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
                 rc = VMR3ReqProcessU(pUVM, VMCPUID_ANY, false /*fPriorityOnly*/);
                 Log(("vmR3EmulationThread: Req rc=%Rrc, VM state %s -> %s\n", rc, VMR3GetStateName(enmBefore), VMR3GetStateName(pVM->enmVMState)));
             }
-            else if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs)
+            else if (VMINT_REQS_PENDING(&pUVCpu->vm.s))
             {
                 /*
                  * Service execute in specific EMT request.
@@ -320,6 +321,7 @@ static const char *vmR3GetHaltMethodName(VMHALTMETHOD enmMethod)
         case VMHALTMETHOD_1:            return "method1";
         //case VMHALTMETHOD_2:            return "method2";
         case VMHALTMETHOD_GLOBAL_1:     return "global1";
+        case VMHALTMETHOD_POLL:         return "poll";
         default:                        return "unknown";
     }
 }
@@ -787,6 +789,257 @@ static DECLCALLBACK(int) vmR3HaltGlobal1Halt(PUVMCPU pUVCpu, const uint32_t fMas
 }
 
 
+/**
+ * Initialize the poll halt method.
+ *
+ * @return VBox status code.
+ * @param   pUVM            Pointer to the user mode VM structure.
+ */
+static DECLCALLBACK(int) vmR3HaltPollInit(PUVM pUVM)
+{
+    /*
+     * The defaults.  The spin/block threshold is the same as for global 1.
+     */
+    uint32_t cNsResolution = SUPSemEventMultiGetResolution(pUVM->vm.s.pSession);
+    if (cNsResolution > 5*RT_NS_100US)
+        pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg = 50000;
+    else if (cNsResolution > RT_NS_100US)
+        pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg = cNsResolution / 4;
+    else
+        pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg = 2000;
+    pUVM->vm.s.Halt.Poll.cNsPollStartCfg = 10000;   /* 10us */
+    pUVM->vm.s.Halt.Poll.cNsPollMaxCfg   = 200000;  /* 200us */
+    pUVM->vm.s.Halt.Poll.uPollGrowCfg    = 2;
+    pUVM->vm.s.Halt.Poll.uPollShrinkCfg  = 2;
+
+    /*
+     * Query overrides.
+     */
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pUVM->pVM), "/VMM/HaltedPoll");
+    /** @cfgm{/VMM/HaltedPoll/SpinBlockThreshold, uint32_t, ns, resolution based}
+     * The threshold between spinning and blocking once the poll window is used up. */
+    int rc = CFGMR3QueryU32Def(pCfg, "SpinBlockThreshold", &pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg,
+                               pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg);
+    AssertLogRelRCReturn(rc, rc);
+    /** @cfgm{/VMM/HaltedPoll/PollStart, uint32_t, ns, 10000}
+     * The poll window to start out with when growing it from zero. */
+    rc = CFGMR3QueryU32Def(pCfg, "PollStart", &pUVM->vm.s.Halt.Poll.cNsPollStartCfg, pUVM->vm.s.Halt.Poll.cNsPollStartCfg);
+    AssertLogRelRCReturn(rc, rc);
+    /** @cfgm{/VMM/HaltedPoll/PollMax, uint32_t, ns, 200000}
+     * The max poll window.  Halts longer than this shrink the window.  Zero
+     * disables polling, making this method behave like global 1. */
+    rc = CFGMR3QueryU32Def(pCfg, "PollMax", &pUVM->vm.s.Halt.Poll.cNsPollMaxCfg, pUVM->vm.s.Halt.Poll.cNsPollMaxCfg);
+    AssertLogRelRCReturn(rc, rc);
+    /** @cfgm{/VMM/HaltedPoll/PollGrow, uint32_t, 2}
+     * The factor the poll window grows by after a short halt. */
+    rc = CFGMR3QueryU32Def(pCfg, "PollGrow", &pUVM->vm.s.Halt.Poll.uPollGrowCfg, pUVM->vm.s.Halt.Poll.uPollGrowCfg);
+    AssertLogRelRCReturn(rc, rc);
+    /** @cfgm{/VMM/HaltedPoll/PollShrink, uint32_t, 2}
+     * The divisor the poll window shrinks by after a long halt, zero resets
+     * the window. */
+    rc = CFGMR3QueryU32Def(pCfg, "PollShrink", &pUVM->vm.s.Halt.Poll.uPollShrinkCfg, pUVM->vm.s.Halt.Poll.uPollShrinkCfg);
+    AssertLogRelRCReturn(rc, rc);
+    if (pUVM->vm.s.Halt.Poll.uPollGrowCfg < 2)
+        pUVM->vm.s.Halt.Poll.uPollGrowCfg = 2;
+    if (pUVM->vm.s.Halt.Poll.cNsPollStartCfg > pUVM->vm.s.Halt.Poll.cNsPollMaxCfg)
+        pUVM->vm.s.Halt.Poll.cNsPollStartCfg = pUVM->vm.s.Halt.Poll.cNsPollMaxCfg;
+
+    for (VMCPUID idCpu = 0; idCpu < pUVM->cCpus; idCpu++)
+        pUVM->aCpus[idCpu].vm.s.cNsHaltPollWindow = 0;
+
+    LogRel(("VMEmt: HaltedPoll config: cNsSpinBlockThresholdCfg=%u cNsPollStartCfg=%u cNsPollMaxCfg=%u uPollGrowCfg=%u uPollShrinkCfg=%u\n",
+            pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg, pUVM->vm.s.Halt.Poll.cNsPollStartCfg,
+            pUVM->vm.s.Halt.Poll.cNsPollMaxCfg, pUVM->vm.s.Halt.Poll.uPollGrowCfg, pUVM->vm.s.Halt.Poll.uPollShrinkCfg));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Adjusts the poll window of a VCPU after a halt.
+ *
+ * This follows the KVM halt_poll_ns logic: Nothing changes if the halt ended
+ * within the window, the window shrinks if the halt was longer than the max
+ * window (polling would only have burned CPU), and it grows if the halt was
+ * short enough that a bigger window would have caught the wakeup.
+ *
+ * @param   pUVCpu          Pointer to the user mode VMCPU structure.
+ * @param   cNsHalted       How long the halt took.
+ */
+static void vmR3HaltPollAdjustWindow(PUVMCPU pUVCpu, uint64_t cNsHalted)
+{
+    PUVM     pUVM     = pUVCpu->pUVM;
+    uint32_t cNsWindow = pUVCpu->vm.s.cNsHaltPollWindow;
+    if (cNsHalted <= cNsWindow)
+        return;
+    if (cNsHalted > pUVM->vm.s.Halt.Poll.cNsPollMaxCfg)
+    {
+        if (cNsWindow)
+        {
+            cNsWindow = pUVM->vm.s.Halt.Poll.uPollShrinkCfg ? cNsWindow / pUVM->vm.s.Halt.Poll.uPollShrinkCfg : 0;
+            STAM_REL_COUNTER_INC(&pUVCpu->vm.s.StatHaltPollShrink);
+        }
+    }
+    else if (cNsWindow < pUVM->vm.s.Halt.Poll.cNsPollMaxCfg)
+    {
+        uint64_t cNsNew = cNsWindow >= pUVM->vm.s.Halt.Poll.cNsPollStartCfg
+                        ? (uint64_t)cNsWindow * pUVM->vm.s.Halt.Poll.uPollGrowCfg
+                        : pUVM->vm.s.Halt.Poll.cNsPollStartCfg;
+        cNsWindow = (uint32_t)RT_MIN(cNsNew, pUVM->vm.s.Halt.Poll.cNsPollMaxCfg);
+        STAM_REL_COUNTER_INC(&pUVCpu->vm.s.StatHaltPollGrow);
+    }
+    pUVCpu->vm.s.cNsHaltPollWindow = cNsWindow;
+}
+
+
+/**
+ * The poll halt method - Poll the force action flags for an adaptive period
+ * before blocking in GVMM (ring-0) like the global 1 method.
+ *
+ * Polling saves the wakeup latency and the ring-0 round trips for both the
+ * halting and the signalling thread when the guest halts for short periods,
+ * e.g. while waiting on IPIs or fast I/O completions.
+ */
+static DECLCALLBACK(int) vmR3HaltPollHalt(PUVMCPU pUVCpu, const uint32_t fMask, uint64_t u64Now)
+{
+    PUVM    pUVM  = pUVCpu->pUVM;
+    PVMCPU  pVCpu = pUVCpu->pVCpu;
+    PVM     pVM   = pUVCpu->pVM;
+    Assert(VMMGetCpu(pVM) == pVCpu);
+
+    /*
+     * The poll phase.  We don't set fWait here, so other threads only need to
+     * raise the force action flag and won't have to wake us up in ring-0.
+     * Timers are served as usual since they may be what we're waiting for.
+     */
+    int            rc        = VINF_SUCCESS;
+    bool           fPolled   = false;
+    uint64_t const u64PollEnd = u64Now + pUVCpu->vm.s.cNsHaltPollWindow;
+    if (pUVCpu->vm.s.cNsHaltPollWindow)
+    {
+        STAM_REL_PROFILE_START(&pUVCpu->vm.s.StatHaltPoll, a);
+        for (;;)
+        {
+            uint64_t const u64StartTimers   = RTTimeNanoTS();
+            TMR3TimerQueuesDo(pVM);
+            uint64_t const cNsElapsedTimers = RTTimeNanoTS() - u64StartTimers;
+            STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltTimers, cNsElapsedTimers);
+            if (    VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                ||  VMCPU_FF_IS_PENDING(pVCpu, fMask))
+            {
+                fPolled = true;
+                break;
+            }
+
+            uint64_t u64Delta;
+            uint64_t u64GipTime = TMTimerPollGIP(pVM, pVCpu, &u64Delta);
+            uint64_t u64SpinEnd = RT_MIN(u64GipTime, u64PollEnd);
+            uint64_t u64Cur;
+            while (   (u64Cur = RTTimeNanoTS()) < u64SpinEnd
+                   && !VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                   && !VMCPU_FF_IS_PENDING(pVCpu, fMask))
+                ASMNopPause();
+            if (    VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                ||  VMCPU_FF_IS_PENDING(pVCpu, fMask))
+            {
+                fPolled = true;
+                break;
+            }
+            if (u64Cur >= u64PollEnd)
+                break;
+        }
+        STAM_REL_PROFILE_STOP(&pUVCpu->vm.s.StatHaltPoll, a);
+        if (fPolled)
+            STAM_REL_COUNTER_INC(&pUVCpu->vm.s.StatHaltPollHits);
+        else
+            STAM_REL_COUNTER_INC(&pUVCpu->vm.s.StatHaltPollMisses);
+    }
+
+    /*
+     * The global 1 halt loop.
+     */
+    if (!fPolled)
+    {
+        ASMAtomicWriteBool(&pUVCpu->vm.s.fWait, true);
+        unsigned cLoops = 0;
+        for (;; cLoops++)
+        {
+            /*
+             * Work the timers and check if we can exit.
+             */
+            uint64_t const u64StartTimers   = RTTimeNanoTS();
+            TMR3TimerQueuesDo(pVM);
+            uint64_t const cNsElapsedTimers = RTTimeNanoTS() - u64StartTimers;
+            STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltTimers, cNsElapsedTimers);
+            if (    VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                ||  VMCPU_FF_IS_PENDING(pVCpu, fMask))
+                break;
+
+            /*
+             * Estimate time left to the next event.
+             */
+            uint64_t u64Delta;
+            uint64_t u64GipTime = TMTimerPollGIP(pVM, pVCpu, &u64Delta);
+            if (    VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                ||  VMCPU_FF_IS_PENDING(pVCpu, fMask))
+                break;
+
+            /*
+             * Block if the interval isn't all that small.
+             */
+            if (u64Delta >= pUVM->vm.s.Halt.Poll.cNsSpinBlockThresholdCfg)
+            {
+                VMMR3YieldStop(pVM);
+                if (    VM_FF_IS_PENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                    ||  VMCPU_FF_IS_PENDING(pVCpu, fMask))
+                    break;
+
+                uint64_t const u64StartSchedHalt   = RTTimeNanoTS();
+                rc = SUPR3CallVMMR0Ex(pVM->pVMR0, pVCpu->idCpu, VMMR0_DO_GVMM_SCHED_HALT, u64GipTime, NULL);
+                uint64_t const u64EndSchedHalt     = RTTimeNanoTS();
+                uint64_t const cNsElapsedSchedHalt = u64EndSchedHalt - u64StartSchedHalt;
+                STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlock, cNsElapsedSchedHalt);
+
+                if (rc == VERR_INTERRUPTED)
+                    rc = VINF_SUCCESS;
+                else if (RT_FAILURE(rc))
+                {
+                    rc = vmR3FatalWaitError(pUVCpu, "vmR3HaltPollHalt: VMMR0_DO_GVMM_SCHED_HALT->%Rrc\n", rc);
+                    break;
+                }
+                else
+                {
+                    int64_t const cNsOverslept = u64EndSchedHalt - u64GipTime;
+                    if (cNsOverslept > 50000)
+                        STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockOverslept, cNsOverslept);
+                    else if (cNsOverslept < -50000)
+                        STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockInsomnia,  cNsElapsedSchedHalt);
+                    else
+                        STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockOnTime,    cNsElapsedSchedHalt);
+                }
+            }
+            /*
+             * When spinning call upon the GVMM and do some wakups once
+             * in a while, it's not like we're actually busy or anything.
+             */
+            else if (!(cLoops & 0x1fff))
+            {
+                uint64_t const u64StartSchedYield   = RTTimeNanoTS();
+                rc = SUPR3CallVMMR0Ex(pVM->pVMR0, pVCpu->idCpu, VMMR0_DO_GVMM_SCHED_POLL, false /* don't yield */, NULL);
+                uint64_t const cNsElapsedSchedYield = RTTimeNanoTS() - u64StartSchedYield;
+                STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltYield, cNsElapsedSchedYield);
+            }
+        }
+        ASMAtomicUoWriteBool(&pUVCpu->vm.s.fWait, false);
+    }
+
+    /*
+     * Adjust the poll window according to how long we were halted.
+     */
+    vmR3HaltPollAdjustWindow(pUVCpu, RTTimeNanoTS() - u64Now);
+    return rc;
+}
+
+
 /**
  * The global 1 halt method - VMR3Wait() worker.
  *
@@ -891,9 +1144,9 @@ static DECLCALLBACK(int) vmR3BootstrapWait(PUVMCPU pUVCpu)
         /*
          * Check Relevant FFs.
          */
-        if (pUVM->vm.s.pNormalReqs   || pUVM->vm.s.pPriorityReqs)   /* global requests pending? */
+        if (VMINT_REQS_PENDING(&pUVM->vm.s))   /* global requests pending? */
             break;
-        if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs) /* local requests pending? */
+        if (VMINT_REQS_PENDING(&pUVCpu->vm.s)) /* local requests pending? */
             break;
 
         if (    pUVCpu->pVM
@@ -1040,6 +1293,7 @@ static const struct VMHALTMETHODDESC
     { VMHALTMETHOD_OLD,       NULL,                NULL,   vmR3HaltOldDoHalt,   vmR3DefaultWait,     vmR3DefaultNotifyCpuFF,     NULL },
     { VMHALTMETHOD_1,         vmR3HaltMethod1Init, NULL,   vmR3HaltMethod1Halt, vmR3DefaultWait,     vmR3DefaultNotifyCpuFF,     NULL },
     { VMHALTMETHOD_GLOBAL_1,  vmR3HaltGlobal1Init, NULL,   vmR3HaltGlobal1Halt, vmR3HaltGlobal1Wait, vmR3HaltGlobal1NotifyCpuFF, NULL },
+    { VMHALTMETHOD_POLL,      vmR3HaltPollInit,    NULL,   vmR3HaltPollHalt,    vmR3HaltGlobal1Wait, vmR3HaltGlobal1NotifyCpuFF, NULL },
 };
 
 
@@ -1152,9 +1406,14 @@ VMMR3_INT_DECL(int) VMR3WaitHalted(PVM pVM, PVMCPU pVCpu, bool fIgnoreInterrupts
     VMCPU_ASSERT_STATE(pVCpu, VMCPUSTATE_STARTED);
     VMCPU_SET_STATE(pVCpu, VMCPUSTATE_STARTED_HALTED);
     PUVM pUVM = pUVCpu->pUVM;
+    uint64_t const uTscTrace = DBGFTRACEEVT_START(pVCpu, DBGFTRACEEVT_F_HALT);
     int rc = g_aHaltMethods[pUVM->vm.s.iHaltMethod].pfnHalt(pUVCpu, fMask, u64Now);
+    if (uTscTrace)
+        DBGFTraceEvtAdd(pVCpu, DBGFTRACEEVTTYPE_HALT, uTscTrace, 0, 0, 0, (int64_t)rc);
     VMCPU_SET_STATE(pVCpu, VMCPUSTATE_STARTED);
 
+    STAM_REL_HISTOGRAM_ADD(&pUVCpu->vm.s.StatHaltDuration, RTTimeNanoTS() - u64Now);
+
     /*
      * Notify TM and resume the yielder
      */
@@ -2805,6 +2805,15 @@ static int vmmR3ServiceCallRing3Request(PVM pVM, PVMCPU pVCpu)
             break;
         }
 
+        /*
+         * Restore a page from the saved-state page file.
+         */
+        case VMMCALLRING3_PGM_LAZY_RESTORE_PAGE:
+        {
+            pVCpu->vmm.s.rcCallRing3 = PGMR3PhysLazyRestorePage(pVM, pVCpu->vmm.s.u64CallRing3Arg);
+            break;
+        }
+
         /*
          * Acquire the PGM lock.
          */
@@ -37,6 +37,14 @@
 #include <iprt/thread.h>
 
 
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The number of request packets to put on the free lists when creating the
+ * VM, so the first bursts of requests don't hit the heap. */
+#define VMREQ_PREALLOCATED      32
+
+
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
@@ -785,6 +793,161 @@ VMMR3DECL(int) VMR3ReqFree(PVMREQ pReq)
 }
 
 
+/**
+ * Puts some request packets on the free lists.
+ *
+ * Called at UVM creation time, failures are ignored since the packets will be
+ * allocated on demand anyway.
+ *
+ * @param   pUVM            Pointer to the user mode VM structure.
+ */
+void vmR3ReqPreallocU(PUVM pUVM)
+{
+    PVMREQ apReqs[VMREQ_PREALLOCATED];
+    unsigned cReqs;
+    for (cReqs = 0; cReqs < RT_ELEMENTS(apReqs); cReqs++)
+        if (RT_FAILURE(VMR3ReqAlloc(pUVM, &apReqs[cReqs], VMREQTYPE_INTERNAL, VMCPUID_ANY)))
+            break;
+    while (cReqs-- > 0)
+        VMR3ReqFree(apReqs[cReqs]);
+}
+
+
+/**
+ * Initializes a request ring.
+ *
+ * @param   pRing           The ring.
+ */
+static void vmR3ReqRingInit(PVMREQRING pRing)
+{
+    pRing->iHead     = 0;
+    pRing->iTail     = 0;
+    pRing->cOverflow = 0;
+    for (uint32_t i = 0; i < RT_ELEMENTS(pRing->aSlots); i++)
+    {
+        pRing->aSlots[i].uSeq = i;
+        pRing->aSlots[i].pReq = NULL;
+    }
+}
+
+
+/**
+ * Sets up the request rings, which are located right after the UVM structure.
+ *
+ * @param   pUVM            Pointer to the user mode VM structure.  The
+ *                          allocation must be VM_UVM_ALLOC_SIZE(cCpus) bytes.
+ */
+void vmR3ReqInitRingsU(PUVM pUVM)
+{
+    PVMREQRING paRings = (PVMREQRING)((uint8_t *)pUVM + RT_ALIGN_Z(RT_UOFFSETOF_DYN(UVM, aCpus[pUVM->cCpus]), 64));
+    pUVM->vm.s.pPriorityRing = &paRings[0];
+    pUVM->vm.s.pNormalRing   = &paRings[1];
+    for (VMCPUID idCpu = 0; idCpu < pUVM->cCpus; idCpu++)
+    {
+        pUVM->aCpus[idCpu].vm.s.pPriorityRing = &paRings[2 + idCpu * 2];
+        pUVM->aCpus[idCpu].vm.s.pNormalRing   = &paRings[2 + idCpu * 2 + 1];
+    }
+    for (VMCPUID i = 0; i < (pUVM->cCpus + 1) * 2; i++)
+        vmR3ReqRingInit(&paRings[i]);
+}
+
+
+/**
+ * Adds a request to a ring.
+ *
+ * @returns true if queued, false if the ring is full.
+ * @param   pRing           The ring.
+ * @param   pReq            The request.
+ */
+static bool vmR3ReqRingPush(PVMREQRING pRing, PVMREQ pReq)
+{
+    uint32_t iHead = ASMAtomicReadU32(&pRing->iHead);
+    for (;;)
+    {
+        PVMREQRINGSLOT pSlot = &pRing->aSlots[iHead % VMREQRING_ENTRIES];
+        int32_t const iDiff = (int32_t)(ASMAtomicReadU32(&pSlot->uSeq) - iHead);
+        if (iDiff == 0)
+        {
+            /* The slot is free, try claim it. */
+            if (ASMAtomicCmpXchgExU32(&pRing->iHead, iHead + 1, iHead, &iHead))
+            {
+                ASMAtomicWritePtr(&pSlot->pReq, pReq);
+                ASMAtomicWriteU32(&pSlot->uSeq, iHead + 1);
+                return true;
+            }
+        }
+        else if (iDiff < 0)
+            return false; /* Still in use from the previous round, i.e. full. */
+        else
+            iHead = ASMAtomicReadU32(&pRing->iHead);
+    }
+}
+
+
+/**
+ * Takes the oldest request off a ring.
+ *
+ * @returns The request, NULL if the ring is empty.
+ * @param   pRing           The ring.
+ */
+PVMREQ vmR3ReqRingPop(PVMREQRING pRing)
+{
+    uint32_t iTail = ASMAtomicReadU32(&pRing->iTail);
+    for (;;)
+    {
+        PVMREQRINGSLOT pSlot = &pRing->aSlots[iTail % VMREQRING_ENTRIES];
+        int32_t const iDiff = (int32_t)(ASMAtomicReadU32(&pSlot->uSeq) - (iTail + 1));
+        if (iDiff == 0)
+        {
+            /* The slot has been filled, try claim it. */
+            if (ASMAtomicCmpXchgExU32(&pRing->iTail, iTail + 1, iTail, &iTail))
+            {
+                PVMREQ pReq = ASMAtomicReadPtrT(&pSlot->pReq, PVMREQ);
+                ASMAtomicWriteU32(&pSlot->uSeq, iTail + VMREQRING_ENTRIES);
+                return pReq;
+            }
+        }
+        else if (iDiff < 0)
+            return NULL; /* Empty, or the producer hasn't finished writing the slot. */
+        else
+            iTail = ASMAtomicReadU32(&pRing->iTail);
+    }
+}
+
+
+/**
+ * Inserts a request into a queue.
+ *
+ * The request goes into the ring unless it's full or the overflow list is in
+ * use.  Keeping away from the ring until the overflow has been completely
+ * drained keeps the processing order FIFO, as the overflow lists are only
+ * looked at after the ring has been emptied.  Note that the list head alone
+ * can't tell us this, it is briefly NULL while the consumer takes a request
+ * off the list, hence VMREQRING::cOverflow.
+ *
+ * @param   pUVM            Pointer to the user mode VM structure.
+ * @param   pRing           The ring.
+ * @param   ppOverflow      The overflow list head.
+ * @param   pReq            The request, state set to VMREQSTATE_QUEUED.
+ */
+static void vmR3ReqInsert(PUVM pUVM, PVMREQRING pRing, PVMREQ volatile *ppOverflow, PVMREQ pReq)
+{
+    if (   !ASMAtomicReadU32(&pRing->cOverflow)
+        && vmR3ReqRingPush(pRing, pReq))
+        return;
+
+    STAM_COUNTER_INC(&pUVM->vm.s.StatReqRingFull);
+    ASMAtomicIncU32(&pRing->cOverflow);
+    PVMREQ pNext;
+    do
+    {
+        pNext = ASMAtomicUoReadPtrT(ppOverflow, PVMREQ);
+        ASMAtomicWritePtr(&pReq->pNext, pNext);
+        ASMCompilerBarrier();
+    } while (!ASMAtomicCmpXchgPtr(ppOverflow, pReq, pNext));
+}
+
+
 /**
  * Queue a request.
  *
@@ -873,15 +1036,11 @@ VMMR3DECL(int) VMR3ReqQueue(PVMREQ pReq, RTMSINTERVAL cMillies)
         /*
          * Insert it.
          */
-        volatile PVMREQ *ppQueueHead = pReq->fFlags & VMREQFLAGS_PRIORITY ? &pUVCpu->vm.s.pPriorityReqs : &pUVCpu->vm.s.pNormalReqs;
         pReq->enmState = VMREQSTATE_QUEUED;
-        PVMREQ pNext;
-        do
-        {
-            pNext = ASMAtomicUoReadPtrT(ppQueueHead, PVMREQ);
-            ASMAtomicWritePtr(&pReq->pNext, pNext);
-            ASMCompilerBarrier();
-        } while (!ASMAtomicCmpXchgPtr(ppQueueHead, pReq, pNext));
+        if (fFlags & VMREQFLAGS_PRIORITY)
+            vmR3ReqInsert(pUVM, pUVCpu->vm.s.pPriorityRing, &pUVCpu->vm.s.pPriorityReqs, pReq);
+        else
+            vmR3ReqInsert(pUVM, pUVCpu->vm.s.pNormalRing, &pUVCpu->vm.s.pNormalReqs, pReq);
 
         /*
          * Notify EMT.
@@ -908,15 +1067,11 @@ VMMR3DECL(int) VMR3ReqQueue(PVMREQ pReq, RTMSINTERVAL cMillies)
         /*
          * Insert it.
          */
-        volatile PVMREQ *ppQueueHead = pReq->fFlags & VMREQFLAGS_PRIORITY ? &pUVM->vm.s.pPriorityReqs : &pUVM->vm.s.pNormalReqs;
         pReq->enmState = VMREQSTATE_QUEUED;
-        PVMREQ pNext;
-        do
-        {
-            pNext = ASMAtomicUoReadPtrT(ppQueueHead, PVMREQ);
-            ASMAtomicWritePtr(&pReq->pNext, pNext);
-            ASMCompilerBarrier();
-        } while (!ASMAtomicCmpXchgPtr(ppQueueHead, pReq, pNext));
+        if (fFlags & VMREQFLAGS_PRIORITY)
+            vmR3ReqInsert(pUVM, pUVM->vm.s.pPriorityRing, &pUVM->vm.s.pPriorityReqs, pReq);
+        else
+            vmR3ReqInsert(pUVM, pUVM->vm.s.pNormalRing, &pUVM->vm.s.pNormalReqs, pReq);
 
         /*
          * Notify EMT.
@@ -1030,7 +1185,7 @@ DECLINLINE(void) vmR3ReqSetFF(PUVM pUVM, VMCPUID idDstCpu)
 
 /**
  * VMR3ReqProcessU helper that handles cases where there are more than one
- * pending request.
+ * request on an overflow list.
  *
  * @returns The oldest request.
  * @param   pUVM                Pointer to the user mode VM structure
@@ -1081,6 +1236,31 @@ static PVMREQ vmR3ReqProcessUTooManyHelper(PUVM pUVM, VMCPUID idDstCpu, PVMREQ p
 }
 
 
+/**
+ * Takes the oldest request off an overflow list.
+ *
+ * @returns The request, NULL if the list is empty.
+ * @param   pUVM                Pointer to the user mode VM structure
+ * @param   idDstCpu            VMCPUID_ANY or virtual CPU ID.
+ * @param   pRing               The ring the overflow list belongs to.
+ * @param   ppReqs              Pointer to the list head.
+ */
+DECLINLINE(PVMREQ) vmR3ReqPopOverflow(PUVM pUVM, VMCPUID idDstCpu, PVMREQRING pRing, PVMREQ volatile *ppReqs)
+{
+    if (RT_LIKELY(!ASMAtomicUoReadPtrT(ppReqs, PVMREQ)))
+        return NULL;
+    PVMREQ pReq = ASMAtomicXchgPtrT(ppReqs, NULL, PVMREQ);
+    if (pReq)
+    {
+        if (RT_UNLIKELY(pReq->pNext))
+            pReq = vmR3ReqProcessUTooManyHelper(pUVM, idDstCpu, pReq, ppReqs);
+        /* Only now that the remainder is back on the list may producers use the ring again. */
+        ASMAtomicDecU32(&pRing->cOverflow);
+    }
+    return pReq;
+}
+
+
 /**
  * Process pending request(s).
  *
@@ -1108,19 +1288,38 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
     /*
      * Determine which queues to process.
      */
+    PVMREQRING       pPriorityRing;
+    PVMREQRING       pNormalRing;
     PVMREQ volatile *ppNormalReqs;
     PVMREQ volatile *ppPriorityReqs;
     if (idDstCpu == VMCPUID_ANY)
     {
+        pPriorityRing  = pUVM->vm.s.pPriorityRing;
+        pNormalRing    = pUVM->vm.s.pNormalRing;
         ppPriorityReqs = &pUVM->vm.s.pPriorityReqs;
-        ppNormalReqs   = !fPriorityOnly ? &pUVM->vm.s.pNormalReqs                 : ppPriorityReqs;
+        ppNormalReqs   = &pUVM->vm.s.pNormalReqs;
     }
     else
     {
         Assert(idDstCpu < pUVM->cCpus);
         Assert(pUVM->aCpus[idDstCpu].vm.s.NativeThreadEMT == RTThreadNativeSelf());
+        pPriorityRing  = pUVM->aCpus[idDstCpu].vm.s.pPriorityRing;
+        pNormalRing    = pUVM->aCpus[idDstCpu].vm.s.pNormalRing;
         ppPriorityReqs = &pUVM->aCpus[idDstCpu].vm.s.pPriorityReqs;
-        ppNormalReqs   = !fPriorityOnly ? &pUVM->aCpus[idDstCpu].vm.s.pNormalReqs : ppPriorityReqs;
+        ppNormalReqs   = &pUVM->aCpus[idDstCpu].vm.s.pNormalReqs;
+    }
+
+    /*
+     * Clear the FF before looking at the queues.  Producers set it after
+     * queuing, so nothing can slip thru and we can process the whole batch
+     * without touching it again.
+     */
+    if (RT_LIKELY(pUVM->pVM))
+    {
+        if (idDstCpu == VMCPUID_ANY)
+            VM_FF_CLEAR(pUVM->pVM, VM_FF_REQUEST);
+        else
+            VMCPU_FF_CLEAR(&pUVM->pVM->aCpus[idDstCpu], VMCPU_FF_REQUEST);
     }
 
     /*
@@ -1133,35 +1332,22 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
     for (;;)
     {
         /*
-         * Get the pending requests.
-         *
-         * If there are more than one request, unlink the oldest and put the
-         * rest back so that we're reentrant.
+         * Get the oldest pending request, priority ones first.  The rings are
+         * drained before the overflow lists since the latter only receive
+         * requests while the ring is full.  Requests are taken one at a time
+         * so we're reentrant.
          */
-        if (RT_LIKELY(pUVM->pVM))
+        PVMREQ pReq = vmR3ReqRingPop(pPriorityRing);
+        if (!pReq)
+            pReq = vmR3ReqPopOverflow(pUVM, idDstCpu, pPriorityRing, ppPriorityReqs);
+        if (!pReq && !fPriorityOnly)
         {
-            if (idDstCpu == VMCPUID_ANY)
-                VM_FF_CLEAR(pUVM->pVM, VM_FF_REQUEST);
-            else
-                VMCPU_FF_CLEAR(&pUVM->pVM->aCpus[idDstCpu], VMCPU_FF_REQUEST);
-        }
-
-        PVMREQ pReq = ASMAtomicXchgPtrT(ppPriorityReqs, NULL, PVMREQ);
-        if (pReq)
-        {
-            if (RT_UNLIKELY(pReq->pNext))
-                pReq = vmR3ReqProcessUTooManyHelper(pUVM, idDstCpu, pReq, ppPriorityReqs);
-            else if (ASMAtomicReadPtrT(ppNormalReqs, PVMREQ))
-                vmR3ReqSetFF(pUVM, idDstCpu);
-        }
-        else
-        {
-            pReq = ASMAtomicXchgPtrT(ppNormalReqs, NULL, PVMREQ);
+            pReq = vmR3ReqRingPop(pNormalRing);
             if (!pReq)
-                break;
-            if (RT_UNLIKELY(pReq->pNext))
-                pReq = vmR3ReqProcessUTooManyHelper(pUVM, idDstCpu, pReq, ppNormalReqs);
+                pReq = vmR3ReqPopOverflow(pUVM, idDstCpu, pNormalRing, ppNormalReqs);
         }
+        if (!pReq)
+            break;
 
         /*
          * Process the request
@@ -1176,6 +1362,19 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
         }
     }
 
+    /*
+     * Make sure we're called again if we're leaving requests behind.
+     */
+    if (   rc != VINF_SUCCESS
+        || fPriorityOnly)
+    {
+        if (   !VMREQRING_IS_EMPTY(pPriorityRing)
+            || !VMREQRING_IS_EMPTY(pNormalRing)
+            || *ppPriorityReqs
+            || *ppNormalReqs)
+            vmR3ReqSetFF(pUVM, idDstCpu);
+    }
+
     LogFlow(("VMR3ReqProcess: returns %Rrc (enmVMState=%d)\n", rc, pUVM->pVM ? pUVM->pVM->enmVMState : VMSTATE_CREATING));
     return rc;
 }
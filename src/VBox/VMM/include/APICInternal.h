@@ -213,6 +213,10 @@
 #define X2APIC_LDR_GET_CLUSTER_ID(a_uReg)    ((a_uReg) & X2APIC_LDR_CLUSTER_ID)
 /** LDR - Mask of the LDR logical ID (x2APIC). */
 #define X2APIC_LDR_LOGICAL_ID                UINT32_C(0x0000ffff)
+/** LDR - Derives the logical ID from the x2APIC ID (x2APIC).
+ *  See Intel spec. 10.12.10.2 "Deriving Logical x2APIC ID from the Local x2APIC ID". */
+#define X2APIC_LDR_FROM_ID(a_uApicId)        (  (((a_uApicId) & UINT32_C(0xffff0)) << 12) \
+                                              | (UINT32_C(1) << ((a_uApicId) & UINT32_C(0xf))) )
 
 /** LDR - Flat mode logical ID mask. */
 #define XAPIC_LDR_FLAT_LOGICAL_ID            UINT32_C(0xff)
@@ -1228,6 +1232,14 @@ typedef struct APIC
     /** Alignment padding. */
     uint32_t                    u32Alignment1;
     /** @} */
+
+    /** @name x2APIC destination map.
+     * @{ */
+    /** Bitmap indexed by VCPU ID of the APICs that are in x2APIC mode with the
+     *  LDR derived from their x2APIC ID, see apicUpdateX2ApicDestMap(). Lets the
+     *  ICR fast path resolve a logical destination without querying each APIC. */
+    uint64_t volatile           u64X2ApicDestMap;
+    /** @} */
 } APIC;
 /** Pointer to APIC VM instance data. */
 typedef APIC *PAPIC;
@@ -1236,6 +1248,7 @@ typedef APIC const *PCAPIC;
 AssertCompileMemberAlignment(APIC, cbApicPib, 8);
 AssertCompileMemberAlignment(APIC, fVirtApicRegsEnabled, 8);
 AssertCompileMemberAlignment(APIC, enmMaxMode, 8);
+AssertCompileMemberAlignment(APIC, u64X2ApicDestMap, 8);
 AssertCompileSizeAlignment(APIC, 8);
 
 /**
@@ -1379,6 +1392,14 @@ typedef struct APICCPU
     STAMCOUNTER                 StatIcrHiWrite;
     /** Number of times the full ICR (x2APIC send IPI) is written. */
     STAMCOUNTER                 StatIcrFullWrite;
+    /** Number of x2APIC ICR writes handled by the fast path. */
+    STAMCOUNTER                 StatIcrFastPath;
+    /** Number of IPIs posted by the x2APIC ICR fast path (divide by
+     *  StatIcrFastPath for the IPIs per exit). */
+    STAMCOUNTER                 StatIcrFastPathIpis;
+    /** Number of target EMTs woken up or poked in a batch by the x2APIC ICR
+     *  fast path. */
+    STAMCOUNTER                 StatIcrFastPathNotify;
     /** @} */
 #endif
 } APICCPU;
@@ -1458,6 +1479,7 @@ VMM_INT_DECL(void)            apicSetInterruptFF(PVMCPU pVCpu, PDMAPICIRQ enmTyp
 VMM_INT_DECL(void)            apicClearInterruptFF(PVMCPU pVCpu, PDMAPICIRQ enmType);
 void                          apicInitIpi(PVMCPU pVCpu);
 void                          apicResetCpu(PVMCPU pVCpu, bool fResetApicBaseMsr);
+void                          apicUpdateX2ApicDestMap(PVMCPU pVCpu);
 
 RT_C_DECLS_END
 
@@ -29,6 +29,7 @@
 #include <iprt/avl.h>
 #include <iprt/dbg.h>
 #include <VBox/vmm/dbgf.h>
+#include <VBox/vmm/dbgftrace.h>
 
 
 
@@ -352,6 +353,31 @@ typedef enum DBGFEVENTSTATE
 } DBGFEVENTSTATE;
 
 
+/**
+ * Binary event trace ring of a VCPU, see @ref grp_dbgf_traceevt.
+ *
+ * Only the EMT of the VCPU writes to the ring.  Readers copy the records out
+ * and use iNext to tell which of them may have been overwritten meanwhile.
+ */
+typedef struct DBGFTRACEEVTRING
+{
+    /** The number of records ever written, the next one goes into
+     * aRecs[iNext & fMask]. */
+    uint64_t volatile           iNext;
+    /** The number of records in the ring (power of two). */
+    uint32_t                    cRecs;
+    /** The index mask (cRecs - 1). */
+    uint32_t                    fMask;
+    /** Padding so the records are cache line aligned. */
+    uint8_t                     abPadding[48];
+    /** The records. */
+    DBGFTRACEEVTREC             aRecs[1];
+} DBGFTRACEEVTRING;
+AssertCompileMemberAlignment(DBGFTRACEEVTRING, aRecs, 64);
+/** Pointer to a binary event trace ring. */
+typedef DBGFTRACEEVTRING *PDBGFTRACEEVTRING;
+
+
 /** Converts a DBGFCPU pointer into a VM pointer. */
 #define DBGFCPU_2_VM(pDbgfCpu) ((PVM)((uint8_t *)(pDbgfCpu) + (pDbgfCpu)->offVM))
 
@@ -20,8 +20,10 @@
 
 #include <VBox/vmm/cpum.h>
 #include <VBox/vmm/iem.h>
+#include <VBox/vmm/pgm.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/param.h>
+#include <iprt/critsect.h>
 
 #include <setjmp.h>
 
@@ -351,6 +353,127 @@ AssertCompileSizeAlignment(IEMTLB, 64);
 #define IEMTLB_PHYS_REV_INCR    RT_BIT_64(8)
 
 
+/** @name Opcode page cache
+ *
+ * Without the code TLB every instruction executed by IEMExecLots starts out
+ * with an empty opcode buffer, so the opcode bytes are fetched by a guest page
+ * table walk followed by a PGMPhysRead (ram range lookup, access handler
+ * checks, mapping) per instruction.  The opcode page cache keeps a copy of
+ * recently executed guest pages in ring-3, indexed by guest physical address,
+ * and a per-VCPU hint remembering the last linear page translation.  Hot
+ * loops are thus fetched by a memcpy.
+ *
+ * The pages are kept coherent by a PGM write access handler on each cached
+ * page.  The first write marks the cache page stale and turns off the
+ * monitoring of that page (PGMHandlerPhysicalPageTempOff) so the guest can
+ * write on at full speed; the monitoring is re-armed when the page is fetched
+ * again.  Pages that keep being written to (code and data sharing a page, self
+ * modifying code) are given up on after IEM_OPCODE_CACHE_MAX_WRITES rounds.
+ *
+ * Note that only writes going thru PGM's access handler machinery are seen.
+ * Ring-3 code writing guest memory via a PGMPhysGCPhys2CCPtr mapping (or
+ * similar direct mappings) bypasses the handler and will not invalidate the
+ * cache; such writers must not target pages guest code is executed from, or
+ * must use PGMPhysWrite instead.
+ *
+ * Readers don't take any locks, instead each cache page has a sequence
+ * number which is odd while the page is being filled and incremented on
+ * every invalidation.  A reader copies the opcode bytes and then checks that
+ * the sequence number is still what it was when the hint was set up.
+ *
+ * @{ */
+/** The default number of pages in the opcode page cache (power of two). */
+#define IEM_OPCODE_CACHE_DEF_PAGES      64
+/** The max number of pages in the opcode page cache. */
+#define IEM_OPCODE_CACHE_MAX_PAGES      1024
+/** The number of write invalidation rounds after which a page is no longer
+ *  cached (until the cache slot is reused). */
+#define IEM_OPCODE_CACHE_MAX_WRITES     8
+
+/**
+ * An opcode cache page.
+ */
+typedef struct IEMOPCODECACHEPAGE
+{
+    /** Sequence number, odd while being filled.  Incremented by two on
+     * invalidation. */
+    uint32_t volatile       uSeq;
+    /** The number of times the page was written to since it was first
+     * cached in this slot. */
+    uint32_t volatile       cWrites;
+    /** The guest physical address of the page, NIL_RTGCPHYS if free. */
+    RTGCPHYS                GCPhys;
+    /** Set when the content no longer reflects guest memory. */
+    bool volatile           fStale;
+    /** Whether we've registered a write handler for GCPhys. */
+    bool                    fMonitored;
+    /** Explicit alignment padding. */
+    bool                    afPadding[6];
+    /** The page content. */
+    uint8_t                 abPage[PAGE_SIZE];
+} IEMOPCODECACHEPAGE;
+/** Pointer to an opcode cache page. */
+typedef IEMOPCODECACHEPAGE *PIEMOPCODECACHEPAGE;
+
+/**
+ * Per-VCPU opcode cache hint, caching the translation of the last linear
+ * code page.
+ */
+typedef struct IEMOPCODECACHEHINT
+{
+    /** The linear address of the page, NIL_RTGCPTR if invalid. */
+    RTGCPTR                 GCPtrPage;
+    /** The cache page, NULL if the page can't be cached. */
+    PIEMOPCODECACHEPAGE     pPage;
+    /** The IEMCPU::uOpcodeCacheRev value this hint is valid for. */
+    uint32_t                uRev;
+    /** The IEMOPCODECACHEPAGE::uSeq value this hint is valid for. */
+    uint32_t                uSeq;
+    /** Whether the page is user accessible (X86_PTE_US). */
+    bool                    fUser;
+    /** Whether the page is marked no-execute (X86_PTE_PAE_NX). */
+    bool                    fNoExec;
+    /** Explicit alignment padding. */
+    bool                    afPadding[6];
+    /** Hint hits (no page walk needed). */
+    STAMCOUNTER             StatHintHits;
+    /** Hint misses requiring a page walk and cache lookup. */
+    STAMCOUNTER             StatLookups;
+    /** Cache pages filled (or refilled) from guest memory. */
+    STAMCOUNTER             StatFills;
+    /** Lookups of pages that can't be cached. */
+    STAMCOUNTER             StatUncachable;
+} IEMOPCODECACHEHINT;
+/** Pointer to an opcode cache hint. */
+typedef IEMOPCODECACHEHINT *PIEMOPCODECACHEHINT;
+
+/**
+ * The ring-3 opcode page cache, shared by all VCPUs.
+ */
+typedef struct IEMOPCODECACHE
+{
+    /** Serializes filling and evicting pages. */
+    RTCRITSECT              CritSect;
+    /** The write handler type. */
+    PGMPHYSHANDLERTYPE      hWriteHandlerType;
+    /** The number of pages (power of two). */
+    uint32_t                cPages;
+    /** The pages. */
+    PIEMOPCODECACHEPAGE     paPages;
+    /** Pages invalidated by guest writes. */
+    STAMCOUNTER             StatWriteInvalidations;
+    /** Pages evicted to make room for others. */
+    STAMCOUNTER             StatEvictions;
+    /** Full cache flushes. */
+    STAMCOUNTER             StatFlushes;
+    /** Per-VCPU hints (VM::cCpus). */
+    IEMOPCODECACHEHINT      aHints[1];
+} IEMOPCODECACHE;
+/** Pointer to the opcode page cache. */
+typedef IEMOPCODECACHE *PIEMOPCODECACHE;
+/** @} */
+
+
 /**
  * The per-CPU IEM state.
  */
@@ -621,6 +744,14 @@ typedef struct IEMCPU
     R3PTRTYPE(PIEMINSTRSTATS) pStatsCCR3;
     /** Pointer to instruction statistics for ring-3 context. */
     R3PTRTYPE(PIEMINSTRSTATS) pStatsR3;
+
+    /** Pointer to the opcode page cache (shared by all VCPUs), NULL if disabled. */
+    R3PTRTYPE(PIEMOPCODECACHE) pOpcodeCacheR3;
+    /** The opcode cache hint revision.  Incremented whenever the linear to
+     * physical translation of code may have changed. */
+    uint32_t                uOpcodeCacheRev;
+    /** Alignment padding. */
+    uint32_t                u32OpcodeCachePadding;
 } IEMCPU;
 AssertCompileMemberOffset(IEMCPU, fCurXcpt, 0x48);
 AssertCompileMemberAlignment(IEMCPU, DataTlb, 64);
@@ -1892,6 +2023,11 @@ typedef IEMOPMEDIAF1H1 const *PCIEMOPMEDIAF1H1;
 /** @}  */
 
 
+#ifdef IN_RING3
+bool                iemR3OpcodeCacheLookup(PVMCPU pVCpu, PIEMOPCODECACHE pCache, PIEMOPCODECACHEHINT pHint, RTGCPTR GCPtrPage);
+void                iemR3OpcodeCacheFlush(PVM pVM);
+#endif
+
 /** @} */
 
 RT_C_DECLS_END
@@ -55,6 +55,162 @@ DECLINLINE(PIOMIOPORTRANGER3) iomIOPortGetRangeR3(PVM pVM, RTIOPORT Port)
 }
 
 
+/**
+ * Flushes the range caches of the current context if the range table has
+ * changed since they were filled.
+ *
+ * @param   pVM     The cross context VM structure.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ *
+ * @remarks The caller owns the IOM lock (shared is sufficient), so the
+ *          generation cannot change while the caches are being refilled.
+ */
+DECLINLINE(void) iomRangeCacheSync(PVM pVM, PVMCPU pVCpu)
+{
+    Assert(IOM_IS_SHARED_LOCK_OWNER(pVM));
+    uint32_t const uGen = ASMAtomicUoReadU32(&pVM->iom.s.uRangeGen);
+    if (RT_LIKELY(pVCpu->iom.s.CTX_SUFF(uRangeCacheGen) == uGen))
+    { /* likely */ }
+    else
+    {
+        for (unsigned i = 0; i < IOM_RANGE_CACHE_ENTRIES; i++)
+        {
+            pVCpu->iom.s.CTX_SUFF(apIOPortRangeCache)[i] = 0;
+            pVCpu->iom.s.CTX_SUFF(apMMIORangeCache)[i]   = 0;
+        }
+        pVCpu->iom.s.CTX_SUFF(uRangeCacheGen) = uGen;
+    }
+}
+
+
+/**
+ * Gets the range cache set for an I/O port.
+ *
+ * @returns Index of the first entry of the set.
+ * @param   Port    The I/O port.
+ */
+DECLINLINE(unsigned) iomIOPortCacheSet(RTIOPORT Port)
+{
+    return (((unsigned)Port >> 3) ^ ((unsigned)Port >> 8)) % IOM_RANGE_CACHE_SETS * IOM_RANGE_CACHE_WAYS;
+}
+
+
+/**
+ * Looks up an I/O port in the range cache of the current context.
+ *
+ * This doesn't check the generation, that's up to the caller.
+ *
+ * @returns Pointer to I/O port range, NULL if not cached.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ * @param   Port    The I/O port to lookup.
+ */
+DECLINLINE(CTX_SUFF(PIOMIOPORTRANGE)) iomIOPortCacheLookup(PVMCPU pVCpu, RTIOPORT Port)
+{
+    CTX_SUFF(PIOMIOPORTRANGE) *papSet = &pVCpu->iom.s.CTX_SUFF(apIOPortRangeCache)[iomIOPortCacheSet(Port)];
+    for (unsigned iWay = 0; iWay < IOM_RANGE_CACHE_WAYS; iWay++)
+    {
+        CTX_SUFF(PIOMIOPORTRANGE) pRange = papSet[iWay];
+        if (   pRange
+            && (unsigned)Port - (unsigned)pRange->Port < (unsigned)pRange->cPorts)
+        {
+            if (iWay)
+            {
+                papSet[iWay] = papSet[0];
+                papSet[0]    = pRange;
+            }
+            return pRange;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Gets the I/O port range for the specified I/O port in the current context,
+ * consulting the range cache first.
+ *
+ * @returns Pointer to I/O port range.
+ * @returns NULL if no port registered.
+ *
+ * @param   pVM     The cross context VM structure.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ * @param   Port    The I/O port lookup.
+ */
+DECLINLINE(CTX_SUFF(PIOMIOPORTRANGE)) iomIOPortGetRangeCached(PVM pVM, PVMCPU pVCpu, RTIOPORT Port)
+{
+    iomRangeCacheSync(pVM, pVCpu);
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = iomIOPortCacheLookup(pVCpu, Port);
+    if (pRange)
+        STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatIOPortCacheHits);
+    else
+    {
+        STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatIOPortCacheMisses);
+        pRange = iomIOPortGetRange(pVM, Port);
+        if (pRange)
+        {
+            CTX_SUFF(PIOMIOPORTRANGE) *papSet = &pVCpu->iom.s.CTX_SUFF(apIOPortRangeCache)[iomIOPortCacheSet(Port)];
+            for (unsigned iWay = IOM_RANGE_CACHE_WAYS - 1; iWay > 0; iWay--)
+                papSet[iWay] = papSet[iWay - 1];
+            papSet[0] = pRange;
+        }
+    }
+    return pRange;
+}
+
+
+/**
+ * Looks up the I/O port range without taking the IOM lock.
+ *
+ * Only ranges in the range cache of the current context are found.  Whatever
+ * the caller needs from the range must be copied out and then validated by
+ * calling iomRangeGenIsCurrent with the returned generation, as the range may
+ * be changed or freed at any time.
+ *
+ * @returns Pointer to I/O port range, NULL if not found in the cache.
+ * @param   pVM     The cross context VM structure.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ * @param   Port    The I/O port to lookup.
+ * @param   puGen   Where to return the range table generation.
+ */
+DECLINLINE(CTX_SUFF(PIOMIOPORTRANGE)) iomIOPortGetRangeLockFree(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32_t *puGen)
+{
+    uint32_t const uGen = ASMAtomicReadU32(&pVM->iom.s.uRangeGen);
+    if (pVCpu->iom.s.CTX_SUFF(uRangeCacheGen) == uGen)
+    {
+        *puGen = uGen;
+        return iomIOPortCacheLookup(pVCpu, Port);
+    }
+    return NULL;
+}
+
+
+/**
+ * Checks that the range table hasn't changed since iomIOPortGetRangeLockFree.
+ *
+ * @returns true if the range data read is good, false if the caller must take
+ *          the slow path.
+ * @param   pVM     The cross context VM structure.
+ * @param   uGen    The generation returned by iomIOPortGetRangeLockFree.
+ */
+DECLINLINE(bool) iomRangeGenIsCurrent(PVM pVM, uint32_t uGen)
+{
+    ASMReadFence();
+    return ASMAtomicReadU32(&pVM->iom.s.uRangeGen) == uGen;
+}
+
+
+/**
+ * Gets the range cache set for a physical address.
+ *
+ * @returns Index of the first entry of the set.
+ * @param   GCPhys  The physical address.
+ */
+DECLINLINE(unsigned) iomMmioCacheSet(RTGCPHYS GCPhys)
+{
+    return (unsigned)((GCPhys >> PAGE_SHIFT) ^ (GCPhys >> 20)) % IOM_RANGE_CACHE_SETS * IOM_RANGE_CACHE_WAYS;
+}
+
+
 /**
  * Gets the MMIO range for the specified physical address in the current context.
  *
@@ -67,12 +223,33 @@ DECLINLINE(PIOMIOPORTRANGER3) iomIOPortGetRangeR3(PVM pVM, RTIOPORT Port)
  */
 DECLINLINE(PIOMMMIORANGE) iomMmioGetRange(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys)
 {
-    Assert(IOM_IS_SHARED_LOCK_OWNER(pVM));
-    PIOMMMIORANGE pRange = pVCpu->iom.s.CTX_SUFF(pMMIORangeLast);
-    if (    !pRange
-        ||  GCPhys - pRange->GCPhys >= pRange->cb)
-        pVCpu->iom.s.CTX_SUFF(pMMIORangeLast) = pRange
-            = (PIOMMMIORANGE)RTAvlroGCPhysRangeGet(&pVM->iom.s.CTX_SUFF(pTrees)->MMIOTree, GCPhys);
+    iomRangeCacheSync(pVM, pVCpu);
+
+    PIOMMMIORANGE *papSet = &pVCpu->iom.s.CTX_SUFF(apMMIORangeCache)[iomMmioCacheSet(GCPhys)];
+    for (unsigned iWay = 0; iWay < IOM_RANGE_CACHE_WAYS; iWay++)
+    {
+        PIOMMMIORANGE pRange = papSet[iWay];
+        if (   pRange
+            && GCPhys - pRange->GCPhys < pRange->cb)
+        {
+            if (iWay)
+            {
+                papSet[iWay] = papSet[0];
+                papSet[0]    = pRange;
+            }
+            STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatMMIOCacheHits);
+            return pRange;
+        }
+    }
+
+    STAM_REL_COUNTER_INC(&pVCpu->iom.s.StatMMIOCacheMisses);
+    PIOMMMIORANGE pRange = (PIOMMMIORANGE)RTAvlroGCPhysRangeGet(&pVM->iom.s.CTX_SUFF(pTrees)->MMIOTree, GCPhys);
+    if (pRange)
+    {
+        for (unsigned iWay = IOM_RANGE_CACHE_WAYS - 1; iWay > 0; iWay--)
+            papSet[iWay] = papSet[iWay - 1];
+        papSet[0] = pRange;
+    }
     return pRange;
 }
 
@@ -106,11 +283,7 @@ DECLINLINE(PIOMMMIORANGE) iomMmioGetRangeWithRef(PVM pVM, PVMCPU pVCpu, RTGCPHYS
     int rc = IOM_LOCK_SHARED_EX(pVM, VINF_SUCCESS);
     AssertRCReturn(rc, NULL);
 
-    PIOMMMIORANGE pRange = pVCpu->iom.s.CTX_SUFF(pMMIORangeLast);
-    if (   !pRange
-        || GCPhys - pRange->GCPhys >= pRange->cb)
-        pVCpu->iom.s.CTX_SUFF(pMMIORangeLast) = pRange
-            = (PIOMMMIORANGE)RTAvlroGCPhysRangeGet(&pVM->iom.s.CTX_SUFF(pTrees)->MMIOTree, GCPhys);
+    PIOMMMIORANGE pRange = iomMmioGetRange(pVM, pVCpu, GCPhys);
     if (pRange)
         iomMmioRetainRange(pRange);
 
@@ -146,12 +319,9 @@ DECLINLINE(void) iomMmioReleaseRange(PVM pVM, PIOMMMIORANGE pRange)
  */
 DECLINLINE(PIOMMMIORANGE) iomMMIOGetRangeUnsafe(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys)
 {
-    PIOMMMIORANGE pRange = pVCpu->iom.s.CTX_SUFF(pMMIORangeLast);
-    if (    !pRange
-        ||  GCPhys - pRange->GCPhys >= pRange->cb)
-        pVCpu->iom.s.CTX_SUFF(pMMIORangeLast) = pRange
-            = (PIOMMMIORANGE)RTAvlroGCPhysRangeGet(&pVM->iom.s.CTX_SUFF(pTrees)->MMIOTree, GCPhys);
-    return pRange;
+    /* Not using the range cache here as it's only to be touched while owning the lock. */
+    RT_NOREF_PV(pVCpu);
+    return (PIOMMMIORANGE)RTAvlroGCPhysRangeGet(&pVM->iom.s.CTX_SUFF(pTrees)->MMIOTree, GCPhys);
 }
 #endif /* VBOX_STRICT */
 
@@ -324,7 +324,10 @@ typedef struct IOM
 
     /** MMIO physical access handler type.   */
     PGMPHYSHANDLERTYPE              hMmioHandlerType;
-    uint32_t                        u32Padding;
+    /** The range table generation.  Incremented (while owning the lock
+     * exclusively) before I/O port or MMIO ranges are changed or freed, which
+     * invalidates the per-VCPU range caches, see IOMCPU::apIOPortRangeCacheR3. */
+    uint32_t volatile               uRangeGen;
 
     /** Lock serializing EMT access to IOM. */
 #ifdef IOM_WITH_CRIT_SECT_RW
@@ -379,6 +382,17 @@ typedef struct IOM
 typedef IOM *PIOM;
 
 
+/** @name Per-VCPU range cache geometry.
+ * @{ */
+/** The number of sets in the per-VCPU range caches (power of two). */
+#define IOM_RANGE_CACHE_SETS            4
+/** The number of entries per set in the per-VCPU range caches. */
+#define IOM_RANGE_CACHE_WAYS            2
+/** The total number of entries in a per-VCPU range cache. */
+#define IOM_RANGE_CACHE_ENTRIES         (IOM_RANGE_CACHE_SETS * IOM_RANGE_CACHE_WAYS)
+/** @} */
+
+
 /**
  * IOM per virtual CPU instance data.
  */
@@ -427,30 +441,56 @@ typedef struct IOMCPU
         uint32_t                        uAlignmentPadding;
     } PendingMmioWrite;
 
-    /** @name Caching of I/O Port and MMIO ranges and statistics.
-     * (Saves quite some time in rep outs/ins instruction emulation.)
+    /** @name Caching of I/O Port and MMIO statistics.
      * @{ */
-    R3PTRTYPE(PIOMIOPORTRANGER3)    pRangeLastReadR3;
-    R3PTRTYPE(PIOMIOPORTRANGER3)    pRangeLastWriteR3;
     R3PTRTYPE(PIOMIOPORTSTATS)      pStatsLastReadR3;
     R3PTRTYPE(PIOMIOPORTSTATS)      pStatsLastWriteR3;
-    R3PTRTYPE(PIOMMMIORANGE)        pMMIORangeLastR3;
     R3PTRTYPE(PIOMMMIOSTATS)        pMMIOStatsLastR3;
 
-    R0PTRTYPE(PIOMIOPORTRANGER0)    pRangeLastReadR0;
-    R0PTRTYPE(PIOMIOPORTRANGER0)    pRangeLastWriteR0;
     R0PTRTYPE(PIOMIOPORTSTATS)      pStatsLastReadR0;
     R0PTRTYPE(PIOMIOPORTSTATS)      pStatsLastWriteR0;
-    R0PTRTYPE(PIOMMMIORANGE)        pMMIORangeLastR0;
     R0PTRTYPE(PIOMMMIOSTATS)        pMMIOStatsLastR0;
 
-    RCPTRTYPE(PIOMIOPORTRANGERC)    pRangeLastReadRC;
-    RCPTRTYPE(PIOMIOPORTRANGERC)    pRangeLastWriteRC;
     RCPTRTYPE(PIOMIOPORTSTATS)      pStatsLastReadRC;
     RCPTRTYPE(PIOMIOPORTSTATS)      pStatsLastWriteRC;
-    RCPTRTYPE(PIOMMMIORANGE)        pMMIORangeLastRC;
     RCPTRTYPE(PIOMMMIOSTATS)        pMMIOStatsLastRC;
     /** @} */
+
+    /** @name Caching of I/O port and MMIO ranges.
+     *
+     * Small set-associative caches of recently used ranges for each context,
+     * indexed by set * IOM_RANGE_CACHE_WAYS + way with way 0 being the most
+     * recently used entry of a set.  Only the owning EMT accesses these.  The
+     * entries of a context are only valid while uRangeCacheGen of that context
+     * equals IOM::uRangeGen, which allows I/O port lookups without taking the
+     * IOM lock: the generation is re-checked after the needed bits have been
+     * copied out of the range.
+     * @{ */
+    R3PTRTYPE(PIOMIOPORTRANGER3)    apIOPortRangeCacheR3[IOM_RANGE_CACHE_ENTRIES];
+    R3PTRTYPE(PIOMMMIORANGE)        apMMIORangeCacheR3[IOM_RANGE_CACHE_ENTRIES];
+    R0PTRTYPE(PIOMIOPORTRANGER0)    apIOPortRangeCacheR0[IOM_RANGE_CACHE_ENTRIES];
+    R0PTRTYPE(PIOMMMIORANGE)        apMMIORangeCacheR0[IOM_RANGE_CACHE_ENTRIES];
+    RCPTRTYPE(PIOMIOPORTRANGERC)    apIOPortRangeCacheRC[IOM_RANGE_CACHE_ENTRIES];
+    RCPTRTYPE(PIOMMMIORANGE)        apMMIORangeCacheRC[IOM_RANGE_CACHE_ENTRIES];
+    /** The IOM::uRangeGen value the ring-3 cache entries are valid for. */
+    uint32_t                        uRangeCacheGenR3;
+    /** The IOM::uRangeGen value the ring-0 cache entries are valid for. */
+    uint32_t                        uRangeCacheGenR0;
+    /** The IOM::uRangeGen value the raw-mode cache entries are valid for. */
+    uint32_t                        uRangeCacheGenRC;
+    /** Alignment padding. */
+    uint32_t                        u32RangeCachePadding;
+    /** I/O port range cache hits. */
+    STAMCOUNTER                     StatIOPortCacheHits;
+    /** I/O port range cache misses (tree lookups). */
+    STAMCOUNTER                     StatIOPortCacheMisses;
+    /** I/O port accesses dispatched without taking the IOM lock. */
+    STAMCOUNTER                     StatIOPortLockFree;
+    /** MMIO range cache hits. */
+    STAMCOUNTER                     StatMMIOCacheHits;
+    /** MMIO range cache misses (tree lookups). */
+    STAMCOUNTER                     StatMMIOCacheMisses;
+    /** @} */
 } IOMCPU;
 /** Pointer to IOM per virtual CPU instance data. */
 typedef IOMCPU *PIOMCPU;
@@ -28,6 +28,9 @@
 #include <iprt/nt/hyperv.h>
 #include <iprt/critsect.h>
 #endif
+#ifdef RT_OS_LINUX
+#include <iprt/critsect.h>
+#endif
 
 RT_C_DECLS_BEGIN
 
@@ -100,6 +103,79 @@ typedef struct NEMWINIOCTL
 #endif /* RT_OS_WINDOWS */
 
 
+#ifdef RT_OS_LINUX
+/*
+ * Linux: Code configuration.
+ */
+/** Linux: The largest memory slot we create, in pages.  Slots never cross a
+ *  boundary of this size so they can be (re)established one window at a time. */
+# define NEM_LNX_MAX_SLOT_PAGES         512
+/** Linux: Maximum number of guest RAM and ROM ranges to pre-map. */
+# define NEM_LNX_MAX_PREMAP_RANGES      16
+
+/** Linux: Checks if a_GCPhys is subject to the limited A20 gate emulation. */
+# define NEM_LNX_IS_SUBJECT_TO_A20(a_GCPhys)    ((RTGCPHYS)((a_GCPhys) - _1M) < (RTGCPHYS)_64K)
+
+/**
+ * Linux: A KVM memory slot backed by a run of host contiguous PGM pages.
+ */
+typedef struct NEMLNXMEMSLOT
+{
+    /** The first guest physical address. */
+    RTGCPHYS                    GCPhys;
+    /** The size of the slot in bytes. */
+    RTGCPHYS                    cb;
+    /** The ring-3 mapping of the first page. */
+    void                       *pvR3;
+    /** The KVM slot number. */
+    uint32_t                    idSlot;
+    /** Set if the slot is writable, clear if it is KVM_MEM_READONLY. */
+    bool                        fWritable;
+} NEMLNXMEMSLOT;
+/** Pointer to a Linux KVM memory slot. */
+typedef NEMLNXMEMSLOT *PNEMLNXMEMSLOT;
+
+/**
+ * Linux: The KVM memory slot table.
+ *
+ * Guest memory is not necessarily host contiguous in ring-3, so instead of one
+ * slot per RAM range we map runs of host contiguous pages with the same access
+ * rights.  The slots are dropped whenever PGM changes any page in them and
+ * re-established lazily on the next access exit.
+ */
+typedef struct NEMLNXMEMSLOTS
+{
+    /** Protects the table.  Taken after the PGM lock, never before it. */
+    RTCRITSECT                  CritSect;
+    /** Incremented whenever slots are dropped, so a mapper racing a PGM
+     *  notification can detect that its page information is stale. */
+    uint32_t volatile           uGeneration;
+    /** Set when the pre-mappable ranges should be (re)mapped by the next EMT
+     *  entering the run loop. */
+    bool volatile               fPremapPending;
+    /** Number of active slots in paSlots. */
+    uint32_t                    cSlots;
+    /** Maximum number of slots (multiple of 32). */
+    uint32_t                    cMaxSlots;
+    /** Active slots sorted by guest physical address. */
+    PNEMLNXMEMSLOT              paSlots;
+    /** Bitmap of KVM slot numbers in use. */
+    uint32_t                   *pbmUsedIds;
+    /** Number of entries in aPremapRanges. */
+    uint32_t                    cPremapRanges;
+    /** RAM and ROM ranges to map ahead of the first access. */
+    struct
+    {
+        RTGCPHYS                GCPhys;
+        RTGCPHYS                cb;
+    }                           aPremapRanges[NEM_LNX_MAX_PREMAP_RANGES];
+} NEMLNXMEMSLOTS;
+/** Pointer to the Linux KVM memory slot table. */
+typedef NEMLNXMEMSLOTS *PNEMLNXMEMSLOTS;
+
+#endif /* RT_OS_LINUX */
+
+
 /** Trick to make slickedit see the static functions in the template. */
 #ifndef IN_SLICKEDIT
 # define NEM_TMPL_STATIC static
@@ -205,6 +281,26 @@ typedef struct NEM
         uint64_t                cPagesInUse;
     } R0Stats;
 #endif /* RT_OS_WINDOWS */
+#ifdef RT_OS_LINUX
+    /** Set if the KVM backend is enabled (/NEM/UseKvm). */
+    bool                        fUseKvm : 1;
+    /** Set if A20 is enabled. */
+    bool                        fA20Enabled : 1;
+    /** Set if KVM_GET_XCRS / KVM_SET_XCRS are available. */
+    bool                        fHasXcrs : 1;
+    /** The /dev/kvm file descriptor. */
+    int32_t                     fdKvm;
+    /** The KVM VM file descriptor. */
+    int32_t                     fdVm;
+    /** The size of the per vCPU kvm_run mapping. */
+    uint32_t                    cbVCpuMmap;
+    /** The memory slot table. */
+    R3PTRTYPE(PNEMLNXMEMSLOTS)  pMemSlots;
+    /** Number of memory slots created. */
+    STAMCOUNTER                 StatMemSlotMap;
+    /** Number of memory slots dropped. */
+    STAMCOUNTER                 StatMemSlotUnmap;
+#endif /* RT_OS_LINUX */
 } NEM;
 /** Pointer to NEM VM instance data. */
 typedef NEM *PNEM;
@@ -321,6 +417,43 @@ typedef struct NEMCPU
     STAMCOUNTER                 StatQueryCpuTick;
     /** @} */
 #endif /* RT_OS_WINDOWS */
+#ifdef RT_OS_LINUX
+    /** The KVM vCPU file descriptor. */
+    int32_t                     fdVCpu;
+    /** Set if a port I/O or MMIO exit waits for the next KVM_RUN to complete
+     *  the instruction. */
+    bool                        fPendingIoCompletion;
+    /** Set if the state was pushed to KVM in the current runloop iteration,
+     *  making the interrupt window information in kvm_run stale. */
+    bool                        fStateExported;
+    /** The mmap'ed kvm_run structure. */
+    R3PTRTYPE(struct kvm_run *) pRun;
+    /** The EMT, for poking it out of KVM_RUN. */
+    RTTHREAD                    hEmtThread;
+
+    /** @name Statistics
+     * @{ */
+    STAMCOUNTER                 StatExitPortIo;
+    STAMCOUNTER                 StatExitMmio;
+    STAMCOUNTER                 StatExitMmioMapped;
+    STAMCOUNTER                 StatExitHalt;
+    STAMCOUNTER                 StatExitInterruptWindow;
+    STAMCOUNTER                 StatExitShutdown;
+    STAMCOUNTER                 StatExitEmulationFailure;
+    STAMCOUNTER                 StatExitIntr;
+    STAMCOUNTER                 StatInjectInterrupt;
+    STAMCOUNTER                 StatInjectNmi;
+    STAMCOUNTER                 StatBreakOnCancel;
+    STAMCOUNTER                 StatBreakOnFFPre;
+    STAMCOUNTER                 StatBreakOnFFPost;
+    STAMCOUNTER                 StatBreakOnStatus;
+    STAMCOUNTER                 StatExport;
+    STAMCOUNTER                 StatImportOnDemand;
+    STAMCOUNTER                 StatImportOnReturn;
+    STAMCOUNTER                 StatImportOnReturnSkipped;
+    STAMCOUNTER                 StatQueryCpuTick;
+    /** @} */
+#endif /* RT_OS_LINUX */
 } NEMCPU;
 /** Pointer to NEM VMCPU instance data. */
 typedef NEMCPU *PNEMCPU;
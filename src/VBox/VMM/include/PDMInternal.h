@@ -263,6 +263,70 @@ typedef struct PDMDRVINSINT
 } PDMDRVINSINT;
 
 
+/** Number of contending call sites tracked by PDMCRITSECTPROF. */
+#define PDMCRITSECTPROF_CALLERS         4
+
+/**
+ * A contending call site tracked by PDMCRITSECTPROF.
+ */
+typedef struct PDMCRITSECTCALLER
+{
+    /** The return address of the enter call. */
+    RTHCUINTPTR                     uAddr;
+    /** Number of contended enters attributed to this site. */
+    uint32_t volatile               cHits;
+    /** Set if uAddr is a ring-0 address, clear if ring-3. */
+    bool                            fRing0;
+    /** Alignment padding. */
+    bool                            afPadding[3];
+} PDMCRITSECTCALLER;
+
+/**
+ * Adaptive spinning and contention profiling data for a critical section.
+ *
+ * This lives in the hyper heap so that ring-0 can update it, and it is
+ * optional: the pProfR3/pProfR0 members are NULL if the allocation failed,
+ * and for read/write sections (which don't spin) unless contention profiling
+ * is enabled.  The wait profiling members at the end are only allocated when
+ * /PDM/CritSect/Profiling is set.
+ *
+ * The members are only updated by the owner of the section.  The exception
+ * is StatWait, which the shared waiters of read/write sections add to as
+ * well; being a histogram it is updated atomically.  Call sites are only
+ * recorded by exclusive owners.
+ */
+typedef struct PDMCRITSECTPROF
+{
+    /** The TSC when the current owner entered the section, 0 if unknown. */
+    uint64_t                        u64TscEntered;
+    /** Moving average of the hold time in TSC ticks (weight 1/8). */
+    uint32_t                        cTicksHoldAvg;
+    /** The current spin budget in TSC ticks, derived from cTicksHoldAvg. */
+    uint32_t volatile               cTicksSpin;
+    /** The spin budget limit in TSC ticks, 0 means never spin. */
+    uint32_t                        cTicksSpinMax;
+    /** Set if the wait profiling members are present. */
+    bool                            fWaitProf;
+    /** Alignment padding. */
+    bool                            afPadding[3];
+    /** Contended enters which got the section while spinning. */
+    STAMCOUNTER                     StatSpinHits;
+    /** Contended enters which had to block. */
+    STAMCOUNTER                     StatSpinMisses;
+    /** @name Wait profiling, only present if fWaitProf is set.
+     * @{ */
+    /** Time spent getting the section when contended (spinning + blocking). */
+    STAMHISTOGRAM                   StatWait;
+    /** The top contending call sites (space-saving approximation). */
+    PDMCRITSECTCALLER               aCallers[PDMCRITSECTPROF_CALLERS];
+    /** @} */
+} PDMCRITSECTPROF;
+AssertCompileMemberAlignment(PDMCRITSECTPROF, StatSpinHits, 8);
+AssertCompileMemberAlignment(PDMCRITSECTPROF, StatWait, 8);
+/** Pointer to critical section profiling data. */
+typedef PDMCRITSECTPROF *PPDMCRITSECTPROF;
+
+
 /**
  * Private critical section data.
  */
@@ -305,6 +369,10 @@ typedef struct PDMCRITSECTINT
     STAMCOUNTER                     StatContentionR3;
     /** Profiling the time the section is locked. */
     STAMPROFILEADV                  StatLocked;
+    /** Adaptive spinning and contention profiling data - R3 Ptr. */
+    R3PTRTYPE(PPDMCRITSECTPROF)     pProfR3;
+    /** Adaptive spinning and contention profiling data - R0 Ptr. */
+    R0PTRTYPE(PPDMCRITSECTPROF)     pProfR0;
 } PDMCRITSECTINT;
 AssertCompileMemberAlignment(PDMCRITSECTINT, StatContentionRZLock, 8);
 /** Pointer to private critical section data. */
@@ -365,6 +433,10 @@ typedef struct PDMCRITSECTRWINT
     STAMCOUNTER                         StatR3EnterShared;
     /** Profiling the time the section is write locked. */
     STAMPROFILEADV                      StatWriteLocked;
+    /** Contention profiling data - R3 Ptr.  No adaptive spinning here. */
+    R3PTRTYPE(PPDMCRITSECTPROF)         pProfR3;
+    /** Contention profiling data - R0 Ptr. */
+    R0PTRTYPE(PPDMCRITSECTPROF)         pProfR0;
 } PDMCRITSECTRWINT;
 AssertCompileMemberAlignment(PDMCRITSECTRWINT, StatContentionRZEnterExcl, 8);
 AssertCompileMemberAlignment(PDMCRITSECTRWINT, Core.u64State, 8);
@@ -730,6 +802,8 @@ typedef PDMMOD *PPDMMOD;
 
 /** Extra space in the free array. */
 #define PDMQUEUE_FREE_SLACK         16
+/** The max number of items passed to a consumer callback in one go. */
+#define PDMQUEUE_MAX_BATCH          32
 
 /**
  * Queue type.
@@ -766,6 +840,9 @@ typedef struct PDMQUEUE
             R3PTRTYPE(PFNPDMQUEUEDEV)   pfnCallback;
             /** Pointer to the device instance owning the queue. */
             R3PTRTYPE(PPDMDEVINS)       pDevIns;
+            /** Pointer to the batched consumer function, used instead of
+             * pfnCallback if set. */
+            R3PTRTYPE(PFNPDMQUEUEDEVBATCH) pfnCallbackBatch;
         } Dev;
         /** PDMQUEUETYPE_DRV */
         struct
@@ -780,6 +857,9 @@ typedef struct PDMQUEUE
         {
             /** Pointer to consumer function. */
             R3PTRTYPE(PFNPDMQUEUEINT)   pfnCallback;
+            /** Pointer to the batched consumer function, used instead of
+             * pfnCallback if set. */
+            R3PTRTYPE(PFNPDMQUEUEINTBATCH) pfnCallbackBatch;
         } Int;
         /** PDMQUEUETYPE_EXTERNAL */
         struct
@@ -800,18 +880,18 @@ typedef struct PDMQUEUE
     PTMTIMERR3                      pTimer;
     /** Pointer to the VM - R3. */
     PVMR3                           pVMR3;
-    /** LIFO of pending items - R3. */
-    R3PTRTYPE(PPDMQUEUEITEMCORE) volatile pPendingR3;
     /** Pointer to the VM - R0. */
     PVMR0                           pVMR0;
-    /** LIFO of pending items - R0. */
-    R0PTRTYPE(PPDMQUEUEITEMCORE) volatile pPendingR0;
     /** Pointer to the GC VM and indicator for GC enabled queue.
      * If this is NULL, the queue cannot be used in GC.
      */
     PVMRC                           pVMRC;
-    /** LIFO of pending items - GC. */
-    RCPTRTYPE(PPDMQUEUEITEMCORE) volatile pPendingRC;
+    /** Set by PDMQueueInsertEx when a timer driven queue should be flushed by
+     * the next VM_FF_PDM_QUEUES processing instead of waiting for the timer. */
+    bool volatile                   fExpedite;
+    /** Set while an EMT is flushing the queue, there can only be one consumer. */
+    bool volatile                   fFlushing;
+    bool                            afAlignment0[2];
 
     /** Item size (bytes). */
     uint32_t                        cbItem;
@@ -822,6 +902,22 @@ typedef struct PDMQUEUE
     /** Index to the free tail (where we remove). */
     uint32_t volatile               iFreeTail;
 
+    /** Offset of the pending ring relative to the queue structure.
+     * The ring entries are item index + 1, zero meaning the producer hasn't
+     * filled in the entry yet (or the consumer has cleared it). */
+    uint32_t                        offPending;
+    /** The pending ring index mask (ring size - 1, the size being a power of two
+     * no smaller than cItems, so the ring can never overflow). */
+    uint32_t                        fPendingMask;
+    /** The pending ring producer index (free running). */
+    uint32_t volatile               iPendingHead;
+    /** The pending ring consumer index (free running). */
+    uint32_t volatile               iPendingTail;
+    /** Offset of the first item relative to the queue structure. */
+    uint32_t                        offItems;
+    /** Stat: High water mark of the number of pending items. */
+    uint32_t volatile               cPendingMax;
+
     /** Unique queue name. */
     R3PTRTYPE(const char *)         pszName;
 #if HC_ARCH_BITS == 32
@@ -831,10 +927,18 @@ typedef struct PDMQUEUE
     STAMCOUNTER                     StatAllocFailures;
     /** Stat: PDMQueueInsert calls. */
     STAMCOUNTER                     StatInsert;
+    /** Stat: PDMQueueInsert calls finding the queue three quarters full or more. */
+    STAMCOUNTER                     StatInsertCongested;
+    /** Stat: PDMQueueInsertEx calls expediting a timer driven queue. */
+    STAMCOUNTER                     StatInsertExpedite;
     /** Stat: Queue flushes. */
     STAMCOUNTER                     StatFlush;
     /** Stat: Queue flushes with pending items left over. */
     STAMCOUNTER                     StatFlushLeftovers;
+    /** Stat: Consumer callback batches. */
+    STAMCOUNTER                     StatFlushBatches;
+    /** Stat: Items consumed. */
+    STAMCOUNTER                     StatFlushItems;
 #ifdef VBOX_WITH_STATISTICS
     /** State: Profiling the flushing. */
     STAMPROFILE                     StatFlushPrf;
@@ -858,6 +962,16 @@ typedef struct PDMQUEUE
     }                               aFreeItems[1];
 } PDMQUEUE;
 
+/** Gets the pending ring of a queue (current context). */
+#define PDMQUEUE_PENDING_RING(a_pQueue) \
+    ((uint32_t volatile *)((uint8_t *)(a_pQueue) + (a_pQueue)->offPending))
+/** Gets the item with the given index (current context). */
+#define PDMQUEUE_ITEM(a_pQueue, a_iItem) \
+    ((PPDMQUEUEITEMCORE)((uint8_t *)(a_pQueue) + (a_pQueue)->offItems + (size_t)(a_iItem) * (a_pQueue)->cbItem))
+/** Checks if the queue has any pending items. */
+#define PDMQUEUE_IS_PENDING(a_pQueue) \
+    (ASMAtomicUoReadU32(&(a_pQueue)->iPendingHead) != ASMAtomicUoReadU32(&(a_pQueue)->iPendingTail))
+
 /** @name PDM::fQueueFlushing
  * @{ */
 /** Used to make sure only one EMT will flush the queues.
@@ -1241,7 +1355,7 @@ int         pdmR3DevInit(PVM pVM);
 int         pdmR3DevInitComplete(PVM pVM);
 PPDMDEV     pdmR3DevLookup(PVM pVM, const char *pszName);
 int         pdmR3DevFindLun(PVM pVM, const char *pszDevice, unsigned iInstance, unsigned iLun, PPDMLUN *ppLun);
-DECLCALLBACK(bool) pdmR3DevHlpQueueConsumer(PVM pVM, PPDMQUEUEITEMCORE pItem);
+DECLCALLBACK(uint32_t) pdmR3DevHlpQueueConsumer(PVM pVM, PPDMQUEUEITEMCORE *papItems, uint32_t cItems);
 
 int         pdmR3UsbLoadModules(PVM pVM);
 int         pdmR3UsbInstantiateDevices(PVM pVM);
@@ -1307,6 +1421,7 @@ void        pdmUnlock(PVM pVM);
 #if defined(IN_RING3) || defined(IN_RING0)
 void        pdmCritSectRwLeaveSharedQueued(PPDMCRITSECTRW pThis);
 void        pdmCritSectRwLeaveExclQueued(PPDMCRITSECTRW pThis);
+void        pdmCritSectProfRecordWait(PPDMCRITSECTPROF pProf, uint64_t u64TscStart, RTHCUINTPTR uCaller);
 #endif
 
 /** @} */
@@ -596,6 +596,58 @@ DECLINLINE(void) pgmPhysPageWriteMonitor(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhy
 }
 
 
+/**
+ * Records a RAM page change in the live save dirty bitmap of its RAM range.
+ *
+ * This must be called whenever the state of a RAM page changes while a live
+ * save is tracking dirty pages, so that pgmR3ScanRamPages only has to look at
+ * the pages that actually changed.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pPage       The page that changed.
+ * @param   GCPhys      The address of the page if known, NIL_RTGCPHYS if not.
+ *
+ * @remarks Called from within the PGM critical section.
+ */
+DECLINLINE(void) pgmPhysPageMarkLiveSaveDirty(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (!pVM->pgm.s.LiveSave.fDirtyBitmaps)
+        return;
+
+    /*
+     * Locate the RAM range.  Use the address and the RAM range TLB when we
+     * have one, otherwise fall back on searching for the range containing
+     * the page structure.
+     */
+    PPGMRAMRANGE pRam = GCPhys != NIL_RTGCPHYS ? pgmPhysGetRange(pVM, GCPhys) : NULL;
+    uintptr_t    iPage;
+    if (   !pRam
+        || (iPage = ((uintptr_t)pPage - (uintptr_t)&pRam->aPages[0]) / sizeof(PGMPAGE)) >= (pRam->cb >> PAGE_SHIFT))
+    {
+        for (pRam = pVM->pgm.s.CTX_SUFF(pRamRangesX); pRam; pRam = pRam->CTX_SUFF(pNext))
+        {
+            iPage = ((uintptr_t)pPage - (uintptr_t)&pRam->aPages[0]) / sizeof(PGMPAGE);
+            if (iPage < (pRam->cb >> PAGE_SHIFT))
+                break;
+        }
+        if (!pRam)
+            return;
+    }
+
+    if (!pRam->pbmLSDirtyR3)
+        return; /* The range is scanned in full. */
+#ifdef IN_RC
+    ASMAtomicWriteBool(&pVM->pgm.s.LiveSave.fDirtyBitmapsIncomplete, true);
+#else
+    if (pRam->CTX_SUFF(pbmLSDirty))
+        ASMBitSet(pRam->CTX_SUFF(pbmLSDirty), (int32_t)iPage);
+    else
+        ASMAtomicWriteBool(&pVM->pgm.s.LiveSave.fDirtyBitmapsIncomplete, true);
+#endif
+}
+
+
 /**
  * Checks if the no-execute (NX) feature is active (EFER.NXE=1).
  *
@@ -1231,6 +1283,73 @@ DECLINLINE(PX86PML4E) pgmShwGetLongModePML4EPtr(PVMCPU pVCpu, unsigned int iPml4
 
 #endif /* !IN_RC */
 
+/**
+ * Fills a section of a physical handler index from the handler tree.
+ *
+ * @param   pTree           The physical handler tree.
+ * @param   pvBase          What the index entries are relative to, i.e. the
+ *                          current context PGM::pTrees.
+ * @param   GCPhysRam       The address of the first page in the RAM range.
+ * @param   paoffHandlers   The index.
+ * @param   iPage           The first page to fill.
+ * @param   iPageLast       The last page to fill (inclusive).
+ */
+DECLINLINE(void) pgmHandlerPhysicalIdxFillWorker(PAVLROGCPHYSTREE pTree, void *pvBase, RTGCPHYS GCPhysRam,
+                                                 int32_t *paoffHandlers, uint32_t iPage, uint32_t iPageLast)
+{
+    Assert(iPage <= iPageLast);
+    for (uint32_t i = iPage; i <= iPageLast; i++)
+        paoffHandlers[i] = 0;
+
+    /*
+     * Walk the handlers intersecting the section in ascending order.  Since
+     * they don't overlap, finding a non-zero entry means that the page is
+     * shared by two or more handlers.
+     */
+    RTGCPHYS const  GCPhysFirst = GCPhysRam + ((RTGCPHYS)iPage << PAGE_SHIFT);
+    RTGCPHYS const  GCPhysLast  = GCPhysRam + ((RTGCPHYS)iPageLast << PAGE_SHIFT) + PAGE_OFFSET_MASK;
+    PPGMPHYSHANDLER pCur        = (PPGMPHYSHANDLER)RTAvlroGCPhysRangeGet(pTree, GCPhysFirst);
+    if (!pCur)
+        pCur = (PPGMPHYSHANDLER)RTAvlroGCPhysGetBestFit(pTree, GCPhysFirst, true /*fAbove*/);
+    while (pCur && pCur->Core.Key <= GCPhysLast)
+    {
+        int32_t const offCur   = (int32_t)((uintptr_t)pCur - (uintptr_t)pvBase);
+        uint32_t      iCur     = pCur->Core.Key > GCPhysFirst
+                               ? (uint32_t)((pCur->Core.Key - GCPhysRam) >> PAGE_SHIFT) : iPage;
+        uint32_t      iCurLast = pCur->Core.KeyLast < GCPhysLast
+                               ? (uint32_t)((pCur->Core.KeyLast - GCPhysRam) >> PAGE_SHIFT) : iPageLast;
+        Assert(offCur != 0 && offCur != PGM_PHYS_HANDLER_IDX_SHARED);
+        for (; iCur <= iCurLast; iCur++)
+            paoffHandlers[iCur] = !paoffHandlers[iCur] ? offCur : PGM_PHYS_HANDLER_IDX_SHARED;
+
+        if (pCur->Core.KeyLast >= GCPhysLast)
+            break;
+        pCur = (PPGMPHYSHANDLER)RTAvlroGCPhysGetBestFit(pTree, pCur->Core.KeyLast + 1, true /*fAbove*/);
+    }
+}
+
+
+/**
+ * Gets the current context mapping of the physical handler index of a RAM
+ * range.
+ *
+ * @returns Pointer to the index, NULL if not allocated or not accessible in
+ *          the current context.
+ * @param   pRam                The RAM range.
+ */
+DECLINLINE(int32_t *) pgmHandlerPhysicalIdxGet(PPGMRAMRANGE pRam)
+{
+#ifdef IN_RING3
+    return pRam->paoffPhysHandlersR3;
+#elif defined(IN_RING0)
+    return pRam->paoffPhysHandlersR0;
+#else
+    RT_NOREF(pRam);
+    return NULL;
+#endif
+}
+
+
 /**
  * Cached physical handler lookup.
  *
@@ -1250,6 +1369,38 @@ DECLINLINE(PPGMPHYSHANDLER) pgmHandlerPhysicalLookup(PVM pVM, RTGCPHYS GCPhys)
     }
 
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PhysHandlerLookupMisses));
+
+    /*
+     * Consult the per-RAM-range handler index.  It only gives a definite
+     * answer for pages covered by at most one handler, the tree has to sort
+     * out the rest.
+     */
+    PPGMRAMRANGE pRam = pgmPhysGetRange(pVM, GCPhys);
+    if (   pRam
+        && !(pRam->fFlags & PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE))
+    {
+        int32_t const *paoffHandlers = pgmHandlerPhysicalIdxGet(pRam);
+        if (paoffHandlers)
+        {
+            int32_t const offHandler = paoffHandlers[(GCPhys - pRam->GCPhys) >> PAGE_SHIFT];
+            if (offHandler != PGM_PHYS_HANDLER_IDX_SHARED)
+            {
+                STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PhysHandlerLookupIdx));
+                if (!offHandler)
+                    return NULL;
+                pHandler = (PPGMPHYSHANDLER)((uintptr_t)pVM->pgm.s.CTX_SUFF(pTrees) + offHandler);
+                Assert(pHandler->Core.Key != NIL_RTGCPHYS);
+                if (   GCPhys >= pHandler->Core.Key
+                    && GCPhys <= pHandler->Core.KeyLast)
+                {
+                    pVM->pgm.s.CTX_SUFF(pLastPhysHandler) = pHandler;
+                    return pHandler;
+                }
+                return NULL;
+            }
+        }
+    }
+
     pHandler = (PPGMPHYSHANDLER)RTAvlroGCPhysRangeGet(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, GCPhys);
     if (pHandler)
         pVM->pgm.s.CTX_SUFF(pLastPhysHandler) = pHandler;
@@ -828,8 +828,12 @@ typedef union PGMPAGE
         /** 5     - Flag indicating that a write monitored page was written to
          *  when set. */
         uint64_t    fWrittenToY         : 1;
-        /** 7:6   - Unused. */
-        uint64_t    u2Unused0           : 2;
+        /** 6     - Set while the page content is still in the saved-state page
+         *  file (lazy restore). */
+        uint64_t    fLazyRestoreY       : 1;
+        /** 7     - Unused (strict builds stash a shared page checksum bit
+         *  here, see pgmR3PhysAssertSharedPageChecksums). */
+        uint64_t    u1Unused0           : 1;
         /** 9:8   - The physical handler state (PGM_PAGE_HNDL_VIRT_STATE_*). */
         uint64_t    u2HandlerVirtStateY : 2;
         /** 11:10 - NEM state bits. */
@@ -1184,6 +1188,25 @@ typedef PPGMPAGE *PPPGMPAGE;
  */
 #define PGM_PAGE_IS_FT_DIRTY(a_pPage)           ( (a_pPage)->s.fFTDirtyY )
 
+/**
+ * Marks the page as pending lazy restore from the saved-state page file.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_SET_LAZY_RESTORE(a_pPage)      do { (a_pPage)->s.fLazyRestoreY = 1; } while (0)
+
+/**
+ * Clears the lazy restore indicator.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_CLEAR_LAZY_RESTORE(a_pPage)    do { (a_pPage)->s.fLazyRestoreY = 0; } while (0)
+
+/**
+ * Checks if the page content has yet to be read from the saved-state page file.
+ * @returns true/false.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_IS_LAZY_RESTORE(a_pPage)       ( (a_pPage)->s.fLazyRestoreY )
+
 
 /** @name PT usage values (PGMPAGE::u2PDEType).
  *
@@ -1525,6 +1548,20 @@ typedef struct PGMRAMRANGE
     R3PTRTYPE(void *)                   pvR3;
     /** Live save per page tracking data. */
     R3PTRTYPE(PPGMLIVESAVERAMPAGE)      paLSPages;
+    /** Live save dirty page bitmap, one bit per page - R3 pointer.
+     * A set bit means the page needs looking at by the next scan.  NULL if the
+     * range isn't tracked and must be scanned in full. */
+    R3PTRTYPE(uint64_t *)               pbmLSDirtyR3;
+    /** Live save dirty page bitmap - R0 pointer. */
+    R0PTRTYPE(uint64_t *)               pbmLSDirtyR0;
+    /** Physical access handler index, one entry per page - R3 pointer.
+     * Each entry is the offset of the only handler covering the page relative
+     * to PGM::pTreesR3/R0, zero if no handler covers it, or
+     * PGM_PHYS_HANDLER_IDX_SHARED.  NULL if not allocated.
+     * @sa pgmHandlerPhysicalLookup */
+    R3PTRTYPE(int32_t *)                paoffPhysHandlersR3;
+    /** Physical access handler index - R0 pointer. */
+    R0PTRTYPE(int32_t *)                paoffPhysHandlersR0;
     /** The range description. */
     R3PTRTYPE(const char *)             pszDesc;
     /** Pointer to self - R0 pointer. */
@@ -1567,8 +1604,17 @@ typedef PGMRAMRANGE *PPGMRAMRANGE;
 #define PGM_RAM_RANGE_FLAGS_AD_HOC_MMIO     RT_BIT(22)
 /** Ad hoc RAM range for an MMIO2 or pre-registered MMIO mapping. */
 #define PGM_RAM_RANGE_FLAGS_AD_HOC_MMIO_EX  RT_BIT(23)
+/** The physical handler index (paoffPhysHandlersR3/R0) is out of date
+ * because the handlers changed in a context which couldn't update it.  The
+ * next update in ring-3 or ring-0 rebuilds it in full. */
+#define PGM_RAM_RANGE_FLAGS_HANDLER_IDX_STALE RT_BIT(24)
 /** @} */
 
+/** PGMRAMRANGE::paoffPhysHandlersR3 entry value indicating that more than one
+ * handler covers the page, so the tree must be consulted.  Handlers are
+ * heap allocated and thus aligned, so this is never a valid offset. */
+#define PGM_PHYS_HANDLER_IDX_SHARED         INT32_C(1)
+
 /** Tests if a RAM range is an ad hoc one or not.
  * @returns true/false.
  * @param   pRam    The RAM range.
@@ -1898,6 +1944,26 @@ typedef struct PGMCHUNKR3MAPTLB
 #define PGM_CHUNKR3MAPTLB_IDX(idChunk)     ( (idChunk) & (PGM_CHUNKR3MAPTLB_ENTRIES - 1) )
 
 
+/**
+ * Where the memory backing large guest RAM pages comes from.
+ *
+ * @see /PGM/LargePageBacking
+ */
+typedef enum PGMLARGEPAGEBACKING
+{
+    /** The usual invalid zero entry. */
+    PGMLARGEPAGEBACKING_INVALID = 0,
+    /** Physically contiguous memory allocated by GMM in ring-0. */
+    PGMLARGEPAGEBACKING_GMM,
+    /** Transparent huge pages allocated in ring-3 (MADV_HUGEPAGE). */
+    PGMLARGEPAGEBACKING_THP,
+    /** hugetlbfs pages allocated in ring-3 (MAP_HUGETLB). */
+    PGMLARGEPAGEBACKING_HUGETLB,
+    /** End of valid values. */
+    PGMLARGEPAGEBACKING_END
+} PGMLARGEPAGEBACKING;
+
+
 /**
  * Ring-3 guest page mapping TLB entry.
  * @remarks used in ring-0 as well at the moment.
@@ -3253,6 +3319,8 @@ typedef struct PGMSTATS
     STAMCOUNTER StatR3PhysHandlerLookupMisses;      /**< R3: Number of cache misses when looking up physical handlers. */
     STAMCOUNTER StatRZPhysHandlerLookupHits;        /**< RC/R0: Number of cache hits when lookup up physical handlers. */
     STAMCOUNTER StatRZPhysHandlerLookupMisses;      /**< RC/R0: Number of cache misses when looking up physical handlers */
+    STAMCOUNTER StatR3PhysHandlerLookupIdx;         /**< R3: Number of lookups resolved by the per-range handler index. */
+    STAMCOUNTER StatRZPhysHandlerLookupIdx;         /**< RC/R0: Number of lookups resolved by the per-range handler index. */
     STAMPROFILE StatRZVirtHandlerSearchByPhys;      /**< RC/R0: Profiling of pgmHandlerVirtualFindByPhysAddr. */
     STAMPROFILE StatR3VirtHandlerSearchByPhys;      /**< R3: Profiling of pgmHandlerVirtualFindByPhysAddr. */
     STAMCOUNTER StatRZPageReplaceShared;            /**< RC/R0: Times a shared page has been replaced by a private one. */
@@ -3374,8 +3442,14 @@ typedef struct PGM
     bool                            fRestoreRomPagesOnReset;
     /** Whether to automatically clear all RAM pages on reset. */
     bool                            fZeroRamPagesOnReset;
+    /** Where large pages are allocated from, PGMLARGEPAGEBACKING.
+     * @cfgm{/PGM/LargePageBacking} */
+    uint8_t                         enmLargePageBacking;
+    /** Set when the host failed to provide a large page for
+     * enmLargePageBacking, so we don't keep trying for every large page. */
+    bool                            fLargePageBackingUnavailable;
     /** Alignment padding. */
-    bool                            afAlignment3[7];
+    bool                            afAlignment3[5];
 
     /** Indicates that PGMR3FinalizeMappings has been called and that further
      * PGMR3MapIntermediate calls will be rejected. */
@@ -3652,8 +3726,12 @@ typedef struct PGM
         uint32_t                    cIgnoredPages;
         /** Indicates that a live save operation is active. */
         bool                        fActive;
-        /** Padding. */
-        bool                        afReserved[2];
+        /** Indicates that the RAM ranges have dirty bitmaps
+         *  (PGMRAMRANGE::pbmLSDirtyR3) which must be updated when pages change. */
+        bool                        fDirtyBitmaps;
+        /** Set when a page was dirtied in a context where the bitmap isn't
+         * accessible, forcing the next scan to look at all pages. */
+        bool volatile               fDirtyBitmapsIncomplete;
         /** The next history index. */
         uint8_t                     iDirtyPagesHistory;
         /** History of the total amount of dirty pages. */
@@ -3671,9 +3749,66 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
-        uint32_t                    cAlignment;
+        /** The number of RAM scans that could not be driven by the dirty
+         * bitmaps and had to look at every page (for statistics). */
+        uint32_t                    cFullRamScans;
+        /** The max size of the delta page cache in bytes, 0 if re-sent pages
+         * should never be delta encoded (CFGM /PGM/LiveSave/DeltaCacheSize). */
+        uint64_t                    cbDeltaCacheMax;
+        /** The ring-3 delta page cache holding copies of the pages sent, NULL
+         * if not delta encoding. */
+        R3PTRTYPE(struct PGMLIVESAVEDELTACACHE *) pDeltaCacheR3;
+        /** The number of pages sent as deltas (for statistics). */
+        uint64_t                    cDeltaPages;
+        /** The number of bytes saved by sending deltas instead of whole pages
+         * (for statistics). */
+        uint64_t                    cbDeltaSaved;
     } LiveSave;
 
+    /**
+     * Lazy restore data.
+     */
+    struct
+    {
+        /** Whether saved states should be written and read using the RAM page
+         * file (CFGM /PGM/LazyRestore). */
+        bool                        fEnabled;
+        /** Indicates that pages are still being faulted in from the page file. */
+        bool volatile               fActive;
+        /** Padding. */
+        bool                        afReserved[2];
+        /** The number of pages still pending restore. */
+        uint32_t volatile           cPendingPages;
+        /** The ring-3 state (page file, pending bitmap, streamer thread). */
+        R3PTRTYPE(struct PGMLAZYRESTORE *) pStateR3;
+        /** The access handler type covering the pending pages. */
+        PGMPHYSHANDLERTYPE          hHandlerType;
+        /** Incremented every time lazy restoring starts or stops, used for
+         * discarding stale streamer requests. */
+        uint32_t volatile           idGeneration;
+    } LazyRestore;
+
+    /**
+     * Page fusion content scanner data.
+     */
+    struct
+    {
+        /** The timer kicking off scan passes, NULL if the scanner is disabled. */
+        PTMTIMERR3                  pTimerR3;
+        /** Where the next scan pass resumes (guest physical address). */
+        RTGCPHYS                    GCPhysCursor;
+        /** The max number of guest pages examined per pass
+         * (CFGM /PGM/PageFusion/PagesPerScan). */
+        uint32_t                    cPagesPerScan;
+        /** The interval between scan passes in milliseconds
+         * (CFGM /PGM/PageFusion/IntervalMs). */
+        uint32_t                    cMsInterval;
+        /** Whether the scanner is enabled (CFGM /PGM/PageFusion/ContentScan). */
+        bool                        fEnabled;
+        /** Padding. */
+        bool                        afReserved[7];
+    } Dedup;
+
     /** @name   Error injection.
      * @{ */
     /** Inject handy page allocation errors pretending we're completely out of
@@ -3708,8 +3843,21 @@ typedef struct PGM
     STAMCOUNTER                     StatLargePageReused;    /**< The number of large pages we've reused.*/
     STAMCOUNTER                     StatLargePageRefused;   /**< The number of times we couldn't use a large page.*/
     STAMCOUNTER                     StatLargePageRecheck;   /**< The number of times we rechecked a disabled large page.*/
+    STAMCOUNTER                     StatLargePageGmm;       /**< Large pages allocated by GMM in ring-0. */
+    STAMCOUNTER                     StatLargePageSeeded;    /**< Large pages seeded with ring-3 host large page memory. */
+    STAMCOUNTER                     StatLargePageRecycled;  /**< Large pages recycled from previously seeded memory. */
+    STAMCOUNTER                     StatLargePageSeedFailed;/**< Failed attempts at seeding ring-3 memory. */
 
     STAMPROFILE                     StatShModCheck;         /**< Profiles shared module checks. */
+
+    STAMPROFILE                     StatDedupScan;          /**< Profiles page fusion content scan passes. */
+    STAMCOUNTER                     StatDedupScanned;       /**< Pages hashed by the content scanner. */
+    STAMCOUNTER                     StatDedupMerged;        /**< Pages replaced by an identical shared page. */
+    STAMCOUNTER                     StatDedupConverted;     /**< Pages converted into shared reference copies. */
+    STAMCOUNTER                     StatDedupZero;          /**< Zero filled pages skipped by the content scanner. */
+
+    STAMPROFILE                     StatLazyRestoreFaults;  /**< Profiles on-demand page restores. */
+    STAMCOUNTER                     StatLazyRestoreStreamed; /**< Pages restored by the background streamer. */
     /** @} */
 
 #ifdef VBOX_WITH_STATISTICS
@@ -4206,6 +4354,8 @@ int             pgmHandlerPhysicalExDestroy(PVM pVM, PPGMPHYSHANDLER pHandler);
 void            pgmR3HandlerPhysicalUpdateAll(PVM pVM);
 bool            pgmHandlerPhysicalIsAll(PVM pVM, RTGCPHYS GCPhys);
 void            pgmHandlerPhysicalResetAliasedPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhysPage, bool fDoAccounting);
+void            pgmHandlerPhysicalIdxUpdate(PVM pVM, PPGMRAMRANGE pRam, RTGCPHYS GCPhys, RTGCPHYS GCPhysLast);
+void            pgmR3HandlerPhysicalIdxEnsure(PVM pVM, RTGCPHYS GCPhys);
 #ifdef VBOX_WITH_RAW_MODE
 PPGMVIRTHANDLER pgmHandlerVirtualFindByPhysAddr(PVM pVM, RTGCPHYS GCPhys, unsigned *piPage);
 DECLCALLBACK(int) pgmHandlerVirtualResetOne(PAVLROGCPTRNODECORE pNode, void *pvUser);
@@ -4260,6 +4410,14 @@ int             pgmR3PhysRomReset(PVM pVM);
 int             pgmR3PhysRamZeroAll(PVM pVM);
 int             pgmR3PhysChunkMap(PVM pVM, uint32_t idChunk, PPPGMCHUNKR3MAP ppChunk);
 int             pgmR3PhysRamTerm(PVM pVM);
+void            pgmR3PhysHandlerIdxFree(PPGMRAMRANGE pRam);
+int             pgmR3PhysLazyRestorePage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
+int             pgmR3LazyRestoreInit(PVM pVM);
+void            pgmR3LazyRestoreReset(PVM pVM);
+void            pgmR3LazyRestoreTerm(PVM pVM);
+#ifdef VBOX_WITH_PAGE_SHARING
+int             pgmR3SharedPageScanInit(PVM pVM);
+#endif
 void            pgmR3PhysRomTerm(PVM pVM);
 void            pgmR3PhysAssertSharedPageChecksums(PVM pVM);
 
@@ -21,6 +21,7 @@
 #include <VBox/cdefs.h>
 #include <VBox/types.h>
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/stam.h>
 #include <iprt/critsect.h>
 
 RT_C_DECLS_BEGIN
@@ -291,6 +292,18 @@ AssertCompile2MemberOffsets(SSMUNIT, u.Common.pfnLoadDone, u.External.pfnLoadDon
 AssertCompile2MemberOffsets(SSMUNIT, u.Common.pvKey,       u.External.pvUser);
 
 
+/** @name SSM_ZIP_CODEC_XXX - Compression codecs.
+ * These are stored in SSM_REC_TYPE_RAW_ZIP records, so don't change them.
+ * @{ */
+/** No compression, blocks are stored as raw (or zero) records. */
+#define SSM_ZIP_CODEC_NONE                      0
+/** LZF, fast and the traditional default. */
+#define SSM_ZIP_CODEC_LZF                       1
+/** zlib (deflate), slower but denser than LZF. */
+#define SSM_ZIP_CODEC_ZLIB                      2
+/** @} */
+
+
 /**
  * SSM VM Instance data.
  * Changes to this must checked against the padding of the cfgm union in VM!
@@ -313,7 +326,17 @@ typedef struct SSM
     bool                    fInitialized;
     /** Current pass (for STAM). */
     uint32_t                uPass;
-    uint32_t                u32Alignment;
+    /** The compression codec for saving (SSM_ZIP_CODEC_XXX, /SSM/Compression). */
+    uint8_t                 uZipCodec;
+    uint8_t                 abAlignment[3];
+    /** The number of compression worker threads (/SSM/CompressionThreads). */
+    uint32_t                cZipThreads;
+    /** Number of compression blocks handed to the worker threads. */
+    STAMCOUNTER             StatZipBlocks;
+    /** Number of bytes the compression blocks were encoded into. */
+    STAMCOUNTER             StatZipBytesOut;
+    /** Number of times the EMT had to wait for a compression worker. */
+    STAMCOUNTER             StatZipStalls;
 } SSM;
 /** Pointer to SSM VM instance data. */
 typedef SSM *PSSM;
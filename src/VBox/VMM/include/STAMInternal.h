@@ -25,6 +25,7 @@
 #include <VBox/vmm/gmm.h>
 #include <iprt/list.h>
 #include <iprt/semaphore.h>
+#include <iprt/thread.h>
 
 
 
@@ -96,6 +97,8 @@ typedef struct STAMDESC
         PSTAMPROFILE    pProfile;
         /** Advanced profile. */
         PSTAMPROFILEADV pProfileAdv;
+        /** Histogram. */
+        PSTAMHISTOGRAM  pHistogram;
         /** Ratio, unsigned 32-bit. */
         PSTAMRATIOU32   pRatioU32;
         /** unsigned 8-bit. */
@@ -152,6 +155,14 @@ typedef struct STAMUSERPERVM
     uint32_t                uAlignment;
     /** The copy of the GMM statistics. */
     GMMSTATS                GMMStats;
+
+    /** Incremented whenever a sample is registered or deregistered (under
+     * the write lock).  Used by the shared memory export. */
+    uint32_t                cGeneration;
+    /** Explicit alignment padding. */
+    uint32_t                uAlignment2;
+    /** The shared memory export state, NULL if not exporting. */
+    R3PTRTYPE(struct STAMEXPORT *) pExport;
 } STAMUSERPERVM;
 #ifdef IN_RING3
 AssertCompileMemberAlignment(STAMUSERPERVM, GMMStats, 8);
@@ -172,6 +183,52 @@ typedef STAMUSERPERVM *PSTAMUSERPERVM;
 /** Lazy initialization */
 #define STAM_LAZY_INIT(pUVM)    do { } while (0)
 
+
+#ifdef IN_RING3
+/**
+ * The shared memory export state (STAMExport.cpp).
+ */
+typedef struct STAMEXPORT
+{
+    /** The user mode VM handle. */
+    PUVM                    pUVM;
+    /** The publisher thread. */
+    RTTHREAD                hThread;
+    /** Event the publisher thread waits on between updates. */
+    RTSEMEVENT              hEvtWakeup;
+    /** Set when the publisher thread should terminate. */
+    bool volatile           fTerminate;
+    /** The update interval in milliseconds. */
+    uint32_t                cMsInterval;
+    /** The sample name pattern(s) to export, NULL for all. */
+    char                   *pszPattern;
+    /** The shared memory object descriptor. */
+    int                     fdShm;
+    /** The mapping of the segment. */
+    uint8_t                *pbMap;
+    /** The size of the mapping. */
+    size_t                  cbMap;
+    /** The STAMUSERPERVM::cGeneration the descriptor table was built for. */
+    uint32_t                uGenBuilt;
+    /** Set if the layout must be rebuilt regardless of the generation. */
+    bool                    fRebuild;
+    /** Refresh groups used by the exported samples. */
+    uint64_t                bmRefreshGroups;
+    /** The number of exported samples. */
+    uint32_t                cDescs;
+    /** The exported samples, parallel to the segment descriptor table. */
+    PSTAMDESC              *papDescs;
+    /** The number of entries papDescs has room for. */
+    uint32_t                cDescsAlloc;
+    /** The segment name. */
+    char                    szName[64];
+} STAMEXPORT;
+/** Pointer to the shared memory export state. */
+typedef STAMEXPORT *PSTAMEXPORT;
+
+void stamR3RefreshGroup(PUVM pUVM, uint8_t iRefreshGroup, uint64_t *pbmRefreshedGroups);
+#endif /* IN_RING3 */
+
 /** @} */
 
 RT_C_DECLS_END
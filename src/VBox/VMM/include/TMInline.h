@@ -20,22 +20,173 @@
 
 
 /**
- * Used to unlink a timer from the active list.
+ * Replaces a child link in the search tree.
  *
  * @param   pQueue      The timer queue.
- * @param   pTimer      The timer that needs linking.
+ * @param   pParent     The parent node, NULL if @a pOld is the root.
+ * @param   pOld        The current child.
+ * @param   pNew        The new child, NULL if none.
+ */
+DECL_FORCE_INLINE(void) tmTimerTreeReplaceChild(PTMTIMERQUEUE pQueue, PTMTIMER pParent, PTMTIMER pOld, PTMTIMER pNew)
+{
+    if (!pParent)
+        TMTIMER_SET_TREE_ROOT(pQueue, pNew);
+    else if (TMTIMER_GET_TREE_NODE(pParent, pParent->offTreeLeft) == pOld)
+        pParent->offTreeLeft  = TMTIMER_TREE_OFF(pParent, pNew);
+    else
+        pParent->offTreeRight = TMTIMER_TREE_OFF(pParent, pNew);
+    if (pNew)
+        pNew->offTreeParent = TMTIMER_TREE_OFF(pNew, pParent);
+}
+
+
+/**
+ * Rotates a node up above its parent, preserving the in-order sequence.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The node to rotate up.  Must have a parent.
+ */
+DECL_FORCE_INLINE(void) tmTimerTreeRotateUp(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    PTMTIMER const pParent = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeParent);
+    PTMTIMER const pGrand  = TMTIMER_GET_TREE_NODE(pParent, pParent->offTreeParent);
+    Assert(pParent);
+    if (TMTIMER_GET_TREE_NODE(pParent, pParent->offTreeLeft) == pTimer)
+    {
+        PTMTIMER const pMiddle = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeRight);
+        pParent->offTreeLeft = TMTIMER_TREE_OFF(pParent, pMiddle);
+        if (pMiddle)
+            pMiddle->offTreeParent = TMTIMER_TREE_OFF(pMiddle, pParent);
+        pTimer->offTreeRight = TMTIMER_TREE_OFF(pTimer, pParent);
+    }
+    else
+    {
+        PTMTIMER const pMiddle = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeLeft);
+        pParent->offTreeRight = TMTIMER_TREE_OFF(pParent, pMiddle);
+        if (pMiddle)
+            pMiddle->offTreeParent = TMTIMER_TREE_OFF(pMiddle, pParent);
+        pTimer->offTreeLeft = TMTIMER_TREE_OFF(pTimer, pParent);
+    }
+    pParent->offTreeParent = TMTIMER_TREE_OFF(pParent, pTimer);
+    tmTimerTreeReplaceChild(pQueue, pGrand, pParent, pTimer);
+}
+
+
+/**
+ * Links a timer into the active list of a timer queue.
+ *
+ * The insertion point is looked up in the search tree, which makes this
+ * O(log n) on average instead of walking the list.  Timers with the same
+ * expire time are kept in the order they were linked.
+ *
+ * @param   pQueue          The queue.
+ * @param   pTimer          The timer.
+ * @param   u64Expire       The timer expiration time.
  *
  * @remarks Called while owning the relevant queue lock.
  */
-DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
 {
-#ifdef VBOX_STRICT
-    TMTIMERSTATE const enmState = pTimer->enmState;
-    Assert(  pTimer->enmClock == TMCLOCK_VIRTUAL_SYNC
-           ? enmState == TMTIMERSTATE_ACTIVE
-           : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
-#endif
+    Assert(!pTimer->offNext);
+    Assert(!pTimer->offPrev);
+    Assert(!pTimer->offTreeParent && !pTimer->offTreeLeft && !pTimer->offTreeRight);
+    Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
+
+    /*
+     * Find the leaf position, noting the neighbours in the active list on
+     * the way: the last node we went right of precedes the new timer, the
+     * last one we went left of follows it.
+     */
+    pTimer->u64TreeKey = u64Expire;
+    PTMTIMER pParent   = NULL;
+    PTMTIMER pPrev     = NULL;
+    PTMTIMER pNext     = NULL;
+    PTMTIMER pCur      = TMTIMER_GET_TREE_ROOT(pQueue);
+    while (pCur)
+    {
+        pParent = pCur;
+        if (u64Expire < pCur->u64TreeKey)
+        {
+            pNext = pCur;
+            pCur  = TMTIMER_GET_TREE_NODE(pCur, pCur->offTreeLeft);
+        }
+        else
+        {
+            pPrev = pCur;
+            pCur  = TMTIMER_GET_TREE_NODE(pCur, pCur->offTreeRight);
+        }
+    }
+
+    if (!pParent)
+        TMTIMER_SET_TREE_ROOT(pQueue, pTimer);
+    else if (pParent == pNext)
+        pParent->offTreeLeft  = TMTIMER_TREE_OFF(pParent, pTimer);
+    else
+        pParent->offTreeRight = TMTIMER_TREE_OFF(pParent, pTimer);
+    pTimer->offTreeParent = TMTIMER_TREE_OFF(pTimer, pParent);
+
+    /* Restore the heap property. */
+    for (;;)
+    {
+        pParent = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeParent);
+        if (!pParent || pParent->uTreePriority <= pTimer->uTreePriority)
+            break;
+        tmTimerTreeRotateUp(pQueue, pTimer);
+    }
 
+    /*
+     * Link it into the active list.
+     */
+    TMTIMER_SET_PREV(pTimer, pPrev);
+    TMTIMER_SET_NEXT(pTimer, pNext);
+    if (pNext)
+        TMTIMER_SET_PREV(pNext, pTimer);
+    if (pPrev)
+    {
+        TMTIMER_SET_NEXT(pPrev, pTimer);
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, pNext ? "tmTimerQueueLinkActive middle" : "tmTimerQueueLinkActive tail",
+                           R3STRING(pTimer->pszDesc));
+    }
+    else
+    {
+        TMTIMER_SET_HEAD(pQueue, pTimer);
+        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, pNext ? "tmTimerQueueLinkActive head" : "tmTimerQueueLinkActive empty",
+                           R3STRING(pTimer->pszDesc));
+    }
+}
+
+
+/**
+ * Unlinks a timer from the active list, no state checks.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer that needs unlinking.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActiveWorker(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    /*
+     * Rotate it down to a leaf and cut it off the tree.
+     */
+    for (;;)
+    {
+        PTMTIMER const pLeft  = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeLeft);
+        PTMTIMER const pRight = TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeRight);
+        if (pLeft)
+            tmTimerTreeRotateUp(pQueue, !pRight || pLeft->uTreePriority <= pRight->uTreePriority ? pLeft : pRight);
+        else if (pRight)
+            tmTimerTreeRotateUp(pQueue, pRight);
+        else
+            break;
+    }
+    tmTimerTreeReplaceChild(pQueue, TMTIMER_GET_TREE_NODE(pTimer, pTimer->offTreeParent), pTimer, NULL);
+    pTimer->offTreeParent = 0;
+
+    /*
+     * Unlink it from the active list.
+     */
     const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
     const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
     if (pPrev)
@@ -52,5 +203,25 @@ DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER
     pTimer->offPrev = 0;
 }
 
+
+/**
+ * Used to unlink a timer from the active list.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer that needs linking.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+#ifdef VBOX_STRICT
+    TMTIMERSTATE const enmState = pTimer->enmState;
+    Assert(  pTimer->enmClock == TMCLOCK_VIRTUAL_SYNC
+           ? enmState == TMTIMERSTATE_ACTIVE
+           : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
+#endif
+    tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
+}
+
 #endif
 
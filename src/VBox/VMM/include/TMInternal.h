@@ -179,6 +179,24 @@ typedef struct TMTIMER
     /** Timer relative offset to the previous timer in the chain. */
     int32_t                 offPrev;
 
+    /** @name Search tree over the active list.
+     * The active timers are also kept in a treap ordered by u64TreeKey, so
+     * finding the insertion point in the active list doesn't require walking
+     * it.  An in-order walk of the tree yields the same order as the list.
+     * @{ */
+    /** Timer relative offset to the parent node. */
+    int32_t                 offTreeParent;
+    /** Timer relative offset to the left child (earlier expire times). */
+    int32_t                 offTreeLeft;
+    /** Timer relative offset to the right child (same or later expire times). */
+    int32_t                 offTreeRight;
+    /** The heap priority, a random number assigned when creating the timer. */
+    uint32_t                uTreePriority;
+    /** The expire time the timer was linked with.  This is a copy since
+     * u64Expire may be updated while the timer is still linked. */
+    uint64_t                u64TreeKey;
+    /** @} */
+
     /** Pointer to the VM the timer belongs to - R3 Ptr. */
     PVMR3                   pVMR3;
     /** Pointer to the VM the timer belongs to - R0 Ptr. */
@@ -243,6 +261,10 @@ AssertCompileMemberSize(TMTIMER, enmState, sizeof(uint32_t));
 #define TMTIMER_SET_PREV(pTimer, pPrev) ((pTimer)->offPrev = (pPrev) ? (intptr_t)(pPrev) - (intptr_t)(pTimer) : 0)
 /** Set the next timer link. */
 #define TMTIMER_SET_NEXT(pTimer, pNext) ((pTimer)->offNext = (pNext) ? (intptr_t)(pNext) - (intptr_t)(pTimer) : 0)
+/** Get a timer from a timer relative tree offset (offTreeParent and friends). */
+#define TMTIMER_GET_TREE_NODE(pTimer, off)  ((PTMTIMER)((off) ? (intptr_t)(pTimer) + (off) : 0))
+/** Calculate the timer relative tree offset of another timer. */
+#define TMTIMER_TREE_OFF(pTimer, pNode)     ((pNode) ? (int32_t)((intptr_t)(pNode) - (intptr_t)(pTimer)) : 0)
 
 
 /**
@@ -275,8 +297,13 @@ typedef struct TMTIMERQUEUE
     int32_t volatile        offSchedule;
     /** The clock for this queue. */
     TMCLOCK                 enmClock;
+    /** The root of the search tree over the active list.
+     * Access is serialized like for offActive.
+     *
+     * The offset is relative to the queue structure. */
+    int32_t                 offTreeRoot;
     /** Pad the structure up to 32 bytes. */
-    uint32_t                au32Padding[3];
+    uint32_t                au32Padding[2];
 } TMTIMERQUEUE;
 
 /** Pointer to a timer queue. */
@@ -286,6 +313,10 @@ typedef TMTIMERQUEUE *PTMTIMERQUEUE;
 #define TMTIMER_GET_HEAD(pQueue)        ((PTMTIMER)((pQueue)->offActive ? (intptr_t)(pQueue) + (pQueue)->offActive : 0))
 /** Set the head of the active timer list. */
 #define TMTIMER_SET_HEAD(pQueue, pHead) ((pQueue)->offActive = pHead ? (intptr_t)pHead - (intptr_t)(pQueue) : 0)
+/** Get the root of the active timer search tree. */
+#define TMTIMER_GET_TREE_ROOT(pQueue)   ((PTMTIMER)((pQueue)->offTreeRoot ? (intptr_t)(pQueue) + (pQueue)->offTreeRoot : 0))
+/** Set the root of the active timer search tree. */
+#define TMTIMER_SET_TREE_ROOT(pQueue, pRoot) ((pQueue)->offTreeRoot = pRoot ? (intptr_t)pRoot - (intptr_t)(pQueue) : 0)
 
 
 /**
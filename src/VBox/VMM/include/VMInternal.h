@@ -141,6 +141,9 @@ typedef enum
     VMHALTMETHOD_1,
     /** The first go at a more global approach. */
     VMHALTMETHOD_GLOBAL_1,
+    /** Global 1 with an adaptive per-VCPU polling window in front of the
+     * blocking (like halt_poll_ns in KVM). */
+    VMHALTMETHOD_POLL,
     /** The end of valid methods. (not inclusive of course) */
     VMHALTMETHOD_END,
     /** The usual 32-bit max value. */
@@ -178,14 +181,90 @@ typedef VMINT *PVMINT;
 
 #ifdef IN_RING3
 
+/** The number of slots in a VMREQRING (power of two). */
+#define VMREQRING_ENTRIES           128
+
+/**
+ * A slot in a VMREQRING.
+ */
+typedef struct VMREQRINGSLOT
+{
+    /** The sequence number: equals the position when the slot is free for the
+     * producer, position + 1 when it holds a request for the consumer. */
+    uint32_t volatile               uSeq;
+    /** Explicit alignment padding. */
+    uint32_t                        u32Padding;
+    /** The request. */
+    PVMREQ volatile                 pReq;
+} VMREQRINGSLOT;
+/** Pointer to a request ring slot. */
+typedef VMREQRINGSLOT *PVMREQRINGSLOT;
+
+/**
+ * Bounded lock-free request ring.
+ *
+ * Any thread may queue requests and, for the VMCPUID_ANY queue, any EMT may
+ * dequeue them.  Each slot carries a sequence number which tells producers and
+ * consumers whether it's their turn with the slot, so requests are handed over
+ * in FIFO order with a single compare-and-exchange on each side.  When the
+ * ring is full, requests go onto the overflow list (pNormalReqs /
+ * pPriorityReqs) instead.  See vmR3ReqRingPush and vmR3ReqRingPop.
+ */
+typedef struct VMREQRING
+{
+    /** The producer position. */
+    uint32_t volatile               iHead;
+    /** Keep the positions in separate cache lines. */
+    uint8_t                         abPadding0[60];
+    /** The consumer position. */
+    uint32_t volatile               iTail;
+    /** The number of requests on the overflow list that goes with the ring.
+     * Incremented before a request is put on the list and decremented after
+     * one has been taken off it.  While non-zero, producers bypass the ring so
+     * requests queued while the overflow is being drained stay behind the
+     * older ones. */
+    uint32_t volatile               cOverflow;
+    /** Keep the positions and slots in separate cache lines. */
+    uint8_t                         abPadding1[56];
+    /** The slots. */
+    VMREQRINGSLOT                   aSlots[VMREQRING_ENTRIES];
+} VMREQRING;
+AssertCompileMemberAlignment(VMREQRING, iTail, 64);
+AssertCompileMemberAlignment(VMREQRING, aSlots, 64);
+/** Pointer to a request ring. */
+typedef VMREQRING *PVMREQRING;
+
+/** Checks if a request ring is empty (or only contains requests which are
+ * about to be written).  Only useful for polling. */
+#define VMREQRING_IS_EMPTY(a_pRing)     ((a_pRing)->iHead == (a_pRing)->iTail)
+
+/** Checks if there are requests pending on the queues of a VMINTUSERPERVM or
+ * VMINTUSERPERVMCPU structure.  Only useful for polling. */
+#define VMINT_REQS_PENDING(a_pVmS) \
+    (   !VMREQRING_IS_EMPTY((a_pVmS)->pPriorityRing) \
+     || !VMREQRING_IS_EMPTY((a_pVmS)->pNormalRing) \
+     || (a_pVmS)->pPriorityReqs \
+     || (a_pVmS)->pNormalReqs)
+
+/** The size of the UVM allocation for @a a_cCpus virtual CPUs.  The request
+ * rings (one normal and one priority for the VM and each VCPU) follow the UVM
+ * structure, see vmR3ReqInitRingsU. */
+#define VM_UVM_ALLOC_SIZE(a_cCpus) \
+    (RT_ALIGN_Z(RT_UOFFSETOF_DYN(UVM, aCpus[a_cCpus]), 64) + ((a_cCpus) + 1) * 2 * sizeof(VMREQRING))
+
+
 /**
  * VM internal data kept in the UVM.
  */
 typedef struct VMINTUSERPERVM
 {
-    /** Head of the standard request queue. Atomic. */
+    /** The standard request ring. */
+    PVMREQRING                      pNormalRing;
+    /** The priority request ring. */
+    PVMREQRING                      pPriorityRing;
+    /** Head of the standard request overflow list. Atomic. */
     volatile PVMREQ                 pNormalReqs;
-    /** Head of the priority request queue. Atomic. */
+    /** Head of the priority request overflow list. Atomic. */
     volatile PVMREQ                 pPriorityReqs;
     /** The last index used during alloc/free. */
     volatile uint32_t               iReqFree;
@@ -222,6 +301,9 @@ typedef struct VMINTUSERPERVM
     /** Number of times we've raced someone when pushing the other requests back
      * onto the list. */
     STAMCOUNTER                     StatReqPushBackRaces;
+    /** Number of requests that went onto an overflow list because the ring was
+     * full or the overflow list was already in use. */
+    STAMCOUNTER                     StatReqRingFull;
 # endif
 
     /** Pointer to the support library session.
@@ -312,6 +394,25 @@ typedef struct VMINTUSERPERVM
             /** The threshold between spinning and blocking. */
             uint32_t                cNsSpinBlockThresholdCfg;
         }                           Global1;
+
+       /**
+        * Global 1 with adaptive polling: Spin for up to a per-VCPU window
+        * before blocking in the GVMM.  The window grows when the VCPU was
+        * woken up shortly after it blocked and shrinks when it slept long.
+        */
+        struct
+        {
+            /** The threshold between spinning and blocking (after polling). */
+            uint32_t                cNsSpinBlockThresholdCfg;
+            /** The initial poll window when growing from zero. */
+            uint32_t                cNsPollStartCfg;
+            /** The max poll window, also the halt time considered short. */
+            uint32_t                cNsPollMaxCfg;
+            /** The factor to grow the poll window by. */
+            uint32_t                uPollGrowCfg;
+            /** The divisor to shrink the poll window by, 0 resets it. */
+            uint32_t                uPollShrinkCfg;
+        }                           Poll;
     }                               Halt;
 
     /** Pointer to the DBGC instance data. */
@@ -340,9 +441,13 @@ typedef VMINTUSERPERVM *PVMINTUSERPERVM;
  */
 typedef struct VMINTUSERPERVMCPU
 {
-    /** Head of the normal request queue. Atomic. */
+    /** The normal request ring. */
+    PVMREQRING                      pNormalRing;
+    /** The priority request ring. */
+    PVMREQRING                      pPriorityRing;
+    /** Head of the normal request overflow list. Atomic. */
     volatile PVMREQ                 pNormalReqs;
-    /** Head of the priority request queue. Atomic. */
+    /** Head of the priority request overflow list. Atomic. */
     volatile PVMREQ                 pPriorityReqs;
 
     /** The handle to the EMT thread. */
@@ -368,7 +473,8 @@ typedef struct VMINTUSERPERVMCPU
     uint32_t                        HaltFrequency;
     /** The number of halts in the current period. */
     uint32_t                        cHalts;
-    uint32_t                        padding; /**< alignment padding. */
+    /** The current poll window (ns) of the poll halt method. */
+    uint32_t                        cNsHaltPollWindow;
     /** When we started counting halts in cHalts (RTTimeNanoTS). */
     uint64_t                        u64HaltsStartTS;
     /** @} */
@@ -450,6 +556,12 @@ typedef struct VMINTUSERPERVMCPU
     STAMPROFILE                     StatHaltBlockOnTime;
     STAMPROFILE                     StatHaltTimers;
     STAMPROFILE                     StatHaltPoll;
+    STAMCOUNTER                     StatHaltPollHits;
+    STAMCOUNTER                     StatHaltPollMisses;
+    STAMCOUNTER                     StatHaltPollGrow;
+    STAMCOUNTER                     StatHaltPollShrink;
+    /** Halt duration histogram. */
+    STAMHISTOGRAM                   StatHaltDuration;
     /** @} */
 } VMINTUSERPERVMCPU;
 AssertCompileMemberAlignment(VMINTUSERPERVMCPU, u64HaltsStartTS, 8);
@@ -472,6 +584,11 @@ DECLCALLBACK(int)   vmR3SetRuntimeError(PVM pVM, uint32_t fFlags, const char *ps
 DECLCALLBACK(int)   vmR3SetRuntimeErrorV(PVM pVM, uint32_t fFlags, const char *pszErrorId, const char *pszFormat, va_list *pVa);
 void                vmSetRuntimeErrorCopy(PVM pVM, uint32_t fFlags, const char *pszErrorId, const char *pszFormat, va_list va);
 void                vmR3SetTerminated(PVM pVM);
+#ifdef IN_RING3
+void                vmR3ReqInitRingsU(PUVM pUVM);
+void                vmR3ReqPreallocU(PUVM pUVM);
+PVMREQ              vmR3ReqRingPop(PVMREQRING pRing);
+#endif
 
 RT_C_DECLS_END
 
@@ -0,0 +1,415 @@
+/* $Id$ */
+/** @file
+ * Page fusion content scanner testcase.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/param.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/sort.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Where in guest RAM the testcase puts its pages. */
+#define TST_GCPHYS_FIRST        UINT64_C(0x01000000)
+/** Pages per scan call, enough for a full pass over the 128MB the default
+ * tree gives the VM. */
+#define TST_PAGES_PER_PASS      _256K
+/** The number of last-word variations searched for a hash collision. */
+#define TST_COLLISION_TRIES     _256K
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * The page fusion counters of a VM.
+ */
+typedef struct TSTFUSIONSTATS
+{
+    uint64_t    cScanned;
+    uint64_t    cMerged;
+    uint64_t    cConverted;
+} TSTFUSIONSTATS;
+
+/**
+ * A hash value and the last page word producing it.
+ */
+typedef struct TSTHASHWORD
+{
+    uint32_t    uHash;
+    uint64_t    uWord;
+} TSTHASHWORD;
+
+/** A test run on EMT(0) of a freshly created VM. */
+typedef DECLCALLBACK(int) FNTSTTEST(PVM pVM);
+/** Pointer to a FNTSTTEST. */
+typedef FNTSTTEST *PFNTSTTEST;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST   g_hTest;
+/** The content of the candidate left behind by a destroyed VM. */
+static uint8_t  g_abLeftover[PAGE_SIZE];
+
+
+/** @callback_method_impl{FNSTAMR3ENUM, Gets the value of a counter.} */
+static DECLCALLBACK(int) tstGetCounter(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                       STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    RT_NOREF(pszName, enmUnit, enmVisiblity, pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        *(uint64_t *)pvUser = ((PSTAMCOUNTER)pvSample)->c;
+    return VINF_SUCCESS;
+}
+
+
+/** Gets the page fusion counters of the VM. */
+static void tstQueryStats(PVM pVM, TSTFUSIONSTATS *pStats)
+{
+    RT_ZERO(*pStats);
+    STAMR3Enum(pVM->pUVM, "/PGM/PageFusion/Scanned",   tstGetCounter, &pStats->cScanned);
+    STAMR3Enum(pVM->pUVM, "/PGM/PageFusion/Merged",    tstGetCounter, &pStats->cMerged);
+    STAMR3Enum(pVM->pUVM, "/PGM/PageFusion/Converted", tstGetCounter, &pStats->cConverted);
+}
+
+
+/** Does @a cPasses full content scan passes. */
+static int tstScan(PVM pVM, unsigned cPasses)
+{
+    while (cPasses-- > 0)
+    {
+        int rc = PGMR3SharedPageScan(pVM, TST_PAGES_PER_PASS);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/** Checks that the guest page at @a GCPhys has the expected content. */
+static void tstCheckPage(PVM pVM, RTGCPHYS GCPhys, uint8_t const *pbExpect)
+{
+    uint8_t abPage[PAGE_SIZE];
+    RTTESTI_CHECK_RC_RETV(PGMPhysSimpleReadGCPhys(pVM, abPage, GCPhys, PAGE_SIZE), VINF_SUCCESS);
+    if (memcmp(abPage, pbExpect, PAGE_SIZE))
+        RTTestFailed(g_hTest, "Page %RGp has the wrong content", GCPhys);
+}
+
+
+/**
+ * Checks the counter changes since @a pBefore.
+ */
+static void tstCheckStats(PVM pVM, TSTFUSIONSTATS const *pBefore, uint64_t cMerged, uint64_t cConverted, unsigned iLine)
+{
+    TSTFUSIONSTATS Now;
+    tstQueryStats(pVM, &Now);
+    if (Now.cScanned == pBefore->cScanned)
+        RTTestFailed(g_hTest, "line %u: nothing was scanned", iLine);
+    if (   Now.cMerged    - pBefore->cMerged    != cMerged
+        || Now.cConverted - pBefore->cConverted != cConverted)
+        RTTestFailed(g_hTest, "line %u: merged %RU64 and converted %RU64 pages, expected %RU64 and %RU64", iLine,
+                     Now.cMerged - pBefore->cMerged, Now.cConverted - pBefore->cConverted, cMerged, cConverted);
+}
+#define TST_CHECK_STATS(a_pVM, a_pBefore, a_cMerged, a_cConverted) \
+    tstCheckStats(a_pVM, a_pBefore, a_cMerged, a_cConverted, __LINE__)
+
+
+/**
+ * Merging pages with identical content, and breaking the sharing again on
+ * write.
+ */
+static void tstMerge(PVM pVM)
+{
+    RTTestSub(g_hTest, "Merging");
+
+    /* Eight copies of one page, four of another and four unique ones. */
+    static unsigned const s_acCopies[] = { 8, 4, 1, 1, 1, 1 };
+    uint8_t *pbPages = (uint8_t *)RTMemAlloc(RT_ELEMENTS(s_acCopies) * PAGE_SIZE);
+    RTTESTI_CHECK_RETV(pbPages);
+    RTRandBytes(pbPages, RT_ELEMENTS(s_acCopies) * PAGE_SIZE);
+
+    RTGCPHYS GCPhys = TST_GCPHYS_FIRST;
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acCopies); i++)
+        for (unsigned iCopy = 0; iCopy < s_acCopies[i]; iCopy++, GCPhys += PAGE_SIZE)
+            RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, GCPhys, &pbPages[i * PAGE_SIZE], PAGE_SIZE), VINF_SUCCESS);
+
+    /* The first pass converts one copy of each and merges the copies after
+       it, the second merges the first copies. */
+    TSTFUSIONSTATS Before;
+    tstQueryStats(pVM, &Before);
+    RTTESTI_CHECK_RC(tstScan(pVM, 2), VINF_SUCCESS);
+    TST_CHECK_STATS(pVM, &Before, 7 + 3, 2);
+
+    /* Nothing changes after that. */
+    tstQueryStats(pVM, &Before);
+    RTTESTI_CHECK_RC(tstScan(pVM, 1), VINF_SUCCESS);
+    TST_CHECK_STATS(pVM, &Before, 0, 0);
+
+    GCPhys = TST_GCPHYS_FIRST;
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acCopies); i++)
+        for (unsigned iCopy = 0; iCopy < s_acCopies[i]; iCopy++, GCPhys += PAGE_SIZE)
+            tstCheckPage(pVM, GCPhys, &pbPages[i * PAGE_SIZE]);
+
+    /* Writing to a shared page must only change that page. */
+    uint8_t abPage[PAGE_SIZE];
+    memcpy(abPage, pbPages, PAGE_SIZE);
+    abPage[42] ^= 0xff;
+    RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + 3 * PAGE_SIZE, &abPage[42], 1), VINF_SUCCESS);
+    for (unsigned iCopy = 0; iCopy < s_acCopies[0]; iCopy++)
+        tstCheckPage(pVM, TST_GCPHYS_FIRST + iCopy * PAGE_SIZE, iCopy == 3 ? abPage : pbPages);
+
+    RTMemFree(pbPages);
+}
+
+
+/**
+ * Hashes a page the way the GMM content deduplication index does
+ * (gmmR0DedupHashPage), except for the last word which is left out.
+ */
+static uint64_t tstHashPartial(uint8_t const *pbPage)
+{
+    uint64_t const *pu64  = (uint64_t const *)pbPage;
+    uint64_t        uHash = UINT64_C(0xcbf29ce484222325);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint64_t) - 1; i++)
+        uHash = (uHash ^ pu64[i]) * UINT64_C(0x00000100000001b3);
+    return uHash;
+}
+
+
+/** Completes the hash of tstHashPartial with the last word of the page. */
+static uint32_t tstHashFinal(uint64_t uPartial, uint64_t uLastWord)
+{
+    uint64_t const uHash = (uPartial ^ uLastWord) * UINT64_C(0x00000100000001b3);
+    return (uint32_t)(uHash ^ (uHash >> 32));
+}
+
+
+/** @callback_method_impl{FNRTSORTCMP} */
+static DECLCALLBACK(int) tstCompareHashWords(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    RT_NOREF(pvUser);
+    uint32_t const uHash1 = ((TSTHASHWORD const *)pvElement1)->uHash;
+    uint32_t const uHash2 = ((TSTHASHWORD const *)pvElement2)->uHash;
+    return uHash1 < uHash2 ? -1 : uHash1 > uHash2 ? 1 : 0;
+}
+
+
+/**
+ * Pages with different content but the same hash must not be fused.
+ *
+ * Two such pages are made by varying the last word of a random page until
+ * the hash repeats.
+ */
+static void tstCollision(PVM pVM)
+{
+    RTTestSub(g_hTest, "Hash collision");
+
+    uint8_t      abPage1[PAGE_SIZE];
+    uint8_t      abPage2[PAGE_SIZE];
+    TSTHASHWORD *paWords = (TSTHASHWORD *)RTMemAlloc(TST_COLLISION_TRIES * sizeof(TSTHASHWORD));
+    RTTESTI_CHECK_RETV(paWords);
+
+    RTRandBytes(abPage1, sizeof(abPage1));
+    uint64_t const uPartial = tstHashPartial(abPage1);
+    uint64_t const uBase    = RTRandU64();
+    for (uint32_t i = 0; i < TST_COLLISION_TRIES; i++)
+    {
+        paWords[i].uWord = uBase + i;
+        paWords[i].uHash = tstHashFinal(uPartial, uBase + i);
+    }
+    RTSortShell(paWords, TST_COLLISION_TRIES, sizeof(TSTHASHWORD), tstCompareHashWords, NULL);
+
+    uint32_t i = 1;
+    while (i < TST_COLLISION_TRIES && paWords[i].uHash != paWords[i - 1].uHash)
+        i++;
+    if (i >= TST_COLLISION_TRIES)
+    {
+        /* Happens with a likelihood of about 1 in 3000. */
+        RTTestSkipped(g_hTest, "No collision found");
+        RTMemFree(paWords);
+        return;
+    }
+    memcpy(abPage2, abPage1, sizeof(abPage2));
+    memcpy(&abPage1[PAGE_SIZE - sizeof(uint64_t)], &paWords[i - 1].uWord, sizeof(uint64_t));
+    memcpy(&abPage2[PAGE_SIZE - sizeof(uint64_t)], &paWords[i].uWord, sizeof(uint64_t));
+    RTMemFree(paWords);
+
+    RTGCPHYS const GCPhys1 = TST_GCPHYS_FIRST + _1M;
+    RTGCPHYS const GCPhys2 = GCPhys1 + PAGE_SIZE;
+    RTTESTI_CHECK_RC_RETV(PGMPhysSimpleWriteGCPhys(pVM, GCPhys1, abPage1, PAGE_SIZE), VINF_SUCCESS);
+    RTTESTI_CHECK_RC_RETV(PGMPhysSimpleWriteGCPhys(pVM, GCPhys2, abPage2, PAGE_SIZE), VINF_SUCCESS);
+
+    TSTFUSIONSTATS Before;
+    tstQueryStats(pVM, &Before);
+    RTTESTI_CHECK_RC(tstScan(pVM, 3), VINF_SUCCESS);
+    TST_CHECK_STATS(pVM, &Before, 0, 0);
+    tstCheckPage(pVM, GCPhys1, abPage1);
+    tstCheckPage(pVM, GCPhys2, abPage2);
+}
+
+
+/**
+ * Leaves a candidate behind in a VM that is destroyed afterwards.
+ */
+static DECLCALLBACK(int) tstLeaveCandidate(PVM pVM)
+{
+    RTTestSub(g_hTest, "Candidates of a destroyed VM");
+    RTRandBytes(g_abLeftover, sizeof(g_abLeftover));
+    RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + _2M, g_abLeftover, sizeof(g_abLeftover)),
+                     VINF_SUCCESS);
+    RTTESTI_CHECK_RC(tstScan(pVM, 2), VINF_SUCCESS);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that the candidate left behind by tstLeaveCandidate is gone: a copy
+ * of it only becomes a candidate itself.
+ */
+static DECLCALLBACK(int) tstCheckLeftover(PVM pVM)
+{
+    TSTFUSIONSTATS Before;
+    tstQueryStats(pVM, &Before);
+    RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + _2M, g_abLeftover, sizeof(g_abLeftover)),
+                     VINF_SUCCESS);
+    RTTESTI_CHECK_RC(tstScan(pVM, 2), VINF_SUCCESS);
+    TST_CHECK_STATS(pVM, &Before, 0, 0);
+    tstCheckPage(pVM, TST_GCPHYS_FIRST + _2M, g_abLeftover);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Does the testing on EMT(0).
+ */
+static DECLCALLBACK(int) tstWorker(PVM pVM, PFNTSTTEST pfnTest)
+{
+    /* Let the scanner deal with whatever the VM allocated on its own first. */
+    int rc = tstScan(pVM, 2);
+    if (rc == VERR_NOT_SUPPORTED || rc == VERR_NOT_IMPLEMENTED)
+    {
+        RTTestSkipped(g_hTest, "Page fusion isn't available: %Rrc", rc);
+        return rc;
+    }
+    RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+
+    return pfnTest(pVM);
+}
+
+
+/** Does the merging and collision tests. */
+static DECLCALLBACK(int) tstMergeAndCollision(PVM pVM)
+{
+    tstMerge(pVM);
+    tstCollision(pVM);
+    return tstLeaveCandidate(pVM);
+}
+
+
+static DECLCALLBACK(int) tstConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+        rc = CFGMR3InsertInteger(CFGMR3GetRoot(pVM), "PageFusionAllowed", 1);
+    return rc;
+}
+
+
+/**
+ * Creates a VM, runs @a pfnTest on EMT(0) and destroys the VM again.
+ *
+ * @returns VBox status code of the test, VERR_NOT_SUPPORTED or
+ *          VERR_NOT_IMPLEMENTED if page fusion isn't available.
+ * @param   pfnTest         The test.
+ */
+static int tstRunInVM(PFNTSTTEST pfnTest)
+{
+    /* Only one VM per support driver session, so they take turns. */
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTTestFailed(g_hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+        return rc;
+    }
+
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstWorker, 2, pVM, pfnTest);
+    if (RT_FAILURE(rc) && rc != VERR_NOT_SUPPORTED && rc != VERR_NOT_IMPLEMENTED)
+        RTTestFailed(g_hTest, "tstWorker failed: rc=%Rrc\n", rc);
+
+    int rc2 = VMR3PowerOff(pUVM);
+    if (RT_FAILURE(rc2))
+        RTTestFailed(g_hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc2);
+    rc2 = VMR3Destroy(pUVM);
+    if (RT_FAILURE(rc2))
+        RTTestFailed(g_hTest, "VMR3Destroy failed: rc=%Rrc\n", rc2);
+    VMR3ReleaseUVM(pUVM);
+    return rc;
+}
+
+
+/**
+ * Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstGMMDedup", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+#ifdef VBOX_WITH_PAGE_SHARING
+    if (RT_SUCCESS(tstRunInVM(tstMergeAndCollision)))
+        tstRunInVM(tstCheckLeftover);
+#else
+    RTTestSkipped(g_hTest, "Built without VBOX_WITH_PAGE_SHARING");
+#endif
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
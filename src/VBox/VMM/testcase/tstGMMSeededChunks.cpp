@@ -0,0 +1,269 @@
+/* $Id$ */
+/** @file
+ * Testcase for guest RAM large pages backed by host large pages seeded from
+ * ring-3 (/PGM/LargePageBacking).
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/param.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Where in guest RAM the testcase allocates its large pages. */
+#define TST_GCPHYS_FIRST        UINT64_C(0x02000000)
+/** The number of large pages allocated per VM. */
+#define TST_LARGE_PAGES         4
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * How the large pages of a VM were backed so far (/PGM/LargePage/Backing/).
+ */
+typedef struct TSTBACKINGSTATS
+{
+    uint64_t    cGmm;
+    uint64_t    cSeeded;
+    uint64_t    cRecycled;
+    uint64_t    cSeedFailed;
+} TSTBACKINGSTATS;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST   g_hTest;
+
+
+/** @callback_method_impl{FNSTAMR3ENUM, Gets the value of a counter.} */
+static DECLCALLBACK(int) tstGetCounter(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                       STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    RT_NOREF(pszName, enmUnit, enmVisiblity, pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        *(uint64_t *)pvUser = ((PSTAMCOUNTER)pvSample)->c;
+    return VINF_SUCCESS;
+}
+
+
+/** Gets the large page backing counters of the VM. */
+static void tstQueryStats(PVM pVM, TSTBACKINGSTATS *pStats)
+{
+    RT_ZERO(*pStats);
+    STAMR3Enum(pVM->pUVM, "/PGM/LargePage/Backing/Gmm",        tstGetCounter, &pStats->cGmm);
+    STAMR3Enum(pVM->pUVM, "/PGM/LargePage/Backing/Seeded",     tstGetCounter, &pStats->cSeeded);
+    STAMR3Enum(pVM->pUVM, "/PGM/LargePage/Backing/Recycled",   tstGetCounter, &pStats->cRecycled);
+    STAMR3Enum(pVM->pUVM, "/PGM/LargePage/Backing/SeedFailed", tstGetCounter, &pStats->cSeedFailed);
+}
+
+
+/** Gets the amount of private guest RAM of the VM. */
+static uint64_t tstQueryPrivateMem(PVM pVM)
+{
+    uint64_t cbTotal = 0, cbPrivate = 0, cbShared = 0, cbZero = 0;
+    RTTESTI_CHECK_RC(PGMR3QueryMemoryStats(pVM->pUVM, &cbTotal, &cbPrivate, &cbShared, &cbZero), VINF_SUCCESS);
+    return cbPrivate;
+}
+
+
+/**
+ * Checks that a freshly allocated large page reads as zeros and that writes
+ * to its first and last pages stick.
+ */
+static void tstCheckLargePage(PVM pVM, RTGCPHYS GCPhys)
+{
+    uint8_t abPage[PAGE_SIZE];
+    for (RTGCPHYS off = 0; off < _2M; off += PAGE_SIZE)
+    {
+        RTTESTI_CHECK_RC_RETV(PGMPhysSimpleReadGCPhys(pVM, abPage, GCPhys + off, PAGE_SIZE), VINF_SUCCESS);
+        if (!ASMMemIsZeroPage(abPage))
+        {
+            RTTestFailed(g_hTest, "Page %RGp isn't zero", GCPhys + off);
+            return;
+        }
+    }
+
+    static RTGCPHYS const s_aoffPages[] = { 0, _2M - PAGE_SIZE };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_aoffPages); i++)
+    {
+        RTGCPHYS const GCPhysPage = GCPhys + s_aoffPages[i];
+        uint64_t const uExpect    = GCPhysPage ^ UINT64_C(0x5eed5eed5eed5eed);
+        uint64_t       uValue     = 0;
+        RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, GCPhysPage + 8, &uExpect, sizeof(uExpect)), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(PGMPhysSimpleReadGCPhys(pVM, &uValue, GCPhysPage + 8, sizeof(uValue)), VINF_SUCCESS);
+        RTTESTI_CHECK_MSG(uValue == uExpect, ("%RGp: %#RX64, expected %#RX64\n", GCPhysPage + 8, uValue, uExpect));
+    }
+}
+
+
+/**
+ * Allocates TST_LARGE_PAGES large pages and checks how they were backed.
+ *
+ * @returns VBox status code, VERR_NOT_SUPPORTED or VERR_NOT_IMPLEMENTED if
+ *          large pages aren't available.
+ * @param   pVM             The cross context VM structure.
+ * @param   pszBacking      The configured backing.
+ */
+static DECLCALLBACK(int) tstWorker(PVM pVM, const char *pszBacking)
+{
+    TSTBACKINGSTATS Before;
+    tstQueryStats(pVM, &Before);
+    uint64_t const cbPrivateBefore = tstQueryPrivateMem(pVM);
+
+    for (unsigned i = 0; i < TST_LARGE_PAGES; i++)
+    {
+        RTGCPHYS const GCPhys = TST_GCPHYS_FIRST + i * _2M;
+        int rc = PGMR3PhysAllocateLargeHandyPage(pVM, GCPhys);
+        if (i == 0 && (rc == VERR_NOT_SUPPORTED || rc == VERR_NOT_IMPLEMENTED))
+        {
+            RTTestSkipped(g_hTest, "Large pages aren't available: %Rrc", rc);
+            return rc;
+        }
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        tstCheckLargePage(pVM, GCPhys);
+    }
+
+    RTTESTI_CHECK(tstQueryPrivateMem(pVM) - cbPrivateBefore == TST_LARGE_PAGES * _2M);
+
+    /*
+     * Each large page is backed exactly once.  A fresh VM has nothing to
+     * recycle, and a host failure is only counted when falling back on GMM.
+     */
+    TSTBACKINGSTATS After;
+    tstQueryStats(pVM, &After);
+    uint64_t const cGmm        = After.cGmm        - Before.cGmm;
+    uint64_t const cSeeded     = After.cSeeded     - Before.cSeeded;
+    uint64_t const cRecycled   = After.cRecycled   - Before.cRecycled;
+    uint64_t const cSeedFailed = After.cSeedFailed - Before.cSeedFailed;
+    RTTestIPrintf(RTTESTLVL_ALWAYS, "%s: gmm=%RU64 seeded=%RU64 recycled=%RU64 seed-failed=%RU64\n",
+                  pszBacking, cGmm, cSeeded, cRecycled, cSeedFailed);
+    RTTESTI_CHECK(cGmm + cSeeded + cRecycled == TST_LARGE_PAGES);
+    RTTESTI_CHECK(cRecycled == 0);
+    if (!strcmp(pszBacking, "gmm"))
+        RTTESTI_CHECK(cGmm == TST_LARGE_PAGES && cSeedFailed == 0);
+    else
+        RTTESTI_CHECK(cSeedFailed == cGmm);
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int) tstConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF1(pUVM);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        PCFGMNODE pPGM  = CFGMR3GetChild(pRoot, "PGM");
+        if (!pPGM)
+            rc = CFGMR3InsertNode(pRoot, "PGM", &pPGM);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertString(pPGM, "LargePageBacking", (const char *)pvUser);
+    }
+    return rc;
+}
+
+
+/**
+ * Creates a VM with the given backing, does the testing on EMT(0) and
+ * destroys the VM, releasing the memory it seeded.
+ *
+ * @returns VBox status code of the testing.
+ * @param   pszBacking      The /PGM/LargePageBacking value.
+ */
+static int tstRunInVM(const char *pszBacking)
+{
+    /* Only one VM per support driver session, so they take turns. */
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstConfigConstructor, (void *)pszBacking, &pVM, &pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTTestFailed(g_hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+        return rc;
+    }
+
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstWorker, 2, pVM, pszBacking);
+    if (RT_FAILURE(rc) && rc != VERR_NOT_SUPPORTED && rc != VERR_NOT_IMPLEMENTED)
+        RTTestFailed(g_hTest, "tstWorker failed: rc=%Rrc\n", rc);
+
+    int rc2 = VMR3PowerOff(pUVM);
+    if (RT_FAILURE(rc2))
+        RTTestFailed(g_hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc2);
+    rc2 = VMR3Destroy(pUVM);
+    if (RT_FAILURE(rc2))
+        RTTestFailed(g_hTest, "VMR3Destroy failed: rc=%Rrc\n", rc2);
+    VMR3ReleaseUVM(pUVM);
+    return rc;
+}
+
+
+/**
+ * Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstGMMSeededChunks", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    RTTestSub(g_hTest, "GMM large pages");
+    if (RT_SUCCESS(tstRunInVM("gmm")))
+    {
+        RTTestSub(g_hTest, "Transparent huge pages");
+        tstRunInVM("thp");
+
+        /* The seeded chunks of the previous VM are gone, so again nothing
+           is recycled. */
+        RTTestSub(g_hTest, "Transparent huge pages after cleanup");
+        tstRunInVM("thp");
+
+        RTTestSub(g_hTest, "hugetlbfs pages");
+        tstRunInVM("hugetlb");
+    }
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
@@ -0,0 +1,420 @@
+/* $Id$ */
+/** @file
+ * IEM Testcase - Instruction throughput benchmark.
+ *
+ * Runs a small guest loop thru IEMExecLots with and without the opcode page
+ * cache and, where possible, natively, reporting instructions per second.
+ * Also checks that the opcode page cache is coherent with self modifying
+ * guest code.
+ */
+
+/*
+ * Copyright (C) 2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/cpum.h>
+#include <VBox/vmm/iem.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <iprt/asm.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+#include <iprt/x86.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Where the guest code is placed. */
+#define TST_CODE_ADDR       UINT32_C(0x00010000)
+/** The number of guest instructions executed per loop iteration. */
+#define TST_INSTR_PER_ITER  5
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The test handle. */
+static RTTEST   g_hTest;
+/** Whether the VM being created should use the opcode page cache. */
+static bool     g_fOpcodeCache;
+
+/**
+ * The benchmark loop (32-bit code, also valid 64-bit code).
+ *
+ * @code
+ *          mov     ecx, <iterations>
+ *  .loop:  add     eax, ebx
+ *          xor     edx, eax
+ *          lea     ebx, [ebx + ebx + 1]
+ *          sub     ecx, 1
+ *          jnz     .loop
+ *          hlt
+ * @endcode
+ */
+static const uint8_t g_abLoop[] =
+{
+    0xb9, 0x00, 0x00, 0x00, 0x00,   /* mov ecx, imm32 - patched */
+    0x01, 0xd8,                     /* add eax, ebx */
+    0x31, 0xc2,                     /* xor edx, eax */
+    0x8d, 0x5c, 0x1b, 0x01,         /* lea ebx, [ebx + ebx + 1] */
+    0x83, 0xe9, 0x01,               /* sub ecx, 1 */
+    0x75, 0xf3,                     /* jnz .loop */
+    0xf4                            /* hlt */
+};
+/** Offset of the iteration count in g_abLoop. */
+#define TST_LOOP_OFF_COUNT  1
+
+/** Where the self modifying code is placed. */
+#define TST_SMC_ADDR        UINT32_C(0x00020000)
+
+/**
+ * Self modifying loop (32-bit code only).
+ *
+ * Each iteration increments the immediate of the instruction at the top of
+ * the loop, so the result is only right if every modification is picked up.
+ *
+ * @code
+ *          mov     ecx, <iterations>
+ *  .loop:  mov     eax, 1000h          ; .imm = .loop + 1
+ *          add     edx, eax
+ *          inc     dword [.imm]
+ *          sub     ecx, 1
+ *          jnz     .loop
+ *          hlt
+ * @endcode
+ */
+static const uint8_t g_abSmc[] =
+{
+    0xb9, 0x00, 0x00, 0x00, 0x00,   /* mov ecx, imm32 - patched */
+    0xb8, 0x00, 0x10, 0x00, 0x00,   /* mov eax, 1000h - modified by the loop */
+    0x01, 0xc2,                     /* add edx, eax */
+    0xff, 0x05, 0x00, 0x00, 0x00, 0x00, /* inc dword [abs32] - patched */
+    0x83, 0xe9, 0x01,               /* sub ecx, 1 */
+    0x75, 0xee,                     /* jnz .loop */
+    0xf4                            /* hlt */
+};
+/** Offset of the iteration count in g_abSmc. */
+#define TST_SMC_OFF_COUNT   1
+/** Offset of the modified immediate in g_abSmc. */
+#define TST_SMC_OFF_IMM     6
+/** Offset of the address operand of the inc instruction in g_abSmc. */
+#define TST_SMC_OFF_INC_PTR 14
+
+
+/**
+ * Computes the expected register values after running the loop.
+ */
+static void tstIEMBenchExpected(uint32_t cIterations, uint32_t *puEax, uint32_t *puEbx, uint32_t *puEdx)
+{
+    uint32_t uEax = 0, uEbx = 0, uEdx = 0;
+    while (cIterations-- > 0)
+    {
+        uEax += uEbx;
+        uEdx ^= uEax;
+        uEbx  = uEbx * 2 + 1;
+    }
+    *puEax = uEax;
+    *puEbx = uEbx;
+    *puEdx = uEdx;
+}
+
+
+/**
+ * Sets up the guest context for flat 32-bit protected mode execution of the
+ * loop.
+ */
+static void tstIEMBenchInitCtx(PCPUMCTX pCtx)
+{
+    pCtx->cr0 |= X86_CR0_PE;
+
+    pCtx->cs.Sel      = pCtx->cs.ValidSel = 0x08;
+    pCtx->cs.fFlags   = CPUMSELREG_FLAGS_VALID;
+    pCtx->cs.u64Base  = 0;
+    pCtx->cs.u32Limit = UINT32_MAX;
+    pCtx->cs.Attr.u   = 0xc09b; /* present, dpl 0, 32-bit execute/read code, accessed, 4K granularity */
+
+    PCPUMSELREG apSRegs[] = { &pCtx->ds, &pCtx->es, &pCtx->fs, &pCtx->gs, &pCtx->ss };
+    for (unsigned i = 0; i < RT_ELEMENTS(apSRegs); i++)
+    {
+        apSRegs[i]->Sel      = apSRegs[i]->ValidSel = 0x10;
+        apSRegs[i]->fFlags   = CPUMSELREG_FLAGS_VALID;
+        apSRegs[i]->u64Base  = 0;
+        apSRegs[i]->u32Limit = UINT32_MAX;
+        apSRegs[i]->Attr.u   = 0xc093; /* present, dpl 0, 32-bit read/write data, accessed, 4K granularity */
+    }
+
+    pCtx->rax    = 0;
+    pCtx->rbx    = 0;
+    pCtx->rdx    = 0;
+    pCtx->rip    = TST_CODE_ADDR;
+    pCtx->rflags.u = X86_EFL_1;
+}
+
+
+/**
+ * Runs the loop thru IEM, EMT worker.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   cIterations     The number of loop iterations.
+ * @param   pcNsElapsed     Where to return the time it took.
+ */
+static DECLCALLBACK(int) tstIEMBenchRunOnEmt(PVM pVM, uint32_t cIterations, uint64_t *pcNsElapsed)
+{
+    PVMCPU pVCpu = VMMGetCpu(pVM);
+
+    uint8_t abCode[sizeof(g_abLoop)];
+    memcpy(abCode, g_abLoop, sizeof(abCode));
+    memcpy(&abCode[TST_LOOP_OFF_COUNT], &cIterations, sizeof(cIterations));
+    int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_CODE_ADDR, abCode, sizeof(abCode));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PCPUMCTX pCtx = CPUMQueryGuestCtxPtr(pVCpu);
+    tstIEMBenchInitCtx(pCtx);
+
+    uint64_t const nsStart = RTTimeNanoTS();
+    VBOXSTRICTRC   rcStrict;
+    do
+    {
+        uint32_t cInstructions = 0;
+        rcStrict = IEMExecLots(pVCpu, &cInstructions);
+    } while (rcStrict == VINF_SUCCESS);
+    *pcNsElapsed = RTTimeNanoTS() - nsStart;
+
+    if (rcStrict != VINF_EM_HALT)
+    {
+        RTTestFailed(g_hTest, "IEMExecLots returned %Rrc at %RX64\n", VBOXSTRICTRC_VAL(rcStrict), pCtx->rip);
+        return RT_FAILURE(VBOXSTRICTRC_VAL(rcStrict)) ? VBOXSTRICTRC_VAL(rcStrict) : VERR_INTERNAL_ERROR;
+    }
+
+    uint32_t uEax, uEbx, uEdx;
+    tstIEMBenchExpected(cIterations, &uEax, &uEbx, &uEdx);
+    if (pCtx->eax != uEax || pCtx->ebx != uEbx || pCtx->edx != uEdx)
+        RTTestFailed(g_hTest, "Wrong result: eax=%#x ebx=%#x edx=%#x, expected %#x %#x %#x\n",
+                     pCtx->eax, pCtx->ebx, pCtx->edx, uEax, uEbx, uEdx);
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int) tstIEMBenchConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pIem;
+        rc = CFGMR3InsertNode(CFGMR3GetRoot(pVM), "IEM", &pIem);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pIem, "OpcodeCache", g_fOpcodeCache);
+    }
+    return rc;
+}
+
+
+/**
+ * Benchmarks IEM with or without the opcode page cache.
+ */
+static void tstIEMBenchInterpreted(bool fOpcodeCache, uint32_t cIterations)
+{
+    RTTestSubF(g_hTest, "IEM, opcode cache %s", fOpcodeCache ? "enabled" : "disabled");
+    g_fOpcodeCache = fOpcodeCache;
+
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstIEMBenchConfigConstructor, NULL, NULL, &pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTTestFailed(g_hTest, "VMR3Create failed: %Rrc\n", rc);
+        return;
+    }
+
+    uint64_t cNsElapsed = 0;
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstIEMBenchRunOnEmt, 3, VMR3GetVM(pUVM), cIterations, &cNsElapsed);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t const cInstrs = (uint64_t)cIterations * TST_INSTR_PER_ITER + 2;
+        RTTestValue(g_hTest, "Elapsed", cNsElapsed, RTTESTUNIT_NS);
+        RTTestValue(g_hTest, "Throughput", cInstrs * RT_NS_1SEC / RT_MAX(cNsElapsed, 1), RTTESTUNIT_INSTRS_PER_SEC);
+        if (fOpcodeCache)
+            STAMR3Print(pUVM, "/IEM/*OpcodeCache*");
+    }
+    else
+        RTTestFailed(g_hTest, "Running the loop failed: %Rrc\n", rc);
+
+    rc = VMR3Destroy(pUVM);
+    if (RT_FAILURE(rc))
+        RTTestFailed(g_hTest, "VMR3Destroy failed: %Rrc\n", rc);
+    VMR3ReleaseUVM(pUVM);
+}
+
+
+/**
+ * Runs the self modifying loop thru IEM and checks the result, EMT worker.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ * @param   cIterations     The number of loop iterations.
+ */
+static DECLCALLBACK(int) tstIEMBenchSmcOnEmt(PVM pVM, uint32_t cIterations)
+{
+    PVMCPU pVCpu = VMMGetCpu(pVM);
+
+    uint8_t abCode[sizeof(g_abSmc)];
+    memcpy(abCode, g_abSmc, sizeof(abCode));
+    memcpy(&abCode[TST_SMC_OFF_COUNT], &cIterations, sizeof(cIterations));
+    uint32_t const uImmAddr = TST_SMC_ADDR + TST_SMC_OFF_IMM;
+    memcpy(&abCode[TST_SMC_OFF_INC_PTR], &uImmAddr, sizeof(uImmAddr));
+    int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_SMC_ADDR, abCode, sizeof(abCode));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PCPUMCTX pCtx = CPUMQueryGuestCtxPtr(pVCpu);
+    tstIEMBenchInitCtx(pCtx);
+    pCtx->rip = TST_SMC_ADDR;
+
+    VBOXSTRICTRC rcStrict;
+    do
+    {
+        uint32_t cInstructions = 0;
+        rcStrict = IEMExecLots(pVCpu, &cInstructions);
+    } while (rcStrict == VINF_SUCCESS);
+    if (rcStrict != VINF_EM_HALT)
+    {
+        RTTestFailed(g_hTest, "IEMExecLots returned %Rrc at %RX64\n", VBOXSTRICTRC_VAL(rcStrict), pCtx->rip);
+        return RT_FAILURE(VBOXSTRICTRC_VAL(rcStrict)) ? VBOXSTRICTRC_VAL(rcStrict) : VERR_INTERNAL_ERROR;
+    }
+
+    uint32_t uEdx = 0;
+    for (uint32_t i = 0; i < cIterations; i++)
+        uEdx += UINT32_C(0x1000) + i;
+    uint32_t const uEax = UINT32_C(0x1000) + cIterations - 1;
+    if (pCtx->eax != uEax || pCtx->edx != uEdx)
+        RTTestFailed(g_hTest, "Stale opcodes executed (%u iterations): eax=%#x edx=%#x, expected %#x %#x\n",
+                     cIterations, pCtx->eax, pCtx->edx, uEax, uEdx);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that IEM with the opcode page cache executes self modifying code
+ * correctly, both while the cache keeps re-arming the page and after it has
+ * given up on it.
+ */
+static void tstIEMBenchSelfModifying(void)
+{
+    RTTestSub(g_hTest, "Self modifying code");
+    g_fOpcodeCache = true;
+
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstIEMBenchConfigConstructor, NULL, NULL, &pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTTestFailed(g_hTest, "VMR3Create failed: %Rrc\n", rc);
+        return;
+    }
+
+    static uint32_t const s_acIterations[] = { 1, 4, 256 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acIterations); i++)
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstIEMBenchSmcOnEmt, 2, VMR3GetVM(pUVM), s_acIterations[i]);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "Running the self modifying loop failed: %Rrc\n", rc);
+    }
+
+    rc = VMR3Destroy(pUVM);
+    if (RT_FAILURE(rc))
+        RTTestFailed(g_hTest, "VMR3Destroy failed: %Rrc\n", rc);
+    VMR3ReleaseUVM(pUVM);
+}
+
+
+/**
+ * Benchmarks the loop running natively on the host for reference.
+ */
+static void tstIEMBenchNative(uint32_t cIterations)
+{
+    RTTestSub(g_hTest, "Native");
+#if defined(RT_ARCH_AMD64) || defined(RT_ARCH_X86)
+    /* Wrap the loop in push ebx/rbx ... pop ebx/rbx + ret instead of the hlt. */
+    uint8_t *pbCode = (uint8_t *)RTMemExecAlloc(sizeof(g_abLoop) + 8);
+    if (!pbCode)
+    {
+        RTTestSkipped(g_hTest, "RTMemExecAlloc failed");
+        return;
+    }
+    pbCode[0] = 0x53;                                               /* push ebx */
+    memcpy(&pbCode[1], g_abLoop, sizeof(g_abLoop) - 1);
+    memcpy(&pbCode[1 + TST_LOOP_OFF_COUNT], &cIterations, sizeof(cIterations));
+    pbCode[sizeof(g_abLoop)]     = 0x5b;                            /* pop ebx */
+    pbCode[sizeof(g_abLoop) + 1] = 0xc3;                            /* ret */
+
+    DECLCALLBACKPTR(void, pfnLoop)(void) = (void (RTCALL *)(void))(uintptr_t)pbCode;
+    uint64_t const nsStart    = RTTimeNanoTS();
+    pfnLoop();
+    uint64_t const cNsElapsed = RTTimeNanoTS() - nsStart;
+
+    uint64_t const cInstrs = (uint64_t)cIterations * TST_INSTR_PER_ITER + 1;
+    RTTestValue(g_hTest, "Elapsed", cNsElapsed, RTTESTUNIT_NS);
+    RTTestValue(g_hTest, "Throughput", cInstrs * RT_NS_1SEC / RT_MAX(cNsElapsed, 1), RTTESTUNIT_INSTRS_PER_SEC);
+    RTMemExecFree(pbCode, sizeof(g_abLoop) + 8);
+#else
+    RT_NOREF(cIterations);
+    RTTestSkipped(g_hTest, "Not an x86 host");
+#endif
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstIEMBench", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    uint32_t cIterations = _4M;
+    if (argc > 1)
+        cIterations = RT_MAX(RTStrToUInt32(argv[1]), 1);
+
+    tstIEMBenchSelfModifying();
+    tstIEMBenchInterpreted(true /*fOpcodeCache*/, cIterations);
+    tstIEMBenchInterpreted(false /*fOpcodeCache*/, cIterations);
+    tstIEMBenchNative(RT_MIN(cIterations, UINT32_MAX / 64) * 64);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
+
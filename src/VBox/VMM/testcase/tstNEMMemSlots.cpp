@@ -0,0 +1,180 @@
+/* $Id$ */
+/** @file
+ * Testcase for the KVM memory slots of the Linux NEM backend.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/nem.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/param.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The size of the windows KVM memory slots are confined to. */
+#define TST_SLOT_WINDOW         _2M
+/** A guest RAM page the testcase writes to after pre-mapping. */
+#define TST_GCPHYS_WRITE        UINT64_C(0x01000000)
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST   g_hTest;
+
+
+/** @callback_method_impl{FNSTAMR3ENUM, Gets the value of a counter.} */
+static DECLCALLBACK(int) tstGetCounter(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                       STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    RT_NOREF(pszName, enmUnit, enmVisiblity, pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        *(uint64_t *)pvUser = ((PSTAMCOUNTER)pvSample)->c;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that the guest RAM, none of which has been touched yet, was mapped
+ * into KVM memory slots while initializing the VM.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM structure.
+ */
+static DECLCALLBACK(int) tstWorker(PVM pVM)
+{
+    uint64_t cbRam = 0;
+    RTTESTI_CHECK_RC_RET(CFGMR3QueryU64(CFGMR3GetRoot(pVM), "RamSize", &cbRam), VINF_SUCCESS, VERR_INTERNAL_ERROR);
+
+    /*
+     * Each slot is confined to one window, so fully mapped RAM takes at
+     * least a slot per window.  Allocating the fresh RAM pages while mapping
+     * must not cost any slots either.
+     */
+    uint64_t cMapped   = 0;
+    uint64_t cUnmapped = 0;
+    STAMR3Enum(pVM->pUVM, "/NEM/MemSlotMap",   tstGetCounter, &cMapped);
+    STAMR3Enum(pVM->pUVM, "/NEM/MemSlotUnmap", tstGetCounter, &cUnmapped);
+    RTTestIPrintf(RTTESTLVL_ALWAYS, "%RU64 MB RAM: %RU64 slots mapped, %RU64 unmapped\n", cbRam / _1M, cMapped, cUnmapped);
+    RTTESTI_CHECK_MSG(cMapped >= cbRam / TST_SLOT_WINDOW, ("cMapped=%RU64, expected at least %RU64\n", cMapped, cbRam / TST_SLOT_WINDOW));
+    RTTESTI_CHECK_MSG(cUnmapped == 0, ("cUnmapped=%RU64\n", cUnmapped));
+
+    /*
+     * The pages are backed by now, so writing one leaves the slots be.
+     */
+    uint64_t const uExpect = UINT64_C(0x4e454d4d656d536c);
+    uint64_t       uValue  = 0;
+    RTTESTI_CHECK_RC(PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_WRITE, &uExpect, sizeof(uExpect)), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(PGMPhysSimpleReadGCPhys(pVM, &uValue, TST_GCPHYS_WRITE, sizeof(uValue)), VINF_SUCCESS);
+    RTTESTI_CHECK(uValue == uExpect);
+
+    uint64_t cUnmappedAfter = 0;
+    STAMR3Enum(pVM->pUVM, "/NEM/MemSlotUnmap", tstGetCounter, &cUnmappedAfter);
+    RTTESTI_CHECK_MSG(cUnmappedAfter == cUnmapped, ("cUnmappedAfter=%RU64, expected %RU64\n", cUnmappedAfter, cUnmapped));
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int) tstConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        PCFGMNODE pHM   = CFGMR3GetChild(pRoot, "HM");
+        if (!pHM)
+            rc = CFGMR3InsertNode(pRoot, "HM", &pHM);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pHM, "UseNEMInstead", true);
+
+        PCFGMNODE pNEM = CFGMR3GetChild(pRoot, "NEM");
+        if (RT_SUCCESS(rc) && !pNEM)
+            rc = CFGMR3InsertNode(pRoot, "NEM", &pNEM);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pNEM, "UseKvm", true);
+    }
+    return rc;
+}
+
+
+/**
+ * Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstNEMMemSlots", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    RTTestSub(g_hTest, "Pre-mapping fresh RAM");
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        if (NEMR3IsEnabled(pUVM))
+        {
+            rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstWorker, 1, pVM);
+            if (RT_FAILURE(rc))
+                RTTestFailed(g_hTest, "tstWorker failed: rc=%Rrc\n", rc);
+        }
+        else
+            RTTestSkipped(g_hTest, "The VM isn't using NEM");
+
+        rc = VMR3PowerOff(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc);
+        rc = VMR3Destroy(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "VMR3Destroy failed: rc=%Rrc\n", rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else if (   rc == VERR_NEM_NOT_AVAILABLE
+             || rc == VERR_NEM_MISSING_KERNEL_API
+             || rc == VERR_NEM_INIT_FAILED)
+        RTTestSkipped(g_hTest, "KVM isn't usable: %Rrc", rc);
+    else
+        RTTestFailed(g_hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
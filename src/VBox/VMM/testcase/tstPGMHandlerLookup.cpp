@@ -0,0 +1,520 @@
+/* $Id$ */
+/** @file
+ * PGM physical access handler lookup testcase and benchmark.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Where in guest RAM the testcase registers its handlers. */
+#define TST_GCPHYS_FIRST        UINT64_C(0x02000000)
+/** The number of pages the handlers are spread over (the default tree gives
+ * the VM 128MB of RAM). */
+#define TST_PAGES               _16K
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A slice of guest RAM reserved for one handler.
+ *
+ * Keeping each handler within its own slot means registrations and
+ * modifications never conflict.  Slots smaller than a page come in runs
+ * sharing a page.
+ */
+typedef struct TSTSLOT
+{
+    /** The first address of the slot. */
+    RTGCPHYS            GCPhys;
+    /** The size of the slot. */
+    RTGCPHYS            cb;
+    /** The handler type. */
+    PGMPHYSHANDLERTYPE  hType;
+    /** Whether the handler is registered. */
+    bool                fRegistered;
+    /** The first address of the registered handler. */
+    RTGCPHYS            GCPhysCur;
+    /** The last address of the registered handler, second half included. */
+    RTGCPHYS            GCPhysLastCur;
+    /** Where the handler was split, 0 if it isn't. */
+    RTGCPHYS            GCPhysSplit;
+} TSTSLOT;
+typedef TSTSLOT *PTSTSLOT;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST               g_hTest;
+/** Write handler type. */
+static PGMPHYSHANDLERTYPE   g_hTypeWrite = NIL_PGMPHYSHANDLERTYPE;
+/** All access handler type. */
+static PGMPHYSHANDLERTYPE   g_hTypeAll   = NIL_PGMPHYSHANDLERTYPE;
+/** The slots. */
+static PTSTSLOT             g_paSlots;
+/** The number of slots. */
+static uint32_t             g_cSlots;
+
+
+/** @callback_method_impl{FNPGMPHYSHANDLER, Never called.} */
+static DECLCALLBACK(VBOXSTRICTRC)
+tstHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+           PGMACCESSTYPE enmAccessType, PGMACCESSORIGIN enmOrigin, void *pvUser)
+{
+    RT_NOREF(pVM, pVCpu, GCPhys, pvPhys, pvBuf, cbBuf, enmAccessType, enmOrigin, pvUser);
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
+
+
+/** @callback_method_impl{FNSTAMR3ENUM, Gets the value of a counter.} */
+static DECLCALLBACK(int) tstGetCounter(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                       STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    RT_NOREF(pszName, enmUnit, enmVisiblity, pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        *(uint64_t *)pvUser = ((PSTAMCOUNTER)pvSample)->c;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Gets the number of lookups resolved by the handler index so far.
+ *
+ * @returns The count, UINT64_MAX if the VMM was built without statistics.
+ */
+static uint64_t tstGetIdxLookups(PVM pVM)
+{
+    uint64_t c = UINT64_MAX;
+    STAMR3Enum(pVM->pUVM, "/PGM/R3/PhysHandlerLookupIdx", tstGetCounter, &c);
+    return c;
+}
+
+
+/** Checks whether the slot model has a handler covering @a GCPhys. */
+static bool tstIsCovered(RTGCPHYS GCPhys)
+{
+    /* The slots are sorted and handlers stay within theirs, so only the last
+       slot starting at or below the address can cover it. */
+    uint32_t iFirst = 0;
+    uint32_t iEnd   = g_cSlots;
+    while (iFirst < iEnd)
+    {
+        uint32_t const i = iFirst + (iEnd - iFirst) / 2;
+        if (g_paSlots[i].GCPhys <= GCPhys)
+            iFirst = i + 1;
+        else
+            iEnd = i;
+    }
+    if (!iFirst)
+        return false;
+    PTSTSLOT pSlot = &g_paSlots[iFirst - 1];
+    return pSlot->fRegistered && GCPhys >= pSlot->GCPhysCur && GCPhys <= pSlot->GCPhysLastCur;
+}
+
+
+/** Checks the lookup at @a GCPhys against the slot model. */
+static bool tstCheckAddr(PVM pVM, RTGCPHYS GCPhys)
+{
+    bool const fExpect = tstIsCovered(GCPhys);
+    if (PGMHandlerPhysicalIsRegistered(pVM, GCPhys) == fExpect)
+        return true;
+    RTTestFailed(g_hTest, "Lookup mismatch at %RGp: expected %RTbool", GCPhys, fExpect);
+    return false;
+}
+
+
+/** Checks the lookups on both sides of @a GCPhys and at the ends of its page. */
+static void tstCheckBoundary(PVM pVM, RTGCPHYS GCPhys)
+{
+    RTGCPHYS const GCPhysPage = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    tstCheckAddr(pVM, GCPhys - 1);
+    tstCheckAddr(pVM, GCPhys);
+    tstCheckAddr(pVM, GCPhys + 1);
+    tstCheckAddr(pVM, GCPhysPage);
+    tstCheckAddr(pVM, GCPhysPage + PAGE_OFFSET_MASK);
+}
+
+
+/** Checks the start, the end and a random address of every page. */
+static void tstCheckAll(PVM pVM)
+{
+    for (uint32_t iPage = 0; iPage < TST_PAGES; iPage++)
+    {
+        RTGCPHYS const GCPhysPage = TST_GCPHYS_FIRST + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        if (   !tstCheckAddr(pVM, GCPhysPage)
+            || !tstCheckAddr(pVM, GCPhysPage + PAGE_OFFSET_MASK)
+            || !tstCheckAddr(pVM, GCPhysPage + RTRandU32Ex(0, PAGE_OFFSET_MASK)))
+            return;
+    }
+}
+
+
+/** Picks a random extent within the slot, whole pages for all access handlers. */
+static void tstRandExtent(PTSTSLOT pSlot, RTGCPHYS *pGCPhys, RTGCPHYS *pGCPhysLast)
+{
+    if (pSlot->hType == g_hTypeAll)
+    {
+        uint32_t const cPages = (uint32_t)(pSlot->cb >> PAGE_SHIFT);
+        uint32_t const iFirst = RTRandU32Ex(0, cPages - 1);
+        *pGCPhys     = pSlot->GCPhys + ((RTGCPHYS)iFirst << PAGE_SHIFT);
+        *pGCPhysLast = pSlot->GCPhys + ((RTGCPHYS)RTRandU32Ex(iFirst, cPages - 1) << PAGE_SHIFT) + PAGE_OFFSET_MASK;
+    }
+    else
+    {
+        *pGCPhys     = pSlot->GCPhys + RTRandU64Ex(0, pSlot->cb - 2);
+        *pGCPhysLast = RTRandU64Ex(*pGCPhys + 1, pSlot->GCPhys + pSlot->cb - 1);
+    }
+}
+
+
+/**
+ * Carves the test area up into at most @a cSlots handler slots.
+ *
+ * Most cover whole pages like MMIO2 and ROM, the rest come in runs of small
+ * write handler slots sharing a page.
+ */
+static bool tstLayoutSlots(uint32_t cSlots)
+{
+    g_paSlots = (PTSTSLOT)RTMemAllocZ(sizeof(TSTSLOT) * cSlots);
+    RTTESTI_CHECK_RET(g_paSlots, false);
+
+    uint32_t const cAvgPages = RT_MAX(TST_PAGES / cSlots, 2);
+    RTGCPHYS const GCPhysEnd = TST_GCPHYS_FIRST + ((RTGCPHYS)TST_PAGES << PAGE_SHIFT);
+    RTGCPHYS       GCPhys    = TST_GCPHYS_FIRST;
+    uint32_t       i         = 0;
+    while (i < cSlots && GCPhys < GCPhysEnd)
+    {
+        if (RTRandU32Ex(0, 3) == 0)
+        {
+            for (uint32_t iSub = RTRandU32Ex(0, 2); iSub < 4 && i < cSlots; iSub++, i++)
+            {
+                g_paSlots[i].GCPhys = GCPhys + iSub * (PAGE_SIZE / 4);
+                g_paSlots[i].cb     = PAGE_SIZE / 4;
+                g_paSlots[i].hType  = g_hTypeWrite;
+            }
+            GCPhys += PAGE_SIZE;
+        }
+        else
+        {
+            RTGCPHYS const cb = (RTGCPHYS)RTRandU32Ex(1, cAvgPages * 2 - 1) << PAGE_SHIFT;
+            if (cb > GCPhysEnd - GCPhys)
+                break;
+            g_paSlots[i].GCPhys = GCPhys;
+            g_paSlots[i].cb     = cb;
+            g_paSlots[i].hType  = RTRandU32Ex(0, 1) == 0 ? g_hTypeAll : g_hTypeWrite;
+            GCPhys += cb;
+            i++;
+        }
+    }
+    g_cSlots = i;
+    return true;
+}
+
+
+static void tstRegister(PVM pVM, PTSTSLOT pSlot)
+{
+    RTGCPHYS GCPhys, GCPhysLast;
+    tstRandExtent(pSlot, &GCPhys, &GCPhysLast);
+    RTTESTI_CHECK_RC_RETV(PGMHandlerPhysicalRegister(pVM, GCPhys, GCPhysLast, pSlot->hType, NULL, NIL_RTR0PTR, NIL_RTRCPTR,
+                                                     "tstPGMHandlerLookup"), VINF_SUCCESS);
+    pSlot->fRegistered   = true;
+    pSlot->GCPhysCur     = GCPhys;
+    pSlot->GCPhysLastCur = GCPhysLast;
+    tstCheckBoundary(pVM, GCPhys);
+    tstCheckBoundary(pVM, GCPhysLast);
+}
+
+
+static void tstDeregister(PVM pVM, PTSTSLOT pSlot)
+{
+    if (pSlot->GCPhysSplit)
+    {
+        RTTESTI_CHECK_RC(PGMHandlerPhysicalDeregister(pVM, pSlot->GCPhysSplit), VINF_SUCCESS);
+        pSlot->GCPhysSplit = 0;
+    }
+    RTTESTI_CHECK_RC_RETV(PGMHandlerPhysicalDeregister(pVM, pSlot->GCPhysCur), VINF_SUCCESS);
+    pSlot->fRegistered = false;
+    tstCheckBoundary(pVM, pSlot->GCPhysCur);
+    tstCheckBoundary(pVM, pSlot->GCPhysLastCur);
+}
+
+
+/**
+ * Moves the handler within its slot.
+ *
+ * The new extent ends on a page boundary as PGMHandlerPhysicalModify only
+ * gets the page count right for those.
+ */
+static void tstModify(PVM pVM, PTSTSLOT pSlot)
+{
+    RTGCPHYS const GCPhysOld     = pSlot->GCPhysCur;
+    RTGCPHYS const GCPhysLastOld = pSlot->GCPhysLastCur;
+    RTGCPHYS GCPhys, GCPhysLast;
+    tstRandExtent(pSlot, &GCPhys, &GCPhysLast);
+    GCPhysLast |= PAGE_OFFSET_MASK;
+    RTTESTI_CHECK_RC_RETV(PGMHandlerPhysicalModify(pVM, GCPhysOld, GCPhys, GCPhysLast), VINF_SUCCESS);
+    pSlot->GCPhysCur     = GCPhys;
+    pSlot->GCPhysLastCur = GCPhysLast;
+    tstCheckBoundary(pVM, GCPhysOld);
+    tstCheckBoundary(pVM, GCPhysLastOld);
+    tstCheckBoundary(pVM, GCPhys);
+    tstCheckBoundary(pVM, GCPhysLast);
+}
+
+
+/**
+ * Splits the handler, on a page boundary half of the time, and checks the
+ * pages on either side of the split.
+ */
+static void tstSplit(PVM pVM, PTSTSLOT pSlot)
+{
+    bool const fMultiPage = (pSlot->GCPhysCur >> PAGE_SHIFT) != (pSlot->GCPhysLastCur >> PAGE_SHIFT);
+    RTGCPHYS   GCPhysSplit;
+    if (pSlot->hType == g_hTypeAll || (fMultiPage && RTRandU32Ex(0, 1) == 0))
+    {
+        if (!fMultiPage)
+            return;
+        GCPhysSplit = RT_ALIGN_64(RTRandU64Ex(pSlot->GCPhysCur + 1, pSlot->GCPhysLastCur & ~(RTGCPHYS)PAGE_OFFSET_MASK),
+                                  PAGE_SIZE);
+    }
+    else
+        GCPhysSplit = RTRandU64Ex(pSlot->GCPhysCur + 1, pSlot->GCPhysLastCur);
+
+    /* The second half is released on its own when joined or deregistered,
+       but PGMHandlerPhysicalSplit doesn't reference the type for it. */
+    PGMHandlerPhysicalTypeRetain(pVM, pSlot->hType);
+    RTTESTI_CHECK_RC_RETV(PGMHandlerPhysicalSplit(pVM, pSlot->GCPhysCur, GCPhysSplit), VINF_SUCCESS);
+    pSlot->GCPhysSplit = GCPhysSplit;
+    tstCheckBoundary(pVM, GCPhysSplit);
+}
+
+
+/**
+ * Joins the two halves of a split handler and checks the pages around where
+ * the split was.
+ */
+static void tstJoin(PVM pVM, PTSTSLOT pSlot)
+{
+    RTTESTI_CHECK_RC_RETV(PGMHandlerPhysicalJoin(pVM, pSlot->GCPhysCur, pSlot->GCPhysSplit), VINF_SUCCESS);
+    tstCheckBoundary(pVM, pSlot->GCPhysSplit);
+    pSlot->GCPhysSplit = 0;
+}
+
+
+/** Deregisters all handlers and frees the slots. */
+static void tstCleanupSlots(PVM pVM)
+{
+    for (uint32_t i = 0; i < g_cSlots; i++)
+        if (g_paSlots[i].fRegistered)
+            tstDeregister(pVM, &g_paSlots[i]);
+    RTMemFree(g_paSlots);
+    g_paSlots = NULL;
+    g_cSlots  = 0;
+}
+
+
+/**
+ * Random registration, deregistration, modification, splitting and joining,
+ * checking the lookups as we go.
+ */
+static void tstCorrectness(PVM pVM)
+{
+    RTTestSub(g_hTest, "Register, deregister, modify, split and join");
+    if (!tstLayoutSlots(4096))
+        return;
+    uint64_t const cIdxLookupsStart = tstGetIdxLookups(pVM);
+
+    for (uint32_t i = 0; i < g_cSlots; i++)
+        tstRegister(pVM, &g_paSlots[i]);
+    tstCheckAll(pVM);
+
+    for (uint32_t iOp = 0; iOp < 20000 && !RTTestErrorCount(g_hTest); iOp++)
+    {
+        PTSTSLOT pSlot = &g_paSlots[RTRandU32Ex(0, g_cSlots - 1)];
+        if (!pSlot->fRegistered)
+            tstRegister(pVM, pSlot);
+        else if (pSlot->GCPhysSplit)
+            tstJoin(pVM, pSlot);
+        else
+            switch (RTRandU32Ex(0, 2))
+            {
+                case 0:
+                    tstDeregister(pVM, pSlot);
+                    break;
+                case 1:
+                    if (pSlot->cb > PAGE_SIZE)
+                        tstModify(pVM, pSlot);
+                    break;
+                case 2:
+                    tstSplit(pVM, pSlot);
+                    break;
+            }
+
+        if (!(iOp % 997))
+            tstCheckAll(pVM);
+    }
+    tstCheckAll(pVM);
+
+    /* Most of those lookups should have been resolved by the index. */
+    uint64_t const cIdxLookups = tstGetIdxLookups(pVM);
+    if (cIdxLookups != UINT64_MAX)
+        RTTESTI_CHECK_MSG(cIdxLookups > cIdxLookupsStart, ("The handler index wasn't used\n"));
+
+    tstCleanupSlots(pVM);
+    tstCheckAll(pVM);
+}
+
+
+/**
+ * Times resolving handler lookups for the given number of handlers.
+ *
+ * Models a guest hammering monitored pages: most addresses hit a handler,
+ * the rest land on plain RAM next to them.
+ */
+static void tstBenchmark(PVM pVM, uint32_t cHandlers)
+{
+    uint32_t const cAddrs   = _16K;
+    RTGCPHYS      *paGCPhys = (RTGCPHYS *)RTMemAlloc(sizeof(RTGCPHYS) * cAddrs);
+    RTTESTI_CHECK_RETV(paGCPhys);
+    if (tstLayoutSlots(cHandlers))
+    {
+        for (uint32_t i = 0; i < g_cSlots; i++)
+            tstRegister(pVM, &g_paSlots[i]);
+
+        for (uint32_t i = 0; i < cAddrs; i++)
+        {
+            if (RTRandU32Ex(0, 3) != 0)
+            {
+                PTSTSLOT pSlot = &g_paSlots[RTRandU32Ex(0, g_cSlots - 1)];
+                paGCPhys[i] = RTRandU64Ex(pSlot->GCPhysCur, pSlot->GCPhysLastCur);
+            }
+            else
+                paGCPhys[i] = TST_GCPHYS_FIRST + RTRandU64Ex(0, ((RTGCPHYS)TST_PAGES << PAGE_SHIFT) - 1);
+        }
+
+        uint32_t const cPasses = 64;
+        uint32_t       cHits   = 0;
+        uint64_t const nsStart = RTTimeNanoTS();
+        for (uint32_t iPass = 0; iPass < cPasses; iPass++)
+            for (uint32_t i = 0; i < cAddrs; i++)
+                cHits += PGMHandlerPhysicalIsRegistered(pVM, paGCPhys[i]);
+        uint64_t const cNs = RTTimeNanoTS() - nsStart;
+        RTTESTI_CHECK(cHits >= cPasses * (cAddrs / 2));
+
+        RTTestValueF(g_hTest, (uint64_t)cPasses * cAddrs * RT_NS_1SEC / RT_MAX(cNs, 1), RTTESTUNIT_CALLS_PER_SEC,
+                     "%u handlers", g_cSlots);
+        tstCleanupSlots(pVM);
+    }
+    RTMemFree(paGCPhys);
+}
+
+
+/**
+ * Does the testing on EMT(0).
+ */
+static DECLCALLBACK(int) tstWorker(PVM pVM)
+{
+    int rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_WRITE, tstHandler,
+                                              NULL, NULL, NULL, NULL, NULL, NULL, "tst write", &g_hTypeWrite);
+    RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+    rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL, tstHandler,
+                                          NULL, NULL, NULL, NULL, NULL, NULL, "tst all", &g_hTypeAll);
+    RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+
+    tstCorrectness(pVM);
+
+    RTTestSub(g_hTest, "Lookup benchmark");
+    static uint32_t const s_acHandlers[] = { 16, 256, 4096, 16384 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acHandlers); i++)
+        tstBenchmark(pVM, s_acHandlers[i]);
+
+    PGMHandlerPhysicalTypeRelease(pVM, g_hTypeWrite);
+    PGMHandlerPhysicalTypeRelease(pVM, g_hTypeAll);
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int)
+tstPGMHandlerLookupConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    return CFGMR3ConstructDefaultTree(pVM);
+}
+
+
+/**
+ * Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstPGMHandlerLookup", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstPGMHandlerLookupConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstWorker, 1, pVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "tstWorker failed: rc=%Rrc\n", rc);
+
+        rc = VMR3PowerOff(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc);
+        rc = VMR3Destroy(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(g_hTest, "VMR3Destroy failed: rc=%Rrc\n", rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+        RTTestFailed(g_hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
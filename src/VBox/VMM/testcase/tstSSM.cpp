@@ -20,6 +20,7 @@
 *   Header Files                                                                                                                 *
 *********************************************************************************************************************************/
 #include <VBox/vmm/ssm.h>
+#include "SSMInternal.h" /* compression settings */
 #include "VMInternal.h" /* createFakeVM */
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
@@ -827,6 +828,50 @@ extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
     u64Elapsed = RTTimeNanoTS() - u64Start;
     RTPrintf("tstSSM: Validated and checksummed in %'RI64 ns\n", u64Elapsed);
 
+    /*
+     * Do another round using zlib compression on a couple of worker threads.
+     */
+    const char *pszFilenameZlib = "SSMTestSave#2";
+    pVM->ssm.s.uZipCodec   = SSM_ZIP_CODEC_ZLIB;
+    pVM->ssm.s.cZipThreads = 4;
+    u64Start = RTTimeNanoTS();
+    rc = SSMR3Save(pVM, pszFilenameZlib, NULL, NULL, SSMAFTER_DESTROY, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Save #2 -> %Rrc\n", rc);
+        return 1;
+    }
+    u64Elapsed = RTTimeNanoTS() - u64Start;
+    RTPrintf("tstSSM: Saved with zlib in %'RI64 ns\n", u64Elapsed);
+
+    rc = RTPathQueryInfo(pszFilenameZlib, &Info, RTFSOBJATTRADD_NOTHING);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstSSM: failed to query file size: %Rrc\n", rc);
+        return 1;
+    }
+    RTPrintf("tstSSM: file size %'RI64 bytes\n", Info.cbObject);
+
+    u64Start = RTTimeNanoTS();
+    rc = SSMR3Load(pVM, pszFilenameZlib, NULL /*pStreamOps*/, NULL /*pStreamOpsUser*/,
+                   SSMAFTER_RESUME, NULL /*pfnProgress*/, NULL /*pvProgressUser*/);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Load #2 -> %Rrc\n", rc);
+        return 1;
+    }
+    u64Elapsed = RTTimeNanoTS() - u64Start;
+    RTPrintf("tstSSM: Loaded zlib state in %'RI64 ns\n", u64Elapsed);
+
+    rc = SSMR3ValidateFile(pszFilenameZlib, true /* fChecksumIt */);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3ValidateFile #2 -> %Rrc\n", rc);
+        return 1;
+    }
+    RTFileDelete(pszFilenameZlib);
+    pVM->ssm.s.uZipCodec   = SSM_ZIP_CODEC_LZF;
+
     /*
      * Open it and read.
      */
@@ -0,0 +1,434 @@
+/* $Id$ */
+/** @file
+ * STAM shared memory export testcase.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/process.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST       g_hTest;
+/** The segment name the testcase configures. */
+static char         g_szName[64];
+/** A counter sample. */
+static STAMCOUNTER  g_Counter;
+/** A 32-bit sample. */
+static uint32_t     g_u32;
+/** The sample of the callback sample. */
+static uint32_t     g_uCallbackSample;
+/** Set to make the next call to the callback sample block until
+ *  g_hEvtRelease is signalled. */
+static bool volatile g_fBlock;
+/** Signalled by the callback sample when it blocks. */
+static RTSEMEVENT   g_hEvtBlocked;
+/** Releases the blocked callback sample. */
+static RTSEMEVENT   g_hEvtRelease;
+
+
+static DECLCALLBACK(int)
+tstSTAMExportConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        CFGMR3RemoveValue(pRoot, "Name");
+        rc = CFGMR3InsertString(pRoot, "Name", "tstSTAMExport");
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+
+        PCFGMNODE pStam;
+        rc = CFGMR3InsertNode(pRoot, "STAM", &pStam);
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        PCFGMNODE pExport;
+        rc = CFGMR3InsertNode(pStam, "Export", &pExport);
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        rc = CFGMR3InsertInteger(pExport, "Enabled", true);
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        rc = CFGMR3InsertInteger(pExport, "IntervalMs", 10);
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        rc = CFGMR3InsertString(pExport, "Name", g_szName);
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+        rc = CFGMR3InsertString(pExport, "Pattern", "/tstSTAMExport/*");
+        RTTESTI_CHECK_RC_RET(rc, VINF_SUCCESS, rc);
+    }
+    return rc;
+}
+
+
+/**
+ * Creates a VM exporting its statistics under the test name.
+ *
+ * @returns The user mode VM handle, NULL on failure.
+ * @param   ppVM            Where to return the cross context VM structure.
+ */
+static PUVM tstCreateVM(PVM *ppVM)
+{
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstSTAMExportConfigConstructor, NULL, ppVM, &pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTTestFailed(g_hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+        return NULL;
+    }
+    return pUVM;
+}
+
+
+/**
+ * Powers off and destroys a VM created by tstCreateVM.
+ *
+ * @param   pUVM            The user mode VM handle.
+ */
+static void tstDestroyVM(PUVM pUVM)
+{
+    int rc = VMR3PowerOff(pUVM);
+    if (RT_FAILURE(rc))
+        RTTestFailed(g_hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc);
+    rc = VMR3Destroy(pUVM);
+    if (RT_FAILURE(rc))
+        RTTestFailed(g_hTest, "VMR3Destroy failed: rc=%Rrc\n", rc);
+    VMR3ReleaseUVM(pUVM);
+}
+
+
+/**
+ * Creates a segment under the test name as some other process would.
+ *
+ * @returns The descriptor, -1 on failure.
+ * @param   u32Magic        The header magic.
+ * @param   uPid            The header PID.
+ */
+static int tstCreateForeign(uint32_t u32Magic, uint32_t uPid)
+{
+    shm_unlink(g_szName);
+    int fd = shm_open(g_szName, O_RDWR | O_CREAT | O_EXCL, 0640);
+    RTTESTI_CHECK_RET(fd >= 0, -1);
+    RTTESTI_CHECK(ftruncate(fd, _4K) == 0);
+    PSTAMSHMHDR pHdr = (PSTAMSHMHDR)mmap(NULL, _4K, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    RTTESTI_CHECK(pHdr != MAP_FAILED);
+    if (pHdr != MAP_FAILED)
+    {
+        pHdr->u32Magic    = u32Magic;
+        pHdr->uPid        = uPid;
+        pHdr->cMsInterval = 12345; /* marker */
+        munmap(pHdr, _4K);
+    }
+    return fd;
+}
+
+
+/**
+ * Reads the header of the segment currently under the test name.
+ *
+ * @returns true if found, false if not.
+ * @param   pHdr            Where to return the header.
+ */
+static bool tstReadHdr(PSTAMSHMHDR pHdr)
+{
+    int fd = shm_open(g_szName, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    void *pv = mmap(NULL, sizeof(*pHdr), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    RTTESTI_CHECK_RET(pv != MAP_FAILED, false);
+    memcpy(pHdr, pv, sizeof(*pHdr));
+    munmap(pv, sizeof(*pHdr));
+    return true;
+}
+
+
+/**
+ * Maps the whole segment under the test name read-only, like a reader would.
+ *
+ * @returns The mapping, NULL on failure.
+ * @param   pcbMap          Where to return the size of the mapping.
+ */
+static uint8_t *tstMapSegment(size_t *pcbMap)
+{
+    STAMSHMHDR Hdr;
+    RTTESTI_CHECK_RET(tstReadHdr(&Hdr), NULL);
+    int fd = shm_open(g_szName, O_RDONLY, 0);
+    RTTESTI_CHECK_RET(fd >= 0, NULL);
+    void *pv = mmap(NULL, Hdr.cbSegment, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    RTTESTI_CHECK_RET(pv != MAP_FAILED, NULL);
+    *pcbMap = Hdr.cbSegment;
+    return (uint8_t *)pv;
+}
+
+
+/**
+ * Waits for the publisher to do @a cUpdates more updates.
+ *
+ * @param   pHdr            The header in a mapping of the segment.
+ * @param   cUpdates        The number of updates to wait for.
+ */
+static void tstWaitUpdates(PSTAMSHMHDR pHdr, uint64_t cUpdates)
+{
+    uint64_t const cTarget = ASMAtomicReadU64(&pHdr->cUpdates) + cUpdates;
+    for (unsigned i = 0; i < 500 && ASMAtomicReadU64(&pHdr->cUpdates) < cTarget; i++)
+        RTThreadSleep(10);
+    RTTESTI_CHECK(ASMAtomicReadU64(&pHdr->cUpdates) >= cTarget);
+}
+
+
+/**
+ * The callback sample, blocking the first caller after g_fBlock is set.
+ */
+static DECLCALLBACK(void) tstPrintCallback(PVM pVM, void *pvSample, char *pszBuf, size_t cchBuf)
+{
+    RT_NOREF(pVM, pvSample);
+    if (ASMAtomicXchgBool(&g_fBlock, false))
+    {
+        RTSemEventSignal(g_hEvtBlocked);
+        RTSemEventWait(g_hEvtRelease, RT_INDEFINITE_WAIT);
+    }
+    RTStrCopy(pszBuf, cchBuf, "ok");
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, Destroys the VM given by pvUser.}
+ */
+static DECLCALLBACK(int) tstDestroyThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    RT_NOREF(hThreadSelf);
+    tstDestroyVM((PUVM)pvUser);
+    return VINF_SUCCESS;
+}
+
+
+static void tstPublish(void)
+{
+    RTTestSub(g_hTest, "Publishing");
+    g_Counter.c = 42;
+    g_u32       = 0x1234;
+
+    PVM  pVM;
+    PUVM pUVM = tstCreateVM(&pVM);
+    if (!pUVM)
+        return;
+    RTTESTI_CHECK_RC(STAMR3RegisterU(pUVM, &g_Counter, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, "/tstSTAMExport/Counter",
+                                     STAMUNIT_OCCURENCES, "A counter."), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(STAMR3RegisterU(pUVM, &g_u32, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, "/tstSTAMExport/U32",
+                                     STAMUNIT_COUNT, NULL), VINF_SUCCESS);
+
+    size_t   cbMap = 0;
+    uint8_t *pbMap = tstMapSegment(&cbMap);
+    if (!pbMap)
+    {
+        tstDestroyVM(pUVM);
+        return;
+    }
+    PSTAMSHMHDR pHdr = (PSTAMSHMHDR)pbMap;
+    tstWaitUpdates(pHdr, 2);
+
+    RTTESTI_CHECK(pHdr->u32Magic == STAMSHMHDR_MAGIC);
+    RTTESTI_CHECK(pHdr->uPid == (uint32_t)RTProcSelf());
+    RTTESTI_CHECK(pHdr->cMsInterval == 10);
+    RTTESTI_CHECK(!strcmp(pHdr->szVMName, "tstSTAMExport"));
+    RTTESTI_CHECK(pHdr->cDescs == 2);
+    if (pHdr->cDescs == 2)
+    {
+        PCSTAMSHMDESC paDescs = (PCSTAMSHMDESC)&pbMap[pHdr->offDescs];
+        const char   *pchStrs = (const char *)&pbMap[pHdr->offStrings];
+        RTTESTI_CHECK(!strcmp(&pchStrs[paDescs[0].offName], "/tstSTAMExport/Counter"));
+        RTTESTI_CHECK(!strcmp(&pchStrs[paDescs[0].offDesc], "A counter."));
+        RTTESTI_CHECK(!strcmp(&pchStrs[paDescs[1].offName], "/tstSTAMExport/U32"));
+        RTTESTI_CHECK(paDescs[1].offDesc == STAMSHM_NO_DESC);
+        RTTESTI_CHECK(((PCSTAMCOUNTER)&pbMap[pHdr->offValues + paDescs[0].offValue])->c == 42);
+        RTTESTI_CHECK(*(uint32_t const *)&pbMap[pHdr->offValues + paDescs[1].offValue] == 0x1234);
+
+        /* Values are updated in place. */
+        g_Counter.c = 43;
+        tstWaitUpdates(pHdr, 2);
+        RTTESTI_CHECK(((PCSTAMCOUNTER)&pbMap[pHdr->offValues + paDescs[0].offValue])->c == 43);
+    }
+
+    /* Deregistering rebuilds the layout. */
+    uint32_t const uLayoutGen = ASMAtomicReadU32(&pHdr->uLayoutGen);
+    RTTESTI_CHECK_RC(STAMR3Deregister(pUVM, "/tstSTAMExport/U32"), VINF_SUCCESS);
+    tstWaitUpdates(pHdr, 2);
+    RTTESTI_CHECK(ASMAtomicReadU32(&pHdr->uLayoutGen) != uLayoutGen);
+    RTTESTI_CHECK(pHdr->cDescs == 1);
+
+    /* Destroying the VM marks it dead and unlinks it. */
+    tstDestroyVM(pUVM);
+    RTTESTI_CHECK(pHdr->u32Magic == ~STAMSHMHDR_MAGIC);
+    STAMSHMHDR Hdr;
+    RTTESTI_CHECK(!tstReadHdr(&Hdr));
+    munmap(pbMap, cbMap);
+}
+
+
+static void tstStale(void)
+{
+    RTTestSub(g_hTest, "Stale and live segments");
+    STAMSHMHDR Hdr;
+    PVM        pVM;
+    PUVM       pUVM;
+
+    /* Left behind by a process with our PID: replaced. */
+    int fd = tstCreateForeign(STAMSHMHDR_MAGIC, (uint32_t)RTProcSelf());
+    close(fd);
+    pUVM = tstCreateVM(&pVM);
+    if (pUVM)
+    {
+        RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.cMsInterval == 10);
+        tstDestroyVM(pUVM);
+    }
+
+    /* Cleanly shut down but not unlinked: replaced. */
+    fd = tstCreateForeign(~STAMSHMHDR_MAGIC, 0);
+    close(fd);
+    pUVM = tstCreateVM(&pVM);
+    if (pUVM)
+    {
+        RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.cMsInterval == 10);
+        tstDestroyVM(pUVM);
+    }
+
+    /* Owned by a live process: no export, and the segment stays. */
+    fd = tstCreateForeign(STAMSHMHDR_MAGIC, (uint32_t)getppid());
+    close(fd);
+    pUVM = tstCreateVM(&pVM);
+    if (pUVM)
+    {
+        RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.cMsInterval == 12345);
+        tstDestroyVM(pUVM);
+        RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.cMsInterval == 12345);
+    }
+    shm_unlink(g_szName);
+}
+
+
+static void tstForeignName(void)
+{
+    RTTestSub(g_hTest, "Name taken over");
+
+    PVM  pVM;
+    PUVM pUVM = tstCreateVM(&pVM);
+    if (!pUVM)
+        return;
+
+    /* Someone unlinks ours and creates theirs under the same name. */
+    int fd = tstCreateForeign(STAMSHMHDR_MAGIC, (uint32_t)getppid());
+    tstDestroyVM(pUVM);
+
+    STAMSHMHDR Hdr;
+    RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.cMsInterval == 12345);
+    close(fd);
+    shm_unlink(g_szName);
+}
+
+
+static void tstSlowCallback(void)
+{
+    RTTestSub(g_hTest, "Slow callback sample");
+    RTTESTI_CHECK_RC_RETV(RTSemEventCreate(&g_hEvtBlocked), VINF_SUCCESS);
+    RTTESTI_CHECK_RC_RETV(RTSemEventCreate(&g_hEvtRelease), VINF_SUCCESS);
+
+    PVM  pVM;
+    PUVM pUVM = tstCreateVM(&pVM);
+    if (pUVM)
+    {
+        RTTESTI_CHECK_RC(STAMR3RegisterCallback(pVM, &g_uCallbackSample, STAMVISIBILITY_ALWAYS, STAMUNIT_NONE,
+                                                NULL, tstPrintCallback, "A slow callback.", "/tstSTAMExport/Callback"),
+                         VINF_SUCCESS);
+
+        /* Get the publisher thread stuck in the callback. */
+        ASMAtomicWriteBool(&g_fBlock, true);
+        RTTESTI_CHECK_RC(RTSemEventWait(g_hEvtBlocked, 5 * RT_MS_1SEC), VINF_SUCCESS);
+
+        /* Destroying the VM waits for it, the samples must not go away under it. */
+        RTTHREAD hThread;
+        int rc = RTThreadCreate(&hThread, tstDestroyThread, pUVM, 0 /*cbStack*/, RTTHREADTYPE_DEFAULT,
+                                RTTHREADFLAGS_WAITABLE, "Destroy");
+        RTTESTI_CHECK_RC(rc, VINF_SUCCESS);
+        if (RT_SUCCESS(rc))
+        {
+            RTTESTI_CHECK_RC(RTThreadWait(hThread, 500, NULL), VERR_TIMEOUT);
+            STAMSHMHDR Hdr;
+            RTTESTI_CHECK(tstReadHdr(&Hdr) && Hdr.u32Magic == STAMSHMHDR_MAGIC);
+
+            RTSemEventSignal(g_hEvtRelease);
+            RTTESTI_CHECK_RC(RTThreadWait(hThread, 30 * RT_MS_1SEC, NULL), VINF_SUCCESS);
+            RTTESTI_CHECK(!tstReadHdr(&Hdr));
+        }
+        else
+        {
+            RTSemEventSignal(g_hEvtRelease);
+            tstDestroyVM(pUVM);
+        }
+    }
+    RTSemEventDestroy(g_hEvtBlocked);
+    RTSemEventDestroy(g_hEvtRelease);
+}
+
+
+/**
+ * Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, RTR3INIT_FLAGS_SUPLIB, "tstSTAMExport", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    RTStrPrintf(g_szName, sizeof(g_szName), "/tstSTAMExport-%u", (unsigned)RTProcSelf());
+
+    tstPublish();
+    tstStale();
+    tstForeignName();
+    tstSlowCallback();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
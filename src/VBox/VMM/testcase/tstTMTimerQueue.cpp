@@ -0,0 +1,349 @@
+/* $Id$ */
+/** @file
+ * TM active timer list testcase and benchmark.
+ *
+ * Exercises tmTimerQueueLinkActive and tmTimerQueueUnlinkActive on a queue
+ * with thousands of timers outside a VM, checking the list order against the
+ * search tree and comparing the cost with the old linear insertion.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define DBGFTRACE_DISABLED /* The timers have no VM. */
+#include <VBox/vmm/tm.h>
+#include <VBox/vmm/dbgftrace.h>
+#include "TMInternal.h"
+#include <VBox/err.h>
+
+#include <iprt/asm.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+#include "TMInline.h"
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A queue with its timers, allocated as one block so the relative offsets
+ * work the same way as on the hyper heap.
+ */
+typedef struct TSTTMQUEUE
+{
+    TMTIMERQUEUE    Queue;
+    /** Link sequence numbers for checking the ordering of equal expire times. */
+    uint64_t       *pauSeqNo;
+    /** The next sequence number. */
+    uint64_t        uSeqNo;
+    /** Number of timers. */
+    uint32_t        cTimers;
+    /** The timers. */
+    TMTIMER         aTimers[1];
+} TSTTMQUEUE;
+typedef TSTTMQUEUE *PTSTTMQUEUE;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+static RTTEST g_hTest;
+
+
+/**
+ * The linear insertion the active list used before the search tree, for
+ * comparison.
+ */
+static void tstLinkActiveLinear(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
+{
+    PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue);
+    if (pCur)
+    {
+        for (;; pCur = TMTIMER_GET_NEXT(pCur))
+        {
+            if (pCur->u64Expire > u64Expire)
+            {
+                const PTMTIMER pPrev = TMTIMER_GET_PREV(pCur);
+                TMTIMER_SET_NEXT(pTimer, pCur);
+                TMTIMER_SET_PREV(pTimer, pPrev);
+                if (pPrev)
+                    TMTIMER_SET_NEXT(pPrev, pTimer);
+                else
+                {
+                    TMTIMER_SET_HEAD(pQueue, pTimer);
+                    pQueue->u64Expire = u64Expire;
+                }
+                TMTIMER_SET_PREV(pCur, pTimer);
+                return;
+            }
+            if (!pCur->offNext)
+            {
+                TMTIMER_SET_NEXT(pCur, pTimer);
+                TMTIMER_SET_PREV(pTimer, pCur);
+                return;
+            }
+        }
+    }
+    else
+    {
+        TMTIMER_SET_HEAD(pQueue, pTimer);
+        pQueue->u64Expire = u64Expire;
+    }
+}
+
+
+/**
+ * The matching unlink for tstLinkActiveLinear.
+ */
+static void tstUnlinkActiveLinear(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
+    const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
+    if (pPrev)
+        TMTIMER_SET_NEXT(pPrev, pNext);
+    else
+    {
+        TMTIMER_SET_HEAD(pQueue, pNext);
+        pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
+    }
+    if (pNext)
+        TMTIMER_SET_PREV(pNext, pPrev);
+    pTimer->offNext = 0;
+    pTimer->offPrev = 0;
+}
+
+
+static PTSTTMQUEUE tstCreateQueue(uint32_t cTimers)
+{
+    PTSTTMQUEUE pThis = (PTSTTMQUEUE)RTMemAllocZ(RT_UOFFSETOF_DYN(TSTTMQUEUE, aTimers[cTimers]));
+    RTTESTI_CHECK_RET(pThis, NULL);
+    pThis->pauSeqNo = (uint64_t *)RTMemAllocZ(sizeof(uint64_t) * cTimers);
+    if (!pThis->pauSeqNo)
+    {
+        RTMemFree(pThis);
+        RTTestFailed(g_hTest, "Out of memory");
+        return NULL;
+    }
+    pThis->cTimers        = cTimers;
+    pThis->Queue.enmClock  = TMCLOCK_VIRTUAL_SYNC;
+    pThis->Queue.u64Expire = INT64_MAX;
+    for (uint32_t i = 0; i < cTimers; i++)
+    {
+        pThis->aTimers[i].enmClock      = TMCLOCK_VIRTUAL_SYNC;
+        pThis->aTimers[i].enmState      = TMTIMERSTATE_STOPPED;
+        pThis->aTimers[i].uTreePriority = RTRandU32();
+    }
+    return pThis;
+}
+
+
+static void tstDestroyQueue(PTSTTMQUEUE pThis)
+{
+    if (pThis)
+    {
+        RTMemFree(pThis->pauSeqNo);
+        RTMemFree(pThis);
+    }
+}
+
+
+DECLINLINE(void) tstArm(PTSTTMQUEUE pThis, uint32_t iTimer, uint64_t u64Expire, bool fLinear)
+{
+    PTMTIMER pTimer = &pThis->aTimers[iTimer];
+    pTimer->u64Expire = u64Expire;
+    pTimer->enmState  = TMTIMERSTATE_ACTIVE;
+    pThis->pauSeqNo[iTimer] = pThis->uSeqNo++;
+    if (fLinear)
+        tstLinkActiveLinear(&pThis->Queue, pTimer, u64Expire);
+    else
+        tmTimerQueueLinkActive(&pThis->Queue, pTimer, u64Expire);
+}
+
+
+DECLINLINE(void) tstDisarm(PTSTTMQUEUE pThis, uint32_t iTimer, bool fLinear)
+{
+    PTMTIMER pTimer = &pThis->aTimers[iTimer];
+    if (fLinear)
+        tstUnlinkActiveLinear(&pThis->Queue, pTimer);
+    else
+        tmTimerQueueUnlinkActive(&pThis->Queue, pTimer);
+    pTimer->enmState = TMTIMERSTATE_STOPPED;
+}
+
+
+/**
+ * Counts the nodes of a (sub)tree, checking the links and the heap property.
+ */
+static uint32_t tstCheckTree(PTMTIMER pNode, PTMTIMER pParent)
+{
+    if (!pNode)
+        return 0;
+    if (TMTIMER_GET_TREE_NODE(pNode, pNode->offTreeParent) != pParent)
+        RTTestFailed(g_hTest, "Bad parent link in %p", pNode);
+    if (pParent && pParent->uTreePriority > pNode->uTreePriority)
+        RTTestFailed(g_hTest, "Heap property violated at %p", pNode);
+    return 1
+         + tstCheckTree(TMTIMER_GET_TREE_NODE(pNode, pNode->offTreeLeft), pNode)
+         + tstCheckTree(TMTIMER_GET_TREE_NODE(pNode, pNode->offTreeRight), pNode);
+}
+
+
+/**
+ * Checks that the active list is sorted, with equal expire times in link
+ * order, and that it agrees with the tree.
+ */
+static void tstCheckQueue(PTSTTMQUEUE pThis, uint32_t cActiveExpected)
+{
+    uint32_t cActive = 0;
+    PTMTIMER pPrev   = NULL;
+    for (PTMTIMER pCur = TMTIMER_GET_HEAD(&pThis->Queue); pCur; pPrev = pCur, pCur = TMTIMER_GET_NEXT(pCur))
+    {
+        if (TMTIMER_GET_PREV(pCur) != pPrev)
+        {
+            RTTestFailed(g_hTest, "Bad prev link at #%u", cActive);
+            return;
+        }
+        if (pPrev)
+        {
+            if (pPrev->u64Expire > pCur->u64Expire)
+            {
+                RTTestFailed(g_hTest, "Not sorted at #%u: %RU64 > %RU64", cActive, pPrev->u64Expire, pCur->u64Expire);
+                return;
+            }
+            if (   pPrev->u64Expire == pCur->u64Expire
+                && pThis->pauSeqNo[pPrev - &pThis->aTimers[0]] > pThis->pauSeqNo[pCur - &pThis->aTimers[0]])
+            {
+                RTTestFailed(g_hTest, "Equal expire times out of link order at #%u", cActive);
+                return;
+            }
+        }
+        cActive++;
+    }
+    RTTESTI_CHECK_MSG(cActive == cActiveExpected, ("%u, expected %u\n", cActive, cActiveExpected));
+
+    PTMTIMER pHead = TMTIMER_GET_HEAD(&pThis->Queue);
+    RTTESTI_CHECK(pThis->Queue.u64Expire == (pHead ? pHead->u64Expire : INT64_MAX));
+    uint32_t cNodes = tstCheckTree(TMTIMER_GET_TREE_ROOT(&pThis->Queue), NULL);
+    RTTESTI_CHECK_MSG(cNodes == cActive, ("%u tree nodes, %u in the list\n", cNodes, cActive));
+}
+
+
+/**
+ * Random arming and disarming, checking the queue as we go.
+ */
+static void tstCorrectness(void)
+{
+    RTTestSub(g_hTest, "Correctness");
+    uint32_t const cTimers = 512;
+    PTSTTMQUEUE pThis = tstCreateQueue(cTimers);
+    if (!pThis)
+        return;
+
+    uint32_t cActive = 0;
+    for (uint32_t iOp = 0; iOp < 200000; iOp++)
+    {
+        uint32_t const iTimer = RTRandU32Ex(0, cTimers - 1);
+        if (pThis->aTimers[iTimer].enmState == TMTIMERSTATE_ACTIVE)
+        {
+            tstDisarm(pThis, iTimer, false /*fLinear*/);
+            cActive--;
+        }
+        else
+        {
+            /* A narrow range gives plenty of equal expire times. */
+            tstArm(pThis, iTimer, RTRandU64Ex(1000, 1063), false /*fLinear*/);
+            cActive++;
+        }
+        if (!(iOp % 997))
+            tstCheckQueue(pThis, cActive);
+
+        /* Now and then expire the head like the run loops do. */
+        if (!(iOp % 7) && cActive)
+        {
+            PTMTIMER pHead = TMTIMER_GET_HEAD(&pThis->Queue);
+            tstDisarm(pThis, (uint32_t)(pHead - &pThis->aTimers[0]), false /*fLinear*/);
+            cActive--;
+        }
+        if (RTTestErrorCount(g_hTest))
+            break;
+    }
+    tstCheckQueue(pThis, cActive);
+    tstDestroyQueue(pThis);
+}
+
+
+/**
+ * Times re-arming timers in a queue of the given size.
+ *
+ * Models periodic device timers: the head timer expires and is re-armed a
+ * random period into the future, interleaved with re-arming a random timer.
+ */
+static void tstBenchmark(uint32_t cTimers, bool fLinear)
+{
+    PTSTTMQUEUE pThis = tstCreateQueue(cTimers);
+    if (!pThis)
+        return;
+
+    uint64_t u64Now = 0;
+    for (uint32_t i = 0; i < cTimers; i++)
+        tstArm(pThis, i, RTRandU64Ex(1, RT_NS_1MS), fLinear);
+
+    uint32_t const cOps = RT_MAX(_1M / cTimers, 64) * 16;
+    uint64_t const nsStart = RTTimeNanoTS();
+    for (uint32_t iOp = 0; iOp < cOps; iOp++)
+    {
+        PTMTIMER       pHead  = TMTIMER_GET_HEAD(&pThis->Queue);
+        uint32_t const iHead  = (uint32_t)(pHead - &pThis->aTimers[0]);
+        u64Now = pHead->u64Expire;
+        tstDisarm(pThis, iHead, fLinear);
+        tstArm(pThis, iHead, u64Now + RTRandU32Ex(1, RT_NS_1MS), fLinear);
+
+        uint32_t const iTimer = RTRandU32Ex(0, cTimers - 1);
+        tstDisarm(pThis, iTimer, fLinear);
+        tstArm(pThis, iTimer, u64Now + RTRandU32Ex(1, RT_NS_1MS), fLinear);
+    }
+    uint64_t const cNsElapsed = RTTimeNanoTS() - nsStart;
+
+    if (!fLinear)
+        tstCheckQueue(pThis, cTimers);
+    RTTestValueF(g_hTest, cNsElapsed / (cOps * 2), RTTESTUNIT_NS_PER_CALL, "%s, %u timers", fLinear ? "linear" : "tree", cTimers);
+    tstDestroyQueue(pThis);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstTMTimerQueue", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstCorrectness();
+
+    RTTestSub(g_hTest, "Re-arm benchmark");
+    static uint32_t const s_acTimers[] = { 16, 64, 256, 1024, 4096, 16384 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acTimers); i++)
+    {
+        tstBenchmark(s_acTimers[i], false /*fLinear*/);
+        tstBenchmark(s_acTimers[i], true /*fLinear*/);
+    }
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -37,6 +37,30 @@
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
 #define TESTCASE    "tstVMREQ"
+/** The max number of producer threads in the throughput benchmark. */
+#define TSTVMREQ_MAX_PRODUCERS      8
+/** The number of requests each producer queues in the throughput benchmark. */
+#define TSTVMREQ_REQS_PER_PRODUCER  _32K
+/** Every this many requests the producer waits for completion, which bounds
+ * the number of requests in flight. */
+#define TSTVMREQ_WAIT_INTERVAL      8
+/** The number of requests queued while the EMT is blocked in the overflow
+ * test, several times the ring size so the overflow lists get used. */
+#define TSTVMREQ_OVERFLOW_REQS      1024
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Producer thread argument for the throughput benchmark.
+ */
+typedef struct TSTVMREQPRODUCER
+{
+    PUVM        pUVM;
+    VMCPUID     idDstCpu;
+    uint32_t    iProducer;
+} TSTVMREQPRODUCER;
 
 
 /*********************************************************************************************************************************
@@ -44,6 +68,8 @@
 *********************************************************************************************************************************/
 /** the error count. */
 static int g_cErrors = 0;
+/** The next sequence number expected from each producer (EMT only). */
+static uint32_t g_aiNextSeq[TSTVMREQ_MAX_PRODUCERS];
 
 
 /**
@@ -208,6 +234,155 @@ static DECLCALLBACK(int) Thread(RTTHREAD hThreadSelf, void *pvUser)
     return VINF_SUCCESS;
 }
 
+/**
+ * The request the throughput benchmark queues, checks that each producer's
+ * requests are executed in the order they were queued.
+ */
+static DECLCALLBACK(int) tstVMREQSeqCallback(uintptr_t iProducer, uintptr_t iSeq)
+{
+    if (g_aiNextSeq[iProducer] != iSeq)
+    {
+        if (g_cErrors < 16)
+            RTPrintf(TESTCASE ": producer %u: got request #%u, expected #%u!\n",
+                     (unsigned)iProducer, (unsigned)iSeq, g_aiNextSeq[iProducer]);
+        g_cErrors++;
+    }
+    g_aiNextSeq[iProducer] = (uint32_t)iSeq + 1;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Producer thread for the throughput benchmark.
+ */
+static DECLCALLBACK(int) tstVMREQProducer(RTTHREAD hThreadSelf, void *pvUser)
+{
+    TSTVMREQPRODUCER *pArgs = (TSTVMREQPRODUCER *)pvUser;
+    NOREF(hThreadSelf);
+
+    for (uint32_t iSeq = 0; iSeq < TSTVMREQ_REQS_PER_PRODUCER; iSeq++)
+    {
+        int rc;
+        if ((iSeq % TSTVMREQ_WAIT_INTERVAL) != TSTVMREQ_WAIT_INTERVAL - 1)
+            rc = VMR3ReqCallNoWaitU(pArgs->pUVM, pArgs->idDstCpu, (PFNRT)tstVMREQSeqCallback, 2,
+                                    (uintptr_t)pArgs->iProducer, (uintptr_t)iSeq);
+        else
+            rc = VMR3ReqCallWaitU(pArgs->pUVM, pArgs->idDstCpu, (PFNRT)tstVMREQSeqCallback, 2,
+                                  (uintptr_t)pArgs->iProducer, (uintptr_t)iSeq);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": producer %u: iSeq=%u rc=%Rrc\n", pArgs->iProducer, iSeq, rc);
+            return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Measures the request throughput with @a cProducers threads queuing requests
+ * for @a idDstCpu.
+ */
+static void tstVMREQBenchmark(PUVM pUVM, VMCPUID idDstCpu, uint32_t cProducers)
+{
+    TSTVMREQPRODUCER aArgs[TSTVMREQ_MAX_PRODUCERS];
+    RTTHREAD         ahThreads[TSTVMREQ_MAX_PRODUCERS];
+    RT_ZERO(g_aiNextSeq);
+
+    uint64_t const u64StartTS = RTTimeNanoTS();
+    uint32_t       cStarted;
+    for (cStarted = 0; cStarted < cProducers; cStarted++)
+    {
+        aArgs[cStarted].pUVM      = pUVM;
+        aArgs[cStarted].idDstCpu  = idDstCpu;
+        aArgs[cStarted].iProducer = cStarted;
+        int rc = RTThreadCreateF(&ahThreads[cStarted], tstVMREQProducer, &aArgs[cStarted], 0, RTTHREADTYPE_DEFAULT,
+                                 RTTHREADFLAGS_WAITABLE, "PROD%u", cStarted);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": RTThreadCreate failed, rc=%Rrc\n", rc);
+            g_cErrors++;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < cStarted; i++)
+    {
+        int rcThread = VERR_INTERNAL_ERROR;
+        int rc = RTThreadWait(ahThreads[i], RT_INDEFINITE_WAIT, &rcThread);
+        if (RT_FAILURE(rc) || RT_FAILURE(rcThread))
+            g_cErrors++;
+    }
+    uint64_t const cNsElapsed = RTTimeNanoTS() - u64StartTS;
+
+    /* The last request of each producer was a waiting one, so everything has been executed. */
+    for (uint32_t i = 0; i < cStarted; i++)
+        if (g_aiNextSeq[i] != TSTVMREQ_REQS_PER_PRODUCER)
+        {
+            RTPrintf(TESTCASE ": producer %u: only %u of %u requests executed!\n", i, g_aiNextSeq[i], TSTVMREQ_REQS_PER_PRODUCER);
+            g_cErrors++;
+        }
+
+    uint64_t const cReqs = (uint64_t)cStarted * TSTVMREQ_REQS_PER_PRODUCER;
+    RTPrintf(TESTCASE ": %u producer(s) -> %s: %9RU64 requests/s (%RU64 requests in %RU64 ms)\n",
+             cProducers, idDstCpu == VMCPUID_ANY ? "any " : "EMT0", cReqs * RT_NS_1SEC / RT_MAX(cNsElapsed, 1),
+             cReqs, cNsElapsed / RT_NS_1MS);
+    RTStrmFlush(g_pStdOut);
+}
+
+
+/**
+ * Request blocking the EMT until the event semaphore is signalled.
+ */
+static DECLCALLBACK(int) tstVMREQBlockCallback(RTSEMEVENT hEvt)
+{
+    return RTSemEventWait(hEvt, RT_INDEFINITE_WAIT);
+}
+
+
+/**
+ * Checks that requests are executed in FIFO order when the ring overflows,
+ * also while the overflow list is being drained and new requests keep coming
+ * in.
+ */
+static void tstVMREQOverflow(PUVM pUVM, VMCPUID idDstCpu)
+{
+    RT_ZERO(g_aiNextSeq);
+    RTSEMEVENT hEvt;
+    int rc = RTSemEventCreate(&hEvt);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": RTSemEventCreate failed, rc=%Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    /* Block the EMT and queue up more requests than the ring can take. */
+    rc = VMR3ReqCallNoWaitU(pUVM, idDstCpu, (PFNRT)tstVMREQBlockCallback, 1, hEvt);
+    uint32_t iSeq = 0;
+    for (; iSeq < TSTVMREQ_OVERFLOW_REQS && RT_SUCCESS(rc); iSeq++)
+        rc = VMR3ReqCallNoWaitU(pUVM, idDstCpu, (PFNRT)tstVMREQSeqCallback, 2, (uintptr_t)0, (uintptr_t)iSeq);
+
+    /* Let it go and keep queuing while it works its way thru the overflow. */
+    RTSemEventSignal(hEvt);
+    for (; iSeq < TSTVMREQ_OVERFLOW_REQS * 2 && RT_SUCCESS(rc); iSeq++)
+        rc = VMR3ReqCallNoWaitU(pUVM, idDstCpu, (PFNRT)tstVMREQSeqCallback, 2, (uintptr_t)0, (uintptr_t)iSeq);
+    if (RT_SUCCESS(rc))
+        rc = VMR3ReqCallWaitU(pUVM, idDstCpu, (PFNRT)tstVMREQSeqCallback, 2, (uintptr_t)0, (uintptr_t)iSeq++);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": overflow: iSeq=%u rc=%Rrc\n", iSeq, rc);
+        g_cErrors++;
+    }
+    else if (g_aiNextSeq[0] != iSeq)
+    {
+        RTPrintf(TESTCASE ": overflow: only %u of %u requests executed!\n", g_aiNextSeq[0], iSeq);
+        g_cErrors++;
+    }
+
+    RTSemEventDestroy(hEvt);
+}
+
+
 static DECLCALLBACK(int)
 tstVMREQConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
 {
@@ -279,6 +454,23 @@ extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
         RTPrintf(TESTCASE  ": %llu ns elapsed\n", u64ElapsedTS);
         RTStrmFlush(g_pStdOut);
 
+        /*
+         * Throughput from many producers, checking the ordering.
+         */
+        RTPrintf(TESTCASE ": request throughput...\n"); RTStrmFlush(g_pStdOut);
+        for (uint32_t cProducers = 1; cProducers <= TSTVMREQ_MAX_PRODUCERS; cProducers *= 2)
+        {
+            tstVMREQBenchmark(pUVM, VMCPUID_ANY, cProducers);
+            tstVMREQBenchmark(pUVM, 0 /*idDstCpu*/, cProducers);
+        }
+
+        /*
+         * Ordering when the rings overflow.
+         */
+        RTPrintf(TESTCASE ": ring overflow ordering...\n"); RTStrmFlush(g_pStdOut);
+        tstVMREQOverflow(pUVM, VMCPUID_ANY);
+        tstVMREQOverflow(pUVM, 0 /*idDstCpu*/);
+
         /*
          * Print stats.
          */
@@ -313,6 +313,7 @@
     GEN_CHECK_OFF(IOM, pTreesRC);
     GEN_CHECK_OFF(IOM, pTreesR3);
     GEN_CHECK_OFF(IOM, pTreesR0);
+    GEN_CHECK_OFF(IOM, uRangeGen);
 
     GEN_CHECK_SIZE(IOMCPU);
     GEN_CHECK_OFF(IOMCPU, DisState);
@@ -324,14 +325,20 @@
     GEN_CHECK_OFF(IOMCPU, PendingMmioWrite.GCPhys);
     GEN_CHECK_OFF(IOMCPU, PendingMmioWrite.abValue);
     GEN_CHECK_OFF(IOMCPU, PendingMmioWrite.cbValue);
-    GEN_CHECK_OFF(IOMCPU, pMMIORangeLastR3);
     GEN_CHECK_OFF(IOMCPU, pMMIOStatsLastR3);
-    GEN_CHECK_OFF(IOMCPU, pMMIORangeLastR0);
     GEN_CHECK_OFF(IOMCPU, pMMIOStatsLastR0);
-    GEN_CHECK_OFF(IOMCPU, pMMIORangeLastRC);
     GEN_CHECK_OFF(IOMCPU, pMMIOStatsLastRC);
-    GEN_CHECK_OFF(IOMCPU, pRangeLastReadR0);
-    GEN_CHECK_OFF(IOMCPU, pRangeLastReadRC);
+    GEN_CHECK_OFF(IOMCPU, pStatsLastReadR0);
+    GEN_CHECK_OFF(IOMCPU, pStatsLastReadRC);
+    GEN_CHECK_OFF(IOMCPU, apIOPortRangeCacheR3);
+    GEN_CHECK_OFF(IOMCPU, apMMIORangeCacheR3);
+    GEN_CHECK_OFF(IOMCPU, apIOPortRangeCacheR0);
+    GEN_CHECK_OFF(IOMCPU, apMMIORangeCacheR0);
+    GEN_CHECK_OFF(IOMCPU, apIOPortRangeCacheRC);
+    GEN_CHECK_OFF(IOMCPU, apMMIORangeCacheRC);
+    GEN_CHECK_OFF(IOMCPU, uRangeCacheGenR3);
+    GEN_CHECK_OFF(IOMCPU, uRangeCacheGenR0);
+    GEN_CHECK_OFF(IOMCPU, uRangeCacheGenRC);
 
     GEN_CHECK_SIZE(IOMMMIORANGE);
     GEN_CHECK_OFF(IOMMMIORANGE, GCPhys);
@@ -566,7 +573,18 @@
     GEN_CHECK_OFF(PDMCRITSECTINT, StatContentionRZUnlock);
     GEN_CHECK_OFF(PDMCRITSECTINT, StatContentionR3);
     GEN_CHECK_OFF(PDMCRITSECTINT, StatLocked);
+    GEN_CHECK_OFF(PDMCRITSECTINT, pProfR3);
+    GEN_CHECK_OFF(PDMCRITSECTINT, pProfR0);
     GEN_CHECK_SIZE(PDMCRITSECT);
+    GEN_CHECK_SIZE(PDMCRITSECTPROF);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, u64TscEntered);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, cTicksHoldAvg);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, cTicksSpin);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, cTicksSpinMax);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, fWaitProf);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, StatSpinHits);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, StatWait);
+    GEN_CHECK_OFF(PDMCRITSECTPROF, aCallers);
     GEN_CHECK_SIZE(PDMCRITSECTRWINT);
     GEN_CHECK_OFF(PDMCRITSECTRWINT, Core);
     GEN_CHECK_OFF(PDMCRITSECTRWINT, pNext);
@@ -577,6 +595,8 @@
     GEN_CHECK_OFF(PDMCRITSECTRWINT, pszName);
     GEN_CHECK_OFF(PDMCRITSECTRWINT, StatContentionRZEnterExcl);
     GEN_CHECK_OFF(PDMCRITSECTRWINT, StatWriteLocked);
+    GEN_CHECK_OFF(PDMCRITSECTRWINT, pProfR3);
+    GEN_CHECK_OFF(PDMCRITSECTRWINT, pProfR0);
     GEN_CHECK_SIZE(PDMCRITSECTRW);
     GEN_CHECK_SIZE(PDMQUEUE);
     GEN_CHECK_OFF(PDMQUEUE, pNext);
@@ -584,28 +604,39 @@
     GEN_CHECK_OFF(PDMQUEUE, u);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Dev.pfnCallback);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Dev.pDevIns);
+    GEN_CHECK_OFF_DOT(PDMQUEUE, u.Dev.pfnCallbackBatch);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Drv.pfnCallback);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Drv.pDrvIns);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Int.pfnCallback);
+    GEN_CHECK_OFF_DOT(PDMQUEUE, u.Int.pfnCallbackBatch);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Ext.pfnCallback);
     GEN_CHECK_OFF_DOT(PDMQUEUE, u.Ext.pvUser);
     GEN_CHECK_OFF(PDMQUEUE, pVMR3);
     GEN_CHECK_OFF(PDMQUEUE, pVMR0);
     GEN_CHECK_OFF(PDMQUEUE, pVMRC);
+    GEN_CHECK_OFF(PDMQUEUE, fExpedite);
+    GEN_CHECK_OFF(PDMQUEUE, fFlushing);
     GEN_CHECK_OFF(PDMQUEUE, cMilliesInterval);
     GEN_CHECK_OFF(PDMQUEUE, pTimer);
     GEN_CHECK_OFF(PDMQUEUE, cbItem);
     GEN_CHECK_OFF(PDMQUEUE, cItems);
-    GEN_CHECK_OFF(PDMQUEUE, pPendingR3);
-    GEN_CHECK_OFF(PDMQUEUE, pPendingR0);
-    GEN_CHECK_OFF(PDMQUEUE, pPendingRC);
     GEN_CHECK_OFF(PDMQUEUE, iFreeHead);
     GEN_CHECK_OFF(PDMQUEUE, iFreeTail);
+    GEN_CHECK_OFF(PDMQUEUE, offPending);
+    GEN_CHECK_OFF(PDMQUEUE, fPendingMask);
+    GEN_CHECK_OFF(PDMQUEUE, iPendingHead);
+    GEN_CHECK_OFF(PDMQUEUE, iPendingTail);
+    GEN_CHECK_OFF(PDMQUEUE, offItems);
+    GEN_CHECK_OFF(PDMQUEUE, cPendingMax);
     GEN_CHECK_OFF(PDMQUEUE, pszName);
     GEN_CHECK_OFF(PDMQUEUE, StatAllocFailures);
     GEN_CHECK_OFF(PDMQUEUE, StatInsert);
+    GEN_CHECK_OFF(PDMQUEUE, StatInsertCongested);
+    GEN_CHECK_OFF(PDMQUEUE, StatInsertExpedite);
     GEN_CHECK_OFF(PDMQUEUE, StatFlush);
     GEN_CHECK_OFF(PDMQUEUE, StatFlushLeftovers);
+    GEN_CHECK_OFF(PDMQUEUE, StatFlushBatches);
+    GEN_CHECK_OFF(PDMQUEUE, StatFlushItems);
     GEN_CHECK_OFF(PDMQUEUE, aFreeItems);
     GEN_CHECK_OFF(PDMQUEUE, aFreeItems[1]);
     GEN_CHECK_OFF_DOT(PDMQUEUE, aFreeItems[0].pItemR3);
@@ -841,6 +872,10 @@
     GEN_CHECK_OFF(PGMRAMRANGE, fFlags);
     GEN_CHECK_OFF(PGMRAMRANGE, pvR3);
     GEN_CHECK_OFF(PGMRAMRANGE, pszDesc);
+    GEN_CHECK_OFF(PGMRAMRANGE, pbmLSDirtyR3);
+    GEN_CHECK_OFF(PGMRAMRANGE, pbmLSDirtyR0);
+    GEN_CHECK_OFF(PGMRAMRANGE, paoffPhysHandlersR3);
+    GEN_CHECK_OFF(PGMRAMRANGE, paoffPhysHandlersR0);
     GEN_CHECK_OFF(PGMRAMRANGE, aPages);
     GEN_CHECK_OFF(PGMRAMRANGE, aPages[1]);
     GEN_CHECK_SIZE(PGMROMPAGE);
@@ -1128,6 +1163,11 @@
     GEN_CHECK_OFF(TMTIMER, offScheduleNext);
     GEN_CHECK_OFF(TMTIMER, offNext);
     GEN_CHECK_OFF(TMTIMER, offPrev);
+    GEN_CHECK_OFF(TMTIMER, offTreeParent);
+    GEN_CHECK_OFF(TMTIMER, offTreeLeft);
+    GEN_CHECK_OFF(TMTIMER, offTreeRight);
+    GEN_CHECK_OFF(TMTIMER, uTreePriority);
+    GEN_CHECK_OFF(TMTIMER, u64TreeKey);
     GEN_CHECK_OFF(TMTIMER, pVMR0);
     GEN_CHECK_OFF(TMTIMER, pVMR3);
     GEN_CHECK_OFF(TMTIMER, pVMRC);
@@ -1141,6 +1181,7 @@
     GEN_CHECK_OFF(TMTIMERQUEUE, offActive);
     GEN_CHECK_OFF(TMTIMERQUEUE, offSchedule);
     GEN_CHECK_OFF(TMTIMERQUEUE, enmClock);
+    GEN_CHECK_OFF(TMTIMERQUEUE, offTreeRoot);
 
     GEN_CHECK_SIZE(TRPM); // has .mac
     GEN_CHECK_SIZE(TRPMCPU); // has .mac
@@ -1363,6 +1404,7 @@
     GEN_CHECK_OFF(APIC, pvApicPibRC);
     GEN_CHECK_OFF(APIC, cbApicPib);
     GEN_CHECK_OFF(APIC, enmMaxMode);
+    GEN_CHECK_OFF(APIC, u64X2ApicDestMap);
     GEN_CHECK_OFF(APICCPU, pvApicPageR0);
     GEN_CHECK_OFF(APICCPU, pvApicPageR3);
     GEN_CHECK_OFF(APICCPU, pvApicPageRC);
@@ -0,0 +1,766 @@
+/* $Id$ */
+/** @file
+ * VBoxStamShm - Reads the statistics a VM exports in shared memory.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+
+#include <iprt/asm.h>
+#include <iprt/asm-math.h>
+#include <iprt/assert.h>
+#include <iprt/buildconfig.h>
+#include <iprt/dir.h>
+#include <iprt/getopt.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/message.h>
+#include <iprt/process.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * An open export segment.
+ */
+typedef struct STAMSHMREADER
+{
+    /** The shared memory object descriptor. */
+    int             fd;
+    /** The read-only mapping. */
+    uint8_t const  *pbMap;
+    /** The size of the mapping. */
+    size_t          cbMap;
+    /** The segment name. */
+    char            szName[64];
+} STAMSHMREADER;
+/** Pointer to an open export segment. */
+typedef STAMSHMREADER *PSTAMSHMREADER;
+
+/**
+ * A consistent private copy of the segment.
+ */
+typedef struct STAMSHMSNAPSHOT
+{
+    /** The copy (header, descriptors, strings and values). */
+    uint8_t        *pb;
+    /** The number of valid bytes. */
+    uint32_t        cb;
+    /** The size of the buffer. */
+    uint32_t        cbAlloc;
+} STAMSHMSNAPSHOT;
+/** Pointer to a segment snapshot. */
+typedef STAMSHMSNAPSHOT *PSTAMSHMSNAPSHOT;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The sample name pattern(s), NULL for all. */
+static const char *g_pszPattern = NULL;
+
+
+/*********************************************************************************************************************************
+*   Reader                                                                                                                       *
+*********************************************************************************************************************************/
+
+/**
+ * Maps the current size of the segment.
+ *
+ * @returns IPRT status code.
+ * @param   pReader     The reader.
+ */
+static int stamShmMap(PSTAMSHMREADER pReader)
+{
+    struct stat St;
+    if (fstat(pReader->fd, &St) != 0)
+        return RTErrConvertFromErrno(errno);
+    if ((size_t)St.st_size < sizeof(STAMSHMHDR))
+        return VERR_INVALID_STATE;
+
+    void *pv = mmap(NULL, (size_t)St.st_size, PROT_READ, MAP_SHARED, pReader->fd, 0);
+    if (pv == MAP_FAILED)
+        return RTErrConvertFromErrno(errno);
+    if (pReader->pbMap)
+        munmap((void *)pReader->pbMap, pReader->cbMap);
+    pReader->pbMap = (uint8_t const *)pv;
+    pReader->cbMap = (size_t)St.st_size;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Opens an export segment.
+ *
+ * @returns IPRT status code.
+ * @param   pReader     The reader to initialize.
+ * @param   pszName     The segment name (starts with a slash).
+ */
+static int stamShmOpen(PSTAMSHMREADER pReader, const char *pszName)
+{
+    pReader->pbMap = NULL;
+    pReader->cbMap = 0;
+    int rc = RTStrCopy(pReader->szName, sizeof(pReader->szName), pszName);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pReader->fd = shm_open(pszName, O_RDONLY, 0);
+    if (pReader->fd < 0)
+        return RTErrConvertFromErrno(errno);
+    rc = stamShmMap(pReader);
+    if (RT_SUCCESS(rc))
+    {
+        PCSTAMSHMHDR pHdr = (PCSTAMSHMHDR)pReader->pbMap;
+        if (pHdr->u32Magic != STAMSHMHDR_MAGIC)
+            rc = pHdr->u32Magic == ~STAMSHMHDR_MAGIC ? VERR_INVALID_STATE : VERR_INVALID_MAGIC;
+        else if ((pHdr->u32Version >> 16) != (STAMSHMHDR_VERSION >> 16))
+            rc = VERR_VERSION_MISMATCH;
+        if (RT_SUCCESS(rc))
+            return rc;
+        munmap((void *)pReader->pbMap, pReader->cbMap);
+        pReader->pbMap = NULL;
+    }
+    close(pReader->fd);
+    pReader->fd = -1;
+    return rc;
+}
+
+
+/**
+ * Closes an export segment.
+ *
+ * @param   pReader     The reader.
+ */
+static void stamShmClose(PSTAMSHMREADER pReader)
+{
+    if (pReader->pbMap)
+        munmap((void *)pReader->pbMap, pReader->cbMap);
+    pReader->pbMap = NULL;
+    if (pReader->fd >= 0)
+        close(pReader->fd);
+    pReader->fd = -1;
+}
+
+
+/**
+ * Takes a consistent copy of the segment.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_INVALID_STATE if the VM has terminated.
+ * @retval  VERR_TIMEOUT if no consistent copy could be taken.
+ * @param   pReader     The reader.
+ * @param   pSnap       The snapshot buffer, reused between calls.
+ */
+static int stamShmSnapshot(PSTAMSHMREADER pReader, PSTAMSHMSNAPSHOT pSnap)
+{
+    for (unsigned cTries = 0; cTries < 1000; cTries++)
+    {
+        PSTAMSHMHDR pHdr = (PSTAMSHMHDR)pReader->pbMap; /* read-only, but the ASMAtomic APIs don't take const */
+        if (ASMAtomicUoReadU32(&pHdr->u32Magic) != STAMSHMHDR_MAGIC)
+            return VERR_INVALID_STATE;
+
+        uint32_t const uSeq = ASMAtomicReadU32(&pHdr->uSeq);
+        if (uSeq & 1)
+        {
+            RTThreadSleep(1);
+            continue;
+        }
+        if (ASMAtomicUoReadU32(&pHdr->cbSegment) > pReader->cbMap)
+        {
+            int rc = stamShmMap(pReader);
+            if (RT_FAILURE(rc))
+                return rc;
+            continue;
+        }
+
+        /* The header fields may be torn, so validate before using them. */
+        uint32_t const offValues = pHdr->offValues;
+        uint32_t const cbValues  = pHdr->cbValues;
+        if (   offValues > pReader->cbMap
+            || cbValues  > pReader->cbMap - offValues)
+            continue;
+        uint32_t const cb = offValues + cbValues;
+        if (cb > pSnap->cbAlloc)
+        {
+            void *pvNew = RTMemRealloc(pSnap->pb, cb);
+            if (!pvNew)
+                return VERR_NO_MEMORY;
+            pSnap->pb      = (uint8_t *)pvNew;
+            pSnap->cbAlloc = cb;
+        }
+        memcpy(pSnap->pb, pReader->pbMap, cb);
+        ASMReadFence();
+        if (ASMAtomicReadU32(&pHdr->uSeq) != uSeq)
+            continue;
+
+        /* Sanity check the copy so the accessors below only need to check the entries. */
+        PCSTAMSHMHDR pCopy = (PCSTAMSHMHDR)pSnap->pb;
+        if (   pCopy->cbDesc   != sizeof(STAMSHMDESC)
+            || pCopy->offDescs  < pCopy->cbHdr
+            || pCopy->offDescs  > offValues
+            || pCopy->offStrings < pCopy->offDescs
+            || pCopy->offStrings > offValues
+            || pCopy->cDescs    > (pCopy->offStrings - pCopy->offDescs) / sizeof(STAMSHMDESC))
+            return VERR_INVALID_STATE;
+        pSnap->cb = cb;
+        return VINF_SUCCESS;
+    }
+    return VERR_TIMEOUT;
+}
+
+
+/**
+ * Gets a string from the snapshot string table.
+ *
+ * @returns Pointer to the string, NULL if the offset is invalid.
+ * @param   pSnap       The snapshot.
+ * @param   off         The string table offset.
+ */
+static const char *stamShmString(PSTAMSHMSNAPSHOT pSnap, uint32_t off)
+{
+    PCSTAMSHMHDR pHdr = (PCSTAMSHMHDR)pSnap->pb;
+    uint32_t const cbStrings = pHdr->offValues - pHdr->offStrings;
+    if (off >= cbStrings)
+        return NULL;
+    const char *psz = (const char *)&pSnap->pb[pHdr->offStrings + off];
+    if (!memchr(psz, '\0', cbStrings - off))
+        return NULL;
+    return psz;
+}
+
+
+/**
+ * Gets a descriptor and its value from the snapshot.
+ *
+ * @returns Pointer to the value, NULL if the descriptor is invalid.
+ * @param   pSnap       The snapshot.
+ * @param   iDesc       The descriptor index.
+ * @param   ppDesc      Where to return the descriptor.
+ * @param   ppszName    Where to return the sample name.
+ */
+static void const *stamShmGetSample(PSTAMSHMSNAPSHOT pSnap, uint32_t iDesc, PCSTAMSHMDESC *ppDesc, const char **ppszName)
+{
+    PCSTAMSHMHDR  pHdr  = (PCSTAMSHMHDR)pSnap->pb;
+    PCSTAMSHMDESC pDesc = &((PCSTAMSHMDESC)&pSnap->pb[pHdr->offDescs])[iDesc];
+    if (   pDesc->offValue > pHdr->cbValues
+        || pDesc->cbValue  > pHdr->cbValues - pDesc->offValue)
+        return NULL;
+    *ppszName = stamShmString(pSnap, pDesc->offName);
+    if (!*ppszName)
+        return NULL;
+    *ppDesc = pDesc;
+    return &pSnap->pb[pHdr->offValues + pDesc->offValue];
+}
+
+
+/**
+ * Checks that the value of a sample has the size its type calls for.
+ *
+ * @returns true if it does, false if not (or if the type is unknown).
+ * @param   pDesc       The descriptor.
+ */
+static bool stamShmIsValueSizeOk(PCSTAMSHMDESC pDesc)
+{
+    switch (pDesc->enmType)
+    {
+        case STAMTYPE_COUNTER:          return pDesc->cbValue == sizeof(STAMCOUNTER);
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:      return pDesc->cbValue == sizeof(STAMPROFILE);
+        case STAMTYPE_HISTOGRAM:        return pDesc->cbValue == sizeof(STAMHISTOGRAM);
+        case STAMTYPE_RATIO_U32:
+        case STAMTYPE_RATIO_U32_RESET:  return pDesc->cbValue == sizeof(STAMRATIOU32);
+        case STAMTYPE_CALLBACK:         return pDesc->cbValue > 0;
+        case STAMTYPE_U8:
+        case STAMTYPE_U8_RESET:
+        case STAMTYPE_X8:
+        case STAMTYPE_X8_RESET:
+        case STAMTYPE_BOOL:
+        case STAMTYPE_BOOL_RESET:       return pDesc->cbValue == sizeof(uint8_t);
+        case STAMTYPE_U16:
+        case STAMTYPE_U16_RESET:
+        case STAMTYPE_X16:
+        case STAMTYPE_X16_RESET:        return pDesc->cbValue == sizeof(uint16_t);
+        case STAMTYPE_U32:
+        case STAMTYPE_U32_RESET:
+        case STAMTYPE_X32:
+        case STAMTYPE_X32_RESET:        return pDesc->cbValue == sizeof(uint32_t);
+        case STAMTYPE_U64:
+        case STAMTYPE_U64_RESET:
+        case STAMTYPE_X64:
+        case STAMTYPE_X64_RESET:        return pDesc->cbValue == sizeof(uint64_t);
+        default:                        return false;
+    }
+}
+
+
+/*********************************************************************************************************************************
+*   Formatting                                                                                                                   *
+*********************************************************************************************************************************/
+
+/**
+ * Resolves a STAMUNIT value (mirrors STAMR3GetUnit, which lives in VBoxVMM).
+ */
+static const char *stamShmUnit(uint8_t enmUnit)
+{
+    switch (enmUnit)
+    {
+        case STAMUNIT_NONE:                 return "";
+        case STAMUNIT_CALLS:                return "calls";
+        case STAMUNIT_COUNT:                return "count";
+        case STAMUNIT_BYTES:                return "bytes";
+        case STAMUNIT_PAGES:                return "pages";
+        case STAMUNIT_ERRORS:               return "errors";
+        case STAMUNIT_OCCURENCES:           return "times";
+        case STAMUNIT_TICKS:                return "ticks";
+        case STAMUNIT_TICKS_PER_CALL:       return "ticks/call";
+        case STAMUNIT_TICKS_PER_OCCURENCE:  return "ticks/time";
+        case STAMUNIT_GOOD_BAD:             return "good:bad";
+        case STAMUNIT_MEGABYTES:            return "megabytes";
+        case STAMUNIT_KILOBYTES:            return "kilobytes";
+        case STAMUNIT_NS:                   return "ns";
+        case STAMUNIT_NS_PER_CALL:          return "ns/call";
+        case STAMUNIT_NS_PER_OCCURENCE:     return "ns/time";
+        case STAMUNIT_PCT:                  return "%";
+        case STAMUNIT_HZ:                   return "Hz";
+        default:                            return "(?unit?)";
+    }
+}
+
+
+/**
+ * Gets the upper bound of a histogram bucket (same as STAM.cpp).
+ */
+static uint64_t stamShmHistogramBucketMax(unsigned iBucket)
+{
+    if (iBucket < STAMHISTOGRAM_SUB_BUCKETS)
+        return iBucket;
+    unsigned const iShift = (iBucket >> STAMHISTOGRAM_SUB_BITS) - 1;
+    uint64_t const uFirst = (uint64_t)(STAMHISTOGRAM_SUB_BUCKETS + (iBucket & (STAMHISTOGRAM_SUB_BUCKETS - 1))) << iShift;
+    return uFirst + (RT_BIT_64(iShift) - 1);
+}
+
+
+/**
+ * Calculates a percentile from histogram bucket counts.
+ *
+ * @returns The upper bound of the bucket the percentile falls into.
+ * @param   pacBuckets      The bucket counts.
+ * @param   cTotal          The sum of the bucket counts.
+ * @param   uPerMyriad      The percentile in 1/10000ths.
+ */
+static uint64_t stamShmHistogramPercentile(uint64_t const volatile *pacBuckets, uint64_t cTotal, unsigned uPerMyriad)
+{
+    uint64_t const cTarget = (cTotal * uPerMyriad + 9999) / 10000;
+    uint64_t       cSeen   = 0;
+    for (unsigned iBucket = 0; iBucket < STAMHISTOGRAM_BUCKETS; iBucket++)
+    {
+        cSeen += pacBuckets[iBucket];
+        if (cSeen >= cTarget && cSeen)
+            return stamShmHistogramBucketMax(iBucket);
+    }
+    return 0;
+}
+
+
+/**
+ * Prints one sample value.
+ *
+ * @param   pszName     The sample name.
+ * @param   pDesc       The descriptor.
+ * @param   pvValue     The value.
+ */
+static void stamShmPrintSample(const char *pszName, PCSTAMSHMDESC pDesc, void const *pvValue)
+{
+    const char *pszUnit = stamShmUnit(pDesc->enmUnit);
+    switch (pDesc->enmType)
+    {
+        case STAMTYPE_COUNTER:
+            RTPrintf("%-48s %12RU64 %s\n", pszName, ((PCSTAMCOUNTER)pvValue)->c, pszUnit);
+            break;
+
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:
+        {
+            PCSTAMPROFILE  pProf = (PCSTAMPROFILE)pvValue;
+            uint64_t const u64   = pProf->cPeriods ? pProf->cPeriods : 1;
+            RTPrintf("%-48s %12RU64 %s (%12RU64 ticks, %7RU64 times, max %9RU64, min %7RI64)\n", pszName,
+                     pProf->cTicks / u64, pszUnit, pProf->cTicks, pProf->cPeriods, pProf->cTicksMax, pProf->cTicksMin);
+            break;
+        }
+
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMHISTOGRAM pHist  = (PCSTAMHISTOGRAM)pvValue;
+            uint64_t        cTotal = 0;
+            for (unsigned i = 0; i < STAMHISTOGRAM_BUCKETS; i++)
+                cTotal += pHist->acBuckets[i];
+            uint64_t const  u64    = pHist->Core.cPeriods ? pHist->Core.cPeriods : 1;
+            RTPrintf("%-48s %12RU64 %s (%7RU64 times, p50 %RU64, p90 %RU64, p99 %RU64, p99.9 %RU64, max %RU64)\n", pszName,
+                     pHist->Core.cTicks / u64, pszUnit, pHist->Core.cPeriods,
+                     stamShmHistogramPercentile(pHist->acBuckets, cTotal, 5000),
+                     stamShmHistogramPercentile(pHist->acBuckets, cTotal, 9000),
+                     stamShmHistogramPercentile(pHist->acBuckets, cTotal, 9900),
+                     stamShmHistogramPercentile(pHist->acBuckets, cTotal, 9990),
+                     pHist->Core.cTicksMax);
+            break;
+        }
+
+        case STAMTYPE_RATIO_U32:
+        case STAMTYPE_RATIO_U32_RESET:
+            RTPrintf("%-48s %8u:%-8u %s\n", pszName,
+                     ((PCSTAMRATIOU32)pvValue)->u32A, ((PCSTAMRATIOU32)pvValue)->u32B, pszUnit);
+            break;
+
+        case STAMTYPE_CALLBACK:
+            RTPrintf("%-48s %.*s %s\n", pszName, pDesc->cbValue, (const char *)pvValue, pszUnit);
+            break;
+
+        case STAMTYPE_U8:
+        case STAMTYPE_U8_RESET:
+            RTPrintf("%-48s %8u %s\n", pszName, *(uint8_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_X8:
+        case STAMTYPE_X8_RESET:
+            RTPrintf("%-48s %8x %s\n", pszName, *(uint8_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_U16:
+        case STAMTYPE_U16_RESET:
+            RTPrintf("%-48s %12u %s\n", pszName, *(uint16_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_X16:
+        case STAMTYPE_X16_RESET:
+            RTPrintf("%-48s %12x %s\n", pszName, *(uint16_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_U32:
+        case STAMTYPE_U32_RESET:
+            RTPrintf("%-48s %12u %s\n", pszName, *(uint32_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_X32:
+        case STAMTYPE_X32_RESET:
+            RTPrintf("%-48s %12x %s\n", pszName, *(uint32_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_U64:
+        case STAMTYPE_U64_RESET:
+            RTPrintf("%-48s %12RU64 %s\n", pszName, *(uint64_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_X64:
+        case STAMTYPE_X64_RESET:
+            RTPrintf("%-48s %12RX64 %s\n", pszName, *(uint64_t const *)pvValue, pszUnit);
+            break;
+        case STAMTYPE_BOOL:
+        case STAMTYPE_BOOL_RESET:
+            RTPrintf("%-48s %12s %s\n", pszName, *(uint8_t const *)pvValue ? "true" : "false", pszUnit);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Prints the change of one sample between two snapshots.
+ *
+ * Counters and profiles are shown as deltas and rates, the other types are
+ * only shown when they've changed.
+ *
+ * @param   pszName     The sample name.
+ * @param   pDesc       The descriptor.
+ * @param   pvOld       The old value.
+ * @param   pvNew       The new value.
+ * @param   cNsElapsed  The time between the two snapshots.
+ */
+static void stamShmPrintDiff(const char *pszName, PCSTAMSHMDESC pDesc, void const *pvOld, void const *pvNew, uint64_t cNsElapsed)
+{
+    const char *pszUnit = stamShmUnit(pDesc->enmUnit);
+    uint64_t const cNs  = cNsElapsed ? cNsElapsed : 1;
+    switch (pDesc->enmType)
+    {
+        case STAMTYPE_COUNTER:
+        {
+            uint64_t const cDelta = ((PCSTAMCOUNTER)pvNew)->c - ((PCSTAMCOUNTER)pvOld)->c;
+            if (cDelta)
+                RTPrintf("%-48s %+12RI64 %s (%RU64/s)\n", pszName, cDelta, pszUnit,
+                         ASMMultU64ByU32DivByU32(cDelta, RT_NS_1SEC, (uint32_t)RT_MIN(cNs, UINT32_MAX)));
+            break;
+        }
+
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMPROFILE  pOld     = (PCSTAMPROFILE)pvOld;
+            PCSTAMPROFILE  pNew     = (PCSTAMPROFILE)pvNew;
+            uint64_t const cPeriods = pNew->cPeriods - pOld->cPeriods;
+            uint64_t const cTicks   = pNew->cTicks   - pOld->cTicks;
+            if (cPeriods)
+                RTPrintf("%-48s %12RU64 %s (%+12RI64 ticks, %+7RI64 times, %RU64 times/s)\n", pszName,
+                         cTicks / cPeriods, pszUnit, cTicks, cPeriods,
+                         ASMMultU64ByU32DivByU32(cPeriods, RT_NS_1SEC, (uint32_t)RT_MIN(cNs, UINT32_MAX)));
+            break;
+        }
+
+        default:
+            if (memcmp(pvOld, pvNew, pDesc->cbValue))
+                stamShmPrintSample(pszName, pDesc, pvNew);
+            break;
+    }
+}
+
+
+/*********************************************************************************************************************************
+*   Commands                                                                                                                     *
+*********************************************************************************************************************************/
+
+/**
+ * Lists the export segments on the host (Linux only, others lack a way of
+ * enumerating POSIX shared memory objects).
+ */
+static RTEXITCODE stamShmCmdList(void)
+{
+#ifdef RT_OS_LINUX
+    RTDIR hDir;
+    int rc = RTDirOpenFiltered(&hDir, "/dev/shm" STAMSHM_NAME_PREFIX "*", RTDIRFILTER_WINNT, 0 /*fFlags*/);
+    if (RT_FAILURE(rc))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to open /dev/shm: %Rrc", rc);
+
+    RTPrintf("%-24s %8s %-32s %8s %8s %10s\n", "Segment", "PID", "VM", "Samples", "Interval", "Age");
+    RTDIRENTRY Entry;
+    while (RT_SUCCESS(RTDirRead(hDir, &Entry, NULL)))
+    {
+        char szName[64];
+        RTStrPrintf(szName, sizeof(szName), "/%s", Entry.szName);
+
+        STAMSHMREADER Reader;
+        rc = stamShmOpen(&Reader, szName);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("%-24s (%Rrc)\n", szName, rc);
+            continue;
+        }
+        PSTAMSHMHDR    pHdr  = (PSTAMSHMHDR)Reader.pbMap;
+        uint64_t const cNsTs = ASMAtomicUoReadU64(&pHdr->u64NanoTS);
+        uint64_t const cNow  = RTTimeNanoTS();
+        RTPrintf("%-24s %8u %-32.*s %8u %6ums %8RU64ms\n", szName, pHdr->uPid, (int)sizeof(pHdr->szVMName), pHdr->szVMName,
+                 pHdr->cDescs, pHdr->cMsInterval, cNow > cNsTs ? (cNow - cNsTs) / RT_NS_1MS : 0);
+        stamShmClose(&Reader);
+    }
+    RTDirClose(hDir);
+    return RTEXITCODE_SUCCESS;
+#else
+    return RTMsgErrorExit(RTEXITCODE_FAILURE, "Listing is not supported on this host, use --name");
+#endif
+}
+
+
+/**
+ * Dumps all matching samples.
+ */
+static RTEXITCODE stamShmCmdDump(PSTAMSHMREADER pReader)
+{
+    STAMSHMSNAPSHOT Snap = { NULL, 0, 0 };
+    int rc = stamShmSnapshot(pReader, &Snap);
+    if (RT_FAILURE(rc))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to read '%s': %Rrc", pReader->szName, rc);
+
+    uint32_t const cDescs = ((PCSTAMSHMHDR)Snap.pb)->cDescs;
+    for (uint32_t i = 0; i < cDescs; i++)
+    {
+        PCSTAMSHMDESC pDesc;
+        const char   *pszName;
+        void const   *pvValue = stamShmGetSample(&Snap, i, &pDesc, &pszName);
+        if (   pvValue
+            && stamShmIsValueSizeOk(pDesc)
+            && (!g_pszPattern || RTStrSimplePatternMultiMatch(g_pszPattern, RTSTR_MAX, pszName, RTSTR_MAX, NULL)))
+            stamShmPrintSample(pszName, pDesc, pvValue);
+    }
+    RTMemFree(Snap.pb);
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Prints the changes of the matching samples over one or more intervals.
+ */
+static RTEXITCODE stamShmCmdDiff(PSTAMSHMREADER pReader, uint32_t cMsInterval, uint32_t cIterations)
+{
+    STAMSHMSNAPSHOT aSnaps[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    unsigned        iOld      = 0;
+    RTEXITCODE      rcExit    = RTEXITCODE_SUCCESS;
+    int rc = stamShmSnapshot(pReader, &aSnaps[iOld]);
+    for (uint32_t iIteration = 0; RT_SUCCESS(rc) && (!cIterations || iIteration < cIterations); iIteration++)
+    {
+        RTThreadSleep(cMsInterval);
+
+        unsigned const iNew = iOld ^ 1;
+        rc = stamShmSnapshot(pReader, &aSnaps[iNew]);
+        if (RT_FAILURE(rc))
+            break;
+
+        PCSTAMSHMHDR pOldHdr = (PCSTAMSHMHDR)aSnaps[iOld].pb;
+        PCSTAMSHMHDR pNewHdr = (PCSTAMSHMHDR)aSnaps[iNew].pb;
+        if (pOldHdr->uLayoutGen != pNewHdr->uLayoutGen)
+            RTPrintf("--- layout changed, restarting ---\n");
+        else
+        {
+            RTPrintf("--- %RU64 ms ---\n", (pNewHdr->u64NanoTS - pOldHdr->u64NanoTS) / RT_NS_1MS);
+            for (uint32_t i = 0; i < pNewHdr->cDescs; i++)
+            {
+                PCSTAMSHMDESC pDesc, pDescOld;
+                const char   *pszName, *pszNameOld;
+                void const   *pvNew = stamShmGetSample(&aSnaps[iNew], i, &pDesc, &pszName);
+                void const   *pvOld = stamShmGetSample(&aSnaps[iOld], i, &pDescOld, &pszNameOld);
+                if (   pvNew
+                    && pvOld
+                    && pDesc->cbValue == pDescOld->cbValue
+                    && stamShmIsValueSizeOk(pDesc)
+                    && (!g_pszPattern || RTStrSimplePatternMultiMatch(g_pszPattern, RTSTR_MAX, pszName, RTSTR_MAX, NULL)))
+                    stamShmPrintDiff(pszName, pDesc, pvOld, pvNew, pNewHdr->u64NanoTS - pOldHdr->u64NanoTS);
+            }
+        }
+        iOld = iNew;
+    }
+    if (RT_FAILURE(rc))
+        rcExit = rc == VERR_INVALID_STATE
+               ? RTMsgErrorExit(RTEXITCODE_FAILURE, "The VM has terminated")
+               : RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to read '%s': %Rrc", pReader->szName, rc);
+    RTMemFree(aSnaps[0].pb);
+    RTMemFree(aSnaps[1].pb);
+    return rcExit;
+}
+
+
+static void stamShmUsage(const char *argv0)
+{
+    RTPrintf("Usage: %s list\n"
+             "   or: %s dump <--pid <pid>|--name <segment>> [--pattern <pat>]\n"
+             "   or: %s diff <--pid <pid>|--name <segment>> [--pattern <pat>] [--interval <ms>] [--count <n>]\n"
+             "\n"
+             "Reads the statistics a VM exports when /STAM/Export/Enabled is set.\n"
+             "Patterns are simple patterns separated by '|', like the VM takes.\n",
+             argv0, argv0, argv0);
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = RTR3InitExe(argc, &argv, 0);
+    if (RT_FAILURE(rc))
+        return RTMsgInitFailure(rc);
+
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--pid",          'p', RTGETOPT_REQ_UINT32 },
+        { "--name",         'n', RTGETOPT_REQ_STRING },
+        { "--pattern",      'P', RTGETOPT_REQ_STRING },
+        { "--interval",     'i', RTGETOPT_REQ_UINT32 },
+        { "--count",        'c', RTGETOPT_REQ_UINT32 },
+    };
+
+    const char *pszCmd      = NULL;
+    char        szName[64]  = "";
+    uint32_t    cMsInterval = RT_MS_1SEC;
+    uint32_t    cIterations = 1;
+
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /* fFlags */);
+    while ((rc = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (rc)
+        {
+            case 'p':
+                RTStrPrintf(szName, sizeof(szName), STAMSHM_NAME_PREFIX "%u", ValueUnion.u32);
+                break;
+
+            case 'n':
+                if (ValueUnion.psz[0] == '/')
+                    rc = RTStrCopy(szName, sizeof(szName), ValueUnion.psz);
+                else
+                    rc = RTStrPrintf(szName, sizeof(szName), "/%s", ValueUnion.psz) < sizeof(szName) - 1
+                       ? VINF_SUCCESS : VERR_BUFFER_OVERFLOW;
+                if (RT_FAILURE(rc))
+                    return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Segment name is too long: %s", ValueUnion.psz);
+                break;
+
+            case 'P':
+                g_pszPattern = ValueUnion.psz;
+                break;
+
+            case 'i':
+                cMsInterval = RT_MAX(ValueUnion.u32, 1);
+                break;
+
+            case 'c':
+                cIterations = ValueUnion.u32;
+                break;
+
+            case VINF_GETOPT_NOT_OPTION:
+                if (pszCmd)
+                    return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Unexpected argument: %s", ValueUnion.psz);
+                pszCmd = ValueUnion.psz;
+                break;
+
+            case 'h':
+                stamShmUsage(RTProcShortName());
+                return RTEXITCODE_SUCCESS;
+
+            case 'V':
+                RTPrintf("%sr%s\n", RTBldCfgVersion(), RTBldCfgRevisionStr());
+                return RTEXITCODE_SUCCESS;
+
+            default:
+                return RTGetOptPrintError(rc, &ValueUnion);
+        }
+    }
+
+    if (!pszCmd)
+    {
+        stamShmUsage(RTProcShortName());
+        return RTEXITCODE_SYNTAX;
+    }
+    if (!strcmp(pszCmd, "list"))
+        return stamShmCmdList();
+
+    bool const fDump = !strcmp(pszCmd, "dump");
+    if (!fDump && strcmp(pszCmd, "diff"))
+        return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Unknown command: %s", pszCmd);
+    if (!szName[0])
+        return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Either --pid or --name is required");
+
+    STAMSHMREADER Reader;
+    rc = stamShmOpen(&Reader, szName);
+    if (RT_FAILURE(rc))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to open '%s': %Rrc", szName, rc);
+    RTEXITCODE rcExit = fDump ? stamShmCmdDump(&Reader) : stamShmCmdDiff(&Reader, cMsInterval, cIterations);
+    stamShmClose(&Reader);
+    return rcExit;
+}
+
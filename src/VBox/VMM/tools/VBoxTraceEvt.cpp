@@ -0,0 +1,617 @@
+/* $Id$ */
+/** @file
+ * VBoxTraceEvt - Reads binary event trace files written by DBGFR3TraceEvtDump.
+ */
+
+/*
+ * Copyright (C) 2006-2017 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/dbgftrace.h>
+#include <VBox/err.h>
+
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/buildconfig.h>
+#include <iprt/file.h>
+#include <iprt/getopt.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/message.h>
+#include <iprt/process.h>
+#include <iprt/sort.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A loaded trace file.
+ */
+typedef struct TRACEEVTFILE
+{
+    /** The file content. */
+    uint8_t                    *pbFile;
+    /** The file size. */
+    size_t                      cbFile;
+    /** The header. */
+    DBGFTRACEEVTFILEHDR const  *pHdr;
+    /** The name table. */
+    DBGFTRACEEVTFILENAME const *paNames;
+    /** Per VCPU section headers, cCpus entries. */
+    DBGFTRACEEVTFILECPU const **papCpus;
+    /** Per VCPU records, cCpus entries. */
+    PCDBGFTRACEEVTREC          *papaRecs;
+    /** The TSC of the oldest record in the file, used as time zero. */
+    uint64_t                    uTscFirst;
+    /** The TSC of the newest record in the file. */
+    uint64_t                    uTscLast;
+} TRACEEVTFILE;
+/** Pointer to a loaded trace file. */
+typedef TRACEEVTFILE *PTRACEEVTFILE;
+
+/**
+ * Exit histogram entry.
+ */
+typedef struct TRACEEVTEXITSTAT
+{
+    /** The EMEXIT_MAKE_FT() flags and type. */
+    uint64_t            uKey;
+    /** Number of exits. */
+    uint64_t            cExits;
+    /** Total ticks spent handling them. */
+    uint64_t            cTicksTotal;
+    /** Max ticks spent handling one. */
+    uint64_t            cTicksMax;
+} TRACEEVTEXITSTAT;
+/** Pointer to an exit histogram entry. */
+typedef TRACEEVTEXITSTAT *PTRACEEVTEXITSTAT;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** Event type names, indexed by DBGFTRACEEVTTYPE. */
+static const char * const g_apszTypeNames[DBGFTRACEEVTTYPE_END] =
+{
+    "invalid", "exit", "ioport-read", "ioport-write", "mmio-read", "mmio-write", "irq", "halt", "pdmq-flush"
+};
+
+/** Only consider records from this VCPU (--cpu), UINT32_MAX for all. */
+static uint32_t     g_idCpu    = UINT32_MAX;
+/** Only consider records of these types (--type), bitmap of DBGFTRACEEVTTYPE. */
+static uint32_t     g_fTypes   = UINT32_MAX;
+/** Only consider records starting at or after this time (--from), in
+ *  microseconds relative to the first record. */
+static uint64_t     g_cUsFrom  = 0;
+/** Only consider records starting before this time (--to), in microseconds
+ *  relative to the first record. */
+static uint64_t     g_cUsTo    = UINT64_MAX;
+
+
+/**
+ * Converts host TSC ticks to nanoseconds.
+ */
+static uint64_t traceEvtTicksToNs(PTRACEEVTFILE pFile, uint64_t cTicks)
+{
+    uint64_t const uHz = pFile->pHdr->u64TscHz;
+    if (!uHz)
+        return cTicks;
+    return cTicks / uHz * RT_NS_1SEC_64 + cTicks % uHz * RT_NS_1SEC_64 / uHz;
+}
+
+
+/**
+ * Looks up the name of something recorded by key.
+ *
+ * @returns Name if found, NULL if not.
+ */
+static const char *traceEvtLookupName(PTRACEEVTFILE pFile, DBGFTRACEEVTTYPE enmType, uint64_t uKey)
+{
+    for (uint32_t i = 0; i < pFile->pHdr->cNames; i++)
+        if (pFile->paNames[i].uKey == uKey && pFile->paNames[i].enmType == (uint8_t)enmType)
+            return pFile->paNames[i].szName;
+    return NULL;
+}
+
+
+/**
+ * Loads and validates a trace file.
+ *
+ * @returns Exit code, RTEXITCODE_SUCCESS on success (message displayed on
+ *          failure).
+ */
+static RTEXITCODE traceEvtLoad(PTRACEEVTFILE pFile, const char *pszFilename)
+{
+    RT_ZERO(*pFile);
+    void  *pvFile;
+    size_t cbFile;
+    int rc = RTFileReadAll(pszFilename, &pvFile, &cbFile);
+    if (RT_FAILURE(rc))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to read '%s': %Rrc", pszFilename, rc);
+    pFile->pbFile = (uint8_t *)pvFile;
+    pFile->cbFile = cbFile;
+
+    DBGFTRACEEVTFILEHDR const *pHdr = (DBGFTRACEEVTFILEHDR const *)pvFile;
+    if (   cbFile < sizeof(*pHdr)
+        || pHdr->u32Magic != DBGFTRACEEVTFILEHDR_MAGIC)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "'%s' is not a binary event trace file", pszFilename);
+    if (   pHdr->u32Version != DBGFTRACEEVTFILEHDR_VERSION
+        || pHdr->cbHdr      <  sizeof(*pHdr)
+        || pHdr->cbHdr      >  cbFile
+        || pHdr->cbRec      != sizeof(DBGFTRACEEVTREC)
+        || pHdr->cCpus      == 0
+        || pHdr->cCpus      >  _4K)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "'%s': unsupported version %u or bad header (cbHdr=%u cbRec=%u cCpus=%u)",
+                              pszFilename, pHdr->u32Version, pHdr->cbHdr, pHdr->cbRec, pHdr->cCpus);
+    pFile->pHdr = pHdr;
+
+    size_t off = pHdr->cbHdr;
+    if ((cbFile - off) / sizeof(DBGFTRACEEVTFILENAME) < pHdr->cNames)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "'%s' is truncated (name table)", pszFilename);
+    pFile->paNames = (DBGFTRACEEVTFILENAME const *)&pFile->pbFile[off];
+    off += pHdr->cNames * sizeof(DBGFTRACEEVTFILENAME);
+
+    pFile->papCpus  = (DBGFTRACEEVTFILECPU const **)RTMemAllocZ(pHdr->cCpus * sizeof(pFile->papCpus[0]));
+    pFile->papaRecs = (PCDBGFTRACEEVTREC *)RTMemAllocZ(pHdr->cCpus * sizeof(pFile->papaRecs[0]));
+    if (!pFile->papCpus || !pFile->papaRecs)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Out of memory");
+
+    pFile->uTscFirst = UINT64_MAX;
+    pFile->uTscLast  = 0;
+    for (uint32_t iCpu = 0; iCpu < pHdr->cCpus; iCpu++)
+    {
+        if (cbFile - off < sizeof(DBGFTRACEEVTFILECPU))
+            return RTMsgErrorExit(RTEXITCODE_FAILURE, "'%s' is truncated (VCPU #%u header)", pszFilename, iCpu);
+        DBGFTRACEEVTFILECPU const *pCpu = (DBGFTRACEEVTFILECPU const *)&pFile->pbFile[off];
+        off += sizeof(*pCpu);
+        if ((cbFile - off) / sizeof(DBGFTRACEEVTREC) < pCpu->cRecs)
+            return RTMsgErrorExit(RTEXITCODE_FAILURE, "'%s' is truncated (VCPU #%u records)", pszFilename, iCpu);
+        pFile->papCpus[iCpu]  = pCpu;
+        pFile->papaRecs[iCpu] = (PCDBGFTRACEEVTREC)&pFile->pbFile[off];
+        off += pCpu->cRecs * sizeof(DBGFTRACEEVTREC);
+
+        if (pCpu->cRecs)
+        {
+            pFile->uTscFirst = RT_MIN(pFile->uTscFirst, pFile->papaRecs[iCpu][0].uTsc);
+            pFile->uTscLast  = RT_MAX(pFile->uTscLast,  pFile->papaRecs[iCpu][pCpu->cRecs - 1].uTsc);
+        }
+    }
+    if (pFile->uTscFirst == UINT64_MAX)
+        pFile->uTscFirst = pFile->uTscLast = pHdr->uTscDump;
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Frees the resources associated with a loaded trace file.
+ */
+static void traceEvtUnload(PTRACEEVTFILE pFile)
+{
+    RTMemFree(pFile->papaRecs);
+    RTMemFree(pFile->papCpus);
+    RTFileReadAllFree(pFile->pbFile, pFile->cbFile);
+    RT_ZERO(*pFile);
+}
+
+
+/**
+ * Checks whether a record passes the --cpu, --type, --from and --to filters.
+ */
+static bool traceEvtIsIncluded(PTRACEEVTFILE pFile, uint32_t idCpu, PCDBGFTRACEEVTREC pRec)
+{
+    if (g_idCpu != UINT32_MAX && g_idCpu != idCpu)
+        return false;
+    if (pRec->enmType >= 32 || !(g_fTypes & RT_BIT_32(pRec->enmType)))
+        return false;
+    if (g_cUsFrom != 0 || g_cUsTo != UINT64_MAX)
+    {
+        uint64_t const cUs = pRec->uTsc > pFile->uTscFirst
+                           ? traceEvtTicksToNs(pFile, pRec->uTsc - pFile->uTscFirst) / RT_NS_1US : 0;
+        if (cUs < g_cUsFrom || cUs >= g_cUsTo)
+            return false;
+    }
+    return true;
+}
+
+
+/**
+ * The 'info' command: Displays the header and per VCPU summary.
+ */
+static RTEXITCODE traceEvtCmdInfo(PTRACEEVTFILE pFile)
+{
+    DBGFTRACEEVTFILEHDR const *pHdr = pFile->pHdr;
+    RTTIMESPEC  Dump;
+    char        szTime[64];
+    RTTimeSpecToString(RTTimeSpecSetNano(&Dump, pHdr->i64UnixNsDump), szTime, sizeof(szTime));
+    RTPrintf("Dumped:      %s\n"
+             "TSC rate:    %'RU64 Hz\n"
+             "VCPUs:       %u\n"
+             "Names:       %u\n"
+             "Time span:   %'RU64 us\n",
+             szTime, pHdr->u64TscHz, pHdr->cCpus, pHdr->cNames,
+             traceEvtTicksToNs(pFile, pFile->uTscLast - pFile->uTscFirst) / RT_NS_1US);
+
+    uint64_t acTypes[DBGFTRACEEVTTYPE_END] = { 0 };
+    for (uint32_t iCpu = 0; iCpu < pHdr->cCpus; iCpu++)
+    {
+        DBGFTRACEEVTFILECPU const *pCpu = pFile->papCpus[iCpu];
+        RTPrintf("VCPU %-4u    %'10u records, %'RU64 lost to wrap-around\n", pCpu->idCpu, pCpu->cRecs, pCpu->cLost);
+        for (uint32_t i = 0; i < pCpu->cRecs; i++)
+        {
+            PCDBGFTRACEEVTREC pRec = &pFile->papaRecs[iCpu][i];
+            if (pRec->enmType < DBGFTRACEEVTTYPE_END && traceEvtIsIncluded(pFile, pCpu->idCpu, pRec))
+                acTypes[pRec->enmType]++;
+        }
+    }
+
+    for (unsigned i = DBGFTRACEEVTTYPE_INVALID + 1; i < DBGFTRACEEVTTYPE_END; i++)
+        if (acTypes[i])
+            RTPrintf("%-12s %'12RU64\n", g_apszTypeNames[i], acTypes[i]);
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Compares two exit histogram entries by total time, descending.
+ */
+static DECLCALLBACK(int) traceEvtCompareExitStats(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    RT_NOREF(pvUser);
+    PTRACEEVTEXITSTAT pStat1 = (PTRACEEVTEXITSTAT)pvElement1;
+    PTRACEEVTEXITSTAT pStat2 = (PTRACEEVTEXITSTAT)pvElement2;
+    if (pStat1->cTicksTotal != pStat2->cTicksTotal)
+        return pStat1->cTicksTotal > pStat2->cTicksTotal ? -1 : 1;
+    return pStat1->cExits > pStat2->cExits ? -1 : pStat1->cExits < pStat2->cExits;
+}
+
+
+/**
+ * The 'hist' command: Exit reason histogram and exit duration distribution.
+ */
+static RTEXITCODE traceEvtCmdHist(PTRACEEVTFILE pFile)
+{
+    /*
+     * Gather.
+     */
+    PTRACEEVTEXITSTAT paStats = NULL;
+    uint32_t          cStats  = 0;
+    uint64_t          cExits  = 0;
+    uint64_t          cTicks  = 0;
+    uint64_t          acBuckets[24] = { 0 }; /* [0] is < 1us, [i] is [2^(i-1), 2^i) us, the last one catches everything above. */
+    for (uint32_t iCpu = 0; iCpu < pFile->pHdr->cCpus; iCpu++)
+    {
+        DBGFTRACEEVTFILECPU const *pCpu = pFile->papCpus[iCpu];
+        for (uint32_t i = 0; i < pCpu->cRecs; i++)
+        {
+            PCDBGFTRACEEVTREC pRec = &pFile->papaRecs[iCpu][i];
+            if (   pRec->enmType != DBGFTRACEEVTTYPE_EXIT
+                || !traceEvtIsIncluded(pFile, pCpu->idCpu, pRec))
+                continue;
+
+            uint32_t iStat = 0;
+            while (iStat < cStats && paStats[iStat].uKey != pRec->u64Arg0)
+                iStat++;
+            if (iStat == cStats)
+            {
+                if (!(cStats % 64))
+                {
+                    void *pvNew = RTMemRealloc(paStats, (cStats + 64) * sizeof(paStats[0]));
+                    if (!pvNew)
+                    {
+                        RTMemFree(paStats);
+                        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Out of memory");
+                    }
+                    paStats = (PTRACEEVTEXITSTAT)pvNew;
+                }
+                RT_ZERO(paStats[iStat]);
+                paStats[iStat].uKey = pRec->u64Arg0;
+                cStats++;
+            }
+            paStats[iStat].cExits++;
+            paStats[iStat].cTicksTotal += pRec->cTicks;
+            paStats[iStat].cTicksMax    = RT_MAX(paStats[iStat].cTicksMax, pRec->cTicks);
+            cExits++;
+            cTicks += pRec->cTicks;
+
+            uint64_t const cUs     = traceEvtTicksToNs(pFile, pRec->cTicks) / RT_NS_1US;
+            unsigned const iBucket = cUs ? ASMBitLastSetU64(cUs) : 0;
+            acBuckets[RT_MIN(iBucket, RT_ELEMENTS(acBuckets) - 1)]++;
+        }
+    }
+    if (!cExits)
+    {
+        RTPrintf("No exit records (was the 'exit' category enabled?)\n");
+        return RTEXITCODE_SUCCESS;
+    }
+
+    /*
+     * Display.
+     */
+    RTSortShell(paStats, cStats, sizeof(paStats[0]), traceEvtCompareExitStats, NULL);
+    RTPrintf("%-32s %12s %6s %14s %10s %10s\n", "Exit", "Count", "%", "Total us", "Avg ns", "Max us");
+    for (uint32_t i = 0; i < cStats; i++)
+    {
+        char        szFallback[32];
+        const char *pszName = traceEvtLookupName(pFile, DBGFTRACEEVTTYPE_EXIT, paStats[i].uKey);
+        if (!pszName)
+        {
+            RTStrPrintf(szFallback, sizeof(szFallback), "exit-%#RX64", paStats[i].uKey);
+            pszName = szFallback;
+        }
+        RTPrintf("%-32s %'12RU64 %3RU64.%RU64 %'14RU64 %'10RU64 %'10RU64\n",
+                 pszName, paStats[i].cExits,
+                 paStats[i].cExits * 100 / cExits, paStats[i].cExits * 1000 / cExits % 10,
+                 traceEvtTicksToNs(pFile, paStats[i].cTicksTotal) / RT_NS_1US,
+                 traceEvtTicksToNs(pFile, paStats[i].cTicksTotal) / paStats[i].cExits,
+                 traceEvtTicksToNs(pFile, paStats[i].cTicksMax) / RT_NS_1US);
+    }
+    RTPrintf("%-32s %'12RU64 %6s %'14RU64 %'10RU64\n", "Total", cExits, "100.0",
+             traceEvtTicksToNs(pFile, cTicks) / RT_NS_1US, traceEvtTicksToNs(pFile, cTicks) / cExits);
+
+    RTPrintf("\nExit handling time distribution:\n");
+    unsigned iLast = RT_ELEMENTS(acBuckets) - 1;
+    while (iLast > 0 && !acBuckets[iLast])
+        iLast--;
+    for (unsigned i = 0; i <= iLast; i++)
+    {
+        char szRange[32];
+        if (i == 0)
+            RTStrPrintf(szRange, sizeof(szRange), "< 1 us");
+        else if (i == RT_ELEMENTS(acBuckets) - 1)
+            RTStrPrintf(szRange, sizeof(szRange), ">= %'RU64 us", RT_BIT_64(i - 1));
+        else
+            RTStrPrintf(szRange, sizeof(szRange), "%'RU64 - %'RU64 us", RT_BIT_64(i - 1), RT_BIT_64(i) - 1);
+        unsigned const cStars = (unsigned)(acBuckets[i] * 50 / cExits);
+        RTPrintf("%20s %'12RU64 %.*s\n", szRange, acBuckets[i], cStars, "**************************************************");
+    }
+
+    RTMemFree(paStats);
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Formats the type specific part of a record for the timeline.
+ */
+static void traceEvtFormatDetails(PTRACEEVTFILE pFile, PCDBGFTRACEEVTREC pRec, char *pszBuf, size_t cbBuf)
+{
+    const char *pszName;
+    switch (pRec->enmType)
+    {
+        case DBGFTRACEEVTTYPE_EXIT:
+            pszName = traceEvtLookupName(pFile, DBGFTRACEEVTTYPE_EXIT, pRec->u64Arg0);
+            if (pszName)
+                RTStrPrintf(pszBuf, cbBuf, "%s rc=%d", pszName, (int32_t)pRec->u64Arg1);
+            else
+                RTStrPrintf(pszBuf, cbBuf, "exit-%#RX64 rc=%d", pRec->u64Arg0, (int32_t)pRec->u64Arg1);
+            break;
+
+        case DBGFTRACEEVTTYPE_IOPORT_READ:
+        case DBGFTRACEEVTTYPE_IOPORT_WRITE:
+            RTStrPrintf(pszBuf, cbBuf, "port=%#06x cb=%u value=%#RX64 rc=%d",
+                        pRec->u16Arg, pRec->bArg, pRec->u64Arg0, (int32_t)pRec->u64Arg1);
+            break;
+
+        case DBGFTRACEEVTTYPE_MMIO_READ:
+        case DBGFTRACEEVTTYPE_MMIO_WRITE:
+            RTStrPrintf(pszBuf, cbBuf, "GCPhys=%RX64 cb=%u value=%#RX64", pRec->u64Arg0, pRec->bArg, pRec->u64Arg1);
+            break;
+
+        case DBGFTRACEEVTTYPE_IRQ:
+            RTStrPrintf(pszBuf, cbBuf, "%s vector=%#04x tag=%#RX64", pRec->bArg ? "pic" : "apic", pRec->u16Arg, pRec->u64Arg0);
+            break;
+
+        case DBGFTRACEEVTTYPE_HALT:
+            RTStrPrintf(pszBuf, cbBuf, "rc=%d", (int32_t)pRec->u64Arg1);
+            break;
+
+        case DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH:
+            pszName = traceEvtLookupName(pFile, DBGFTRACEEVTTYPE_PDM_QUEUE_FLUSH, pRec->u64Arg0);
+            if (pszName)
+                RTStrPrintf(pszBuf, cbBuf, "%s", pszName);
+            else
+                RTStrPrintf(pszBuf, cbBuf, "queue-%RX64", pRec->u64Arg0);
+            break;
+
+        default:
+            RTStrPrintf(pszBuf, cbBuf, "bArg=%#x u16Arg=%#x u64Arg0=%#RX64 u64Arg1=%#RX64",
+                        pRec->bArg, pRec->u16Arg, pRec->u64Arg0, pRec->u64Arg1);
+            break;
+    }
+}
+
+
+/**
+ * The 'timeline' command: All records merged in chronological order.
+ */
+static RTEXITCODE traceEvtCmdTimeline(PTRACEEVTFILE pFile)
+{
+    uint32_t const cCpus   = pFile->pHdr->cCpus;
+    uint32_t      *paiNext = (uint32_t *)RTMemAllocZ(cCpus * sizeof(paiNext[0]));
+    if (!paiNext)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Out of memory");
+
+    RTPrintf("%16s %4s %-12s %12s  %s\n", "Time us", "CPU", "Event", "Duration ns", "Details");
+    for (;;)
+    {
+        /* Pick the oldest pending record; the VCPU count is small enough for a linear scan. */
+        uint32_t iCpuMin = UINT32_MAX;
+        uint64_t uTscMin = UINT64_MAX;
+        for (uint32_t iCpu = 0; iCpu < cCpus; iCpu++)
+            if (   paiNext[iCpu] < pFile->papCpus[iCpu]->cRecs
+                && pFile->papaRecs[iCpu][paiNext[iCpu]].uTsc < uTscMin)
+            {
+                iCpuMin = iCpu;
+                uTscMin = pFile->papaRecs[iCpu][paiNext[iCpu]].uTsc;
+            }
+        if (iCpuMin == UINT32_MAX)
+            break;
+
+        PCDBGFTRACEEVTREC pRec  = &pFile->papaRecs[iCpuMin][paiNext[iCpuMin]++];
+        uint32_t const    idCpu = pFile->papCpus[iCpuMin]->idCpu;
+        if (!traceEvtIsIncluded(pFile, idCpu, pRec))
+            continue;
+
+        char szDetails[128];
+        traceEvtFormatDetails(pFile, pRec, szDetails, sizeof(szDetails));
+        uint64_t const cNs = pRec->uTsc > pFile->uTscFirst ? traceEvtTicksToNs(pFile, pRec->uTsc - pFile->uTscFirst) : 0;
+        RTPrintf("%'12RU64.%03u %4u %-12s %'12RU64  %s\n",
+                 cNs / RT_NS_1US, (unsigned)(cNs % RT_NS_1US), idCpu,
+                 pRec->enmType < DBGFTRACEEVTTYPE_END ? g_apszTypeNames[pRec->enmType] : "unknown",
+                 traceEvtTicksToNs(pFile, pRec->cTicks), szDetails);
+    }
+
+    RTMemFree(paiNext);
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Parses a --type argument, a comma separated list of event type names.
+ */
+static int traceEvtParseTypes(const char *pszTypes, uint32_t *pfTypes)
+{
+    uint32_t fTypes = 0;
+    while (*pszTypes)
+    {
+        const char  *pszComma = strchr(pszTypes, ',');
+        size_t const cch      = pszComma ? (size_t)(pszComma - pszTypes) : strlen(pszTypes);
+        unsigned     i        = DBGFTRACEEVTTYPE_INVALID + 1;
+        while (   i < DBGFTRACEEVTTYPE_END
+               && (strlen(g_apszTypeNames[i]) != cch || strncmp(g_apszTypeNames[i], pszTypes, cch)))
+            i++;
+        if (i >= DBGFTRACEEVTTYPE_END)
+            return VERR_NOT_FOUND;
+        fTypes |= RT_BIT_32(i);
+        pszTypes += cch + (pszComma != NULL);
+    }
+    *pfTypes = fTypes;
+    return VINF_SUCCESS;
+}
+
+
+static void traceEvtUsage(const char *argv0)
+{
+    RTPrintf("Usage: %s info     <file> [filters]\n"
+             "   or: %s hist     <file> [filters]\n"
+             "   or: %s timeline <file> [filters]\n"
+             "\n"
+             "Reads binary event trace files written by DBGFR3TraceEvtDump (debugger\n"
+             "command '.traceevtdump').\n"
+             "\n"
+             "Filters:\n"
+             "  --cpu <id>         Only records from the given VCPU.\n"
+             "  --type <t1,t2,..>  Only records of the given types:\n"
+             "                     exit, ioport-read, ioport-write, mmio-read, mmio-write,\n"
+             "                     irq, halt, pdmq-flush.\n"
+             "  --from <us>        Only records at or after this time, relative to the\n"
+             "                     first record in the file.\n"
+             "  --to <us>          Only records before this time.\n",
+             argv0, argv0, argv0);
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = RTR3InitExe(argc, &argv, 0);
+    if (RT_FAILURE(rc))
+        return RTMsgInitFailure(rc);
+
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--cpu",          'c', RTGETOPT_REQ_UINT32 },
+        { "--type",         't', RTGETOPT_REQ_STRING },
+        { "--from",         'f', RTGETOPT_REQ_UINT64 },
+        { "--to",           'T', RTGETOPT_REQ_UINT64 },
+    };
+
+    const char *pszCmd      = NULL;
+    const char *pszFilename = NULL;
+
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /* fFlags */);
+    while ((rc = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (rc)
+        {
+            case 'c':
+                g_idCpu = ValueUnion.u32;
+                break;
+
+            case 't':
+                rc = traceEvtParseTypes(ValueUnion.psz, &g_fTypes);
+                if (RT_FAILURE(rc))
+                    return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Unknown event type in: %s", ValueUnion.psz);
+                break;
+
+            case 'f':
+                g_cUsFrom = ValueUnion.u64;
+                break;
+
+            case 'T':
+                g_cUsTo = ValueUnion.u64;
+                break;
+
+            case VINF_GETOPT_NOT_OPTION:
+                if (!pszCmd)
+                    pszCmd = ValueUnion.psz;
+                else if (!pszFilename)
+                    pszFilename = ValueUnion.psz;
+                else
+                    return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Unexpected argument: %s", ValueUnion.psz);
+                break;
+
+            case 'h':
+                traceEvtUsage(RTProcShortName());
+                return RTEXITCODE_SUCCESS;
+
+            case 'V':
+                RTPrintf("%sr%s\n", RTBldCfgVersion(), RTBldCfgRevisionStr());
+                return RTEXITCODE_SUCCESS;
+
+            default:
+                return RTGetOptPrintError(rc, &ValueUnion);
+        }
+    }
+
+    if (!pszCmd || !pszFilename)
+    {
+        traceEvtUsage(RTProcShortName());
+        return RTEXITCODE_SYNTAX;
+    }
+
+    RTEXITCODE (*pfnCmd)(PTRACEEVTFILE pFile);
+    if (!strcmp(pszCmd, "info"))
+        pfnCmd = traceEvtCmdInfo;
+    else if (!strcmp(pszCmd, "hist"))
+        pfnCmd = traceEvtCmdHist;
+    else if (!strcmp(pszCmd, "timeline"))
+        pfnCmd = traceEvtCmdTimeline;
+    else
+        return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Unknown command: %s", pszCmd);
+
+    TRACEEVTFILE File;
+    RTEXITCODE rcExit = traceEvtLoad(&File, pszFilename);
+    if (rcExit == RTEXITCODE_SUCCESS)
+        rcExit = pfnCmd(&File);
+    traceEvtUnload(&File);
+    return rcExit;
+}
+